@@ -29,6 +29,7 @@
 
 #include <CommonLibs/Logger.h>
 #include <CommonLibs/MemoryLeak.h>
+#include <CommonLibs/Stats.h>
 #include <Control/TransactionTable.h>
 #include <Globals/Globals.h>
 #include <UMTS/UMTSConfig.h>
@@ -45,6 +46,7 @@ using namespace CommandLine;
 namespace UMTS {
 extern CommandLine::CLIStatus rrcTest(int argc, char **argv, std::ostream &os);
 extern CommandLine::CLIStatus rlcTest(int argc, char **argv, std::ostream &os);
+extern CommandLine::CLIStatus asnCaptureCLI(int argc, char **argv, std::ostream &os);
 }; // namespace UMTS
 namespace SGSN {
 // Hack.
@@ -1255,8 +1257,16 @@ static CLIStatus freqcorr(int argc, char **argv, ostream &os)
 	return SUCCESS;
 }
 
+/** Print the memory use stats, or set how often call sites are sampled. */
 static CLIStatus memStat(int argc, char **argv, ostream &os)
 {
+	if (argc == 3 && strcmp(argv[1], "sample") == 0) {
+		gMemStats.sampleRate(atoi(argv[2]));
+		os << "sampling one in " << gMemStats.sampleRate() << " allocations, 0 for none" << endl;
+		return SUCCESS;
+	}
+	if (argc != 1)
+		return BAD_NUM_ARGS;
 	gMemStats.text(os);
 	return SUCCESS;
 }
@@ -1270,33 +1280,19 @@ static CLIStatus crashme(int argc, char **argv, ostream &os)
 	return FAILURE;
 }
 
-/* TODO : stats CLI
-static CLIStatus stats(int argc, char** argv, ostream& os)
+/** Print or clear the performance counters. */
+static CLIStatus stats(int argc, char **argv, ostream &os)
 {
-
-	char cmd[200];
-	if (argc==2) {
-		if (strcmp(argv[1],"clear")==0) {
-				gReports.clear();
-				os << "stats table (gReporting) cleared" << endl;
-				return SUCCESS;
-		}
-		sprintf(cmd,"sqlite3 %s 'select name||\": \"||value||\" events over \"||((%lu-clearedtime)/60)||\"
-minutes\" from reporting where name like \"%%%s%%\";'", gConfig.getStr("Control.Reporting.StatsTable").c_str(),
-time(NULL), argv[1]);
-	}
-	else if (argc==1)
-		sprintf(cmd,"sqlite3 %s 'select name||\": \"||value||\" events over \"||((%lu-clearedtime)/60)||\"
-minutes\" from reporting;'", gConfig.getStr("Control.Reporting.StatsTable").c_str(), time(NULL)); else return
-BAD_NUM_ARGS; FILE *result = popen(cmd,"r"); char *line = (char*)malloc(200); while (!feof(result)) { if (!fgets(line,
-200, result)) break; os << line;
+	if (argc > 2)
+		return BAD_NUM_ARGS;
+	if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+		statsClear();
+		os << "stats cleared" << endl;
+		return SUCCESS;
 	}
-	free(line);
-	os << endl;
-	pclose(result);
+	statsText(os, argc == 2 ? argv[1] : NULL);
 	return SUCCESS;
 }
-*/
 
 //@} // CLI commands
 
@@ -1341,11 +1337,16 @@ void Parser::addCommands()
 	addCommand("notices", notices, "-- show startup copyright and legal notices");
 	addCommand("sgsn", SGSN::sgsnCLI, "SGSN mode sub-command.  Type: sgsn help for more");
 	addCommand("crashme", crashme, "force crash of OpenBTS for testing purposes");
-	// addCommand("stats", stats,"[patt] OR clear -- print all, or selected, performance counters, OR clear all
-	// counters");
+	addCommand("stats", stats,
+		"[patt] OR clear -- print all, or selected, performance counters, OR clear all counters");
 	addCommand("rlctest", UMTS::rlcTest, "-- internal testing commands for UMTS");
 	addCommand("rrctest", UMTS::rrcTest, "-- internal testing commands for UMTS");
-	addCommand("memstat", memStat, "-- internal testing command: print memory use stats");
+	addCommand("memstat", memStat,
+		"[] OR [sample N] -- internal testing command: print memory use stats, OR attribute one in N allocations "
+		"to their call sites, 0 to stop");
+	addCommand("asncapture", UMTS::asnCaptureCLI,
+		"[] OR [clear] OR [dump file] -- show, clear or save the raw RRC messages kept while "
+		"UMTS.Debug.ASN.Capture is set");
 }
 
 }; // namespace CommandLine
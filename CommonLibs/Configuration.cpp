@@ -58,7 +58,9 @@ float ConfigurationRecord::floatNumber() const
  */
 
 ConfigurationTable::ConfigurationTable(const char *filename, const char *wCmdName, ConfigurationKeyMap wSchema)
+	: mSnapshot(NULL), mGeneration(0), mPhase(0), mStopping(false)
 {
+	mReaders[0] = mReaders[1] = 0;
 	gLogEarly(LOG_INFO, "opening configuration table from path %s", filename);
 
 	// (pat) When I used malloc here, sqlite3 sporadically crashes.
@@ -141,6 +143,13 @@ ConfigurationTable::ConfigurationTable(const char *filename, const char *wCmdNam
 	// Init the cross checking callback to something predictable
 	mCrossCheck = NULL;
 
+	// Readers only load the snapshot pointer, so there must be one before anybody reads.
+	// From here on the refresher thread rebuilds it when it expires.
+	mLock.lock();
+	refreshSnapshot();
+	mLock.unlock();
+	mRefresher.start((void *(*)(void *))refreshLoopAdapter, (void *)this);
+
 #define DUMP_CONFIGURATION_TABLE 0
 #if DUMP_CONFIGURATION_TABLE
 	// (pat) Dump any non-default config variables...
@@ -177,6 +186,23 @@ ConfigurationTable::ConfigurationTable(const char *filename, const char *wCmdNam
 #endif
 }
 
+ConfigurationTable::~ConfigurationTable()
+{
+	mLock.lock();
+	mStopping = true;
+	mRefreshSignal.signal();
+	mLock.unlock();
+	mRefresher.join();
+
+	delete mSnapshot;
+	while (!mRetired.empty()) {
+		delete mRetired.front().second;
+		mRetired.pop_front();
+	}
+	if (mDB)
+		sqlite3_close(mDB);
+}
+
 string ConfigurationTable::getDefaultSQL(const std::string &program, const std::string &version)
 {
 	stringstream ss;
@@ -309,7 +335,6 @@ string ConfigurationTable::getTeX(const std::string &program, const std::string
 bool ConfigurationTable::defines(const string &key)
 {
 	try {
-		ScopedLock lock(mLock);
 		return lookup(key).defined();
 	} catch (ConfigurationTableKeyNotFound) {
 		// TODO: re-enable once we figure out why this message is being sent to syslog regardless of log level
@@ -598,45 +623,112 @@ ConfigurationKeyMap ConfigurationTable::getSimilarKeys(const std::string &snippe
 	return tmp;
 }
 
-const ConfigurationRecord &ConfigurationTable::lookup(const string &key)
+ConfigurationRecord ConfigurationTable::lookup(const string &key)
 {
 	assert(mDB);
 
-	checkCacheAge();
-	// We assume the caller holds mLock.
-	// So it is OK to return a reference into the cache.
-
-	// Check the cache.
-	// This is cheap.
-	ConfigurationMap::const_iterator where = mCache.find(key);
-	if (where != mCache.end()) {
-		if (where->second.defined())
-			return where->second;
+	// No lock needed; the snapshot is immutable and held until the record is copied out.
+	ConfigurationSnapshotRef snap(*this);
+	const ConfigurationRecord *rec = snap->find(key);
+	if (!rec)
 		throw ConfigurationTableKeyNotFound(key);
+	return *rec;
+}
+
+const ConfigurationSnapshot *ConfigurationTable::refreshSnapshot()
+{
+	// We assume the caller holds mLock, so set() and remove() are not in the middle of a write.
+	assert(mDB);
+
+	ConfigurationSnapshot *snap = mSnapshot;
+	if (snap && !snap->expired())
+		return snap;
+
+	// A purge() from here on marks the snapshot stale again, so it is not lost in the rebuild.
+	if (snap)
+		__atomic_store_n(&snap->mStale, 0, __ATOMIC_RELAXED);
+	ConfigurationSnapshot *next = buildSnapshot();
+	if (snap && next->mValues == snap->mValues) {
+		// Nothing changed; keep the generation so that ConfigHandles and templates keep their cached values.
+		__atomic_store_n(&snap->mBuilt, next->mBuilt, __ATOMIC_RELAXED);
+		delete next;
+		reclaim();
+	} else {
+		next->mGeneration = ++mGeneration;
+		if (snap && __atomic_load_n(&snap->mStale, __ATOMIC_RELAXED))
+			next->mStale = 1;
+		publishSnapshot(next);
+		snap = next;
 	}
 
-	// Check the database.
-	// This is more expensive.
-	char *value = NULL;
+	return snap;
+}
+
+void ConfigurationTable::refreshLoop()
+{
+	// Wake up often enough to pick up a purge() or another process's changes within a second or so.
+	ScopedLock lock(mLock);
+	while (!mStopping) {
+		refreshSnapshot();
+		mRefreshSignal.wait(mLock, 1000);
+	}
+}
 
-	sqlite3_single_lookup(mDB, "CONFIG", "KEYSTRING", key.c_str(), "VALUESTRING", value);
+ConfigurationSnapshot *ConfigurationTable::buildSnapshot()
+{
+	// We assume the caller holds mLock.  The caller assigns the generation.
+	ConfigurationSnapshot *snap = new ConfigurationSnapshot(0, time(NULL));
 
-	// value found, cache the result
-	if (value) {
-		mCache[key] = ConfigurationRecord(value);
-		// key definition found, cache the default
-	} else if (keyDefinedInSchema(key)) {
-		mCache[key] = ConfigurationRecord(mSchema[key].getDefaultValue());
-		// total miss, cache the error
-	} else {
-		mCache[key] = ConfigurationRecord(false);
-		throw ConfigurationTableKeyNotFound(key);
+	// Start with the schema defaults, then overlay whatever is in the database.
+	// A NULL value in the database falls back to the default, as it always has.
+	for (ConfigurationKeyMap::const_iterator it = mSchema.begin(); it != mSchema.end(); ++it) {
+		snap->mValues[it->first] = ConfigurationRecord(it->second.getDefaultValue());
+	}
+	ConfigurationRecordMap pairs = getAllPairs();
+	for (ConfigurationRecordMap::const_iterator it = pairs.begin(); it != pairs.end(); ++it) {
+		if (it->second.defined())
+			snap->mValues[it->first] = it->second;
 	}
+	return snap;
+}
+
+void ConfigurationTable::publishSnapshot(ConfigurationSnapshot *snap)
+{
+	// We assume the caller holds mLock.
+	ConfigurationSnapshot *old = mSnapshot;
+	__atomic_store_n(&mSnapshot, snap, __ATOMIC_SEQ_CST);
+
+	// A reader that can still see the old snapshot entered in this phase or an earlier one.
+	if (old)
+		mRetired.push_back(std::make_pair(__atomic_load_n(&mPhase, __ATOMIC_SEQ_CST), old));
+	reclaim();
+}
 
-	free(value);
+void ConfigurationTable::publishChanged(ConfigurationSnapshot *snap)
+{
+	// We assume the caller holds mLock.
+	if (snap->mValues == mSnapshot->mValues) {
+		delete snap;
+		return;
+	}
+	snap->mGeneration = ++mGeneration;
+	publishSnapshot(snap);
+}
 
-	// Leave mLock locked.  The caller holds it still.
-	return mCache[key];
+void ConfigurationTable::reclaim()
+{
+	// We assume the caller holds mLock.
+	// The phase moves on only when nobody is left from the one before it, so two steps past the phase a
+	// snapshot was replaced in, every reader that could have loaded it is gone.
+	for (int step = 0; step < 2; step++) {
+		if (__atomic_load_n(&mReaders[(mPhase + 1) & 1], __ATOMIC_SEQ_CST))
+			break;
+		__atomic_add_fetch(&mPhase, 1, __ATOMIC_SEQ_CST);
+	}
+	while (!mRetired.empty() && mPhase - mRetired.front().first >= 2) {
+		delete mRetired.front().second;
+		mRetired.pop_front();
+	}
 }
 
 bool ConfigurationTable::isStatic(const string &key)
@@ -650,9 +742,7 @@ bool ConfigurationTable::isStatic(const string &key)
 
 string ConfigurationTable::getStr(const string &key)
 {
-	// We need the lock because rec is a reference into the cache.
 	try {
-		ScopedLock lock(mLock);
 		return lookup(key).value();
 	} catch (ConfigurationTableKeyNotFound) {
 		// Raise an alert and re-throw the exception.
@@ -674,9 +764,7 @@ bool ConfigurationTable::getBool(const string &key)
 
 long ConfigurationTable::getNum(const string &key)
 {
-	// We need the lock because rec is a reference into the cache.
 	try {
-		ScopedLock lock(mLock);
 		return lookup(key).number();
 	} catch (ConfigurationTableKeyNotFound) {
 		// Raise an alert and re-throw the exception.
@@ -688,7 +776,6 @@ long ConfigurationTable::getNum(const string &key)
 float ConfigurationTable::getFloat(const string &key)
 {
 	try {
-		ScopedLock lock(mLock);
 		return lookup(key).floatNumber();
 	} catch (ConfigurationTableKeyNotFound) {
 		// Raise an alert and re-throw the exception.
@@ -702,7 +789,6 @@ std::vector<string> ConfigurationTable::getVectorOfStrings(const string &key)
 	// Look up the string.
 	char *line = NULL;
 	try {
-		ScopedLock lock(mLock);
 		const ConfigurationRecord &rec = lookup(key);
 		line = strdup(rec.value().c_str());
 	} catch (ConfigurationTableKeyNotFound) {
@@ -743,7 +829,6 @@ std::vector<unsigned> ConfigurationTable::getVector(const string &key)
 	// Look up the string.
 	char *line = NULL;
 	try {
-		ScopedLock lock(mLock);
 		const ConfigurationRecord &rec = lookup(key);
 		line = strdup(rec.value().c_str());
 	} catch (ConfigurationTableKeyNotFound) {
@@ -775,13 +860,21 @@ bool ConfigurationTable::remove(const string &key)
 	assert(mDB);
 
 	ScopedLock lock(mLock);
-	// Clear the cache entry and the database.
-	ConfigurationMap::iterator where = mCache.find(key);
-	if (where != mCache.end())
-		mCache.erase(where);
+	// Publish a snapshot without the key first, so an update hook that reads it back sees the change.
+	ConfigurationSnapshot *next = new ConfigurationSnapshot(*refreshSnapshot());
+	if (keyDefinedInSchema(key))
+		next->mValues[key] = ConfigurationRecord(mSchema[key].getDefaultValue());
+	else
+		next->mValues.erase(key);
+	publishChanged(next);
 	// Really remove it.
 	string cmd = "DELETE FROM CONFIG WHERE KEYSTRING=='" + key + "'";
-	return sqlite3_command(mDB, cmd.c_str());
+	bool success = sqlite3_command(mDB, cmd.c_str());
+	if (!success) {
+		purge();
+		refreshSnapshot();
+	}
+	return success;
 }
 
 void ConfigurationTable::find(const string &pat, ostream &os) const
@@ -866,11 +959,18 @@ bool ConfigurationTable::set(const string &key, const string &value)
 		      key + "\",\"" + value + "\",1)";
 	}
 
+	// Publish the new value first, so an update hook that reads it back sees the change.
+	ConfigurationSnapshot *next = new ConfigurationSnapshot(*refreshSnapshot());
+	next->mValues[key] = ConfigurationRecord(value);
+	publishChanged(next);
+
 	bool success = sqlite3_command(mDB, cmd.c_str());
 
-	// Cache the result.
-	if (success)
-		mCache[key] = ConfigurationRecord(value);
+	// On failure go back to whatever the database says.
+	if (!success) {
+		purge();
+		refreshSnapshot();
+	}
 
 	return success;
 }
@@ -884,37 +984,21 @@ bool ConfigurationTable::set(const string &key, long value)
 
 void ConfigurationTable::checkCacheAge()
 {
-	// mLock is set by caller
-	static time_t timeOfLastPurge = 0;
-
-	time_t now = time(NULL);
-
-	// purge every 3 seconds
-	// purge period cannot be configuration parameter
-	if ((now - timeOfLastPurge) < 3)
-		return;
-
-	timeOfLastPurge = now;
-
-	// this is purge() without the lock
-	ConfigurationMap::iterator mp;
-	for (mp = mCache.begin(); mp != mCache.end(); /* nop */) {
-		ConfigurationMap::iterator prev = mp;
-		mp++;
-		mCache.erase(prev);
-	}
+	// The refresher thread tracks the snapshot's age; this just does its work now instead of on its next tick.
+	ScopedLock lock(mLock);
+	refreshSnapshot();
 }
 
 void ConfigurationTable::purge()
 {
-	ScopedLock lock(mLock);
-
-	ConfigurationMap::iterator mp;
-	for (mp = mCache.begin(); mp != mCache.end(); /* nop */) {
-		ConfigurationMap::iterator prev = mp;
-		mp++;
-		mCache.erase(prev);
-	}
+	// Do not take mLock or touch the database; this is called from the sqlite update hook.
+	unsigned phase = enterReader();
+	ConfigurationSnapshot *snap = __atomic_load_n(&mSnapshot, __ATOMIC_ACQUIRE);
+	if (snap)
+		__atomic_store_n(&snap->mStale, 1, __ATOMIC_RELAXED);
+	leaveReader(phase);
+	// Signalling without holding mLock is allowed; the refresher rebuilds once the writer lets go of mLock.
+	mRefreshSignal.signal();
 }
 
 void ConfigurationTable::setUpdateHook(void (*func)(void *, int, char const *, char const *, sqlite3_int64))
@@ -26,8 +26,10 @@
 #include <regex.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <iostream>
+#include <list>
 #include <map>
 #include <sstream>
 #include <string>
@@ -78,8 +80,43 @@ public:
 	bool defined() const { return mDefined; }
 
 	float floatNumber() const;
+
+	bool operator==(const ConfigurationRecord &other) const
+	{
+		return mDefined == other.mDefined && mValue == other.mValue;
+	}
+
+	/** Convert the value to one of the types supported by ConfigHandle. */
+	template <class T>
+	T as() const;
 };
 
+template <>
+inline long ConfigurationRecord::as<long>() const
+{
+	return mNumber;
+}
+template <>
+inline int ConfigurationRecord::as<int>() const
+{
+	return (int)mNumber;
+}
+template <>
+inline unsigned ConfigurationRecord::as<unsigned>() const
+{
+	return (unsigned)mNumber;
+}
+template <>
+inline bool ConfigurationRecord::as<bool>() const
+{
+	return mNumber != 0;
+}
+template <>
+inline float ConfigurationRecord::as<float>() const
+{
+	return floatNumber();
+}
+
 /** A string class that uses a hash function for comparison. */
 class HashString : public std::string {
 
@@ -124,18 +161,74 @@ class ConfigurationKey;
 typedef std::map<std::string, ConfigurationKey> ConfigurationKeyMap;
 ConfigurationKeyMap getConfigurationKeys();
 
+/**
+	An immutable copy of every defined configuration value.
+	The ConfigurationTable publishes a new snapshot whenever the database changes
+	and readers pick up the current one with a single atomic pointer load.
+	Undefined keys are simply absent.
+*/
+class ConfigurationSnapshot {
+
+	friend class ConfigurationTable;
+
+private:
+	ConfigurationRecordMap mValues; ///< key -> value, including schema defaults
+	unsigned mGeneration;		///< increases by one for each snapshot with different values
+	time_t mBuilt;			///< when the values were last read from the database, read without a lock
+	mutable int mStale;		///< set by purge(), read without a lock
+
+public:
+	/** Snapshots older than this are re-read from the database to pick up changes made by other processes. */
+	static const time_t sMaxAge = 3;
+
+	ConfigurationSnapshot(unsigned wGeneration, time_t wBuilt) : mGeneration(wGeneration), mBuilt(wBuilt), mStale(0)
+	{
+	}
+
+	/** Return the record for key, or NULL if key is not defined. */
+	const ConfigurationRecord *find(const std::string &key) const
+	{
+		ConfigurationRecordMap::const_iterator where = mValues.find(key);
+		return where == mValues.end() ? NULL : &where->second;
+	}
+
+	unsigned generation() const { return mGeneration; }
+
+	/** True if this snapshot should be replaced before it is used again. */
+	bool expired() const
+	{
+		return __atomic_load_n(&mStale, __ATOMIC_RELAXED) ||
+		       time(NULL) - __atomic_load_n(&mBuilt, __ATOMIC_RELAXED) >= sMaxAge;
+	}
+
+	const ConfigurationRecordMap &values() const { return mValues; }
+};
+
 /**
 	A class for maintaining a configuration key-value table,
-	based on sqlite3 and a local map-based cache.
+	based on sqlite3 and an immutable snapshot of the whole table.
 	Thread-safe, too.
+	Readers never take mLock or touch the database; they just load the snapshot pointer.
+	set() and remove() publish their changes themselves, and mRefresher rebuilds a snapshot that has expired.
+	Readers go through a ConfigurationSnapshotRef, which counts them by phase, and a replaced snapshot
+	is freed only after every reader of the phase it was replaced in, and of the phases before, is gone.
 */
 class ConfigurationTable {
 
+	friend class ConfigurationSnapshotRef;
+
 private:
-	sqlite3 *mDB;						      ///< database connection
-	ConfigurationMap mCache;				      ///< cache of recently access configuration values
-	mutable Mutex mLock;					      ///< control for multithreaded access to the cache
-	std::vector<std::string> (*mCrossCheck)(const std::string &); ///< cross check callback pointer
+	sqlite3 *mDB;							   ///< database connection
+	ConfigurationSnapshot *mSnapshot;				   ///< current snapshot, published atomically
+	unsigned mGeneration;						   ///< generation of the last snapshot published
+	unsigned mPhase;						   ///< advanced by reclaim() once the readers before it are gone
+	int mReaders[2];						   ///< readers that entered in an even or an odd phase
+	std::list<std::pair<unsigned, ConfigurationSnapshot *>> mRetired; ///< replaced snapshots and the phase they were replaced in
+	mutable Mutex mLock;						   ///< control for multithreaded snapshot rebuilds
+	Signal mRefreshSignal;						   ///< wakes mRefresher after purge() or on shutdown
+	bool mStopping;							   ///< tells mRefresher to exit, under mLock
+	Thread mRefresher;						   ///< rebuilds expired snapshots
+	std::vector<std::string> (*mCrossCheck)(const std::string &);	   ///< cross check callback pointer
 
 public:
 	ConfigurationKeyMap mSchema; ///< definition of configuration default values and validation logic
@@ -145,6 +238,9 @@ public:
 	ConfigurationTable(const char *filename = ":memory:", const char *wCmdName = 0,
 		ConfigurationKeyMap wSchema = ConfigurationKeyMap());
 
+	/** Nobody may be using the table, or hold a ConfigurationSnapshotRef to it, by now. */
+	~ConfigurationTable();
+
 	/** Generate an up-to-date example sql file for new installs. */
 	std::string getDefaultSQL(const std::string &program, const std::string &version);
 
@@ -244,16 +340,95 @@ public:
 	/** purege cache if it exceeds a certain age */
 	void checkCacheAge();
 
-	/** Delete all records from the cache. */
+	/**
+		Mark the current snapshot out of date and wake the refresher thread to rebuild it.
+		This does not touch the database, so it is safe to call from the sqlite update hook.
+	*/
 	void purge();
 
 private:
 	/**
-		Attempt to lookup a record, cache if needed.
+		Return the current snapshot, which may be up to a refresh period out of date.
+		The caller must have entered as a reader; the pointer stays valid until it leaves.
+	*/
+	const ConfigurationSnapshot *snapshot()
+	{
+		const ConfigurationSnapshot *snap = __atomic_load_n(&mSnapshot, __ATOMIC_ACQUIRE);
+		assert(snap);
+		return snap;
+	}
+
+	/** Count the caller as a reader and return the phase to hand back to leaveReader(). */
+	unsigned enterReader()
+	{
+		while (true) {
+			unsigned phase = __atomic_load_n(&mPhase, __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&mReaders[phase & 1], 1, __ATOMIC_SEQ_CST);
+			// If the phase moved on meanwhile, reclaim() may not have seen us; count again in the new one.
+			if (__atomic_load_n(&mPhase, __ATOMIC_SEQ_CST) == phase)
+				return phase;
+			__atomic_sub_fetch(&mReaders[phase & 1], 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	void leaveReader(unsigned phase) { __atomic_sub_fetch(&mReaders[phase & 1], 1, __ATOMIC_SEQ_CST); }
+
+	/**
+		Attempt to lookup a record in the current snapshot.
 		Throw ConfigurationTableKeyNotFound if not found.
-		Caller should hold mLock because the returned reference points into the cache.
 	*/
-	const ConfigurationRecord &lookup(const std::string &key);
+	ConfigurationRecord lookup(const std::string &key);
+
+	/** Rebuild the snapshot if it has expired and return the current one.  Caller holds mLock. */
+	const ConfigurationSnapshot *refreshSnapshot();
+
+	/** Body of mRefresher: keep the snapshot fresh until the table is destroyed. */
+	void refreshLoop();
+
+	static void *refreshLoopAdapter(ConfigurationTable *table)
+	{
+		table->refreshLoop();
+		return NULL;
+	}
+
+	/** Read the database and schema into a new snapshot.  Caller holds mLock. */
+	ConfigurationSnapshot *buildSnapshot();
+
+	/** Make snap the current snapshot and retire the old one.  Caller holds mLock. */
+	void publishSnapshot(ConfigurationSnapshot *snap);
+
+	/** Publish snap as a new generation if its values differ from the current ones, else free it.  Caller holds mLock. */
+	void publishChanged(ConfigurationSnapshot *snap);
+
+	/** Free the retired snapshots no reader can still see.  Caller holds mLock. */
+	void reclaim();
+};
+
+/**
+	The current snapshot of a table, held for as long as this is in scope.
+	Keep it short-lived; while it exists, no snapshot replaced after it was taken is freed.
+*/
+class ConfigurationSnapshotRef {
+
+private:
+	ConfigurationTable &mTable;
+	unsigned mPhase;
+	const ConfigurationSnapshot *mSnapshot;
+
+	ConfigurationSnapshotRef(const ConfigurationSnapshotRef &);
+	ConfigurationSnapshotRef &operator=(const ConfigurationSnapshotRef &);
+
+public:
+	ConfigurationSnapshotRef(ConfigurationTable &wTable) : mTable(wTable)
+	{
+		mPhase = mTable.enterReader();
+		mSnapshot = mTable.snapshot();
+	}
+
+	~ConfigurationSnapshotRef() { mTable.leaveReader(mPhase); }
+
+	const ConfigurationSnapshot *operator->() const { return mSnapshot; }
+	const ConfigurationSnapshot &operator*() const { return *mSnapshot; }
 };
 
 typedef std::map<HashString, std::string> HashStringMap;
@@ -366,4 +541,50 @@ static inline ConfigurationTable &getConfig(void)
 
 #define gConfig getConfig()
 
+/**
+	A typed handle on one configuration key, for code that reads the same key over and over.
+	The value is converted once per snapshot generation, so in the steady state get() costs
+	one atomic load and a compare instead of a locked map lookup.
+	T may be long, int, unsigned, bool or float.
+	Handles may be static; they resolve against gConfig on first use.
+	While a new snapshot is being published a concurrent get() may still return the previous value.
+*/
+template <class T>
+class ConfigHandle {
+
+private:
+	std::string mKey;
+	mutable unsigned mGeneration; ///< generation mValue was taken from; 0 means not resolved yet
+	mutable T mValue;
+	mutable bool mDefined;
+
+public:
+	ConfigHandle(const char *wKey) : mKey(wKey), mGeneration(0), mValue(T()), mDefined(false) {}
+
+	/**
+		Get the value.
+		Throw ConfigurationTableKeyNotFound if the key is not defined.
+	*/
+	T get() const
+	{
+		ConfigurationSnapshotRef snap(gConfig);
+		if (__atomic_load_n(&mGeneration, __ATOMIC_ACQUIRE) != snap->generation()) {
+			const ConfigurationRecord *rec = snap->find(mKey);
+			T val = rec ? rec->as<T>() : T();
+			__atomic_store(&mValue, &val, __ATOMIC_RELAXED);
+			__atomic_store_n(&mDefined, rec != NULL, __ATOMIC_RELAXED);
+			__atomic_store_n(&mGeneration, snap->generation(), __ATOMIC_RELEASE);
+		}
+		if (!__atomic_load_n(&mDefined, __ATOMIC_RELAXED))
+			throw ConfigurationTableKeyNotFound(mKey);
+		T val;
+		__atomic_load(&mValue, &val, __ATOMIC_RELAXED);
+		return val;
+	}
+
+	operator T() const { return get(); }
+
+	const std::string &key() const { return mKey; }
+};
+
 #endif
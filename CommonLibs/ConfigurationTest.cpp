@@ -28,6 +28,7 @@
 #include <string>
 
 #include "Configuration.h"
+#include "Utils.h"
 
 using namespace std;
 
@@ -107,6 +108,41 @@ int main(int argc, char *argv[])
 		cout << "ConfigurationTableKeyNotFound exception successfully caught." << endl;
 	}
 
+	// Typed handles follow set() and remove() through the snapshot generation.
+	ConfigHandle<int> numHandle("numnumber");
+	ConfigHandle<bool> boolHandle("booltest");
+	unsigned generation = ConfigurationSnapshotRef(gConfig)->generation();
+	cout << "handle numnumber " << numHandle.get() << " gen " << generation << endl;
+	// A rebuild that reads back the same values keeps the generation.
+	gConfig.purge();
+	cout << "rebuilt, gen " << (ConfigurationSnapshotRef(gConfig)->generation() == generation ? "unchanged" : "CHANGED")
+	     << endl;
+	gConfig.set("numnumber", 17);
+	gConfig.set("booltest", 1);
+	cout << "handle numnumber " << numHandle.get() << " booltest " << boolHandle.get() << endl;
+	gConfig.remove("numnumber");
+	cout << "handle numnumber " << numHandle.get() << " (default)" << endl;
+	try {
+		ConfigHandle<long> missing("supposedtoabort");
+		missing.get();
+	} catch (ConfigurationTableKeyNotFound) {
+		cout << "ConfigHandle exception successfully caught." << endl;
+	}
+
+	const unsigned reads = 10000000;
+	long sum = 0;
+	double start = timef();
+	for (unsigned i = 0; i < reads; i++)
+		sum += gConfig.getNum("numnumber");
+	double getNumTime = timef() - start;
+	start = timef();
+	for (unsigned i = 0; i < reads; i++)
+		sum += numHandle.get();
+	double handleTime = timef() - start;
+	cout << format("getNum %.1f ns/read, ConfigHandle %.1f ns/read", 1e9 * getNumTime / reads,
+			1e9 * handleTime / reads)
+	     << (sum ? "" : " ") << endl;
+
 	delete gConfigObject;
 
 	return 0;
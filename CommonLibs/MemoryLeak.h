@@ -15,7 +15,8 @@
 #ifndef _MEMORYLEAK_
 #define _MEMORYLEAK_ 1
 
-#include <map>
+#include <ostream>
+#include <stdint.h>
 
 #include "Logger.h"
 #include "ScalarTypes.h"
@@ -27,6 +28,24 @@
 
 namespace Utils {
 
+struct MemSite;
+
+/*
+	Counts of live and total objects of each checked class, for the memstat command.
+
+	The checked classes include Vector, BitVector, ByteVector and signalVector, so the counts are bumped from
+	every thread on nearly every allocation.  Each thread counts into its own shard, a cache line aligned block
+	only that thread writes, so a count is a plain load and store with no locked instruction and no shared
+	line; the reader adds up the shards.  An object freed on another thread than the one that made it shows as
+	a delete in one shard and a new in the other, which cancel in the sum.  When a thread exits its shard goes
+	on a free list, counts and all, for the next thread to take over, so there are never more shards than
+	threads alive at once and nothing counted is lost.  Everything here is zero initialized, so objects
+	constructed before gMemStats itself are counted too.
+
+	Attribution to call sites, via RN_MEMLOG, is sampled: off by default, or one in N allocations when the
+	sample rate is set with "memstat sample N".  Sampled objects carry a pointer to their call site and
+	decrement it when destroyed.
+*/
 struct MemStats {
 	// Enumerates the classes that are checked.
 	// Redundancies are ok, for example, we check BitVector and also
@@ -59,36 +78,100 @@ struct MemStats {
 		// Must be last:
 		mMax,
 	};
-	int mMemTotal[mMax]; // In elements, not bytes.
-	int mMemNow[mMax];
-	const char *mMemName[mMax];
-	MemStats();
-	void memChkNew(MemoryNames memIndex, const char *id);
-	void memChkDel(MemoryNames memIndex, const char *id);
+
+	struct Shard {
+		int64_t mNew[mMax]; // In elements, not bytes.
+		int64_t mDel[mMax];
+		Shard *mNext;	  ///< Every shard ever made; shards are never freed.
+		Shard *mNextFree; ///< Free list link, under the shard lock.
+	} __attribute__((aligned(64)));
+
+	Shard *mShards;		    ///< Pushed with a release store under the shard lock, read without it.
+	const char *mMemName[mMax]; ///< Set by the first new of each class.
+	int mSampleRate;	    ///< Sample one in this many RN_MEMLOG calls, 0 for none.
+	MemSite *mSites;	    ///< Call sites seen while sampling; never unlinked.
+
+	inline void memChkNew(MemoryNames memIndex, const char *id);
+	inline void memChkDel(MemoryNames memIndex, const char *id);
+	/** Live and total objects of a class, summed over the shards. */
+	int64_t now(MemoryNames memIndex) const;
+	int64_t total(MemoryNames memIndex) const;
 	void text(std::ostream &os);
-	// We would prefer to use an unordered_map, but that requires special compile switches.
-	// What a super great language.
-	typedef std::map<std::string, Int_z> MemMapType;
-	MemMapType mMemMap;
+	/** Sample one in rate RN_MEMLOG calls, or none if 0; call sites already sampled keep their counts. */
+	void sampleRate(int rate) { __atomic_store_n(&mSampleRate, rate < 0 ? 0 : rate, __ATOMIC_RELAXED); }
+	int sampleRate() const { return __atomic_load_n(&mSampleRate, __ATOMIC_RELAXED); }
+
+	/** Take a free shard, or make one, for this thread. */
+	static Shard *acquireShard();
 };
 extern struct MemStats gMemStats;
 
+/** This thread's shard, or NULL until its first count. */
+extern __thread MemStats::Shard *gMemShard;
+/** RN_MEMLOG calls left before this thread samples one. */
+extern __thread int gMemSampleCountdown;
+
+// Only this thread writes its shard, so the increments need not be atomic, but the stores are, for the reader.
+inline void MemStats::memChkNew(MemoryNames memIndex, const char *id)
+{
+	Shard *shard = gMemShard ? gMemShard : acquireShard();
+	__atomic_store_n(&shard->mNew[memIndex], shard->mNew[memIndex] + 1, __ATOMIC_RELAXED);
+	if (!__atomic_load_n(&mMemName[memIndex], __ATOMIC_RELAXED)) {
+		__atomic_store_n(&mMemName[memIndex], id, __ATOMIC_RELAXED);
+	}
+}
+
+inline void MemStats::memChkDel(MemoryNames memIndex, const char *id)
+{
+	Shard *shard = gMemShard ? gMemShard : acquireShard();
+	__atomic_store_n(&shard->mDel[memIndex], shard->mDel[memIndex] + 1, __ATOMIC_RELAXED);
+}
+
+/** Whether this RN_MEMLOG call is sampled. */
+inline bool memSample()
+{
+	int rate = gMemStats.sampleRate();
+	if (!rate || --gMemSampleCountdown > 0) {
+		return false;
+	}
+	gMemSampleCountdown = rate;
+	return true;
+}
+
+/** One RN_MEMLOG call site, registered the first time it is sampled. */
+struct MemSite {
+	const char *mType;
+	const char *mFile;
+	int mLine;
+	int64_t mLive;	  ///< Sampled objects from here not yet destroyed.
+	int64_t mSampled; ///< Sampled objects from here ever.
+	MemSite *mNext;
+
+	MemSite(const char *wType, const char *wFile, int wLine);
+	void add()
+	{
+		__atomic_fetch_add(&mLive, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&mSampled, 1, __ATOMIC_RELAXED);
+	}
+	void remove() { __atomic_fetch_sub(&mLive, 1, __ATOMIC_RELAXED); }
+};
+
 // This is a memory leak detector.
 // Use by putting RN_MEMCHKNEW and RN_MEMCHKDEL in class constructors/destructors,
 // or use the DEFINE_MEMORY_LEAK_DETECTOR class and add the defined class
 // as an ancestor to the class to be memory leak checked.
 
 struct MemLabel {
-	std::string mccKey;
+	MemSite *mccSite; ///< Where this object was made, if it was sampled.
+
+	MemLabel() : mccSite(NULL) {}
+	// A copy was not made at the original's call site, and an assignment does not move the object.
+	MemLabel(const MemLabel &) : mccSite(NULL) {}
+	MemLabel &operator=(const MemLabel &) { return *this; }
 	virtual ~MemLabel()
 	{
-		// During startup there are constructor races where static instances of other classes (BitVector)
-		// are inited before MemoryLeak.  Such instances have an mccKey of "".  I have only seen that happen
-		// during an exit() call, which doesnt matter much, but lets be neat and prevent a crash.
-		if (mccKey == "")
-			return;
-		Int_z &tmp = Utils::gMemStats.mMemMap[mccKey];
-		tmp = tmp - 1;
+		if (mccSite)
+			mccSite->remove();
 	}
 };
 
@@ -112,15 +195,18 @@ struct MemLabel {
 
 #define RN_MEMLOG(type, ptr) \
 	{ \
-		static std::string key = format("%s_%s:%d", #type, __FILE__, __LINE__); \
-		(ptr)->/* MemCheck##type:: */ mccKey = key; \
-		Utils::gMemStats.mMemMap[key]++; \
+		if (Utils::memSample() && !(ptr)->mccSite) { \
+			static Utils::MemSite site(#type, __FILE__, __LINE__); \
+			(ptr)->/* MemCheck##type:: */ mccSite = &site; \
+			site.add(); \
+		} \
 	}
 
 // TODO: The above assumes that checkclass is MemCheck ## subClass
 #define DEFINE_MEMORY_LEAK_DETECTOR_CLASS(subClass, checkerClass) \
 	struct checkerClass : public virtual Utils::MemLabel { \
 		checkerClass() { RN_MEMCHKNEW(subClass); } \
+		checkerClass(const checkerClass &) : Utils::MemLabel() { RN_MEMCHKNEW(subClass); } \
 		virtual ~checkerClass() { RN_MEMCHKDEL(subClass); } \
 	};
 
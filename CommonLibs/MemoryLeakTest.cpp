@@ -0,0 +1,252 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the memory accounting stays exact with objects made and freed on many threads, including threads that
+// come and go, check call site sampling, and time a count against the shared counters it replaced.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "ByteVector.h"
+#include "Configuration.h"
+#include "Interthread.h"
+#include "MemoryLeak.h"
+#include "Stats.h"
+#include "Threads.h"
+#include "Vector.h"
+
+using namespace std;
+using namespace Utils;
+
+ConfigurationTable *gConfigObject;
+
+static const unsigned sThreads = 8;
+static const unsigned sPerThread = 200000;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static unsigned shardCount()
+{
+	unsigned n = 0;
+	for (const MemStats::Shard *s = gMemStats.mShards; s; s = s->mNext) {
+		n++;
+	}
+	return n;
+}
+
+// Make and free vectors, keeping a few alive at a time as the radio threads do.
+static void *churn(void *)
+{
+	Vector<int> *live[16] = {NULL};
+	for (unsigned i = 0; i < sPerThread; i++) {
+		delete live[i % 16];
+		live[i % 16] = new Vector<int>(8);
+	}
+	for (unsigned i = 0; i < 16; i++) {
+		delete live[i];
+	}
+	return NULL;
+}
+
+static void testThreads()
+{
+	int64_t now = gMemStats.now(MemStats::mVector), total = gMemStats.total(MemStats::mVector);
+	Thread threads[sThreads];
+	for (unsigned t = 0; t < sThreads; t++) {
+		threads[t].start(churn, NULL);
+	}
+	for (unsigned t = 0; t < sThreads; t++) {
+		threads[t].join();
+	}
+	check("every thread counted", gMemStats.total(MemStats::mVector) - total == sThreads * sPerThread);
+	check("nothing left alive", gMemStats.now(MemStats::mVector) == now);
+}
+
+// Objects handed from one thread to another to free, as bursts go from the modem to the FEC threads.
+static InterthreadQueue<Vector<int> > sHandoff;
+
+static void *make(void *)
+{
+	for (unsigned i = 0; i < sPerThread; i++) {
+		sHandoff.write(new Vector<int>(8));
+	}
+	return NULL;
+}
+
+static void *consume(void *)
+{
+	for (unsigned i = 0; i < sPerThread; i++) {
+		delete sHandoff.read();
+	}
+	return NULL;
+}
+
+static void testHandoff()
+{
+	int64_t now = gMemStats.now(MemStats::mVector);
+	Thread maker, consumer;
+	maker.start(make, NULL);
+	consumer.start(consume, NULL);
+	maker.join();
+	consumer.join();
+	check("freed on another thread", gMemStats.now(MemStats::mVector) == now);
+}
+
+static void *once(void *)
+{
+	Vector<int> v(8);
+	return NULL;
+}
+
+static void testShortThreads()
+{
+	unsigned shards = shardCount();
+	int64_t total = gMemStats.total(MemStats::mVector);
+	for (unsigned t = 0; t < 200; t++) {
+		Thread thread;
+		thread.start(once, NULL);
+		thread.join();
+	}
+	check("short lived threads reuse shards", shardCount() <= shards + 1);
+	check("and their counts are kept", gMemStats.total(MemStats::mVector) - total == 200);
+}
+
+static void testCopies()
+{
+	int64_t now = gMemStats.now(MemStats::mByteVector);
+	{
+		ByteVector a(10);
+		ByteVector b(a);
+		ByteVector c(b);
+		c = a;
+	}
+	check("copies counted", gMemStats.now(MemStats::mByteVector) == now);
+}
+
+static ByteVector *logged(unsigned i)
+{
+	ByteVector *v = new ByteVector(i % 100 + 1);
+	RN_MEMLOG(ByteVector, v);
+	return v;
+}
+
+static void testSampling()
+{
+	ByteVector *unsampled = logged(0);
+	check("no call sites unless sampling", gMemStats.mSites == NULL && unsampled->mccSite == NULL);
+
+	gMemStats.sampleRate(4);
+	const unsigned n = 1000;
+	ByteVector *v[n];
+	for (unsigned i = 0; i < n; i++) {
+		v[i] = logged(i);
+	}
+	MemSite *site = gMemStats.mSites;
+	check("one in four sampled", site && site->mNext == NULL && site->mSampled == n / 4 && site->mLive == n / 4);
+	ByteVector copy(*v[0]);
+	check("copies are not attributed", copy.mccSite == NULL);
+	for (unsigned i = 0; i < n; i++) {
+		delete v[i];
+	}
+	check("sampled objects released", site && site->mLive == 0);
+
+	gMemStats.sampleRate(0);
+	delete logged(1);
+	check("sampling off", site && site->mSampled == n / 4);
+
+	ostringstream os;
+	gMemStats.text(os);
+	check("memstat shows the site", os.str().find("ByteVector_") != string::npos);
+	delete unsampled;
+}
+
+// The counters as they were, shared by every thread.
+static int sShared[MemStats::mMax];
+
+static void *countShared(void *)
+{
+	for (unsigned i = 0; i < sPerThread * 10; i++) {
+		__atomic_fetch_add(&sShared[MemStats::mVector], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_sub(&sShared[MemStats::mVector], 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void *countSharded(void *)
+{
+	for (unsigned i = 0; i < sPerThread * 10; i++) {
+		gMemStats.memChkNew(MemStats::mVector, "Vector");
+		gMemStats.memChkDel(MemStats::mVector, "Vector");
+	}
+	return NULL;
+}
+
+static double timeThreads(void *(*fn)(void *), unsigned numThreads)
+{
+	Thread *threads = new Thread[numThreads];
+	uint64_t start = statNanoseconds();
+	for (unsigned t = 0; t < numThreads; t++) {
+		threads[t].start(fn, NULL);
+	}
+	for (unsigned t = 0; t < numThreads; t++) {
+		threads[t].join();
+	}
+	double ns = (double)(statNanoseconds() - start) / (sPerThread * 10 * 2);
+	delete[] threads;
+	return ns;
+}
+
+static void benchmark()
+{
+	for (unsigned n = 1; n <= sThreads; n *= 2) {
+		double shared = timeThreads(countShared, n);
+		double sharded = timeThreads(countSharded, n);
+		printf("%u threads, per count: shared atomic %.1f ns, sharded %.1f ns\n", n, shared, sharded);
+	}
+	uint64_t start = statNanoseconds();
+	int64_t sum = 0;
+	for (unsigned i = 0; i < 1000; i++) {
+		sum += gMemStats.now(MemStats::mVector);
+	}
+	printf("%u shards, reading a count %.0f ns (%d)\n", shardCount(), (statNanoseconds() - start) / 1000.0,
+		(int)(sum % 2));
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+
+	testThreads();
+	testHandoff();
+	testShortThreads();
+	testCopies();
+	testSampling();
+	benchmark();
+
+	gMemStats.text(cout);
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
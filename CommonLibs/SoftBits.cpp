@@ -0,0 +1,144 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "SoftBits.h"
+
+// The generator polynomials, in the bit order of ViterbiR2O9, where bit 0 is the newest input.
+static const unsigned sPoly[2] = {0x11d, 0x1af};
+
+template <>
+void SoftQuantizer::quantize<int8_t>(const float *in, int8_t *out, size_t n) const
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	// The same steps as the scalar quantize, 4 lanes at a time: min and max pick the limit for a NaN as the
+	// selects do, and the sign bit of v makes the half to round away from zero.  The packs cannot saturate.
+	const __m128 half = _mm_set1_ps(0.5F);
+	const __m128 gain = _mm_set1_ps(mGain);
+	const __m128 max = _mm_set1_ps(SoftBitLimits<int8_t>::max());
+	const __m128 min = _mm_set1_ps(-SoftBitLimits<int8_t>::max());
+	const __m128 sign = _mm_set1_ps(-0.0F);
+	for (; i + 16 <= n; i += 16) {
+		__m128i q[4];
+		for (unsigned j = 0; j < 4; j++) {
+			__m128 v = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in + i + 4 * j), half), gain), max);
+			v = _mm_max_ps(_mm_min_ps(v, max), min);
+			v = _mm_add_ps(v, _mm_or_ps(half, _mm_and_ps(v, sign)));
+			q[j] = _mm_cvttps_epi32(v);
+		}
+		__m128i lo = _mm_packs_epi32(q[0], q[1]);
+		__m128i hi = _mm_packs_epi32(q[2], q[3]);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi16(lo, hi));
+	}
+#endif
+	for (; i < n; i++) {
+		out[i] = quantize<int8_t>(in[i]);
+	}
+}
+
+ViterbiR2O9Fixed::ViterbiR2O9Fixed()
+{
+	for (unsigned x = 0; x < 2; x++) {
+		for (unsigned s = 0; s < sStates; s++) {
+			unsigned window = s | (x << 8);
+			for (unsigned g = 0; g < 2; g++) {
+				mSign[x][g][s] = __builtin_parity(window & sPoly[g]) ? 1 : -1;
+			}
+		}
+	}
+}
+
+template <class T>
+void ViterbiR2O9Fixed::decode(const Vector<T> &in, BitVector &target)
+{
+	typedef typename SoftBitLimits<T>::Metric Metric;
+	const size_t steps = target.size();
+	const size_t sz = in.size();
+	assert(sz <= 2 * steps);
+
+	if (mDecisions.size() < steps * sStates / 8) {
+		mDecisions.resize(steps * sStates / 8);
+	}
+
+	// The encoder starts in state 0.  The others start low enough never to win, but not so low that
+	// adding branch metrics for the first 8 steps could overflow.
+	Metric metrics[2][sStates];
+	const Metric unreachable = (Metric)(-16 * SoftBitLimits<T>::max());
+	for (unsigned s = 0; s < sStates; s++) {
+		metrics[0][s] = unreachable;
+	}
+	metrics[0][0] = 0;
+
+	// Branch metrics and the predecessors' metrics are laid out by destination state, so the add-compare-select
+	// is an elementwise loop.
+	Metric bm[2][sStates], pred[2][sStates];
+	uint8_t decisions[sStates];
+	const T *ip = in.begin();
+	for (size_t t = 0; t < steps; t++) {
+		const Metric a = 2 * t < sz ? ip[2 * t] : 0;
+		const Metric b = 2 * t + 1 < sz ? ip[2 * t + 1] : 0;
+		const Metric *old = metrics[t & 1];
+		Metric *cur = metrics[(t + 1) & 1];
+		uint8_t *dp = &mDecisions[t * sStates / 8];
+
+		for (unsigned s = 0; s < sStates; s++) {
+			bm[0][s] = mSign[0][0][s] * a + mSign[0][1][s] * b;
+			bm[1][s] = mSign[1][0][s] * a + mSign[1][1][s] * b;
+		}
+		for (unsigned j = 0; j < sStates / 2; j++) {
+			pred[0][2 * j] = pred[0][2 * j + 1] = old[j];
+			pred[1][2 * j] = pred[1][2 * j + 1] = old[j + sStates / 2];
+		}
+		const Metric c0 = pred[0][0] + bm[0][0], c1 = pred[1][0] + bm[1][0];
+		const Metric base = c1 > c0 ? c1 : c0;
+		for (unsigned s = 0; s < sStates; s++) {
+			// Only differences matter; keep them centered on state 0.
+			const Metric m0 = pred[0][s] + bm[0][s] - base;
+			const Metric m1 = pred[1][s] + bm[1][s] - base;
+			decisions[s] = m1 > m0;
+			cur[s] = m1 > m0 ? m1 : m0;
+		}
+
+		// Pack 8 decisions at a time; the multiply moves the low bit of byte i to bit 56 + i.
+		for (unsigned k = 0; k < sStates / 8; k++) {
+			uint64_t bytes;
+			memcpy(&bytes, &decisions[8 * k], 8);
+			dp[k] = (bytes * 0x0102040810204080ULL) >> 56;
+		}
+	}
+
+	// Trace back from the best end state.
+	const Metric *last = metrics[steps & 1];
+	unsigned state = 0;
+	for (unsigned s = 1; s < sStates; s++) {
+		if (last[s] > last[state]) {
+			state = s;
+		}
+	}
+	for (size_t t = steps; t-- > 0;) {
+		target[t] = state & 0x01;
+		unsigned d = (mDecisions[t * sStates / 8 + state / 8] >> (state & 0x07)) & 0x01;
+		state = (state >> 1) | (d << 7);
+	}
+}
+
+template void ViterbiR2O9Fixed::decode<int8_t>(const Vector<int8_t> &in, BitVector &target);
+template void ViterbiR2O9Fixed::decode<int16_t>(const Vector<int16_t> &in, BitVector &target);
+template void ViterbiR2O9Fixed::decode<float>(const Vector<float> &in, BitVector &target);
@@ -0,0 +1,130 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef SOFTBITS_H
+#define SOFTBITS_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include "BitVector.h"
+#include "Vector.h"
+
+/**@file
+	Fixed point soft bits.
+
+	A SoftVector holds each soft bit as a float probability: 0 for a sure 0, 1 for a sure 1, 0.5 when nothing
+	is known.  The demodulators produce it linearly from the despread amplitude, so noisy values run past both
+	ends.  The fixed point form is a signed log-likelihood style value instead: positive for a 1, negative for
+	a 0, 0 when nothing is known, saturated at the limits of the type.  Eight bits quarter the memory traffic
+	of the float path and let a decoder update 16 or 32 trellis states per SIMD instruction.
+*/
+
+typedef Vector<int8_t> SoftVector8;
+
+/** Range of a soft bit type, and the type wide enough for a Viterbi path metric of it. */
+template <class T>
+struct SoftBitLimits;
+template <>
+struct SoftBitLimits<int8_t> {
+	typedef int16_t Metric;
+	static float max() { return 127.0F; }
+};
+template <>
+struct SoftBitLimits<int16_t> {
+	typedef int32_t Metric;
+	static float max() { return 32767.0F; }
+};
+template <>
+struct SoftBitLimits<float> {
+	typedef float Metric;
+	static float max() { return 1.0e30F; }
+};
+
+/**
+	Conversion between float soft bits and fixed point.
+	At scale 1 a clean hard bit, ie, a float soft bit of 0 or 1, maps to a quarter of full scale, which leaves
+	two bits of headroom for noise and fading before saturation.
+*/
+class SoftQuantizer {
+	float mGain; // Fixed point full scales per unit of (p - 0.5).
+
+public:
+	SoftQuantizer(float wScale = 1.0F) : mGain(wScale / 2.0F) {}
+
+	float scale() const { return mGain * 2.0F; }
+
+	template <class T>
+	T quantize(float p) const
+	{
+		// Written as selects rather than branches; soft bits are as good as random.
+		const float max = SoftBitLimits<T>::max();
+		float v = (p - 0.5F) * mGain * max;
+		v = v < max ? v : max;
+		v = v > -max ? v : -max;
+		return (T)(int)(v + copysignf(0.5F, v));
+	}
+
+	template <class T>
+	float dequantize(T q) const
+	{
+		return 0.5F + (float)q / (mGain * SoftBitLimits<T>::max());
+	}
+
+	template <class T>
+	void quantize(const float *in, T *out, size_t n) const
+	{
+		for (size_t i = 0; i < n; i++) {
+			out[i] = quantize<T>(in[i]);
+		}
+	}
+};
+
+/**
+	Eight bit soft bits are quantized a frame at a time on the uplink, and the compiler makes a slow job of
+	narrowing float to int8_t, so with SSE2 this is done 16 at a time by hand.  The result is the same.
+*/
+template <>
+void SoftQuantizer::quantize<int8_t>(const float *in, int8_t *out, size_t n) const;
+
+/**
+	Full trellis Viterbi decoder for the 25.212 4.2.3.1 rate 1/2, constraint length 9 convolutional code, the
+	same code as ViterbiR2O9, for fixed point soft bits.
+
+	ViterbiR2O9 runs the T-algorithm over a linked list of candidates with float costs.  This keeps all 256
+	path metrics in a flat array of SoftBitLimits<T>::Metric, updates them with branchless add-compare-select
+	and renormalizes every step, so the inner loop is straight line integer arithmetic the compiler can
+	vectorize.  Decisions are kept for a full traceback from the best end state, so the output is the
+	maximum likelihood sequence rather than a deferred decision.
+*/
+class ViterbiR2O9Fixed {
+	static const unsigned sStates = 256;
+
+	// For the transition into state s from predecessor (s >> 1) | x << 7, the sign (+1 or -1) that generator g
+	// puts on each soft bit.
+	int8_t mSign[2][2][sStates];
+	Vector<uint8_t> mDecisions; // One bit per state per step, grown as needed.
+
+public:
+	ViterbiR2O9Fixed();
+
+	/**
+		Decode in, 2 soft bits per output bit, into target.
+		If in is short the missing soft bits are treated as unknown.
+	*/
+	template <class T>
+	void decode(const Vector<T> &in, BitVector &target);
+};
+
+#endif
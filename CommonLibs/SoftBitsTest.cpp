@@ -0,0 +1,180 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Block error rate against Eb/N0 of the rate 1/2 K=9 convolutional code over BPSK in AWGN, for the float
+// soft bit path and the int16 and int8 fixed point paths, and the time each decoder takes per block.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "BitVector.h"
+#include "Configuration.h"
+#include "SoftBits.h"
+
+ConfigurationTable *gConfigObject;
+
+// A 244 bit block with its 8 tail bits, like an AMR 12.2 class A block would be coded alone.
+static const unsigned sInfoBits = 244;
+static const unsigned sBits = sInfoBits + 8;
+static const unsigned sBlocks = 2000;
+
+enum { T_ALGORITHM, FULL_FLOAT, FULL_INT16, FULL_INT8, NUM_DECODERS };
+static const char *sNames[NUM_DECODERS] = {"float T-alg", "float", "int16", "int8"};
+
+static unsigned sFailures = 0;
+
+static double seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double gaussian(unsigned *seed)
+{
+	double u1 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+	double u2 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static bool sameInfo(const BitVector &a, const BitVector &b)
+{
+	for (unsigned i = 0; i < sInfoBits; i++) {
+		if (a.bit(i) != b.bit(i))
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+
+	ViterbiR2O9 coder;
+	ViterbiR2O9Fixed fixed;
+	SoftQuantizer quantizer;
+	BitVector info(sBits), coded(2 * sBits), decoded(sBits);
+	SoftVector soft(2 * sBits), llr(2 * sBits);
+	Vector<int16_t> soft16(2 * sBits);
+	SoftVector8 soft8(2 * sBits);
+	unsigned seed = 1;
+
+	// The frame at a time int8 quantizer must agree with the scalar one, rounding and saturation included.
+	SoftVector ramp(40001);
+	SoftVector8 ramp8(ramp.size());
+	for (unsigned i = 0; i < ramp.size(); i++) {
+		ramp[i] = 0.5F + ((int)i - 20000) / 10000.0F;
+	}
+	ramp[7] = NAN;
+	quantizer.quantize(ramp.begin(), ramp8.begin(), ramp.size());
+	bool same = true;
+	for (unsigned i = 0; i < ramp.size(); i++) {
+		same &= ramp8[i] == quantizer.quantize<int8_t>(ramp[i]);
+	}
+	printf("int8 quantize %s\n", same ? "ok" : "FAILED");
+	sFailures += !same;
+
+	// Noiseless, every decoder must be exact.
+	for (unsigned i = 0; i < sBits; i++) {
+		info[i] = i < sInfoBits ? rand_r(&seed) & 1 : 0;
+	}
+	info.encode(coder, coded);
+	for (unsigned i = 0; i < 2 * sBits; i++) {
+		soft[i] = coded.bit(i);
+		llr[i] = soft[i] - 0.5F;
+	}
+	quantizer.quantize(soft.begin(), soft16.begin(), soft.size());
+	quantizer.quantize(soft.begin(), soft8.begin(), soft.size());
+	fixed.decode(llr, decoded);
+	bool ok = sameInfo(decoded, info);
+	fixed.decode(soft16, decoded);
+	ok &= sameInfo(decoded, info);
+	fixed.decode(soft8, decoded);
+	ok &= sameInfo(decoded, info);
+	printf("noiseless decode %s\n", ok ? "ok" : "FAILED");
+	sFailures += !ok;
+
+	printf("%-6s", "Eb/N0");
+	for (unsigned d = 0; d < NUM_DECODERS; d++) {
+		printf(" %12s", sNames[d]);
+	}
+	printf("   BLER over %u blocks of %u bits\n", sBlocks, sInfoBits);
+
+	double time[NUM_DECODERS] = {0};
+	for (int ebn0 = 0; ebn0 <= 5; ebn0++) {
+		// Rate 1/2, so each coded bit carries half the energy of an information bit.
+		double esn0 = pow(10.0, ebn0 / 10.0) / 2.0;
+		double sigma = sqrt(1.0 / (2.0 * esn0));
+		unsigned errors[NUM_DECODERS] = {0};
+
+		for (unsigned blk = 0; blk < sBlocks; blk++) {
+			for (unsigned i = 0; i < sBits; i++) {
+				info[i] = i < sInfoBits ? rand_r(&seed) & 1 : 0;
+			}
+			info.encode(coder, coded);
+			// As the demodulator scales them: +-1 plus noise, mapped onto 0..1.
+			for (unsigned i = 0; i < 2 * sBits; i++) {
+				float y = (coded.bit(i) ? 1.0 : -1.0) + sigma * gaussian(&seed);
+				soft[i] = 0.5F + 0.5F * y;
+				llr[i] = soft[i] - 0.5F;
+			}
+
+			double start = seconds();
+			soft.decode(coder, decoded);
+			time[T_ALGORITHM] += seconds() - start;
+			errors[T_ALGORITHM] += !sameInfo(decoded, info);
+
+			start = seconds();
+			fixed.decode(llr, decoded);
+			time[FULL_FLOAT] += seconds() - start;
+			errors[FULL_FLOAT] += !sameInfo(decoded, info);
+
+			start = seconds();
+			quantizer.quantize(soft.begin(), soft16.begin(), soft.size());
+			fixed.decode(soft16, decoded);
+			time[FULL_INT16] += seconds() - start;
+			errors[FULL_INT16] += !sameInfo(decoded, info);
+
+			start = seconds();
+			quantizer.quantize(soft.begin(), soft8.begin(), soft.size());
+			fixed.decode(soft8, decoded);
+			time[FULL_INT8] += seconds() - start;
+			errors[FULL_INT8] += !sameInfo(decoded, info);
+		}
+
+		printf("%4d dB", ebn0);
+		for (unsigned d = 0; d < NUM_DECODERS; d++) {
+			printf(" %12.4f", (double)errors[d] / sBlocks);
+		}
+		printf("\n");
+
+		// Quantization loss must be lost in the statistical noise of the float result.
+		double slack = 3.0 * sqrt(errors[FULL_FLOAT] + 1.0);
+		if (errors[FULL_INT16] > errors[FULL_FLOAT] + slack || errors[FULL_INT8] > errors[FULL_FLOAT] + slack) {
+			printf("fixed point loss at %d dB FAILED\n", ebn0);
+			sFailures++;
+		}
+	}
+
+	printf("%-6s", "us");
+	for (unsigned d = 0; d < NUM_DECODERS; d++) {
+		printf(" %12.1f", time[d] * 1e6 / (6 * sBlocks));
+	}
+	printf("   per block, including quantization\n");
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
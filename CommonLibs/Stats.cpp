@@ -0,0 +1,266 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+#include "Configuration.h"
+#include "Logger.h"
+#include "Stats.h"
+#include "Threads.h"
+
+using namespace std;
+
+Stat *Stat::sFirst = NULL;
+__thread int gStatStripe = -1;
+
+static unsigned sNextStripe = 0;
+static time_t sClearedTime = time(NULL);
+
+int statAssignStripe()
+{
+	gStatStripe = __atomic_fetch_add(&sNextStripe, 1, __ATOMIC_RELAXED) % sStatStripes;
+	return gStatStripe;
+}
+
+Stat::Stat(const char *wName, const char *wDesc, Type wType) : mName(wName), mDesc(wDesc), mType(wType)
+{
+	// Push onto the list.  Stats are normally constructed before main, but dynamically created ones are fine too.
+	mNext = __atomic_load_n(&sFirst, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&sFirst, &mNext, this, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+}
+
+const char *Stat::typeName() const
+{
+	switch (mType) {
+	case COUNTER:
+		return "counter";
+	case GAUGE:
+		return "gauge";
+	case HISTOGRAM:
+		return "histogram";
+	}
+	return "unknown";
+}
+
+StatCounter::StatCounter(const char *wName, const char *wDesc) : Stat(wName, wDesc, COUNTER)
+{
+	memset(mStripes, 0, sizeof(mStripes));
+}
+
+uint64_t StatCounter::value() const
+{
+	uint64_t total = 0;
+	for (unsigned i = 0; i < sStatStripes; i++)
+		total += __atomic_load_n(&mStripes[i].mValue, __ATOMIC_RELAXED);
+	return total;
+}
+
+void StatCounter::clear()
+{
+	for (unsigned i = 0; i < sStatStripes; i++)
+		__atomic_store_n(&mStripes[i].mValue, 0, __ATOMIC_RELAXED);
+}
+
+void StatCounter::text(ostream &os) const { os << value(); }
+
+void StatCounter::json(ostream &os) const { os << "{\"type\":\"counter\",\"value\":" << value() << "}"; }
+
+StatGauge::StatGauge(const char *wName, const char *wDesc) : Stat(wName, wDesc, GAUGE), mValue(0) {}
+
+void StatGauge::text(ostream &os) const { os << value(); }
+
+void StatGauge::json(ostream &os) const { os << "{\"type\":\"gauge\",\"value\":" << value() << "}"; }
+
+StatHistogram::StatHistogram(const char *wName, const char *wUnits, const char *wDesc)
+	: Stat(wName, wDesc, HISTOGRAM), mUnits(wUnits), mSum(0), mMax(0)
+{
+	memset(mBuckets, 0, sizeof(mBuckets));
+}
+
+unsigned StatHistogram::bucket(uint64_t v)
+{
+	if (v >> sMaxBits)
+		v = (1ULL << sMaxBits) - 1;
+	if (v < (1U << sSubBits))
+		return v;
+	unsigned msb = 63 - __builtin_clzll(v);
+	unsigned shift = msb - sSubBits + 1;
+	return shift * sHalf + (v >> shift);
+}
+
+uint64_t StatHistogram::bucketMax(unsigned b)
+{
+	if (b < (1U << sSubBits))
+		return b;
+	unsigned shift = b / sHalf - 1;
+	return (((uint64_t)(b - shift * sHalf) + 1) << shift) - 1;
+}
+
+void StatHistogram::record(uint64_t v)
+{
+	__atomic_fetch_add(&mBuckets[bucket(v)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&mSum, v, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&mMax, __ATOMIC_RELAXED);
+	while (v > max && !__atomic_compare_exchange_n(&mMax, &max, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+uint64_t StatHistogram::count() const
+{
+	uint64_t total = 0;
+	for (unsigned b = 0; b < sBuckets; b++)
+		total += __atomic_load_n(&mBuckets[b], __ATOMIC_RELAXED);
+	return total;
+}
+
+uint64_t StatHistogram::quantile(double q) const
+{
+	// Copy the buckets once so the count and the walk agree.
+	uint64_t counts[sBuckets];
+	uint64_t total = 0;
+	for (unsigned b = 0; b < sBuckets; b++) {
+		counts[b] = __atomic_load_n(&mBuckets[b], __ATOMIC_RELAXED);
+		total += counts[b];
+	}
+	if (total == 0)
+		return 0;
+	uint64_t rank = (uint64_t)(q * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	uint64_t seen = 0;
+	for (unsigned b = 0; b < sBuckets; b++) {
+		seen += counts[b];
+		if (seen >= rank) {
+			// Never report more than the largest value actually seen.
+			uint64_t v = bucketMax(b), m = max();
+			return (m && v > m) ? m : v;
+		}
+	}
+	return max();
+}
+
+double StatHistogram::mean() const
+{
+	uint64_t n = count();
+	return n ? (double)__atomic_load_n(&mSum, __ATOMIC_RELAXED) / n : 0.0;
+}
+
+void StatHistogram::clear()
+{
+	for (unsigned b = 0; b < sBuckets; b++)
+		__atomic_store_n(&mBuckets[b], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&mSum, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&mMax, 0, __ATOMIC_RELAXED);
+}
+
+void StatHistogram::text(ostream &os) const
+{
+	ios::fmtflags flags = os.flags();
+	streamsize precision = os.precision();
+	os << "n=" << count() << " mean=" << fixed << setprecision(1) << mean() << " p50=" << quantile(0.5)
+	   << " p90=" << quantile(0.9) << " p99=" << quantile(0.99) << " p99.9=" << quantile(0.999)
+	   << " max=" << max() << " " << mUnits;
+	os.flags(flags);
+	os.precision(precision);
+}
+
+void StatHistogram::json(ostream &os) const
+{
+	ios::fmtflags flags = os.flags();
+	streamsize precision = os.precision();
+	os << "{\"type\":\"histogram\",\"units\":\"" << mUnits << "\",\"count\":" << count() << ",\"mean\":" << fixed
+	   << setprecision(3) << mean() << ",\"p50\":" << quantile(0.5) << ",\"p90\":" << quantile(0.9)
+	   << ",\"p99\":" << quantile(0.99) << ",\"p999\":" << quantile(0.999) << ",\"max\":" << max() << "}";
+	os.flags(flags);
+	os.precision(precision);
+}
+
+static bool statNameLess(const Stat *a, const Stat *b) { return strcmp(a->name(), b->name()) < 0; }
+
+void statsText(ostream &os, const char *patt)
+{
+	vector<const Stat *> stats;
+	for (const Stat *stat = Stat::first(); stat; stat = stat->next()) {
+		if (!patt || strstr(stat->name(), patt))
+			stats.push_back(stat);
+	}
+	sort(stats.begin(), stats.end(), statNameLess);
+
+	os << "stats over " << (time(NULL) - sClearedTime) << " seconds" << endl;
+	for (unsigned i = 0; i < stats.size(); i++) {
+		const Stat *stat = stats[i];
+		os << setw(36) << left << stat->name() << " " << setw(9) << stat->typeName() << right << " ";
+		stat->text(os);
+		os << endl;
+	}
+}
+
+void statsJson(ostream &os)
+{
+	os << "{\"time\":" << time(NULL) << ",\"cleared\":" << sClearedTime << ",\"stats\":{";
+	for (const Stat *stat = Stat::first(); stat; stat = stat->next()) {
+		os << "\"" << stat->name() << "\":";
+		stat->json(os);
+		if (stat->next())
+			os << ",";
+	}
+	os << "}}" << endl;
+}
+
+void statsClear()
+{
+	for (const Stat *stat = Stat::first(); stat; stat = stat->next())
+		const_cast<Stat *>(stat)->clear();
+	sClearedTime = time(NULL);
+}
+
+static void *statsSnapshotLoop(void *)
+{
+	while (true) {
+		int period = gConfig.getNum("Control.Reporting.StatsPeriod");
+		string path = gConfig.getStr("Control.Reporting.StatsFile");
+		if (period <= 0 || path.empty()) {
+			// Disabled; look again later in case it is turned on.
+			sleep(10);
+			continue;
+		}
+		sleep(period);
+
+		string tmp = path + ".tmp";
+		ofstream file(tmp.c_str());
+		if (!file) {
+			LOG(WARNING) << "cannot write stats snapshot " << tmp;
+			continue;
+		}
+		statsJson(file);
+		file.close();
+		if (rename(tmp.c_str(), path.c_str()))
+			LOG(WARNING) << "cannot replace stats snapshot " << path;
+	}
+	return NULL;
+}
+
+void statsStartSnapshots()
+{
+	static Thread snapshotThread;
+	snapshotThread.start(statsSnapshotLoop, NULL);
+}
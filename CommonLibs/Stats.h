@@ -0,0 +1,195 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <ostream>
+
+/**@file
+	Performance counters.
+
+	Stats are declared with static storage duration next to the code they measure and link themselves into a
+	global list when constructed, eg:
+
+		static StatCounter sRetransmits("UMTS.RLC.AM.Retransmits", "AMD PDUs sent again after a NACK");
+		...
+		sRetransmits.inc();
+
+	Updates never lock or allocate.  Counters are striped over cache lines so threads bumping the same counter
+	do not share a line; the reader adds the stripes.  Stats are never unregistered, so the list can be walked
+	by any thread at any time.  The CLI "stats" command and the periodic snapshot file both read them.
+*/
+
+/** Base class of every registered stat. */
+class Stat {
+public:
+	enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+private:
+	const char *mName;
+	const char *mDesc;
+	Type mType;
+	Stat *mNext;
+
+	// Constant initialized, so stats in other translation units may be constructed in any order.
+	static Stat *sFirst;
+
+	// Not copyable; the list holds pointers.
+	Stat(const Stat &);
+	Stat &operator=(const Stat &);
+
+public:
+	Stat(const char *wName, const char *wDesc, Type wType);
+	virtual ~Stat() {}
+
+	const char *name() const { return mName; }
+	const char *desc() const { return mDesc; }
+	Type type() const { return mType; }
+	const char *typeName() const;
+
+	/** Reset to zero.  Updates racing with the reset may or may not be counted. */
+	virtual void clear() = 0;
+	/** One line of human readable value, without the name. */
+	virtual void text(std::ostream &os) const = 0;
+	/** The value as a JSON object. */
+	virtual void json(std::ostream &os) const = 0;
+
+	static const Stat *first() { return __atomic_load_n(&sFirst, __ATOMIC_ACQUIRE); }
+	const Stat *next() const { return mNext; }
+};
+
+/** Number of stripes in a StatCounter. */
+static const unsigned sStatStripes = 16;
+
+/** This thread's stripe, assigned round robin on first use. */
+extern __thread int gStatStripe;
+extern int statAssignStripe();
+inline unsigned statStripe()
+{
+	int stripe = gStatStripe;
+	return stripe >= 0 ? stripe : statAssignStripe();
+}
+
+/** Monotonic event count, eg packets or retransmissions. */
+class StatCounter : public Stat {
+	struct Stripe {
+		uint64_t mValue;
+	} __attribute__((aligned(64)));
+	Stripe mStripes[sStatStripes];
+
+public:
+	StatCounter(const char *wName, const char *wDesc = "");
+
+	void inc(uint64_t n = 1) { __atomic_fetch_add(&mStripes[statStripe()].mValue, n, __ATOMIC_RELAXED); }
+	uint64_t value() const;
+
+	void clear();
+	void text(std::ostream &os) const;
+	void json(std::ostream &os) const;
+};
+
+/** Instantaneous level, eg queue depth or active channels. */
+class StatGauge : public Stat {
+	int64_t mValue;
+
+public:
+	StatGauge(const char *wName, const char *wDesc = "");
+
+	void set(int64_t v) { __atomic_store_n(&mValue, v, __ATOMIC_RELAXED); }
+	void add(int64_t n) { __atomic_fetch_add(&mValue, n, __ATOMIC_RELAXED); }
+	int64_t value() const { return __atomic_load_n(&mValue, __ATOMIC_RELAXED); }
+
+	void clear() { set(0); }
+	void text(std::ostream &os) const;
+	void json(std::ostream &os) const;
+};
+
+/**
+	Log-linear histogram in the style of HdrHistogram.
+	Values below 2^sSubBits are counted exactly; above that each power of two is split into 2^(sSubBits-1)
+	buckets, so any recorded value is reported within about 3%.  Values are clamped to 2^sMaxBits-1.
+*/
+class StatHistogram : public Stat {
+public:
+	static const unsigned sSubBits = 6;
+	static const unsigned sMaxBits = 40;
+	static const unsigned sHalf = 1 << (sSubBits - 1);
+	static const unsigned sBuckets = (sMaxBits - sSubBits + 2) * sHalf;
+
+private:
+	const char *mUnits;
+	uint64_t mBuckets[sBuckets];
+	uint64_t mSum;
+	uint64_t mMax;
+
+public:
+	StatHistogram(const char *wName, const char *wUnits, const char *wDesc = "");
+
+	static unsigned bucket(uint64_t v);
+	/** Largest value that lands in the bucket. */
+	static uint64_t bucketMax(unsigned b);
+
+	void record(uint64_t v);
+
+	uint64_t count() const;
+	/** Value at or below which fraction q of the recorded values fall, 0 if nothing recorded. */
+	uint64_t quantile(double q) const;
+	uint64_t max() const { return __atomic_load_n(&mMax, __ATOMIC_RELAXED); }
+	double mean() const;
+	const char *units() const { return mUnits; }
+
+	void clear();
+	void text(std::ostream &os) const;
+	void json(std::ostream &os) const;
+};
+
+/** Monotonic clock in nanoseconds, for timing hot paths. */
+inline uint64_t statNanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Record the microseconds between construction and destruction into a histogram. */
+class StatTimer {
+	StatHistogram &mHistogram;
+	uint64_t mStart;
+
+public:
+	StatTimer(StatHistogram &wHistogram) : mHistogram(wHistogram), mStart(statNanoseconds()) {}
+	~StatTimer() { mHistogram.record((statNanoseconds() - mStart) / 1000); }
+};
+
+/** Print every stat whose name contains patt, or all of them if patt is NULL. */
+void statsText(std::ostream &os, const char *patt = NULL);
+
+/** Print every stat as one JSON object. */
+void statsJson(std::ostream &os);
+
+/** Clear every stat. */
+void statsClear();
+
+/**
+	Start a thread that rewrites Control.Reporting.StatsFile with statsJson() every Control.Reporting.StatsPeriod
+	seconds.  The file is replaced atomically, so readers always see a complete snapshot.
+*/
+void statsStartSnapshots();
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the stats registry and time the hot path updates.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "Configuration.h"
+#include "Stats.h"
+#include "Threads.h"
+
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+static StatCounter sCounter("Test.Counter", "incremented by every thread");
+static StatGauge sGauge("Test.Gauge");
+static StatHistogram sHistogram("Test.Histogram", "us");
+
+static const unsigned sThreads = 8;
+static const unsigned sPerThread = 1000000;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static void *bump(void *)
+{
+	for (unsigned i = 0; i < sPerThread; i++) {
+		sCounter.inc();
+		sHistogram.record(i % 1000);
+	}
+	return NULL;
+}
+
+static void testBuckets()
+{
+	bool ok = true;
+	unsigned prev = 0;
+	for (uint64_t v = 0; v < 10000000; v += 1 + v / 50) {
+		unsigned b = StatHistogram::bucket(v);
+		// Monotonic, and every value is no more than its bucket's max and about 3% below it.
+		ok &= b >= prev && b < StatHistogram::sBuckets;
+		ok &= v <= StatHistogram::bucketMax(b) && StatHistogram::bucketMax(b) - v <= v / 32;
+		ok &= b == 0 || StatHistogram::bucketMax(b - 1) < v;
+		prev = b;
+	}
+	ok &= StatHistogram::bucket(~0ULL) == StatHistogram::sBuckets - 1;
+	check("histogram buckets", ok);
+}
+
+static void testThreads()
+{
+	Thread threads[sThreads];
+	for (unsigned t = 0; t < sThreads; t++) {
+		threads[t].start(bump, NULL);
+	}
+	for (unsigned t = 0; t < sThreads; t++) {
+		threads[t].join();
+	}
+	check("counter sums every thread", sCounter.value() == sThreads * sPerThread);
+	check("histogram count", sHistogram.count() == sThreads * sPerThread);
+	uint64_t p50 = sHistogram.quantile(0.5), p99 = sHistogram.quantile(0.99);
+	check("histogram p50 of 0..999", p50 >= 499 && p50 <= 499 * 103 / 100);
+	check("histogram p99 of 0..999", p99 >= 989 && p99 <= 999);
+	check("histogram max", sHistogram.max() == 999);
+	check("histogram mean", sHistogram.mean() > 499.4 && sHistogram.mean() < 499.6);
+}
+
+static void testReport()
+{
+	sGauge.set(5);
+	sGauge.add(-2);
+	check("gauge", sGauge.value() == 3);
+
+	ostringstream text, json;
+	statsText(text, "Test.Gauge");
+	check("text filtered by pattern", text.str().find("Test.Gauge") != string::npos &&
+						  text.str().find("Test.Counter") == string::npos);
+	statsJson(json);
+	check("json has every stat", json.str().find("\"Test.Counter\":{\"type\":\"counter\",\"value\":8000000}") !=
+					     string::npos &&
+					     json.str().find("\"Test.Histogram\":{\"type\":\"histogram\"") != string::npos);
+
+	statsClear();
+	check("clear", sCounter.value() == 0 && sGauge.value() == 0 && sHistogram.count() == 0 && sHistogram.max() == 0);
+}
+
+static void benchmark()
+{
+	const unsigned n = 50000000;
+	uint64_t start = statNanoseconds();
+	for (unsigned i = 0; i < n; i++) {
+		sCounter.inc();
+	}
+	double inc = (double)(statNanoseconds() - start) / n;
+	start = statNanoseconds();
+	for (unsigned i = 0; i < n; i++) {
+		sHistogram.record(i & 0xffff);
+	}
+	double record = (double)(statNanoseconds() - start) / n;
+	start = statNanoseconds();
+	for (unsigned i = 0; i < n / 10; i++) {
+		StatTimer timer(sHistogram);
+	}
+	double timed = (double)(statNanoseconds() - start) / (n / 10);
+	printf("counter inc %.1f ns, histogram record %.1f ns, timed scope %.1f ns\n", inc, record, timed);
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+
+	testBuckets();
+	testThreads();
+	testReport();
+	benchmark();
+
+	statsText(cout);
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
@@ -89,6 +89,9 @@ public:
 	// void lock() { int result = pthread_mutex_lock(&mMutex); assert(0==result); }
 	void lock() { pthread_mutex_lock(&mMutex); }
 
+	/** Lock the mutex if nobody else holds it; return true if it was locked. */
+	bool trylock() { return pthread_mutex_trylock(&mMutex) == 0; }
+
 	void unlock() { pthread_mutex_unlock(&mMutex); }
 
 	friend class Signal;
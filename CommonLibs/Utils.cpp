@@ -14,6 +14,8 @@
 
 #include <sys/time.h> // For gettimeofday
 
+#include <assert.h>
+#include <pthread.h>
 #include <stdio.h>  // For vsnprintf
 #include <string.h> // For strcpy
 #include <unistd.h> // For usleep
@@ -28,40 +30,106 @@ namespace Utils {
 
 MemStats gMemStats;
 int gMemLeakDebug = 0;
+__thread MemStats::Shard *gMemShard = NULL;
+__thread int gMemSampleCountdown = 0;
 
-MemStats::MemStats()
+// For taking and returning shards, which a thread does once each.
+static pthread_mutex_t sMemShardLock = PTHREAD_MUTEX_INITIALIZER;
+static MemStats::Shard *sMemFreeShards = NULL;
+static pthread_key_t sMemShardKey;
+static pthread_once_t sMemShardKeyOnce = PTHREAD_ONCE_INIT;
+
+// Runs as a thread exits, with the thread's shard.
+static void memReleaseShard(void *arg)
 {
-	memset(mMemNow, 0, sizeof(mMemNow));
-	memset(mMemTotal, 0, sizeof(mMemTotal));
-	memset(mMemName, 0, sizeof(mMemName));
+	MemStats::Shard *shard = (MemStats::Shard *)arg;
+	pthread_mutex_lock(&sMemShardLock);
+	shard->mNextFree = sMemFreeShards;
+	sMemFreeShards = shard;
+	pthread_mutex_unlock(&sMemShardLock);
+	gMemShard = NULL;
 }
 
-void MemStats::text(std::ostream &os)
+static void memMakeShardKey() { pthread_key_create(&sMemShardKey, memReleaseShard); }
+
+MemStats::Shard *MemStats::acquireShard()
 {
-	os << "Structs current total:\n";
-	for (int i = 0; i < mMax; i++) {
-		os << "\t" << (mMemName[i] ? mMemName[i] : "unknown") << " " << mMemNow[i] << " " << mMemTotal[i]
-		   << "\n";
+	pthread_once(&sMemShardKeyOnce, memMakeShardKey);
+	pthread_mutex_lock(&sMemShardLock);
+	Shard *shard = sMemFreeShards;
+	if (shard) {
+		sMemFreeShards = shard->mNextFree;
+	} else {
+		shard = new Shard;
+		memset(shard, 0, sizeof(*shard));
+		shard->mNext = gMemStats.mShards;
+		__atomic_store_n(&gMemStats.mShards, shard, __ATOMIC_RELEASE);
 	}
+	pthread_mutex_unlock(&sMemShardLock);
+	// Objects destroyed by other key destructors as the thread exits may take a shard again; pthreads calls the
+	// destructor again for that.
+	pthread_setspecific(sMemShardKey, shard);
+	gMemShard = shard;
+	return shard;
 }
 
-void MemStats::memChkNew(MemoryNames memIndex, const char *id)
+int64_t MemStats::now(MemoryNames memIndex) const
 {
-	/*std::cout << "new " #type "\n";*/
-	mMemNow[memIndex]++;
-	mMemTotal[memIndex]++;
-	mMemName[memIndex] = id;
+	int64_t sum = 0;
+	for (const Shard *s = __atomic_load_n(&mShards, __ATOMIC_ACQUIRE); s; s = s->mNext) {
+		sum += __atomic_load_n(&s->mNew[memIndex], __ATOMIC_RELAXED) -
+		       __atomic_load_n(&s->mDel[memIndex], __ATOMIC_RELAXED);
+	}
+	return sum;
+}
+
+int64_t MemStats::total(MemoryNames memIndex) const
+{
+	int64_t sum = 0;
+	for (const Shard *s = __atomic_load_n(&mShards, __ATOMIC_ACQUIRE); s; s = s->mNext) {
+		sum += __atomic_load_n(&s->mNew[memIndex], __ATOMIC_RELAXED);
+	}
+	return sum;
+}
+
+void MemStats::text(std::ostream &os)
+{
+	os << "Structs current total:\n";
+	for (int i = 0; i < mMax; i++) {
+		const char *name = __atomic_load_n(&mMemName[i], __ATOMIC_RELAXED);
+		int64_t current = now((MemoryNames)i);
+		os << "\t" << (name ? name : "unknown") << " " << current << " " << total((MemoryNames)i) << "\n";
+		// The shards are read one after another, so a count can be off by the objects that changed threads
+		// in the meantime, but never by more than a handful.
+		if (current < -100) {
+			LOG(ERR) << "Memory underflow on type " << (name ? name : "unknown");
+			if (gMemLeakDebug)
+				assert(0);
+		}
+	}
+	int rate = sampleRate();
+	MemSite *site = __atomic_load_n(&mSites, __ATOMIC_ACQUIRE);
+	if (!rate && !site) {
+		return;
+	}
+	if (rate) {
+		os << "Call sites, sampling one in " << rate << " allocations, live sampled:\n";
+	} else {
+		os << "Call sites, not sampling, live sampled:\n";
+	}
+	for (; site; site = site->mNext) {
+		os << "\t" << site->mType << "_" << site->mFile << ":" << site->mLine << " "
+		   << __atomic_load_n(&site->mLive, __ATOMIC_RELAXED) << " "
+		   << __atomic_load_n(&site->mSampled, __ATOMIC_RELAXED) << "\n";
+	}
 }
 
-void MemStats::memChkDel(MemoryNames memIndex, const char *id)
+MemSite::MemSite(const char *wType, const char *wFile, int wLine)
+	: mType(wType), mFile(wFile), mLine(wLine), mLive(0), mSampled(0)
 {
-	/*std::cout << "del " #type "\n";*/
-	mMemNow[memIndex]--;
-	if (mMemNow[memIndex] < 0) {
-		LOG(ERR) << "Memory underflow on type " << id;
-		if (gMemLeakDebug)
-			assert(0);
-		mMemNow[memIndex] += 100; // Prevent another message for a while.
+	mNext = __atomic_load_n(&gMemStats.mSites, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&gMemStats.mSites, &mNext, this, true, __ATOMIC_RELEASE,
+		__ATOMIC_RELAXED)) {
 	}
 }
 
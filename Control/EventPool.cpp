@@ -0,0 +1,185 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <assert.h>
+
+#include <CommonLibs/Logger.h>
+
+#include "EventPool.h"
+
+using namespace Control;
+
+namespace {
+
+// Carries a new handler to its worker, ahead of any event for it.
+class AttachEvent : public Event {
+public:
+	EventHandler *mHandler;
+	AttachEvent(EventHandler *wHandler) : Event(Event::Attach), mHandler(wHandler) {}
+};
+
+} // namespace
+
+void EventHandler::startTimer(unsigned tag, unsigned ms)
+{
+	assert(tag < sMaxTimers && mPool);
+	mTimerSeq[tag]++;
+	mPool->startTimer(this, tag, ms);
+}
+
+void EventHandler::stopTimer(unsigned tag)
+{
+	assert(tag < sMaxTimers);
+	mTimerSeq[tag]++;
+}
+
+void EventHandler::finish() { mFinished = true; }
+
+EventPool::EventPool(const char *wName, unsigned numWorkers)
+	: mName(wName), mNextID(1), mStopping(false), mHandlers(0), mHandled(0), mDropped(0)
+{
+	assert(numWorkers > 0);
+	for (unsigned i = 0; i < numWorkers; i++) {
+		Worker *w = new Worker;
+		w->mPool = this;
+		mWorkers.push_back(w);
+		w->mThread.start(workerLoop, w);
+	}
+	mTimerThread.start(timerLoop, this);
+}
+
+EventPool::~EventPool()
+{
+	{
+		ScopedLock lock(mTimerLock);
+		mStopping = true;
+		mTimerSignal.signal();
+	}
+	mTimerThread.join();
+	for (unsigned i = 0; i < mWorkers.size(); i++) {
+		Worker *w = mWorkers[i];
+		w->mQ.write(new Event(Event::Stop));
+		w->mThread.join();
+		for (std::map<uint64_t, EventHandler *>::iterator it = w->mHandlers.begin(); it != w->mHandlers.end();
+			++it) {
+			delete it->second;
+		}
+		delete w;
+	}
+}
+
+uint64_t EventPool::add(EventHandler *handler)
+{
+	assert(!handler->mPool);
+	handler->mPool = this;
+	handler->mID = __atomic_fetch_add(&mNextID, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&mHandlers, 1, __ATOMIC_RELAXED);
+	post(handler->mID, new AttachEvent(handler));
+	return handler->mID;
+}
+
+void EventPool::post(uint64_t target, Event *event)
+{
+	event->mTarget = target;
+	mWorkers[target % mWorkers.size()]->mQ.write(event);
+}
+
+size_t EventPool::queued() const
+{
+	size_t n = 0;
+	for (unsigned i = 0; i < mWorkers.size(); i++) {
+		n += mWorkers[i]->mQ.size();
+	}
+	return n;
+}
+
+void *EventPool::workerLoop(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	EventPool *pool = w->mPool;
+	while (true) {
+		Event *event = w->mQ.read();
+		if (event->mType == Event::Stop) {
+			delete event;
+			return NULL;
+		}
+		if (event->mType == Event::Attach) {
+			EventHandler *handler = static_cast<AttachEvent *>(event)->mHandler;
+			w->mHandlers[handler->mID] = handler;
+			delete event;
+			continue;
+		}
+		std::map<uint64_t, EventHandler *>::iterator it = w->mHandlers.find(event->mTarget);
+		if (it == w->mHandlers.end()) {
+			// The handler finished with this already on its way, as when a response crosses a timeout.
+			__atomic_fetch_add(&pool->mDropped, 1, __ATOMIC_RELAXED);
+			delete event;
+			continue;
+		}
+		EventHandler *handler = it->second;
+		if (event->mType == Event::Timer) {
+			TimerEvent *timer = static_cast<TimerEvent *>(event);
+			if (timer->mSeq != handler->mTimerSeq[timer->mTag]) {
+				// Stopped or restarted since.
+				delete event;
+				continue;
+			}
+		}
+		handler->handle(event);
+		delete event;
+		__atomic_fetch_add(&pool->mHandled, 1, __ATOMIC_RELAXED);
+		if (handler->mFinished) {
+			w->mHandlers.erase(it);
+			delete handler;
+			__atomic_fetch_sub(&pool->mHandlers, 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void EventPool::startTimer(EventHandler *handler, unsigned tag, unsigned ms)
+{
+	TimerEntry entry;
+	entry.mWhen.future(ms);
+	entry.mTarget = handler->mID;
+	entry.mTag = tag;
+	entry.mSeq = handler->mTimerSeq[tag];
+	ScopedLock lock(mTimerLock);
+	bool sooner = mTimers.empty() || entry.before(mTimers.top());
+	mTimers.push(entry);
+	if (sooner) {
+		mTimerSignal.signal();
+	}
+}
+
+// Stopped timers are not taken out; they expire as usual and the worker drops them by their sequence number.
+void *EventPool::timerLoop(void *arg)
+{
+	EventPool *pool = (EventPool *)arg;
+	ScopedLock lock(pool->mTimerLock);
+	while (!pool->mStopping) {
+		if (pool->mTimers.empty()) {
+			pool->mTimerSignal.wait(pool->mTimerLock);
+			continue;
+		}
+		long remaining = pool->mTimers.top().mWhen.remaining();
+		if (remaining > 0) {
+			pool->mTimerSignal.wait(pool->mTimerLock, remaining);
+			continue;
+		}
+		TimerEntry entry = pool->mTimers.top();
+		pool->mTimers.pop();
+		pool->post(entry.mTarget, new TimerEvent(entry.mTag, entry.mSeq));
+	}
+	return NULL;
+}
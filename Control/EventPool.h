@@ -0,0 +1,183 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef EVENTPOOL_H
+#define EVENTPOOL_H
+
+#include <stdint.h>
+
+#include <map>
+#include <queue>
+#include <vector>
+
+#include <CommonLibs/Interthread.h>
+#include <CommonLibs/Threads.h>
+#include <CommonLibs/Timeval.h>
+
+namespace Control {
+
+class EventPool;
+
+/** An event for one EventHandler.  Subclasses carry the payload; whoever handles the event does not delete it. */
+class Event {
+public:
+	/** Types below zero are the pool's own; handlers number theirs from zero. */
+	enum { Attach = -1, Timer = -2, Stop = -3 };
+
+private:
+	friend class EventPool;
+	int mType;
+	uint64_t mTarget; ///< The handler, by id.
+
+public:
+	Event(int wType) : mType(wType), mTarget(0) {}
+	virtual ~Event() {}
+
+	int type() const { return mType; }
+};
+
+/** The event a timer of an EventHandler sends when it expires. */
+class TimerEvent : public Event {
+	friend class EventPool;
+	unsigned mTag;
+	unsigned mSeq;
+
+public:
+	TimerEvent(unsigned wTag, unsigned wSeq) : Event(Event::Timer), mTag(wTag), mSeq(wSeq) {}
+
+	unsigned tag() const { return mTag; }
+};
+
+/**
+	Something driven by events on an EventPool, eg the state machine of one procedure with one MS.
+	All the events for a handler are handled in order on one worker thread, so a handler needs no lock of its own
+	for what only its events touch.  A handler must not block: instead of waiting for a message it returns, and the
+	message comes back as an event, and instead of sleeping it starts a timer.
+*/
+class EventHandler {
+public:
+	static const unsigned sMaxTimers = 4;
+
+private:
+	friend class EventPool;
+	EventPool *mPool;
+	uint64_t mID;
+	unsigned mTimerSeq[sMaxTimers]; ///< Bumped by every start and stop, so an expiry from before is recognized.
+	bool mFinished;
+
+public:
+	EventHandler() : mPool(NULL), mID(0), mFinished(false)
+	{
+		for (unsigned i = 0; i < sMaxTimers; i++) {
+			mTimerSeq[i] = 0;
+		}
+	}
+	virtual ~EventHandler() {}
+
+	/** Handle one event; on the handler's worker thread. */
+	virtual void handle(Event *event) = 0;
+
+	/** The id events are posted to, once added to a pool. */
+	uint64_t id() const { return mID; }
+
+protected:
+	/** (Re)start timer tag, which sends a TimerEvent after ms; from handle() only. */
+	void startTimer(unsigned tag, unsigned ms);
+
+	/** Stop timer tag; an expiry already on its way is dropped.  From handle() only. */
+	void stopTimer(unsigned tag);
+
+	/** Leave the pool and be deleted after this event; events that come after are dropped. From handle() only. */
+	void finish();
+
+	EventPool *pool() const { return mPool; }
+};
+
+/**
+	A few worker threads running many EventHandlers, and a timer thread for their timers.
+	Handlers are spread over the workers by id, and each worker has its own queue, so the events of one handler
+	stay in order and never run on two threads at once.  Posting an event is one write to an InterthreadQueue,
+	from any thread; an event for a handler that has finished is dropped and deleted.
+*/
+class EventPool {
+	struct Worker {
+		EventPool *mPool;
+		InterthreadQueue<Event> mQ;
+		std::map<uint64_t, EventHandler *> mHandlers; ///< Only the worker thread touches this.
+		Thread mThread;
+	};
+
+	struct TimerEntry {
+		Timeval mWhen;
+		uint64_t mTarget;
+		unsigned mTag, mSeq;
+		bool before(const TimerEntry &other) const
+		{
+			return mWhen.sec() < other.mWhen.sec() ||
+			       (mWhen.sec() == other.mWhen.sec() && mWhen.usec() < other.mWhen.usec());
+		}
+		bool operator<(const TimerEntry &other) const { return other.before(*this); } // Earliest on top.
+	};
+
+	const char *mName;
+	std::vector<Worker *> mWorkers;
+	uint64_t mNextID;
+
+	Mutex mTimerLock;
+	Signal mTimerSignal;
+	std::priority_queue<TimerEntry> mTimers;
+	Thread mTimerThread;
+	bool mStopping;
+
+	unsigned mHandlers; ///< Added and not yet finished.
+	uint64_t mHandled;
+	uint64_t mDropped;
+
+	static void *workerLoop(void *arg);
+	static void *timerLoop(void *arg);
+
+	friend class EventHandler;
+	void startTimer(EventHandler *handler, unsigned tag, unsigned ms);
+
+	EventPool(const EventPool &);
+	EventPool &operator=(const EventPool &);
+
+public:
+	EventPool(const char *wName, unsigned numWorkers);
+
+	/** Stop the threads; handlers still in the pool are deleted. */
+	~EventPool();
+
+	/**
+		Take ownership of a handler and give it an id.
+		The handler gets events from here on, the first ones it posts to itself included.
+		@return The id.
+	*/
+	uint64_t add(EventHandler *handler);
+
+	/** Post an event to a handler, from any thread; the pool deletes it after handling, or if the handler is gone. */
+	void post(uint64_t target, Event *event);
+
+	const char *name() const { return mName; }
+	unsigned workers() const { return mWorkers.size(); }
+	unsigned handlers() const { return __atomic_load_n(&mHandlers, __ATOMIC_RELAXED); }
+	uint64_t handled() const { return __atomic_load_n(&mHandled, __ATOMIC_RELAXED); }
+	uint64_t dropped() const { return __atomic_load_n(&mDropped, __ATOMIC_RELAXED); }
+	/** Events waiting over all workers. */
+	size_t queued() const;
+};
+
+} // namespace Control
+
+#endif
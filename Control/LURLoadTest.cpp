@@ -0,0 +1,507 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Push thousands of simultaneous location updates through LocationUpdating procedures on an EventPool, against
+// a stub registrar in this process that answers after a delay, as one across a network would.  Each MS is a
+// LURPeer that answers what the procedure sends it the way a handset would, including the challenge.  Some
+// IMSIs are unknown to the registrar, some of their REGISTERs get lost once and some are never answered, so the
+// retransmissions and Timer F run under load too.  Then compare with registrations one at a time on one
+// thread, the way the DCCH dispatcher ran the blocking LocationUpdatingController.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Threads.h>
+#include <GSM/GSML3MMMessages.h>
+#include <GSM/GSMTransfer.h>
+
+#include "LocationUpdating.h"
+#include "TMSITable.h"
+
+using namespace Control;
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+TMSITable *gTMSITable;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// What the registrar makes of the MS with this index.
+enum Kind { Normal, LostOnce, Unknown, Silent };
+
+static Kind kind(unsigned index)
+{
+	if (index % 50 == 7)
+		return Silent;
+	if (index % 20 == 3)
+		return Unknown;
+	if (index % 10 == 5)
+		return LostOnce;
+	return Normal;
+}
+
+static string IMSIOf(unsigned index)
+{
+	char buf[16];
+	snprintf(buf, sizeof(buf), "00101%010u", index);
+	return buf;
+}
+
+static unsigned indexOf(const char *IMSI) { return atoi(IMSI + 5); }
+
+// The test SIM's A3: fold the RAND into 32 bits with a key from the IMSI.
+static uint32_t A3(const string &RAND, const char *IMSI)
+{
+	uint32_t sres = indexOf(IMSI) * 2654435761u;
+	for (size_t i = 0; i + 8 <= RAND.size(); i += 8) {
+		sres ^= strtoul(RAND.substr(i, 8).c_str(), NULL, 16);
+	}
+	return sres;
+}
+
+static string hex32(uint32_t v)
+{
+	char buf[9];
+	snprintf(buf, sizeof(buf), "%08x", v);
+	return buf;
+}
+
+/**
+	The registrar: answers each REGISTER after a delay, from a thread of its own.
+	The first REGISTER of an IMSI gets a 401 with a challenge, the one with the right SRES a 200.
+*/
+class StubRegistrar {
+	struct Pending {
+		uint64_t mDue;
+		EventPool *mPool;
+		uint64_t mTarget;
+		InterthreadQueue<RegistrarEvent> *mQ;
+		int mStatus;
+		string mRAND;
+		bool operator<(const Pending &other) const { return other.mDue < mDue; }
+	};
+
+	unsigned mDelayMs;
+	Mutex mLock;
+	Signal mSignal;
+	std::priority_queue<Pending> mPending;
+	map<unsigned, unsigned> mAttempts; ///< By IMSI index.
+	bool mStopping;
+	Thread mThread;
+
+	static void *loop(void *arg)
+	{
+		StubRegistrar *r = (StubRegistrar *)arg;
+		ScopedLock lock(r->mLock);
+		while (!r->mStopping) {
+			if (r->mPending.empty()) {
+				r->mSignal.wait(r->mLock);
+				continue;
+			}
+			uint64_t now = nanoseconds();
+			const Pending &p = r->mPending.top();
+			if (p.mDue > now) {
+				r->mSignal.wait(r->mLock, (p.mDue - now) / 1000000 + 1);
+				continue;
+			}
+			RegistrarEvent *event = new RegistrarEvent(p.mStatus, p.mRAND);
+			if (p.mQ) {
+				p.mQ->write(event);
+			} else {
+				p.mPool->post(p.mTarget, event);
+			}
+			r->mPending.pop();
+		}
+		return NULL;
+	}
+
+public:
+	unsigned mRequests, mLost, mChallenges, mVerified;
+
+	StubRegistrar(unsigned wDelayMs)
+		: mDelayMs(wDelayMs), mStopping(false), mRequests(0), mLost(0), mChallenges(0), mVerified(0)
+	{
+		mThread.start(loop, this);
+	}
+
+	~StubRegistrar()
+	{
+		{
+			ScopedLock lock(mLock);
+			mStopping = true;
+			mSignal.signal();
+		}
+		mThread.join();
+	}
+
+	/** A REGISTER; the answer goes to the handler on the pool, or to the queue. */
+	void request(EventPool *pool, uint64_t target, InterthreadQueue<RegistrarEvent> *q, const char *IMSI,
+		const string &RAND, const char *SRES)
+	{
+		ScopedLock lock(mLock);
+		mRequests++;
+		unsigned index = indexOf(IMSI);
+		Kind k = kind(index);
+		if (k == Silent || (k == LostOnce && mAttempts[index]++ == 0)) {
+			mLost++;
+			return;
+		}
+		Pending p;
+		p.mDue = nanoseconds() + mDelayMs * 1000000ULL;
+		p.mPool = pool;
+		p.mTarget = target;
+		p.mQ = q;
+		if (k == Unknown) {
+			p.mStatus = 404;
+		} else if (!SRES) {
+			p.mStatus = 401;
+			p.mRAND = hex32(random()) + hex32(random()) + hex32(random()) + hex32(index);
+			mChallenges++;
+		} else if (strtoul(SRES, NULL, 16) == A3(RAND, IMSI)) {
+			p.mStatus = 200;
+			mVerified++;
+		} else {
+			p.mStatus = 401;
+		}
+		bool sooner = mPending.empty() || p.mDue < mPending.top().mDue;
+		mPending.push(p);
+		if (sooner) {
+			mSignal.signal();
+		}
+	}
+};
+
+static StubRegistrar *sRegistrar;
+
+// What happened to each MS.
+struct Outcome {
+	unsigned mAccepts, mRejects, mRejectCause, mAuthRequests, mIdentityRequests;
+	int mReleaseCause; ///< -1 until released.
+	bool mNewTMSI;
+	const char *mWelcome;
+	uint64_t mStartNs, mEndNs;
+};
+
+static vector<Outcome> sOutcomes;
+
+static GSM::L3Frame *frame(const vector<unsigned char> &bytes)
+{
+	return new GSM::L3Frame((const char *)&bytes[0], bytes.size());
+}
+
+// GSM 04.08 10.5.1.4, as LV.
+static void writeIMSI(vector<unsigned char> &bytes, const string &IMSI)
+{
+	bytes.push_back(1 + IMSI.size() / 2);
+	bytes.push_back(((IMSI[0] - '0') << 4) | 0x08 | GSM::IMSIType);
+	for (size_t i = 1; i < IMSI.size(); i += 2) {
+		bytes.push_back(((IMSI[i + 1] - '0') << 4) | (IMSI[i] - '0'));
+	}
+}
+
+static void writeTMSI(vector<unsigned char> &bytes, unsigned TMSI)
+{
+	bytes.push_back(5);
+	bytes.push_back(0xf0 | GSM::TMSIType);
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		bytes.push_back(TMSI >> shift);
+	}
+}
+
+// The LAI the MSs come from; not ours, so a TMSI from it is never looked up.
+static const unsigned char sOldLAI[5] = {0x00, 0xf1, 0x20, 0x00, 0x07};
+
+static GSM::L3LocationUpdatingRequest *makeLUR(unsigned index)
+{
+	vector<unsigned char> bytes;
+	bytes.push_back(GSM::L3MobilityManagementPD);
+	bytes.push_back(GSM::L3MMMessage::LocationUpdatingRequest);
+	bytes.push_back(0x70); // No key, normal updating.
+	bytes.insert(bytes.end(), sOldLAI, sOldLAI + 5);
+	bytes.push_back(0x57); // Classmark 1.
+	if (index % 4 == 1) {
+		writeTMSI(bytes, 0x40000000 + index);
+	} else {
+		writeIMSI(bytes, IMSIOf(index));
+	}
+	GSM::L3Frame *f = frame(bytes);
+	GSM::L3Message *msg = GSM::parseL3(*f);
+	delete f;
+	return dynamic_cast<GSM::L3LocationUpdatingRequest *>(msg);
+}
+
+/** A handset, answering right away whatever the procedure sends it. */
+class TestPeer : public LURPeer {
+	unsigned mIndex;
+	EventPool *mPool;
+	uint64_t mID;
+	string mRAND;
+	const char *mSRES;
+	string mSRESBuf;
+
+	void reply(const vector<unsigned char> &bytes) { mPool->post(mID, new L3FrameEvent(frame(bytes))); }
+
+public:
+	TestPeer(unsigned wIndex) : mIndex(wIndex), mPool(NULL), mID(0), mSRES(NULL) {}
+
+	void open(EventPool *pool, uint64_t id)
+	{
+		mPool = pool;
+		mID = id;
+	}
+
+	void send(const GSM::L3Message &msg)
+	{
+		Outcome &o = sOutcomes[mIndex];
+		GSM::L3Frame f(msg);
+		size_t rp = 8;
+		unsigned MTI = f.readField(rp, 8) & 0x3f;
+		vector<unsigned char> bytes;
+		bytes.push_back(GSM::L3MobilityManagementPD);
+		switch (MTI) {
+		case GSM::L3MMMessage::IdentityRequest:
+			o.mIdentityRequests++;
+			bytes.push_back(GSM::L3MMMessage::IdentityResponse);
+			writeIMSI(bytes, IMSIOf(mIndex));
+			reply(bytes);
+			break;
+		case GSM::L3MMMessage::AuthenticationRequest: {
+			o.mAuthRequests++;
+			rp += 8;
+			string RAND;
+			for (unsigned i = 0; i < 4; i++) {
+				RAND += hex32(f.readField(rp, 32));
+			}
+			uint32_t sres = A3(RAND, IMSIOf(mIndex).c_str());
+			bytes.push_back(GSM::L3MMMessage::AuthenticationResponse);
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				bytes.push_back(sres >> shift);
+			}
+			reply(bytes);
+			break;
+		}
+		case GSM::L3MMMessage::LocationUpdatingAccept:
+			o.mAccepts++;
+			// With a mobile identity after the LAI, there's a TMSI to take.
+			if (f.size() > 7 * 8) {
+				o.mNewTMSI = true;
+				bytes.push_back(0x1b); // TMSI Reallocation Complete.
+				reply(bytes);
+			}
+			break;
+		case GSM::L3MMMessage::LocationUpdatingReject:
+			o.mRejects++;
+			o.mRejectCause = f.peekField(16, 8);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void registerIMSI(const char *IMSI, const string &RAND, const char *SRES)
+	{
+		mRAND = RAND;
+		mSRESBuf = SRES ? SRES : "";
+		mSRES = SRES ? mSRESBuf.c_str() : NULL;
+		sRegistrar->request(mPool, mID, NULL, IMSI, mRAND, mSRES);
+	}
+
+	void retransmit() { sRegistrar->request(mPool, mID, NULL, IMSIOf(mIndex).c_str(), mRAND, mSRES); }
+
+	void close(unsigned cause, const char *IMSI, const char *welcome, const char *shortCode)
+	{
+		Outcome &o = sOutcomes[mIndex];
+		o.mReleaseCause = cause;
+		o.mWelcome = welcome;
+		__atomic_store_n(&o.mEndNs, nanoseconds(), __ATOMIC_RELEASE);
+	}
+};
+
+static double quantile(vector<double> v, double q)
+{
+	if (v.empty())
+		return 0;
+	sort(v.begin(), v.end());
+	return v[(size_t)(q * (v.size() - 1))];
+}
+
+static const unsigned sDelayMs = 20;
+static const int sTimerF = 1500;
+
+static double testLoad(unsigned count, unsigned workers)
+{
+	GSM::L3LocationAreaIdentity LAI("001", "01", 1000);
+	sOutcomes.assign(count, Outcome());
+	vector<GSM::L3LocationUpdatingRequest *> lurs(count);
+	for (unsigned i = 0; i < count; i++) {
+		lurs[i] = makeLUR(i);
+		sOutcomes[i].mReleaseCause = -1;
+	}
+	sRegistrar = new StubRegistrar(sDelayMs);
+	EventPool *pool = new EventPool("LUR", workers);
+
+	uint64_t start = nanoseconds();
+	for (unsigned i = 0; i < count; i++) {
+		sOutcomes[i].mStartNs = nanoseconds();
+		LocationUpdating::start(pool, *lurs[i], LAI, new TestPeer(i));
+	}
+	uint64_t started = nanoseconds();
+	unsigned peak = 0;
+	while (pool->handlers() && nanoseconds() - start < 60000000000ULL) {
+		peak = max(peak, pool->handlers());
+		usleep(1000);
+	}
+
+	// Everything but the silent ones, which wait out Timer F and the hold.
+	uint64_t lastNormal = 0;
+	vector<double> latencyMs;
+	unsigned accepted = 0, rejected = 0, timedOut = 0, unfinished = 0;
+	bool ok = true;
+	for (unsigned i = 0; i < count; i++) {
+		const Outcome &o = sOutcomes[i];
+		uint64_t end = __atomic_load_n(&o.mEndNs, __ATOMIC_ACQUIRE);
+		if (o.mReleaseCause < 0) {
+			unfinished++;
+			continue;
+		}
+		ok &= o.mIdentityRequests == (i % 4 == 1 ? 1u : 0u);
+		switch (kind(i)) {
+		case Normal:
+		case LostOnce:
+			ok &= o.mAccepts == 1 && o.mRejects == 0 && o.mAuthRequests == 1 && o.mNewTMSI &&
+			      o.mReleaseCause == 0 && o.mWelcome && strstr(o.mWelcome, "NormalRegistration");
+			accepted++;
+			break;
+		case Unknown:
+			ok &= o.mAccepts == 0 && o.mRejects == 1 && o.mRejectCause == 4 && o.mAuthRequests == 0 &&
+			      o.mWelcome && strstr(o.mWelcome, "FailedRegistration");
+			rejected++;
+			break;
+		case Silent:
+			ok &= o.mAccepts == 0 && o.mRejects == 1 && o.mRejectCause == 0x11 && o.mReleaseCause == 0;
+			timedOut++;
+			break;
+		}
+		if (kind(i) != Silent) {
+			lastNormal = max(lastNormal, end);
+			latencyMs.push_back((end - o.mStartNs) * 1e-6);
+		}
+	}
+	double seconds = (lastNormal - start) * 1e-9;
+	double rate = (accepted + rejected) / seconds;
+	printf("%u registrations on %u workers, registrar %u ms away: started in %.0f ms, %u in flight at most\n", count,
+		workers, sDelayMs, (started - start) * 1e-6, peak);
+	printf("%u accepted, %u rejected in %.2f s, %.0f a second; latency p50/p99/max %.0f/%.0f/%.0f ms\n", accepted,
+		rejected, seconds, rate, quantile(latencyMs, 0.5), quantile(latencyMs, 0.99), quantile(latencyMs, 1.0));
+	printf("%u timed out; registrar: %u REGISTERs, %u lost, %u challenges, %u verified; %llu events, %llu dropped\n",
+		timedOut, sRegistrar->mRequests, sRegistrar->mLost, sRegistrar->mChallenges, sRegistrar->mVerified,
+		(unsigned long long)pool->handled(), (unsigned long long)pool->dropped());
+	check("every procedure finished", unfinished == 0 && pool->handlers() == 0);
+	check("accepts, rejects and timeouts as the registrar said", ok);
+	unsigned lostOnce = 0;
+	for (unsigned i = 0; i < count; i++) {
+		lostOnce += kind(i) == LostOnce;
+	}
+	check("lost REGISTERs retransmitted", sRegistrar->mVerified == accepted && sRegistrar->mChallenges >= accepted &&
+						      sRegistrar->mLost >= lostOnce + timedOut);
+
+	delete pool;
+	delete sRegistrar;
+	for (unsigned i = 0; i < count; i++) {
+		delete lurs[i];
+	}
+	return rate;
+}
+
+// The same registrations, one at a time, blocking on each answer as the dispatcher thread did.
+static double testBlocking(unsigned count)
+{
+	sRegistrar = new StubRegistrar(sDelayMs);
+	InterthreadQueue<RegistrarEvent> q;
+	unsigned done = 0;
+	uint64_t start = nanoseconds();
+	for (unsigned i = 0; done < count; i++) {
+		if (kind(i) == Silent || kind(i) == LostOnce)
+			continue;
+		string IMSI = IMSIOf(i);
+		sRegistrar->request(NULL, 0, &q, IMSI.c_str(), "", NULL);
+		RegistrarEvent *r = q.read();
+		if (r->mStatus == 401) {
+			string SRES = hex32(A3(r->mRAND, IMSI.c_str()));
+			sRegistrar->request(NULL, 0, &q, IMSI.c_str(), r->mRAND, SRES.c_str());
+			delete r;
+			r = q.read();
+		}
+		delete r;
+		done++;
+	}
+	double rate = done / ((nanoseconds() - start) * 1e-9);
+	printf("%u registrations one at a time: %.0f a second\n", done, rate);
+	delete sRegistrar;
+	return rate;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("LURLoadTest", "EMERG");
+	gConfig.set("SIP.Timer.E", 500);
+	gConfig.set("SIP.Timer.F", sTimerF);
+	gConfig.set("SIP.Proxy.Registration", "127.0.0.1:5064");
+	gConfig.set("Control.LUR.DefaultAuthenticationAccept", 1);
+	gConfig.set("Control.LUR.QueryIMEI", 0);
+	gConfig.set("Control.LUR.QueryClassmark", 0);
+	gConfig.set("Control.LUR.SendTMSIs", 1);
+	gConfig.set("Control.LUR.UnprovisionedRejectCause", 4);
+	gConfig.set("UMTS.Identity.MCC", "001");
+	gConfig.set("UMTS.Identity.MNC", "01");
+	gConfig.set("UMTS.Identity.LAC", 1000);
+	gConfig.set("UMTS.Identity.ShortName", "LURLoadTest");
+	gConfig.set("GSM.ShowCountry", 0);
+	gTMSITable = new TMSITable(":memory:");
+
+	unsigned count = argc > 1 ? atoi(argv[1]) : 4000;
+	double rate = testLoad(count, 4);
+	double blockingRate = testBlocking(50);
+	check("10x the registrations of one at a time", rate > 10 * blockingRate);
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
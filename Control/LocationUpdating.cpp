@@ -0,0 +1,442 @@
+/**@file The Location Updating procedure as a state machine, GSM 04.08 4.4.4. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2008, 2009, 2010 Free Software Foundation, Inc.
+ * Copyright 2011, 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdlib.h>
+
+#include <sstream>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
+#include <CommonLibs/Utils.h>
+#include <GSM/GSML3Message.h>
+#include <GSM/GSML3RRMessages.h>
+#include <GSM/GSMTransfer.h>
+
+#include "LocationUpdating.h"
+#include "TMSITable.h"
+
+#undef WARNING
+
+using namespace Control;
+using namespace std;
+
+static StatGauge sActive("Control.LUR.Active", "location updating procedures in progress");
+static StatCounter sCompleted("Control.LUR.Completed", "location updating procedures finished");
+static StatHistogram sLatency("Control.LUR.Latency", "us", "from the Location Updating Request to the release");
+
+static ConfigHandle<int> sTimerE("SIP.Timer.E");
+static ConfigHandle<int> sTimerF("SIP.Timer.F");
+
+// How long the MS has to answer, as getMessage() waited.
+static const unsigned sGuardMs = 20000;
+
+L3FrameEvent::L3FrameEvent(GSM::L3Frame *wFrame) : Event(UplinkFrame), mFrame(wFrame) {}
+
+L3FrameEvent::~L3FrameEvent() { delete mFrame; }
+
+RegistrarEvent::RegistrarEvent(int wStatus, const string &wRAND)
+	: Event(RegistrarResponse), mStatus(wStatus), mRAND(wRAND)
+{
+}
+
+LocationUpdating::LocationUpdating(const GSM::L3LocationUpdatingRequest &wLUR,
+	const GSM::L3LocationAreaIdentity &wLAI, LURPeer *wPeer)
+	: mLUR(wLUR), mLAI(wLAI), mPeer(wPeer), mState(Idle), mStartNs(statNanoseconds()),
+	  mMobileID(wLUR.mobileID()), mPreexistingTMSI(0), mNewTMSI(0), mIMSIAttach(false), mSuccess(false),
+	  mAuthenticateOK(false), mUpperRAND(0), mLowerRAND(0)
+{
+}
+
+LocationUpdating::~LocationUpdating()
+{
+	// Still going when the pool was shut down.
+	if (mState != Idle)
+		sActive.add(-1);
+	delete mPeer;
+}
+
+void LocationUpdating::start(EventPool *pool, const GSM::L3LocationUpdatingRequest &lur,
+	const GSM::L3LocationAreaIdentity &LAI, LURPeer *peer)
+{
+	uint64_t id = pool->add(new LocationUpdating(lur, LAI, peer));
+	pool->post(id, new Event(ProcedureStart));
+}
+
+void LocationUpdating::handle(Event *event)
+{
+	switch (event->type()) {
+	case ProcedureStart:
+		begin();
+		break;
+	case UplinkFrame:
+		handleFrame(static_cast<L3FrameEvent *>(event)->frame());
+		break;
+	case RegistrarResponse:
+		handleRegistrar(*static_cast<RegistrarEvent *>(event));
+		break;
+	case Event::Timer:
+		handleTimer(static_cast<TimerEvent *>(event)->tag());
+		break;
+	default:
+		LOG(ERR) << "unknown event type " << event->type();
+	}
+}
+
+// Wait for the MS.
+void LocationUpdating::expect(State state)
+{
+	mState = state;
+	startTimer(GuardTimer, sGuardMs);
+}
+
+void LocationUpdating::begin()
+{
+	sActive.add(1);
+	mPeer->open(pool(), id());
+	LOG(INFO) << mLUR;
+
+	// The location updating request gets mapped to a SIP registration.
+	// Resolve an IMSI, as resolveIMSI() does, and see if there's a pre-existing IMSI-TMSI mapping.
+	if (mMobileID.type() == GSM::IMSIType) {
+		mPreexistingTMSI = gTMSITable->TMSI(IMSI());
+		identified();
+		return;
+	}
+	// FIXME -- Should send MM Reject, cause 0x60, "invalid mandatory information".
+	if (mMobileID.type() == GSM::IMEIType) {
+		close(0x62);
+		return;
+	}
+	// Must be a TMSI.  Look in the table to see if it's one we assigned.
+	unsigned TMSI = mMobileID.TMSI();
+	char *IMSI = NULL;
+	if (mLUR.LAI() == mLAI)
+		IMSI = gTMSITable->IMSI(TMSI);
+	if (IMSI) {
+		mMobileID = GSM::L3MobileIdentity(IMSI);
+		free(IMSI);
+		mPreexistingTMSI = TMSI;
+		identified();
+		return;
+	}
+	// Not our TMSI.  Ask for the IMSI.
+	mPeer->send(GSM::L3IdentityRequest(GSM::IMSIType));
+	expect(Identifying);
+}
+
+void LocationUpdating::identified()
+{
+	LOG(DEBUG) << "resolved mobile ID " << mMobileID << ", TMSI " << mPreexistingTMSI;
+	// IMSIAttach set to true if this is a new registration.
+	mIMSIAttach = mPreexistingTMSI == 0;
+	// We generate a TMSI for every new phone we see, even if we don't actually assign it.
+	if (!mPreexistingTMSI)
+		mNewTMSI = gTMSITable->assign(IMSI(), &mLUR);
+	registerIMSI(NULL);
+}
+
+void LocationUpdating::registerIMSI(const char *SRES)
+{
+	LOG(DEBUG) << "registering " << IMSI();
+	mPeer->registerIMSI(IMSI(), SRES ? mRAND : string(), SRES);
+	mState = SRES ? Verifying : Registering;
+	stopTimer(GuardTimer);
+	startTimer(TimerE, sTimerE);
+	startTimer(TimerF, sTimerF);
+}
+
+void LocationUpdating::handleRegistrar(const RegistrarEvent &event)
+{
+	if (mState != Registering && mState != Verifying) {
+		LOG(NOTICE) << "stray registrar response " << event.mStatus << " for " << IMSI();
+		return;
+	}
+	stopTimer(TimerE);
+	stopTimer(TimerF);
+	LOG(INFO) << "received status " << event.mStatus << " for " << IMSI();
+	if (event.mStatus == 200) {
+		LOG(INFO) << "REGISTER success";
+		mSuccess = true;
+	} else if (event.mStatus == 401) {
+		// If RAND is included on 401 unauthorized, then the challenge-response game is afoot.
+		if (mState == Registering && event.mRAND.length() != 0) {
+			LOG(INFO) << "sending " << event.mRAND << " to mobile";
+			mRAND = event.mRAND;
+			uint64_t uRAND, lRAND;
+			stringToUint(mRAND, &uRAND, &lRAND);
+			mPeer->send(GSM::L3AuthenticationRequest(0, GSM::L3RAND(uRAND, lRAND)));
+			expect(Authenticating);
+			return;
+		}
+		LOG(INFO) << "REGISTER fail -- unauthorized";
+	} else if (event.mStatus == 404) {
+		LOG(INFO) << "REGISTER fail -- not found";
+	} else {
+		LOG(NOTICE) << "REGISTER unexpected response " << event.mStatus;
+	}
+	registered();
+}
+
+void LocationUpdating::registered()
+{
+	// Authentication.
+	// If no method is assigned, assume authentication is not required.
+	mAuthenticateOK = gConfig.defines("Control.LUR.DefaultAuthenticationAccept");
+
+	// RAND-SRES Exchange compared to cache?
+	// The tokens are never read back from the table, so this is always the first time.
+	if (gConfig.defines("Control.LUR.CachedAuthentication")) {
+		LOG(NOTICE) << "First cache-based authentication for " << IMSI();
+		// Generate 128 bits of RAND.
+		mUpperRAND = random();
+		mUpperRAND = (mUpperRAND << 32) + random();
+		mLowerRAND = random();
+		mLowerRAND = (mLowerRAND << 32) + random();
+		mPeer->send(GSM::L3AuthenticationRequest(0, GSM::L3RAND(mUpperRAND, mLowerRAND)));
+		expect(CachedAuthenticating);
+		return;
+	}
+	authenticated();
+}
+
+void LocationUpdating::authenticated()
+{
+	if (!mAuthenticateOK && !gConfig.defines("Control.LUR.OpenRegistration")) {
+		LOG(CRIT) << "failed authentication for IMSI " << IMSI();
+		mPeer->send(GSM::L3AuthenticationReject());
+		close(0);
+		return;
+	}
+	queryIMEI();
+}
+
+void LocationUpdating::queryIMEI()
+{
+	if (mIMSIAttach && gConfig.getBool("Control.LUR.QueryIMEI")) {
+		mPeer->send(GSM::L3IdentityRequest(GSM::IMEIType));
+		expect(QueryingIMEI);
+		return;
+	}
+	queryClassmark();
+}
+
+void LocationUpdating::queryClassmark()
+{
+	if (mIMSIAttach && gConfig.getBool("Control.LUR.QueryClassmark")) {
+		mPeer->send(GSM::L3ClassmarkEnquiry());
+		expect(QueryingClassmark);
+		return;
+	}
+	decide();
+}
+
+void LocationUpdating::decide()
+{
+	// We fail closed unless we're configured otherwise.
+	if (!mSuccess && !gConfig.defines("Control.LUR.OpenRegistration")) {
+		LOG(INFO) << "registration FAILED: " << mMobileID;
+		mPeer->send(GSM::L3LocationUpdatingReject(gConfig.getNum("Control.LUR.UnprovisionedRejectCause")));
+		if (!mPreexistingTMSI) {
+			close(0, "Control.LUR.FailedRegistration.Message", "Control.LUR.FailedRegistration.ShortCode");
+		} else {
+			close(0);
+		}
+		return;
+	}
+
+	// If success is true, we had a normal registration.
+	// Otherwise, we are here because of open registration.
+	if (mSuccess) {
+		LOG(INFO) << "registration SUCCESS: " << mMobileID;
+	} else {
+		LOG(INFO) << "registration ALLOWED: " << mMobileID;
+	}
+
+	// Send the "short name" and time-of-day.
+	if (mIMSIAttach && gConfig.defines("UMTS.Identity.ShortName")) {
+		mPeer->send(GSM::L3MMInformation(gConfig.getStr("UMTS.Identity.ShortName").c_str()));
+	}
+	// Accept. Make a TMSI assignment, too, if needed.
+	if (mPreexistingTMSI || !gConfig.getBool("Control.LUR.SendTMSIs")) {
+		mPeer->send(GSM::L3LocationUpdatingAccept(mLAI));
+		accepted();
+		return;
+	}
+	assert(mNewTMSI);
+	mPeer->send(GSM::L3LocationUpdatingAccept(mLAI, mNewTMSI));
+	// Wait for MM TMSI REALLOCATION COMPLETE (0x055b), but not for long.
+	mState = Reallocating;
+	startTimer(GuardTimer, 1000);
+}
+
+void LocationUpdating::accepted()
+{
+	// If this is an IMSI attach, send a welcome message.
+	if (!mIMSIAttach) {
+		close(0);
+	} else if (mSuccess) {
+		close(0, "Control.LUR.NormalRegistration.Message", "Control.LUR.NormalRegistration.ShortCode");
+	} else {
+		close(0, "Control.LUR.OpenRegistration.Message", "Control.LUR.OpenRegistration.ShortCode");
+	}
+}
+
+void LocationUpdating::handleFrame(const GSM::L3Frame &frame)
+{
+	switch (mState) {
+	case Identifying:
+	case Authenticating:
+	case CachedAuthenticating:
+	case QueryingIMEI:
+	case QueryingClassmark:
+		break;
+	case Reallocating:
+		// FIXME -- Actually check the response type.
+		LOG(INFO) << frame;
+		stopTimer(GuardTimer);
+		accepted();
+		return;
+	default:
+		// Not waiting for the MS; it can wait for us.
+		LOG(NOTICE) << "ignoring " << frame << " from " << mMobileID << " in state " << mState;
+		return;
+	}
+	stopTimer(GuardTimer);
+	if (frame.primitive() != GSM::DATA) {
+		LOG(NOTICE) << "unexpected primitive " << frame.primitive();
+		// Cause 0x62 means "message type not not compatible with protocol state".
+		close(0x62);
+		return;
+	}
+	GSM::L3Message *msg = GSM::parseL3(frame);
+	if (!msg) {
+		LOG(NOTICE) << "unparsed message";
+		// Cause 0x61 means "message type not implemented".
+		close(0x61);
+		return;
+	}
+	LOG(INFO) << *msg;
+	handleMessage(msg);
+	delete msg;
+}
+
+void LocationUpdating::handleMessage(const GSM::L3Message *msg)
+{
+	switch (mState) {
+	case Identifying:
+		if (const GSM::L3IdentityResponse *resp = dynamic_cast<const GSM::L3IdentityResponse *>(msg)) {
+			mMobileID = resp->mobileID();
+			// FIXME -- Should send MM Reject, cause 0x60, "invalid mandatory information".
+			if (mMobileID.type() != GSM::IMSIType)
+				break;
+			// We have not yet assigned our own TMSI for this phone.
+			mPreexistingTMSI = 0;
+			identified();
+			return;
+		}
+		break;
+	case Authenticating:
+		if (const GSM::L3AuthenticationResponse *resp = dynamic_cast<const GSM::L3AuthenticationResponse *>(msg)) {
+			// Verify the mobile's SRES with the registrar.
+			ostringstream os;
+			os << hex << resp->SRES().value();
+			registerIMSI(os.str().c_str());
+			return;
+		}
+		break;
+	case CachedAuthenticating:
+		if (const GSM::L3AuthenticationResponse *resp = dynamic_cast<const GSM::L3AuthenticationResponse *>(msg)) {
+			gTMSITable->putAuthTokens(IMSI(), mUpperRAND, mLowerRAND, resp->SRES().value());
+			mAuthenticateOK = true;
+			LOG(INFO) << "cache-based authentication for IMSI " << IMSI() << " result " << mAuthenticateOK;
+			authenticated();
+			return;
+		}
+		break;
+	case QueryingIMEI:
+		if (const GSM::L3IdentityResponse *resp = dynamic_cast<const GSM::L3IdentityResponse *>(msg)) {
+			if (!gTMSITable->IMEI(IMSI(), resp->mobileID().digits()))
+				LOG(WARNING) << "failed access to TMSITable";
+			queryClassmark();
+			return;
+		}
+		break;
+	case QueryingClassmark:
+		if (const GSM::L3ClassmarkChange *resp = dynamic_cast<const GSM::L3ClassmarkChange *>(msg)) {
+			if (!gTMSITable->classmark(IMSI(), resp->classmark()))
+				LOG(WARNING) << "failed access to TMSITable";
+			decide();
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+	LOG(WARNING) << "Unexpected message " << *msg;
+	// Cause 0x62 means "message type not not compatible with protocol state".
+	close(0x62);
+}
+
+void LocationUpdating::handleTimer(unsigned tag)
+{
+	switch (tag) {
+	case TimerE:
+		mPeer->retransmit();
+		startTimer(TimerE, sTimerE);
+		return;
+	case TimerF:
+		stopTimer(TimerE);
+		if (mState == Verifying) {
+			LOG(ALERT) << "SIP authentication timed out.  Is the proxy running at "
+				   << gConfig.getStr("SIP.Proxy.Registration");
+		} else {
+			LOG(ALERT) << "SIP registration timed out.  Is the proxy running at "
+				   << gConfig.getStr("SIP.Proxy.Registration");
+		}
+		// Reject with a "network failure" cause code, 0x11, and give the MS time to take it before the release.
+		mPeer->send(GSM::L3LocationUpdatingReject(0x11));
+		mState = Holding;
+		startTimer(GuardTimer, 4000);
+		return;
+	case GuardTimer:
+		if (mState == Holding) {
+			close(0);
+		} else if (mState == Reallocating) {
+			LOG(NOTICE) << "no response to TMSI assignment";
+			accepted();
+		} else {
+			LOG(NOTICE) << "timeout in state " << mState << " for " << mMobileID;
+			// Cause 0x03 means "abnormal release, timer expired".
+			close(0x03);
+		}
+		return;
+	}
+}
+
+void LocationUpdating::close(unsigned cause, const char *welcome, const char *shortCode)
+{
+	stopTimer(GuardTimer);
+	stopTimer(TimerE);
+	stopTimer(TimerF);
+	mPeer->close(cause, mMobileID.type() == GSM::IMSIType ? IMSI() : NULL, welcome, shortCode);
+	sActive.add(-1);
+	sCompleted.inc();
+	sLatency.record((statNanoseconds() - mStartNs) / 1000);
+	mState = Idle;
+	finish();
+}
@@ -0,0 +1,168 @@
+/**@file The Location Updating procedure as a state machine, GSM 04.08 4.4.4. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef LOCATIONUPDATING_H
+#define LOCATIONUPDATING_H
+
+#include <string>
+
+#include <GSM/GSML3CommonElements.h>
+#include <GSM/GSML3MMMessages.h>
+
+#include "EventPool.h"
+
+namespace GSM {
+class L3Frame;
+class L3Message;
+} // namespace GSM
+
+namespace Control {
+
+/** The events of the procedures on a DCCH, besides the pool's own. */
+enum DCCHEventType { ProcedureStart = 0, UplinkFrame = 1, RegistrarResponse = 2 };
+
+/** A frame from the MS, posted by the channel the procedure listens on.  The event owns the frame. */
+class L3FrameEvent : public Event {
+	GSM::L3Frame *mFrame;
+
+public:
+	L3FrameEvent(GSM::L3Frame *wFrame);
+	~L3FrameEvent();
+
+	const GSM::L3Frame &frame() const { return *mFrame; }
+};
+
+/** The final response to a REGISTER. */
+class RegistrarEvent : public Event {
+public:
+	int mStatus;
+	std::string mRAND; ///< The challenge of a 401, or empty.
+
+	RegistrarEvent(int wStatus, const std::string &wRAND);
+};
+
+/**
+	What a LocationUpdating procedure talks to: the MS on its DCCH, and the registrar.
+	None of these may block.  Frames from the MS come back to the procedure as L3FrameEvents and responses
+	from the registrar as RegistrarEvents, on the pool and id given to open().  The procedure owns its peer.
+*/
+class LURPeer {
+public:
+	virtual ~LURPeer() {}
+
+	/** Start sending the procedure its events. */
+	virtual void open(EventPool *pool, uint64_t id) = 0;
+
+	/** Send a message to the MS. */
+	virtual void send(const GSM::L3Message &msg) = 0;
+
+	/**
+		Send a REGISTER for an IMSI, as a new transaction.
+		@param RAND The challenge answered, or empty.
+		@param SRES The MS's response to it, or NULL.
+	*/
+	virtual void registerIMSI(const char *IMSI, const std::string &RAND, const char *SRES) = 0;
+
+	/** Send the last REGISTER again. */
+	virtual void retransmit() = 0;
+
+	/**
+		Stop sending events, optionally send the MS a welcome message, and release the channel.
+		The message may be sent after close() returns, but the peer does not send events any more.
+		@param cause The cause for the Channel Release.
+		@param welcome The name of the configuration key with the message, or NULL.
+		@param shortCode The name of the key with the short code the message comes from.
+	*/
+	virtual void close(unsigned cause, const char *IMSI = NULL, const char *welcome = NULL,
+		const char *shortCode = NULL) = 0;
+};
+
+/**
+	The Location Updating procedure with one MS, GSM 04.08 4.4.4, mapped to a SIP registration.
+	It does what LocationUpdatingController did, step for step, but as a state machine on an EventPool: each step
+	sends something and returns, and the answer, or the timeout, is the next event.  Timer E retransmits the
+	REGISTER and Timer F gives up on it, as the blocking SIPEngine::Register did.
+*/
+class LocationUpdating : public EventHandler {
+public:
+	enum State {
+		Idle,
+		Identifying,	   ///< Waiting for the IMSI of an unknown TMSI.
+		Registering,	   ///< Waiting for the registrar.
+		Authenticating,	   ///< Waiting for the MS to answer the registrar's challenge.
+		Verifying,	   ///< Waiting for the registrar to check the MS's answer.
+		CachedAuthenticating, ///< Waiting for the MS to answer our own challenge.
+		QueryingIMEI,
+		QueryingClassmark,
+		Reallocating,	   ///< Waiting for TMSI Reallocation Complete.
+		Holding		   ///< After a Location Updating Reject for the network failure, before the release.
+	};
+
+private:
+	enum { GuardTimer = 0, TimerE = 1, TimerF = 2 };
+
+	GSM::L3LocationUpdatingRequest mLUR;
+	GSM::L3LocationAreaIdentity mLAI; ///< Ours.
+	LURPeer *mPeer;
+	State mState;
+	uint64_t mStartNs;
+
+	GSM::L3MobileIdentity mMobileID;
+	unsigned mPreexistingTMSI;
+	unsigned mNewTMSI;
+	bool mIMSIAttach;
+	bool mSuccess; ///< The registrar accepted the MS.
+	bool mAuthenticateOK;
+	std::string mRAND;
+	uint64_t mUpperRAND, mLowerRAND; ///< Of our own challenge, for CachedAuthentication.
+
+	const char *IMSI() const { return mMobileID.digits(); }
+
+	void begin();
+	void identified();
+	void registerIMSI(const char *SRES);
+	void registered();
+	void authenticated();
+	void queryIMEI();
+	void queryClassmark();
+	void decide();
+	void accepted();
+
+	void expect(State state);
+	void handleFrame(const GSM::L3Frame &frame);
+	void handleMessage(const GSM::L3Message *msg);
+	void handleRegistrar(const RegistrarEvent &event);
+	void handleTimer(unsigned tag);
+	void close(unsigned cause, const char *welcome = NULL, const char *shortCode = NULL);
+
+public:
+	/** @param wLAI Our location area, to which the MS updates. */
+	LocationUpdating(const GSM::L3LocationUpdatingRequest &wLUR, const GSM::L3LocationAreaIdentity &wLAI,
+		LURPeer *wPeer);
+	~LocationUpdating();
+
+	/** Start a procedure on a pool.  This returns at once; the procedure releases the channel when it is done. */
+	static void start(EventPool *pool, const GSM::L3LocationUpdatingRequest &lur,
+		const GSM::L3LocationAreaIdentity &LAI, LURPeer *peer);
+
+	void handle(Event *event);
+
+	State state() const { return mState; }
+};
+
+} // namespace Control
+
+#endif
@@ -30,6 +30,7 @@
 
 #include "CallControl.h"
 #include "ControlCommon.h"
+#include "LocationUpdating.h"
 #include "MobilityManagement.h"
 #include "SMSControl.h"
 
@@ -86,56 +87,6 @@ void Control::IMSIDetachController(const GSM::L3IMSIDetachIndication *idi, UMTS:
 	DCCH->send(GSM::HARDRELEASE);
 }
 
-bool authenticateViaCaching(const char *IMSI, UMTS::DCCHLogicalChannel *DCCH)
-{
-	uint64_t uRAND = 0, lRAND = 0;
-	uint32_t SRES = 0;
-	// bool foundIMSI = gTMSITable->getAuthTokens(IMSI,uRAND,lRAND,SRES);
-
-	// First time?
-	if (!uRAND) {
-		LOG(NOTICE) << "First cache-based authentication for " << IMSI;
-		// Generate 128 bits of RAND.
-		uRAND = random();
-		uRAND = (uRAND << 32) + random();
-		lRAND = random();
-		lRAND = (lRAND << 32) + random();
-		// Do the transaction.
-		DCCH->send(GSM::L3AuthenticationRequest(0, GSM::L3RAND(uRAND, lRAND)));
-		GSM::L3Message *msg = getMessage(DCCH);
-		GSM::L3AuthenticationResponse *resp = dynamic_cast<GSM::L3AuthenticationResponse *>(msg);
-		if (!resp) {
-			if (msg) {
-				LOG(WARNING) << "Unexpected message " << *msg;
-				delete msg;
-			}
-			throw UnexpectedMessage();
-		}
-		LOG(INFO) << *resp;
-		gTMSITable->putAuthTokens(IMSI, uRAND, lRAND, resp->SRES().value());
-		delete msg;
-		return true;
-	}
-
-	// Next time.
-	// Do the transaction using tokens from the table.
-	DCCH->send(GSM::L3AuthenticationRequest(0, GSM::L3RAND(uRAND, lRAND)));
-	GSM::L3Message *msg = getMessage(DCCH);
-	GSM::L3AuthenticationResponse *resp = dynamic_cast<GSM::L3AuthenticationResponse *>(msg);
-	if (!resp) {
-		if (msg) {
-			LOG(WARNING) << "Unexpected message " << *msg;
-			delete msg;
-		}
-		throw UnexpectedMessage();
-	}
-	LOG(INFO) << *resp;
-	// Compare and reject if comparison failed.
-	bool OK = SRES == resp->SRES().value();
-	delete msg;
-	return OK;
-}
-
 /**
 	Send a given welcome message from a given short code.
 	@return true if it was sent
@@ -153,217 +104,151 @@ bool sendWelcomeMessage(const char *messageName, const char *shortCodeName, cons
 	return true;
 }
 
-/**
-	Controller for the Location Updating transaction, GSM 04.08 4.4.4.
-	@param lur The location updating request.
-	@param DCCH The Dm channel to the MS, which will be released by the function.
-*/
-void Control::LocationUpdatingController(const GSM::L3LocationUpdatingRequest *lur, UMTS::DCCHLogicalChannel *DCCH)
-{
-	assert(DCCH);
-	assert(lur);
-	LOG(INFO) << *lur;
-
-	// The location updating request gets mapped to a SIP
-	// registration with the Asterisk server.
+namespace {
 
-	// We also allocate a new TMSI for every handset we encounter.
-	// If the handset is allow to register it may receive a TMSI reassignment.
+/** Takes the responses to the REGISTERs of all LocationUpdating procedures, on the SIP workers. */
+class RegistrarListener : public SIPListener {
+public:
+	void sipMessage(osip_message_t *msg, uint64_t tag);
+};
 
-	// Resolve an IMSI and see if there's a pre-existing IMSI-TMSI mapping.
-	// This operation will throw an exception, caught in a higher scope,
-	// if it fails in the GSM domain.
-	GSM::L3MobileIdentity mobileID = lur->mobileID();
-	bool sameLAI = (lur->LAI() == gNodeB->LAI());
-	unsigned preexistingTMSI = resolveIMSI(sameLAI, mobileID, DCCH);
-	const char *IMSI = mobileID.digits();
-	// IMSIAttach set to true if this is a new registration.
-	bool IMSIAttach = (preexistingTMSI == 0);
+RegistrarListener sRegistrarListener;
 
-	// We assign generate a TMSI for every new phone we see,
-	// even if we don't actually assign it.
-	unsigned newTMSI = 0;
-	if (!preexistingTMSI)
-		newTMSI = gTMSITable->assign(IMSI, lur);
+/** A welcome message to send, and the channel to release after, once a procedure is done. */
+struct WelcomeJob {
+	string mIMSI;
+	const char *mWelcome, *mShortCode;
+	UMTS::DCCHLogicalChannel *mDCCH;
+};
 
-	// Try to register the IMSI with Asterisk.
-	// This will be set true if registration succeeded in the SIP world.
-	bool success = false;
-	string RAND;
-	try {
-		SIPEngine engine(gConfig.getStr("SIP.Proxy.Registration").c_str(), IMSI);
-		LOG(DEBUG) << "waiting for registration";
-		success = engine.Register(SIPEngine::SIPRegister, &RAND);
-	} catch (SIPTimeout) {
-		LOG(ALERT)
-		"SIP registration timed out.  Is the proxy running at " << gConfig.getStr("SIP.Proxy.Registration");
-		// Reject with a "network failure" cause code, 0x11.
-		DCCH->send(GSM::L3LocationUpdatingReject(0x11));
-		// HACK -- wait long enough for a response
-		// FIXME -- Why are we doing this?
-		sleep(4);
-		// Release the channel and return.
-		DCCH->send(GSM::L3ChannelRelease());
-		return;
-	}
+// sendWelcomeMessage blocks until the MS acks the SMS, for up to a timeout on each step, so it runs on these
+// threads and not on the pool.  The channel is held until the release, so the acks come to recv() here and not to
+// the DCCH dispatcher.
+InterthreadQueue<WelcomeJob> sWelcomeQ;
 
-	// Did we get a RAND for challenge-response?
-	if (RAND.length() != 0) {
-		// Get the mobile's SRES.
-		LOG(INFO) << "sending " << RAND << " to mobile";
-		uint64_t uRAND;
-		uint64_t lRAND;
-		stringToUint(RAND, &uRAND, &lRAND);
-		DCCH->send(GSM::L3AuthenticationRequest(0, GSM::L3RAND(uRAND, lRAND)));
-		GSM::L3Message *msg = getMessage(DCCH);
-		GSM::L3AuthenticationResponse *resp = dynamic_cast<GSM::L3AuthenticationResponse *>(msg);
-		if (!resp) {
-			if (msg) {
-				LOG(WARNING) << "Unexpected message " << *msg;
-				delete msg;
-			}
-			// FIXME -- We should differentiate between wrong message and no message at all.
-			throw UnexpectedMessage();
-		}
-		LOG(INFO) << *resp;
-		uint32_t mobileSRES = resp->SRES().value();
-		delete msg;
-		// verify SRES
+void *welcomeLoop(void *)
+{
+	while (true) {
+		WelcomeJob *job = sWelcomeQ.read();
 		try {
-			SIPEngine engine(gConfig.getStr("SIP.Proxy.Registration").c_str(), IMSI);
-			LOG(DEBUG) << "waiting for registration";
-			ostringstream os;
-			os << hex << mobileSRES;
-			string SRESstr = os.str();
-			success = engine.Register(SIPEngine::SIPRegister, &RAND, IMSI, SRESstr.c_str());
-		} catch (SIPTimeout) {
-			LOG(ALERT)
-			"SIP authentication timed out.  Is the proxy running at "
-				<< gConfig.getStr("SIP.Proxy.Registration");
-			// Reject with a "network failure" cause code, 0x11.
-			DCCH->send(GSM::L3LocationUpdatingReject(0x11));
-			// HACK -- wait long enough for a response
-			// FIXME -- Why are we doing this?
-			sleep(4);
-			// Release the channel and return.
-			DCCH->send(GSM::L3ChannelRelease());
-			return;
+			sendWelcomeMessage(job->mWelcome, job->mShortCode, job->mIMSI.c_str(), job->mDCCH);
+		} catch (ControlLayerException) {
+			LOG(NOTICE) << "welcome message to IMSI " << job->mIMSI << " failed";
 		}
+		job->mDCCH->send(GSM::L3ChannelRelease());
+		job->mDCCH->unlisten();
+		delete job;
 	}
+	return NULL;
+}
 
-	// This allows us to configure Open Registration
-	bool openRegistration = gConfig.defines("Control.LUR.OpenRegistration");
-
-	// Authentication.
-	// If no method is assigned, assume authentication is not required.
-	bool authenticateOK = gConfig.defines("Control.LUR.DefaultAuthenticationAccept");
+Mutex sLURPoolLock;
+EventPool *sLURPool = NULL;
 
-	// RAND-SRES Exchange compared to cache?
-	if (gConfig.defines("Control.LUR.CachedAuthentication")) {
-		authenticateOK = authenticateViaCaching(IMSI, DCCH);
-		LOG(INFO) << "cache-based authentication for IMSI " << IMSI << " result " << authenticateOK;
+EventPool *LURPool()
+{
+	ScopedLock lock(sLURPoolLock);
+	if (!sLURPool) {
+		sLURPool = new EventPool("LUR", gConfig.getNum("Control.LUR.Workers"));
+		unsigned welcomeThreads = gConfig.getNum("Control.LUR.WelcomeThreads");
+		for (unsigned i = 0; i < welcomeThreads; i++) {
+			Thread *thread = new Thread;
+			thread->start(welcomeLoop, NULL);
+		}
 	}
+	return sLURPool;
+}
 
-	if (!authenticateOK && !openRegistration) {
-		LOG(CRIT) << "failed authentication for IMSI " << IMSI;
-		DCCH->send(GSM::L3AuthenticationReject());
-		DCCH->send(GSM::L3ChannelRelease());
-		return;
+void RegistrarListener::sipMessage(osip_message_t *msg, uint64_t tag)
+{
+	int status = msg->status_code;
+	if (status >= 200) {
+		LOG(INFO) << "received status " << status << " " << msg->reason_phrase;
+		LURPool()->post(tag, new RegistrarEvent(status, randy401(msg)));
 	}
+	osip_message_free(msg);
+}
 
-	// Query for IMEI?
-	if (IMSIAttach && gConfig.getBool("Control.LUR.QueryIMEI")) {
-		DCCH->send(GSM::L3IdentityRequest(GSM::IMEIType));
-		GSM::L3Message *msg = getMessage(DCCH);
-		GSM::L3IdentityResponse *resp = dynamic_cast<GSM::L3IdentityResponse *>(msg);
-		if (!resp) {
-			if (msg) {
-				LOG(WARNING) << "Unexpected message " << *msg;
-				delete msg;
-			}
-			throw UnexpectedMessage();
-		}
-		LOG(INFO) << *resp;
-		if (!gTMSITable->IMEI(IMSI, resp->mobileID().digits()))
-			LOG(WARNING) << "failed access to TMSITable";
-		delete msg;
+/** A LocationUpdating procedure's DCCH and registrar: the channel to the MS, and a SIPEngine per REGISTER. */
+class DCCHPeer : public LURPeer {
+	UMTS::DCCHLogicalChannel *mDCCH;
+	EventPool *mPool;
+	uint64_t mID;
+	SIPEngine *mEngine;
+	osip_message_t *mREGISTER;
+
+	void endRegister()
+	{
+		if (!mEngine)
+			return;
+		gSIPInterface->removeCall(mEngine->callID());
+		osip_message_free(mREGISTER);
+		delete mEngine;
+		mEngine = NULL;
+		mREGISTER = NULL;
 	}
 
-	// Query for classmark?
-	if (IMSIAttach && gConfig.getBool("Control.LUR.QueryClassmark")) {
-		DCCH->send(GSM::L3ClassmarkEnquiry());
-		GSM::L3Message *msg = getMessage(DCCH);
-		GSM::L3ClassmarkChange *resp = dynamic_cast<GSM::L3ClassmarkChange *>(msg);
-		if (!resp) {
-			if (msg) {
-				LOG(WARNING) << "Unexpected message " << *msg;
-				delete msg;
-			}
-			throw UnexpectedMessage();
-		}
-		LOG(INFO) << *resp;
-		const GSM::L3MobileStationClassmark2 &classmark = resp->classmark();
-		if (!gTMSITable->classmark(IMSI, classmark))
-			LOG(WARNING) << "failed access to TMSITable";
-		delete msg;
+public:
+	DCCHPeer(UMTS::DCCHLogicalChannel *wDCCH) : mDCCH(wDCCH), mPool(NULL), mID(0), mEngine(NULL), mREGISTER(NULL)
+	{
 	}
 
-	// We fail closed unless we're configured otherwise
-	if (!success && !openRegistration) {
-		LOG(INFO) << "registration FAILED: " << mobileID;
-		DCCH->send(GSM::L3LocationUpdatingReject(gConfig.getNum("Control.LUR.UnprovisionedRejectCause")));
-		if (!preexistingTMSI) {
-			sendWelcomeMessage("Control.LUR.FailedRegistration.Message",
-				"Control.LUR.FailedRegistration.ShortCode", IMSI, DCCH);
-		}
-		// Release the channel and return.
-		DCCH->send(GSM::L3ChannelRelease());
-		return;
+	~DCCHPeer() { endRegister(); }
+
+	void open(EventPool *pool, uint64_t id)
+	{
+		mPool = pool;
+		mID = id;
+		mDCCH->listen(pool, id);
 	}
 
-	// If success is true, we had a normal registration.
-	// Otherwise, we are here because of open registration.
-	// Either way, we're going to register a phone if we arrive here.
+	void send(const GSM::L3Message &msg) { mDCCH->send(msg); }
 
-	if (success) {
-		LOG(INFO) << "registration SUCCESS: " << mobileID;
-	} else {
-		LOG(INFO) << "registration ALLOWED: " << mobileID;
+	void registerIMSI(const char *IMSI, const string &RAND, const char *SRES)
+	{
+		endRegister();
+		mEngine = new SIPEngine(gConfig.getStr("SIP.Proxy.Registration").c_str(), IMSI);
+		gSIPInterface->addCall(mEngine->callID(), &sRegistrarListener, mID);
+		string wRAND(RAND);
+		mREGISTER = mEngine->makeRegister(SIPEngine::SIPRegister, SRES ? &wRAND : NULL, SRES ? IMSI : NULL, SRES);
+		gSIPInterface->write(mEngine->proxyAddr(), mREGISTER);
 	}
 
-	// Send the "short name" and time-of-day.
-	if (IMSIAttach && gConfig.defines("UMTS.Identity.ShortName")) {
-		DCCH->send(GSM::L3MMInformation(gConfig.getStr("UMTS.Identity.ShortName").c_str()));
-	}
-	// Accept. Make a TMSI assignment, too, if needed.
-	if (preexistingTMSI || !gConfig.getBool("Control.LUR.SendTMSIs")) {
-		DCCH->send(GSM::L3LocationUpdatingAccept(gNodeB->LAI()));
-	} else {
-		assert(newTMSI);
-		DCCH->send(GSM::L3LocationUpdatingAccept(gNodeB->LAI(), newTMSI));
-		// Wait for MM TMSI REALLOCATION COMPLETE (0x055b).
-		GSM::L3Frame *resp = DCCH->recv(1000);
-		// FIXME -- Actually check the response type.
-		if (!resp) {
-			LOG(NOTICE) << "no response to TMSI assignment";
-		} else {
-			LOG(INFO) << *resp;
-		}
-		delete resp;
+	void retransmit()
+	{
+		if (mREGISTER)
+			gSIPInterface->write(mEngine->proxyAddr(), mREGISTER);
 	}
 
-	// If this is an IMSI attach, send a welcome message.
-	if (IMSIAttach) {
-		if (success) {
-			sendWelcomeMessage("Control.LUR.NormalRegistration.Message",
-				"Control.LUR.NormalRegistration.ShortCode", IMSI, DCCH);
-		} else {
-			sendWelcomeMessage("Control.LUR.OpenRegistration.Message",
-				"Control.LUR.OpenRegistration.ShortCode", IMSI, DCCH);
+	void close(unsigned cause, const char *IMSI, const char *welcome, const char *shortCode)
+	{
+		endRegister();
+		if (welcome && IMSI && gConfig.defines(welcome)) {
+			mDCCH->hold();
+			WelcomeJob *job = new WelcomeJob;
+			job->mIMSI = IMSI;
+			job->mWelcome = welcome;
+			job->mShortCode = shortCode;
+			job->mDCCH = mDCCH;
+			sWelcomeQ.write(job);
+			return;
 		}
+		mDCCH->unlisten();
+		mDCCH->send(GSM::L3ChannelRelease(cause));
 	}
+};
 
-	// Release the channel and return.
-	DCCH->send(GSM::L3ChannelRelease());
-	return;
+} // namespace
+
+/**
+	Controller for the Location Updating transaction, GSM 04.08 4.4.4.
+	This starts a LocationUpdating procedure on the LUR pool and returns; the procedure releases the channel.
+	@param lur The location updating request.
+	@param DCCH The Dm channel to the MS.
+*/
+void Control::LocationUpdatingController(const GSM::L3LocationUpdatingRequest *lur, UMTS::DCCHLogicalChannel *DCCH)
+{
+	assert(DCCH);
+	assert(lur);
+	LocationUpdating::start(LURPool(), *lur, gNodeB->LAI(), new DCCHPeer(DCCH));
 }
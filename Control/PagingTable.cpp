@@ -0,0 +1,240 @@
+/**@file Outstanding pages, indexed by mobile ID, on a timer wheel. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <CommonLibs/Logger.h>
+
+#include "PagingTable.h"
+
+using namespace std;
+using namespace RRC;
+
+PagingTable::PagingTable(unsigned wRepeatMs, unsigned wShare)
+	: mWheel(sWheelFrames), mStarted(false), mFrame(0), mSFNOffset(0), mCredit(0), mDeferred(0)
+{
+	configure(wRepeatMs, wShare);
+}
+
+void PagingTable::configure(unsigned wRepeatMs, unsigned wShare)
+{
+	mRepeatFrames = wRepeatMs / sFrameMs;
+	if (mRepeatFrames < 1)
+		mRepeatFrames = 1;
+	if (mRepeatFrames >= sWheelFrames)
+		mRepeatFrames = sWheelFrames - 1;
+	mShare = wShare;
+	if (mShare < 1)
+		mShare = 1;
+	if (mShare > 100)
+		mShare = 100;
+}
+
+// The IMSI as a decimal number, 25.304 8.3, mod gHyperframe, which every DRX cycle divides.
+static int IMSIOccasion(const char *IMSI)
+{
+	if (!IMSI || !*IMSI)
+		return -1;
+	unsigned occasion = 0;
+	for (const char *digit = IMSI; *digit; digit++) {
+		if (*digit < '0' || *digit > '9')
+			return -1;
+		occasion = (occasion * 10 + *digit - '0') % UMTS::gHyperframe;
+	}
+	return occasion;
+}
+
+bool PagingTable::occasion(const PagingEntry &entry, uint64_t frame) const
+{
+	return (frame + mSFNOffset) % mRepeatFrames == entry.mOccasion % mRepeatFrames;
+}
+
+void PagingTable::schedule(PagingEntry &entry)
+{
+	uint64_t due = mFrame + mRepeatFrames;
+	if (entry.mOccasion >= 0) {
+		// The first frame after this one whose SFN is the IMSI mod the DRX cycle.
+		uint64_t next = mFrame + 1;
+		unsigned at = (next + mSFNOffset) % mRepeatFrames;
+		due = next + (entry.mOccasion % mRepeatFrames + mRepeatFrames - at) % mRepeatFrames;
+	}
+	uint64_t expirationFrame = (entry.mExpiration + sFrameMs - 1) / sFrameMs;
+	if (expirationFrame < due)
+		due = expirationFrame;
+	if (due <= mFrame)
+		due = mFrame + 1;
+	entry.mDue = due;
+	mWheel[due % sWheelFrames].push_back(entry.mID);
+}
+
+bool PagingTable::add(const GSM::L3MobileIdentity &ID, UMTS::ChannelTypeL3 type, unsigned transactionID,
+	uint64_t expiration, const char *IMSI)
+{
+	PagingEntryMap::iterator it = mEntries.find(ID);
+	if (it != mEntries.end()) {
+		LOG(DEBUG) << ID << " already in table";
+		it->second.renew(expiration);
+		return false;
+	}
+	int occasion = IMSIOccasion(ID.type() == GSM::IMSIType ? ID.digits() : IMSI);
+	it = mEntries.insert(PagingEntryMap::value_type(ID, PagingEntry(ID, type, transactionID, expiration, occasion)))
+		     .first;
+	if (occasion < 0)
+		mFirst.push_back(ID);
+	else if (mStarted)
+		schedule(it->second);
+	LOG(INFO) << ID << " added to table";
+	return true;
+}
+
+unsigned PagingTable::remove(const GSM::L3MobileIdentity &ID)
+{
+	// Whatever the entry left in the wheel or the queues is skipped when it comes up.
+	PagingEntryMap::iterator it = mEntries.find(ID);
+	if (it == mEntries.end())
+		return 0;
+	unsigned transactionID = it->second.transactionID();
+	if (it->second.mDeferred)
+		mDeferred--;
+	mEntries.erase(it);
+	return transactionID;
+}
+
+PagingEntry *PagingTable::nextDue(deque<GSM::L3MobileIdentity> &queue, uint64_t now, vector<unsigned> &expired)
+{
+	while (!queue.empty()) {
+		PagingEntryMap::iterator it = mEntries.find(queue.front());
+		queue.pop_front();
+		// Removed, or renewed and paged since it was queued.
+		if (it == mEntries.end() || it->second.mDue != PagingEntry::sQueued)
+			continue;
+		if (it->second.expired(now)) {
+			LOG(INFO) << "erasing " << it->first;
+			expired.push_back(it->second.transactionID());
+			mEntries.erase(it);
+			continue;
+		}
+		return &it->second;
+	}
+	return NULL;
+}
+
+void PagingTable::service(uint64_t now, unsigned SFN, vector<PagingBatch> &messages, vector<unsigned> &expired)
+{
+	uint64_t nowFrame = now / sFrameMs;
+	// The SFN and the time are read apart, so an offset one frame off the last comes from reading them across a
+	// frame boundary, not from the radio clock moving.  Entries in the wheel for occasions a real move shifted
+	// are rescheduled as they come up.
+	unsigned offset = (SFN + UMTS::gHyperframe - nowFrame % UMTS::gHyperframe) % UMTS::gHyperframe;
+	unsigned drift = (offset + UMTS::gHyperframe - mSFNOffset) % UMTS::gHyperframe;
+	if (!mStarted || (drift > 1 && drift < UMTS::gHyperframe - 1))
+		mSFNOffset = offset;
+	if (!mStarted) {
+		mStarted = true;
+		mFrame = nowFrame ? nowFrame - 1 : 0;
+		// Entries added before there was a clock to find their occasions on.
+		for (PagingEntryMap::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+			if (it->second.mOccasion >= 0 && it->second.mDue == PagingEntry::sQueued)
+				schedule(it->second);
+		}
+	}
+
+	uint64_t frame = mFrame + 1;
+	if (nowFrame >= frame + sWheelFrames) {
+		// Stalled for a whole turn of the wheel; every entry in it is due, so one turn finds them all.
+		frame = nowFrame - sWheelFrames + 1;
+	}
+	for (; frame <= nowFrame; frame++) {
+		mFrame = frame;
+		// The entries whose paging occasion this is, new pages ahead of repeats.
+		vector<PagingEntry *> here, hereRepeat;
+		WheelSlot slot;
+		slot.swap(mWheel[frame % sWheelFrames]);
+		for (WheelSlot::const_iterator id = slot.begin(); id != slot.end(); ++id) {
+			PagingEntryMap::iterator it = mEntries.find(*id);
+			// Skip what was removed, or removed and added again since it went in this slot.
+			if (it == mEntries.end())
+				continue;
+			PagingEntry &entry = it->second;
+			if (entry.mDue == PagingEntry::sQueued || entry.mDue > frame ||
+				entry.mDue % sWheelFrames != frame % sWheelFrames)
+				continue;
+			if (entry.mDeferred) {
+				entry.mDeferred = false;
+				mDeferred--;
+			}
+			if (entry.expired(now)) {
+				LOG(INFO) << "erasing " << it->first;
+				expired.push_back(entry.transactionID());
+				mEntries.erase(it);
+				continue;
+			}
+			if (entry.mOccasion < 0) {
+				entry.mDue = PagingEntry::sQueued;
+				mRepeat.push_back(entry.mID);
+			} else if (!occasion(entry, frame)) {
+				schedule(entry);
+			} else if (entry.mPages) {
+				hereRepeat.push_back(&entry);
+			} else {
+				here.push_back(&entry);
+			}
+		}
+
+		// At most one message in a frame, and only in the share of the frames that paging gets.  Credit a frame
+		// could not use is kept up to one message, and what is left after a message carries over.
+		mCredit += mShare;
+		// New pages ahead of repeats, and the occasion's own ahead of those that could go in any frame.
+		PagingBatch batch;
+		size_t taken = 0, takenRepeat = 0;
+		while (mCredit >= 100 && batch.size() < sRecordsPerMessage) {
+			PagingEntry *entry = taken < here.size() ? here[taken++] : NULL;
+			if (!entry)
+				entry = nextDue(mFirst, now, expired);
+			if (!entry && takenRepeat < hereRepeat.size())
+				entry = hereRepeat[takenRepeat++];
+			if (!entry)
+				entry = nextDue(mRepeat, now, expired);
+			if (!entry)
+				break;
+			entry->mPages++;
+			batch.push_back(*entry);
+			schedule(*entry);
+		}
+		if (batch.size()) {
+			messages.push_back(batch);
+			mCredit -= 100;
+		}
+		if (mCredit > 100)
+			mCredit = 100;
+
+		// The rest of this occasion's entries wait for the next one.
+		here.erase(here.begin(), here.begin() + taken);
+		here.insert(here.end(), hereRepeat.begin() + takenRepeat, hereRepeat.end());
+		for (vector<PagingEntry *>::iterator entry = here.begin(); entry != here.end(); ++entry) {
+			(*entry)->mDeferred = true;
+			mDeferred++;
+			schedule(**entry);
+		}
+	}
+}
+
+void PagingTable::dump(ostream &os, uint64_t now) const
+{
+	for (PagingEntryMap::const_iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+		const PagingEntry &entry = it->second;
+		os << entry.ID() << " " << entry.type() << " " << entry.expired(now) << " pages=" << entry.pages()
+		   << endl;
+	}
+}
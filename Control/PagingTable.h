@@ -0,0 +1,170 @@
+/**@file Outstanding pages, indexed by mobile ID, on a timer wheel. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef PAGINGTABLE_H
+#define PAGINGTABLE_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include <GSM/GSML3CommonElements.h>
+#include <UMTS/UMTSCommon.h>
+
+namespace RRC {
+
+/** An entry in the paging table. */
+class PagingEntry {
+
+private:
+	GSM::L3MobileIdentity mID; ///< The mobile ID.
+	UMTS::ChannelTypeL3 mType; ///< The needed channel type.
+	unsigned mTransactionID;   ///< The associated transaction ID.
+	uint64_t mExpiration;      ///< When to give up, in ms on the paging table's clock.
+	uint64_t mDue;		   ///< The frame of its wheel slot, or sQueued while it waits to go out.
+	unsigned mPages;	   ///< Times sent so far.
+	int mOccasion;		   ///< IMSI mod gHyperframe, for the UE's paging occasion, or -1 if unknown.
+	bool mDeferred;		   ///< Missed its last paging occasion for lack of room.
+
+	friend class PagingTable;
+
+public:
+	static const uint64_t sQueued = ~(uint64_t)0;
+
+	/**
+		Create a new entry.
+		@param wExpiration When to stop paging, in ms on the paging table's clock.
+	*/
+	PagingEntry(const GSM::L3MobileIdentity &wID, UMTS::ChannelTypeL3 wType, unsigned wTransactionID,
+		uint64_t wExpiration, int wOccasion = -1)
+		: mID(wID), mType(wType), mTransactionID(wTransactionID), mExpiration(wExpiration), mDue(sQueued),
+		  mPages(0), mOccasion(wOccasion), mDeferred(false)
+	{
+	}
+
+	/** Access the ID. */
+	const GSM::L3MobileIdentity &ID() const { return mID; }
+
+	/** Access the channel type needed. */
+	UMTS::ChannelTypeL3 type() const { return mType; }
+
+	unsigned transactionID() const { return mTransactionID; }
+
+	unsigned pages() const { return mPages; }
+
+	/** Renew the timer. */
+	void renew(uint64_t wExpiration) { mExpiration = wExpiration; }
+
+	/** Returns true if the entry is expired at the given time. */
+	bool expired(uint64_t now) const { return now >= mExpiration; }
+};
+
+/** The identities for one PagingType1 message. */
+typedef std::vector<PagingEntry> PagingBatch;
+
+/**
+	The pages in progress, for the Pager.
+	Entries are indexed by mobile ID, so adding, renewing and removing one does not scan the table.  Each entry
+	waits in the slot of a timer wheel, one slot per 10 ms radio frame, for its next page or its expiration,
+	whichever comes first, so a frame looks only at the entries due in it.
+	A UE in DRX listens to the PCH only in its paging occasion, the frame whose SFN is its IMSI mod the DRX
+	cycle, 25.304 8.3, so an entry whose IMSI is known waits for its occasion, and the entries that share an
+	occasion go out together; those that do not fit in the occasion's message wait for the next one, a cycle
+	later.  Entries with no known IMSI can go in any frame, so they wait in a queue and fill the room the
+	occasion's own entries leave.  Either way new pages go ahead of repeats.
+	Messages carry up to maxPage1 IDs, at most one in a frame and no more than the configured share of the
+	frames, which is what the PCH can carry, so a burst of pages spreads out instead of each going on its own.
+	Not thread-safe; the Pager locks around it.
+*/
+class PagingTable {
+
+public:
+	static const unsigned sRecordsPerMessage = 8; ///< maxPage1, 25.331 10.3.10.
+	static const unsigned sFrameMs = 10;
+	static const unsigned sWheelFrames = 1024; ///< Longer than the longest DRX cycle, 25.304 8.3.
+
+private:
+	typedef std::map<GSM::L3MobileIdentity, PagingEntry> PagingEntryMap;
+	typedef std::vector<GSM::L3MobileIdentity> WheelSlot;
+
+	PagingEntryMap mEntries;
+	std::vector<WheelSlot> mWheel;
+	std::deque<GSM::L3MobileIdentity> mFirst;  ///< Due, not yet paged.
+	std::deque<GSM::L3MobileIdentity> mRepeat; ///< Due, paged before.
+	bool mStarted;
+	uint64_t mFrame;	///< The last frame serviced.
+	unsigned mSFNOffset;	///< SFN less the frame number, mod gHyperframe.
+	unsigned mRepeatFrames; ///< Between pages of one ID, the DRX cycle.
+	unsigned mShare;	///< Percent of the frames that may carry a message.
+	unsigned mCredit;	///< Toward the next message, in hundredths.
+	size_t mDeferred;	///< Entries waiting for a later occasion after missing one.
+
+	/** True if a frame is the paging occasion of an entry with a known IMSI. */
+	bool occasion(const PagingEntry &entry, uint64_t frame) const;
+
+	/** Put an entry in the wheel for its next page, at its paging occasion if it has one, or its expiration. */
+	void schedule(PagingEntry &entry);
+
+	/** Take the next entry that is really due from a queue; expired ones go to the expired list on the way. */
+	PagingEntry *nextDue(std::deque<GSM::L3MobileIdentity> &queue, uint64_t now, std::vector<unsigned> &expired);
+
+public:
+	/**
+		@param wRepeatMs Time between pages of one ID, normally the DRX cycle.
+		@param wShare Percent of the radio frames paging may use.
+	*/
+	PagingTable(unsigned wRepeatMs, unsigned wShare);
+
+	/** Change the repeat time and the share; takes effect for the next page of each entry. */
+	void configure(unsigned wRepeatMs, unsigned wShare);
+
+	/**
+		Add an ID to page until the expiration, or renew it if it is already here.
+		@param IMSI The UE's IMSI, for its paging occasion, if the ID is a TMSI and the IMSI is known.
+		@return True if the ID is new.
+	*/
+	bool add(const GSM::L3MobileIdentity &ID, UMTS::ChannelTypeL3 type, unsigned transactionID,
+		uint64_t expiration, const char *IMSI = NULL);
+
+	/**
+		Stop paging an ID.
+		@return The transaction ID of the entry, or 0 if there was none.
+	*/
+	unsigned remove(const GSM::L3MobileIdentity &ID);
+
+	/**
+		Service every frame up to now.
+		@param now The time, in ms.
+		@param SFN The SFN of the frame now is in.
+		@param messages Gets the PagingType1 messages to send.
+		@param expired Gets the transaction IDs of the entries that expired.
+	*/
+	void service(uint64_t now, unsigned SFN, std::vector<PagingBatch> &messages, std::vector<unsigned> &expired);
+
+	size_t size() const { return mEntries.size(); }
+
+	/** IDs due that have not gone out yet for lack of room on the PCH, and any removed since they were due. */
+	size_t backlog() const { return mFirst.size() + mRepeat.size() + mDeferred; }
+
+	void dump(std::ostream &os, uint64_t now) const;
+};
+
+} // namespace RRC
+
+#endif
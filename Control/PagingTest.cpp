@@ -0,0 +1,318 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Page a burst of 10,000 mobile IDs, IMSIs and TMSIs, through a PagingTable on a simulated clock, one radio
+// frame at a time, as the Pager does.  Most of the mobiles answer a while after their first page and are
+// removed, as a paging response would; the rest never answer and must expire.  Then time the same adds and one
+// paging pass on the list the Pager used to keep, which it scanned for every add and sent one page at a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+
+#include "PagingTable.h"
+
+using namespace RRC;
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const unsigned sDRXMs = 640; // UMTS.CN-DSI.CycleLengthCoeff 6.
+static const uint64_t sStart = 1000000;
+
+static GSM::L3MobileIdentity mobile(unsigned i)
+{
+	if (i % 3 == 0)
+		return GSM::L3MobileIdentity(0x40000000u + i);
+	char imsi[16];
+	snprintf(imsi, sizeof(imsi), "00101%010u", i);
+	return GSM::L3MobileIdentity(imsi);
+}
+
+// The SFN of the frame a time is in, as the Pager reads it off the NodeB's clock.
+static unsigned SFN(uint64_t now, unsigned offset = 0)
+{
+	return (now / PagingTable::sFrameMs + offset) % UMTS::gHyperframe;
+}
+
+// An IMSI whose paging occasion, in a DRX cycle of up to gHyperframe frames, is the given SFN mod the cycle.
+static string IMSIAt(unsigned occasion, unsigned n)
+{
+	char imsi[16];
+	// 00101 times 10^10 is a multiple of gHyperframe.
+	snprintf(imsi, sizeof(imsi), "00101%010u", n * UMTS::gHyperframe + occasion);
+	return imsi;
+}
+
+// TMSIs with no IMSI known have no paging occasion, so they can go in any frame.
+static void testBasics()
+{
+	PagingTable table(sDRXMs, 100);
+	vector<PagingBatch> messages;
+	vector<unsigned> expired;
+	table.service(sStart, SFN(sStart), messages, expired);
+
+	GSM::L3MobileIdentity first(0x40000001u), last(0x4000000au);
+	check("new ID", table.add(first, UMTS::DCCHType, 11, sStart + 2000));
+	check("same ID renews", !table.add(first, UMTS::DCCHType, 11, sStart + 3000) && table.size() == 1);
+	for (unsigned i = 2; i <= 10; i++) {
+		table.add(GSM::L3MobileIdentity(0x40000000u + i), UMTS::DTCHType, 10 + i, sStart + 2000);
+	}
+	table.service(sStart + 10, SFN(sStart + 10), messages, expired);
+	check("first page in the next frame, 8 to a message",
+		messages.size() == 1 && messages[0].size() == 8 && messages[0][0].ID() == first);
+	table.service(sStart + 20, SFN(sStart + 20), messages, expired);
+	check("the rest in the frame after",
+		messages.size() == 2 && messages[1].size() == 2 && messages[1][1].ID() == last);
+	table.service(sStart + sDRXMs, SFN(sStart + sDRXMs), messages, expired);
+	unsigned before = messages.size();
+	table.service(sStart + 20 + sDRXMs, SFN(sStart + 20 + sDRXMs), messages, expired);
+	check("paged again a DRX cycle later", before == 2 && messages.size() == 4);
+	check("remove returns the transaction", table.remove(GSM::L3MobileIdentity(0x40000005u)) == 15 &&
+							 table.remove(GSM::L3MobileIdentity(0x40000005u)) == 0);
+	table.service(sStart + 2010, SFN(sStart + 2010), messages, expired);
+	check("expired at their time, renewed one kept", expired.size() == 8 && table.size() == 1);
+	table.service(sStart + 3010, SFN(sStart + 3010), messages, expired);
+	check("renewed one expired later", expired.size() == 9 && expired.back() == 11 && table.size() == 0);
+}
+
+// Ten UEs share a paging occasion, nine paged by IMSI and one by a TMSI whose IMSI is known, with the SFN
+// seven frames ahead of the table's clock, and a TMSI with no IMSI known goes along.
+static void testOccasions()
+{
+	const unsigned offset = 7, occasion = 5, cycle = sDRXMs / PagingTable::sFrameMs;
+	PagingTable table(sDRXMs, 100);
+	vector<PagingBatch> messages;
+	vector<unsigned> expired;
+	table.service(sStart, SFN(sStart, offset), messages, expired);
+
+	for (unsigned n = 0; n < 9; n++) {
+		table.add(GSM::L3MobileIdentity(IMSIAt(occasion, n).c_str()), UMTS::DCCHType, n + 1, sStart + 10000);
+	}
+	GSM::L3MobileIdentity known(0x40000001u), unknown(0x40000002u);
+	table.add(known, UMTS::DCCHType, 10, sStart + 10000, IMSIAt(occasion, 9).c_str());
+	table.add(unknown, UMTS::DCCHType, 11, sStart + 10000);
+
+	vector<unsigned> sentSFN;
+	bool onOccasion = true;
+	unsigned unknownSFN = 0;
+	for (uint64_t now = sStart + 10; now <= sStart + 2 * sDRXMs; now += 10) {
+		size_t before = messages.size();
+		table.service(now, SFN(now, offset), messages, expired);
+		for (size_t m = before; m < messages.size(); m++) {
+			sentSFN.push_back(SFN(now, offset));
+			for (size_t r = 0; r < messages[m].size(); r++) {
+				if (messages[m][r].ID() == unknown) {
+					if (!unknownSFN)
+						unknownSFN = SFN(now, offset);
+				} else if (SFN(now, offset) % cycle != occasion) {
+					onOccasion = false;
+				}
+			}
+		}
+	}
+	check("no known IMSI: paged in the next frame", unknownSFN == SFN(sStart + 10, offset));
+	check("known IMSIs paged only in their paging occasion", onOccasion);
+	vector<size_t> atOccasion;
+	for (size_t m = 0; m < messages.size(); m++) {
+		if (sentSFN[m] % cycle == occasion)
+			atOccasion.push_back(m);
+	}
+	check("the occasion's IDs go together, 8 to a message",
+		atOccasion.size() == 2 && messages[atOccasion[0]].size() == 8);
+	bool rest = atOccasion.size() == 2 && messages[atOccasion[1]].size() == 8 &&
+		    sentSFN[atOccasion[1]] == (sentSFN[atOccasion[0]] + cycle) % UMTS::gHyperframe;
+	check("the rest in the next occasion, new pages first",
+		rest && messages[atOccasion[1]][0].pages() == 1 && messages[atOccasion[1]][1].ID() == known &&
+			messages[atOccasion[1]][1].pages() == 1 && messages[atOccasion[1]][2].pages() == 2);
+	check("the repeats that missed it in the backlog", table.backlog() == 2);
+}
+
+// With the PCH always busy, the share of frames that carry a message is the configured one, whether or not it
+// divides 100.
+static void testShare()
+{
+	const unsigned shares[] = {25, 30, 70};
+	const unsigned frames = 1000;
+	bool kept = true;
+	for (unsigned s = 0; s < sizeof(shares) / sizeof(shares[0]); s++) {
+		PagingTable table(sDRXMs, shares[s]);
+		vector<PagingBatch> messages;
+		vector<unsigned> expired;
+		table.service(sStart, SFN(sStart), messages, expired);
+		for (unsigned i = 0; i < 2000; i++) {
+			table.add(GSM::L3MobileIdentity(0x40000000u + i), UMTS::DCCHType, i + 1, sStart + 100000);
+		}
+		for (unsigned f = 1; f <= frames; f++) {
+			uint64_t now = sStart + f * PagingTable::sFrameMs;
+			table.service(now, SFN(now), messages, expired);
+		}
+		printf("share %u%%: %u messages in %u frames\n", shares[s], (unsigned)messages.size(), frames);
+		kept &= messages.size() * 100 + 100 > shares[s] * frames && messages.size() * 100 <= shares[s] * frames;
+	}
+	check("share of the frames kept, with no credit lost", kept);
+}
+
+// The Pager before the PagingTable: a list, scanned on every add, and every ID sent on its own on every pass.
+struct OldEntry {
+	GSM::L3MobileIdentity mID;
+	unsigned mTransactionID;
+	uint64_t mExpiration;
+};
+
+static void testBurst(unsigned count)
+{
+	PagingTable table(sDRXMs, 100);
+	vector<PagingBatch> messages;
+	vector<unsigned> expired;
+	table.service(sStart, SFN(sStart), messages, expired);
+
+	// Most answer 200 to 1200 ms after their first page; every tenth never does.
+	srandom(47);
+	map<GSM::L3MobileIdentity, unsigned> idIndex;
+	vector<uint64_t> firstPaged(count, 0), answerDelay(count, 0);
+	for (unsigned i = 0; i < count; i++) {
+		idIndex[mobile(i)] = i;
+		answerDelay[i] = i % 10 == 9 ? 0 : 200 + random() % 1000;
+	}
+	multimap<uint64_t, unsigned> answers;
+
+	uint64_t t0 = nanoseconds();
+	for (unsigned i = 0; i < count; i++) {
+		table.add(mobile(i), i % 4 ? UMTS::DCCHType : UMTS::DTCHType, i + 1, sStart + 30000);
+	}
+	uint64_t addNs = nanoseconds() - t0;
+
+	unsigned frames = 0, maxPerFrame = 0, maxRecords = 0, records = 0, wrongExpired = 0, removed = 0;
+	unsigned offOccasion = 0, cycle = sDRXMs / PagingTable::sFrameMs;
+	uint64_t serviceNs = 0, lastFirstPage = 0;
+	for (uint64_t now = sStart + 10; table.size(); now += 10) {
+		size_t before = messages.size();
+		t0 = nanoseconds();
+		table.service(now, SFN(now), messages, expired);
+		serviceNs += nanoseconds() - t0;
+		frames++;
+		if (messages.size() - before > maxPerFrame)
+			maxPerFrame = messages.size() - before;
+		for (size_t m = before; m < messages.size(); m++) {
+			records += messages[m].size();
+			if (messages[m].size() > maxRecords)
+				maxRecords = messages[m].size();
+			for (size_t r = 0; r < messages[m].size(); r++) {
+				unsigned i = idIndex[messages[m][r].ID()];
+				// mobile(i) has IMSI i mod the cycle.
+				if (i % 3 && i % cycle != SFN(now) % cycle)
+					offOccasion++;
+				if (!firstPaged[i]) {
+					firstPaged[i] = now;
+					lastFirstPage = now;
+					if (answerDelay[i])
+						answers.insert(make_pair(now + answerDelay[i], i));
+				}
+			}
+		}
+		while (answers.size() && answers.begin()->first <= now) {
+			unsigned i = answers.begin()->second;
+			answers.erase(answers.begin());
+			if (table.remove(mobile(i)) == i + 1)
+				removed++;
+		}
+	}
+	unsigned neverPaged = 0;
+	for (unsigned i = 0; i < count; i++) {
+		if (!firstPaged[i])
+			neverPaged++;
+	}
+	for (unsigned i = 0; i < expired.size(); i++) {
+		if (expired[i] % 10 != 0)
+			wrongExpired++;
+	}
+
+	printf("%u IDs: added in %.2f ms, %u messages with %u records over %u frames, %.2f us a frame\n", count,
+		addNs / 1e6, (unsigned)messages.size(), records, frames, serviceNs / 1e3 / frames);
+	printf("every ID paged within %.2f s; %u answered, %u expired\n", (lastFirstPage - sStart) / 1e3, removed,
+		(unsigned)expired.size());
+	check("every ID paged before it expired", neverPaged == 0);
+	check("at most one message a frame, 8 records a message", maxPerFrame <= 1 && maxRecords <= 8);
+	check("IMSIs paged only in their paging occasion", offOccasion == 0);
+	check("burst packed full", lastFirstPage - sStart <= (count / 8 + 2) * 10);
+	check("answered ones removed with their transaction", removed == count - count / 10);
+	check("the rest expired", expired.size() == count / 10 && wrongExpired == 0);
+
+	// The old list.
+	list<OldEntry> old;
+	t0 = nanoseconds();
+	for (unsigned i = 0; i < count; i++) {
+		GSM::L3MobileIdentity id = mobile(i);
+		bool found = false;
+		for (list<OldEntry>::iterator it = old.begin(); it != old.end(); ++it) {
+			if (it->mID == id) {
+				it->mExpiration = sStart + 30000;
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			OldEntry e = {id, i + 1, sStart + 30000};
+			old.push_back(e);
+		}
+	}
+	uint64_t oldAddNs = nanoseconds() - t0;
+	unsigned oldSent = 0;
+	for (list<OldEntry>::iterator it = old.begin(); it != old.end(); ++it) {
+		oldSent++;
+	}
+	printf("old list: added in %.2f ms; one pass sends %u pages at once\n", oldAddNs / 1e6, oldSent);
+	check("indexed adds 10x faster than the list", addNs * 10 < oldAddNs);
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("PagingTest", "EMERG");
+
+	testBasics();
+	testOccasions();
+	testShare();
+	testBurst(argc > 1 ? atoi(argv[1]) : 10000);
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
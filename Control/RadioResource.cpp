@@ -18,12 +18,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
+#include <Globals/Globals.h>
 #include <UMTS/UMTSConfig.h>
 #include <UMTS/UMTSLogicalChannel.h>
+#include <UMTS/URRCMessages.h>
 
 #include "RadioResource.h"
+#include "TMSITable.h"
 #include "TransactionTable.h"
 
 #undef WARNING
@@ -33,28 +38,43 @@ using namespace UMTS;
 using namespace RRC;
 using namespace Control;
 
+static StatGauge sPending("Control.Paging.Pending", "mobile IDs being paged");
+static StatGauge sBacklog("Control.Paging.Backlog", "mobile IDs due to be paged that wait for room on the PCH");
+static StatCounter sMessages("Control.Paging.Messages", "PagingType1 messages sent");
+static StatCounter sRecords("Control.Paging.Records", "paging records sent, up to 8 to a message");
+static StatCounter sExpired("Control.Paging.Expired", "pages that expired without a response");
+
+// The pager's clock, in ms.
+static uint64_t pagerNow() { return statNanoseconds() / 1000000; }
+
+// The DRX cycle of an idle UE, 25.304 8.3: 2^k radio frames, with k from SIB1.
+static unsigned DRXCycleMs()
+{
+	int k = gConfig.getNum("UMTS.CN-DSI.CycleLengthCoeff");
+	if (k < 3)
+		k = 3;
+	if (k > 9)
+		k = 9;
+	return PagingTable::sFrameMs << k;
+}
+
+Pager::Pager() : mTable(640, 100), mRunning(false) {}
+
 void Pager::addID(
 	const GSM::L3MobileIdentity &newID, UMTS::ChannelTypeL3 chanType, TransactionEntry &transaction, unsigned wLife)
 {
 	transaction.GSMState(GSM::Paging);
 	transaction.setTimer("3113", wLife);
+	// A UE paged by TMSI still listens in the paging occasion of its IMSI.
+	char *IMSI = NULL;
+	if (newID.type() == GSM::TMSIType && gTMSITable)
+		IMSI = gTMSITable->IMSI(newID.TMSI());
 	// Add a mobile ID to the paging list for a given lifetime.
+	// If this ID is already in the list, this just resets its timer.
 	ScopedLock lock(mLock);
-	// If this ID is already in the list, just reset its timer.
-	// Uhg, another linear time search.
-	// This would be faster if the paging list were ordered by ID.
-	// But the list should usually be short, so it may not be worth the effort.
-	for (PagingEntryList::iterator lp = mPageIDs.begin(); lp != mPageIDs.end(); ++lp) {
-		if (lp->ID() == newID) {
-			LOG(DEBUG) << newID << " already in table";
-			lp->renew(wLife);
-			mPageSignal.signal();
-			return;
-		}
-	}
-	// If this ID is new, put it in the list.
-	mPageIDs.push_back(PagingEntry(newID, chanType, transaction.ID(), wLife));
-	LOG(INFO) << newID << " added to table";
+	mTable.add(newID, chanType, transaction.ID(), pagerNow() + wLife, IMSI);
+	free(IMSI);
+	sPending.set(mTable.size());
 	mPageSignal.signal();
 }
 
@@ -63,56 +83,41 @@ unsigned Pager::removeID(const GSM::L3MobileIdentity &delID)
 	// Return the associated transaction ID, or 0 if none found.
 	LOG(INFO) << delID;
 	ScopedLock lock(mLock);
-	for (PagingEntryList::iterator lp = mPageIDs.begin(); lp != mPageIDs.end(); ++lp) {
-		if (lp->ID() == delID) {
-			unsigned retVal = lp->transactionID();
-			mPageIDs.erase(lp);
-			return retVal;
-		}
-	}
-	return 0;
+	unsigned retVal = mTable.remove(delID);
+	sPending.set(mTable.size());
+	return retVal;
 }
 
-unsigned Pager::pageAll()
+unsigned Pager::pageDue()
 {
-	// Traverse the full list and page all IDs.
-	// Remove expired IDs.
-	// Return the number of IDs paged.
-	// This is a linear time operation.
-
-	ScopedLock lock(mLock);
-
-	// Clear expired entries.
-	PagingEntryList::iterator lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
-		if (!lp->expired())
-			++lp;
-		else {
-			LOG(INFO) << "erasing " << lp->ID();
-			// Non-responsive, dead transaction?
-			gTransactionTable->removePaging(lp->transactionID());
-			// remove from the list
-			lp = mPageIDs.erase(lp);
-		}
+	vector<PagingBatch> messages;
+	vector<unsigned> expired;
+	{
+		ScopedLock lock(mLock);
+		mTable.service(pagerNow(), gNodeB->clock().FN(), messages, expired);
+		sPending.set(mTable.size());
+		sBacklog.set(mTable.backlog());
 	}
 
-	LOG(INFO) << "paging " << mPageIDs.size() << " mobile(s)";
-
-	// Page remaining entries, two at a time if possible.
-	// These PCH send operations are non-blocking.
-	lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
-		// TODO UMTS -- This needs a rewrite for UMTS.
-		assert(0);
+	for (unsigned i = 0; i < expired.size(); i++) {
+		// Non-responsive, dead transaction?
+		gTransactionTable->removePaging(expired[i]);
 	}
+	sExpired.inc(expired.size());
 
-	return mPageIDs.size();
+	for (unsigned i = 0; i < messages.size(); i++) {
+		LOG(INFO) << "paging " << messages[i].size() << " mobile(s)";
+		sendPagingType1(messages[i]);
+		sRecords.inc(messages[i].size());
+	}
+	sMessages.inc(messages.size());
+	return messages.size();
 }
 
 size_t Pager::pagingEntryListSize()
 {
 	ScopedLock lock(mLock);
-	return mPageIDs.size();
+	return mTable.size();
 }
 
 void Pager::start()
@@ -135,28 +140,20 @@ void Pager::serviceLoop()
 
 		LOG(DEBUG) << "Pager blocking for signal";
 		mLock.lock();
-		while (mPageIDs.size() == 0)
+		while (mTable.size() == 0)
 			mPageSignal.wait(mLock);
+		mTable.configure(DRXCycleMs(), gConfig.getNum("UMTS.Paging.Share"));
 		mLock.unlock();
 
-		// page everything
-		pageAll();
+		pageDue();
 
-		// Wait for pending activity to clear the channel.
-		// TODO UMTS -- Needs to be written for UMTS.
-		// This wait is what causes PCH to have lower priority than AGCH.
-		// unsigned load = gNodeB->getPCH()->load();
-		// LOG(DEBUG) << "Pager waiting for " << load << " multiframes";
-		// if (load) usleep(UMTS::gFrameMicroseconds*load);
+		// Sleep to the next radio frame.
+		usleep(1000 * (PagingTable::sFrameMs - pagerNow() % PagingTable::sFrameMs));
 	}
 }
 
 void Pager::dump(ostream &os) const
 {
 	ScopedLock lock(mLock);
-	PagingEntryList::const_iterator lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
-		os << lp->ID() << " " << lp->type() << " " << lp->expired() << endl;
-		++lp;
-	}
+	mTable.dump(os, pagerNow());
 }
@@ -19,11 +19,11 @@
 #ifndef RADIORESOURCE_H
 #define RADIORESOURCE_H
 
-#include <list>
-
 #include <GSM/GSML3CommonElements.h>
 #include <UMTS/UMTSCommon.h>
 
+#include "PagingTable.h"
+
 namespace GSM {
 class L3MobileIdentity;
 class L3PagingResponse;
@@ -79,62 +79,25 @@ void *AccessGrantServiceLoop(void *);
 /**@ Paging mechanisms */
 //@{
 
-/** An entry in the paging list. */
-class PagingEntry {
-
-private:
-	GSM::L3MobileIdentity mID; ///< The mobile ID.
-	UMTS::ChannelTypeL3 mType; ///< The needed channel type.
-	unsigned mTransactionID;   ///< The associated transaction ID.
-	Timeval mExpiration;       ///< The expiration time for this entry.
-
-public:
-	/**
-		Create a new entry, with current timestamp.
-		@param wID The ID to be paged.
-		@param wLife The number of milliseconds to keep paging.
-	*/
-	PagingEntry(
-		const GSM::L3MobileIdentity &wID, UMTS::ChannelTypeL3 wType, unsigned wTransactionID, unsigned wLife)
-		: mID(wID), mType(wType), mTransactionID(wTransactionID), mExpiration(wLife)
-	{
-	}
-
-	/** Access the ID. */
-	const GSM::L3MobileIdentity &ID() const { return mID; }
-
-	/** Access the channel type needed. */
-	UMTS::ChannelTypeL3 type() const { return mType; }
-
-	unsigned transactionID() const { return mTransactionID; }
-
-	/** Renew the timer. */
-	void renew(unsigned wLife) { mExpiration = Timeval(wLife); }
-
-	/** Returns true if the entry is expired. */
-	bool expired() const { return mExpiration.passed(); }
-};
-
-typedef std::list<PagingEntry> PagingEntryList;
-
 /**
-	The pager is a global object that generates paging messages on the CCCH.
+	The pager is a global object that generates PagingType1 messages for the PCH.
 	To page a mobile, add the mobile ID to the pager.
 	The entry will be deleted automatically when it expires.
-	All pager operations are linear time.
-	Not much point in optimizing since the main operation is inherently linear.
+	The IDs are kept in a PagingTable, which batches them into messages and spreads a burst of them over the
+	frames the PCH has for paging, UMTS.Paging.Share of them; each ID is paged in its UE's paging occasion, and
+	again every DRX cycle.
 */
 class Pager {
 
 private:
-	PagingEntryList mPageIDs; ///< List of ID's to be paged.
-	mutable Mutex mLock;      ///< Lock for thread-safe access.
-	Signal mPageSignal;       ///< signal to wake the paging loop
-	Thread mPagingThread;     ///< Thread for the paging loop.
+	PagingTable mTable;   ///< The IDs being paged.
+	mutable Mutex mLock;  ///< Lock for thread-safe access.
+	Signal mPageSignal;   ///< signal to wake the paging loop
+	Thread mPagingThread; ///< Thread for the paging loop.
 	volatile bool mRunning;
 
 public:
-	Pager() : mRunning(false) {}
+	Pager();
 
 	/** Set the output FIFO and start the paging loop. */
 	void start();
@@ -158,12 +121,12 @@ public:
 
 private:
 	/**
-		Traverse the paging list, paging all IDs.
-		@return Number of IDs paged.
+		Send the pages due by now, and drop the expired ones.
+		@return Number of messages sent.
 	*/
-	unsigned pageAll();
+	unsigned pageDue();
 
-	/** A loop that repeatedly calls pageAll. */
+	/** A loop that calls pageDue every radio frame. */
 	void serviceLoop();
 
 	/** C-style adapter. */
@@ -347,6 +347,16 @@ void LlcEntity::lleWriteHighSide(LlcDlFrame &frame, bool isCmd, const char *desc
 	lleWriteRaw(frame, descr);
 }
 
+void LlcEntity::lleWriteHighSide(LlcDlChain &chain, bool isCmd, const char *descr)
+{
+	chain.prependUIHeader(getLlcSapi(), isCmd, mVU++ % mSNS);
+	// The frame goes to the RLC on another thread, so it gets a buffer of its own, exactly its size: the
+	// ByteVector refcount is not atomic, and a segment of a shared buffer could append into the next frame.
+	ByteVector frame(chain.size());
+	chain.gather(frame.begin());
+	mSI->sgsnSend2MsHighSide(frame, descr, 0);
+}
+
 void LlcEntityGmm::lleUplinkData(ByteVector &payload)
 {
 	LLCDEBUG("LlcEntityGmm lleUplinkData");
@@ -642,151 +652,21 @@ void Sndcp::sndcpWriteLowSide(SndcpFrame &frame)
 	}
 }
 
-// Send the pdu segment on its way.
-// TODO: we are assuming unacknowledged mode.
-void Sndcp::sndcpWriteSegment(ByteVector &pduSeg, unsigned segnum, unsigned flags)
-{
-	LlcDlFrame result(pduSeg.size() + 4); // May be overkill by one or more bytes.
-	result.appendByte(flags);
-	if (flags & F_BIT) {
-		// 6.7.1.1: First segment has DCOMP and PCOMP parameters.
-		// Amusingly, only make the pdu bigger.
-		result.appendByte(0); // No compression.
-	}
-	result.appendField(segnum, 4);		  // segment number.
-	result.appendField(mSendNPdu % mSNS, 12); // pdu number.
-	result.append(pduSeg);
-	// TODO: Is this a command or a response?
-	mlle->lleWriteHighSide(result, true, "user pdu");
-}
-
 // downlink data from internet comes in here.
 // It needs to be segmented and sent to LLC Entity for yet another header.
+// The segments are views of the sdu; each is copied once, when LLC gathers it into its frame.
+// TODO: we are assuming unacknowledged mode.
 void Sndcp::sndcpWriteHighSide(ByteVector &sdu)
 {
-	// Set the first byte flags.
-	unsigned flags = mNSapi;
-	flags |= T_BIT; // UNITDATA PDU
-	flags |= F_BIT; // First segment.
-	// Segment the pdu.
-	unsigned segnum = 0;
 	unsigned segsize = getMaxPduSize();
 	segsize -= 12; // be safe.  If you dont do this, the blackberry rejects the packets.
-	for (; sdu.size() > segsize; segnum++) {
-		flags |= M_BIT; // Not last segment.
-		ByteVector seg(sdu.segment(0, segsize));
-		sndcpWriteSegment(seg, segnum, flags);
-		sdu.trimLeft(segsize);
-		flags &= ~F_BIT; // Not first segment.
+	SndcpSegmenter segments(sdu, segsize, mNSapi, mSendNPdu % mSNS);
+	LlcDlChain chain;
+	while (segments.next(chain)) {
+		// TODO: Is this a command or a response?
+		mlle->lleWriteHighSide(chain, true, "user pdu");
 	}
-	flags &= ~M_BIT; // Now it is the last segment.
-	sndcpWriteSegment(sdu, segnum, flags);
 	mSendNPdu = (mSendNPdu + 1) % mSNS;
 }
 
-// invert the low width bits of x.
-static uint32_t revbits(uint32_t x, unsigned width)
-{
-	x &= ((uint32_t)1 << width) - 1;
-	uint32_t result = 0;
-	for (unsigned i = 0; i < width; i++) {
-		result = result << 1;
-		result |= (x & 1);
-		x = x >> 1;
-	}
-	return result;
-}
-
-// Pre-compute the CRC divisors for each possible byte.
-static void genParityTab(uint32_t invGen, uint32_t *tab)
-{
-	for (int i = 0; i < 256; i++) {
-		uint32_t crc = i;
-
-		for (int b = 7; b >= 0; b--) {
-			unsigned bit = crc & 1;
-			crc >>= 1;
-			if (bit) {
-				crc ^= invGen;
-			}
-		}
-		tab[i] = crc;
-	}
-}
-
-Parity32::Parity32(uint32_t generator, unsigned width, bool invertFirst)
-{
-	mMask = (((uint32_t)1 << width) - 1);
-	mInitialRemainder = invertFirst ? mMask : 0;
-	// If it is a 32-bit generator, dont bother passing in bit 33,
-	// which gets shifted off the top of the 32-bit generator argument.
-	if (width == 32) {
-		// untested:  The 33rd bit is off the top, so put it back.
-		// Note that this would work for both cases, but clearer to separate it.
-		mInvertedGenerator = (revbits(generator, 32) >> 1) | (1 << 31);
-	} else {
-		mInvertedGenerator = revbits(mMask & generator, 24);
-	}
-	genParityTab(mInvertedGenerator, mTab);
-}
-
-uint32_t Parity32::computeCrc(unsigned char *str, int len)
-{
-	uint32_t crc = mInitialRemainder;
-	unsigned char *bp = str, *ep = str + len;
-	while (bp < ep) {
-		crc = (crc >> 8) ^ mTab[(crc ^ *bp++) & 0xff];
-	}
-	return (~crc) & mMask;
-
-	// As a comment, this is the identical algorithm to the above, without the table lookup:
-	/***
-	for (int l = 0; l < len; l++) {
-		crc = crc ^ str[l];
-		for (int b = 7; b >= 0; b--)
-		{
-			unsigned bit = crc & 1;
-			crc >>= 1;
-			if (bit) { crc ^= lsbgen; }
-		}
-	}
-	***/
-}
-
-uint32_t Parity32::computeCrc(ByteVector &bv) { return computeCrc(bv.begin(), bv.size()); }
-
-extern "C" {
-int gprs_llc_fcs(uint8_t *data, unsigned int len);
-};
-
-void LlcParity::appendFCS(ByteVector &bv)
-{
-	uint32_t fcs = computeCrc(bv);
-	// append 24-bit fcs LSB first.
-	bv.appendByte(fcs & 0xff);
-	bv.appendByte((fcs >> 8) & 0xff);
-	bv.appendByte((fcs >> 16) & 0xff);
-
-	// Double check:
-#if 0
-	uint32_t oldcrc = gprs_llc_fcs(bv.begin(),bv.size()-3);
-	if (fcs != oldcrc) {
-		printf("CRC ERROR: old=%d new=%d\n",oldcrc,fcs);
-	} else {
-		printf("CRC matches\n");
-	}
-#endif
-}
-
-// Check the FCS in the last 3 bytes of bytevector.
-bool LlcParity::checkFCS(ByteVector &bv)
-{
-	unsigned len = bv.size();
-	uint32_t fcs = (bv.getByte(len - 1) << 16) | (bv.getByte(len - 2) << 8) | bv.getByte(len - 3);
-	uint32_t computedFCS = computeCrc(bv.begin(), len - 3);
-	return fcs == computedFCS;
-}
-
-LlcParity gLlcParity; // The one and only parity generator needed.
-
 }; // namespace SGSN
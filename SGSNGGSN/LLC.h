@@ -23,6 +23,7 @@
 #include <CommonLibs/MemoryLeak.h>
 
 #include "GPRSL3Messages.h"
+#include "LlcChain.h"
 #include "SgsnBase.h"
 
 namespace GPRS {
@@ -56,54 +57,6 @@ struct LLCFormat {
 	static const char *name(type format);
 };
 
-// (pat) This is a generic parity generator for up to 32 bit parity.
-
-// Pats Notes: The generator-based algorithm in BitVector.h did not work
-// for the LLC FCS when I tried to pre-invert the remainder.
-// Here is a new one based on table lookups, which is better for ByteVectors.
-// An N-bit CRC is always N+1 bits long where the first and last bits are 1.
-// The CRC is the remainder of division of the input by the generator.
-// The complicated description of the LLC FCS is describing a normal 24-bit CRC
-// but they are setting the remainder to all ones beforehand (to catch the input
-// error of leading 0s) and inverting it after (to catch the input error of trailing 0s.)
-// Algorithm here is based on LSB-first algorithm from wikipedia "Computation of CRC"
-// So we have to pre-reverse the bits of the CRC generator.
-// The top bit of the CRC sets the shift-register output to 0 for the division,
-// so the division result comes out 0, but those bits are not relevant to the CRC,
-// which is the remainder, because they are all shifted away.
-// So we chop the top bit off.
-class Parity32 {
-	uint32_t mTab[256]; // Precomputed crc remainders.
-	uint32_t mInvertedGenerator;
-	uint32_t mInitialRemainder;
-	uint32_t mMask;
-
-public:
-	Parity32(uint32_t generator, unsigned width, bool invertFirst);
-	uint32_t computeCrc(unsigned char *str, int len);
-	uint32_t computeCrc(ByteVector &bv);
-};
-
-// 04.64 5.5 FCS [Frame Check Sequence] field, aka parity.
-// The CRC shall be the ones complement of the sum (modulo 2) of:
-// 		the remainder of xk (x23 + x22 + x21 +... + x2 + x + 1) divided (modulo 2) by
-//		the generator polynomial, where k is the number of bits of the dividend;
-// 	plus the remainder of the division (modulo 2) by the generator polynomial
-// 		of the product of x24 by the dividend.
-// The CRC-24 generator polynomial is:
-// G(x) = x24 + x23 + x21 + x20 + x19 + x17 + x16 + x15 + x13 + x8 + x7 + x5 + x4 + x2 + 1
-class LlcParity : public Parity32 {
-	static const uint32_t sFCSGenerator = (1 << 24) + (1 << 23) + (1 << 21) + (1 << 20) + (1 << 19) + (1 << 17) +
-					      (1 << 16) + (1 << 15) + (1 << 13) + (1 << 8) + (1 << 7) + (1 << 5) +
-					      (1 << 4) + (1 << 2) + 1;
-
-public:
-	LlcParity() : Parity32(sFCSGenerator, 24, true){};
-	void appendFCS(ByteVector &bv);
-	bool checkFCS(ByteVector &bv); // true if parity ok.
-};
-extern LlcParity gLlcParity;
-
 struct LlcDefs {
 	// sec 6.4 LLC commands for U-format frames, passed in LlcFrame::mM above.
 	enum U_M_Commands {    // Some are commands and some are responses.
@@ -340,6 +293,8 @@ struct LlcEntity {
 	// void setSndcp(unsigned nsapi,Sndcp*);
 	void lleWriteLowSide(LlcFrame &frame);
 	void lleWriteHighSide(LlcDlFrame &frame, bool isCmd, const char *descr);
+	// Add the UI header to a chain, gather it with its FCS into a frame, and send it.
+	void lleWriteHighSide(LlcDlChain &chain, bool isCmd, const char *descr);
 	void lleWriteHighSide(L3GprsDlMsg &msg);
 	void lleWriteRaw(ByteVector &frame, const char *descr);
 };
@@ -407,11 +362,6 @@ struct SndcpFrame : public ByteVector {
 };
 
 class Sndcp {
-	enum { // Address field bits
-		F_BIT = 0x40,
-		T_BIT = 0x20,
-		M_BIT = 0x10
-	};
 	// Our identifiers:
 	static const unsigned sUmSNS = 4096; // Module for Unacknowledged Mode, sequence number space.
 	static const unsigned sAmSNS = 256;  // Module for Acknowledged Mode, sequence number space.
@@ -453,7 +403,6 @@ private:
 	int diffSNS(int v1, int v2);
 	// SDU segmented to this size.  May be negotiated using XID command, which we dont implement.
 	unsigned getMaxPduSize();
-	void sndcpWriteSegment(ByteVector &pduSeg, unsigned segnum, unsigned flags);
 
 public:
 	// downlink data from internet comes in here.
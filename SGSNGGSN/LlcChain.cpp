@@ -0,0 +1,213 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2011, 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <string.h>
+
+#include "LlcChain.h"
+
+namespace SGSN {
+
+// invert the low width bits of x.
+static uint32_t revbits(uint32_t x, unsigned width)
+{
+	x &= ((uint32_t)1 << width) - 1;
+	uint32_t result = 0;
+	for (unsigned i = 0; i < width; i++) {
+		result = result << 1;
+		result |= (x & 1);
+		x = x >> 1;
+	}
+	return result;
+}
+
+// Pre-compute the CRC divisors for each possible byte.
+static void genParityTab(uint32_t invGen, uint32_t *tab)
+{
+	for (int i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (int b = 7; b >= 0; b--) {
+			unsigned bit = crc & 1;
+			crc >>= 1;
+			if (bit) {
+				crc ^= invGen;
+			}
+		}
+		tab[i] = crc;
+	}
+}
+
+Parity32::Parity32(uint32_t generator, unsigned width, bool invertFirst)
+{
+	mMask = (((uint32_t)1 << width) - 1);
+	mInitialRemainder = invertFirst ? mMask : 0;
+	// If it is a 32-bit generator, dont bother passing in bit 33,
+	// which gets shifted off the top of the 32-bit generator argument.
+	if (width == 32) {
+		// untested:  The 33rd bit is off the top, so put it back.
+		// Note that this would work for both cases, but clearer to separate it.
+		mInvertedGenerator = (revbits(generator, 32) >> 1) | (1 << 31);
+	} else {
+		mInvertedGenerator = revbits(mMask & generator, 24);
+	}
+	genParityTab(mInvertedGenerator, mTab[0]);
+	for (int i = 0; i < 256; i++) {
+		for (int k = 1; k < 4; k++) {
+			uint32_t prev = mTab[k - 1][i];
+			mTab[k][i] = (prev >> 8) ^ mTab[0][prev & 0xff];
+		}
+	}
+}
+
+// Four bytes a step: xor them into the remainder, then each byte of the result is looked up as if the bytes after
+// it were zero, which is what the remainder shifted past them would be.
+uint32_t Parity32::crcUpdate(uint32_t crc, const unsigned char *str, unsigned len) const
+{
+	const unsigned char *bp = str, *ep = str + len;
+	for (; ep - bp >= 4; bp += 4) {
+		crc ^= bp[0] | (bp[1] << 8) | (bp[2] << 16) | ((uint32_t)bp[3] << 24);
+		crc = mTab[3][crc & 0xff] ^ mTab[2][(crc >> 8) & 0xff] ^ mTab[1][(crc >> 16) & 0xff] ^
+		      mTab[0][crc >> 24];
+	}
+	while (bp < ep) {
+		crc = (crc >> 8) ^ mTab[0][(crc ^ *bp++) & 0xff];
+	}
+	return crc;
+}
+
+uint32_t Parity32::crcCopy(uint32_t crc, unsigned char *dst, const unsigned char *src, unsigned len) const
+{
+	// In blocks that stay in the cache between the copy and the CRC.
+	const unsigned sBlock = 256;
+	while (len) {
+		unsigned n = len < sBlock ? len : sBlock;
+		memcpy(dst, src, n);
+		crc = crcUpdate(crc, dst, n);
+		dst += n;
+		src += n;
+		len -= n;
+	}
+	return crc;
+}
+
+uint32_t Parity32::computeCrc(unsigned char *str, int len)
+{
+	return crcFinish(crcUpdate(crcStart(), str, len));
+
+	// As a comment, this is the identical algorithm to the above, without the table lookup:
+	/***
+	for (int l = 0; l < len; l++) {
+		crc = crc ^ str[l];
+		for (int b = 7; b >= 0; b--)
+		{
+			unsigned bit = crc & 1;
+			crc >>= 1;
+			if (bit) { crc ^= lsbgen; }
+		}
+	}
+	***/
+}
+
+uint32_t Parity32::computeCrc(ByteVector &bv) { return computeCrc(bv.begin(), bv.size()); }
+
+extern "C" {
+int gprs_llc_fcs(uint8_t *data, unsigned int len);
+};
+
+void LlcParity::appendFCS(ByteVector &bv)
+{
+	uint32_t fcs = computeCrc(bv);
+	// append 24-bit fcs LSB first.
+	bv.appendByte(fcs & 0xff);
+	bv.appendByte((fcs >> 8) & 0xff);
+	bv.appendByte((fcs >> 16) & 0xff);
+
+	// Double check:
+#if 0
+	uint32_t oldcrc = gprs_llc_fcs(bv.begin(),bv.size()-3);
+	if (fcs != oldcrc) {
+		printf("CRC ERROR: old=%d new=%d\n",oldcrc,fcs);
+	} else {
+		printf("CRC matches\n");
+	}
+#endif
+}
+
+// Check the FCS in the last 3 bytes of bytevector.
+bool LlcParity::checkFCS(ByteVector &bv)
+{
+	unsigned len = bv.size();
+	uint32_t fcs = (bv.getByte(len - 1) << 16) | (bv.getByte(len - 2) << 8) | bv.getByte(len - 3);
+	uint32_t computedFCS = computeCrc(bv.begin(), len - 3);
+	return fcs == computedFCS;
+}
+
+LlcParity gLlcParity; // The one and only parity generator needed.
+
+void LlcDlChain::prependSndcpHeader(unsigned flags, bool first, unsigned segnum, unsigned pduNumber)
+{
+	unsigned char *hp = prepend(first ? 4 : 3);
+	*hp++ = flags;
+	if (first) {
+		// 6.7.1.1: First segment has DCOMP and PCOMP parameters.
+		*hp++ = 0; // No compression.
+	}
+	*hp++ = ((segnum & 0xf) << 4) | ((pduNumber >> 8) & 0xf); // segment number, pdu number.
+	*hp = pduNumber & 0xff;
+}
+
+void LlcDlChain::prependUIHeader(unsigned sapi, bool isCmd, unsigned nu)
+{
+	unsigned char *hp = prepend(3);
+	// PD bit always 0, C/R set to 1 for a downlink command, 2 unused bits, then the SAPI.
+	hp[0] = (isCmd ? 0x40 : 0) | (sapi & 0xf);
+	// UI format tag and unused bits, the frame number, E = 0 for no encryption and PM = 1 for FCS over everything.
+	hp[1] = 0xc0 | ((nu >> 6) & 0x7);
+	hp[2] = ((nu & 0x3f) << 2) | 1;
+}
+
+unsigned LlcDlChain::gather(unsigned char *dst) const
+{
+	unsigned char *dp = dst;
+	uint32_t crc = gLlcParity.crcStart();
+	crc = gLlcParity.crcCopy(crc, dp, mHead + mHeadStart, headSize());
+	dp += headSize();
+	crc = gLlcParity.crcCopy(crc, dp, mPayload, mPayloadSize);
+	dp += mPayloadSize;
+	LlcParity::writeFCS(dp, gLlcParity.crcFinish(crc));
+	return size();
+}
+
+bool SndcpSegmenter::next(LlcDlChain &chain)
+{
+	if (mSegNum >= segments()) {
+		return false;
+	}
+	unsigned len = mNPdu.size() - mOffset;
+	unsigned flags = mFlags;
+	if (mSegNum == 0) {
+		flags |= F_BIT; // First segment.
+	}
+	if (len > mSegSize) {
+		len = mSegSize;
+		flags |= M_BIT; // Not last segment.
+	}
+	chain.reset(mNPdu.begin() + mOffset, len);
+	chain.prependSndcpHeader(flags, mSegNum == 0, mSegNum, mPduNumber);
+	mOffset += len;
+	mSegNum++;
+	return true;
+}
+
+}; // namespace SGSN
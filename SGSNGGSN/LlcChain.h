@@ -0,0 +1,166 @@
+/**@file Downlink LLC frames as scatter-gather chains, and the LLC FCS, from GSM 04.64 and 04.65. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2011, 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef LLCCHAIN_H
+#define LLCCHAIN_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <CommonLibs/ByteVector.h>
+
+namespace SGSN {
+
+// (pat) This is a generic parity generator for up to 32 bit parity.
+
+// Pats Notes: The generator-based algorithm in BitVector.h did not work
+// for the LLC FCS when I tried to pre-invert the remainder.
+// Here is a new one based on table lookups, which is better for ByteVectors.
+// An N-bit CRC is always N+1 bits long where the first and last bits are 1.
+// The CRC is the remainder of division of the input by the generator.
+// The complicated description of the LLC FCS is describing a normal 24-bit CRC
+// but they are setting the remainder to all ones beforehand (to catch the input
+// error of leading 0s) and inverting it after (to catch the input error of trailing 0s.)
+// Algorithm here is based on LSB-first algorithm from wikipedia "Computation of CRC"
+// So we have to pre-reverse the bits of the CRC generator.
+// The top bit of the CRC sets the shift-register output to 0 for the division,
+// so the division result comes out 0, but those bits are not relevant to the CRC,
+// which is the remainder, because they are all shifted away.
+// So we chop the top bit off.
+// The CRC can also be run in pieces: crcStart, then crcUpdate or crcCopy over each piece in order, then crcFinish.
+class Parity32 {
+	// Precomputed crc remainders: mTab[0] for one byte, and mTab[k] for a byte followed by k zero bytes,
+	// so crcUpdate can take 4 bytes a step.
+	uint32_t mTab[4][256];
+	uint32_t mInvertedGenerator;
+	uint32_t mInitialRemainder;
+	uint32_t mMask;
+
+public:
+	Parity32(uint32_t generator, unsigned width, bool invertFirst);
+	uint32_t computeCrc(unsigned char *str, int len);
+	uint32_t computeCrc(ByteVector &bv);
+
+	uint32_t crcStart() const { return mInitialRemainder; }
+	uint32_t crcUpdate(uint32_t crc, const unsigned char *str, unsigned len) const;
+	// Copy a piece and run the CRC over it in the same pass.
+	uint32_t crcCopy(uint32_t crc, unsigned char *dst, const unsigned char *src, unsigned len) const;
+	uint32_t crcFinish(uint32_t crc) const { return (~crc) & mMask; }
+};
+
+// 04.64 5.5 FCS [Frame Check Sequence] field, aka parity.
+// The CRC shall be the ones complement of the sum (modulo 2) of:
+// 		the remainder of xk (x23 + x22 + x21 +... + x2 + x + 1) divided (modulo 2) by
+//		the generator polynomial, where k is the number of bits of the dividend;
+// 	plus the remainder of the division (modulo 2) by the generator polynomial
+// 		of the product of x24 by the dividend.
+// The CRC-24 generator polynomial is:
+// G(x) = x24 + x23 + x21 + x20 + x19 + x17 + x16 + x15 + x13 + x8 + x7 + x5 + x4 + x2 + 1
+class LlcParity : public Parity32 {
+	static const uint32_t sFCSGenerator = (1 << 24) + (1 << 23) + (1 << 21) + (1 << 20) + (1 << 19) + (1 << 17) +
+					      (1 << 16) + (1 << 15) + (1 << 13) + (1 << 8) + (1 << 7) + (1 << 5) +
+					      (1 << 4) + (1 << 2) + 1;
+
+public:
+	static const unsigned sFCSLength = 3;
+	LlcParity() : Parity32(sFCSGenerator, 24, true){};
+	void appendFCS(ByteVector &bv);
+	bool checkFCS(ByteVector &bv); // true if parity ok.
+	// Write a finished fcs, LSB first.
+	static void writeFCS(unsigned char *dst, uint32_t fcs)
+	{
+		dst[0] = fcs & 0xff;
+		dst[1] = (fcs >> 8) & 0xff;
+		dst[2] = (fcs >> 16) & 0xff;
+	}
+};
+extern LlcParity gLlcParity;
+
+// A downlink LLC UI frame described in pieces, like an iovec, so SNDCP can cut an N-PDU into segments without
+// copying each one into a frame of its own and LLC can add its header without copying the frame again.
+// The SNDCP and LLC headers are written backward into the headroom, the payload is a view of the N-PDU,
+// and the FCS is computed over the pieces as gather puts them together.
+struct LlcDlChain {
+	// SNDCP header up to 4 bytes and the LLC UI header 3.
+	static const unsigned sHeadroom = 8;
+
+	unsigned char mHead[sHeadroom];
+	unsigned mHeadStart;
+	const unsigned char *mPayload; // A view; the N-PDU must outlive the chain.
+	unsigned mPayloadSize;
+
+	LlcDlChain() { reset(0, 0); }
+
+	void reset(const unsigned char *wPayload, unsigned wPayloadSize)
+	{
+		mHeadStart = sHeadroom;
+		mPayload = wPayload;
+		mPayloadSize = wPayloadSize;
+	}
+
+	unsigned char *prepend(unsigned len)
+	{
+		assert(len <= mHeadStart);
+		mHeadStart -= len;
+		return mHead + mHeadStart;
+	}
+
+	unsigned headSize() const { return sHeadroom - mHeadStart; }
+	// The whole frame, FCS included.
+	unsigned size() const { return headSize() + mPayloadSize + LlcParity::sFCSLength; }
+
+	// 04.65 6.7.2: the SN-UNITDATA header, with the DCOMP/PCOMP byte on the first segment.
+	void prependSndcpHeader(unsigned flags, bool first, unsigned segnum, unsigned pduNumber);
+	// 04.64 6.2.3 and 6.3.5.2: the address field and the UI control field, no ciphering, FCS over everything.
+	void prependUIHeader(unsigned sapi, bool isCmd, unsigned nu);
+
+	// Put the frame together at dst, which needs size() bytes, with the FCS on the end; returns size().
+	unsigned gather(unsigned char *dst) const;
+};
+
+// 04.65 6.7: A downlink N-PDU cut into SN-UNITDATA segments of at most segsize bytes.
+// Each segment is a view of the N-PDU with its SNDCP header; nothing is copied.
+class SndcpSegmenter {
+	const ByteVector &mNPdu;
+	unsigned mSegSize;
+	unsigned mFlags; // NSAPI and T bit.
+	unsigned mPduNumber;
+	unsigned mOffset;
+	unsigned mSegNum;
+
+public:
+	enum { // Address field bits
+		F_BIT = 0x40,
+		T_BIT = 0x20,
+		M_BIT = 0x10
+	};
+
+	SndcpSegmenter(const ByteVector &wNPdu, unsigned wSegSize, unsigned wNSapi, unsigned wPduNumber)
+		: mNPdu(wNPdu), mSegSize(wSegSize), mFlags(wNSapi | T_BIT), mPduNumber(wPduNumber), mOffset(0),
+		  mSegNum(0)
+	{
+		assert(mSegSize > 0);
+	}
+
+	unsigned segments() const { return mNPdu.size() ? (mNPdu.size() + mSegSize - 1) / mSegSize : 1; }
+
+	// Set the chain to the next segment; false when there are no more.
+	bool next(LlcDlChain &chain);
+};
+
+}; // namespace SGSN
+
+#endif
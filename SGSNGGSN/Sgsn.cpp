@@ -49,7 +49,8 @@ static void sendAuthenticationRequest(SgsnInfo *si, GmmInfo::SecurityState secSt
 static SgsnInfo *sgsnGetSgsnInfoByHandle(uint32_t mshandle, bool create);
 static int getNMO();
 
-bool sgsnDebug() { return gConfig.getBool("SGSN.Debug"); }
+static ConfigHandle<bool> sSgsnDebug("SGSN.Debug");
+bool sgsnDebug() { return sSgsnDebug.get(); }
 
 bool enableMultislot()
 {
@@ -1393,7 +1394,8 @@ SgsnInfo *findSgsnInfoByHandle(uint32_t handle, bool create)
 	SgsnInfo *si, *result = NULL;
 	// We can delete unused SgsnInfo as soon as the attach procedure is over,
 	// which is 15s, but let them hang around a bit longer so the user can see them.
-	int idletime = gConfig.getNum("SGSN.Timer.MS.Idle");
+	static ConfigHandle<int> sIdleTime("SGSN.Timer.MS.Idle");
+	int idletime = sIdleTime.get();
 	time_t now;
 	time(&now);
 	RN_FOR_ALL(SgsnInfoList_t, sSgsnInfoList, si)
@@ -106,6 +106,7 @@
 #include <linux/if_tun.h> // pat added.
 
 #include <CommonLibs/Configuration.h>
+#include <CommonLibs/Stats.h>
 
 #include "Ggsn.h"
 #include "miniggsn.h"
@@ -129,6 +130,12 @@ int tun_fd = -1;	// This is the tunnel we use to talk with the MSs.
 FILE *mg_log_fp = NULL; // Extra log file for IP traffic.
 int mg_debug_level = 0;
 
+static StatCounter sDownlinkPackets("GGSN.Downlink.Packets", "packets read from the tunnel for the MSs");
+static StatCounter sDownlinkBytes("GGSN.Downlink.Bytes", "bytes read from the tunnel for the MSs");
+static StatCounter sUplinkPackets("GGSN.Uplink.Packets", "packets from the MSs written to the tunnel");
+static StatCounter sUplinkBytes("GGSN.Uplink.Bytes", "bytes from the MSs written to the tunnel");
+static StatCounter sUplinkDiscards("GGSN.Uplink.Discards", "packets from the MSs that failed a check or the firewall");
+
 // old:
 // static char const *mg_base_ip_str = "192.168.99.1";	// This did not raw bind.
 // static char const *mg_base_ip_route = "192.168.99.0/24";
@@ -307,6 +314,8 @@ unsigned char *miniggsn_rcv_npdu(int *plen, uint32_t *dstaddr)
 			// ip_ntoa(iph->daddr,NULL), timestr());
 		}
 
+		sDownlinkPackets.inc();
+		sDownlinkBytes.inc(ret);
 		*dstaddr = iph->daddr;
 		// TODO: Do we have to allocate a new buffer?
 		*plen = ret;
@@ -414,6 +423,7 @@ int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp, unsigned char *npdu, unsigned len)
 #define MUST_HAVE(assertion) \
 	if (!(assertion)) { \
 		MGERROR("ggsn: Packet failed test, discarded: %s", #assertion); \
+		sUplinkDiscards.inc(); \
 		return -1; \
 	}
 
@@ -451,6 +461,7 @@ int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp, unsigned char *npdu, unsigned len)
 			char ipaddrbuf[50];
 			ip_ntoa(packet_dest_ip_addr, ipaddrbuf);
 			MGERROR("ggsn: Packet wth dest ip = %s discarded by firewall", ipaddrbuf);
+			sUplinkDiscards.inc();
 			return -1;
 		}
 	}
@@ -466,6 +477,9 @@ int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp, unsigned char *npdu, unsigned len)
 	int result = write(tun_fd, npdu, len);
 	if (result != (int)len) {
 		MGERROR("ggsn: error: write(tun_fd,%d) result=%d %s", len, result, strerror(errno));
+	} else {
+		sUplinkPackets.inc();
+		sUplinkBytes.inc(len);
 	}
 	return 0;
 }
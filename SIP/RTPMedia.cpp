@@ -0,0 +1,677 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
+
+#include "RTPMedia.h"
+
+using namespace SIP;
+using namespace std;
+
+static StatGauge sSessions("SIP.RTP.Sessions", "RTP sessions open");
+static StatCounter sReceived("SIP.RTP.Received", "RTP packets received");
+static StatCounter sSent("SIP.RTP.Sent", "RTP packets sent");
+static StatCounter sLate("SIP.RTP.Late", "frames that came after their turn to play");
+static StatCounter sLost("SIP.RTP.Lost", "gaps played out");
+static StatCounter sPoolEmpty("SIP.RTP.PoolEmpty", "frames dropped for want of a free frame");
+static StatCounter sRefused("SIP.RTP.Refused", "sessions refused because every media thread was full");
+static StatHistogram sTickTime("SIP.RTP.Tick", "us", "media thread time to play out and send for all its sessions");
+
+static const unsigned sFrameSamples = 160;	  // 20 ms at 8 kHz.
+static const uint64_t sTickNs = 20000000ULL;
+static const unsigned sHeaderSize = 12;	  // RTP without CSRCs.
+static const unsigned sMaxBatch = 16;	  // Datagrams per recvmmsg or sendmmsg.
+static const unsigned sMaxTxQueue = 4;	  // Frames a call may queue ahead of the media thread.
+static const unsigned sDTMFEndPackets = 3; // RFC 4733 2.5.1.4.
+
+// RTPFramePool
+
+RTPFramePool::RTPFramePool(unsigned count) : mFrames(count), mFree(NULL), mAvailable(count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		mFrames[i].mNext = mFree;
+		mFree = &mFrames[i];
+	}
+}
+
+RTPFrame *RTPFramePool::get()
+{
+	ScopedLock lock(mLock);
+	RTPFrame *frame = mFree;
+	if (!frame) {
+		sPoolEmpty.inc();
+		return NULL;
+	}
+	mFree = frame->mNext;
+	frame->mNext = NULL;
+	mAvailable--;
+	return frame;
+}
+
+void RTPFramePool::put(RTPFrame *frame)
+{
+	if (!frame)
+		return;
+	ScopedLock lock(mLock);
+	frame->mNext = mFree;
+	mFree = frame;
+	mAvailable++;
+}
+
+unsigned RTPFramePool::available() const
+{
+	ScopedLock lock(const_cast<Mutex &>(mLock));
+	return mAvailable;
+}
+
+// RTPJitterBuffer
+
+RTPJitterBuffer::RTPJitterBuffer(RTPFramePool &wPool)
+	: mPool(wPool), mBuffered(0), mStarted(false), mPlaying(false), mNextSeq(0), mHaveTransit(false),
+	  mLastTransit(0), mJitter(0), mTarget(1), mLate(0), mLost(0), mPlayed(0), mDropped(0)
+{
+	memset(mSlots, 0, sizeof(mSlots));
+}
+
+RTPJitterBuffer::~RTPJitterBuffer() { reset(); }
+
+void RTPJitterBuffer::discard(unsigned slot)
+{
+	if (mSlots[slot]) {
+		mPool.put(mSlots[slot]);
+		mSlots[slot] = NULL;
+		mBuffered--;
+	}
+}
+
+void RTPJitterBuffer::reset()
+{
+	for (unsigned i = 0; i < sSlots; i++) {
+		discard(i);
+	}
+	mStarted = false;
+	mPlaying = false;
+}
+
+void RTPJitterBuffer::put(RTPFrame *frame, uint32_t arrival)
+{
+	// RFC 3550 6.4.1, in samples.
+	int64_t transit = (int32_t)(arrival - frame->mTimestamp);
+	if (mHaveTransit) {
+		int64_t d = transit - mLastTransit;
+		mJitter += ((d < 0 ? -d : d) - mJitter) / 16.0;
+	}
+	mLastTransit = transit;
+	mHaveTransit = true;
+	mTarget = 1 + (unsigned)(3 * mJitter / sFrameSamples + 0.999);
+	if (mTarget > sMaxTarget)
+		mTarget = sMaxTarget;
+
+	if (!mStarted) {
+		mStarted = true;
+		mNextSeq = frame->mSeq;
+	}
+	int ahead = (int16_t)(frame->mSeq - mNextSeq);
+	if (ahead < 0) {
+		// Before playout starts, an earlier frame moves the start back, if what is held still fits behind it.
+		bool fits = !mPlaying && -ahead < (int)sSlots;
+		for (int off = sSlots + ahead; fits && off < (int)sSlots; off++) {
+			fits = !mSlots[(uint16_t)(mNextSeq + off) % sSlots];
+		}
+		if (!fits) {
+			mLate++;
+			sLate.inc();
+			mPool.put(frame);
+			return;
+		}
+		mNextSeq = frame->mSeq;
+		ahead = 0;
+	}
+	if (ahead >= (int)sSlots) {
+		// A jump in the stream, as after a long silence or a restart of the far end.  Start over from here.
+		reset();
+		mStarted = true;
+		mNextSeq = frame->mSeq;
+	}
+	unsigned slot = frame->mSeq % sSlots;
+	if (mSlots[slot]) {
+		mDropped++;
+		mPool.put(frame);
+		return;
+	}
+	mSlots[slot] = frame;
+	mBuffered++;
+}
+
+RTPFrame *RTPJitterBuffer::get()
+{
+	if (!mPlaying) {
+		// Prefill to the target delay.
+		if (mBuffered == 0 || mBuffered < mTarget)
+			return NULL;
+		mPlaying = true;
+		while (!mSlots[mNextSeq % sSlots]) {
+			mNextSeq++;
+		}
+	}
+	// More delay than the jitter calls for: skip ahead.
+	while (mBuffered > mTarget + 2) {
+		unsigned slot = mNextSeq % sSlots;
+		if (mSlots[slot]) {
+			discard(slot);
+			mDropped++;
+		}
+		mNextSeq++;
+	}
+	unsigned slot = mNextSeq % sSlots;
+	RTPFrame *frame = mSlots[slot];
+	mSlots[slot] = NULL;
+	mNextSeq++;
+	if (frame) {
+		mBuffered--;
+		mPlayed++;
+		return frame;
+	}
+	mLost++;
+	sLost.inc();
+	if (mBuffered == 0) {
+		// Underrun; prefill again, to what is probably a longer target by now.
+		mPlaying = false;
+	}
+	return NULL;
+}
+
+// RTPMediaSession
+
+RTPMediaSession::RTPMediaSession(RTPMediaEngine *wEngine, int wFD, unsigned short wPort,
+	const struct sockaddr_in &wRemote, uint8_t wPayloadType, int wDTMFPayloadType)
+	: mEngine(wEngine), mFD(wFD), mPort(wPort), mRemote(wRemote), mPayloadType(wPayloadType),
+	  mDTMFPayloadType(wDTMFPayloadType), mSSRC(random()), mTxSeq(random()), mClosing(false), mRestarting(false),
+	  mJitter(wEngine->pool()), mTxHead(NULL), mTxTail(NULL), mTxTime(random()), mPlayoutHead(0),
+	  mPlayoutCount(0), mDTMF('\0'), mDTMFStartTime(0), mDTMFDuration(0), mDTMFEnds(0), mNewRemote(wRemote),
+	  mNewPayloadType(wPayloadType), mNewDTMFPayloadType(wDTMFPayloadType)
+{
+	sSessions.add(1);
+}
+
+RTPMediaSession::~RTPMediaSession()
+{
+	::close(mFD);
+	RTPFramePool &pool = mEngine->pool();
+	while (mTxHead) {
+		RTPFrame *next = mTxHead->mNext;
+		pool.put(mTxHead);
+		mTxHead = next;
+	}
+	for (unsigned i = 0; i < mPlayoutCount; i++) {
+		pool.put(mPlayout[(mPlayoutHead + i) % sPlayoutSlots]);
+	}
+	sSessions.add(-1);
+}
+
+void RTPMediaSession::send(const unsigned char *frame, unsigned length)
+{
+	RTPFrame *f = mEngine->pool().get();
+	if (!f)
+		return;
+	if (length > RTPFrame::sMaxPayload)
+		length = RTPFrame::sMaxPayload;
+	memcpy(f->mData, frame, length);
+	f->mLength = length;
+	RTPFrame *drop = NULL;
+	{
+		ScopedLock lock(mLock);
+		f->mTimestamp = mTxTime;
+		mTxTime += sFrameSamples;
+		if (mTxTail)
+			mTxTail->mNext = f;
+		else
+			mTxHead = f;
+		mTxTail = f;
+		// Don't let the call get more than a few frames ahead; the oldest is the least use.
+		unsigned n = 0;
+		for (RTPFrame *p = mTxHead; p; p = p->mNext) {
+			n++;
+		}
+		if (n > sMaxTxQueue) {
+			drop = mTxHead;
+			mTxHead = drop->mNext;
+		}
+	}
+	mEngine->pool().put(drop);
+}
+
+int RTPMediaSession::recv(unsigned char *frame, unsigned maxLength, unsigned timeout)
+{
+	RTPFrame *f;
+	{
+		ScopedLock lock(mLock);
+		if (!mPlayoutCount && timeout)
+			mPlayoutSignal.wait(mLock, timeout);
+		if (!mPlayoutCount)
+			return 0;
+		f = mPlayout[mPlayoutHead];
+		mPlayoutHead = (mPlayoutHead + 1) % sPlayoutSlots;
+		mPlayoutCount--;
+	}
+	if (!f)
+		return 0;
+	unsigned length = f->mLength < maxLength ? f->mLength : maxLength;
+	memcpy(frame, f->mData, length);
+	mEngine->pool().put(f);
+	return length;
+}
+
+bool RTPMediaSession::startDTMF(char key)
+{
+	if (!strchr("0123456789*#ABCDabcd", key))
+		return false;
+	ScopedLock lock(mLock);
+	if ((mRestarting ? mNewDTMFPayloadType : mDTMFPayloadType) < 0)
+		return false;
+	mDTMF = key;
+	mDTMFStartTime = mTxTime;
+	mDTMFDuration = 0;
+	mDTMFEnds = 0;
+	return true;
+}
+
+void RTPMediaSession::stopDTMF()
+{
+	ScopedLock lock(mLock);
+	if (mDTMF && !mDTMFEnds)
+		mDTMFEnds = sDTMFEndPackets;
+}
+
+// RTPMediaEngine
+
+// The RFC 4733 event code for a key.
+static unsigned DTMFEvent(char key)
+{
+	if (key >= '0' && key <= '9')
+		return key - '0';
+	if (key == '*')
+		return 10;
+	if (key == '#')
+		return 11;
+	return 12 + (toupper(key) - 'A');
+}
+
+static void putHeader(unsigned char *p, bool marker, uint8_t payloadType, uint16_t seq, uint32_t timestamp,
+	uint32_t SSRC)
+{
+	p[0] = 0x80;
+	p[1] = (marker ? 0x80 : 0) | (payloadType & 0x7f);
+	p[2] = seq >> 8;
+	p[3] = seq;
+	p[4] = timestamp >> 24;
+	p[5] = timestamp >> 16;
+	p[6] = timestamp >> 8;
+	p[7] = timestamp;
+	p[8] = SSRC >> 24;
+	p[9] = SSRC >> 16;
+	p[10] = SSRC >> 8;
+	p[11] = SSRC;
+}
+
+// Enough for every session to fill its jitter buffer and its queues at once.
+RTPMediaEngine::RTPMediaEngine(unsigned numWorkers, unsigned maxWorkerSessions)
+	: mPool(numWorkers * maxWorkerSessions *
+		(RTPJitterBuffer::sSlots + RTPMediaSession::sPlayoutSlots + sMaxTxQueue + 1)),
+	  mNextWorker(0), mMaxSessions(numWorkers * maxWorkerSessions), mSessions(0), mStopping(false)
+{
+	assert(numWorkers > 0);
+	for (unsigned i = 0; i < numWorkers; i++) {
+		Worker *w = new Worker;
+		w->mEngine = this;
+		w->mEpoll = epoll_create1(0);
+		w->mCPUNs = 0;
+		if (w->mEpoll < 0) {
+			LOG(ALERT) << "cannot create epoll set: " << strerror(errno);
+		}
+		mWorkers.push_back(w);
+		w->mThread.start(workerLoop, w);
+	}
+}
+
+RTPMediaEngine::~RTPMediaEngine()
+{
+	mStopping = true;
+	for (unsigned i = 0; i < mWorkers.size(); i++) {
+		Worker *w = mWorkers[i];
+		w->mThread.join();
+		for (unsigned j = 0; j < w->mSessions.size(); j++) {
+			delete w->mSessions[j];
+		}
+		for (unsigned j = 0; j < w->mAdded.size(); j++) {
+			delete w->mAdded[j];
+		}
+		::close(w->mEpoll);
+		delete w;
+	}
+}
+
+static bool remoteAddress(const char *IP, unsigned short port, struct sockaddr_in &address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	if (!inet_aton(IP, &address.sin_addr)) {
+		LOG(ERR) << "bad RTP remote address " << IP;
+		return false;
+	}
+	return true;
+}
+
+RTPMediaSession *RTPMediaEngine::open(unsigned short localPort, const char *remoteIP, unsigned short remotePort,
+	uint8_t payloadType, int DTMFPayloadType)
+{
+	struct sockaddr_in remote;
+	if (!remoteAddress(remoteIP, remotePort, remote))
+		return NULL;
+
+	// The pool has frames for this many and no more.
+	if (__atomic_add_fetch(&mSessions, 1, __ATOMIC_RELAXED) > mMaxSessions) {
+		__atomic_sub_fetch(&mSessions, 1, __ATOMIC_RELAXED);
+		LOG(ALERT) << "no RTP session for port " << localPort << ", all " << mMaxSessions << " in use";
+		sRefused.inc();
+		return NULL;
+	}
+
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		LOG(ERR) << "cannot open RTP socket: " << strerror(errno);
+		__atomic_sub_fetch(&mSessions, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(localPort);
+	local.sin_addr.s_addr = INADDR_ANY;
+	socklen_t length = sizeof(local);
+	if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+		getsockname(fd, (struct sockaddr *)&local, &length) < 0) {
+		LOG(ERR) << "cannot bind RTP port " << localPort << ": " << strerror(errno);
+		::close(fd);
+		__atomic_sub_fetch(&mSessions, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	RTPMediaSession *session =
+		new RTPMediaSession(this, fd, ntohs(local.sin_port), remote, payloadType, DTMFPayloadType);
+	Worker *w = mWorkers[__atomic_fetch_add(&mNextWorker, 1, __ATOMIC_RELAXED) % mWorkers.size()];
+	ScopedLock lock(w->mLock);
+	w->mAdded.push_back(session);
+	return session;
+}
+
+bool RTPMediaEngine::restart(RTPMediaSession *session, const char *remoteIP, unsigned short remotePort,
+	uint8_t payloadType, int DTMFPayloadType)
+{
+	struct sockaddr_in remote;
+	if (!remoteAddress(remoteIP, remotePort, remote))
+		return false;
+	ScopedLock lock(session->mLock);
+	session->mNewRemote = remote;
+	session->mNewPayloadType = payloadType;
+	session->mNewDTMFPayloadType = DTMFPayloadType;
+	__atomic_store_n(&session->mRestarting, true, __ATOMIC_RELEASE);
+	return true;
+}
+
+void RTPMediaEngine::close(RTPMediaSession *session)
+{
+	if (session)
+		__atomic_store_n(&session->mClosing, true, __ATOMIC_RELEASE);
+}
+
+uint64_t RTPMediaEngine::CPUNs() const
+{
+	uint64_t total = 0;
+	for (unsigned i = 0; i < mWorkers.size(); i++) {
+		total += __atomic_load_n(&mWorkers[i]->mCPUNs, __ATOMIC_RELAXED);
+	}
+	return total;
+}
+
+void RTPMediaEngine::receive(RTPMediaSession *session)
+{
+	unsigned char buffers[sMaxBatch][sHeaderSize + 15 * 4 + RTPFrame::sMaxPayload];
+	struct iovec iov[sMaxBatch];
+	struct mmsghdr msgs[sMaxBatch];
+	struct sockaddr_in sources[sMaxBatch];
+	while (true) {
+		for (unsigned i = 0; i < sMaxBatch; i++) {
+			iov[i].iov_base = buffers[i];
+			iov[i].iov_len = sizeof(buffers[i]);
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &sources[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+		}
+		int n = recvmmsg(session->mFD, msgs, sMaxBatch, MSG_DONTWAIT, NULL);
+		if (n <= 0)
+			return;
+		uint32_t arrival = statNanoseconds() / 125000; // 8 kHz samples.
+		sReceived.inc(n);
+		for (int i = 0; i < n; i++) {
+			const unsigned char *p = buffers[i];
+			unsigned length = msgs[i].msg_len;
+			if (length < sHeaderSize || (p[0] >> 6) != 2)
+				continue;
+			unsigned header = sHeaderSize + 4 * (p[0] & 0x0f);
+			if ((p[1] & 0x7f) != session->mPayloadType || length < header)
+				continue; // Incoming RFC 2833 events are not handled, as before.
+			RTPFrame *frame = mPool.get();
+			if (!frame)
+				continue;
+			frame->mSeq = (p[2] << 8) | p[3];
+			frame->mTimestamp = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+			frame->mLength = length - header < RTPFrame::sMaxPayload ? length - header : RTPFrame::sMaxPayload;
+			memcpy(frame->mData, p + header, frame->mLength);
+			session->mJitter.put(frame, arrival);
+			// Symmetric RTP: answer where the stream comes from.
+			if (sources[i].sin_port != session->mRemote.sin_port ||
+				sources[i].sin_addr.s_addr != session->mRemote.sin_addr.s_addr) {
+				session->mRemote = sources[i];
+			}
+		}
+		if (n < (int)sMaxBatch)
+			return;
+	}
+}
+
+void RTPMediaEngine::tick(RTPMediaSession *session)
+{
+	if (__atomic_load_n(&session->mRestarting, __ATOMIC_ACQUIRE)) {
+		// The payload types are read by receive(), on this thread, so they change here and not in restart().
+		{
+			ScopedLock lock(session->mLock);
+			session->mRemote = session->mNewRemote;
+			session->mPayloadType = session->mNewPayloadType;
+			session->mDTMFPayloadType = session->mNewDTMFPayloadType;
+			session->mRestarting = false;
+		}
+		session->mJitter.reset();
+	}
+	RTPFrame *played = session->mJitter.get();
+	RTPFrame *tx;
+	char DTMF;
+	uint32_t DTMFStartTime;
+	unsigned DTMFDuration;
+	bool DTMFEnd;
+	RTPFrame *overflow = NULL;
+	{
+		ScopedLock lock(session->mLock);
+		if (session->mPlayoutCount == RTPMediaSession::sPlayoutSlots) {
+			// The call is not keeping up; it loses the oldest.
+			overflow = session->mPlayout[session->mPlayoutHead];
+			session->mPlayoutHead = (session->mPlayoutHead + 1) % RTPMediaSession::sPlayoutSlots;
+			session->mPlayoutCount--;
+		}
+		session->mPlayout[(session->mPlayoutHead + session->mPlayoutCount) % RTPMediaSession::sPlayoutSlots] =
+			played;
+		session->mPlayoutCount++;
+		session->mPlayoutSignal.signal();
+
+		tx = session->mTxHead;
+		session->mTxHead = session->mTxTail = NULL;
+
+		DTMF = session->mDTMF;
+		DTMFStartTime = session->mDTMFStartTime;
+		DTMFDuration = session->mDTMFDuration;
+		DTMFEnd = session->mDTMFEnds > 0;
+		if (DTMF) {
+			if (DTMFEnd) {
+				if (--session->mDTMFEnds == 0)
+					session->mDTMF = '\0';
+			} else {
+				session->mDTMFDuration += sFrameSamples;
+			}
+		}
+	}
+	mPool.put(overflow);
+
+	if (!session->mRemote.sin_port) {
+		while (tx) {
+			RTPFrame *next = tx->mNext;
+			mPool.put(tx);
+			tx = next;
+		}
+		return;
+	}
+
+	unsigned char buffers[sMaxTxQueue + 1][sHeaderSize + RTPFrame::sMaxPayload];
+	struct iovec iov[sMaxTxQueue + 1];
+	struct mmsghdr msgs[sMaxTxQueue + 1];
+	unsigned n = 0;
+	while (tx) {
+		RTPFrame *next = tx->mNext;
+		putHeader(buffers[n], false, session->mPayloadType, session->mTxSeq++, tx->mTimestamp, session->mSSRC);
+		memcpy(buffers[n] + sHeaderSize, tx->mData, tx->mLength);
+		iov[n].iov_len = sHeaderSize + tx->mLength;
+		mPool.put(tx);
+		tx = next;
+		n++;
+	}
+	if (DTMF) {
+		unsigned char *p = buffers[n];
+		putHeader(p, DTMFDuration == 0, session->mDTMFPayloadType, session->mTxSeq++, DTMFStartTime,
+			session->mSSRC);
+		p[sHeaderSize] = DTMFEvent(DTMF);
+		p[sHeaderSize + 1] = (DTMFEnd ? 0x80 : 0) | 10; // Volume -10 dBm0.
+		p[sHeaderSize + 2] = DTMFDuration >> 8;
+		p[sHeaderSize + 3] = DTMFDuration;
+		iov[n].iov_len = sHeaderSize + 4;
+		n++;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		iov[i].iov_base = buffers[i];
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &session->mRemote;
+		msgs[i].msg_hdr.msg_namelen = sizeof(session->mRemote);
+	}
+	if (n) {
+		int sent = sendmmsg(session->mFD, msgs, n, MSG_DONTWAIT);
+		if (sent > 0)
+			sSent.inc(sent);
+	}
+}
+
+void *RTPMediaEngine::workerLoop(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	RTPMediaEngine *engine = w->mEngine;
+	struct epoll_event events[64];
+	uint64_t nextTick = statNanoseconds() + sTickNs;
+	while (!engine->mStopping) {
+		uint64_t now = statNanoseconds();
+		int timeout = now >= nextTick ? 0 : (nextTick - now + 999999) / 1000000;
+		int n = epoll_wait(w->mEpoll, events, 64, timeout);
+		for (int i = 0; i < n; i++) {
+			engine->receive((RTPMediaSession *)events[i].data.ptr);
+		}
+		now = statNanoseconds();
+		if (now < nextTick)
+			continue;
+		nextTick += sTickNs;
+		if (now > nextTick + 5 * sTickNs) {
+			// Stalled; don't try to catch up.
+			nextTick = now + sTickNs;
+		}
+
+		{
+			ScopedLock lock(w->mLock);
+			for (unsigned i = 0; i < w->mAdded.size(); i++) {
+				RTPMediaSession *session = w->mAdded[i];
+				struct epoll_event ev;
+				ev.events = EPOLLIN;
+				ev.data.ptr = session;
+				if (epoll_ctl(w->mEpoll, EPOLL_CTL_ADD, session->mFD, &ev) < 0) {
+					LOG(ERR) << "cannot add RTP port " << session->mPort << " to epoll: " << strerror(errno);
+				}
+				w->mSessions.push_back(session);
+			}
+			w->mAdded.clear();
+		}
+
+		for (unsigned i = 0; i < w->mSessions.size();) {
+			RTPMediaSession *session = w->mSessions[i];
+			if (__atomic_load_n(&session->mClosing, __ATOMIC_ACQUIRE)) {
+				epoll_ctl(w->mEpoll, EPOLL_CTL_DEL, session->mFD, NULL);
+				delete session;
+				__atomic_sub_fetch(&engine->mSessions, 1, __ATOMIC_RELAXED);
+				w->mSessions[i] = w->mSessions.back();
+				w->mSessions.pop_back();
+				continue;
+			}
+			engine->tick(session);
+			i++;
+		}
+
+		struct timespec cpu;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+		__atomic_store_n(&w->mCPUNs, (uint64_t)cpu.tv_sec * 1000000000ULL + cpu.tv_nsec, __ATOMIC_RELAXED);
+		sTickTime.record((statNanoseconds() - now) / 1000);
+	}
+	return NULL;
+}
+
+RTPMediaEngine &SIP::rtpMediaEngine()
+{
+	static RTPMediaEngine *engine = NULL;
+	static Mutex lock;
+	ScopedLock sl(lock);
+	if (!engine) {
+		engine = new RTPMediaEngine(gConfig.getNum("SIP.RTP.Workers"), gConfig.getNum("SIP.RTP.SessionsPerWorker"));
+	}
+	return *engine;
+}
@@ -0,0 +1,256 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef RTPMEDIA_H
+#define RTPMEDIA_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <CommonLibs/Threads.h>
+
+namespace SIP {
+
+/** A vocoder frame, from an RTPFramePool. */
+struct RTPFrame {
+	static const unsigned sMaxPayload = 160; ///< Big enough for G.711.
+
+	RTPFrame *mNext; ///< For whatever list the frame is on.
+	uint32_t mTimestamp;
+	uint16_t mSeq;
+	uint16_t mLength;
+	unsigned char mData[sMaxPayload];
+};
+
+/**
+	Preallocated RTPFrames, so the media path does not allocate.
+	Every RTPFrame is in one place at a time: the pool, a jitter buffer, a send queue or a playout queue.
+*/
+class RTPFramePool {
+	Mutex mLock;
+	std::vector<RTPFrame> mFrames;
+	RTPFrame *mFree;
+	unsigned mAvailable;
+
+public:
+	RTPFramePool(unsigned count);
+
+	/** @return A frame, or NULL if the pool is empty. */
+	RTPFrame *get();
+
+	/** Give a frame back; NULL is ignored. */
+	void put(RTPFrame *frame);
+
+	unsigned available() const;
+	unsigned size() const { return mFrames.size(); }
+};
+
+/**
+	An adaptive jitter buffer for one RTP stream of 20 ms frames.
+	It estimates the interarrival jitter as in RFC 3550 6.4.1 and holds back playout by enough frames to cover
+	about three times that, so the delay grows when the network gets worse and shrinks again when it settles.
+	Frames are held by sequence number, so reordered frames play in order; a frame that comes after its turn to
+	play is dropped as late, and a frame that never comes is a gap for the vocoder to conceal.
+	Not thread-safe; it belongs to the media thread of its session.
+*/
+class RTPJitterBuffer {
+public:
+	static const unsigned sSlots = 32;	  ///< The most frames held, 640 ms.
+	static const unsigned sMaxTarget = 10; ///< The most delay, in frames.
+
+private:
+	RTPFramePool &mPool;
+	RTPFrame *mSlots[sSlots]; ///< By sequence number modulo sSlots.
+	unsigned mBuffered;
+	bool mStarted;	///< Anything has come.
+	bool mPlaying;	///< Past the prefill; gets play frames.
+	uint16_t mNextSeq; ///< The next to play.
+
+	bool mHaveTransit;
+	int64_t mLastTransit; ///< Arrival minus RTP timestamp, in 8 kHz samples.
+	double mJitter;	      ///< In 8 kHz samples.
+	unsigned mTarget;     ///< Delay, in frames.
+
+	unsigned mLate, mLost, mPlayed, mDropped;
+
+	void discard(unsigned slot);
+
+public:
+	RTPJitterBuffer(RTPFramePool &wPool);
+	~RTPJitterBuffer();
+
+	/**
+		Take a frame that arrived.
+		@param arrival The arrival time, in 8 kHz samples on any clock.
+	*/
+	void put(RTPFrame *frame, uint32_t arrival);
+
+	/**
+		Take the frame to play at this 20 ms tick.
+		@return The frame, to go back to the pool, or NULL for a gap or while prefilling.
+	*/
+	RTPFrame *get();
+
+	/** Return every frame to the pool and start over. */
+	void reset();
+
+	unsigned buffered() const { return mBuffered; }
+	unsigned target() const { return mTarget; }
+	double jitterMs() const { return mJitter / 8.0; }
+	unsigned late() const { return mLate; }
+	unsigned lost() const { return mLost; }
+	unsigned played() const { return mPlayed; }
+	/** Thrown away to shrink the delay, or as duplicates. */
+	unsigned dropped() const { return mDropped; }
+};
+
+class RTPMediaEngine;
+
+/**
+	One RTP stream, both ways, served by an RTPMediaEngine.
+	The call thread calls send() and recv(); the socket, the jitter buffer and the timing belong to a media thread.
+*/
+class RTPMediaSession {
+	friend class RTPMediaEngine;
+
+	static const unsigned sPlayoutSlots = 4;
+
+	RTPMediaEngine *mEngine;
+	int mFD;
+	unsigned short mPort;
+	struct sockaddr_in mRemote; ///< Follows where the stream comes from, for symmetric RTP.
+	uint8_t mPayloadType;
+	int mDTMFPayloadType; ///< -1 for none.
+	uint32_t mSSRC;
+	uint16_t mTxSeq; ///< Media thread only.
+	bool mClosing;
+	bool mRestarting; ///< A restart is waiting in mNewRemote and the rest, for the media thread.
+
+	RTPJitterBuffer mJitter; ///< Media thread only.
+
+	Mutex mLock; ///< For what follows, between the call thread and the media thread.
+	Signal mPlayoutSignal;
+	RTPFrame *mTxHead, *mTxTail;
+	uint32_t mTxTime;
+	RTPFrame *mPlayout[sPlayoutSlots]; ///< Frames or gaps (NULL) the media thread played, for recv().
+	unsigned mPlayoutHead, mPlayoutCount;
+	char mDTMF;
+	uint32_t mDTMFStartTime;
+	unsigned mDTMFDuration;
+	unsigned mDTMFEnds; ///< End packets still to send, RFC 4733 2.5.1.4.
+	struct sockaddr_in mNewRemote;
+	uint8_t mNewPayloadType;
+	int mNewDTMFPayloadType;
+
+	RTPMediaSession(RTPMediaEngine *wEngine, int wFD, unsigned short wPort, const struct sockaddr_in &wRemote,
+		uint8_t wPayloadType, int wDTMFPayloadType);
+	~RTPMediaSession();
+
+public:
+	/** Queue a vocoder frame to send at the next tick; it takes the next 20 ms of RTP time. */
+	void send(const unsigned char *frame, unsigned length);
+
+	/**
+		Take the next 20 ms of received audio.
+		@param timeout How long to wait for the next tick, in ms; 0 to poll.
+		@return The length of the frame, or 0 for a gap or none yet.
+	*/
+	int recv(unsigned char *frame, unsigned maxLength, unsigned timeout);
+
+	/** Start sending RFC 2833 events for a key along with the audio. */
+	bool startDTMF(char key);
+
+	/** Send the end of the current event and stop. */
+	void stopDTMF();
+
+	unsigned short port() const { return mPort; }
+	const RTPJitterBuffer &jitter() const { return mJitter; }
+};
+
+/**
+	Serves every RTP session from a few threads.
+	Each thread waits on one epoll set for all of its sessions' sockets and drains a readable socket with one
+	recvmmsg(), into frames from a shared pool and on into each session's jitter buffer.  Every 20 ms it plays one
+	frame out of each jitter buffer to its call and sends what the call queued, with any DTMF event, in one
+	sendmmsg() per session.
+*/
+class RTPMediaEngine {
+	struct Worker {
+		RTPMediaEngine *mEngine;
+		int mEpoll;
+		Thread mThread;
+		Mutex mLock;
+		std::vector<RTPMediaSession *> mAdded; ///< Under mLock, for the worker to take.
+		std::vector<RTPMediaSession *> mSessions; ///< The worker's own.
+		uint64_t mCPUNs;
+	};
+
+	RTPFramePool mPool;
+	std::vector<Worker *> mWorkers;
+	unsigned mNextWorker;
+	unsigned mMaxSessions;
+	unsigned mSessions; ///< Open, or closed and not yet deleted.
+	volatile bool mStopping;
+
+	static void *workerLoop(void *arg);
+	void receive(RTPMediaSession *session);
+	void tick(RTPMediaSession *session);
+
+	RTPMediaEngine(const RTPMediaEngine &);
+	RTPMediaEngine &operator=(const RTPMediaEngine &);
+
+public:
+	/**
+		@param numWorkers The media threads.
+		@param maxWorkerSessions Sessions each thread serves; the frame pool is sized for them all.
+	*/
+	RTPMediaEngine(unsigned numWorkers, unsigned maxWorkerSessions);
+
+	/** Stop the threads and close every session. */
+	~RTPMediaEngine();
+
+	/**
+		Bind a local port and start a session to a remote address.
+		@param DTMFPayloadType The RFC 2833 payload type, or -1 for none.
+		@return The session, or NULL if the port could not be bound or every thread is full.
+	*/
+	RTPMediaSession *open(unsigned short localPort, const char *remoteIP, unsigned short remotePort,
+		uint8_t payloadType, int DTMFPayloadType = -1);
+
+	/**
+		Start a session over to a new remote address, on the same port and socket, as for a re-INVITE.
+		The media thread drops what the jitter buffer holds at its next tick.
+		@return False if the address is bad; the session goes on as it was.
+	*/
+	bool restart(RTPMediaSession *session, const char *remoteIP, unsigned short remotePort, uint8_t payloadType,
+		int DTMFPayloadType = -1);
+
+	/** Close a session; it must not be used after, and the media thread deletes it. */
+	void close(RTPMediaSession *session);
+
+	RTPFramePool &pool() { return mPool; }
+	unsigned workers() const { return mWorkers.size(); }
+
+	/** CPU time the media threads have used, in ns. */
+	uint64_t CPUNs() const;
+};
+
+/** The engine for the calls' RTP, started on first use with SIP.RTP.Workers threads. */
+RTPMediaEngine &rtpMediaEngine();
+
+} // namespace SIP
+
+#endif
@@ -0,0 +1,476 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Checks the jitter buffer and the frame pool, the RTP and RFC 2833 packets a session sends, and then loads the
+// media engine with more and more loopback calls until its threads use more than a quarter of a core or lose more
+// than 1% of the frames.  Every call gets a GSM frame each 20 ms from one generator socket, with some frames held
+// back a tick so they arrive out of order, and the call thread echoes each frame it plays back to the generator.
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
+#include <CommonLibs/Threads.h>
+
+#include "RTPMedia.h"
+
+using namespace SIP;
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static const unsigned sGSMFrame = 33;
+static const double sCPUBudget = 0.25; ///< Of one core, for all the media threads.
+static const unsigned sStepMs = 2000;
+
+static RTPFrame *frame(RTPFramePool &pool, uint16_t seq)
+{
+	RTPFrame *f = pool.get();
+	f->mSeq = seq;
+	f->mTimestamp = seq * 160;
+	f->mLength = sGSMFrame;
+	f->mData[0] = seq;
+	return f;
+}
+
+// The sequence number of the next played frame, or -1 for a gap; the frame goes back to the pool.
+static int play(RTPFramePool &pool, RTPJitterBuffer &jb)
+{
+	RTPFrame *f = jb.get();
+	if (!f)
+		return -1;
+	int seq = f->mSeq;
+	pool.put(f);
+	return seq;
+}
+
+static void testPool()
+{
+	RTPFramePool pool(4);
+	RTPFrame *f[5];
+	for (unsigned i = 0; i < 5; i++) {
+		f[i] = pool.get();
+	}
+	check("pool gives its frames, then NULL", f[0] && f[3] && !f[4] && pool.available() == 0);
+	for (unsigned i = 0; i < 5; i++) {
+		pool.put(f[i]);
+	}
+	check("pool takes them back", pool.available() == 4);
+}
+
+static void testJitterBuffer()
+{
+	RTPFramePool pool(64);
+	{
+		RTPJitterBuffer jb(pool);
+		jb.put(frame(pool, 100), 100 * 160);
+		jb.put(frame(pool, 102), 102 * 160);
+		jb.put(frame(pool, 101), 101 * 160);
+		int a = play(pool, jb), b = play(pool, jb), c = play(pool, jb);
+		check("reordered frames play in order", a == 100 && b == 101 && c == 102);
+		jb.put(frame(pool, 101), 101 * 160);
+		check("a frame after its turn is dropped as late", jb.late() == 1 && jb.buffered() == 0);
+		jb.put(frame(pool, 104), 104 * 160);
+		int gap = play(pool, jb), d = play(pool, jb);
+		check("a missing frame is a gap", gap == -1 && d == 104 && jb.lost() == 1);
+		jb.put(frame(pool, 105), 105 * 160);
+		jb.put(frame(pool, 105), 105 * 160);
+		check("a duplicate is dropped", jb.dropped() == 1 && jb.buffered() == 1);
+		jb.put(frame(pool, 105 + 1000), 1105 * 160);
+		check("a jump starts over", jb.buffered() == 1 && play(pool, jb) == 1105);
+	}
+	check("frames all back in the pool", pool.available() == 64);
+
+	{
+		RTPJitterBuffer jb(pool);
+		srandom(46);
+		uint16_t seq = 0;
+		// 60 ms of jitter, as on a congested backhaul.
+		for (unsigned i = 0; i < 200; i++, seq++) {
+			jb.put(frame(pool, seq), seq * 160 + random() % 480);
+			play(pool, jb);
+		}
+		unsigned jittery = jb.target();
+		printf("jitter %.1f ms, target %u frames\n", jb.jitterMs(), jittery);
+		check("jittery arrivals raise the delay", jittery >= 3);
+		for (unsigned i = 0; i < 200; i++, seq++) {
+			jb.put(frame(pool, seq), seq * 160);
+			play(pool, jb);
+		}
+		printf("jitter %.1f ms, target %u frames, %u buffered\n", jb.jitterMs(), jb.target(), jb.buffered());
+		check("steady arrivals lower it again", jb.target() <= 2 && jb.buffered() <= jb.target() + 2);
+	}
+	check("frames all back in the pool", pool.available() == 64);
+}
+
+// Read what a session sent, with a timeout in ms; returns the length or -1.
+static int readPacket(int fd, unsigned char *buffer, unsigned size, int timeout)
+{
+	struct pollfd p = {fd, POLLIN, 0};
+	if (poll(&p, 1, timeout) <= 0)
+		return -1;
+	return ::recv(fd, buffer, size, 0);
+}
+
+static int openPeer(unsigned short &port)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in a;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(a);
+	bind(fd, (struct sockaddr *)&a, sizeof(a));
+	getsockname(fd, (struct sockaddr *)&a, &length);
+	port = ntohs(a.sin_port);
+	return fd;
+}
+
+static void sendTo(int fd, unsigned short port, const unsigned char *packet, unsigned length)
+{
+	struct sockaddr_in a;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	a.sin_port = htons(port);
+	sendto(fd, packet, length, 0, (struct sockaddr *)&a, sizeof(a));
+}
+
+static void putRTP(unsigned char *p, uint8_t payloadType, uint16_t seq, uint32_t timestamp)
+{
+	memset(p, 0, 12);
+	p[0] = 0x80;
+	p[1] = payloadType;
+	p[2] = seq >> 8;
+	p[3] = seq;
+	p[4] = timestamp >> 24;
+	p[5] = timestamp >> 16;
+	p[6] = timestamp >> 8;
+	p[7] = timestamp;
+}
+
+static void testSession()
+{
+	RTPMediaEngine engine(1, 1);
+	unsigned short peerPort;
+	int peer = openPeer(peerPort);
+	RTPMediaSession *session = engine.open(0, "127.0.0.1", peerPort, 3, 101);
+	check("session opens on a free port", session && session->port());
+	if (!session)
+		return;
+
+	unsigned char frame[sGSMFrame];
+	memset(frame, 0xd5, sizeof(frame));
+	session->send(frame, sizeof(frame));
+	unsigned char packet[256];
+	int n = readPacket(peer, packet, sizeof(packet), 200);
+	check("a frame goes out as GSM RTP", n == 12 + (int)sGSMFrame && packet[0] == 0x80 &&
+						 (packet[1] & 0x7f) == 3 && packet[12] == 0xd5);
+
+	// Frames come in, one a tick, and the call takes them as they play out, in order.
+	unsigned played = 0, inOrder = 0, last = 0;
+	for (unsigned i = 0; i < 16; i++) {
+		if (i < 10) {
+			unsigned char in[12 + sGSMFrame];
+			putRTP(in, 3, 500 + i, 80000 + 160 * i);
+			memset(in + 12, i, sGSMFrame);
+			sendTo(peer, session->port(), in, sizeof(in));
+		}
+		unsigned char out[sGSMFrame];
+		while (session->recv(out, sizeof(out), 20) > 0) {
+			if (!played || out[0] == last + 1)
+				inOrder++;
+			last = out[0];
+			played++;
+		}
+	}
+	check("received frames play out in order", played >= 8 && inOrder == played);
+
+	// Drain any audio, then a key press: events while held, then three end packets.
+	while (readPacket(peer, packet, sizeof(packet), 50) > 0) {
+	}
+	check("DTMF key accepted", session->startDTMF('5'));
+	usleep(100000);
+	session->stopDTMF();
+	unsigned events = 0, ends = 0, markers = 0, otherKey = 0;
+	uint32_t timestamp = 0;
+	bool sameTimestamp = true;
+	while ((n = readPacket(peer, packet, sizeof(packet), 100)) > 0) {
+		if ((packet[1] & 0x7f) != 101 || n != 16)
+			continue;
+		uint32_t ts = (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+		if (events && ts != timestamp)
+			sameTimestamp = false;
+		timestamp = ts;
+		events++;
+		if (packet[1] & 0x80)
+			markers++;
+		if (packet[13] & 0x80)
+			ends++;
+		if (packet[12] != 5)
+			otherKey++;
+	}
+	check("DTMF events, one marker, three ends", events >= 5 && markers == 1 && ends == 3 && !otherKey);
+	check("DTMF events share the start timestamp", sameTimestamp);
+
+	// The engine was made for one session.
+	check("a session past the limit is refused", !engine.open(0, "127.0.0.1", peerPort, 3));
+
+	// A re-INVITE moves the stream to a new peer, from the same port.
+	unsigned short newPeerPort;
+	int newPeer = openPeer(newPeerPort);
+	check("restart to a new peer", engine.restart(session, "127.0.0.1", newPeerPort, 3, 101));
+	session->send(frame, sizeof(frame));
+	struct pollfd p = {newPeer, POLLIN, 0};
+	struct sockaddr_in from;
+	socklen_t fromLength = sizeof(from);
+	n = poll(&p, 1, 200) > 0 ? recvfrom(newPeer, packet, sizeof(packet), 0, (struct sockaddr *)&from, &fromLength)
+				 : -1;
+	check("and sends to it from the same port", n == 12 + (int)sGSMFrame && ntohs(from.sin_port) == session->port());
+
+	// The slot comes back once the media thread has closed the session.
+	engine.close(session);
+	usleep(100000);
+	session = engine.open(0, "127.0.0.1", peerPort, 3);
+	check("a closed session's place is free again", session != NULL);
+	engine.close(session);
+	::close(peer);
+	::close(newPeer);
+}
+
+// The load test.
+
+struct Load {
+	RTPMediaEngine *mEngine;
+	vector<RTPMediaSession *> mSessions;
+	vector<unsigned short> mPorts;
+	int mFD; ///< The generator's socket; all the calls go to it.
+	volatile bool mStop;
+	unsigned mSent, mEchoed, mMisrouted;
+};
+
+// The call threads, all as one: take what each call played out and send it back.
+static void *echoLoop(void *arg)
+{
+	Load *load = (Load *)arg;
+	unsigned char frame[sGSMFrame];
+	while (!load->mStop) {
+		for (unsigned i = 0; i < load->mSessions.size(); i++) {
+			while (load->mSessions[i]->recv(frame, sizeof(frame), 0) > 0) {
+				load->mSessions[i]->send(frame, sizeof(frame));
+			}
+		}
+		usleep(5000);
+	}
+	return NULL;
+}
+
+static void drainEchoes(Load &load)
+{
+	static const unsigned batch = 64;
+	unsigned char buffers[batch][64];
+	struct iovec iov[batch];
+	struct mmsghdr msgs[batch];
+	struct sockaddr_in sources[batch];
+	while (true) {
+		for (unsigned i = 0; i < batch; i++) {
+			iov[i].iov_base = buffers[i];
+			iov[i].iov_len = sizeof(buffers[i]);
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &sources[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+		}
+		int n = recvmmsg(load.mFD, msgs, batch, MSG_DONTWAIT, NULL);
+		if (n <= 0)
+			return;
+		for (int i = 0; i < n; i++) {
+			unsigned call = (buffers[i][12] << 8) | buffers[i][13];
+			if (msgs[i].msg_len != 12 + sGSMFrame || call >= load.mPorts.size() ||
+				ntohs(sources[i].sin_port) != load.mPorts[call]) {
+				load.mMisrouted++;
+				continue;
+			}
+			load.mEchoed++;
+		}
+	}
+}
+
+struct StepResult {
+	double mCPU;  ///< Of one core.
+	double mLoss; ///< Of the frames sent.
+	unsigned mMisrouted;
+};
+
+static StepResult runStep(unsigned calls)
+{
+	RTPMediaEngine engine(1, calls);
+	Load load;
+	load.mEngine = &engine;
+	load.mStop = false;
+	load.mSent = load.mEchoed = load.mMisrouted = 0;
+	unsigned short generatorPort;
+	load.mFD = openPeer(generatorPort);
+	int size = 8 << 20;
+	setsockopt(load.mFD, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	for (unsigned i = 0; i < calls; i++) {
+		RTPMediaSession *session = engine.open(0, "127.0.0.1", generatorPort, 3);
+		if (!session)
+			break;
+		load.mSessions.push_back(session);
+		load.mPorts.push_back(session->port());
+	}
+	calls = load.mSessions.size();
+
+	Thread echoThread;
+	echoThread.start(echoLoop, &load);
+
+	struct Pending {
+		unsigned char mPacket[12 + sGSMFrame];
+		struct sockaddr_in mTo;
+	};
+	vector<Pending> now(calls), held;
+	vector<struct iovec> iov(2 * calls);
+	vector<struct mmsghdr> msgs(2 * calls);
+	srandom(calls);
+	uint64_t start = statNanoseconds();
+	uint64_t cpuStart = engine.CPUNs();
+	unsigned ticks = sStepMs / 20;
+	for (unsigned t = 0; t < ticks; t++) {
+		// This tick's frame for every call, except that 2% are held back a tick, behind the next frame.
+		vector<Pending> late;
+		late.swap(held);
+		for (unsigned i = 0; i < calls; i++) {
+			Pending &p = now[i];
+			putRTP(p.mPacket, 3, t, t * 160);
+			p.mPacket[12] = i >> 8;
+			p.mPacket[13] = i;
+			memset(&p.mTo, 0, sizeof(p.mTo));
+			p.mTo.sin_family = AF_INET;
+			p.mTo.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			p.mTo.sin_port = htons(load.mPorts[i]);
+		}
+		unsigned n = 0;
+		for (unsigned i = 0; i < calls; i++) {
+			if (t + 1 < ticks && random() % 50 == 0) {
+				held.push_back(now[i]);
+				continue;
+			}
+			iov[n].iov_base = now[i].mPacket;
+			iov[n].iov_len = sizeof(now[i].mPacket);
+			memset(&msgs[n].msg_hdr, 0, sizeof(msgs[n].msg_hdr));
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			msgs[n].msg_hdr.msg_name = &now[i].mTo;
+			msgs[n].msg_hdr.msg_namelen = sizeof(now[i].mTo);
+			n++;
+		}
+		for (unsigned i = 0; i < late.size(); i++, n++) {
+			iov[n].iov_base = late[i].mPacket;
+			iov[n].iov_len = sizeof(late[i].mPacket);
+			memset(&msgs[n].msg_hdr, 0, sizeof(msgs[n].msg_hdr));
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			msgs[n].msg_hdr.msg_name = &late[i].mTo;
+			msgs[n].msg_hdr.msg_namelen = sizeof(late[i].mTo);
+		}
+		for (unsigned done = 0; done < n;) {
+			int sent = sendmmsg(load.mFD, &msgs[done], n - done, 0);
+			if (sent <= 0)
+				break;
+			done += sent;
+			load.mSent += sent;
+		}
+		// Take the echoes until the next tick.
+		uint64_t next = start + (uint64_t)(t + 1) * 20000000ULL;
+		for (uint64_t at = statNanoseconds(); at < next; at = statNanoseconds()) {
+			struct pollfd p = {load.mFD, POLLIN, 0};
+			poll(&p, 1, (next - at) / 1000000 + 1);
+			drainEchoes(load);
+		}
+	}
+	double seconds = (statNanoseconds() - start) / 1e9;
+	uint64_t cpu = engine.CPUNs() - cpuStart;
+	// Let the last frames play out and come back.
+	for (unsigned i = 0; i < 20; i++) {
+		usleep(10000);
+		drainEchoes(load);
+	}
+	load.mStop = true;
+	echoThread.join();
+	for (unsigned i = 0; i < calls; i++) {
+		engine.close(load.mSessions[i]);
+	}
+	::close(load.mFD);
+
+	StepResult result;
+	result.mCPU = cpu / 1e9 / seconds;
+	result.mLoss = load.mSent ? 1.0 - (double)load.mEchoed / load.mSent : 1.0;
+	result.mMisrouted = load.mMisrouted;
+	printf("%5u calls: %.1f%% of a core, %u frames, %.2f%% lost, %u misrouted\n", calls, 100 * result.mCPU,
+		load.mSent, 100 * result.mLoss, result.mMisrouted);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("RTPMediaTest", "EMERG");
+
+	testPool();
+	testJitterBuffer();
+	testSession();
+
+	unsigned maxCalls = argc > 1 ? atoi(argv[1]) : 3200;
+	unsigned capacity = 0;
+	bool firstClean = false, misrouted = false;
+	for (unsigned calls = 100; calls <= maxCalls; calls *= 2) {
+		StepResult r = runStep(calls);
+		if (r.mMisrouted)
+			misrouted = true;
+		if (calls == 100)
+			firstClean = r.mLoss < 0.01;
+		if (r.mCPU > sCPUBudget || r.mLoss > 0.01)
+			break;
+		capacity = calls;
+	}
+	printf("%u concurrent calls within %.0f%% of a core and 1%% loss\n", capacity, 100 * sCPUBudget);
+	statsText(cout, "SIP.RTP");
+	check("100 calls with under 1% loss", firstClean);
+	check("every echo from its own call's port", !misrouted);
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
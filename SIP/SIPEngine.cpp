@@ -22,7 +22,6 @@
 
 #include <iostream>
 
-#include <ortp/telephonyevents.h>
 #undef WARNING
 
 #include <CommonLibs/Timeval.h>
@@ -86,8 +85,7 @@ ostream &SIP::operator<<(ostream &os, SIPState s)
 SIPEngine::SIPEngine(const char *proxy, const char *IMSI)
 	: mCSeq(random() % 1000), mMyToFromHeader(NULL), mRemoteToFromHeader(NULL), mCallIDHeader(NULL),
 	  mSIPPort(gConfig.getNum("SIP.Local.Port")), mSIPIP(gConfig.getStr("SIP.Local.IP")), mINVITE(NULL),
-	  mLastResponse(NULL), mBYE(NULL), mSession(NULL), mTxTime(0), mRxTime(0), mState(NullState), mDTMF('\0'),
-	  mDTMFDuration(0)
+	  mLastResponse(NULL), mBYE(NULL), mSession(NULL), mState(NullState)
 {
 	if (IMSI)
 		user(IMSI);
@@ -117,7 +115,8 @@ SIPEngine::~SIPEngine()
 		osip_message_free(mLastResponse);
 	if (mBYE != NULL)
 		osip_message_free(mBYE);
-	// FIXME -- Do we need to dispose of the RtpSesion *mSesison?
+	if (mSession)
+		rtpMediaEngine().close(mSession);
 }
 
 void SIPEngine::saveINVITE(const osip_message_t *INVITE, bool mine)
@@ -186,11 +185,12 @@ void SIPEngine::user(const char *wCallID, const char *IMSI, const char *origID,
 	mRemoteDomain = string(origHost);
 }
 
-string randy401(osip_message_t *msg)
+string SIP::randy401(const osip_message_t *msg)
 {
 	if (msg->status_code != 401)
 		return "";
-	osip_www_authenticate_t *auth = (osip_www_authenticate_t *)osip_list_get(&msg->www_authenticates, 0);
+	osip_www_authenticate_t *auth =
+		(osip_www_authenticate_t *)osip_list_get(const_cast<osip_list_t *>(&msg->www_authenticates), 0);
 	if (auth == NULL)
 		return "";
 	char *rand = osip_www_authenticate_get_nonce(auth);
@@ -202,13 +202,8 @@ string randy401(osip_message_t *msg)
 	return rands;
 }
 
-bool SIPEngine::Register(Method wMethod, string *RAND, const char *IMSI, const char *SRES)
+osip_message_t *SIPEngine::makeRegister(Method wMethod, string *RAND, const char *IMSI, const char *SRES)
 {
-	LOG(INFO) << "user " << mSIPUsername << " state " << mState << " " << wMethod << " callID " << mCallID;
-
-	// Before start, need to add mCallID
-	gSIPInterface->addCall(mCallID);
-
 	// Initial configuration for sip message.
 	// Make a new from tag and new branch.
 	// make new mCSeq.
@@ -216,7 +211,7 @@ bool SIPEngine::Register(Method wMethod, string *RAND, const char *IMSI, const c
 	// Generate SIP Message
 	// Either a register or unregister. Only difference
 	// is expiration period.
-	osip_message_t *reg;
+	osip_message_t *reg = NULL;
 	if (wMethod == SIPRegister) {
 		reg = sip_register(mSIPUsername.c_str(), 60 * gConfig.getNum("SIP.RegistrationPeriod"), mSIPPort,
 			mSIPIP.c_str(), mProxyIP.c_str(), mMyTag.c_str(), mViaBranch.c_str(), mCallID.c_str(), mCSeq,
@@ -227,6 +222,17 @@ bool SIPEngine::Register(Method wMethod, string *RAND, const char *IMSI, const c
 	} else {
 		assert(0);
 	}
+	return reg;
+}
+
+bool SIPEngine::Register(Method wMethod, string *RAND, const char *IMSI, const char *SRES)
+{
+	LOG(INFO) << "user " << mSIPUsername << " state " << mState << " " << wMethod << " callID " << mCallID;
+
+	// Before start, need to add mCallID
+	gSIPInterface->addCall(mCallID);
+
+	osip_message_t *reg = makeRegister(wMethod, RAND, IMSI, SRES);
 
 	LOG(DEBUG) << "writing " << reg;
 	gSIPInterface->write(&mProxyAddr, reg);
@@ -694,46 +700,28 @@ SIPState SIPEngine::MTCCheckForCancel()
 
 void SIPEngine::InitRTP(const osip_message_t *msg)
 {
-	if (mSession == NULL)
-		mSession = rtp_session_new(RTP_SESSION_SENDRECV);
-
-	bool rfc2833 = gConfig.defines("SIP.DTMF.RFC2833");
-	if (rfc2833) {
-		RtpProfile *profile = rtp_session_get_send_profile(mSession);
-		int index = gConfig.getNum("SIP.DTMF.RFC2833.PayloadType");
-		rtp_profile_set_payload(profile, index, &payload_type_telephone_event);
-		// Do we really need this next line?
-		rtp_session_set_send_profile(mSession, profile);
-	}
-
-	rtp_session_set_blocking_mode(mSession, TRUE);
-	rtp_session_set_scheduling_mode(mSession, TRUE);
-	rtp_session_set_connected_mode(mSession, TRUE);
-	rtp_session_set_symmetric_rtp(mSession, TRUE);
-	// Hardcode RTP session type to GSM full rate (GSM 06.10).
-	// FIXME -- Make this work for multiple vocoder types.
-	rtp_session_set_payload_type(mSession, 3);
-
 	char d_ip_addr[20];
 	char d_port[10];
 	get_rtp_params(msg, d_port, d_ip_addr);
 	LOG(DEBUG) << "IP=" << d_ip_addr << " " << d_port << " " << mRTPPort;
 
-#ifdef ORTP_NEW_API
-	rtp_session_set_local_addr(mSession, "0.0.0.0", mRTPPort, -1);
-#else
-	rtp_session_set_local_addr(mSession, "0.0.0.0", mRTPPort);
-#endif
-	rtp_session_set_remote_addr(mSession, d_ip_addr, atoi(d_port));
-
-	// Check for event support.
-	int code = rtp_session_telephone_events_supported(mSession);
-	if (code == -1) {
-		if (rfc2833) {
-			LOG(ALERT) << "RTP session does not support selected DTMF method RFC-2833";
-		} else {
-			LOG(WARNING) << "RTP session does not support telephone events";
-		}
+	// Hardcode RTP session type to GSM full rate (GSM 06.10).
+	// FIXME -- Make this work for multiple vocoder types.
+	bool rfc2833 = gConfig.defines("SIP.DTMF.RFC2833");
+	int DTMFPayloadType = rfc2833 ? gConfig.getNum("SIP.DTMF.RFC2833.PayloadType") : -1;
+	// A re-INVITE starts over on the socket it has; the port would not be free again until the media thread
+	// closed the old one.
+	if (mSession) {
+		if (rtpMediaEngine().restart(mSession, d_ip_addr, atoi(d_port), 3, DTMFPayloadType))
+			return;
+		rtpMediaEngine().close(mSession);
+		mSession = NULL;
+		LOG(ALERT) << "cannot restart RTP session on port " << mRTPPort;
+		return;
+	}
+	mSession = rtpMediaEngine().open(mRTPPort, d_ip_addr, atoi(d_port), 3, DTMFPayloadType);
+	if (!mSession) {
+		LOG(ALERT) << "cannot open RTP session on port " << mRTPPort;
 	}
 }
 
@@ -752,58 +740,39 @@ void SIPEngine::MOCInitRTP()
 bool SIPEngine::startDTMF(char key)
 {
 	LOG(DEBUG) << key;
-	if (mState != Active)
+	if (mState != Active || !mSession)
 		return false;
-	mDTMF = key;
-	mDTMFDuration = 0;
-	mDTMFStartTime = mTxTime;
-	int code = rtp_session_send_dtmf2(mSession, mDTMF, mDTMFStartTime, mDTMFDuration);
-	mDTMFDuration += 160;
-	if (!code)
+	if (mSession->startDTMF(key))
 		return true;
-	// Error?  Turn off DTMF sending.
 	LOG(WARNING) << "DTMF RFC-2833 failed on start.";
-	mDTMF = '\0';
 	return false;
 }
 
-void SIPEngine::stopDTMF() { mDTMF = '\0'; }
+void SIPEngine::stopDTMF()
+{
+	if (mSession)
+		mSession->stopDTMF();
+}
 
 void SIPEngine::txFrame(unsigned char *frame)
 {
-	if (mState != Active)
+	if (mState != Active || !mSession)
 		return;
 
 	// HACK -- Hardcoded for GSM/8000.
 	// FIXME -- Make this work for multiple vocoder types.
-	rtp_session_send_with_ts(mSession, frame, 33, mTxTime);
-	mTxTime += 160;
-
-	if (mDTMF) {
-		// Any RFC-2833 action?
-		int code = rtp_session_send_dtmf2(mSession, mDTMF, mDTMFStartTime, mDTMFDuration);
-		mDTMFDuration += 160;
-		LOG(DEBUG) << "DTMF RFC-2833 sending " << mDTMF << " " << mDTMFDuration;
-		// Turn it off if there's an error.
-		if (code) {
-			LOG(ERR) << "DTMF RFC-2833 failed after start.";
-			mDTMF = '\0';
-		}
-	}
+	mSession->send(frame, 33);
 }
 
 int SIPEngine::rxFrame(unsigned char *frame)
 {
-	if (mState != Active)
+	if (mState != Active || !mSession)
 		return 0;
 
-	int more;
-	int ret = 0;
 	// HACK -- Hardcoded for GSM/8000.
 	// FIXME -- Make this work for multiple vocoder types.
-	ret = rtp_session_recv_with_ts(mSession, frame, 33, mRxTime, &more);
-	mRxTime += 160;
-	return ret;
+	// This waits for the next 20 ms tick of the media thread, as the blocking RTP session did.
+	return mSession->recv(frame, 33, 20);
 }
 
 SIPState SIPEngine::MOSMSSendMESSAGE(
@@ -25,6 +25,8 @@
 #include <string>
 
 #include <ortp/ortp.h>
+
+#include "RTPMedia.h"
 #include <osip2/osip.h>
 #undef WARNING
 
@@ -56,6 +58,9 @@ enum SIPState {
 const char *SIPStateString(SIPState s);
 std::ostream &operator<<(std::ostream &os, SIPState s);
 
+/** The RAND of the challenge in a 401, or empty if there is none. */
+std::string randy401(const osip_message_t *msg);
+
 class SIPEngine {
 
 public:
@@ -99,20 +104,11 @@ private:
 	//@{
 	short mRTPPort;
 	unsigned mCodec;
-	RtpSession *mSession; ///< RTP media session
-	unsigned int mTxTime; ///< RTP transmission timestamp in 8 kHz samples
-	unsigned int mRxTime; ///< RTP receive timestamp in 8 kHz samples
+	RTPMediaSession *mSession; ///< RTP media session, with the RFC-2833 DTMF state
 	//@}
 
 	SIPState mState; ///< current SIP call state
 
-	/**@name RFC-2833 DTMF state. */
-	//@{
-	char mDTMF;		 ///< current DTMF digit, \0 if none
-	unsigned mDTMFDuration;  ///< duration of DTMF event so far
-	unsigned mDTMFStartTime; ///< start time of the DTMF key event
-				 //@}
-
 public:
 	/**
 		Default constructor. Initialize the object.
@@ -127,6 +123,7 @@ public:
 
 	const std::string &proxyIP() const { return mProxyIP; }
 	unsigned proxyPort() const { return mProxyPort; }
+	const struct ::sockaddr_in *proxyAddr() const { return &mProxyAddr; }
 
 	/** Return the current SIP call state. */
 	SIPState state() const { return mState; }
@@ -148,6 +145,13 @@ public:
 	bool Register(
 		Method wMethod = SIPRegister, string *RAND = NULL, const char *IMSI = NULL, const char *SRES = NULL);
 
+	/**
+		Build the REGISTER that Register() sends, for a caller that sends it and reads the responses itself.
+		@return The message, to be freed by the caller.
+	*/
+	osip_message_t *makeRegister(
+		Method wMethod = SIPRegister, string *RAND = NULL, const char *IMSI = NULL, const char *SRES = NULL);
+
 	/**
 		Send sip unregister and look at return msg.
 		Can throw SIPTimeout().
@@ -243,9 +247,9 @@ public:
 	void txFrame(unsigned char *frame);
 
 	/**
-		Receive a vocoder frame over RTP.
+		Receive a vocoder frame over RTP, waiting up to one 20 ms tick.
 		@param The vocoder frame
-		@return new RTP timestamp
+		@return The length of the frame, or 0 if there was none
 	*/
 	int rxFrame(unsigned char *frame);
 
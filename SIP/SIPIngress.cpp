@@ -0,0 +1,181 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
+
+#include "SIPIngress.h"
+
+using namespace SIP;
+using namespace std;
+
+static StatCounter sDatagrams("SIP.Ingress.Datagrams", "datagrams read from the SIP socket");
+static StatCounter sDropped("SIP.Ingress.Dropped", "datagrams dropped by the receiver for want of a Call-ID");
+static StatCounter sOverflow("SIP.Ingress.Overflow", "datagrams dropped because their worker's queue was full");
+static StatGauge sQueued("SIP.Ingress.Queued", "datagrams waiting for a worker");
+static StatHistogram sPreparseTime("SIP.Ingress.Preparse", "us", "receiver time per datagram, pre-parse and queueing");
+static StatHistogram sWaitTime("SIP.Ingress.Wait", "us", "from the read of a datagram to a worker taking it");
+static StatHistogram sHandleTime("SIP.Ingress.Handle", "us", "worker time per datagram, parse and dispatch");
+
+// The end of the line at p, at the CR of a CRLF or the LF.
+static const char *lineEnd(const char *p, const char *end)
+{
+	while (p < end && *p != '\r' && *p != '\n') {
+		p++;
+	}
+	return p;
+}
+
+// The start of the next line after a line end.
+static const char *nextLine(const char *p, const char *end)
+{
+	if (p < end && *p == '\r')
+		p++;
+	if (p < end && *p == '\n')
+		p++;
+	return p;
+}
+
+bool SIP::sipPreparse(const char *text, size_t length, string &callID, string &method)
+{
+	const char *end = text + length;
+	const char *eol = lineEnd(text, end);
+
+	// The request line starts with the method; a status line starts with the version.
+	const char *sp = (const char *)memchr(text, ' ', eol - text);
+	method.clear();
+	if (sp && !(eol - text >= 4 && strncmp(text, "SIP/", 4) == 0)) {
+		method.assign(text, sp - text);
+	}
+
+	for (const char *p = nextLine(eol, end); p < end; p = nextLine(eol, end)) {
+		eol = lineEnd(p, end);
+		if (eol == p)
+			break; // The blank line before the body.
+		const char *colon = (const char *)memchr(p, ':', eol - p);
+		if (!colon)
+			continue;
+		const char *nameEnd = colon;
+		while (nameEnd > p && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) {
+			nameEnd--;
+		}
+		size_t nameLen = nameEnd - p;
+		if (!((nameLen == 7 && strncasecmp(p, "Call-ID", 7) == 0) || (nameLen == 1 && (*p == 'i' || *p == 'I'))))
+			continue;
+		const char *v = colon + 1;
+		while (v < eol && (*v == ' ' || *v == '\t')) {
+			v++;
+		}
+		const char *vEnd = v;
+		while (vEnd < eol && *vEnd != '@' && *vEnd != ' ' && *vEnd != '\t') {
+			vEnd++;
+		}
+		if (vEnd == v)
+			return false;
+		callID.assign(v, vEnd - v);
+		return true;
+	}
+	return false;
+}
+
+SIPIngress::SIPIngress(Handler *wHandler, unsigned numWorkers, unsigned maxQueued)
+	: mHandler(wHandler), mMaxQueued(maxQueued)
+{
+	assert(numWorkers > 0);
+	for (unsigned i = 0; i < numWorkers; i++) {
+		Worker *w = new Worker;
+		w->mIngress = this;
+		mWorkers.push_back(w);
+		w->mThread.start(workerLoop, w);
+	}
+}
+
+SIPIngress::~SIPIngress()
+{
+	for (unsigned i = 0; i < mWorkers.size(); i++) {
+		// A datagram with no Call-ID never gets past receive(), so it stops the worker.
+		mWorkers[i]->mQ.write(new SIPDatagram);
+		mWorkers[i]->mThread.join();
+		delete mWorkers[i];
+	}
+}
+
+unsigned SIPIngress::workerFor(const string &callID) const
+{
+	// FNV-1a.
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < callID.size(); i++) {
+		h = (h ^ (unsigned char)callID[i]) * 16777619u;
+	}
+	return h % mWorkers.size();
+}
+
+bool SIPIngress::receive(const char *text, size_t length, const struct sockaddr_in *source)
+{
+	uint64_t start = statNanoseconds();
+	sDatagrams.inc();
+	SIPDatagram *d = new SIPDatagram;
+	if (!sipPreparse(text, length, d->mCallID, d->mMethod)) {
+		LOG(WARNING) << "message with no call id";
+		sDropped.inc();
+		delete d;
+		return false;
+	}
+	// Only this thread adds to the queue, so it cannot fill up between the check and the write.
+	Worker *w = mWorkers[workerFor(d->mCallID)];
+	if (w->mQ.size() >= mMaxQueued) {
+		LOG(INFO) << "SIP worker queue full, dropping message for call id " << d->mCallID;
+		sOverflow.inc();
+		delete d;
+		return false;
+	}
+	d->mText.assign(text, length);
+	memcpy(&d->mSource, source, sizeof(d->mSource));
+	d->mReceivedNs = start;
+	sQueued.add(1);
+	w->mQ.write(d);
+	sPreparseTime.record((statNanoseconds() - start) / 1000);
+	return true;
+}
+
+size_t SIPIngress::queued() const
+{
+	size_t n = 0;
+	for (unsigned i = 0; i < mWorkers.size(); i++) {
+		n += mWorkers[i]->mQ.size();
+	}
+	return n;
+}
+
+void *SIPIngress::workerLoop(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	while (true) {
+		SIPDatagram *d = w->mQ.read();
+		if (d->mCallID.empty()) {
+			delete d;
+			return NULL;
+		}
+		sQueued.add(-1);
+		uint64_t start = statNanoseconds();
+		sWaitTime.record((start - d->mReceivedNs) / 1000);
+		w->mIngress->mHandler->handle(*d);
+		sHandleTime.record((statNanoseconds() - start) / 1000);
+		delete d;
+	}
+}
@@ -0,0 +1,104 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef SIPINGRESS_H
+#define SIPINGRESS_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <CommonLibs/Interthread.h>
+#include <CommonLibs/Threads.h>
+
+namespace SIP {
+
+/** One datagram from the SIP socket, with what the receiver found in it before the full parse. */
+struct SIPDatagram {
+	std::string mText;
+	std::string mCallID; ///< The number part of the Call-ID, before any '@', as osip_call_id_get_number gives it.
+	std::string mMethod; ///< Empty for a response.
+	struct sockaddr_in mSource;
+	uint64_t mReceivedNs; ///< statNanoseconds() when it was read.
+};
+
+/**
+	Find the Call-ID and the method of a SIP message without parsing it, for routing.
+	Accepts the compact form "i:" and any case of the header name.
+	@return False if there is no Call-ID in the headers.
+*/
+bool sipPreparse(const char *text, size_t length, std::string &callID, std::string &method);
+
+/**
+	The SIP ingress pipeline: the thread that reads the socket only pre-parses each datagram and queues it to one of
+	a few workers, which do the full parse and dispatch.  A datagram goes to a worker by a hash of its Call-ID, so
+	the messages of a dialog are handled in the order they came, on one thread, and a slow dispatch, like an INVITE
+	that looks up the TMSI table, holds up only the dialogs on its worker and not the socket.  A worker that falls
+	too far behind has the excess dropped, as a full socket would, and SIP retransmits it.
+*/
+class SIPIngress {
+public:
+	/** Does the full parse and dispatch of a datagram, on a worker thread. */
+	class Handler {
+	public:
+		virtual ~Handler() {}
+		virtual void handle(const SIPDatagram &datagram) = 0;
+	};
+
+private:
+	struct Worker {
+		SIPIngress *mIngress;
+		InterthreadQueue<SIPDatagram> mQ;
+		Thread mThread;
+	};
+
+	Handler *mHandler;
+	std::vector<Worker *> mWorkers;
+	unsigned mMaxQueued; ///< Datagrams each worker can have waiting.
+
+	static void *workerLoop(void *arg);
+
+	SIPIngress(const SIPIngress &);
+	SIPIngress &operator=(const SIPIngress &);
+
+public:
+	/**
+		@param numWorkers The worker threads.
+		@param maxQueued Datagrams each worker can have waiting before more are dropped.
+	*/
+	SIPIngress(Handler *wHandler, unsigned numWorkers, unsigned maxQueued);
+
+	/** Let the workers finish what is queued, then stop them. */
+	~SIPIngress();
+
+	/**
+		Pre-parse a datagram and queue it to its worker; on the thread that reads the socket.
+		@return False if it had no Call-ID or its worker was full, and it was dropped.
+	*/
+	bool receive(const char *text, size_t length, const struct sockaddr_in *source);
+
+	/** The worker for a Call-ID. */
+	unsigned workerFor(const std::string &callID) const;
+
+	unsigned workers() const { return mWorkers.size(); }
+
+	/** Datagrams waiting over all workers. */
+	size_t queued() const;
+};
+
+} // namespace SIP
+
+#endif
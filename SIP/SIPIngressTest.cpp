@@ -0,0 +1,408 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Replay a burst of SIP traffic, timestamped like a capture, over a loopback socket into the SIP ingress pipeline,
+// and then into the old single drive thread that parsed and dispatched each datagram before reading the next.
+// The corpus is MT SMS MESSAGEs, some retransmitted, calls with INVITE, ACK and BYE, and REGISTER responses,
+// with the long and compact Call-ID headers.  The handler stands in for SIPInterface::handle: every datagram
+// costs a parse, and an INVITE or MESSAGE also blocks for the TMSI and transaction table lookups of checkInvite.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Sockets.h>
+#include <CommonLibs/Stats.h>
+#include <CommonLibs/Threads.h>
+
+#include "SIPIngress.h"
+
+using namespace SIP;
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static const unsigned sParseUs = 25;	///< What osip_message_parse and the rest cost per datagram.
+static const unsigned sLookupUs = 2000; ///< What checkInvite blocks for on an INVITE or MESSAGE.
+static const unsigned sWindowMs = 200;	///< The corpus starts its dialogs over this long.
+
+struct CorpusEntry {
+	uint64_t mAtUs; ///< From the start of the replay.
+	string mText;	///< With "X-Sent: " and room for the time it is sent, filled in by the sender.
+};
+
+static bool earlier(const CorpusEntry &a, const CorpusEntry &b) { return a.mAtUs < b.mAtUs; }
+
+static string request(const char *method, unsigned dialog, unsigned seq, bool compact)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf),
+		"%s sip:IMSI001010000%06u@127.0.0.1:5062 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:5063;branch=z9hG4bK%u.%u\r\n"
+		"From: <sip:%u@127.0.0.1>;tag=%u\r\n"
+		"To: <sip:IMSI001010000%06u@127.0.0.1>\r\n"
+		"%s %u-%u@127.0.0.1\r\n"
+		"CSeq: %u %s\r\n"
+		"X-Seq: %u\r\n"
+		"X-Sent: %20s\r\n"
+		"Content-Length: 0\r\n\r\n",
+		method, dialog, dialog, seq, 2000 + dialog % 100, dialog, dialog, compact ? "i:" : "Call-ID:", dialog,
+		dialog * 7919, seq, method, seq, "");
+	return buf;
+}
+
+static string response(const char *status, unsigned dialog, unsigned seq)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf),
+		"SIP/2.0 %s\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:5062;branch=z9hG4bK%u.%u\r\n"
+		"From: <sip:IMSI001010000%06u@127.0.0.1>;tag=%u\r\n"
+		"To: <sip:IMSI001010000%06u@127.0.0.1>\r\n"
+		"call-id: %u-%u\r\n"
+		"CSeq: %u REGISTER\r\n"
+		"WWW-Authenticate: Digest nonce=0123456789abcdef0123456789abcdef\r\n"
+		"X-Seq: %u\r\n"
+		"X-Sent: %20s\r\n"
+		"Content-Length: 0\r\n\r\n",
+		status, dialog, seq, dialog, dialog, dialog, dialog, dialog * 7919, seq, seq, "");
+	return buf;
+}
+
+static vector<CorpusEntry> makeCorpus(unsigned dialogs)
+{
+	vector<CorpusEntry> corpus;
+	srandom(45);
+	for (unsigned d = 0; d < dialogs; d++) {
+		CorpusEntry e;
+		uint64_t start = random() % (sWindowMs * 1000);
+		bool compact = d % 20 == 0;
+		switch (d % 8) {
+		case 0:
+		case 1:
+		case 2:
+			// MT SMS, sometimes retransmitted by a proxy that did not see the 100 Trying in time.
+			e.mAtUs = start;
+			e.mText = request("MESSAGE", d, 1, compact);
+			corpus.push_back(e);
+			if (d % 10 == 0) {
+				e.mAtUs = start + 20000;
+				e.mText = request("MESSAGE", d, 2, compact);
+				corpus.push_back(e);
+			}
+			break;
+		case 3:
+		case 4:
+			// MT call.
+			e.mAtUs = start;
+			e.mText = request("INVITE", d, 1, compact);
+			corpus.push_back(e);
+			e.mAtUs = start + 30000;
+			e.mText = request("ACK", d, 2, compact);
+			corpus.push_back(e);
+			e.mAtUs = start + 60000;
+			e.mText = request("BYE", d, 3, compact);
+			corpus.push_back(e);
+			break;
+		default:
+			// The registrar answering a location update.
+			e.mAtUs = start;
+			e.mText = response("401 Unauthorized", d, 1);
+			corpus.push_back(e);
+			e.mAtUs = start + 10000;
+			e.mText = response("200 OK", d, 2);
+			corpus.push_back(e);
+			break;
+		}
+	}
+	stable_sort(corpus.begin(), corpus.end(), earlier);
+	return corpus;
+}
+
+static uint64_t headerNumber(const string &text, const char *name)
+{
+	size_t p = text.find(name);
+	if (p == string::npos)
+		return 0;
+	return strtoull(text.c_str() + p + strlen(name), NULL, 10);
+}
+
+/** Stands in for SIPInterface::handle, and checks the order of each dialog. */
+class TestHandler : public SIPIngress::Handler {
+	Mutex mLock;
+	map<string, unsigned> mLastSeq;
+
+public:
+	vector<uint64_t> mLatencyUs; ///< From the send to the end of the handling.
+	unsigned mHandled;
+	unsigned mMisordered;
+
+	TestHandler() : mHandled(0), mMisordered(0) {}
+
+	void handle(const SIPDatagram &datagram)
+	{
+		uint64_t until = statNanoseconds() + sParseUs * 1000;
+		while (statNanoseconds() < until) {
+		}
+		if (datagram.mMethod == "INVITE" || datagram.mMethod == "MESSAGE") {
+			usleep(sLookupUs);
+		}
+		unsigned seq = headerNumber(datagram.mText, "X-Seq: ");
+		uint64_t sent = headerNumber(datagram.mText, "X-Sent: ");
+		uint64_t now = statNanoseconds();
+		ScopedLock lock(mLock);
+		unsigned &last = mLastSeq[datagram.mCallID];
+		if (seq <= last) {
+			mMisordered++;
+		}
+		last = seq;
+		mLatencyUs.push_back((now - sent) / 1000);
+		mHandled++;
+	}
+
+	unsigned handled()
+	{
+		ScopedLock lock(mLock);
+		return mHandled;
+	}
+};
+
+struct Replay {
+	const vector<CorpusEntry> *mCorpus;
+	unsigned short mPort;
+};
+
+static void *sendLoop(void *arg)
+{
+	Replay *replay = (Replay *)arg;
+	UDPSocket socket(0, "127.0.0.1", replay->mPort);
+	uint64_t start = statNanoseconds();
+	for (size_t i = 0; i < replay->mCorpus->size(); i++) {
+		const CorpusEntry &e = (*replay->mCorpus)[i];
+		uint64_t now = statNanoseconds();
+		if (start + e.mAtUs * 1000 > now) {
+			usleep((start + e.mAtUs * 1000 - now) / 1000);
+		}
+		string text = e.mText;
+		size_t p = text.find("X-Sent: ") + 8;
+		char sent[21];
+		snprintf(sent, sizeof(sent), "%20llu", (unsigned long long)statNanoseconds());
+		text.replace(p, 20, sent);
+		socket.write(text.c_str(), text.size());
+	}
+	return NULL;
+}
+
+struct Receiver {
+	UDPSocket *mSocket;
+	SIPIngress *mIngress; ///< Or NULL to handle each datagram on the receiving thread, as drive() did.
+	TestHandler *mHandler;
+	volatile bool mStop;
+};
+
+static void *receiveLoop(void *arg)
+{
+	Receiver *r = (Receiver *)arg;
+	char buffer[MAX_UDP_LENGTH + 1];
+	while (!r->mStop) {
+		int n = r->mSocket->read(buffer, 100);
+		if (n < 0)
+			continue;
+		buffer[n] = '\0';
+		if (r->mIngress) {
+			r->mIngress->receive(buffer, n, r->mSocket->source());
+			continue;
+		}
+		SIPDatagram d;
+		d.mText.assign(buffer, n);
+		sipPreparse(buffer, n, d.mCallID, d.mMethod);
+		r->mHandler->handle(d);
+	}
+	return NULL;
+}
+
+struct Result {
+	unsigned mHandled;
+	unsigned mMisordered;
+	uint64_t mP50, mP99;
+	double mSeconds;
+};
+
+static Result replay(const vector<CorpusEntry> &corpus, unsigned workers)
+{
+	TestHandler handler;
+	UDPSocket socket(0);
+	SIPIngress *ingress = workers ? new SIPIngress(&handler, workers, corpus.size()) : NULL;
+	Receiver receiver = {&socket, ingress, &handler, false};
+	Thread receiveThread;
+	receiveThread.start(receiveLoop, &receiver);
+
+	Replay replay = {&corpus, socket.port()};
+	Thread sendThread;
+	uint64_t start = statNanoseconds();
+	sendThread.start(sendLoop, &replay);
+	sendThread.join();
+	// Wait for the last one, or for a second with nothing, which means the rest were lost.
+	unsigned last = 0;
+	uint64_t lastChange = statNanoseconds();
+	while (handler.handled() < corpus.size() && statNanoseconds() - lastChange < 1000000000ULL) {
+		usleep(1000);
+		if (handler.handled() != last) {
+			last = handler.handled();
+			lastChange = statNanoseconds();
+		}
+	}
+	Result result;
+	result.mSeconds = (lastChange - start) / 1e9;
+	receiver.mStop = true;
+	receiveThread.join();
+	delete ingress;
+
+	result.mHandled = handler.mHandled;
+	result.mMisordered = handler.mMisordered;
+	sort(handler.mLatencyUs.begin(), handler.mLatencyUs.end());
+	size_t n = handler.mLatencyUs.size();
+	result.mP50 = n ? handler.mLatencyUs[n / 2] : 0;
+	result.mP99 = n ? handler.mLatencyUs[n * 99 / 100] : 0;
+	printf("%u of %u handled in %.2f s, %u out of order; latency p50/p99 %llu/%llu us\n", result.mHandled,
+		(unsigned)corpus.size(), result.mSeconds, result.mMisordered, (unsigned long long)result.mP50,
+		(unsigned long long)result.mP99);
+	return result;
+}
+
+static void testPreparse()
+{
+	string callID, method;
+	const char *invite = "INVITE sip:IMSI001010000000001@127.0.0.1 SIP/2.0\r\nVia: x\r\n"
+			     "Call-ID: 1234abc@127.0.0.1\r\nCSeq: 1 INVITE\r\n\r\n";
+	check("request method and Call-ID", sipPreparse(invite, strlen(invite), callID, method) &&
+						    method == "INVITE" && callID == "1234abc");
+	const char *ok = "SIP/2.0 200 OK\nFrom: x\ncall-id :  77-88\nCSeq: 2 REGISTER\n\n";
+	check("response, lower case, bare LF", sipPreparse(ok, strlen(ok), callID, method) && method.empty() &&
+						       callID == "77-88");
+	const char *compact = "MESSAGE sip:x SIP/2.0\r\nf: <sip:1@h>\r\ni: 99@h\r\n\r\n";
+	check("compact form", sipPreparse(compact, strlen(compact), callID, method) && method == "MESSAGE" &&
+				      callID == "99");
+	const char *inBody = "MESSAGE sip:x SIP/2.0\r\nCSeq: 1 MESSAGE\r\n\r\nCall-ID: 5@h\r\n";
+	check("no Call-ID but in the body", !sipPreparse(inBody, strlen(inBody), callID, method));
+	const char *lookalike = "BYE sip:x SIP/2.0\r\nCall-Info: <http://x>\r\nI: 6\r\n\r\n";
+	check("Call-Info is not Call-ID", sipPreparse(lookalike, strlen(lookalike), callID, method) && callID == "6");
+}
+
+/** Holds every datagram until let go. */
+class BlockingHandler : public SIPIngress::Handler {
+	Mutex mLock;
+	Signal mSignal;
+	bool mGo;
+
+public:
+	unsigned mHandled;
+
+	BlockingHandler() : mGo(false), mHandled(0) {}
+
+	void handle(const SIPDatagram &)
+	{
+		ScopedLock lock(mLock);
+		mHandled++;
+		mSignal.broadcast();
+		while (!mGo) {
+			mSignal.wait(mLock);
+		}
+	}
+
+	void waitFor(unsigned handled)
+	{
+		ScopedLock lock(mLock);
+		while (mHandled < handled) {
+			mSignal.wait(mLock);
+		}
+	}
+
+	void go()
+	{
+		ScopedLock lock(mLock);
+		mGo = true;
+		mSignal.broadcast();
+	}
+};
+
+static void testQueueLimit()
+{
+	BlockingHandler handler;
+	SIPIngress *ingress = new SIPIngress(&handler, 1, 10);
+	struct sockaddr_in source;
+	memset(&source, 0, sizeof(source));
+	string text = request("MESSAGE", 1, 1, false);
+
+	// The worker holds the first and 10 more wait; the rest are dropped.
+	ingress->receive(text.c_str(), text.size(), &source);
+	handler.waitFor(1);
+	unsigned accepted = 1;
+	for (unsigned i = 0; i < 20; i++) {
+		accepted += ingress->receive(text.c_str(), text.size(), &source);
+	}
+	check("a full worker drops the excess", accepted == 11 && ingress->queued() == 10);
+	handler.go();
+	delete ingress;
+	check("and handles what it kept", handler.mHandled == 11);
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("SIPIngressTest", "EMERG");
+
+	testPreparse();
+	testQueueLimit();
+
+	unsigned dialogs = argc > 1 ? atoi(argv[1]) : 800;
+	vector<CorpusEntry> corpus = makeCorpus(dialogs);
+	printf("%u datagrams from %u dialogs over %u ms\n", (unsigned)corpus.size(), dialogs, sWindowMs);
+
+	printf("ingress, 4 workers: ");
+	fflush(stdout);
+	Result pipelined = replay(corpus, 4);
+	statsText(cout, "SIP.Ingress");
+	check("every datagram handled", pipelined.mHandled == corpus.size());
+	check("every dialog in order", pipelined.mMisordered == 0);
+
+	printf("one drive thread: ");
+	fflush(stdout);
+	Result inline1 = replay(corpus, 0);
+	// One thread falls behind in the burst: the socket overflows, or whatever it keeps waits.
+	check("one drive thread loses datagrams or is 2x slower",
+		inline1.mHandled < corpus.size() || pipelined.mP99 * 2 < inline1.mP99);
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
@@ -36,14 +36,11 @@ using namespace std;
 void SIPMessageMap::write(const std::string &call_id, osip_message_t *msg)
 {
 	LOG(DEBUG) << "call_id=" << call_id << " msg=" << msg;
-	OSIPMessageFIFO *fifo = mMap.readNoBlock(call_id);
-	if (fifo == NULL) {
+	if (!mMap.deliver(call_id, msg)) {
 		// FIXME -- If this write fails, send "call leg non-existent" response on SIP interface.
 		LOG(NOTICE) << "missing SIP FIFO " << call_id;
 		throw SIPError();
 	}
-	LOG(DEBUG) << "write on fifo " << fifo;
-	fifo->write(msg);
 }
 
 osip_message_t *SIPMessageMap::read(const std::string &call_id, unsigned readTimeout)
@@ -61,9 +58,10 @@ osip_message_t *SIPMessageMap::read(const std::string &call_id, unsigned readTim
 	return msg;
 }
 
-bool SIPMessageMap::add(const std::string &call_id, const struct sockaddr_in *returnAddress)
+bool SIPMessageMap::add(
+	const std::string &call_id, const struct sockaddr_in *returnAddress, SIPListener *listener, uint64_t tag)
 {
-	OSIPMessageFIFO *fifo = new OSIPMessageFIFO(returnAddress);
+	OSIPMessageFIFO *fifo = new OSIPMessageFIFO(returnAddress, listener, tag);
 	mMap.write(call_id, fifo);
 	return true;
 }
@@ -79,10 +77,16 @@ bool SIPMessageMap::remove(const std::string &call_id)
 
 // SIPInterface method definitions.
 
-bool SIPInterface::addCall(const string &call_id)
+bool SIPInterface::addCall(const string &call_id, SIPListener *listener, uint64_t tag, const struct sockaddr_in *source)
 {
 	LOG(INFO) << "creating SIP message FIFO callID " << call_id;
-	return mSIPMap.add(call_id, mSIPSocket.source());
+	// The socket's source is the drive thread's last read, so only a datagram's own source will do.
+	struct sockaddr_in none;
+	if (!source) {
+		memset(&none, 0, sizeof(none));
+		source = &none;
+	}
+	return mSIPMap.add(call_id, source, listener, tag);
 }
 
 bool SIPInterface::removeCall(const string &call_id)
@@ -114,6 +118,7 @@ void SIPInterface::start()
 	ortp_scheduler_init();
 	// FIXME -- Can we coordinate this with the global logger?
 	// ortp_set_log_level_mask(ORTP_MESSAGE|ORTP_WARNING|ORTP_ERROR);
+	mIngress = new SIPIngress(this, gConfig.getNum("SIP.Workers"), gConfig.getNum("SIP.Workers.QueueLimit"));
 	mDriveThread.start((void *(*)(void *))driveLoop, this);
 }
 
@@ -139,7 +144,7 @@ void SIPInterface::write(const struct sockaddr_in *dest, osip_message_t *msg)
 
 void SIPInterface::drive()
 {
-	// All inbound SIP messages go here for processing.
+	// All inbound SIP messages go here, and on to the ingress workers for processing.
 
 	LOG(DEBUG) << "blocking on socket";
 	int numRead = mSIPSocket.read(mReadBuffer);
@@ -147,16 +152,21 @@ void SIPInterface::drive()
 		LOG(ALERT) << "cannot read SIP socket.";
 		return;
 	}
-	// FIXME -- Is this +1 offset correct?  Check it.
 	mReadBuffer[numRead] = '\0';
+	mIngress->receive(mReadBuffer, numRead, mSIPSocket.source());
+}
+
+void SIPInterface::handle(const SIPDatagram &datagram)
+{
+	const char *readBuffer = datagram.mText.c_str();
 
 	// Get the proxy from the inbound message.
 #if 0
-	const struct sockaddr_in* sourceAddr = mSIPSocket.source();
+	const struct sockaddr_in* sourceAddr = &datagram.mSource;
 	char msgHost[256];
 	const char* msgHostRet = inet_ntop(AF_INET,&(sourceAddr->sin_addr),msgHost,255);
 	if (!msgHostRet) {
-		LOG(ALERT) << "cannot translate SIP source address for " << mReadBuffer;
+		LOG(ALERT) << "cannot translate SIP source address for " << readBuffer;
 		return;
 	}
 	unsigned msgPortNumber = sourceAddr->sin_port;
@@ -166,9 +176,9 @@ void SIPInterface::drive()
 #endif
 
 	char firstLine[101];
-	sscanf(mReadBuffer, "%100[^\n]", firstLine);
+	sscanf(readBuffer, "%100[^\n]", firstLine);
 	LOG(INFO) << "read " << firstLine;
-	LOG(DEBUG) << "read " << mReadBuffer;
+	LOG(DEBUG) << "read " << readBuffer;
 
 	try {
 
@@ -176,21 +186,21 @@ void SIPInterface::drive()
 		osip_message_t *msg;
 		int i = osip_message_init(&msg);
 		LOG(INFO) << "osip_message_init " << i;
-		int j = osip_message_parse(msg, mReadBuffer, strlen(mReadBuffer));
+		int j = osip_message_parse(msg, readBuffer, datagram.mText.size());
 		// seems like it ought to do something more than display an error,
 		// but it used to not even do that.
 		LOG(INFO) << "osip_message_parse " << j;
 
 		// heroic efforts to get it to parse the www-authenticate header failed,
 		// so we'll just crowbar that sucker in.
-		char *p = strcasestr(mReadBuffer, "nonce");
+		const char *p = strcasestr(readBuffer, "nonce");
 		if (p && p[-1] != 'c') { // nonce but not cnonce
 			p += 6;
-			char *q = p;
+			const char *q = p;
 			while (isalnum(*q)) {
 				q++;
 			}
-			string RAND = string(mReadBuffer, p - mReadBuffer, q - p);
+			string RAND = string(readBuffer, p - readBuffer, q - p);
 			LOG(INFO) << "crowbar www-authenticate " << RAND;
 			osip_www_authenticate_t *auth;
 			osip_www_authenticate_init(&auth);
@@ -204,14 +214,14 @@ void SIPInterface::drive()
 
 		// The parser doesn't seem to be interested in authentication info either.
 		// Get kc from there and put it in tmsi table.
-		char *pp = strcasestr(mReadBuffer, "cnonce");
+		const char *pp = strcasestr(readBuffer, "cnonce");
 		if (pp) {
 			pp += 7;
-			char *qq = pp;
+			const char *qq = pp;
 			while (isalnum(*qq)) {
 				qq++;
 			}
-			string kc = string(mReadBuffer, pp - mReadBuffer, qq - pp);
+			string kc = string(readBuffer, pp - readBuffer, qq - pp);
 			LOG(INFO) << "storing kc in TMSI table"; // mustn't display kc in log
 			const char *imsi = osip_uri_get_username(msg->to->url);
 			if (imsi && strlen(imsi) > 0) {
@@ -228,7 +238,7 @@ void SIPInterface::drive()
 		// if it is, handle appropriatly.
 		// FIXME -- Check return value in case this failed.
 		// FIXME -- If we support USSD via SIP, we will need to check the map first.
-		checkInvite(msg);
+		checkInvite(msg, &datagram.mSource);
 
 		// FIXME -- Need to check for early BYE or CANCEL to stop paging.
 		// If it's a BYE, find the corresponding transaction table entry.
@@ -252,7 +262,7 @@ void SIPInterface::drive()
 		// Don't free msg.  Whoever reads the FIFO will do that.
 		mSIPMap.write(call_num, msg);
 	} catch (SIPException) {
-		LOG(WARNING) << "cannot parse SIP message: " << mReadBuffer;
+		LOG(WARNING) << "cannot parse SIP message: " << readBuffer;
 	}
 }
 
@@ -280,7 +290,7 @@ const char *extractCallID(const osip_message_t *msg)
 	return osip_call_id_get_number(msg->call_id);
 }
 
-bool SIPInterface::checkInvite(osip_message_t *msg)
+bool SIPInterface::checkInvite(osip_message_t *msg, const struct sockaddr_in *source)
 {
 	LOG(DEBUG);
 
@@ -385,7 +395,7 @@ bool SIPInterface::checkInvite(osip_message_t *msg)
 	}
 
 	// Add an entry to the SIP Map to route inbound SIP messages.
-	addCall(callIDNum);
+	addCall(callIDNum, NULL, 0, source);
 	LOG(DEBUG) << "callIDNum " << callIDNum << " IMSI " << IMSI;
 
 	// Get the caller ID if it's available.
@@ -25,6 +25,8 @@
 #include <CommonLibs/Sockets.h>
 #include <Globals/Globals.h>
 
+#include "SIPIngress.h"
+
 namespace GSM {
 
 class L3MobileIdentity;
@@ -32,17 +34,36 @@ class L3MobileIdentity;
 
 namespace SIP {
 
+/**
+	Takes the messages of a call as they arrive, instead of a thread blocked on the FIFO.
+	Used by procedures that run as events, which must not block.
+*/
+class SIPListener {
+public:
+	virtual ~SIPListener() {}
+
+	/**
+		Take one message; on a SIP ingress worker, so this must not block.
+		@param msg The message, to be freed by the listener.
+		@param tag What the call was added with.
+	*/
+	virtual void sipMessage(osip_message_t *msg, uint64_t tag) = 0;
+};
+
 typedef InterthreadQueue<osip_message_t> _OSIPMessageFIFO;
 
 class OSIPMessageFIFO : public _OSIPMessageFIFO {
 
 private:
 	struct sockaddr_in mReturnAddress;
+	SIPListener *mListener; ///< If not NULL, takes the messages instead of the FIFO.
+	uint64_t mTag;
 
 	virtual void freeElement(osip_message_t *element) const { osip_message_free(element); };
 
 public:
-	OSIPMessageFIFO(const struct sockaddr_in *wReturnAddress) : _OSIPMessageFIFO()
+	OSIPMessageFIFO(const struct sockaddr_in *wReturnAddress, SIPListener *wListener = NULL, uint64_t wTag = 0)
+		: _OSIPMessageFIFO(), mListener(wListener), mTag(wTag)
 	{
 		memcpy(&mReturnAddress, wReturnAddress, sizeof(mReturnAddress));
 	}
@@ -60,9 +81,32 @@ public:
 	const struct sockaddr_in *returnAddress() const { return &mReturnAddress; }
 
 	size_t addressSize() const { return sizeof(mReturnAddress); }
+
+	/** Give a message to the listener, if any, or queue it. */
+	void deliver(osip_message_t *msg)
+	{
+		if (mListener)
+			mListener->sipMessage(msg, mTag);
+		else
+			write(msg);
+	}
 };
 
 class OSIPMessageFIFOMap : public InterthreadMap<std::string, OSIPMessageFIFO> {
+public:
+	/**
+		Deliver a message to the FIFO of a call, under the map lock so the FIFO cannot be removed meanwhile.
+		@return False if there is no such call; the message is not taken then.
+	*/
+	bool deliver(const std::string &call_id, osip_message_t *msg)
+	{
+		ScopedLock lock(mLock);
+		Map::iterator iter = mMap.find(call_id);
+		if (iter == mMap.end())
+			return false;
+		iter->second->deliver(msg);
+		return true;
+	}
 };
 
 std::ostream &operator<<(std::ostream &os, const OSIPMessageFIFO &m);
@@ -84,8 +128,9 @@ public:
 	/** Read sip message out of map+fifo. used by sip engine. */
 	osip_message_t *read(const std::string &call_id, unsigned readTimeout = 3600000);
 
-	/** Create a new entry in the map. */
-	bool add(const std::string &call_id, const struct sockaddr_in *returnAddress);
+	/** Create a new entry in the map, with a listener to take its messages, or NULL to queue them. */
+	bool add(const std::string &call_id, const struct sockaddr_in *returnAddress, SIPListener *listener = NULL,
+		uint64_t tag = 0);
 
 	/**
 		Remove a fifo from map (called at the end of a sip interaction).
@@ -101,16 +146,17 @@ public:
 
 std::ostream &operator<<(std::ostream &os, const SIPMessageMap &m);
 
-class SIPInterface {
+class SIPInterface : public SIPIngress::Handler {
 
 private:
-	char mReadBuffer[2048]; ///< buffer for UDP reads
+	char mReadBuffer[MAX_UDP_LENGTH + 1]; ///< buffer for UDP reads
 
 	UDPSocket mSIPSocket;
 
 	Mutex mSocketLock;
 	Thread mDriveThread;
 	SIPMessageMap mSIPMap;
+	SIPIngress *mIngress; ///< Parses and dispatches what the drive thread reads.
 
 public:
 	// 2 ways to starte sip interface.
@@ -125,20 +171,24 @@ public:
 	/**
 		Create the SIP interface to watch for incoming SIP messages.
 	*/
-	SIPInterface() : mSIPSocket(gConfig.getNum("SIP.Local.Port")) {}
+	SIPInterface() : mSIPSocket(gConfig.getNum("SIP.Local.Port")), mIngress(NULL) {}
 
-	/** Start the SIP drive loop. */
+	/** Start the SIP ingress workers and the drive loop. */
 	void start();
 
-	/** Receive, parse and dispatch a single SIP message. */
+	/** Receive a single SIP message and queue it to its ingress worker. */
 	void drive();
 
+	/** Parse and dispatch a single SIP message; on an ingress worker. */
+	void handle(const SIPDatagram &datagram);
+
 	/**
 		Look for incoming INVITE messages to start MTC.
 		@param msg The SIP message to check.
+		@param source Where it came from.
 		@return true if the message is a new INVITE
 	*/
-	bool checkInvite(osip_message_t *);
+	bool checkInvite(osip_message_t *, const struct sockaddr_in *source);
 
 	/**
 		Schedule SMS for delivery.
@@ -157,8 +207,13 @@ public:
 		return mSIPMap.read(call_id, readTimeout);
 	}
 
-	/** Create a new message FIFO in the SIP interface. */
-	bool addCall(const std::string &call_id);
+	/**
+		Create a new message FIFO in the SIP interface.
+		@param listener If not NULL, takes the messages of the call as they arrive, with tag.
+		@param source Where the message that started the call came from, or NULL for a call started here.
+	*/
+	bool addCall(const std::string &call_id, SIPListener *listener = NULL, uint64_t tag = 0,
+		const struct sockaddr_in *source = NULL);
 
 	bool removeCall(const std::string &call_id);
 
@@ -0,0 +1,211 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Run SIPInterface::handle on the SIP ingress workers, as SIPInterface::start sets them up, with the messages the
+// registrar and the far end of a call send to calls that are already in the SIP map: REGISTER responses, some
+// with a challenge, and ACKs and BYEs, with the long and compact Call-ID headers.  Each call is added with a
+// listener, as LocationUpdating adds its REGISTERs, and every message has to come out of the full parse to the
+// listener of its own call, in the order it was sent.  INVITEs and MESSAGEs for new calls start transactions
+// on the NodeB, which is not running here.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <osipparser2/osip_parser.h>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <Control/TMSITable.h>
+#include <Control/TransactionTable.h>
+#include <TRXManager/TRXManager.h>
+#include <UMTS/UMTSConfig.h>
+
+#include "SIPIngress.h"
+#include "SIPInterface.h"
+
+using namespace SIP;
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+// The libraries SIPInterface links with reach these; nothing here runs the code that uses them.
+const char *gDateTime = __DATE__ " " __TIME__;
+UMTS::UMTSConfig *gNodeB = NULL;
+TransceiverManager *gTRX = NULL;
+Control::TMSITable *gTMSITable = NULL;
+Control::TransactionTable *gTransactionTable = NULL;
+SIP::SIPInterface *gSIPInterface = NULL;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static string callID(unsigned dialog)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%u-%u", dialog, dialog * 7919);
+	return buf;
+}
+
+static string request(const char *method, unsigned dialog, unsigned seq)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf),
+		"%s sip:IMSI001010000%06u@127.0.0.1:5062 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:5063;branch=z9hG4bK%u.%u\r\n"
+		"From: <sip:%u@127.0.0.1>;tag=%u\r\n"
+		"To: <sip:IMSI001010000%06u@127.0.0.1>;tag=%u\r\n"
+		"%s %s@127.0.0.1\r\n"
+		"CSeq: %u %s\r\n"
+		"Content-Length: 0\r\n\r\n",
+		method, dialog, dialog, seq, 2000 + dialog % 100, dialog, dialog, dialog + 1,
+		dialog % 20 ? "Call-ID:" : "i:", callID(dialog).c_str(), seq, method);
+	return buf;
+}
+
+static string response(const char *status, unsigned dialog, unsigned seq, bool challenge)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf),
+		"SIP/2.0 %s\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:5062;branch=z9hG4bK%u.%u\r\n"
+		"From: <sip:IMSI001010000%06u@127.0.0.1>;tag=%u\r\n"
+		"To: <sip:IMSI001010000%06u@127.0.0.1>\r\n"
+		"Call-ID: %s\r\n"
+		"CSeq: %u REGISTER\r\n"
+		"%s"
+		"Content-Length: 0\r\n\r\n",
+		status, dialog, seq, dialog, dialog, dialog, callID(dialog).c_str(), seq,
+		challenge ? "WWW-Authenticate: Digest nonce=0123456789abcdef0123456789abcdef\r\n" : "");
+	return buf;
+}
+
+/** Stands in for the procedures' listeners: what came to each tag, in order. */
+class TestListener : public SIPListener {
+	Mutex mLock;
+
+public:
+	struct Delivery {
+		uint64_t mTag;
+		string mCallID;
+		unsigned mSeq;
+		int mStatus;
+		bool mNonce; ///< The WWW-Authenticate nonce came through.
+	};
+
+	map<uint64_t, vector<Delivery> > mDeliveries;
+	unsigned mCount;
+
+	TestListener() : mCount(0) {}
+
+	void sipMessage(osip_message_t *msg, uint64_t tag)
+	{
+		Delivery d;
+		d.mTag = tag;
+		const char *number = msg->call_id ? osip_call_id_get_number(msg->call_id) : NULL;
+		d.mCallID = number ? number : "";
+		osip_cseq_t *cseq = osip_message_get_cseq(msg);
+		d.mSeq = cseq && osip_cseq_get_number(cseq) ? atoi(osip_cseq_get_number(cseq)) : 0;
+		d.mStatus = msg->status_code;
+		osip_www_authenticate_t *auth = NULL;
+		d.mNonce = osip_message_get_www_authenticate(msg, 0, &auth) == 0 && auth &&
+			   osip_www_authenticate_get_nonce(auth);
+		osip_message_free(msg);
+
+		ScopedLock lock(mLock);
+		mDeliveries[tag].push_back(d);
+		mCount++;
+	}
+
+	unsigned count()
+	{
+		ScopedLock lock(mLock);
+		return mCount;
+	}
+};
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("SIPInterfaceTest", "EMERG");
+	gConfig.set("SIP.Local.Port", 0L);
+	parser_init();
+
+	unsigned dialogs = argc > 1 ? atoi(argv[1]) : 400;
+	SIPInterface *sip = new SIPInterface();
+	SIPIngress *ingress = new SIPIngress(sip, 4, 4 * dialogs);
+	TestListener listener;
+
+	// Odd dialogs are registrations, challenged and then accepted; even ones are calls, acked and then hung up.
+	vector<string> corpus;
+	for (unsigned d = 0; d < dialogs; d++) {
+		sip->addCall(callID(d), &listener, 1000 + d);
+	}
+	for (unsigned seq = 1; seq <= 2; seq++) {
+		for (unsigned d = 0; d < dialogs; d++) {
+			if (d % 2) {
+				corpus.push_back(seq == 1 ? response("401 Unauthorized", d, seq, true)
+							  : response("200 OK", d, seq, false));
+			} else {
+				corpus.push_back(request(seq == 1 ? "ACK" : "BYE", d, seq));
+			}
+		}
+	}
+	// And one for a call that is not in the map, which is dropped.
+	corpus.push_back(response("200 OK", dialogs, 1, false));
+
+	struct sockaddr_in source;
+	memset(&source, 0, sizeof(source));
+	source.sin_family = AF_INET;
+	for (size_t i = 0; i < corpus.size(); i++) {
+		ingress->receive(corpus[i].c_str(), corpus[i].size(), &source);
+	}
+	delete ingress;
+
+	printf("%u of %u messages delivered\n", listener.count(), (unsigned)corpus.size());
+	check("every message to a known call delivered", listener.count() == 2 * dialogs);
+
+	bool ownCall = true, ordered = true, parsed = true, nonce = true;
+	for (unsigned d = 0; d < dialogs; d++) {
+		const vector<TestListener::Delivery> &got = listener.mDeliveries[1000 + d];
+		for (unsigned i = 0; i < got.size(); i++) {
+			ownCall &= got[i].mCallID == callID(d);
+			ordered &= got[i].mSeq == i + 1;
+			if (d % 2) {
+				parsed &= got[i].mStatus == (got[i].mSeq == 1 ? 401 : 200);
+				nonce &= got[i].mNonce == (got[i].mSeq == 1);
+			} else {
+				parsed &= got[i].mStatus == 0;
+			}
+		}
+	}
+	check("each to the listener of its own call", ownCall);
+	check("each call in order", ordered);
+	check("status codes parsed", parsed);
+	check("challenge nonces kept", nonce);
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
@@ -19,6 +19,8 @@
 #include <string>
 
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
+#include <UMTS/UMTSClockSync.h>
 #include <UMTS/UMTSConfig.h>
 #include <UMTS/UMTSL1FEC.h>
 #include <UMTS/UMTSLogicalChannel.h>
@@ -30,6 +32,15 @@
 using namespace UMTS;
 using namespace std;
 
+static StatCounter sClockIndications("TRX.Clock.Indications", "binary clock indications from the transceiver");
+static StatCounter sClockLost("TRX.Clock.Lost", "clock indications missing from the sequence");
+static StatCounter sClockRelocks("TRX.Clock.Relocks", "clock indications off the fitted line, so it started over");
+static StatGauge sClockDrift("TRX.Clock.DriftPPB", "radio clock rate against CLOCK_MONOTONIC, parts per billion fast");
+static StatGauge sClockCorrection("TRX.Clock.CorrectionNs",
+	"how far the last indication moved the start of a frame, in ns, later if positive");
+static StatGauge sClockJitter("TRX.Clock.JitterNs", "RMS arrival delay of clock indications beyond the earliest");
+static StatHistogram sClockDelay("TRX.Clock.Delay", "us", "arrival of each clock indication after the fitted line");
+
 int ::ARFCNManager::sendCommandPacket(const char *command, char *response)
 {
 	int msgLen = 0;
@@ -208,6 +219,7 @@ bool ::ARFCNManager::radioPowerOn(bool warn)
 void TransceiverManager::TransceiverManagerInit(int numARFCNs, const char *wTRXAddress, int wBasePort)
 {
 	// mHaveClock = false;
+	mClockSeq = 0;
 	mClockSocket.open(wBasePort + 100);
 	// set up the ARFCN managers
 	for (int i = 0; i < numARFCNs; i++) {
@@ -245,6 +257,8 @@ void TransceiverManager::clockHandler()
 {
 	char buffer[MAX_UDP_LENGTH];
 	int msgLen = mClockSocket.read(buffer, 3000);
+	// As early as possible; everything after this is scheduling jitter the estimator has to filter out.
+	int64_t arrivalNs = Clock::nanoseconds();
 
 	// Did the transceiver die??
 	if (msgLen < 0) {
@@ -259,6 +273,13 @@ void TransceiverManager::clockHandler()
 		return;
 	}
 
+	ClockIndication ind;
+	if (ind.parse(buffer, msgLen)) {
+		clockIndication(ind, arrivalNs);
+		return;
+	}
+
+	// Older transceivers, which only say the frame number.
 	if (strncmp(buffer, "IND CLOCK", 9) == 0) {
 		uint32_t FN;
 		sscanf(buffer, "IND CLOCK %u", &FN);
@@ -272,6 +293,33 @@ void TransceiverManager::clockHandler()
 	LOG(ALERT) << "bogus message " << buffer << " on clock interface";
 }
 
+void TransceiverManager::clockIndication(const ClockIndication &ind, int64_t arrivalNs)
+{
+	sClockIndications.inc();
+	// A transceiver that restarted starts again from 0.
+	if (mClockEstimator.updates() && ind.mSeq > mClockSeq + 1) {
+		sClockLost.inc(ind.mSeq - mClockSeq - 1);
+	}
+	mClockSeq = ind.mSeq;
+
+	if (!mClockEstimator.update(ind.mChips, arrivalNs)) {
+		sClockRelocks.inc();
+		LOG(NOTICE) << "clock indication " << ind.mSeq << " off the fitted line, starting over";
+	}
+	// The frame started TN slots before the chip of the indication.
+	int64_t startNs = mClockEstimator.predict(ind.mChips - (int64_t)ind.mTN * gSlotLen);
+	int64_t moved = gNodeB->clock().setBase(ind.mFN, startNs);
+	mHaveClock = true;
+
+	sClockDrift.set((int64_t)(mClockEstimator.driftPPM() * 1000.0));
+	sClockCorrection.set(moved);
+	sClockJitter.set((int64_t)mClockEstimator.jitterNs());
+	sClockDelay.record(mClockEstimator.lastDelayNs() > 0 ? (uint64_t)mClockEstimator.lastDelayNs() / 1000 : 0);
+	LOG(INFO) << "CLOCK indication " << ind.mSeq << " FN=" << ind.mFN << ":" << (int)ind.mTN
+		  << " chip=" << ind.mChips << " arrival=" << arrivalNs << " moved=" << moved << "ns drift="
+		  << format("%.3f", mClockEstimator.driftPPM()) << "ppm";
+}
+
 ::ARFCNManager::ARFCNManager(const char *wTRXAddress, int wBasePort, TransceiverManager &wTransceiver, unsigned wCId)
 	: mTransceiver(wTransceiver), mDataSocket(wBasePort + 100 + 1, wTRXAddress, wBasePort + 1),
 	  mControlSocket(wBasePort + 100, wTRXAddress, wBasePort), mRadioModem(mDataSocket), mCId(wCId)
@@ -27,6 +27,7 @@
 #include <CommonLibs/Sockets.h>
 #include <CommonLibs/Threads.h>
 
+#include <UMTS/UMTSClockSync.h>
 #include <UMTS/UMTSCommon.h>
 #include <UMTS/UMTSRadioModem.h>
 #include <UMTS/UMTSTransfer.h>
@@ -55,6 +56,10 @@ private:
 	UDPSocket mClockSocket;
 	/// a thread to monitor the global clock socket
 	Thread mClockThread;
+	/// the radio clock against CLOCK_MONOTONIC, from the binary clock indications
+	UMTS::ClockEstimator mClockEstimator;
+	/// sequence number of the last binary clock indication
+	uint32_t mClockSeq;
 
 public:
 	/**
@@ -88,6 +93,9 @@ public:
 private:
 	/** Handler for messages on the clock interface. */
 	void clockHandler();
+
+	/** Set the NodeB clock from a binary clock indication that arrived at CLOCK_MONOTONIC arrivalNs. */
+	void clockIndication(const UMTS::ClockIndication &ind, int64_t arrivalNs);
 };
 
 void *ClockLoopAdapter(TransceiverManager *TRXm);
@@ -145,6 +153,12 @@ public:
 
 	void writeHighSide(UMTS::TxBitsBurst *burst);
 
+	/** Have the modem build a DCH's uplink scrambling code and pilot filters before its first burst. */
+	void prepareUplink(unsigned scramblingCode, unsigned numPilots)
+	{
+		mRadioModem.prepareUplink(scramblingCode, numPilots);
+	}
+
 	/**@name Transceiver controls. */
 	//@{
 
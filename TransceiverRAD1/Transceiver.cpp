@@ -22,6 +22,7 @@
 
 #include <CommonLibs/Configuration.h>
 #include <CommonLibs/Logger.h>
+#include <UMTS/UMTSClockSync.h>
 
 #include "FactoryCalibration.h"
 #include "Transceiver.h"
@@ -32,7 +33,7 @@ Transceiver::Transceiver(int wBasePort, const char *TRXAddress, int wSamplesPerS
 	RadioInterface *wRadioInterface)
 	: mDataSocket(wBasePort + 2, TRXAddress, wBasePort + 102),
 	  mControlSocket(wBasePort + 1, TRXAddress, wBasePort + 101),
-	  mClockSocket(wBasePort, TRXAddress, wBasePort + 100)
+	  mClockSocket(wBasePort, TRXAddress, wBasePort + 100), mLastClockSeq(0)
 {
 	// UMTS::Time startTime(0,0);
 	// UMTS::Time startTime(gHyperframe/2 - 4*216*60,0);
@@ -436,16 +437,21 @@ void Transceiver::driveTransmitFIFO()
 	// else radioClock->wait();
 }
 
+// Tell the core which chip of the receive stream a slot started on, with the frame number advanced past
+// the transmit latency, plus a margin, so the core runs ahead of the radio.  The advance is whole frames, so
+// every indication puts the frame boundaries in the same place.
 void Transceiver::writeClockInterface()
 {
-	char command[50];
-	// FIXME -- This should be adaptive.
-	sprintf(command, "IND CLOCK %llu", (unsigned long long)(mTransmitDeadlineClock.FN() + 8));
+	long long chips;
+	UMTS::Time radioTime = mRadioInterface->getClock()->get(&chips);
+	int advance = mTransmitLatency.FN() + (mTransmitLatency.TN() ? 1 : 0) + 8;
+	UMTS::Time indTime((radioTime.FN() + advance) % UMTS::gHyperframe, radioTime.TN());
+	UMTS::ClockIndication ind(__atomic_add_fetch(&mLastClockSeq, 1, __ATOMIC_RELAXED), indTime, chips);
 
-	LOG(INFO) << "ClockInterface: sending " << command;
-
-	mClockSocket.write(command, strlen(command) + 1);
+	LOG(INFO) << "ClockInterface: sending " << ind.mSeq << " " << indTime << " chip " << chips;
 
+	char command[UMTS::sClockIndicationLength];
+	mClockSocket.write(command, ind.write(command));
 	mLastClockUpdateTime = mTransmitDeadlineClock;
 }
 
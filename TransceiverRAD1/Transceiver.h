@@ -55,6 +55,7 @@ private:
 
 	UMTS::Time mTransmitDeadlineClock; ///< deadline for pushing bursts into transmit FIFO
 	UMTS::Time mLastClockUpdateTime;   ///< last time clock update was sent up to core
+	uint32_t mLastClockSeq;		   ///< sequence number of the last clock indication
 	radioVector *mEmptyTransmitBurst;
 
 	RadioInterface *mRadioInterface; ///< associated radioInterface object
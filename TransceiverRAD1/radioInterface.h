@@ -123,10 +123,13 @@ class RadioClock {
 
 private:
 	UMTS::Time mClock;
+	long long mSlots; ///< Slots received, so the current one started on chip mSlots * gSlotLen.
 	Mutex mLock;
 	Signal updateSignal;
 
 public:
+	RadioClock() : mSlots(0) {}
+
 	/** Set clock */
 	void set(const UMTS::Time &wTime)
 	{
@@ -141,6 +144,7 @@ public:
 	{
 		ScopedLock lock(mLock);
 		mClock.incTN();
+		mSlots++;
 		updateSignal.signal();
 	}
 	// void incTN() { ScopedLock lock(mLock); mClock.incTN(); updateSignal.broadcast();}
@@ -152,6 +156,14 @@ public:
 		return mClock;
 	}
 
+	/** Get clock value and the chip its slot started on, counting every chip received. */
+	UMTS::Time get(long long *chips)
+	{
+		ScopedLock lock(mLock);
+		*chips = mSlots * UMTS::gSlotLen;
+		return mClock;
+	}
+
 	/** Wait until clock has changed */
 	// void wait() {ScopedLock lock(mLock); updateSignal.wait(mLock,1);}
 	// FIXME -- If we take away the timeout, a lot of threads don't start.  Why?
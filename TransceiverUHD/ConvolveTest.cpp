@@ -0,0 +1,161 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU General Public
+ * License version 3. See the COPYING and NOTICE files in the current
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+/*
+ * Check every instruction set level this CPU supports against the scalar
+ * convolve kernels, then time each level.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "convolve.h"
+#include "simd.h"
+
+#define MAX_TAPS 64
+#define LEN 1024
+
+static unsigned failures = 0;
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void fill(float *buf, size_t len, unsigned *seed)
+{
+	for (size_t i = 0; i < len; i++)
+		buf[i] = (float)rand_r(seed) / RAND_MAX - 0.5f;
+}
+
+static void check(int level, const char *what, bool ok)
+{
+	if (!ok) {
+		printf("%-8s %-40s FAILED\n", simd_name(level), what);
+		failures++;
+	}
+}
+
+static bool same(const float *a, const float *b, size_t len, float tol)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (fabsf(a[i] - b[i]) > tol)
+			return false;
+	}
+
+	return true;
+}
+
+/* Every tap length, real and complex, ordinary and strided */
+static void testConvolve(int level)
+{
+	float *x = (float *)malloc(2 * (LEN + MAX_TAPS) * sizeof(float));
+	float *h = (float *)convolve_h_alloc(MAX_TAPS);
+	float y[2 * LEN], ref[2 * LEN];
+	unsigned seed = level + 1;
+	char what[64];
+
+	fill(x, 2 * (LEN + MAX_TAPS), &seed);
+
+	for (int h_len = 1; h_len <= MAX_TAPS; h_len++) {
+		int len = 1 + rand_r(&seed) % (LEN - MAX_TAPS);
+		float tol = 1e-5f * h_len;
+
+		/* Real taps as (h, 0) pairs */
+		fill(h, 2 * h_len, &seed);
+		for (int i = 0; i < h_len; i++)
+			h[2 * i + 1] = 0.0f;
+
+		simd_limit(SIMD_NONE);
+		base_convolve_real(x, LEN, h, h_len, ref, LEN, MAX_TAPS, len, 1, 0);
+		simd_limit(level);
+		convolve_real(x, LEN, h, h_len, y, LEN, MAX_TAPS, len, 1, 0);
+		snprintf(what, sizeof(what), "convolve_real %d taps", h_len);
+		check(level, what, same(y, ref, 2 * len, tol));
+
+		/* Resampler style: input stride q, output stride p */
+		int q = 1 + rand_r(&seed) % 3, p = 1 + rand_r(&seed) % 3;
+		int n = (LEN - MAX_TAPS) / (p > q ? p : q);
+		memset(y, 0, sizeof(y));
+		memset(ref, 0, sizeof(ref));
+		for (int i = 0; i < n; i++)
+			base_convolve_real(x, LEN, h, h_len, &ref[2 * p * i], 1, MAX_TAPS + q * i, 1, 1, 0);
+		convolve_real_stride(&x[2 * (MAX_TAPS - (h_len - 1))], q, h, h_len, y, p, n);
+		snprintf(what, sizeof(what), "convolve_real_stride %d taps %d/%d", h_len, p, q);
+		check(level, what, same(y, ref, 2 * p * n, tol));
+
+		fill(h, 2 * h_len, &seed);
+		simd_limit(SIMD_NONE);
+		base_convolve_complex(x, LEN, h, h_len, ref, LEN, MAX_TAPS, len, 1, 0);
+		simd_limit(level);
+		convolve_complex(x, LEN, h, h_len, y, LEN, MAX_TAPS, len, 1, 0);
+		snprintf(what, sizeof(what), "convolve_complex %d taps", h_len);
+		check(level, what, same(y, ref, 2 * len, 2 * tol));
+	}
+
+	free(x);
+	free(h);
+}
+
+/* Msamples/s of the UMTS resampler's 20 tap filter */
+static void bench(int level)
+{
+	const int iterations = 20000;
+	float *x = (float *)malloc(2 * (LEN + MAX_TAPS) * sizeof(float));
+	float *h = (float *)convolve_h_alloc(20);
+	float y[2 * LEN];
+	unsigned seed = 1;
+	double start, conv, stride;
+
+	fill(x, 2 * (LEN + MAX_TAPS), &seed);
+	fill(h, 40, &seed);
+	simd_limit(level);
+
+	start = now();
+	for (int i = 0; i < iterations; i++)
+		convolve_real(x, LEN + MAX_TAPS, h, 20, y, LEN, MAX_TAPS, LEN, 1, 0);
+	conv = iterations * LEN / (now() - start) / 1e6;
+
+	start = now();
+	for (int i = 0; i < iterations; i++)
+		convolve_real_stride(x, 1, h, 20, y, 1, LEN);
+	stride = iterations * LEN / (now() - start) / 1e6;
+
+	printf("%-8s convolve %7.1f  stride %7.1f Msps\n", simd_name(level), conv, stride);
+
+	free(x);
+	free(h);
+}
+
+int main(int argc, char **argv)
+{
+	simd_limit(SIMD_AVX512);
+	int top = simd_level();
+
+	printf("CPU supports %s\n", simd_name(top));
+	for (int level = SIMD_NONE; level <= top; level++) {
+		testConvolve(level);
+	}
+
+	for (int level = SIMD_NONE; level <= top; level++)
+		bench(level);
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
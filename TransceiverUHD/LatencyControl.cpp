@@ -0,0 +1,306 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU General Public
+ * License version 3. See the COPYING and NOTICE files in the current
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "LatencyControl.h"
+
+/* Long before any radio clock */
+static const long long NEVER = -(1LL << 60);
+
+/* Targets outside this range leave too few or too many slots to count */
+#define MIN_TARGET 1e-6
+#define MAX_TARGET 0.1
+
+static unsigned clampAdvance(long long advance)
+{
+	if (advance < (long long)LatencyControl::sMinAdvance)
+		return LatencyControl::sMinAdvance;
+	if (advance > (long long)LatencyControl::sMaxAdvance)
+		return LatencyControl::sMaxAdvance;
+	return advance;
+}
+
+LatencyControl::LatencyControl(unsigned wAdvance, double wTarget)
+	: mSlots(0), mUnderruns(0), mUnexplained(0), mLate(0), mEmpty(0)
+{
+	target(wTarget);
+	reset(wAdvance);
+}
+
+void LatencyControl::clear()
+{
+	memset(mLag, 0, sizeof(mLag));
+	memset(mLead, 0, sizeof(mLead));
+	mLagCount[0] = mLagCount[1] = 0;
+	mLeadCount[0] = mLeadCount[1] = 0;
+	mCurrent = 0;
+	mFilled = 0;
+	mWarm = false;
+}
+
+void LatencyControl::reset(unsigned wAdvance)
+{
+	ScopedLock lock(mLock);
+
+	clear();
+	mAdvance = clampAdvance(wAdvance);
+	mMargin = mAdvance - 1;
+	mRaisedFrom = 0;
+	mLastTight = mLastRaise = mLastBump = mLastLower = mQuietSince = NEVER;
+	mFloor = 0;
+	mQuietPeriods = 0;
+	mDecayStep = 1;
+	mLastDecay = 0;
+}
+
+/*
+ * A window twice the expected time between underruns, so the lag quantile
+ * rests on a couple of slots at least, but no shorter than a second.
+ */
+void LatencyControl::target(double wTarget)
+{
+	ScopedLock lock(mLock);
+
+	if (wTarget < MIN_TARGET)
+		wTarget = MIN_TARGET;
+	if (wTarget > MAX_TARGET)
+		wTarget = MAX_TARGET;
+
+	mTarget = wTarget;
+	mGeneration = 2 / wTarget;
+	if (mGeneration < sMinGeneration)
+		mGeneration = sMinGeneration;
+	if (mGeneration > sMaxGeneration)
+		mGeneration = sMaxGeneration;
+	clear();
+}
+
+double LatencyControl::target() const
+{
+	ScopedLock lock(mLock);
+	return mTarget;
+}
+
+unsigned LatencyControl::advance() const
+{
+	ScopedLock lock(mLock);
+	return mAdvance;
+}
+
+void LatencyControl::roll()
+{
+	mCurrent ^= 1;
+	memset(mLag[mCurrent], 0, sizeof(mLag[mCurrent]));
+	memset(mLead[mCurrent], 0, sizeof(mLead[mCurrent]));
+	mLagCount[mCurrent] = 0;
+	mLeadCount[mCurrent] = 0;
+	mFilled = 0;
+	mWarm = true;
+}
+
+/* The smallest lag that no more than the target fraction of the window exceeds */
+unsigned LatencyControl::lagQuantile() const
+{
+	uint64_t allowed = mTarget * (mLagCount[0] + mLagCount[1]);
+	uint64_t tail = 0;
+
+	for (unsigned lag = sBins - 1; lag > 0; lag--) {
+		tail += mLag[0][lag] + mLag[1][lag];
+		if (tail > allowed)
+			return lag;
+	}
+
+	return 0;
+}
+
+/*
+ * The largest lead that no more than the target fraction of the window fell
+ * short of. Late bursts are in the first bin, so it can come out -1.
+ */
+int LatencyControl::leadQuantile() const
+{
+	uint64_t count = mLeadCount[0] + mLeadCount[1];
+	uint64_t allowed = mTarget * count;
+	uint64_t tail = 0;
+
+	if (!count)
+		return 0;
+
+	for (unsigned bin = 0; bin < sBins; bin++) {
+		tail += mLead[0][bin] + mLead[1][bin];
+		if (tail > allowed)
+			return (int)bin - 1;
+	}
+
+	return sBins - 2;
+}
+
+/* Slots without an unexplained underrun before the margin comes down */
+unsigned LatencyControl::quiet() const
+{
+	unsigned slots = 1 / mTarget;
+	return slots < sMinGeneration ? sMinGeneration : slots;
+}
+
+/* Raises within one push keep the advance from before the first */
+void LatencyControl::raise(long long now, unsigned wAdvance)
+{
+	if (now != mLastRaise)
+		mRaisedFrom = mAdvance;
+	mAdvance = wAdvance;
+	mLastRaise = now;
+}
+
+void LatencyControl::decide(long long now)
+{
+	if (!mWarm)
+		return;
+
+	// Each quiet period takes twice as much off the margin as the one before, down to the floor, and every
+	// few of them take a slot off the floor
+	if (now - mQuietSince >= quiet()) {
+		mQuietSince = now;
+		if (++mQuietPeriods >= sFloorPeriods) {
+			mQuietPeriods = 0;
+			if (mFloor)
+				mFloor--;
+		}
+		if (mMargin > mFloor) {
+			unsigned step = mDecayStep < mMargin - mFloor ? mDecayStep : mMargin - mFloor;
+			mMargin -= step;
+			mLastDecay = step;
+			mDecayStep *= 2;
+		}
+	}
+
+	unsigned want = clampAdvance(lagQuantile() + 1 + mMargin);
+	if (want > mAdvance) {
+		raise(now, want);
+	} else if (want < mAdvance && now - mLastLower >= UMTS::gFrameSlots) {
+		mAdvance = want;
+		mLastLower = now;
+	}
+}
+
+/*
+ * The slot could be pushed once the radio clock reached its deadline less
+ * the advance, and the lag is how long after that it went. A slot the advance
+ * before the last raise already let through counts from then; one only the
+ * raise let through, from the raise.
+ */
+void LatencyControl::recordPush(long long now, int slack)
+{
+	ScopedLock lock(mLock);
+
+	// Everything up to the advance can go at the first push
+	if (mQuietSince == NEVER)
+		mQuietSince = mLastLower = mLastRaise = now;
+
+	long long deadline = now + slack;
+	long long pushable = deadline - mRaisedFrom + 1;
+	if (pushable > mLastRaise) {
+		pushable = deadline - mAdvance + 1;
+		if (pushable < mLastRaise)
+			pushable = mLastRaise;
+	}
+
+	long long lag = now - pushable;
+	if (lag < 0)
+		lag = 0;
+	if (lag >= sBins)
+		lag = sBins - 1;
+
+	mLag[mCurrent][lag]++;
+	mLagCount[mCurrent]++;
+	if (slack < (int)mMargin)
+		mLastTight = now;
+
+	mSlots++;
+	if (++mFilled >= mGeneration)
+		roll();
+
+	decide(now);
+}
+
+void LatencyControl::recordEmpty()
+{
+	ScopedLock lock(mLock);
+	mEmpty++;
+}
+
+void LatencyControl::recordArrival(int slack)
+{
+	ScopedLock lock(mLock);
+
+	int lead = slack - ((int)mAdvance - 1);
+	unsigned bin;
+
+	if (lead < 0) {
+		mLate++;
+		bin = 0;
+	} else {
+		bin = lead + 1 < (int)sBins ? lead + 1 : sBins - 1;
+	}
+
+	mLead[mCurrent][bin]++;
+	mLeadCount[mCurrent]++;
+}
+
+/*
+ * An underrun within the advance and a frame of a tight push is put down to
+ * the lag and left to the histogram. Any other means the path takes more than
+ * the margin, which becomes the floor, and raises the margin by at least what
+ * the last quiet period took off, so an overshoot comes back in one step.
+ */
+void LatencyControl::recordUnderrun(long long now)
+{
+	ScopedLock lock(mLock);
+
+	mUnderruns++;
+	if (now - mLastTight <= mAdvance + UMTS::gFrameSlots)
+		return;
+
+	mUnexplained++;
+	mQuietSince = now;
+	mQuietPeriods = 0;
+	mDecayStep = 1;
+
+	if (now - mLastBump < sRaiseHoldoff)
+		return;
+
+	// No push had less slack than the margin, so the path takes more than that
+	if (mFloor <= mMargin)
+		mFloor = mMargin + 1 < sMaxAdvance ? mMargin + 1 : sMaxAdvance;
+
+	unsigned step = mLastDecay > sRaiseStep ? mLastDecay : sRaiseStep;
+	mLastDecay = 0;
+	mMargin = mMargin + step < sMaxAdvance ? mMargin + step : sMaxAdvance;
+	mLastBump = now;
+
+	unsigned want = clampAdvance(mWarm ? lagQuantile() + 1 + mMargin : mAdvance + step);
+	if (want > mAdvance)
+		raise(now, want);
+}
+
+int LatencyControl::report(char *buf, size_t len) const
+{
+	ScopedLock lock(mLock);
+
+	return snprintf(buf, len, "%u %u %u %u %llu %llu %llu %llu %llu %d", mAdvance, mMargin, lagQuantile(),
+		(unsigned)(mTarget * 1e6 + 0.5), (unsigned long long)mSlots, (unsigned long long)mUnderruns,
+		(unsigned long long)mUnexplained, (unsigned long long)mLate, (unsigned long long)mEmpty,
+		leadQuantile());
+}
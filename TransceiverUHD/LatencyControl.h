@@ -0,0 +1,133 @@
+#ifndef LATENCYCONTROL_H
+#define LATENCYCONTROL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <CommonLibs/Threads.h>
+#include <UMTS/UMTSCommon.h>
+
+/*
+ * Transmit latency control
+ *
+ * The transceiver pushes the burst for slot D into the radio when the radio
+ * clock reaches D - advance + 1, so each slot starts out with advance - 1
+ * slots of slack. Some of that is used up before the push, when the transmit
+ * thread runs late, and that lag is measured for every slot pushed and kept in
+ * a histogram over the last few seconds. The rest has to cover the path from
+ * the push to the device, which is not visible here; it is held as a margin
+ * that is raised when the device underruns with no late push to explain it
+ * and lowered, faster the longer it stays quiet, when it does not.
+ *
+ * The advance is the lag that all but the target fraction of slots stay
+ * within, plus one, plus the margin. It goes up at once and comes down at most
+ * once a frame.
+ *
+ * The modem's clock is set ahead by the advance, so how early its bursts
+ * arrive does not depend on the advance; their lead over the push is kept in a
+ * histogram of its own, and the late ones counted, for the report.
+ *
+ * Times are absolute slot counts of the radio clock. Thread-safe.
+ */
+class LatencyControl {
+public:
+	static const unsigned sMinAdvance = 2;			    ///< The slot on the air and the one after.
+	static const unsigned sMaxAdvance = 15 * UMTS::gFrameSlots; ///< As the old rule, 15 frames.
+	static const unsigned sBins = sMaxAdvance + 1;		    ///< Lags 0 to sMaxAdvance slots, larger in the last.
+	static const unsigned sMinGeneration = 100 * UMTS::gFrameSlots;
+	static const unsigned sMaxGeneration = 10000 * UMTS::gFrameSlots;
+	static const unsigned sRaiseStep = 3;			    ///< Least margin added for an underrun.
+	static const unsigned sRaiseHoldoff = 10 * UMTS::gFrameSlots; ///< Between raises for underruns.
+	static const unsigned sFloorPeriods = 8;		    ///< Quiet periods for each slot off the floor.
+
+private:
+	mutable Mutex mLock;
+
+	double mTarget;	      ///< Underruns a slot to aim for.
+	unsigned mGeneration; ///< Slots in each half of the window.
+	unsigned mAdvance;
+	unsigned mMargin;
+	unsigned mFloor; ///< Least the path has been seen to take, less what quiet has taken off since.
+
+	// The window: two generations of each histogram, the current one filling and the one before.
+	uint32_t mLag[2][sBins];
+	uint32_t mLead[2][sBins];
+	unsigned mLagCount[2];
+	unsigned mLeadCount[2];
+	unsigned mCurrent;
+	unsigned mFilled; ///< Slots pushed in the current generation.
+	bool mWarm;	  ///< The window has held a full generation.
+
+	long long mLastTight;	 ///< Last push with less slack than the margin.
+	long long mLastRaise;	 ///< Last time the advance went up.
+	unsigned mRaisedFrom;	 ///< The advance before that.
+	long long mLastBump;	 ///< Last time the margin went up for an underrun.
+	long long mLastLower;	 ///< Last time the advance came down.
+	long long mQuietSince;	 ///< Last unexplained underrun, or the last margin decay.
+	unsigned mQuietPeriods;	 ///< Since the floor last came down.
+	unsigned mDecayStep;	 ///< Next margin decay, doubled each quiet period.
+	unsigned mLastDecay;	 ///< Margin the last decay took off, if no underrun since.
+
+	uint64_t mSlots;
+	uint64_t mUnderruns;
+	uint64_t mUnexplained;
+	uint64_t mLate;
+	uint64_t mEmpty;
+
+	void clear();
+	void roll();
+	unsigned lagQuantile() const;
+	int leadQuantile() const;
+	unsigned quiet() const;
+	void raise(long long now, unsigned wAdvance);
+	void decide(long long now);
+
+public:
+	/**
+	  @param wAdvance the advance to hold until the window fills, in slots
+	  @param wTarget the underruns a slot to aim for
+	*/
+	LatencyControl(unsigned wAdvance, double wTarget);
+
+	/** Start over with the given advance, keeping the target and the counts. */
+	void reset(unsigned wAdvance);
+
+	/** Change the target; the window grows with it, so it starts filling again. */
+	void target(double wTarget);
+	double target() const;
+
+	/** The transmit advance to use now, in slots. */
+	unsigned advance() const;
+
+	/**
+	  A slot was pushed into the radio.
+	  @param now the radio clock
+	  @param slack slots from the radio clock to the slot's deadline
+	*/
+	void recordPush(long long now, int slack);
+
+	/** A slot was pushed without a burst from the modem. */
+	void recordEmpty();
+
+	/**
+	  A burst arrived from the modem.
+	  @param slack slots from the radio clock to the burst's slot
+	*/
+	void recordArrival(int slack);
+
+	/** The radio reported an underrun. */
+	void recordUnderrun(long long now);
+
+	/**
+	  Print the state for the control interface, as
+	  "advance margin lag target slots underruns unexplained late empty lead":
+	  the advance, the margin and the lag quantile in slots, the target in
+	  underruns a million slots, the slots pushed, the underruns, the ones no
+	  late push explained, the modem bursts that came too late, the slots pushed
+	  without a burst, and the lead over the push that all but the target
+	  fraction of bursts had, in slots.
+	*/
+	int report(char *buf, size_t len) const;
+};
+
+#endif /* LATENCYCONTROL_H */
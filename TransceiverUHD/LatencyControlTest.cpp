@@ -0,0 +1,290 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU General Public
+ * License version 3. See the COPYING and NOTICE files in the current
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+/*
+ * Drive the transmit loop of Transceiver::driveTransmitFIFO on a simulated
+ * radio clock, one slot at a time, with synthetic traces of how late the
+ * transmit thread wakes and how long the device path takes: steady jitter,
+ * rare long stalls, and a device path that gets slower halfway through. Each
+ * trace runs once with the latency controller and once with the rule it
+ * replaced, which added a frame on an underrun and took a slot off after a
+ * second without one, and the underruns and the average advance over the last
+ * quarter of the run, once both have settled, are compared.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+
+#include "LatencyControl.h"
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static const double sTarget = 1e-4;
+static const unsigned sStartAdvance = 4 * UMTS::gFrameSlots; // As runTransceiver starts it.
+
+/* The controller, or the rule before it, as driveTransmitFIFO sees them */
+class Policy {
+public:
+	virtual ~Policy() {}
+	virtual unsigned advance() = 0;
+	virtual void underrun(long long now) = 0;
+	virtual void push(long long now, int slack) = 0;
+};
+
+class NewPolicy : public Policy {
+public:
+	LatencyControl mControl;
+
+	NewPolicy() : mControl(sStartAdvance, sTarget) {}
+	unsigned advance() { return mControl.advance(); }
+	void underrun(long long now) { mControl.recordUnderrun(now); }
+	void push(long long now, int slack) { mControl.recordPush(now, slack); }
+};
+
+/* The old rule, checked before every push */
+class OldPolicy : public Policy {
+	unsigned mAdvance;
+	long long mLastUpdate;
+	bool mUnderrun;
+
+public:
+	OldPolicy() : mAdvance(sStartAdvance), mLastUpdate(0), mUnderrun(false) {}
+	unsigned advance() { return mAdvance; }
+	void underrun(long long now) { mUnderrun = true; }
+	void push(long long now, int slack)
+	{
+		if (mUnderrun) {
+			mUnderrun = false;
+			if (now > mLastUpdate + 10 * UMTS::gFrameSlots) {
+				mAdvance += UMTS::gFrameSlots;
+				if (mAdvance > 15 * UMTS::gFrameSlots)
+					mAdvance = 15 * UMTS::gFrameSlots;
+				mLastUpdate = now;
+			}
+		} else if (mAdvance > UMTS::gFrameSlots && now > mLastUpdate + 100 * UMTS::gFrameSlots) {
+			mAdvance--;
+			mLastUpdate = now;
+		}
+	}
+};
+
+static double gaussian()
+{
+	double u = (random() + 1.0) / (RAND_MAX + 2.0);
+	double v = (random() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* A synthetic trace: the ticks the transmit thread sleeps through, and the device path */
+class Trace {
+public:
+	virtual ~Trace() {}
+	virtual unsigned stall(long long now) = 0;
+	virtual unsigned path(long long now) = 0;
+};
+
+/* Wakes within a slot or two, path of 4 slots */
+class SteadyTrace : public Trace {
+public:
+	unsigned stall(long long now)
+	{
+		double d = 0.8 * gaussian();
+		return d < 0.5 ? 0 : (unsigned)(d + 0.5);
+	}
+	unsigned path(long long now) { return 4; }
+};
+
+/* On time, but about one wake in 5000 stalls for 8 to 20 slots */
+class BurstyTrace : public Trace {
+public:
+	unsigned stall(long long now) { return random() % 5000 ? 0 : 8 + random() % 13; }
+	unsigned path(long long now) { return 4; }
+};
+
+/* Steady, until the device path goes from 4 slots to 14 */
+class StepTrace : public SteadyTrace {
+	long long mStep;
+
+public:
+	StepTrace(long long wStep) : mStep(wStep) {}
+	unsigned path(long long now) { return now < mStep ? 4 : 14; }
+};
+
+struct Result {
+	unsigned long long mSlots;
+	unsigned long long mUnderruns;
+	unsigned long long mLateUnderruns; ///< In the last quarter.
+	double mAdvanceSum;
+	double mLateAdvanceSum; ///< In the last quarter.
+
+	double rate() const { return (double)mUnderruns / mSlots; }
+	double lateRate() const { return mLateUnderruns / (mSlots / 4.0); }
+	double meanAdvance() const { return mAdvanceSum / mSlots; }
+	double lateAdvance() const { return mLateAdvanceSum / (mSlots / 4.0); }
+};
+
+/*
+ * The radio clock ticks once a slot. When the thread is awake it pushes every
+ * slot whose deadline is less than the advance away, as driveTransmitFIFO
+ * does, then sleeps through as many ticks as the trace says. A slot pushed
+ * with less slack than the device path misses the air, and the device says so
+ * when its time comes; the flag is read before the next push.
+ */
+static Result simulate(Trace &trace, Policy &policy, long long slots, unsigned seed)
+{
+	srandom(seed);
+	Result r = {0, 0, 0, 0, 0};
+	std::deque<long long> reports;
+	long long deadline = 0, wake = 0;
+	bool flag = false;
+
+	for (long long now = 0; now < slots; now++) {
+		while (reports.size() && reports.front() <= now) {
+			flag = true;
+			reports.pop_front();
+		}
+		if (now < wake)
+			continue;
+
+		while (now + policy.advance() > deadline) {
+			if (flag) {
+				policy.underrun(now);
+				flag = false;
+			}
+			int slack = deadline - now;
+			bool missed = slack < (int)trace.path(now);
+			policy.push(now, slack);
+
+			r.mSlots++;
+			r.mAdvanceSum += policy.advance();
+			if (deadline >= slots * 3 / 4)
+				r.mLateAdvanceSum += policy.advance();
+			if (missed) {
+				r.mUnderruns++;
+				if (deadline >= slots * 3 / 4)
+					r.mLateUnderruns++;
+				reports.push_back(deadline > now ? deadline : now);
+			}
+			deadline++;
+		}
+		wake = now + 1 + trace.stall(now);
+	}
+
+	return r;
+}
+
+static void compare(const char *name, Trace &trace, long long slots, Result &now, Result &old)
+{
+	NewPolicy np;
+	OldPolicy op;
+	now = simulate(trace, np, slots, 50);
+	old = simulate(trace, op, slots, 50);
+
+	char report[100];
+	np.mControl.report(report, sizeof(report));
+	printf("%s, %lld slots:\n", name, slots);
+	printf("  controller: advance %.1f slots, %.1f last quarter; %.2g underruns a slot, %.2g last quarter\n",
+		now.meanAdvance(), now.lateAdvance(), now.rate(), now.lateRate());
+	printf("  old rule:   advance %.1f slots, %.1f last quarter; %.2g underruns a slot, %.2g last quarter\n",
+		old.meanAdvance(), old.lateAdvance(), old.rate(), old.lateRate());
+	printf("  report: %s\n", report);
+}
+
+static void testTraces()
+{
+	Result now, old;
+
+	SteadyTrace steady;
+	compare("steady jitter", steady, 1500000, now, old);
+	check("steady: underruns within 2x the target", now.lateRate() < 2 * sTarget);
+	check("steady: a third less advance than the old rule", now.lateAdvance() * 3 < old.lateAdvance() * 2);
+
+	BurstyTrace bursty;
+	compare("rare long stalls", bursty, 1500000, now, old);
+	check("stalls: underruns within 2x the target", now.lateRate() < 2 * sTarget);
+	check("stalls: less advance than the old rule", now.lateAdvance() < old.lateAdvance());
+
+	StepTrace step(1500000);
+	compare("device path 4 to 14 slots", step, 3000000, now, old);
+	check("step: settles within 2x the target", now.lateRate() < 2 * sTarget);
+	check("step: advance covers the new path", now.lateAdvance() > 14);
+	check("step: below the old advance", now.lateAdvance() < old.lateAdvance());
+}
+
+/* The modem side is only counted; check the counts and the report */
+static void testReport()
+{
+	LatencyControl control(sStartAdvance, sTarget);
+	char report[100];
+	unsigned advance, margin, lag, ppm;
+	unsigned long long slots, underruns, unexplained, late, empty;
+	int lead;
+
+	srandom(51);
+	unsigned wantLate = 0;
+	for (long long now = 0; now < 100000; now++) {
+		control.recordPush(now, control.advance() - 1);
+		int ahead = 30 + 8 * gaussian();
+		if (ahead < 0) {
+			wantLate++;
+			control.recordEmpty();
+		}
+		control.recordArrival(control.advance() - 1 + ahead);
+	}
+	unsigned quiet = control.advance();
+	control.recordUnderrun(100000);
+
+	int n = control.report(report, sizeof(report));
+	printf("report: %s\n", report);
+	check("report fits the control response",
+		n > 0 && n < 80 && sscanf(report, "%u %u %u %u %llu %llu %llu %llu %llu %d", &advance, &margin, &lag,
+					     &ppm, &slots, &underruns, &unexplained, &late, &empty, &lead) == 10);
+	check("on-time pushes come down to the minimum", quiet == LatencyControl::sMinAdvance);
+	check("an unexplained underrun raises the margin", margin >= LatencyControl::sRaiseStep && advance > quiet);
+	check("counts", slots == 100000 && underruns == 1 && unexplained == 1 && late == wantLate &&
+				empty == wantLate && ppm == 100);
+	check("modem lead quantile near 30 - 3.7 sigma", lead >= 30 - 8 * 4 - 1 && lead <= 30 - 8 * 3);
+
+	control.target(1e-3);
+	check("new target", fabs(control.target() - 1e-3) < 1e-12);
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("LatencyControlTest", "EMERG");
+
+	testTraces();
+	testReport();
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
@@ -150,9 +150,9 @@ bool RadioInterface::init()
 	outerSendBuffer = new signalVector(NUMCHUNKS * outchunk);
 	innerRecvBuffer = new signalVector(NUMCHUNKS * inchunk);
 
-	/* Buffers that feed the resampler require filter length headroom */
-	innerSendBuffer = new signalVector(NUMCHUNKS * inchunk + upsampler->len());
-	outerRecvBuffer = new signalVector(outchunk + dnsampler->len());
+	/* Resamplers keep their own filter history, so no headroom is needed */
+	innerSendBuffer = new signalVector(NUMCHUNKS * inchunk);
+	outerRecvBuffer = new signalVector(outchunk);
 
 	convertSendBuffer = new short[outerSendBuffer->size() * 2];
 	convertRecvBuffer = new short[outerRecvBuffer->size() * 2];
@@ -261,8 +261,7 @@ bool RadioInterface::pushBuffer(void)
 	inner_len = chunks * inchunk;
 	outer_len = chunks * outchunk;
 
-	/* Input from the buffer with number of taps length headroom */
-	float *resamp_in = (float *)(innerSendBuffer->begin() + upsampler->len());
+	float *resamp_in = (float *)innerSendBuffer->begin();
 	float *resamp_out = (float *)outerSendBuffer->begin();
 
 	rc = upsampler->rotate(resamp_in, inner_len, resamp_out, outer_len);
@@ -276,8 +275,7 @@ bool RadioInterface::pushBuffer(void)
 	mRadio->writeSamples(convertSendBuffer, outer_len, &underrun, writeTimestamp);
 
 	/* Shift remaining samples to beginning of buffer */
-	memmove(innerSendBuffer->begin() + upsampler->len(), innerSendBuffer->begin() + upsampler->len() + inner_len,
-		(sendCursor - inner_len) * 2 * sizeof(float));
+	memmove(innerSendBuffer->begin(), innerSendBuffer->begin() + inner_len, (sendCursor - inner_len) * 2 * sizeof(float));
 
 	writeTimestamp += outer_len;
 	sendCursor -= inner_len;
@@ -310,7 +308,7 @@ bool RadioInterface::pullBuffer(void)
 	}
 
 	short *convert_in = convertRecvBuffer;
-	float *convert_out = (float *)(outerRecvBuffer->begin() + dnsampler->len());
+	float *convert_out = (float *)outerRecvBuffer->begin();
 
 	convert_short_float(convert_out, convert_in, CONVERT_RX_SCALE, outchunk * 2);
 	if (detectClipping(convert_out, outchunk * 2, CLIP_THRESH)) {
@@ -321,7 +319,7 @@ bool RadioInterface::pullBuffer(void)
 	readTimestamp += outchunk;
 
 	/* Write to the end of the inner receive buffer */
-	float *resamp_in = (float *)(outerRecvBuffer->begin() + dnsampler->len());
+	float *resamp_in = (float *)outerRecvBuffer->begin();
 	float *resamp_out = (float *)(innerRecvBuffer->begin() + recvCursor);
 
 	int rc = dnsampler->rotate(resamp_in, outchunk, resamp_out, inchunk);
@@ -345,7 +343,7 @@ void RadioInterface::driveTransmitRadio(signalVector &radioBurst, bool zeroBurst
 		return;
 
 	/* Buffer write position */
-	float *pos = (float *)(innerSendBuffer->begin() + upsampler->len() + sendCursor);
+	float *pos = (float *)(innerSendBuffer->begin() + sendCursor);
 
 	radioifyVector(radioBurst, pos, zeroBurst);
 
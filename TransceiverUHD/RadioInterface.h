@@ -79,10 +79,13 @@ class RadioBurstFIFO : public InterthreadQueueWithWait<radioVector> {
 class RadioClock {
 private:
 	UMTS::Time mClock;
+	long long mSlots; ///< Slots received, so the current one started on chip mSlots * gSlotLen.
 	Mutex mLock;
 	Signal updateSignal;
 
 public:
+	RadioClock() : mSlots(0) {}
+
 	/** Set clock */
 	void set(const UMTS::Time &wTime)
 	{
@@ -96,6 +99,7 @@ public:
 	{
 		ScopedLock lock(mLock);
 		mClock.incTN();
+		mSlots++;
 		updateSignal.signal();
 	}
 
@@ -106,6 +110,14 @@ public:
 		return mClock;
 	}
 
+	/** Get clock value and the chip its slot started on, counting every chip received. */
+	UMTS::Time get(long long *chips)
+	{
+		ScopedLock lock(mLock);
+		*chips = mSlots * UMTS::gSlotLen;
+		return mClock;
+	}
+
 	void wait()
 	{
 		ScopedLock lock(mLock);
@@ -28,7 +28,8 @@
 #include "Resampler.h"
 #include "convolve.h"
 
-#define MAX_OUTPUT_LEN 8192
+/* Filter taps are padded to a multiple of this many complex samples */
+#define TAP_ALIGN 4
 
 static float sinc(float x)
 {
@@ -109,7 +110,7 @@ bool Resampler::initFilters(int type, float bw)
 
 	partitions = (float **)malloc(sizeof(float *) * p);
 	if (!partitions) {
-		delete proto;
+		delete[] proto;
 		return false;
 	}
 
@@ -123,7 +124,7 @@ bool Resampler::initFilters(int type, float bw)
 	} else if (type == FILTER_TYPE_SINC) {
 		scale = gen_windowed_sinc(proto, proto_len, p, q, bw);
 	} else {
-		delete proto;
+		delete[] proto;
 		return false;
 	}
 
@@ -146,7 +147,18 @@ bool Resampler::initFilters(int type, float bw)
 		}
 	}
 
-	delete proto;
+	/*
+	 * Block kernel taps. Each partition is zero padded at the front to
+	 * a whole number of vector widths.
+	 */
+	taps = (float *)memalign(32, p * tap_len * 2 * sizeof(float));
+	memset(taps, 0, p * tap_len * 2 * sizeof(float));
+
+	for (size_t n = 0; n < p; n++) {
+		memcpy(&taps[2 * tap_len * n + 2 * (tap_len - filt_len)], partitions[n], filt_len * 2 * sizeof(float));
+	}
+
+	delete[] proto;
 	return true;
 }
 
@@ -159,6 +171,9 @@ void Resampler::releaseFilters()
 
 	free(partitions);
 	partitions = NULL;
+
+	free(taps);
+	taps = NULL;
 }
 
 bool Resampler::checkLen(size_t in_len, size_t out_len)
@@ -187,97 +202,115 @@ bool Resampler::checkLen(size_t in_len, size_t out_len)
 		return false;
 	}
 
-	if (out_len > path_len) {
-#ifdef DEBUG
-		std::cerr << "Block length of " << out_len << " exceeds max of " << path_len << std::endl;
-		std::cerr << "Resizing" << std::endl;
-#endif
-		computePaths(out_len * 2);
-	}
-
 	return true;
 }
 
-int Resampler::rotate(float *in, size_t in_len, float *out, size_t out_len)
+int Resampler::rotate(const float *in, size_t in_len, float *out, size_t out_len)
 {
-	int n, path;
-	int hist_len = filt_len - 1;
+	size_t blocks, edge;
 
 	if (!checkLen(in_len, out_len))
 		return -1;
 
-	/* Insert history */
-	memcpy(&in[-2 * hist_len], history, hist_len * 2 * sizeof(float));
+	/*
+	 * Join the start of the input onto the saved history. Windows that
+	 * reach back before the first input sample are run from here.
+	 */
+	blocks = out_len / p;
+	edge = in_len < hist_len ? in_len : hist_len;
+	memcpy(&history[2 * hist_len], in, edge * 2 * sizeof(float));
 
-	/* Generate output from precomputed input/output paths */
-	for (size_t i = 0; i < out_len; i++) {
-		n = in_index[i];
-		path = out_path[i];
+	/*
+	 * Drive each branch of the commutator over the whole block. Window
+	 * for input index n covers samples n - hist_len through n.
+	 */
+	for (size_t k = 0; k < p; k++) {
+		const struct branch *br = &branches[k];
+		const float *h = &taps[2 * tap_len * br->path];
+		size_t b = 0;
+
+		for (; b < blocks && b * q + br->in < hist_len; b++) {
+			size_t n = b * q + br->in;
+			convolve_real_stride(&history[2 * n], 1, h, tap_len, &out[2 * (b * p + br->out)], 1, 1);
+		}
 
-		convolve_real(in, in_len, partitions[path], filt_len, &out[2 * i], out_len - i, n, 1, 1, 0);
+		if (b < blocks) {
+			size_t n = b * q + br->in;
+			convolve_real_stride(
+				&in[2 * (n - hist_len)], q, h, tap_len, &out[2 * (b * p + br->out)], p, blocks - b);
+		}
 	}
 
 	/* Save history */
-	memcpy(history, &in[2 * (in_len - hist_len)], hist_len * 2 * sizeof(float));
+	if (in_len >= hist_len)
+		memcpy(history, &in[2 * (in_len - hist_len)], hist_len * 2 * sizeof(float));
+	else
+		memmove(history, &history[2 * in_len], hist_len * 2 * sizeof(float));
 
 	return out_len;
 }
 
 bool Resampler::init(int type, float bw)
 {
-	size_t hist_len = filt_len - 1;
-
 	/* Filterbank filter internals */
 	if (!initFilters(type, bw))
 		return false;
 
-	/* History buffer */
-	history = new float[2 * hist_len];
-	memset(history, 0, 2 * hist_len * sizeof(float));
+	/* History buffer followed by room for the start of the next input */
+	history = new float[4 * hist_len];
+	memset(history, 0, 4 * hist_len * sizeof(float));
 
-	computePaths(path_len);
+	computeBranches();
 
 	return true;
 }
 
-bool Resampler::computePaths(int len)
+/*
+ * Precompute one period of the commutator. Output k of every period
+ * reads from input (q * k) / p of the same period through partition
+ * (q * k) % p. Branches sharing a partition are kept together so its
+ * taps stay in cache.
+ */
+void Resampler::computeBranches()
 {
-	if (len <= 0)
-		return false;
+	size_t *start = new size_t[p + 1];
 
-	delete in_index;
-	delete out_path;
+	memset(start, 0, (p + 1) * sizeof(size_t));
+	for (size_t k = 0; k < p; k++)
+		start[(q * k) % p + 1]++;
+	for (size_t n = 0; n < p; n++)
+		start[n + 1] += start[n];
 
-	/* Precompute filterbank paths */
-	in_index = new size_t[len];
-	out_path = new size_t[len];
+	branches = new struct branch[p];
 
-	for (int i = 0; i < len; i++) {
-		in_index[i] = (q * i) / p;
-		out_path[i] = (q * i) % p;
-	}
+	for (size_t k = 0; k < p; k++) {
+		struct branch *br = &branches[start[(q * k) % p]++];
 
-	path_len = len;
+		br->out = k;
+		br->in = (q * k) / p;
+		br->path = (q * k) % p;
+	}
 
-	return true;
+	delete[] start;
 }
 
 size_t Resampler::len() { return filt_len; }
 
-Resampler::Resampler(size_t p, size_t q, size_t filt_len)
-	: in_index(NULL), out_path(NULL), partitions(NULL), history(NULL)
+const float *Resampler::partition(size_t path) const { return partitions[path]; }
+
+Resampler::Resampler(size_t p, size_t q, size_t filt_len) : partitions(NULL), taps(NULL), history(NULL), branches(NULL)
 {
 	this->p = p;
 	this->q = q;
 	this->filt_len = filt_len;
-	this->path_len = MAX_OUTPUT_LEN;
+	this->tap_len = (filt_len + TAP_ALIGN - 1) / TAP_ALIGN * TAP_ALIGN;
+	this->hist_len = tap_len - 1;
 }
 
 Resampler::~Resampler()
 {
 	releaseFilters();
 
-	delete history;
-	delete in_index;
-	delete out_path;
+	delete[] history;
+	delete[] branches;
 }
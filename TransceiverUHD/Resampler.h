@@ -32,32 +32,54 @@ public:
 	 *
 	 * Input and output vector lengths must of be equal multiples of the
 	 * rational conversion rate denominator and numerator respectively.
+	 * Any such length is accepted. The resampler keeps its own filter
+	 * history between calls, so the input buffer needs no headroom and
+	 * is never written.
 	 */
-	int rotate(float *in, size_t in_len, float *out, size_t out_len);
+	int rotate(const float *in, size_t in_len, float *out, size_t out_len);
 
 	/* Get filter length
 	 *   @return number of taps in each filter partition
 	 */
 	size_t len();
 
+	/* Get filter partition
+	 *   @param path partition index, less than the numerator
+	 *   @return reversed taps in the complex-real layout of convolve_real()
+	 */
+	const float *partition(size_t path) const;
+
 	enum { FILTER_TYPE_SINC,
 		FILTER_TYPE_RRC,
 	};
 
 private:
+	/*
+	 * One output phase of the commutator. The input/output pattern
+	 * repeats every p outputs and q inputs, so a block of outputs is
+	 * driven one branch at a time, each branch running its filter over
+	 * every period of the block.
+	 */
+	struct branch {
+		size_t out;
+		size_t in;
+		size_t path;
+	};
+
 	size_t p;
 	size_t q;
 	size_t filt_len;
-	size_t path_len;
-	size_t *in_index;
-	size_t *out_path;
+	size_t tap_len;
+	size_t hist_len;
 
 	float **partitions;
+	float *taps;
 	float *history;
+	struct branch *branches;
 
 	bool initFilters(int type, float bw);
 	void releaseFilters();
-	bool computePaths(int len);
+	void computeBranches();
 	bool checkLen(size_t in_len, size_t out_len);
 };
 
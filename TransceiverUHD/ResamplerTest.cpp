@@ -0,0 +1,173 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU General Public
+ * License version 3. See the COPYING and NOTICE files in the current
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+/*
+ * Check the block resampler against the original one output at a time
+ * convolve_real() commutator, streaming over many calls of assorted
+ * lengths, and time both at the UMTS transceiver rates.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "Resampler.h"
+#include "convolve.h"
+
+#define RESAMP_INRATE 384
+#define RESAMP_OUTRATE 625
+#define RESAMP_TAP_LEN 20
+
+static unsigned failures = 0;
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/*
+ * The original commutator, driven with the same filter partitions. The
+ * caller's buffer has filter length headroom in front of the input.
+ */
+class Reference {
+public:
+	Reference(const Resampler &r, size_t p, size_t q, size_t filt_len) : r(r), p(p), q(q), filt_len(filt_len)
+	{
+		history = new float[2 * filt_len];
+		memset(history, 0, 2 * filt_len * sizeof(float));
+	}
+	~Reference() { delete[] history; }
+
+	void rotate(float *in, size_t in_len, float *out, size_t out_len)
+	{
+		size_t hist_len = filt_len - 1;
+
+		memcpy(&in[-2 * (int)hist_len], history, hist_len * 2 * sizeof(float));
+		for (size_t i = 0; i < out_len; i++) {
+			convolve_real(in, in_len, (float *)r.partition((q * i) % p), filt_len, &out[2 * i], out_len - i,
+				(q * i) / p, 1, 1, 0);
+		}
+		memcpy(history, &in[2 * (in_len - hist_len)], hist_len * 2 * sizeof(float));
+	}
+
+private:
+	const Resampler &r;
+	size_t p, q, filt_len;
+	float *history;
+};
+
+static void fill(float *buf, size_t len, unsigned *seed)
+{
+	for (size_t i = 0; i < 2 * len; i++)
+		buf[i] = (float)rand_r(seed) / RAND_MAX - 0.5f;
+}
+
+/* Stream the same random input through both and compare every output */
+static void compare(size_t p, size_t q, int type, float bw)
+{
+	Resampler block(p, q, RESAMP_TAP_LEN);
+	block.init(type, bw);
+	Reference ref(block, p, q, RESAMP_TAP_LEN);
+
+	const size_t max_blocks = 8;
+	float *in = new float[2 * (max_blocks * q + RESAMP_TAP_LEN)];
+	float *out_block = new float[2 * max_blocks * p];
+	float *out_ref = new float[2 * max_blocks * p];
+	unsigned seed = 1;
+	double max_err = 0.0, max_mag = 0.0;
+	bool ok = true;
+
+	for (int call = 0; call < 64; call++) {
+		size_t blocks = 1 + rand_r(&seed) % max_blocks;
+		float *x = &in[2 * RESAMP_TAP_LEN];
+
+		fill(x, blocks * q, &seed);
+		if (block.rotate(x, blocks * q, out_block, blocks * p) != (int)(blocks * p))
+			ok = false;
+		ref.rotate(x, blocks * q, out_ref, blocks * p);
+
+		for (size_t i = 0; i < 2 * blocks * p; i++) {
+			double err = fabs(out_block[i] - out_ref[i]);
+			if (err > max_err)
+				max_err = err;
+			if (fabs(out_ref[i]) > max_mag)
+				max_mag = fabs(out_ref[i]);
+		}
+	}
+
+	if (block.rotate(in, q + 1, out_block, p) >= 0)
+		ok = false;
+
+	ok &= max_err <= 1e-5 * max_mag;
+	printf("%4zu/%-4zu max error %.3g of peak %.3g %s\n", p, q, max_err, max_mag, ok ? "ok" : "FAILED");
+	if (!ok)
+		failures++;
+
+	delete[] in;
+	delete[] out_block;
+	delete[] out_ref;
+}
+
+/* Output rate in Msamples/s for chunks of the given number of blocks */
+static void bench(size_t p, size_t q, size_t blocks)
+{
+	Resampler r(p, q, RESAMP_TAP_LEN);
+	r.init(Resampler::FILTER_TYPE_RRC, p < q ? (float)p / (float)q : 1.0f);
+	Reference ref(r, p, q, RESAMP_TAP_LEN);
+
+	size_t in_len = blocks * q, out_len = blocks * p;
+	float *in = new float[2 * (in_len + RESAMP_TAP_LEN)];
+	float *out = new float[2 * out_len];
+	float *x = &in[2 * RESAMP_TAP_LEN];
+	unsigned seed = 2;
+	fill(x, in_len, &seed);
+
+	const size_t total = 20 * 1000 * 1000;
+	size_t calls = total / out_len;
+
+	double start = now();
+	for (size_t i = 0; i < calls; i++)
+		ref.rotate(x, in_len, out, out_len);
+	double old_rate = calls * out_len / (now() - start) / 1e6;
+
+	start = now();
+	for (size_t i = 0; i < calls; i++)
+		r.rotate(x, in_len, out, out_len);
+	double new_rate = calls * out_len / (now() - start) / 1e6;
+
+	printf("%4zu/%-4zu chunk %5zu in: %7.1f Msps one at a time, %7.1f Msps block, x%.1f\n", p, q, in_len,
+		old_rate, new_rate, new_rate / old_rate);
+
+	delete[] in;
+	delete[] out;
+}
+
+int main(int argc, char **argv)
+{
+	/* Receive (downsample) and transmit (upsample) directions of RadioInterface */
+	compare(RESAMP_INRATE, RESAMP_OUTRATE, Resampler::FILTER_TYPE_RRC, (float)RESAMP_INRATE / RESAMP_OUTRATE);
+	compare(RESAMP_OUTRATE, RESAMP_INRATE, Resampler::FILTER_TYPE_RRC, 1.0f);
+	compare(RESAMP_OUTRATE, RESAMP_INRATE, Resampler::FILTER_TYPE_SINC, 1.0f);
+
+	bench(RESAMP_INRATE, RESAMP_OUTRATE, 2);
+	bench(RESAMP_OUTRATE, RESAMP_INRATE, 2);
+	bench(RESAMP_OUTRATE, RESAMP_INRATE, 16);
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
@@ -17,6 +17,8 @@
 #include <stdio.h>
 
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
+#include <UMTS/UMTSClockSync.h>
 
 #include "Transceiver.h"
 
@@ -26,17 +28,35 @@
 /* Default attenuation value in dB */
 #define DEFAULT_ATTEN 20
 
+static StatGauge sTransmitAdvance("TRX.Latency.AdvanceSlots", "transmit latency set by the latency controller");
+static StatCounter sTransmitUnderruns("TRX.Latency.Underruns", "underruns reported by the radio");
+
+/* Slots from b to a */
+static int slotsAfter(const UMTS::Time &a, const UMTS::Time &b)
+{
+	return (a - b) * (int)UMTS::gFrameSlots + (int)a.TN() - (int)b.TN();
+}
+
+static unsigned latencySlots(const UMTS::Time &latency) { return latency.FN() * UMTS::gFrameSlots + latency.TN(); }
+
+/* Whole frames past a transmit advance, plus a margin */
+static unsigned clockFrames(unsigned advance) { return (advance + UMTS::gFrameSlots - 1) / UMTS::gFrameSlots + 8; }
+
 Transceiver::Transceiver(
 	int wBasePort, const char *wTRXAddress, UMTS::Time wTransmitLatency, RadioInterface *wRadioInterface)
 	: mDataSocket(wBasePort + 2, wTRXAddress, wBasePort + 102),
 	  mControlSocket(wBasePort + 1, wTRXAddress, wBasePort + 101),
 	  mClockSocket(wBasePort, wTRXAddress, wBasePort + 100), mTxServiceLoopThread(NULL), mRxServiceLoopThread(NULL),
 	  mTransmitPriorityQueueServiceLoopThread(NULL), mControlServiceLoopThread(NULL), mOn(false),
-	  mPower(DEFAULT_ATTEN), mTransmitLatency(wTransmitLatency), mRadioInterface(wRadioInterface)
+	  mPower(DEFAULT_ATTEN), mTransmitLatency(wTransmitLatency),
+	  mLatency(latencySlots(wTransmitLatency), DEFAULT_UNDERRUN_TARGET / 1e6),
+	  mClockAdvance(clockFrames(latencySlots(wTransmitLatency))), mLastClockSeq(0),
+	  mRadioInterface(wRadioInterface)
 {
 	signalVector emptyVector(UMTS::gSlotLen);
 	UMTS::Time emptyTime(0, 0);
 	mEmptyTransmitBurst = new radioVector((const signalVector &)emptyVector, (UMTS::Time &)emptyTime);
+	sTransmitAdvance.set(mLatency.advance());
 }
 
 Transceiver::~Transceiver()
@@ -78,7 +98,6 @@ void Transceiver::init(int wDelaySpread)
 	mRadioInterface->getClock()->set(time);
 	mTransmitDeadlineClock = time;
 	mLastClockUpdateTime = time;
-	mLatencyUpdateTime = time;
 
 	mDelaySpread = wDelaySpread;
 	mPower = mRadioInterface->setPowerAttenuation(mPower);
@@ -109,7 +128,8 @@ bool Transceiver::start()
 	UMTS::Time time = mRadioInterface->getClock()->get();
 	mTransmitDeadlineClock = time;
 	mLastClockUpdateTime = time;
-	mLatencyUpdateTime = time;
+	mLatency.reset(latencySlots(mTransmitLatency));
+	mClockAdvance = clockFrames(latencySlots(mTransmitLatency));
 
 	if (!mRadioInterface->start()) {
 		LOG(ALERT) << "Device failed to start";
@@ -173,6 +193,9 @@ void Transceiver::stop()
 
 void Transceiver::addRadioVector(signalVector &burst, UMTS::Time &wTime)
 {
+	UMTS::Time now = mRadioInterface->getClock()->get();
+	mLatency.recordArrival(slotsAfter(wTime, now));
+
 	// modulate and stick into queue
 	radioVector *vec = new radioVector(burst, wTime);
 	RN_MEMLOG(radioVector, vec);
@@ -200,6 +223,7 @@ void Transceiver::pushRadioVector(UMTS::Time &now)
 	// Extremely rare that we get here. We need to send a blank burst to the
 	// radio interface to update the timestamp.
 	LOG(INFO) << "Sending empty burst at " << now;
+	mLatency.recordEmpty();
 	mRadioInterface->driveTransmitRadio(*(mEmptyTransmitBurst), true);
 }
 
@@ -207,7 +231,7 @@ void Transceiver::reset() { mTransmitPriorityQueue.clear(); }
 
 void Transceiver::driveControl()
 {
-	int MAX_PACKET_LENGTH = 100;
+	int MAX_PACKET_LENGTH = 200;
 
 	// check control socket
 	char buffer[MAX_PACKET_LENGTH];
@@ -281,6 +305,19 @@ void Transceiver::driveControl()
 			sprintf(response, "RSP TXTUNE 0 %d", freqkhz);
 	} else if (!strcmp(command, "SETFREQOFFSET")) {
 		sprintf(response, "RSP SETFREQOFFSET 1");
+	} else if (!strcmp(command, "LATENCY")) {
+		char report[MAX_PACKET_LENGTH];
+		mLatency.report(report, sizeof(report));
+		snprintf(response, MAX_PACKET_LENGTH, "RSP LATENCY 0 %s", report);
+	} else if (!strcmp(command, "SETLATENCYTARGET")) {
+		int perMillion = 0;
+		sscanf(buffer, "%3s %s %d", cmdcheck, command, &perMillion);
+		if (perMillion < 1 || perMillion > 100000) {
+			sprintf(response, "RSP SETLATENCYTARGET 1 %d", perMillion);
+		} else {
+			underrunTarget(perMillion);
+			sprintf(response, "RSP SETLATENCYTARGET 0 %d", perMillion);
+		}
 	} else {
 		LOG(WARNING) << "bogus command " << command << " on control interface.";
 	}
@@ -371,58 +408,73 @@ void Transceiver::driveReceiveFIFO()
  * Deadline clock indicates the burst that needs to be
  * pushed into the FIFO right NOW.  If transmit queue does
  * not have a burst, stick in filler data.
+ *
+ * The latency is whatever the latency controller says after
+ * each push; it sees the slack every slot was pushed with and
+ * every underrun the radio reports.
  */
 void Transceiver::driveTransmitFIFO()
 {
 	RadioClock *radioClock = mRadioInterface->getClock();
+	long long chips;
 
 	if (!mOn)
 		return;
 
 	radioClock->wait();
 
-	while (radioClock->get() + mTransmitLatency > mTransmitDeadlineClock) {
-		// if underrun, then we're not providing bursts to radio/USRP fast
-		//   enough.  Need to increase latency by one UMTS frame.
-		if (mRadioInterface->getWindowType() == RadioDevice::TX_WINDOW_USRP1) {
-			if (mRadioInterface->isUnderrun()) {
-				// only do latency update every 10 frames, so we don't over update
-				if (radioClock->get() > mLatencyUpdateTime + UMTS::Time(10, 0)) {
-					mTransmitLatency = mTransmitLatency + UMTS::Time(1, 0);
-					if (mTransmitLatency > UMTS::Time(15, 0))
-						mTransmitLatency = UMTS::Time(15, 0);
-
-					LOG(INFO) << "new latency: " << mTransmitLatency;
-					mLatencyUpdateTime = radioClock->get();
-				}
-			} else {
-				// if underrun hasn't occurred in the last sec (100 frames) drop
-				//    transmit latency by a timeslot
-				if (mTransmitLatency > UMTS::Time(1, 0)) {
-					if (radioClock->get() > mLatencyUpdateTime + UMTS::Time(100, 0)) {
-						mTransmitLatency.decTN();
-						LOG(INFO) << "reduced latency: " << mTransmitLatency;
-						mLatencyUpdateTime = radioClock->get();
-					}
-				}
-			}
+	UMTS::Time now = radioClock->get(&chips);
+	while (now + mTransmitLatency > mTransmitDeadlineClock) {
+		long long slot = chips / UMTS::gSlotLen;
+
+		// if underrun, then we're not providing bursts to radio/USRP fast enough
+		if (mRadioInterface->isUnderrun()) {
+			sTransmitUnderruns.inc();
+			mLatency.recordUnderrun(slot);
 		}
 
 		// time to push burst to transmit FIFO
 		pushRadioVector(mTransmitDeadlineClock);
+		mLatency.recordPush(slot, slotsAfter(mTransmitDeadlineClock, now));
 		mTransmitDeadlineClock.incTN();
+
+		unsigned advance = mLatency.advance();
+		if (advance != latencySlots(mTransmitLatency)) {
+			mTransmitLatency = UMTS::Time(advance / UMTS::gFrameSlots, advance % UMTS::gFrameSlots);
+			sTransmitAdvance.set(advance);
+			LOG(INFO) << "new latency: " << mTransmitLatency;
+		}
+
+		now = radioClock->get(&chips);
 	}
 }
 
+// Tell the core which chip of the receive stream a slot started on, with the frame number advanced past
+// the transmit latency, plus a margin, so the core runs ahead of the radio.  The advance is whole frames, so
+// every indication puts the frame boundaries in the same place.  Each change of it moves the core's clock by
+// a frame or more, so it follows the latency controller with hysteresis: up as soon as the controller needs
+// more, and down only when two frames are to spare, a frame an indication.
 void Transceiver::writeClockInterface()
 {
-	char command[50];
-
-	sprintf(command, "IND CLOCK %llu", (unsigned long long)(mTransmitDeadlineClock.FN() + 8));
+	long long chips;
+	UMTS::Time radioTime = mRadioInterface->getClock()->get(&chips);
+	unsigned want = clockFrames(mLatency.advance());
+	unsigned advance;
+	{
+		ScopedLock lock(mClockLock);
+		if (want > mClockAdvance)
+			mClockAdvance = want;
+		else if (want + 2 <= mClockAdvance)
+			mClockAdvance--;
+		advance = mClockAdvance;
+	}
+	UMTS::Time indTime((radioTime.FN() + advance) % UMTS::gHyperframe, radioTime.TN());
+	UMTS::ClockIndication ind(__atomic_add_fetch(&mLastClockSeq, 1, __ATOMIC_RELAXED), indTime, chips);
 
-	LOG(INFO) << "ClockInterface: sending " << command;
+	LOG(INFO) << "ClockInterface: sending " << ind.mSeq << " " << indTime << " chip " << chips;
 
-	mClockSocket.write(command, strlen(command) + 1);
+	char command[UMTS::sClockIndicationLength];
+	mClockSocket.write(command, ind.write(command));
 	mLastClockUpdateTime = mTransmitDeadlineClock;
 }
 
@@ -8,8 +8,12 @@
 #include <CommonLibs/Sockets.h>
 #include <UMTS/UMTSCommon.h>
 
+#include "LatencyControl.h"
 #include "RadioInterface.h"
 
+/* Default transmit underruns to aim for, per million slots */
+#define DEFAULT_UNDERRUN_TARGET 100
+
 /** The Transceiver class, responsible for physical layer of basestation */
 class Transceiver {
 private:
@@ -33,11 +37,15 @@ private:
 	int mPower;       ///< the transmit power in dB
 	int mDelaySpread; ///< maximum expected delay spread, i.e. extend buffer when sending upstream
 
-	UMTS::Time mTransmitLatency;   ///< latency between basestation clock and transmit deadline clock
-	UMTS::Time mLatencyUpdateTime; ///< last time latency was updated
+	UMTS::Time mTransmitLatency; ///< latency between basestation clock and transmit deadline clock
+	LatencyControl mLatency;     ///< sets the transmit latency from the slack of each slot pushed
+
+	Mutex mClockLock;		   ///< serializes the clock advance between the threads that send indications
+	unsigned mClockAdvance;		   ///< frames the core's clock is set ahead of the radio
 
 	UMTS::Time mTransmitDeadlineClock; ///< deadline for pushing bursts into transmit FIFO
 	UMTS::Time mLastClockUpdateTime;   ///< last time clock update was sent up to core
+	uint32_t mLastClockSeq;		   ///< sequence number of the last clock indication
 	radioVector *mEmptyTransmitBurst;
 
 	RadioInterface *mRadioInterface; ///< associated radioInterface object
@@ -80,6 +88,9 @@ public:
 	/** attach the radioInterface transmit FIFO */
 	void transmitFIFO(VectorFIFO *wFIFO) { mTransmitFIFO = wFIFO; }
 
+	/** set the transmit underruns to aim for, per million slots */
+	void underrunTarget(unsigned perMillion) { mLatency.target(perMillion / 1e6); }
+
 	RadioBurstFIFO *highSideTransmitFIFO(void) { return &mT; }
 	RadioBurstFIFO *highSideReceiveFIFO(void) { return &mR; }
 
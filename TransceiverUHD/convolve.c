@@ -1,5 +1,5 @@
 /*
- * SSE Convolution
+ * SSE and AVX convolution
  * Copyright (C) 2012, 2013 Thomas Tsou <tom@tsou.cc>
  *
  * This library is free software; you can redistribute it and/or
@@ -21,16 +21,15 @@
 #include <stdio.h>
 #include <string.h>
 
-#ifdef HAVE_CONFIG_H
-#include "config.h"
-#endif
+#include "simd.h"
 
-#ifdef HAVE_SSE3
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
 #include <pmmintrin.h>
 #include <xmmintrin.h>
 
 /* 4-tap SSE complex-real convolution */
-static void sse_conv_real4(float *restrict x, float *restrict h, float *restrict y, int len)
+static SIMD_TARGET("sse3") void sse_conv_real4(float *restrict x, float *restrict h, float *restrict y, int len)
 {
 	__m128 m0, m1, m2, m3, m4, m5, m6, m7;
 
@@ -61,7 +60,7 @@ static void sse_conv_real4(float *restrict x, float *restrict h, float *restrict
 }
 
 /* 8-tap SSE complex-real convolution */
-static void sse_conv_real8(float *restrict x, float *restrict h, float *restrict y, int len)
+static SIMD_TARGET("sse3") void sse_conv_real8(float *restrict x, float *restrict h, float *restrict y, int len)
 {
 	__m128 m0, m1, m2, m3, m4, m5, m6, m7, m8, m9;
 
@@ -105,7 +104,7 @@ static void sse_conv_real8(float *restrict x, float *restrict h, float *restrict
 }
 
 /* 12-tap SSE complex-real convolution */
-static void sse_conv_real12(float *restrict x, float *restrict h, float *restrict y, int len)
+static SIMD_TARGET("sse3") void sse_conv_real12(float *restrict x, float *restrict h, float *restrict y, int len)
 {
 	__m128 m0, m1, m2, m3, m4, m5, m6, m7;
 	__m128 m8, m9, m10, m11, m12, m13, m14;
@@ -164,7 +163,7 @@ static void sse_conv_real12(float *restrict x, float *restrict h, float *restric
 }
 
 /* 16-tap SSE complex-real convolution */
-static void sse_conv_real16(float *restrict x, float *restrict h, float *restrict y, int len)
+static SIMD_TARGET("sse3") void sse_conv_real16(float *restrict x, float *restrict h, float *restrict y, int len)
 {
 	__m128 m0, m1, m2, m3, m4, m5, m6, m7;
 	__m128 m8, m9, m10, m11, m12, m13, m14, m15;
@@ -236,7 +235,7 @@ static void sse_conv_real16(float *restrict x, float *restrict h, float *restric
 }
 
 /* 20-tap SSE complex-real convolution */
-static void sse_conv_real20(float *restrict x, float *restrict h, float *restrict y, int len)
+static SIMD_TARGET("sse3") void sse_conv_real20(float *restrict x, float *restrict h, float *restrict y, int len)
 {
 	__m128 m0, m1, m2, m3, m4, m5, m6, m7;
 	__m128 m8, m9, m11, m12, m13, m14, m15;
@@ -319,7 +318,7 @@ static void sse_conv_real20(float *restrict x, float *restrict h, float *restric
 }
 
 /* 4*N-tap SSE complex-real convolution */
-static void sse_conv_real4n(float *x, float *h, float *y, int h_len, int len)
+static SIMD_TARGET("sse3") void sse_conv_real4n(const float *x, const float *h, float *y, int h_len, int len)
 {
 	__m128 m0, m1, m2, m4, m5, m6, m7;
 
@@ -359,7 +358,7 @@ static void sse_conv_real4n(float *x, float *h, float *y, int h_len, int len)
 }
 
 /* 4*N-tap SSE complex-complex convolution */
-static void sse_conv_cmplx_4n(float *x, float *h, float *y, int h_len, int len)
+static SIMD_TARGET("sse3") void sse_conv_cmplx_4n(float *x, float *h, float *y, int h_len, int len)
 {
 	__m128 m0, m1, m2, m3, m4, m5, m6, m7;
 
@@ -407,7 +406,7 @@ static void sse_conv_cmplx_4n(float *x, float *h, float *y, int h_len, int len)
 }
 
 /* 8*N-tap SSE complex-complex convolution */
-static void sse_conv_cmplx_8n(float *x, float *h, float *y, int h_len, int len)
+static SIMD_TARGET("sse3") void sse_conv_cmplx_8n(float *x, float *h, float *y, int h_len, int len)
 {
 	__m128 m0, m1, m2, m3, m4, m5, m6, m7;
 	__m128 m8, m9, m10, m11, m12, m13, m14, m15;
@@ -476,10 +475,154 @@ static void sse_conv_cmplx_8n(float *x, float *h, float *y, int h_len, int len)
 		_mm_store_ss(&y[2 * i + 1], m2);
 	}
 }
+
+/* Sum the four complex values of an AVX register into the low pair of an SSE register */
+static SIMD_TARGET("avx2") __m128 avx_sum_cmplx(__m256 m0)
+{
+	__m128 m1;
+
+	m1 = _mm_add_ps(_mm256_castps256_ps128(m0), _mm256_extractf128_ps(m0, 1));
+	return _mm_add_ps(m1, _mm_movehl_ps(m1, m1));
+}
+
+/*
+ * 4*N-tap AVX2 complex-real convolution
+ *
+ * Input and output advance by x_step and y_step complex samples per
+ * output, so the same kernel drives both ordinary convolution and the
+ * strided polyphase branches of the resampler. Real taps are stored
+ * as (h, 0) pairs and duplicated into both lanes on load.
+ */
+static SIMD_TARGET("avx2,fma") void avx2_conv_real4n(
+	const float *x, int x_step, const float *h, int h_len, float *y, int y_step, int len)
+{
+	__m256 m0, m1;
+	__m128 m2;
+
+	for (int i = 0; i < len; i++) {
+		int n = 0;
+
+		m0 = _mm256_setzero_ps();
+		m1 = _mm256_setzero_ps();
+
+		/* Two accumulators to hide the FMA latency */
+		for (; n + 8 <= h_len; n += 8) {
+			m0 = _mm256_fmadd_ps(
+				_mm256_loadu_ps(&x[2 * n + 0]), _mm256_moveldup_ps(_mm256_loadu_ps(&h[2 * n + 0])), m0);
+			m1 = _mm256_fmadd_ps(
+				_mm256_loadu_ps(&x[2 * n + 8]), _mm256_moveldup_ps(_mm256_loadu_ps(&h[2 * n + 8])), m1);
+		}
+		if (n < h_len)
+			m0 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[2 * n]), _mm256_moveldup_ps(_mm256_loadu_ps(&h[2 * n])), m0);
+
+		m2 = avx_sum_cmplx(_mm256_add_ps(m0, m1));
+		_mm_storel_pi((__m64 *)y, m2);
+
+		x += 2 * x_step;
+		y += 2 * y_step;
+	}
+}
+
+/*
+ * 4*N-tap AVX2 complex-complex convolution
+ *
+ * Accumulate x * re(h) and swapped x * im(h) separately and combine the
+ * two with a single add-subtract after the sum.
+ */
+static SIMD_TARGET("avx2,fma") void avx2_conv_cmplx_4n(float *x, float *h, float *y, int h_len, int len)
+{
+	__m256 m0, m1, m2, m3;
+
+	for (int i = 0; i < len; i++) {
+		m0 = _mm256_setzero_ps();
+		m1 = _mm256_setzero_ps();
+
+		for (int n = 0; n < h_len; n += 4) {
+			m2 = _mm256_loadu_ps(&x[2 * i + 2 * n]);
+			m3 = _mm256_loadu_ps(&h[2 * n]);
+
+			m0 = _mm256_fmadd_ps(m2, _mm256_moveldup_ps(m3), m0);
+			m1 = _mm256_fmadd_ps(_mm256_permute_ps(m2, _MM_SHUFFLE(2, 3, 0, 1)), _mm256_movehdup_ps(m3), m1);
+		}
+
+		_mm_storel_pi((__m64 *)&y[2 * i], _mm_addsub_ps(avx_sum_cmplx(m0), avx_sum_cmplx(m1)));
+	}
+}
+
+/* Fold the upper half of an AVX-512 register onto the lower */
+static SIMD_TARGET("avx512f") __m256 avx512_fold(__m512 m0)
+{
+	__m256 m1 = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(m0), 1));
+
+	return _mm256_add_ps(_mm512_castps512_ps256(m0), m1);
+}
+
+/* 4*N-tap AVX-512 complex-real convolution, 8 taps per step with a 4 tap tail */
+static SIMD_TARGET("avx512f,avx2,fma") void avx512_conv_real4n(
+	const float *x, int x_step, const float *h, int h_len, float *y, int y_step, int len)
+{
+	__m512 m0;
+	__m256 m1;
+	__m128 m2;
+
+	for (int i = 0; i < len; i++) {
+		int n = 0;
+
+		m0 = _mm512_setzero_ps();
+		for (; n + 8 <= h_len; n += 8) {
+			m0 = _mm512_fmadd_ps(
+				_mm512_loadu_ps(&x[2 * n]), _mm512_moveldup_ps(_mm512_loadu_ps(&h[2 * n])), m0);
+		}
+
+		m1 = avx512_fold(m0);
+		if (n < h_len)
+			m1 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[2 * n]), _mm256_moveldup_ps(_mm256_loadu_ps(&h[2 * n])), m1);
+
+		m2 = avx_sum_cmplx(m1);
+		_mm_storel_pi((__m64 *)y, m2);
+
+		x += 2 * x_step;
+		y += 2 * y_step;
+	}
+}
+
+/* 4*N-tap AVX-512 complex-complex convolution */
+static SIMD_TARGET("avx512f,avx2,fma") void avx512_conv_cmplx_4n(float *x, float *h, float *y, int h_len, int len)
+{
+	__m512 m0, m1, m2, m3;
+	__m256 m4, m5, m6, m7;
+
+	for (int i = 0; i < len; i++) {
+		int n = 0;
+
+		m0 = _mm512_setzero_ps();
+		m1 = _mm512_setzero_ps();
+
+		for (; n + 8 <= h_len; n += 8) {
+			m2 = _mm512_loadu_ps(&x[2 * i + 2 * n]);
+			m3 = _mm512_loadu_ps(&h[2 * n]);
+
+			m0 = _mm512_fmadd_ps(m2, _mm512_moveldup_ps(m3), m0);
+			m1 = _mm512_fmadd_ps(_mm512_permute_ps(m2, _MM_SHUFFLE(2, 3, 0, 1)), _mm512_movehdup_ps(m3), m1);
+		}
+
+		m4 = avx512_fold(m0);
+		m5 = avx512_fold(m1);
+		if (n < h_len) {
+			m6 = _mm256_loadu_ps(&x[2 * i + 2 * n]);
+			m7 = _mm256_loadu_ps(&h[2 * n]);
+
+			m4 = _mm256_fmadd_ps(m6, _mm256_moveldup_ps(m7), m4);
+			m5 = _mm256_fmadd_ps(_mm256_permute_ps(m6, _MM_SHUFFLE(2, 3, 0, 1)), _mm256_movehdup_ps(m7), m5);
+		}
+
+		_mm_storel_pi((__m64 *)&y[2 * i], _mm_addsub_ps(avx_sum_cmplx(m4), avx_sum_cmplx(m5)));
+	}
+}
 #endif
 
 /* Base multiply and accumulate complex-real */
-static void mac_real(float *x, float *h, float *y)
+static void mac_real(const float *x, const float *h, float *y)
 {
 	y[0] += x[0] * h[0];
 	y[1] += x[1] * h[0];
@@ -493,7 +636,7 @@ static void mac_cmplx(float *x, float *h, float *y)
 }
 
 /* Base vector complex-complex multiply and accumulate */
-static void mac_real_vec_n(float *x, float *h, float *y, int len, int step, int offset)
+static void mac_real_vec_n(const float *x, const float *h, float *y, int len, int step, int offset)
 {
 	for (int i = offset; i < len; i += step)
 		mac_real(&x[2 * i], &h[2 * i], y);
@@ -550,15 +693,25 @@ int convolve_real(
 	float *x, int x_len, float *h, int h_len, float *y, int y_len, int start, int len, int step, int offset)
 {
 	void (*conv_func)(float *, float *, float *, int) = NULL;
-	void (*conv_func_n)(float *, float *, float *, int, int) = NULL;
+	void (*conv_func_n)(const float *, const float *, float *, int, int) = NULL;
 
 	if (bounds_check(x_len, h_len, y_len, start, len, step) < 0)
 		return -1;
 
 	memset(y, 0, len * 2 * sizeof(float));
 
-#ifdef HAVE_SSE3
-	if (step <= 4) {
+#ifdef HAVE_X86_SIMD
+	int level = simd_level();
+
+	if ((step <= 4) && !(h_len % 4) && (level >= SIMD_AVX2)) {
+		if (level >= SIMD_AVX512)
+			avx512_conv_real4n(&x[2 * (-(h_len - 1) + start)], 1, h, h_len, y, 1, len);
+		else
+			avx2_conv_real4n(&x[2 * (-(h_len - 1) + start)], 1, h, h_len, y, 1, len);
+		return len;
+	}
+
+	if ((step <= 4) && (level >= SIMD_SSE3)) {
 		switch (h_len) {
 		case 4:
 			conv_func = sse_conv_real4;
@@ -603,8 +756,18 @@ int convolve_complex(
 
 	memset(y, 0, len * 2 * sizeof(float));
 
-#ifdef HAVE_SSE3
-	if (step <= 4) {
+#ifdef HAVE_X86_SIMD
+	int level = simd_level();
+
+	if ((step <= 4) && !(h_len % 4) && (level >= SIMD_AVX2)) {
+		if (level >= SIMD_AVX512)
+			avx512_conv_cmplx_4n(&x[2 * (-(h_len - 1) + start)], h, y, h_len, len);
+		else
+			avx2_conv_cmplx_4n(&x[2 * (-(h_len - 1) + start)], h, y, h_len, len);
+		return len;
+	}
+
+	if ((step <= 4) && (level >= SIMD_SSE3)) {
 		if (!(h_len % 8))
 			conv_func = sse_conv_cmplx_8n;
 		else if (!(h_len % 4))
@@ -620,6 +783,40 @@ int convolve_complex(
 	return len;
 }
 
+/* API: Aligned complex-real with strided input and output */
+int convolve_real_stride(const float *x, int x_step, const float *h, int h_len, float *y, int y_step, int len)
+{
+	if ((x_step < 1) || (h_len < 1) || (y_step < 1) || (len < 1)) {
+		fprintf(stderr, "Convolve: Invalid input\n");
+		return -1;
+	}
+
+#ifdef HAVE_X86_SIMD
+	int level = simd_level();
+
+	if (!(h_len % 4)) {
+		if (level >= SIMD_AVX512) {
+			avx512_conv_real4n(x, x_step, h, h_len, y, y_step, len);
+			return len;
+		} else if (level >= SIMD_AVX2) {
+			avx2_conv_real4n(x, x_step, h, h_len, y, y_step, len);
+			return len;
+		} else if (level >= SIMD_SSE3) {
+			for (int i = 0; i < len; i++)
+				sse_conv_real4n(&x[2 * i * x_step], h, &y[2 * i * y_step], h_len, 1);
+			return len;
+		}
+	}
+#endif
+	for (int i = 0; i < len; i++) {
+		y[2 * i * y_step + 0] = 0.0f;
+		y[2 * i * y_step + 1] = 0.0f;
+		mac_real_vec_n(&x[2 * i * x_step], h, &y[2 * i * y_step], h_len, 1, 0);
+	}
+
+	return len;
+}
+
 /* API: Non-aligned (no SSE) complex-real */
 int base_convolve_real(
 	float *x, int x_len, float *h, int h_len, float *y, int y_len, int start, int len, int step, int offset)
@@ -647,9 +844,5 @@ int base_convolve_complex(
 /* Aligned filter tap allocation */
 void *convolve_h_alloc(int len)
 {
-#ifdef HAVE_SSE3
-	return memalign(16, len * 2 * sizeof(float));
-#else
-	return malloc(len * 2 * sizeof(float));
-#endif
+	return memalign(32, len * 2 * sizeof(float));
 }
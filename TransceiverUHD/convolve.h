@@ -13,6 +13,14 @@ extern int convolve_real(
 extern int convolve_complex(
 	float *x, int x_len, float *h, int h_len, float *y, int y_len, int start, int len, int step, int offset);
 
+/*
+ * One output per window of h_len complex input samples, with x pointing
+ * at the oldest sample of the first window. Input and output advance by
+ * x_step and y_step complex samples per output.
+ */
+extern int convolve_real_stride(
+	const float *x, int x_step, const float *h, int h_len, float *y, int y_step, int len);
+
 extern int base_convolve_real(
 	float *x, int x_len, float *h, int h_len, float *y, int y_len, int start, int len, int step, int offset);
 
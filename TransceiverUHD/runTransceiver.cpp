@@ -97,6 +97,20 @@ static bool init_extref()
 	return enable != 0;
 }
 
+/* Optional transmit underrun target (default 100 per million slots) */
+static int init_underrun_target()
+{
+	int target;
+
+	try {
+		target = gConfig.getNum("TRX.Latency.UnderrunTarget");
+	} catch (ConfigurationTableKeyNotFound e) {
+		target = DEFAULT_UNDERRUN_TARGET;
+	}
+
+	return target;
+}
+
 /* Optional device hint (default none) */
 static std::string init_devaddr()
 {
@@ -120,7 +134,7 @@ int main(int argc, char *argv[])
 	Transceiver *trx = NULL;
 	RadioInterface *radio = NULL;
 
-	int max_delay;
+	int max_delay, underrun_target;
 	bool found, extref;
 	std::string devaddr;
 
@@ -135,6 +149,7 @@ int main(int argc, char *argv[])
 	max_delay = init_max_delay();
 	extref = init_extref();
 	devaddr = init_devaddr();
+	underrun_target = init_underrun_target();
 
 	srandom(time(NULL));
 
@@ -163,6 +178,7 @@ int main(int argc, char *argv[])
 
 	trx = new Transceiver(5700, "127.0.0.1", UMTS::Time(4, 0), radio);
 	trx->receiveFIFO(radio->receiveFIFO());
+	trx->underrunTarget(underrun_target);
 	trx->init(max_delay);
 
 	while (!gbShutdown)
@@ -0,0 +1,75 @@
+/*
+ * Run time instruction set selection
+ * Copyright (C) 2014 Range Networks, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+
+#include "simd.h"
+
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+static int detected = SIMD_NONE;
+static int limit = SIMD_AVX512;
+
+/*
+ * The compiler's CPU probe checks both CPUID and that the OS saves the
+ * wider register state (XGETBV) before reporting AVX features.
+ */
+static int detect(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return SIMD_SSE4_1;
+	if (__builtin_cpu_supports("sse3"))
+		return SIMD_SSE3;
+#endif
+	return SIMD_NONE;
+}
+
+static void detect_level(void) { detected = detect(); }
+
+/* The kernels call this from every thread, so the probe runs once under pthread_once */
+int simd_level(void)
+{
+	pthread_once(&detect_once, detect_level);
+
+	return detected < limit ? detected : limit;
+}
+
+void simd_limit(int level) { limit = level; }
+
+const char *simd_name(int level)
+{
+	switch (level) {
+	case SIMD_SSE3:
+		return "SSE3";
+	case SIMD_SSE4_1:
+		return "SSE4.1";
+	case SIMD_AVX2:
+		return "AVX2";
+	case SIMD_AVX512:
+		return "AVX-512";
+	default:
+		return "scalar";
+	}
+}
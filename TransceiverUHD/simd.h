@@ -0,0 +1,38 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Instruction set levels for the convolve kernels. Each level
+ * includes everything below it. Kernels for every level are built on x86
+ * regardless of compiler flags and the best one is chosen at run time.
+ */
+enum simd_level {
+	SIMD_NONE,
+	SIMD_SSE3,
+	SIMD_SSE4_1,
+	SIMD_AVX2,
+	SIMD_AVX512,
+};
+
+#if defined(__i386__) || defined(__x86_64__)
+#define HAVE_X86_SIMD
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* Highest level supported by this CPU and allowed by simd_limit() */
+extern int simd_level(void);
+
+/* Cap the level used by the kernels, eg to compare against the scalar code; not for use while they run */
+extern void simd_limit(int level);
+
+extern const char *simd_name(int level);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _SIMD_H_ */
@@ -0,0 +1,350 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Churn DCHs open and closed from RRC-like threads while receive and transmit threads walk the active set every
+// slot, checking nothing a reader holds changes or is deleted under it, and that the retired snapshots are all
+// deleted in the end.  Then compare how long closing a DCH takes against the list with its in-use flags that the
+// modem used before.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <list>
+#include <vector>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Threads.h>
+
+#include "UMTSActiveList.h"
+
+using namespace UMTS;
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const unsigned sChannels = 64;
+static const unsigned sMagic = 0x44434846;
+
+struct Channel {
+	unsigned mMagic;
+	unsigned mIndex;
+};
+
+static Channel sChannel[sChannels];
+
+typedef ActiveList<Channel> ChannelList;
+
+static ChannelList *sList;
+static volatile bool sStop;
+
+struct ReaderResult {
+	unsigned slots, walked, longHolds;
+	bool ok;
+};
+
+// A radio thread: walk the set every slot, now and then holding it for as long as a slow slot might.
+static void *reader(void *arg)
+{
+	ReaderResult *r = (ReaderResult *)arg;
+	r->slots = r->walked = r->longHolds = 0;
+	r->ok = true;
+	unsigned seed = (unsigned)(uintptr_t)arg;
+	Channel *seen[sChannels * 2];
+	while (!sStop) {
+		ChannelList::Snapshot s(*sList);
+		size_t n = 0;
+		for (ChannelList::const_iterator it = s.begin(); it != s.end() && n < sChannels * 2; ++it) {
+			r->ok &= (*it)->mMagic == sMagic && *it == &sChannel[(*it)->mIndex];
+			seen[n++] = *it;
+		}
+		r->ok &= n == s.size() && n <= sChannels;
+		r->walked += n;
+		if (rand_r(&seed) % 64 == 0) {
+			// Writers carry on meanwhile; what we hold must not change.
+			usleep(200);
+			r->longHolds++;
+			size_t i = 0;
+			for (ChannelList::const_iterator it = s.begin(); it != s.end(); ++it, ++i) {
+				r->ok &= i < n && seen[i] == *it;
+			}
+			r->ok &= i == n && s.size() == n;
+		}
+		r->slots++;
+	}
+	return NULL;
+}
+
+struct WriterResult {
+	unsigned first, count, ops;
+	uint64_t worstNs;
+};
+
+// RRC: open and close this thread's DCHs as fast as it can.
+static void *writer(void *arg)
+{
+	WriterResult *w = (WriterResult *)arg;
+	w->ops = 0;
+	w->worstNs = 0;
+	unsigned seed = w->first + 1;
+	vector<bool> open(w->count, false);
+	while (!sStop) {
+		unsigned i = rand_r(&seed) % w->count;
+		uint64_t t = nanoseconds();
+		if (open[i]) {
+			sList->remove(&sChannel[w->first + i]);
+		} else {
+			sList->push_back(&sChannel[w->first + i]);
+		}
+		t = nanoseconds() - t;
+		w->worstNs = max(w->worstNs, t);
+		open[i] = !open[i];
+		w->ops++;
+	}
+	for (unsigned i = 0; i < w->count; i++) {
+		if (open[i]) {
+			sList->remove(&sChannel[w->first + i]);
+		}
+	}
+	return NULL;
+}
+
+static void testStress()
+{
+	for (unsigned i = 0; i < sChannels; i++) {
+		sChannel[i].mMagic = sMagic;
+		sChannel[i].mIndex = i;
+	}
+	sList = new ChannelList;
+	sStop = false;
+	const unsigned numReaders = 2, numWriters = 2;
+	Thread readers[numReaders], writers[numWriters];
+	ReaderResult rr[numReaders];
+	WriterResult wr[numWriters];
+	for (unsigned t = 0; t < numReaders; t++) {
+		readers[t].start(reader, &rr[t]);
+	}
+	for (unsigned t = 0; t < numWriters; t++) {
+		wr[t].first = t * sChannels / numWriters;
+		wr[t].count = sChannels / numWriters;
+		writers[t].start(writer, &wr[t]);
+	}
+	sleep(2);
+	sStop = true;
+	unsigned ops = 0, slots = 0, longHolds = 0;
+	uint64_t worst = 0;
+	bool ok = true;
+	for (unsigned t = 0; t < numWriters; t++) {
+		writers[t].join();
+		ops += wr[t].ops;
+		worst = max(worst, wr[t].worstNs);
+	}
+	for (unsigned t = 0; t < numReaders; t++) {
+		readers[t].join();
+		ok &= rr[t].ok;
+		slots += rr[t].slots;
+		longHolds += rr[t].longHolds;
+	}
+	printf("%u opens and closes, %u slots walked (%u held 200us), writer worst %.0f us\n", ops, slots, longHolds,
+		worst * 1e-3);
+	printf("%llu snapshots deleted, %zu still retired\n", (unsigned long long)sList->reclaimed(), sList->retired());
+	check("readers saw whole, unchanging sets", ok && slots > 0 && longHolds > 0);
+	check("every channel closed", sList->size() == 0);
+
+	// With the readers gone the next change frees everything.
+	sList->push_back(&sChannel[0]);
+	sList->remove(&sChannel[0]);
+	check("retired snapshots all deleted", sList->retired() == 0 && sList->reclaimed() >= ops + 2);
+	delete sList;
+}
+
+// The active DCH list as it was: a locked std::list, with flags the radio threads set while walking it, that
+// close() waited on.
+struct OldList : public std::list<Channel *> {
+	Mutex mLock;
+	bool inTxUse, inRxUse;
+	OldList() : inTxUse(false), inRxUse(false) {}
+};
+
+static OldList *sOld;
+
+static void *oldReader(void *arg)
+{
+	bool *flag = (bool *)arg;
+	unsigned sum = 0;
+	while (!sStop) {
+		OldList::const_iterator it, end;
+		{
+			ScopedLock lock(sOld->mLock);
+			it = sOld->begin();
+			end = sOld->end();
+			*flag = true;
+		}
+		for (; it != end; ++it) {
+			sum += (*it)->mIndex;
+		}
+		usleep(300); // Spreading and pilots for the DCHs.
+		{
+			ScopedLock lock(sOld->mLock);
+			*flag = false;
+		}
+		usleep(300); // The rest of the slot.
+	}
+	return (void *)(uintptr_t)sum;
+}
+
+static void *newReader(void *)
+{
+	unsigned sum = 0;
+	while (!sStop) {
+		{
+			ChannelList::Snapshot s(*sList);
+			for (ChannelList::const_iterator it = s.begin(); it != s.end(); ++it) {
+				sum += (*it)->mIndex;
+			}
+			usleep(300);
+		}
+		usleep(300);
+	}
+	return (void *)(uintptr_t)sum;
+}
+
+static double quantile(vector<uint64_t> v, double q)
+{
+	sort(v.begin(), v.end());
+	return v.empty() ? 0 : v[(size_t)(q * (v.size() - 1))] * 1e-3;
+}
+
+static void benchmark()
+{
+	const unsigned closes = 200;
+	vector<uint64_t> oldNs, newNs;
+
+	// Before.
+	sOld = new OldList;
+	sStop = false;
+	Thread rx, tx;
+	rx.start(oldReader, &sOld->inRxUse);
+	tx.start(oldReader, &sOld->inTxUse);
+	for (unsigned i = 0; i < closes; i++) {
+		Channel *c = &sChannel[i % sChannels];
+		{
+			ScopedLock lock(sOld->mLock);
+			sOld->push_back(c);
+		}
+		usleep(100);
+		uint64_t t = nanoseconds();
+		while (sOld->inTxUse || sOld->inRxUse)
+			usleep(1000);
+		{
+			ScopedLock lock(sOld->mLock);
+			sOld->remove(c);
+		}
+		oldNs.push_back(nanoseconds() - t);
+	}
+	sStop = true;
+	rx.join();
+	tx.join();
+	delete sOld;
+
+	// After.
+	sList = new ChannelList;
+	sStop = false;
+	Thread rx2, tx2;
+	rx2.start(newReader, NULL);
+	tx2.start(newReader, NULL);
+	for (unsigned i = 0; i < closes; i++) {
+		Channel *c = &sChannel[i % sChannels];
+		sList->push_back(c);
+		usleep(100);
+		uint64_t t = nanoseconds();
+		sList->remove(c);
+		newNs.push_back(nanoseconds() - t);
+	}
+	sStop = true;
+	rx2.join();
+	tx2.join();
+
+	printf("close with the radio threads running, p50/p99/max: before %.0f/%.0f/%.0f us, after %.1f/%.1f/%.1f us\n",
+		quantile(oldNs, 0.5), quantile(oldNs, 0.99), quantile(oldNs, 1.0), quantile(newNs, 0.5),
+		quantile(newNs, 0.99), quantile(newNs, 1.0));
+	check("close does not wait for the radio threads", quantile(newNs, 0.99) * 10 < quantile(oldNs, 0.99));
+
+	// What a radio thread pays per slot to look at the set, with 16 DCHs open.
+	for (unsigned i = 0; i < 16; i++) {
+		sList->push_back(&sChannel[i]);
+	}
+	OldList old;
+	for (unsigned i = 0; i < 16; i++) {
+		old.push_back(&sChannel[i]);
+	}
+	const unsigned reps = 1000000;
+	unsigned sum = 0;
+	uint64_t start = nanoseconds();
+	for (unsigned r = 0; r < reps; r++) {
+		OldList::const_iterator it, end;
+		{
+			ScopedLock lock(old.mLock);
+			it = old.begin();
+			end = old.end();
+			old.inRxUse = true;
+		}
+		for (; it != end; ++it) {
+			sum += (*it)->mIndex;
+		}
+		ScopedLock lock(old.mLock);
+		old.inRxUse = false;
+	}
+	double oldSlot = (double)(nanoseconds() - start) / reps;
+	start = nanoseconds();
+	for (unsigned r = 0; r < reps; r++) {
+		ChannelList::Snapshot s(*sList);
+		for (ChannelList::const_iterator it = s.begin(); it != s.end(); ++it) {
+			sum += (*it)->mIndex;
+		}
+	}
+	double newSlot = (double)(nanoseconds() - start) / reps;
+	printf("per slot, 16 DCHs: locked list %.0f ns, snapshot %.0f ns (%u)\n", oldSlot, newSlot, sum % 2);
+	delete sList;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+
+	testStress();
+	benchmark();
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
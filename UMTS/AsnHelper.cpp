@@ -12,6 +12,9 @@
  * See the LEGAL file in the main directory for details.
  */
 
+#include <arpa/inet.h>
+#include <errno.h>
+
 #include <CommonLibs/Configuration.h>
 
 #include <SGSNGGSN/SgsnBase.h> // For the layer 3 logging facility.
@@ -34,9 +37,15 @@ namespace UMTS {
 // Make the ByteVector large enough to hold the expected encoded message,
 // and the ByteVector size will be shrink wrapped around the result before return.
 // If the descr is specified, an error message is printed on failure before return.
+static ConfigHandle<int> sAsnDebug("UMTS.Debug.ASN");
+static ConfigHandle<int> sDebugMessages("UMTS.Debug.Messages");
+static ConfigHandle<bool> sAsnCapture("UMTS.Debug.ASN.Capture");
+
+AsnCaptureRing gAsnCapture;
+
 bool uperEncodeToBV(ASN::asn_TYPE_descriptor_t *td, void *sptr, ByteVector &result, const std::string descr)
 {
-	rn_asn_debug = gConfig.getNum("UMTS.Debug.ASN");
+	rn_asn_debug = sAsnDebug.get();
 	ASN::asn_enc_rval_t rval = uper_encode_to_buffer(td, sptr, result.begin(), result.allocSize());
 
 	if (rval.encoded < 0) {
@@ -46,12 +55,18 @@ bool uperEncodeToBV(ASN::asn_TYPE_descriptor_t *td, void *sptr, ByteVector &resu
 	// (pat) rval.encoded is number of bits, despite documentation
 	// at asn_enc_rval_t that claims it is in bytes.
 	result.setSizeBits(rval.encoded);
+	if (sAsnCapture.get()) {
+		gAsnCapture.capture(AsnCaptureRing::Downlink, td, result.begin(), rval.encoded);
+	}
 	return true;
 }
 
 // Decode an Asn message and return whatever kind of message pops out.
 void *uperDecodeFromByteV(ASN::asn_TYPE_descriptor_t *asnType, ByteVector &bv)
 {
+	if (sAsnCapture.get()) {
+		gAsnCapture.capture(AsnCaptureRing::Uplink, asnType, bv.begin(), bv.sizeBits());
+	}
 	void *result = NULL;
 	ASN::asn_dec_rval_s rval = uper_decode_complete(NULL, // optional stack size
 		asnType, &result, bv.begin(), bv.size()       // per buffer size is in bytes.
@@ -231,12 +246,39 @@ std::string asn2string(ASN::asn_TYPE_descriptor_t *asnp, const void *struct_ptr)
 	return ss.str();
 }
 
+// Same as IS_LOG_LEVEL(INFO) for this file, but only asks the logger again when the configuration changes.
+static bool asnLogInfo()
+{
+	static unsigned sGeneration = 0;
+	static int sLevel = 0;
+	unsigned generation = ConfigurationSnapshotRef(gConfig)->generation();
+	if (__atomic_load_n(&sGeneration, __ATOMIC_ACQUIRE) != generation) {
+		__atomic_store_n(&sLevel, gGetLoggingLevel(__FILE__), __ATOMIC_RELAXED);
+		__atomic_store_n(&sGeneration, generation, __ATOMIC_RELEASE);
+	}
+	return __atomic_load_n(&sLevel, __ATOMIC_RELAXED) >= LOG_INFO;
+}
+
+bool asnLogWanted()
+{
+	return sDebugMessages.get() || asnLogInfo();
+}
+
+void asnCaptureEncoded(ASN::asn_TYPE_descriptor_t *td, const ByteVector &encoded)
+{
+	if (sAsnCapture.get()) {
+		gAsnCapture.capture(AsnCaptureRing::Downlink, td, encoded.begin(), encoded.sizeBits());
+	}
+}
+
 void asnLogMsg(unsigned rbid, ASN::asn_TYPE_descriptor_t *asnp, const void *struct_ptr, const char *comment,
 	UEInfo *uep,    // Or NULL if none.
 	uint32_t urnti) // If uep is NULL, put this in the log instead.
 {
-	int debug = gConfig.getNum("UMTS.Debug.Messages");
-	if (debug || IS_LOG_LEVEL(INFO)) {
+	// Both checks are cached, so this is nearly free when nobody is listening;
+	// the asn printer only runs if there is somewhere to send its output.
+	int debug = sDebugMessages.get();
+	if (debug || asnLogInfo()) {
 		// This C++ IO paradigm is so crappy.
 		std::string readable = asn2string(asnp, struct_ptr);
 		std::string id = uep ? uep->ueid() : format(" urnti=0x%x", urnti);
@@ -248,6 +290,91 @@ void asnLogMsg(unsigned rbid, ASN::asn_TYPE_descriptor_t *asnp, const void *stru
 	}
 }
 
+void AsnCaptureRing::capture(
+	Direction dir, const ASN::asn_TYPE_descriptor_t *td, const uint8_t *bytes, unsigned numBits)
+{
+	uint32_t n = __atomic_fetch_add(&mNext, 1, __ATOMIC_RELAXED);
+	Record *rec = &mRecords[n % sNumRecords];
+	unsigned maxBits = 8 * sMaxBytes;
+	if (numBits > maxBits) {
+		numBits = maxBits;
+	}
+	// The sequence number is odd while we write, and 2*(n+1) when the record for n is complete.
+	__atomic_store_n(&rec->mSeq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->mDir = dir;
+	rec->mNumBits = numBits;
+	gettimeofday(&rec->mTime, NULL);
+	rec->mType = td;
+	memcpy(rec->mBytes, bytes, (numBits + 7) / 8);
+	__atomic_store_n(&rec->mSeq, 2 * n + 2, __ATOMIC_RELEASE);
+}
+
+unsigned AsnCaptureRing::size() const
+{
+	uint32_t next = __atomic_load_n(&mNext, __ATOMIC_ACQUIRE);
+	return next < sNumRecords ? next : sNumRecords;
+}
+
+unsigned AsnCaptureRing::dump(FILE *fp) const
+{
+	fwrite("OBTSASN1", 1, 8, fp);
+	uint32_t next = __atomic_load_n(&mNext, __ATOMIC_ACQUIRE);
+	uint32_t first = next > sNumRecords ? next - sNumRecords : 0;
+	unsigned count = 0;
+	Record copy;
+	for (uint32_t n = first; n != next; n++) {
+		const Record *rec = &mRecords[n % sNumRecords];
+		// Copy the record out, then make sure no writer touched it meanwhile.
+		uint32_t seq = __atomic_load_n(&rec->mSeq, __ATOMIC_ACQUIRE);
+		if (seq != 2 * n + 2) {
+			continue; // Still being written, or already overwritten by a newer message.
+		}
+		memcpy(&copy, rec, sizeof(copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&rec->mSeq, __ATOMIC_RELAXED) != seq) {
+			continue;
+		}
+		const char *name = copy.mType ? copy.mType->name : "";
+		uint8_t namelen = strlen(name) > 255 ? 255 : strlen(name);
+		uint32_t hdr32[2] = {htonl(copy.mTime.tv_sec), htonl(copy.mTime.tv_usec)};
+		uint8_t hdr8[2] = {copy.mDir, namelen};
+		uint16_t numbits = htons(copy.mNumBits);
+		fwrite(hdr32, sizeof(hdr32), 1, fp);
+		fwrite(hdr8, sizeof(hdr8), 1, fp);
+		fwrite(&numbits, sizeof(numbits), 1, fp);
+		fwrite(name, 1, namelen, fp);
+		fwrite(copy.mBytes, 1, (copy.mNumBits + 7) / 8, fp);
+		count++;
+	}
+	return count;
+}
+
+// This can be called by the OpenBTS-UMTS command line interface via the CLI module.
+int asnCaptureCLI(int argc, char **argv, std::ostream &os)
+{
+	if (argc == 1) {
+		os << "UMTS.Debug.ASN.Capture=" << sAsnCapture.get() << " records=" << gAsnCapture.size() << "\n";
+		return 0;
+	}
+	if (0 == strcmp(argv[1], "clear")) {
+		gAsnCapture.clear();
+		return 0;
+	}
+	if (0 == strcmp(argv[1], "dump") && argc == 3) {
+		FILE *fp = fopen(argv[2], "w");
+		if (fp == NULL) {
+			os << "could not open " << argv[2] << ": " << strerror(errno) << "\n";
+			return 5; // FAILURE
+		}
+		unsigned count = gAsnCapture.dump(fp);
+		fclose(fp);
+		os << "wrote " << count << " messages to " << argv[2] << "\n";
+		return 0;
+	}
+	return 1; // BAD_NUM_ARGS
+}
+
 // void AsnBitString::finish(ASN::BIT_STRING_t *ptr)
 //{
 //	if (ptr->bits_unused) setSizeBits(ptr->size*8 - ptr->bits_unused);
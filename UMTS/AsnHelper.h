@@ -16,6 +16,8 @@
 #define ASNHELPER_H
 
 #include <ctype.h>
+#include <stdio.h>
+#include <sys/time.h>
 
 #include <CommonLibs/ByteVector.h>
 
@@ -43,6 +45,51 @@ std::string asn2string(ASN::asn_TYPE_descriptor_t *asnp, const void *struct_ptr)
 class UEInfo;
 void asnLogMsg(unsigned rbid, ASN::asn_TYPE_descriptor_t *asnp, const void *struct_ptr, const char *comment = "",
 	UEInfo *uep = NULL, uint32_t urnti = 0);
+// True if asnLogMsg would print anything.  Messages encoded from an AsnMessageTemplate have no asn
+// structure to print, so the sender checks this and builds the structure only when someone is watching.
+bool asnLogWanted();
+// Record a message that was encoded without going through uperEncodeToBV in the capture ring.
+void asnCaptureEncoded(ASN::asn_TYPE_descriptor_t *td, const ByteVector &encoded);
+
+// The text printout done by asnLogMsg is far too slow to leave on in a busy cell.
+// When UMTS.Debug.ASN.Capture is set, uperEncodeToBV and uperDecodeFromByteV copy the raw UPER bits
+// into this ring instead, which costs a memcpy, and the CLI "asncapture" command dumps the ring to a file.
+// The file starts with the 8 byte magic "OBTSASN1", followed by records, all integers in network order:
+//		uint32 seconds, uint32 microseconds, uint8 direction (0=downlink, 1=uplink),
+//		uint8 namelen, uint16 numbits, namelen bytes of asn type name, (numbits+7)/8 bytes of UPER data.
+// The type name is the asn1c PDU name, eg "DL-DCCH-Message", so the records can be fed to the asn1c
+// converter ("-p <name> -iper") to decode them offline.
+class AsnCaptureRing {
+public:
+	enum Direction { Downlink = 0, Uplink = 1 };
+	static const unsigned sNumRecords = 1024;
+	static const unsigned sMaxBytes = 512; // Longer messages are truncated.
+
+private:
+	struct Record {
+		uint32_t mSeq; // Odd while the record is being written.
+		uint8_t mDir;
+		uint16_t mNumBits;
+		struct timeval mTime;
+		const ASN::asn_TYPE_descriptor_t *mType;
+		uint8_t mBytes[sMaxBytes];
+	};
+	Record mRecords[sNumRecords];
+	uint32_t mNext; // Number of records ever written.
+
+public:
+	AsnCaptureRing() : mNext(0) { memset(mRecords, 0, sizeof(mRecords)); }
+
+	// Lock-free; may be called from any thread.
+	void capture(Direction dir, const ASN::asn_TYPE_descriptor_t *td, const uint8_t *bytes, unsigned numBits);
+
+	// Write the records, oldest first, in the format described above.  Return the number written.
+	unsigned dump(FILE *fp) const;
+
+	void clear() { __atomic_store_n(&mNext, 0, __ATOMIC_RELEASE); }
+	unsigned size() const;
+};
+extern AsnCaptureRing gAsnCapture;
 
 // Some trivial wrappers for ENUMERATED_t and INTEGER_t:
 ASN::ENUMERATED_t toAsnEnumerated(unsigned value);
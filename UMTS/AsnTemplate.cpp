@@ -0,0 +1,223 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdlib.h>
+
+#include <CommonLibs/Logger.h>
+
+#include "AsnTemplate.h"
+
+namespace ASN {
+#include "per_encoder.h"
+};
+
+namespace UMTS {
+
+// Big enough for anything we send on CCCH or DCCH.
+static const unsigned sMaxEncodedBytes = 1000;
+
+void appendBits(ByteVector &dst, const ByteVector &src, size_t srcPos, size_t numBits)
+{
+	while (numBits >= 32) {
+		dst.appendField(src.getField(srcPos, 32), 32);
+		srcPos += 32;
+		numBits -= 32;
+	}
+	if (numBits) {
+		dst.appendField(src.getField(srcPos, numBits), numBits);
+	}
+}
+
+// Return the number of bits encoded, or -1 on failure.
+static int encodeBits(ASN::asn_TYPE_descriptor_t *td, void *sptr, ByteVector &result)
+{
+	ASN::asn_enc_rval_t rval = ASN::uper_encode_to_buffer(td, sptr, result.begin(), result.allocSize());
+	if (rval.encoded < 0) {
+		return -1;
+	}
+	result.setSizeBits(rval.encoded);
+	return rval.encoded;
+}
+
+bool AsnMessageTemplate::fullEncode(const uint32_t *fieldValues, void *splice, ByteVector &result) const
+{
+	void *msg = calloc(1, mSpec.mSize);
+	mSpec.mBuild(msg, fieldValues, splice);
+	int bits = encodeBits(mSpec.mType, msg, result);
+	if (mSpec.mUnsplice) {
+		mSpec.mUnsplice(msg);
+	}
+	if (mSpec.mFree) {
+		mSpec.mType->free_struct(mSpec.mType, msg, 0);
+	}
+	if (bits < 0) {
+		LOG(ALERT) << "ASN encoder failed encoding template message " << mSpec.mType->name;
+		return false;
+	}
+	return true;
+}
+
+bool AsnMessageTemplate::patchedEncode(const uint32_t *fieldValues, void *splice, ByteVector &result) const
+{
+	result.setAppendP(0);
+	appendBits(result, mPrefix, 0, mPrefix.sizeBits());
+	size_t suffixStart = 0;
+	if (mSpec.mSpliceType) {
+		ByteVector spliced(sMaxEncodedBytes);
+		int bits = encodeBits(mSpec.mSpliceType, splice, spliced);
+		if (bits < 0) {
+			LOG(ALERT) << "ASN encoder failed encoding " << mSpec.mSpliceType->name;
+			return false;
+		}
+		appendBits(result, spliced, 0, bits);
+		suffixStart = result.sizeBits();
+		appendBits(result, mSuffix, 0, mSuffix.sizeBits());
+	}
+	for (unsigned i = 0; i < mSpec.mNumFields; i++) {
+		size_t pos = mFields[i].mOffset + (mFields[i].mInSuffix ? suffixStart : 0);
+		result.setField(pos, fieldValues[i], mSpec.mFieldWidth[i]);
+	}
+	return true;
+}
+
+// Return the first and last bit positions where a and b differ, which must be the same size.
+// Return false if they are identical.
+static bool diffRange(const ByteVector &a, const ByteVector &b, size_t &first, size_t &last, unsigned &count)
+{
+	count = 0;
+	for (size_t i = 0; i < a.sizeBits(); i++) {
+		if (a.getBit(i) != b.getBit(i)) {
+			if (count++ == 0) {
+				first = i;
+			}
+			last = i;
+		}
+	}
+	return count != 0;
+}
+
+// True if numBits of a starting at aPos equal those of b starting at bPos.
+static bool sameBits(const ByteVector &a, size_t aPos, const ByteVector &b, size_t bPos, size_t numBits)
+{
+	for (size_t i = 0; i < numBits; i++) {
+		if (a.getBit(aPos + i) != b.getBit(bPos + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool AsnMessageTemplate::learn(void *spliceA, void *spliceB)
+{
+	assert(mSpec.mNumFields <= sMaxFields);
+	uint32_t values[sMaxFields];
+	memset(values, 0, sizeof(values));
+
+	// The base encoding, with all fields zero.
+	ByteVector base(sMaxEncodedBytes);
+	if (!fullEncode(values, spliceA, base)) {
+		mValid = false;
+		return false;
+	}
+	// Nothing the message is built from has changed since it was learned.
+	if (mValid && base.sizeBits() == mBase.sizeBits() && sameBits(base, 0, mBase, 0, base.sizeBits())) {
+		return true;
+	}
+	mValid = false;
+
+	// Find where the splice lands.  The encoding is prefix + splice + suffix, where the
+	// prefix and suffix do not depend on the splice, so try each possible prefix length
+	// against two examples of different lengths.
+	size_t prefixBits = base.sizeBits(), spliceABits = 0;
+	if (mSpec.mSpliceType) {
+		ByteVector other(sMaxEncodedBytes), encA(sMaxEncodedBytes), encB(sMaxEncodedBytes);
+		if (!fullEncode(values, spliceB, other) || encodeBits(mSpec.mSpliceType, spliceA, encA) < 0 ||
+			encodeBits(mSpec.mSpliceType, spliceB, encB) < 0) {
+			return false;
+		}
+		spliceABits = encA.sizeBits();
+		size_t rest = base.sizeBits() - spliceABits;
+		if (encA.sizeBits() == encB.sizeBits() || other.sizeBits() - encB.sizeBits() != rest) {
+			LOG(ERR) << "template " << mSpec.mType->name << " splice examples unusable";
+			return false;
+		}
+		bool found = false;
+		for (size_t pre = 0; pre <= rest && !found; pre++) {
+			found = sameBits(base, 0, other, 0, pre) && sameBits(base, pre, encA, 0, encA.sizeBits()) &&
+				sameBits(other, pre, encB, 0, encB.sizeBits()) &&
+				sameBits(base, pre + encA.sizeBits(), other, pre + encB.sizeBits(), rest - pre);
+			if (found) {
+				prefixBits = pre;
+			}
+		}
+		if (!found) {
+			LOG(ERR) << "template " << mSpec.mType->name << " could not locate " << mSpec.mSpliceType->name;
+			return false;
+		}
+	}
+
+	// Find each field by flipping all its bits.
+	for (unsigned i = 0; i < mSpec.mNumFields; i++) {
+		unsigned width = mSpec.mFieldWidth[i];
+		values[i] = width >= 32 ? 0xffffffff : (1u << width) - 1;
+		ByteVector probe(sMaxEncodedBytes);
+		bool ok = fullEncode(values, spliceA, probe);
+		values[i] = 0;
+		size_t first = 0, last = 0;
+		unsigned count = 0;
+		if (!ok || probe.sizeBits() != base.sizeBits() || !diffRange(base, probe, first, last, count) ||
+			count != width || last - first + 1 != width) {
+			LOG(ERR) << "template " << mSpec.mType->name << " field " << i << " is not a plain bit field";
+			return false;
+		}
+		if (last < prefixBits) {
+			mFields[i].mInSuffix = false;
+			mFields[i].mOffset = first;
+		} else if (first >= prefixBits + spliceABits) {
+			mFields[i].mInSuffix = true;
+			mFields[i].mOffset = first - prefixBits - spliceABits;
+		} else {
+			LOG(ERR) << "template " << mSpec.mType->name << " field " << i << " overlaps the splice";
+			return false;
+		}
+	}
+
+	mPrefix = ByteVector(sMaxEncodedBytes);
+	mPrefix.setAppendP(0);
+	appendBits(mPrefix, base, 0, prefixBits);
+	mSuffix = ByteVector(sMaxEncodedBytes);
+	mSuffix.setAppendP(0);
+	appendBits(mSuffix, base, prefixBits + spliceABits, base.sizeBits() - prefixBits - spliceABits);
+
+	// Now make sure we get exactly what the encoder would have produced.
+	unsigned seed = 1;
+	for (unsigned trial = 0; trial < 16; trial++) {
+		for (unsigned i = 0; i < mSpec.mNumFields; i++) {
+			uint32_t r = ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+			values[i] = mSpec.mFieldWidth[i] >= 32 ? r : r & ((1u << mSpec.mFieldWidth[i]) - 1);
+		}
+		void *splice = (trial & 1) ? spliceB : spliceA;
+		ByteVector full(sMaxEncodedBytes), patched(sMaxEncodedBytes);
+		if (!fullEncode(values, splice, full) || !patchedEncode(values, splice, patched) ||
+			full.sizeBits() != patched.sizeBits() || !sameBits(full, 0, patched, 0, full.sizeBits())) {
+			LOG(ERR) << "template " << mSpec.mType->name << " failed verification";
+			return false;
+		}
+	}
+	mBase = base;
+	mValid = true;
+	return true;
+}
+
+}; // namespace UMTS
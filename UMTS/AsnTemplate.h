@@ -0,0 +1,111 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef ASNTEMPLATE_H
+#define ASNTEMPLATE_H
+
+#include <stdint.h>
+
+#include <CommonLibs/ByteVector.h>
+
+#include "asn_system.h" // Dont let other includes land in namespace ASN.
+namespace ASN {
+#include "constr_TYPE.h"
+};
+
+namespace UMTS {
+
+// Most of the downlink RRC messages we send during connection setup are identical for every UE
+// except for a handful of fixed-width fields: the U-RNTI, C-RNTI, transaction id and so on.
+// Building the asn structures and running uper_encode for each one is very expensive, so an
+// AsnMessageTemplate encodes the message once, figures out where in the encoding those fields landed,
+// and after that just patches the bits.
+//
+// The field positions are found by probing: the message is encoded with each field all zeros and then
+// all ones, and the bits that changed are the field.  This works for any field that UPER encodes as a
+// plain fixed-width bit field, which is true for constrained INTEGERs whose range is exactly 0..2^n-1,
+// fixed size BIT STRINGs, and non-extensible ENUMERATEDs with 2^n values.
+//
+// A message may also contain one variable length "splice" item, for example the InitialUE-Identity
+// echoed back in RRCConnectionSetup.  It is encoded separately with its own descriptor and inserted
+// between the fixed prefix and suffix of the template.
+//
+// Before a template is used it is checked bit-exact against a full encode for a set of random field
+// values; if that fails the template falls back to doing the full encode every time.
+struct AsnTemplateSpec {
+	ASN::asn_TYPE_descriptor_t *mType;	 // The message, eg DL-CCCH-Message.
+	size_t mSize;				 // sizeof the message struct.
+	bool mFree;				 // Free the message after encoding.
+	ASN::asn_TYPE_descriptor_t *mSpliceType; // The variable length item, or NULL if none.
+	unsigned mNumFields;
+	unsigned mFieldWidth[6]; // In bits; a field value must fit in its width.
+
+	// Fill in the zeroed message using these field values and splice item, which may be copied
+	// into the message shallowly.
+	void (*mBuild)(void *msg, const uint32_t *fieldValues, void *splice);
+	// If the splice was copied shallowly, zero it out of the message so it is not freed with the message.
+	void (*mUnsplice)(void *msg);
+};
+
+class AsnMessageTemplate {
+public:
+	static const unsigned sMaxFields = 6;
+
+private:
+	const AsnTemplateSpec &mSpec;
+	bool mValid;
+	ByteVector mPrefix; // Bits before the splice, or the whole message if no splice.
+	ByteVector mSuffix; // Bits after the splice.
+	ByteVector mBase;   // The whole message with every field zero, as last learned.
+	struct Field {
+		bool mInSuffix;
+		unsigned mOffset; // Bit offset within mPrefix or mSuffix.
+	} mFields[sMaxFields];
+
+	bool fullEncode(const uint32_t *fieldValues, void *splice, ByteVector &result) const;
+	bool patchedEncode(const uint32_t *fieldValues, void *splice, ByteVector &result) const;
+
+public:
+	AsnMessageTemplate(const AsnTemplateSpec &wSpec) : mSpec(wSpec), mValid(false) {}
+
+	// Learn the template.  If the spec has a splice type, spliceA and spliceB must be two examples
+	// whose encodings have different lengths.  Return true if the template passed verification.
+	// If the template is valid and the message encodes the same as when it was learned, this costs
+	// one full encode and keeps the template.
+	bool learn(void *spliceA = NULL, void *spliceB = NULL);
+	bool valid() const { return mValid; }
+	const AsnTemplateSpec &spec() const { return mSpec; }
+
+	// Encode the message into result, which must be large enough, and shrink wrap result around it.
+	// Same semantics as uperEncodeToBV.
+	bool encode(const uint32_t *fieldValues, void *splice, ByteVector &result) const
+	{
+		return mValid ? patchedEncode(fieldValues, splice, result) : fullEncode(fieldValues, splice, result);
+	}
+
+	// Encode the slow way; public so the template can be checked against it.
+	bool encodeFull(const uint32_t *fieldValues, void *splice, ByteVector &result) const
+	{
+		return fullEncode(fieldValues, splice, result);
+	}
+
+	size_t sizeBits() const { return mPrefix.sizeBits() + mSuffix.sizeBits(); }
+};
+
+// Append numBits bits of src starting at bit srcPos to the end of dst.
+extern void appendBits(ByteVector &dst, const ByteVector &src, size_t srcPos, size_t numBits);
+
+}; // namespace UMTS
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the CCCH message templates of URRCTemplates.cpp bit-exact against a full encode, and time both.
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Utils.h>
+
+#include "URRCTemplates.h"
+
+namespace ASN {
+#include "DL-CCCH-Message.h"
+#include "asn_SEQUENCE_OF.h"
+};
+
+using namespace std;
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+// Stand-ins for what the builders take from the rest of the BTS, which does not link here.
+// The SRB list and the fake UL TrCh are only as close to the real ones as the encoding needs.
+namespace UMTS {
+
+RrcMasterChConfig *gRrcDcchConfig = NULL;
+
+void setAsnBIT_STRING(ASN::BIT_STRING_t *result, uint8_t *buf, unsigned numBits)
+{
+	result->buf = buf;
+	result->size = (numBits + 7) / 8;
+	result->bits_unused = (numBits % 8) ? (8 - (numBits % 8)) : 0;
+}
+
+ASN::ENUMERATED_t toAsnEnumerated(unsigned value)
+{
+	ASN::ENUMERATED_t result;
+	memset(&result, 0, sizeof(result));
+	ASN::asn_long2INTEGER(&result, value);
+	return result;
+}
+
+// SRB1-3 in UM on RACH/FACH.
+void toAsnSRB_InformationSetupList(RrcMasterChConfig *, void *srblist)
+{
+	for (unsigned rbid = 1; rbid <= 3; rbid++) {
+		ASN::SRB_InformationSetup *srbie = (ASN::SRB_InformationSetup *)calloc(1, sizeof(*srbie));
+		srbie->rb_Identity = (long *)calloc(1, sizeof(long));
+		*srbie->rb_Identity = rbid;
+		srbie->rlc_InfoChoice.present = ASN::RLC_InfoChoice_PR_rlc_Info;
+		ASN::RLC_Info *rlc = &srbie->rlc_InfoChoice.choice.rlc_Info;
+		rlc->ul_RLC_Mode = (ASN::UL_RLC_Mode *)calloc(1, sizeof(ASN::UL_RLC_Mode));
+		rlc->ul_RLC_Mode->present = ASN::UL_RLC_Mode_PR_ul_UM_RLC_Mode;
+		rlc->dl_RLC_Mode = (ASN::DL_RLC_Mode *)calloc(1, sizeof(ASN::DL_RLC_Mode));
+		rlc->dl_RLC_Mode->present = ASN::DL_RLC_Mode_PR_dl_UM_RLC_Mode;
+
+		ASN::RB_MappingOption *opt = (ASN::RB_MappingOption *)calloc(1, sizeof(*opt));
+		opt->ul_LogicalChannelMappings =
+			(ASN::UL_LogicalChannelMappings *)calloc(1, sizeof(ASN::UL_LogicalChannelMappings));
+		opt->ul_LogicalChannelMappings->present = ASN::UL_LogicalChannelMappings_PR_oneLogicalChannel;
+		ASN::UL_LogicalChannelMapping *ul = &opt->ul_LogicalChannelMappings->choice.oneLogicalChannel;
+		ul->ul_TransportChannelType.present = ASN::UL_TransportChannelType_PR_rach;
+		ul->logicalChannelIdentity = (long *)calloc(1, sizeof(long));
+		*ul->logicalChannelIdentity = rbid;
+		ul->rlc_SizeList.present = ASN::UL_LogicalChannelMapping__rlc_SizeList_PR_configured;
+		ul->mac_LogicalChannelPriority = rbid;
+		opt->dl_LogicalChannelMappingList =
+			(ASN::DL_LogicalChannelMappingList *)calloc(1, sizeof(ASN::DL_LogicalChannelMappingList));
+		ASN::DL_LogicalChannelMapping *dl = (ASN::DL_LogicalChannelMapping *)calloc(1, sizeof(*dl));
+		dl->dl_TransportChannelType.present = ASN::DL_TransportChannelType_PR_fach;
+		dl->logicalChannelIdentity = (long *)calloc(1, sizeof(long));
+		*dl->logicalChannelIdentity = rbid;
+		ASN::ASN_SEQUENCE_ADD(&opt->dl_LogicalChannelMappingList->list, dl);
+		ASN::ASN_SEQUENCE_ADD(&srbie->rb_MappingInfo.list, opt);
+
+		ASN::ASN_SEQUENCE_ADD(srblist, srbie);
+	}
+}
+
+// One dedicated TrCh 31 with a single TF, as in URRCMessages.cpp.
+void toAsnFakeUL_AddReconfTransChInfoList(ASN::UL_AddReconfTransChInfoList *ulchlist)
+{
+	ASN::UL_AddReconfTransChInformation *tc =
+		(ASN::UL_AddReconfTransChInformation *)calloc(1, sizeof(ASN::UL_AddReconfTransChInformation));
+	ASN::asn_long2INTEGER(&tc->ul_TransportChannelType, ASN::UL_TrCH_Type_dch);
+	tc->transportChannelIdentity = 31;
+	tc->transportFormatSet.present = ASN::TransportFormatSet_PR_dedicatedTransChTFS;
+	ASN::DedicatedTransChTFS *tfs = &tc->transportFormatSet.choice.dedicatedTransChTFS;
+	tfs->tti.present = ASN::DedicatedTransChTFS__tti_PR_tti10;
+	ASN::DedicatedDynamicTF_Info *tf = (ASN::DedicatedDynamicTF_Info *)calloc(1, sizeof(*tf));
+	tf->rlc_Size.present = ASN::DedicatedDynamicTF_Info__rlc_Size_PR_bitMode;
+	tf->rlc_Size.choice.bitMode.present = ASN::BitModeRLC_SizeInfo_PR_sizeType1;
+	tf->rlc_Size.choice.bitMode.choice.sizeType1 = 4;
+	ASN::NumberOfTransportBlocks *ntb = (ASN::NumberOfTransportBlocks *)calloc(1, sizeof(*ntb));
+	ntb->present = ASN::NumberOfTransportBlocks_PR_zero;
+	ASN::ASN_SEQUENCE_ADD(&tf->numberOfTbSizeList.list, ntb);
+	tf->logicalChannelList.present = ASN::LogicalChannelList_PR_allSizes;
+	ASN::ASN_SEQUENCE_ADD(&tfs->tti.choice.tti10.list, tf);
+	ASN::SemistaticTF_Information *ss = &tfs->semistaticTF_Information;
+	ss->channelCodingType.present = ASN::ChannelCodingType_PR_convolutional;
+	ASN::asn_long2INTEGER(&ss->channelCodingType.choice.convolutional, ASN::CodingRate_half);
+	ss->rateMatchingAttribute = 256;
+	ASN::asn_long2INTEGER(&ss->crc_Size, ASN::CRC_Size_crc16);
+	ASN::ASN_SEQUENCE_ADD(&ulchlist->list, tc);
+}
+
+}; // namespace UMTS
+
+static void setBits(ASN::BIT_STRING_t *bs, unsigned numBits, uint32_t value)
+{
+	bs->size = (numBits + 7) / 8;
+	bs->buf = (uint8_t *)calloc(1, bs->size);
+	bs->bits_unused = bs->size * 8 - numBits;
+	ByteVectorTemp(bs->buf, bs->size).setField(0, value, numBits);
+}
+
+static void addDigits(void *seq, const char *digits)
+{
+	for (; *digits; digits++) {
+		ASN::Digit_t *d = (ASN::Digit_t *)calloc(1, sizeof(ASN::Digit_t));
+		*d = *digits - '0';
+		ASN::ASN_SEQUENCE_ADD(seq, d);
+	}
+}
+
+static void makeImsi(ASN::InitialUE_Identity_t *id, const char *digits)
+{
+	memset(id, 0, sizeof(*id));
+	id->present = ASN::InitialUE_Identity_PR_imsi;
+	addDigits(&id->choice.imsi.list, digits);
+}
+
+// Compare patched and full encodes over many random values; return the number of mismatches.
+static unsigned check(const char *name, AsnMessageTemplate &tmpl, const AsnTemplateSpec &spec, void **splices,
+	unsigned numSplices)
+{
+	unsigned seed = 42, bad = 0;
+	for (unsigned n = 0; n < 2000; n++) {
+		uint32_t values[AsnMessageTemplate::sMaxFields];
+		for (unsigned i = 0; i < spec.mNumFields; i++) {
+			uint32_t r = ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+			values[i] = spec.mFieldWidth[i] >= 32 ? r : r & ((1u << spec.mFieldWidth[i]) - 1);
+		}
+		void *splice = splices ? splices[n % numSplices] : NULL;
+		ByteVector full(1000), patched(1000);
+		tmpl.encodeFull(values, splice, full);
+		tmpl.encode(values, splice, patched);
+		if (full.sizeBits() != patched.sizeBits() || full != patched) {
+			bad++;
+		}
+	}
+	cout << name << ": template " << (tmpl.valid() ? "valid" : "INVALID") << ", " << tmpl.sizeBits()
+	     << " fixed bits, " << bad << " mismatches in 2000" << endl;
+	return bad;
+}
+
+static void bench(const char *name, AsnMessageTemplate &tmpl, const AsnTemplateSpec &spec, void *splice)
+{
+	const unsigned count = 20000;
+	uint32_t values[AsnMessageTemplate::sMaxFields];
+	memset(values, 0, sizeof(values));
+	uint32_t mask = spec.mFieldWidth[0] >= 32 ? 0xffffffff : (1u << spec.mFieldWidth[0]) - 1;
+	ByteVector result(1000);
+	double start = timef();
+	for (unsigned n = 0; n < count; n++) {
+		values[0] = n & mask;
+		tmpl.encodeFull(values, splice, result);
+	}
+	double fullTime = timef() - start;
+	start = timef();
+	for (unsigned n = 0; n < count; n++) {
+		values[0] = n & mask;
+		tmpl.encode(values, splice, result);
+	}
+	double patchTime = timef() - start;
+	cout << format("%s: full encode %.0f msgs/s, template %.0f msgs/s", name, count / fullTime, count / patchTime)
+	     << endl;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("AsnTemplateTest", "NOTICE");
+	unsigned bad = 0;
+
+	AsnMessageTemplate cuc(gCellUpdateConfirmCcchSpec);
+	cuc.learn();
+	bad += check("CellUpdateConfirm-CCCH", cuc, gCellUpdateConfirmCcchSpec, NULL, 1);
+
+	AsnMessageTemplate rel(gRrcConnectionReleaseCcchSpec);
+	rel.learn();
+	bad += check("RRCConnectionRelease-CCCH", rel, gRrcConnectionReleaseCcchSpec, NULL, 1);
+
+	ASN::InitialUE_Identity_t imsi15, imsi6, tmsi;
+	makeImsi(&imsi15, "001010123456789");
+	makeImsi(&imsi6, "001010");
+	memset(&tmsi, 0, sizeof(tmsi));
+	tmsi.present = ASN::InitialUE_Identity_PR_tmsi_and_LAI;
+	setBits(&tmsi.choice.tmsi_and_LAI.tmsi, 32, 0x12345678);
+	addDigits(&tmsi.choice.tmsi_and_LAI.lai.plmn_Identity.mcc.list, "001");
+	addDigits(&tmsi.choice.tmsi_and_LAI.lai.plmn_Identity.mnc.list, "01");
+	setBits(&tmsi.choice.tmsi_and_LAI.lai.lac, 16, 0x1234);
+	AsnMessageTemplate setup(gRrcConnectionSetupSpec);
+	setup.learn(&imsi15, &imsi6);
+	void *splices[3] = {&imsi15, &imsi6, &tmsi};
+	bad += check("RRCConnectionSetup", setup, gRrcConnectionSetupSpec, splices, 3);
+
+	// Learning the same message again keeps the template.
+	unsigned fixed = setup.sizeBits();
+	bool kept = setup.learn(&imsi15, &imsi6) && setup.valid() && setup.sizeBits() == fixed;
+	cout << "RRCConnectionSetup relearned unchanged: " << (kept ? "kept" : "NOT KEPT") << endl;
+	bad += !kept;
+
+	bench("CellUpdateConfirm-CCCH", cuc, gCellUpdateConfirmCcchSpec, NULL);
+	bench("RRCConnectionRelease-CCCH", rel, gRrcConnectionReleaseCcchSpec, NULL);
+	bench("RRCConnectionSetup", setup, gRrcConnectionSetupSpec, &imsi15);
+
+	for (unsigned i = 0; i < 3; i++) {
+		ASN_STRUCT_FREE_CONTENTS_ONLY(ASN::asn_DEF_InitialUE_Identity, splices[i]);
+	}
+
+	cout << (bad ? "FAILED" : "PASSED") << endl;
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Replay clock indication traces through the estimator and compare where it puts the frame boundaries with
+// where setting the clock at each arrival put them.  The built in traces are a drifting radio with arrival
+// jitter, scheduler stalls, irregular indications and a transceiver restart injected; with the ground truth
+// known, the error is measured directly.  Traces recorded from a running BTS, the "chip=" and "arrival="
+// fields of the TRXManager's INFO log, one "chips arrivalNs" pair a line, can be given as arguments, and are
+// replayed for the drift and jitter the estimator finds.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+
+#include "UMTSClockSync.h"
+
+using namespace UMTS;
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static const int64_t sFrameNs = 10000000;
+
+struct Indication {
+	int64_t chips;
+	int64_t arrivalNs;
+	int64_t trueNs;	     ///< When the radio really received the chip, plus the fixed latency; 0 if unknown.
+	int64_t trueAheadNs; ///< The same for the chip sAheadChips on.
+};
+
+// Half a second on, where the next indication would otherwise have to correct the clock.
+static const int64_t sAheadChips = 50 * gFrameLen;
+
+struct Scenario {
+	const char *name;
+	double driftPPM;
+	double jitterUs;    ///< Mean of the exponential scheduling delay.
+	double stallRate;   ///< Fraction of indications held up by a stall...
+	double stallMs;	    ///< ...of up to this long.
+	bool irregular;	    ///< Sent at random slots, every 50 to 150 frames, as the RAD1 transceiver does.
+	bool restart;	    ///< The transceiver restarts half way, counting chips from 0 again.
+	unsigned expectRelocks;
+};
+
+static const unsigned sIndications = 1200;
+static const int64_t sLatencyNs = 180000;
+
+static double exponential(unsigned *seed, double mean) { return -mean * log((rand_r(seed) + 1.0) / (RAND_MAX + 2.0)); }
+
+static vector<Indication> makeTrace(const Scenario &sc, unsigned seed)
+{
+	vector<Indication> trace;
+	double nsPerChip = ClockEstimator::sNominalNsPerChip / (1.0 + sc.driftPPM * 1e-6);
+	int64_t startNs = 1000000000000LL;
+	int64_t chips = 0, radioChips = 0;
+	for (unsigned i = 0; i < sIndications; i++) {
+		unsigned frames = sc.irregular ? 50 + rand_r(&seed) % 101 : 100;
+		unsigned slot = sc.irregular ? rand_r(&seed) % gFrameSlots : 1;
+		radioChips += (int64_t)frames * gFrameLen;
+		chips += (int64_t)frames * gFrameLen;
+		if (sc.restart && i == sIndications / 2) {
+			chips = 0;
+		}
+		Indication ind;
+		ind.chips = chips + slot * gSlotLen;
+		ind.trueNs = startNs + (int64_t)llround((radioChips + slot * gSlotLen) * nsPerChip) + sLatencyNs;
+		ind.trueAheadNs = ind.trueNs + (int64_t)llround(sAheadChips * nsPerChip);
+		double delay = exponential(&seed, sc.jitterUs * 1000.0);
+		if (rand_r(&seed) % 10000 < sc.stallRate * 10000) {
+			delay += (rand_r(&seed) % 1000) * sc.stallMs * 1000.0;
+		}
+		ind.arrivalNs = ind.trueNs + (int64_t)delay;
+		trace.push_back(ind);
+	}
+	return trace;
+}
+
+struct Errors {
+	vector<double> newUs, oldUs;
+	double driftPPM;
+	unsigned relocks, skipped;
+	double jitterUs;
+
+	static double quantile(vector<double> v, double q)
+	{
+		if (v.empty()) {
+			return 0;
+		}
+		sort(v.begin(), v.end());
+		return v[(size_t)(q * (v.size() - 1))];
+	}
+};
+
+// What the clock handler does with each indication, and where each method put the next frame boundary.
+static Errors replay(const vector<Indication> &trace, unsigned warmup)
+{
+	Errors e;
+	ClockEstimator est;
+	for (unsigned i = 0; i < trace.size(); i++) {
+		const Indication &ind = trace[i];
+		est.update(ind.chips, ind.arrivalNs);
+		if (!ind.trueNs || est.updates() < warmup) {
+			continue;
+		}
+		e.newUs.push_back(fabs((double)(est.predict(ind.chips + sAheadChips) - ind.trueAheadNs)) / 1000.0);
+		e.oldUs.push_back(fabs((double)(ind.arrivalNs + 50 * sFrameNs - ind.trueAheadNs)) / 1000.0);
+	}
+	e.driftPPM = est.driftPPM();
+	e.relocks = est.relocks();
+	e.skipped = est.skipped();
+	e.jitterUs = est.jitterNs() / 1000.0;
+	return e;
+}
+
+static void testScenarios()
+{
+	static const Scenario scenarios[] = {
+		{"quiet host", 2.5, 30, 0, 0, false, false, 0},
+		{"loaded host", -4.0, 300, 0.02, 20, false, false, 0},
+		{"irregular indications", 1.0, 150, 0.01, 10, true, false, 0},
+		{"transceiver restart", 3.0, 100, 0, 0, false, true, 1},
+	};
+	for (unsigned s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+		const Scenario &sc = scenarios[s];
+		vector<Indication> trace = makeTrace(sc, 11 + s);
+		Errors e = replay(trace, ClockEstimator::sWindow);
+		double newP99 = Errors::quantile(e.newUs, 0.99), oldP99 = Errors::quantile(e.oldUs, 0.99);
+		printf("%s: frame boundary error p50/p99/max, arrival %.0f/%.0f/%.0f us, estimator %.1f/%.1f/%.1f us\n",
+			sc.name, Errors::quantile(e.oldUs, 0.5), oldP99, Errors::quantile(e.oldUs, 1.0),
+			Errors::quantile(e.newUs, 0.5), newP99, Errors::quantile(e.newUs, 1.0));
+		printf("%s: drift %.3f ppm (true %.3f), jitter %.0f us, %u relocks, %u skipped\n", sc.name, e.driftPPM,
+			sc.driftPPM, e.jitterUs, e.relocks, e.skipped);
+		char what[80];
+		snprintf(what, sizeof(what), "%s: within 100us, 10x better", sc.name);
+		check(what, newP99 < 100 && newP99 * 10 < oldP99);
+		snprintf(what, sizeof(what), "%s: drift within 0.25ppm", sc.name);
+		check(what, fabs(e.driftPPM - sc.driftPPM) < 0.25);
+		snprintf(what, sizeof(what), "%s: relocks only on a restart", sc.name);
+		check(what, e.relocks == sc.expectRelocks);
+	}
+}
+
+static void testWire()
+{
+	ClockIndication a(123456789, Time(4095, 14), 0x123456789abLL), b;
+	char buf[sClockIndicationLength];
+	bool ok = a.write(buf) == sClockIndicationLength && b.parse(buf, sizeof(buf));
+	ok &= b.mSeq == a.mSeq && b.mFN == 4095 && b.mTN == 14 && b.mChips == a.mChips;
+	check("indication round trip", ok);
+	const char text[] = "IND CLOCK 1234";
+	check("text indications are not binary", !b.parse(text, sizeof(text)) && !b.parse(buf, sizeof(buf) - 1));
+}
+
+static void testClock()
+{
+	Clock clock;
+	int64_t now = Clock::nanoseconds();
+	clock.setBase(100, now - 5 * sFrameNs - sFrameNs / 2);
+	bool ok = clock.FN() == 105;
+	int64_t moved = clock.setBase(110, now + 5 * sFrameNs - sFrameNs / 2 + 1000);
+	ok &= moved == 1000 && clock.FN() == 105;
+	// Across the end of the hyperframe.
+	clock.setBase(gHyperframe - 1, now);
+	moved = clock.setBase(1, now + 2 * sFrameNs - 500);
+	ok &= moved == -500;
+	check("setBase", ok);
+}
+
+static bool replayFile(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	if (!f) {
+		printf("%s: cannot open\n", name);
+		return false;
+	}
+	vector<Indication> trace;
+	long long chips, arrival;
+	while (fscanf(f, "%lld %lld", &chips, &arrival) == 2) {
+		Indication ind = {chips, arrival, 0, 0};
+		trace.push_back(ind);
+	}
+	fclose(f);
+	Errors e = replay(trace, 0);
+	printf("%s: %zu indications, drift %.3f ppm, jitter %.0f us, %u relocks, %u skipped\n", name, trace.size(),
+		e.driftPPM, e.jitterUs, e.relocks, e.skipped);
+	return !trace.empty();
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("ClockSyncTest", "ERR");
+
+	testWire();
+	testClock();
+	testScenarios();
+	for (int i = 1; i < argc; i++) {
+		check(argv[i], replayFile(argv[i]));
+	}
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
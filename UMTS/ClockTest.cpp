@@ -0,0 +1,210 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the NodeB clock, then measure how late wait() wakes its callers at frame boundaries, against a plain
+// nanosleep to the boundary as the clock used to do, and how fast FN() is with a writer running.
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Threads.h>
+
+#include "UMTSCommon.h"
+
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static const unsigned sWaiters = 8;
+static const unsigned sFrames = 100;
+
+static Clock *sClock;
+static bool sUseSleep;
+static std::vector<unsigned> sLateness[sWaiters]; // Microseconds past the frame boundary.
+static unsigned sEarly = 0;
+static unsigned sWaiterIndex = 0;
+
+// The old wait(): sleep for the time left to the boundary, as computed when called.
+static void sleepWait(const Time &when)
+{
+	uint32_t fraction;
+	int16_t delta = FNDelta(when.FN(), sClock->FN(&fraction));
+	if (delta <= 0) {
+		return;
+	}
+	uint32_t totalUsecs = delta * gFrameMicroseconds - fraction;
+	struct timespec howlong, rem;
+	howlong.tv_sec = totalUsecs / 1000000;
+	howlong.tv_nsec = (totalUsecs - 1000000 * howlong.tv_sec) * 1000;
+	while (0 != nanosleep(&howlong, &rem)) {
+		howlong = rem;
+	}
+}
+
+static void *waiter(void *)
+{
+	unsigned me = __atomic_fetch_add(&sWaiterIndex, 1, __ATOMIC_RELAXED);
+	for (unsigned i = 0; i < sFrames; i++) {
+		Time target = sClock->get() + 1;
+		if (sUseSleep) {
+			sleepWait(target);
+		} else {
+			sClock->wait(target);
+		}
+		uint32_t fraction;
+		int16_t fn = sClock->FN(&fraction);
+		if (fn != target.FN()) {
+			// Early, or so late a whole frame went by.
+			__atomic_add_fetch(&sEarly, FNDelta(fn, target.FN()) < 0, __ATOMIC_RELAXED);
+			fraction += FNDelta(fn, target.FN()) * gFrameMicroseconds;
+		}
+		sLateness[me].push_back(fraction);
+	}
+	return NULL;
+}
+
+static void jitter(const char *name, bool useSleep)
+{
+	sUseSleep = useSleep;
+	sWaiterIndex = 0;
+	Thread threads[sWaiters];
+	for (unsigned t = 0; t < sWaiters; t++) {
+		sLateness[t].clear();
+		threads[t].start(waiter, NULL);
+	}
+	for (unsigned t = 0; t < sWaiters; t++) {
+		threads[t].join();
+	}
+	std::vector<unsigned> all;
+	for (unsigned t = 0; t < sWaiters; t++) {
+		all.insert(all.end(), sLateness[t].begin(), sLateness[t].end());
+	}
+	std::sort(all.begin(), all.end());
+	printf("%-10s %u wakes  late p50 %5u us  p99 %5u us  max %5u us\n", name, (unsigned)all.size(),
+		all[all.size() / 2], all[all.size() * 99 / 100], all.back());
+}
+
+static volatile bool sStopWriter;
+
+// Sets the clock like transceiver clock indications: each frame of a free running reference, up to 2 ms after
+// the frame starts, and one time in four the frame before, as if delivered late.  Each set puts the start of
+// the frame at now, so the clock under test keeps crossing frame boundaries a little after the reference.
+static void *writer(void *)
+{
+	const int64_t frameNs = gFrameMicroseconds * 1000LL;
+	int64_t startNs = Clock::nanoseconds();
+	int startFN = sClock->FN();
+	sClock->setFN(startFN);
+	unsigned seed = 1;
+	while (!sStopWriter) {
+		int64_t frames = (Clock::nanoseconds() - startNs) / frameNs + 1;
+		int64_t at = startNs + frames * frameNs + rand_r(&seed) % 2000000;
+		struct timespec ts;
+		ts.tv_sec = at / 1000000000LL;
+		ts.tv_nsec = at % 1000000000LL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		if (rand_r(&seed) % 4 == 0) {
+			frames--;
+		}
+		sClock->setFN((startFN + frames) % gHyperframe);
+	}
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	unsigned *calls = (unsigned *)arg;
+	int16_t prev = sClock->FN();
+	bool ok = true;
+	int64_t end = Clock::nanoseconds() + 500000000LL;
+	while (Clock::nanoseconds() < end) {
+		int16_t fn = sClock->FN();
+		// Never back.  A late indication puts the frame start up to a frame late, and the next one on time
+		// skips forward to catch up.
+		ok &= FNDelta(fn, prev) >= 0 && FNDelta(fn, prev) < 10;
+		prev = fn;
+		(*calls)++;
+	}
+	if (!ok) {
+		*calls = 0;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	sClock = new Clock(Time(0));
+
+	sClock->setFN(100);
+	uint32_t fraction;
+	check("setFN", sClock->FN(&fraction) == 100 && fraction < gFrameMicroseconds);
+	sClock->setFN(99);
+	check("setFN a frame back holds the frame", sClock->FN(&fraction) == 100 && fraction < 1000);
+	sClock->setFN(98);
+	check("setFN two frames back is a resync", sClock->FN() == 98);
+	sClock->setFN(100);
+	int64_t start = Clock::nanoseconds();
+	sClock->wait(Time(103));
+	int64_t waited = Clock::nanoseconds() - start;
+	check("wait three frames", sClock->FN() == 103 && waited >= 29000000 && waited < 40000000);
+	start = Clock::nanoseconds();
+	sClock->wait(Time(90));
+	check("wait for the past returns at once", Clock::nanoseconds() - start < 1000000);
+	sClock->setFN(gHyperframe - 1);
+	sClock->wait(Time(1));
+	check("wait across the hyperframe", sClock->FN() == 1);
+
+	printf("%u threads each waiting for the next frame %u times\n", sWaiters, sFrames);
+	jitter("nanosleep", true);
+	jitter("clock", false);
+	check("no early wakes", sEarly == 0);
+
+	Thread write, read[4];
+	unsigned calls[4] = {0};
+	sStopWriter = false;
+	write.start(writer, NULL);
+	for (unsigned t = 0; t < 4; t++) {
+		read[t].start(reader, &calls[t]);
+	}
+	unsigned total = 0;
+	bool ok = true;
+	for (unsigned t = 0; t < 4; t++) {
+		read[t].join();
+		ok &= calls[t] != 0;
+		total += calls[t];
+	}
+	sStopWriter = true;
+	write.join();
+	printf("FN() with a writer: %.1f million calls per second over 4 readers\n", total / 0.5e6);
+	check("FN() monotonic with a writer", ok);
+
+	delete sClock;
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the packed uplink scrambling codes and pilot filters of the UplinkCodeBank against UplinkScramblingCode,
+// read the bank from several threads while DCHs are opened, and compare the cost of opening 64 DCHs with how
+// RadioModem built their codes before.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+
+#include "UMTSCodeBank.h"
+#include "UMTSCodes.h"
+#include "UMTSRadioModemSequences.h"
+#include "sigProcLib.h"
+
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const unsigned sPilotOffset = 384;
+static const unsigned sPilotLen = 256;
+static const unsigned sDCHs = 64;
+
+// The codes the ChannelTree hands its DCHs, from the default UMTS.Uplink.ScramblingCode.
+static unsigned dchCode(unsigned i) { return (1000 + 37841 * i) % 16777216; }
+
+// The pilot filters as RadioModem::UplinkPilotWaveforms built them, from an unpacked code.
+static signalVector **oldPilotFilters(const UplinkScramblingCode &code, unsigned numPilots)
+{
+	const int8_t *ovsf = gOVSFTree.code(8, 0);
+	signalVector **filters = new signalVector *[gFrameSlots];
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		signalVector chips(sPilotLen);
+		for (unsigned i = 0; i < sPilotLen; i++) {
+			unsigned c = sPilotOffset + i, n = slot * gSlotLen + c;
+			float Q = (gPilotPatterns[numPilots - 3][slot].bit(c / 256) ? -1.0F : 1.0F) * ovsf[c % 256];
+			chips[i] = complex(0.0, Q) * complex(code.ICode()[n], code.QCode()[n]);
+		}
+		filters[slot] = reverseConjugate(&chips);
+	}
+	return filters;
+}
+
+static void deleteFilters(signalVector **filters)
+{
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		delete filters[slot];
+	}
+	delete[] filters;
+}
+
+static bool waitFor(const UplinkCodeBank &bank, unsigned code, unsigned numPilots)
+{
+	for (unsigned i = 0; i < 10000; i++) {
+		if (bank.code(code) && (!numPilots || bank.pilotFilter(code, numPilots, gFrameSlots - 1))) {
+			return true;
+		}
+		usleep(100);
+	}
+	return false;
+}
+
+static void testCodes()
+{
+	UplinkCodeBank bank(8, sPilotOffset, sPilotLen);
+	const unsigned codes[] = {0, 1, 1234, 16777215, dchCode(17)};
+	bool same = true, slices = true, filters = true;
+	static int8_t I[PackedScramblingCode::sChips], Q[PackedScramblingCode::sChips];
+	unsigned seed = 3;
+	for (unsigned c = 0; c < sizeof(codes) / sizeof(codes[0]); c++) {
+		bank.request(codes[c], 3 + c);
+		if (!waitFor(bank, codes[c], 3 + c)) {
+			same = false;
+			continue;
+		}
+		UplinkScramblingCode ref(codes[c]);
+		const PackedScramblingCode *packed = bank.code(codes[c]);
+		packed->expand(0, PackedScramblingCode::sChips, I, Q);
+		same &= !memcmp(I, ref.ICode(), sizeof(I)) && !memcmp(Q, ref.QCode(), sizeof(Q));
+
+		// Odd starts and lengths go through every path of the expansion.
+		for (unsigned k = 0; k < 200; k++) {
+			unsigned start = rand_r(&seed) % PackedScramblingCode::sChips;
+			unsigned len = rand_r(&seed) % 100;
+			len = start + len > PackedScramblingCode::sChips ? PackedScramblingCode::sChips - start : len;
+			int8_t sI[100], sQ[100];
+			packed->expand(start, len, sI, sQ);
+			slices &= !memcmp(sI, ref.ICode() + start, len) && !memcmp(sQ, ref.QCode() + start, len);
+		}
+
+		signalVector **old = oldPilotFilters(ref, 3 + c);
+		for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+			signalVector *f = bank.pilotFilter(codes[c], 3 + c, slot);
+			for (unsigned i = 0; f && i < sPilotLen; i++) {
+				filters &= (*f)[i] == (*old[slot])[i];
+			}
+			filters &= f != NULL;
+		}
+		deleteFilters(old);
+	}
+	check("packed codes match UplinkScramblingCode", same);
+	check("expansion of any stretch", slices);
+	check("pilot filters match", filters);
+
+	UplinkCodeBank small(2, sPilotOffset, sPilotLen);
+	bool full = small.request(5) && small.request(6) && small.request(5, 6) && !small.request(7);
+	check("a full bank refuses new codes", full && !small.code(7) && small.size() == 2);
+}
+
+// Demodulator threads look up every DCH's slot 0 while the DCHs are being opened, checking whatever they find.
+static UplinkCodeBank *sBank;
+static int8_t sRefI[sDCHs][gSlotLen], sRefQ[sDCHs][gSlotLen];
+static volatile bool sStop;
+
+struct ReaderResult {
+	unsigned lookups, found;
+	bool ok;
+};
+
+static void *reader(void *arg)
+{
+	ReaderResult *r = (ReaderResult *)arg;
+	r->lookups = r->found = 0;
+	r->ok = true;
+	unsigned i = 0;
+	int8_t I[gSlotLen], Q[gSlotLen];
+	while (!sStop) {
+		unsigned d = i++ % sDCHs;
+		r->lookups++;
+		const PackedScramblingCode *code = sBank->code(dchCode(d));
+		signalVector *filter = sBank->pilotFilter(dchCode(d), 6, 0);
+		if (!code || !filter) {
+			continue;
+		}
+		r->found++;
+		code->expand(0, gSlotLen, I, Q);
+		r->ok &= !memcmp(I, sRefI[d], gSlotLen) && !memcmp(Q, sRefQ[d], gSlotLen) && filter->size() == sPilotLen;
+	}
+	return NULL;
+}
+
+static void testConcurrent()
+{
+	for (unsigned d = 0; d < sDCHs; d++) {
+		UplinkScramblingCode ref(dchCode(d));
+		memcpy(sRefI[d], ref.ICode(), gSlotLen);
+		memcpy(sRefQ[d], ref.QCode(), gSlotLen);
+	}
+	sBank = new UplinkCodeBank(sDCHs, sPilotOffset, sPilotLen);
+	sStop = false;
+	const unsigned numReaders = 4;
+	Thread threads[numReaders];
+	ReaderResult results[numReaders];
+	for (unsigned t = 0; t < numReaders; t++) {
+		threads[t].start(reader, &results[t]);
+	}
+	bool requested = true;
+	for (unsigned d = 0; d < sDCHs; d++) {
+		requested &= sBank->request(dchCode(d), 6);
+		usleep(500);
+	}
+	bool ready = true;
+	for (unsigned d = 0; d < sDCHs; d++) {
+		ready &= waitFor(*sBank, dchCode(d), 6);
+	}
+	usleep(10000);
+	sStop = true;
+	bool ok = true;
+	unsigned lookups = 0, found = 0;
+	for (unsigned t = 0; t < numReaders; t++) {
+		threads[t].join();
+		ok &= results[t].ok;
+		lookups += results[t].lookups;
+		found += results[t].found;
+	}
+	printf("%u lookups from %u threads while opening, %u found a code\n", lookups, numReaders, found);
+	check("concurrent lookups see only whole entries", requested && ready && ok && found > 0);
+	delete sBank;
+}
+
+static void benchmark()
+{
+	// Before: the first burst of each DCH built the code and its pilot filters in the demodulator thread.
+	uint64_t start = nanoseconds();
+	uint64_t worst = 0;
+	for (unsigned d = 0; d < sDCHs; d++) {
+		uint64_t t = nanoseconds();
+		UplinkScramblingCode *code = new UplinkScramblingCode(dchCode(d));
+		signalVector **filters = oldPilotFilters(*code, 6);
+		t = nanoseconds() - t;
+		worst = t > worst ? t : worst;
+		deleteFilters(filters);
+		delete code;
+	}
+	double oldTotal = (nanoseconds() - start) * 1e-6;
+	// ScramblingCode keeps its four subcodes as well as the I and Q codes.
+	size_t oldBytes = sDCHs * (6 * PackedScramblingCode::sChips + gFrameSlots * sPilotLen * sizeof(complex));
+	printf("before: %u DCHs built in %.1f ms, %.2f ms stalled in the first slot, at worst %.2f ms, %zu K\n",
+		sDCHs, oldTotal, oldTotal / sDCHs, worst * 1e-6, oldBytes / 1024);
+
+	// After: opening a DCH queues its code, which is built in the background.
+	UplinkCodeBank bank(sDCHs, sPilotOffset, sPilotLen);
+	start = nanoseconds();
+	worst = 0;
+	for (unsigned d = 0; d < sDCHs; d++) {
+		uint64_t t = nanoseconds();
+		bank.request(dchCode(d), 6);
+		t = nanoseconds() - t;
+		worst = t > worst ? t : worst;
+	}
+	double opened = (nanoseconds() - start) * 1e-6;
+	for (unsigned d = 0; d < sDCHs; d++) {
+		waitFor(bank, dchCode(d), 6);
+	}
+	double built = (nanoseconds() - start) * 1e-6;
+	printf("after: %u DCHs opened in %.3f ms, at worst %.1f us each; all built after %.1f ms, %zu K\n", sDCHs,
+		opened, worst * 1e-3, built, bank.bytes() / 1024);
+
+	// What a demodulator thread pays per slot for the packing.
+	int8_t I[gSlotLen], Q[gSlotLen];
+	const PackedScramblingCode *code = bank.code(dchCode(0));
+	unsigned sum = 0;
+	const unsigned reps = 100000;
+	start = nanoseconds();
+	for (unsigned r = 0; r < reps; r++) {
+		code->expand((r % gFrameSlots) * gSlotLen, gSlotLen, I, Q);
+		sum += I[r % gSlotLen];
+	}
+	double expandNs = (double)(nanoseconds() - start) / reps;
+	start = nanoseconds();
+	for (unsigned r = 0; r < reps; r++) {
+		sum += bank.code(dchCode(r % sDCHs)) != NULL;
+	}
+	double lookupNs = (double)(nanoseconds() - start) / reps;
+	printf("per slot: expand %.0f ns, lookup %.0f ns (%u)\n", expandNs, lookupNs, sum % 2);
+	check("opening is faster than building", worst * 1e-6 < oldTotal / sDCHs);
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("CodeBankTest", "NOTICE");
+	sigProcLibSetup(1);
+
+	testCodes();
+	testConcurrent();
+	benchmark();
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
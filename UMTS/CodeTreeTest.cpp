@@ -0,0 +1,258 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Churn the OVSF code allocator with random allocations and releases, checking every choice against the tree
+// walk the ChannelTree used to do and the bitmaps against a recount, try the defragmentation planner on every
+// allocation that fails, and time both allocators.
+
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "UMTSCodeTree.h"
+
+using namespace UMTS;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const int sTiers = OVSFAllocator::sNumTiers;
+
+// The ChannelTree's search as it was: for each code of the tier, walk up for a used ancestor and down the
+// whole subtree for a used descendant.
+class TreeWalk {
+	bool mUsed[sTiers][OVSFAllocator::sMaxWidth];
+
+	bool freeDownward(int tier, unsigned start, unsigned width) const
+	{
+		if (tier >= sTiers) {
+			return true;
+		}
+		for (unsigned i = 0; i < width; i++) {
+			if (mUsed[tier][start + i]) {
+				return false;
+			}
+		}
+		return freeDownward(tier + 1, 2 * start, 2 * width);
+	}
+
+	bool freeUpward(int tier, unsigned code) const
+	{
+		for (int t = tier - 1; t >= 0; t--) {
+			code /= 2;
+			if (mUsed[t][code]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+	TreeWalk() { memset(mUsed, 0, sizeof(mUsed)); }
+
+	void mark(int tier, unsigned code) { mUsed[tier][code] = true; }
+	void release(int tier, unsigned code) { mUsed[tier][code] = false; }
+
+	int allocate(int tier)
+	{
+		for (unsigned c = 0; c < OVSFAllocator::width(tier); c++) {
+			if (freeDownward(tier, c, 1) && freeUpward(tier, c)) {
+				mUsed[tier][c] = true;
+				return c;
+			}
+		}
+		return -1;
+	}
+};
+
+struct Code {
+	int tier;
+	unsigned code;
+	Code(int wTier, unsigned wCode) : tier(wTier), code(wCode) {}
+};
+
+// Mostly small voice and signalling channels, some data channels, the odd SF=4.
+static int randomTier(unsigned *seed)
+{
+	static const int tiers[16] = {6, 6, 6, 6, 6, 5, 5, 5, 4, 4, 4, 3, 3, 2, 1, 0};
+	return tiers[rand_r(seed) % 16];
+}
+
+static void reserveCommon(OVSFAllocator &codes, TreeWalk *walk)
+{
+	// CPICH, PCCPCH, PICH and an SF=64 SCCPCH, as in the NodeB configuration.
+	static const Code reserved[] = {Code(6, 0), Code(6, 1), Code(6, 2), Code(4, 1)};
+	for (unsigned i = 0; i < sizeof(reserved) / sizeof(reserved[0]); i++) {
+		codes.reserve(reserved[i].tier, reserved[i].code);
+		if (walk) {
+			walk->mark(reserved[i].tier, reserved[i].code);
+		}
+	}
+}
+
+// Carry out a plan on a copy and check it frees the code it promised.
+static bool applyPlan(const OVSFAllocator &codes, int tier, unsigned target,
+	const std::vector<OVSFAllocator::Move> &moves)
+{
+	OVSFAllocator copy(codes);
+	for (unsigned i = 0; i < moves.size(); i++) {
+		copy.release(moves[i].tier, moves[i].from);
+		if (!copy.allocate(moves[i].tier, moves[i].to)) {
+			return false;
+		}
+	}
+	std::ostringstream os;
+	return copy.allocate(tier, target) && copy.check(os);
+}
+
+static void testChurn()
+{
+	OVSFAllocator codes;
+	TreeWalk walk;
+	reserveCommon(codes, &walk);
+	std::vector<Code> allocated;
+	unsigned seed = 1;
+	bool same = true, consistent = true, plansOk = true;
+	unsigned failed = 0, planned = 0, moves = 0;
+	const unsigned ops = 200000;
+
+	for (unsigned op = 0; op < ops; op++) {
+		if (allocated.empty() || rand_r(&seed) % 100 < 55) {
+			int tier = randomTier(&seed);
+			int code = codes.allocate(tier);
+			same &= code == walk.allocate(tier);
+			if (code >= 0) {
+				allocated.push_back(Code(tier, code));
+			} else {
+				failed++;
+				unsigned target;
+				std::vector<OVSFAllocator::Move> plan;
+				if (codes.planDefrag(tier, &target, plan)) {
+					planned++;
+					moves += plan.size();
+					plansOk &= !plan.empty() && applyPlan(codes, tier, target, plan);
+				}
+			}
+		} else {
+			unsigned i = rand_r(&seed) % allocated.size();
+			codes.release(allocated[i].tier, allocated[i].code);
+			walk.release(allocated[i].tier, allocated[i].code);
+			allocated[i] = allocated.back();
+			allocated.pop_back();
+		}
+		if (op % 1000 == 0) {
+			consistent &= codes.check(std::cout);
+		}
+	}
+	consistent &= codes.check(std::cout);
+
+	printf("%u operations, %u allocations failed, %u could be made by moving %.1f channels on average\n", ops,
+		failed, planned, planned ? (double)moves / planned : 0.0);
+	check("same codes as the tree walk", same);
+	check("bitmaps match a recount", consistent);
+	check("defragmentation plans free their code", plansOk && planned > 0);
+}
+
+static void testReservations()
+{
+	OVSFAllocator codes;
+	reserveCommon(codes, NULL);
+	int t;
+	unsigned c;
+	bool ok = codes.findConflict(0, 0, &t, &c) && t == 4 && c == 1;
+	ok &= !codes.findConflict(6, 3, &t, &c) && codes.findFree(6) == 3;
+	ok &= codes.findFree(0) == 1 && codes.freeCount(0) == 3;
+	ok &= codes.freeCount(4) == 62 && codes.freeCount(6) == 256 - 7;
+	// A conflicting reservation still blocks everything under it.
+	ok &= !codes.reserve(3, 0) && !codes.isFree(6, 3) && codes.findFree(3) == 1;
+	std::ostringstream os;
+	ok &= codes.check(os);
+	// Nothing can be moved off a reservation.
+	std::vector<OVSFAllocator::Move> plan;
+	unsigned target;
+	while (codes.allocate(0) >= 0) {
+	}
+	ok &= !codes.planDefrag(0, &target, plan);
+	check("reservations", ok);
+}
+
+static void benchmark()
+{
+	const unsigned ops = 200000;
+	std::vector<int> tiers(ops);
+	std::vector<unsigned> picks(ops);
+	unsigned seed = 7;
+	for (unsigned i = 0; i < ops; i++) {
+		tiers[i] = rand_r(&seed) % 100 < 55 ? randomTier(&seed) : -1;
+		picks[i] = rand_r(&seed);
+	}
+
+	// Both run the same sequence; releases pick by index into the live list.
+	double ns[2];
+	for (unsigned which = 0; which < 2; which++) {
+		OVSFAllocator codes;
+		TreeWalk walk;
+		reserveCommon(codes, &walk);
+		std::vector<Code> allocated;
+		uint64_t start = nanoseconds();
+		for (unsigned i = 0; i < ops; i++) {
+			if (tiers[i] >= 0 || allocated.empty()) {
+				int tier = tiers[i] >= 0 ? tiers[i] : 6;
+				int code = which ? codes.allocate(tier) : walk.allocate(tier);
+				if (code >= 0) {
+					allocated.push_back(Code(tier, code));
+				}
+			} else {
+				unsigned k = picks[i] % allocated.size();
+				if (which) {
+					codes.release(allocated[k].tier, allocated[k].code);
+				} else {
+					walk.release(allocated[k].tier, allocated[k].code);
+				}
+				allocated[k] = allocated.back();
+				allocated.pop_back();
+			}
+		}
+		ns[which] = (double)(nanoseconds() - start) / ops;
+	}
+	printf("per allocate or release: tree walk %.0f ns, bitmaps %.0f ns\n", ns[0], ns[1]);
+}
+
+int main(int argc, char **argv)
+{
+	testReservations();
+	testChurn();
+	benchmark();
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
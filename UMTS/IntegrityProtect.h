@@ -16,7 +16,61 @@
 
 #include <CommonLibs/ByteVector.h>
 
-// This is the algorithm as defined in the spec.
+// KASUMI, 35.202, with its key schedule kept in the object rather than in the globals of the reference code,
+// so it is reentrant and a UE can schedule its CK and IK once instead of on every message.
+class Kasumi {
+	uint16_t mKLi1[8], mKLi2[8];
+	uint16_t mKOi1[8], mKOi2[8], mKOi3[8];
+	uint16_t mKIi1[8], mKIi2[8], mKIi3[8];
+
+	inline uint32_t FO(uint32_t in, int index) const;
+	inline uint32_t FL(uint32_t in, int index) const;
+
+public:
+	// The most blocks encryptLanes runs side by side; also the batch size of the f8/f9 functions below.
+	static const unsigned sMaxLanes = 8;
+
+	// Schedule the 128 bit key, after xoring every byte of it with modifier, which is the KM of 35.201.
+	void setKey(const uint8_t *key, uint8_t modifier = 0);
+
+	// Encrypt one 64 bit block held as two big-endian halves.
+	void encrypt(uint32_t &left, uint32_t &right) const;
+
+	// Encrypt n <= sMaxLanes independent blocks, block i with keys[i].  A single KASUMI is one long
+	// dependency chain of table lookups; running several chains in the same loop lets the cpu overlap them.
+	static void encryptLanes(const Kasumi *const *keys, uint32_t *left, uint32_t *right, unsigned n);
+};
+
+// One f8 (UEA1) invocation, 35.201 sec 3: data is ciphered in place.
+struct KasumiF8Job {
+	const Kasumi *mCK;  // Schedule of CK.
+	const Kasumi *mCKM; // Schedule of CK xor 0x55...
+	uint32_t mCount;
+	unsigned mBearer; // 5 bits.
+	unsigned mDir;    // 0 = uplink, 1 = downlink.
+	uint8_t *mData;
+	unsigned mLength; // In bits.  Bits past the end of the last byte are not modified.
+};
+
+// One f9 (UIA1) invocation, 35.201 sec 4.  The result is left in mMac.
+struct KasumiF9Job {
+	const Kasumi *mIK;  // Schedule of IK.
+	const Kasumi *mIKM; // Schedule of IK xor 0xAA...
+	uint32_t mCount;
+	uint32_t mFresh;
+	unsigned mDir;
+	const uint8_t *mData;
+	unsigned mLength; // In bits.
+	uint32_t mMac;
+};
+
+// Run several f8 or f9 jobs, for example all the PDUs for one TTI, interleaved.  The jobs are independent
+// and may use different keys and lengths.
+void AlgorithmF8Batch(KasumiF8Job *jobs, unsigned n);
+void AlgorithmF9Batch(KasumiF9Job *jobs, unsigned n);
+
+// These are the algorithms as defined in the spec.
+void AlgorithmF8(const uint8_t *key, uint32_t count, unsigned bearer, unsigned dir, uint8_t *data, unsigned length);
 uint32_t AlgorithmF9(uint8_t *key, int count, int fresh, int dir, uint8_t *data, int length);
 
 class IntegrityProtect {
@@ -24,6 +78,9 @@ class IntegrityProtect {
 	// For GSM subscribers (no USIM) IK is generated from Kc, after which we could discard Kc.
 	uint64_t mKc;    // Used to generate mIK.
 	uint8_t mIK[16]; // 128 bit Integrity Key; see setKc().
+	uint8_t mCK[16]; // 128 bit Cipher Key; see setKc().
+	Kasumi mIKSchedule, mIKMSchedule; // Key schedules for f9, made once by setKc.
+	Kasumi mCKSchedule, mCKMSchedule; // Key schedules for f8.
 	// 8.5.10 has the list of messages that are integrity protected, but they might as well not have bothered -
 	// it is just all messages on DCCH are integrity protected, and on other channels they are not.
 	// The spec goes on and on about Integrity Protection being started or not, but it is massive overkill:
@@ -56,6 +113,10 @@ public:
 	void setKc(uint64_t Kc);
 	void setKcs(std::string kcs);
 	uint32_t runF9(unsigned rbid, bool dir, ByteVector &msg);
+	// Cipher or decipher length bits of data in place with f8, using the CK from setKc.
+	// The COUNT-C and bearer are those of 33.102 6.6.4.  Nobody calls this yet because
+	// sendSecurityModeCommand does not start ciphering.
+	void runF8(uint32_t countc, unsigned bearer, bool dir, uint8_t *data, unsigned length);
 	// They call the bottom 4 bits of COUNT-I the RRC SN [sequence number]
 	unsigned getDlRrcSn(unsigned rbid) { return 0xf & mDlCounti[rbid]; }
 	void advanceDlRrcSn(unsigned rbid) { mDlCounti[rbid]++; }
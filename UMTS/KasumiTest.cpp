@@ -0,0 +1,192 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Run KASUMI, f8 and f9 against the 3GPP test sets and time f8 on one core.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Utils.h>
+
+#include "IntegrityProtect.h"
+
+using namespace std;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static unsigned hex2bytes(const char *hex, uint8_t *out)
+{
+	unsigned n = 0;
+	for (; hex[0] && hex[1]; hex += 2) {
+		unsigned v;
+		sscanf(hex, "%2x", &v);
+		out[n++] = v;
+	}
+	return n;
+}
+
+static void check(const char *what, bool ok)
+{
+	printf("%-40s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+// Compare length bits.
+static bool sameBits(const uint8_t *a, const uint8_t *b, unsigned length)
+{
+	unsigned bytes = length / 8, rest = length % 8;
+	if (memcmp(a, b, bytes)) {
+		return false;
+	}
+	return rest == 0 || ((a[bytes] ^ b[bytes]) & (0xff00 >> rest) & 0xff) == 0;
+}
+
+// 35.203 test data, 4.3 (f8) test set 1 and 35.202 KASUMI test set 1.
+static void testVectors()
+{
+	uint8_t key[16], block[8];
+	hex2bytes("2BD6459F82C5B300952C49104881FF48", key);
+	hex2bytes("EA024714AD5C4D84", block);
+	Kasumi kasumi;
+	kasumi.setKey(key);
+	uint32_t left = (block[0] << 24) | (block[1] << 16) | (block[2] << 8) | block[3];
+	uint32_t right = (block[4] << 24) | (block[5] << 16) | (block[6] << 8) | block[7];
+	kasumi.encrypt(left, right);
+	check("KASUMI test set 1", left == 0xDF1F9B25 && right == 0x1C0BF45F);
+
+	uint8_t data[100], cipher[100];
+	hex2bytes("7EC61272743BF1614726446A6C38CED166F6CA76EB5430044286346CEF130F92922B03450D3A9975E5BD2EA0EB55AD8E"
+		  "1B199E3EC4316020E9A1B285E762795359B7BDFD39BEF4B2484583D5AFE082AEE638BF5FD5A606193901A08F4AB41AAB"
+		  "9B134880",
+		data);
+	hex2bytes("D1E2DE70EEF86C6964FB542BC2D460AABFAA10A4A093262B7D199E706FC2D4891553296910F3A973012682E41C4E2B02"
+		  "BE2017B7253BBF9309DE5819CB42E81956F4C99BC9765CAF53B1D0BB8279826ADBBC5522E915C120A618A5A7F5E89708"
+		  "9339650F",
+		cipher);
+	uint8_t plain[100];
+	memcpy(plain, data, sizeof(data));
+	AlgorithmF8(key, 0x72A4F20F, 0x0C, 1, data, 798);
+	check("f8 test set 1 cipher", sameBits(data, cipher, 798));
+	check("f8 test set 1 leaves trailing bits", (data[99] & 0x03) == (plain[99] & 0x03));
+	AlgorithmF8(key, 0x72A4F20F, 0x0C, 1, data, 798);
+	check("f8 test set 1 decipher", memcmp(data, plain, 100) == 0);
+
+	// 35.204 test sets 1 and 2.
+	hex2bytes("6B227737296F393C8079353EDC87E2E805D2EC49A4F2D8E0", data);
+	check("f9 test set 1", AlgorithmF9(key, 0x38A6F056, 0x05D2EC49, 0, data, 189) == 0xF63BD72C);
+	hex2bytes("D42F682428201CAFCD9F97945E6DE7B7", key);
+	hex2bytes("B5924384328A4AE00B737109F8B6C8DD2B4DB63DD533981CEB19AAD52A5B2BC0", data);
+	check("f9 test set 2", AlgorithmF9(key, 0x3EDC87E2, 0xA4F2D8E2, 1, data, 254) == 0xA9DAF1FF);
+}
+
+// The batches must give the same answers as one job at a time, for any mix of lengths and keys.
+static void testBatches()
+{
+	const unsigned n = 20;
+	uint8_t keys[2][16];
+	Kasumi sched[2][2];
+	unsigned seed = 1;
+	for (unsigned k = 0; k < 2; k++) {
+		for (unsigned i = 0; i < 16; i++) {
+			keys[k][i] = rand_r(&seed);
+		}
+		sched[k][0].setKey(keys[k]);
+		sched[k][1].setKey(keys[k], 0x55);
+	}
+	uint8_t data[n][200], single[n][200];
+	KasumiF8Job f8[n];
+	for (unsigned i = 0; i < n; i++) {
+		for (unsigned b = 0; b < 200; b++) {
+			data[i][b] = single[i][b] = rand_r(&seed);
+		}
+		KasumiF8Job job = {&sched[i & 1][0], &sched[i & 1][1], (uint32_t)rand_r(&seed), i & 0x1f, i & 1,
+			data[i], (unsigned)rand_r(&seed) % 1600};
+		f8[i] = job;
+		AlgorithmF8(keys[i & 1], job.mCount, job.mBearer, job.mDir, single[i], job.mLength);
+	}
+	AlgorithmF8Batch(f8, n);
+	check("f8 batch matches single", memcmp(data, single, sizeof(data)) == 0);
+
+	KasumiF9Job f9[n];
+	bool ok = true;
+	for (unsigned k = 0; k < 2; k++) {
+		sched[k][1].setKey(keys[k], 0xAA);
+	}
+	for (unsigned i = 0; i < n; i++) {
+		// Cover the awkward lengths around a block boundary.
+		unsigned length = i < 8 ? 60 + i : (unsigned)rand_r(&seed) % 1600;
+		KasumiF9Job job = {&sched[i & 1][0], &sched[i & 1][1], (uint32_t)rand_r(&seed), (uint32_t)rand_r(&seed),
+			i & 1, data[i], length, 0};
+		f9[i] = job;
+	}
+	AlgorithmF9Batch(f9, n);
+	for (unsigned i = 0; i < n; i++) {
+		ok &= f9[i].mMac ==
+		      AlgorithmF9(keys[i & 1], f9[i].mCount, f9[i].mFresh, f9[i].mDir, data[i], f9[i].mLength);
+	}
+	check("f9 batch matches single", ok);
+}
+
+// Cipher PDUs of the given size, batchSize at a time, on one core.
+static double f8Rate(unsigned pduBytes, unsigned batchSize)
+{
+	uint8_t key[16];
+	memset(key, 0x5a, sizeof(key));
+	Kasumi ck, ckm;
+	ck.setKey(key);
+	ckm.setKey(key, 0x55);
+	KasumiF8Job jobs[Kasumi::sMaxLanes];
+	uint8_t *buf = new uint8_t[pduBytes * Kasumi::sMaxLanes];
+	memset(buf, 0, pduBytes * Kasumi::sMaxLanes);
+	for (unsigned i = 0; i < batchSize; i++) {
+		KasumiF8Job job = {&ck, &ckm, 0, i, 1, buf + i * pduBytes, 8 * pduBytes};
+		jobs[i] = job;
+	}
+	const unsigned totalBits = 200 * 1000 * 1000;
+	unsigned iterations = totalBits / (8 * pduBytes * batchSize);
+	double start = timef();
+	for (unsigned n = 0; n < iterations; n++) {
+		for (unsigned i = 0; i < batchSize; i++) {
+			jobs[i].mCount = n;
+		}
+		AlgorithmF8Batch(jobs, batchSize);
+	}
+	double seconds = timef() - start;
+	delete[] buf;
+	return iterations * 8.0 * pduBytes * batchSize / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("KasumiTest", "NOTICE");
+
+	testVectors();
+	testBatches();
+
+	unsigned sizes[] = {40, 320, 1500};
+	for (unsigned s = 0; s < 3; s++) {
+		printf("f8 %4u byte PDUs: %7.1f Mbit/s one at a time, %7.1f Mbit/s batched by %u\n", sizes[s],
+			f8Rate(sizes[s], 1), f8Rate(sizes[s], Kasumi::sMaxLanes), Kasumi::sMaxLanes);
+	}
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
@@ -17,6 +17,7 @@
 #define MAC_IMPLEMENTATION 1
 
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
 
 #include "MACEngine.h"
 #include "UMTSCommon.h"
@@ -968,6 +969,9 @@ void MaccBase::macService(int fn)
 	flushQ() || flushUE();
 }
 
+static StatHistogram sMacServiceTime("UMTS.MAC.TTI", "us", "time to service every MAC entity for one frame");
+static StatCounter sMacLateFrames("UMTS.MAC.Late", "frames serviced after the frame had already passed");
+
 // Single service loop for all MAC entities.
 // I am not using the prevWriteTime/nextWriteTime paradigm that was used in
 // the GSM code because:  1.  We no longer have a complicated table to lookup
@@ -999,7 +1003,11 @@ void *MacSwitch::macServiceLoop(void *arg)
 				howlong = rem;
 			}
 		}
+		if (gNodeB->clock().get().FN() != nowFN)
+			sMacLateFrames.inc();
+
 		// Lock the list of mac entities and service each.
+		StatTimer timer(sMacServiceTime);
 		gMacSwitch.mMacListLock.lock();
 		MacEngine *mac;
 		RN_FOR_ALL(MacList_t, gMacSwitch.mMacList, mac)
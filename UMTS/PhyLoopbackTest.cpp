@@ -0,0 +1,994 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// End to end loopback of the physical layer, with no radio attached.  The NodeB is the RadioModem itself,
+// serving two simulated UEs through a software radio device: one UE has a DCH in both directions, the other
+// listens to the FACH and sends RACH messages.  The downlink bursts are queued with RadioModem::addBurst, and
+// RadioModem::transmitSlot builds each slot and writes it to a UDP socket, which the device reads as the radio
+// would.  Each uplink burst goes to RadioModem::detectRACHPreamble and decodeRACHMessage as RACHLoopAdapter hands
+// it to them, and to decodeDCH and decodeDPDCHFrame as DCHLoopAdapter does; the RACH slots and the DCH frame the
+// modem puts out are decoded here.  Transport blocks are coded as L1 codes a single TrCh with a 10ms TTI and
+// decoded through the uplink scatter.  Between the two ends every link goes through a fading multipath channel
+// and every receive antenna adds noise.
+//
+// For each channel profile and noise level this prints the block error rate and the throughput of each
+// transport channel and the RACH preambles found, then the processor time each stage of the chain took per
+// frame.  It fails if a channel loses more blocks than it should at a noise level it has the margin for, or if
+// preambles are missed or found where there were none.
+//
+// Usage: PhyLoopbackTest [frames per point]
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <CommonLibs/BitVector.h>
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Sockets.h>
+
+#include "RateMatch.h"
+#include "UMTSCodes.h"
+#include "UMTSConfig.h"
+#include "UMTSL1Const.h"
+#include "UMTSL1Scatter.h"
+#include "UMTSRadioModem.h"
+#include "UMTSRadioModemSequences.h"
+
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+// The modem's processing threads and its default RACH and clock hooks reach the L1 and the NodeB, which the
+// loopback never starts; these stand in for them at link time.
+UMTS::UMTSConfig *gNodeB = NULL;
+namespace UMTS {
+DCHListType gActiveDCH;
+void L1CCTrChUplink::l1WriteLowSide(const RxBitsBurst &) { assert(0); }
+void L1CCTrChUplink::l1WriteLowSideFrame(const RxBitsBurst &, float[30]) { assert(0); }
+}
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+// Codes and timing as RadioModem uses them with the default configuration.
+static const unsigned sDownlinkScramblingCode = 16 * 469;		 // UMTS.Downlink.ScramblingCode
+static const unsigned sPRACHScramblingCode = sDownlinkScramblingCode + 0; // UMTS.PRACH.ScramblingCode
+static const unsigned sPRACHSignature = 13;				 // UMTS.PRACH.Signature
+static const unsigned sPRACHSFLog2 = 5;					 // UMTS.PRACH.SF
+static const unsigned sDelaySpread = 50;				 // UMTS.Radio.MaxExpectedDelaySpread
+static const unsigned sUplinkDCHScramblingCode = 1234;
+static const unsigned sDPCHOffset = 1024; // The uplink DPCH is this far behind the downlink.
+static const unsigned sBurstLen = gSlotLen + 1024 + sDelaySpread;
+static const float sPropagationDelay = 10.0; // Chips each way; the receivers expect about this much.
+
+// Downlink channels: the FACH on an SCCPCH and the DCH fill their slots with data, at the RadioModem amplitudes.
+static const unsigned sFACHSFLog2 = 6;
+static const unsigned sFACHCode = 1;
+static const unsigned sDlDCHSFLog2 = 5;
+static const unsigned sDlDCHCode = 2;
+static const float sCPICHAmplitude = 5.0;
+static const float sFACHAmplitude = 2.0; // RadioModem::mCCPCHAmplitude
+static const float sDCHAmplitude = 10.0;
+// Average downlink chip power: each channel is a QPSK symbol of its amplitude on I and Q, then a scrambling code
+// of power 2.  Everything is scaled to unit power, as is each UE's uplink.
+static const float sDownlinkScale = 1.0 / sqrtf(4.0 * (5.0 * 5.0 + 2.0 * 2.0 + 10.0 * 10.0));
+
+// Uplink DPCH: DPDCH at SF 32 on I, DPCCH with slot format 0 on Q, at equal gain.
+static const unsigned sUlDCHSFLog2 = 5;
+static const unsigned sNumPilots = 6;
+static const unsigned sNumTfc = 2; // TFCI 0 is no data, TFCI 1 is one transport block.
+
+// The UE sends a preamble in the access slot of UMTS.PRACH.Subchannel 1 that ends at slot 12 of every eighth
+// frame, and its message part when the AICH says, which with the downlink two frames ahead of the uplink is 80
+// slots later.  The message is done before the next preamble, which the modem would not look for until then.
+static const unsigned sRACHPeriod = 8;
+static const unsigned sPreambleFrame = 7;
+static const unsigned sPreambleSlot = 12;
+static const unsigned sMessageDelay = 80;
+static const unsigned sPreambleLen = 4096;
+static const unsigned sMessagePilots = 8;
+
+// Pass marks.  Above sMarginSNR every channel has a few dB in hand on the link budget except the FACH, which
+// starts with 15 dB less power than the CPICH and so only keeps its margin without fading, and the RACH, whose
+// single path receiver in the modem only keeps it there too.  Below it, only the AWGN channels that still have
+// margin are held to the mark.
+static const float sMaxBler = 0.1;
+static const float sMarginSNR = 3.0;
+static const unsigned sFalseAlarmFrames = 100; // At most one false alarm in this many frames.
+
+// Radio frame sizes in bits.
+static const unsigned sFACHFrameBits = 2 * (gSlotLen >> sFACHSFLog2) * gFrameSlots;
+static const unsigned sDlDCHFrameBits = 2 * (gSlotLen >> sDlDCHSFLog2) * gFrameSlots;
+static const unsigned sUlDCHFrameBits = (gSlotLen >> sUlDCHSFLog2) * gFrameSlots;
+static const unsigned sRACHFrameBits = (gSlotLen >> sPRACHSFLog2) * gFrameSlots;
+
+static const double sChipRate = 3.84e6;
+
+static DownlinkScramblingCode *sDownlinkCode;
+static UplinkScramblingCode *sUplinkDCHCode;
+static UplinkScramblingCode *sPRACHCode;
+
+/**@name Processor time by stage. */
+//@{
+enum Stage { ENCODE, MODULATE, CHANNEL, DEMODULATE, DECODE, OTHER, NUM_STAGES };
+static const char *sStageNames[NUM_STAGES] = {"encode", "modulate", "channel", "demodulate", "decode", "other"};
+static double sStageSeconds[NUM_STAGES];
+static Stage sStage = OTHER;
+static double sStageStart;
+
+static double cpuSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void switchStage(Stage stage)
+{
+	double now = cpuSeconds();
+	sStageSeconds[sStage] += now - sStageStart;
+	sStageStart = now;
+	sStage = stage;
+}
+
+// Charges the processor time of its scope to a stage, and none of it to the stage it interrupts.
+class StageTimer {
+	Stage mOuter;
+
+public:
+	StageTimer(Stage stage) : mOuter(sStage) { switchStage(stage); }
+	~StageTimer() { switchStage(mOuter); }
+};
+//@}
+
+static float fromDB(float x) { return powf(10.0F, x / 10.0F); }
+
+static float uniform(unsigned *seed) { return (float)rand_r(seed) / ((float)RAND_MAX + 1.0F); }
+
+// Unit power complex gaussian.
+static complex gaussian(unsigned *seed)
+{
+	float u1 = ((float)rand_r(seed) + 1.0F) / ((float)RAND_MAX + 1.0F);
+	float r = sqrtf(-logf(u1));
+	float a = 2.0F * M_PI * uniform(seed);
+	return complex(r * cosf(a), r * sinf(a));
+}
+
+// 25.212 4.2.1, as getParity does it.
+static void crc16(const BitVector &in, BitVector &parity)
+{
+	Parity p(TrCHConsts::mgcrc16, 16, 16 + in.size());
+	p.writeParityWord(in, parity);
+	parity.reverse();
+	parity.invert();
+}
+
+/*
+	One transport channel with a 10ms TTI and one transport format, coded as L1 codes it: CRC 16, rate 1/2
+	convolutional code, rate matching to the radio frame and 2nd interleaving; the 1st interleaver is the
+	identity at 10ms.  Decoding goes through the uplink scatter, which for a single TrCh with a 10ms TTI is the
+	downlink receive path as well, then the Viterbi decoder and the CRC check.
+*/
+class TrChCodec {
+	static const unsigned sCrcSize = 16;
+	static const unsigned sTailSize = 8;
+
+	unsigned mTbSize, mCodedSize, mFrameSize;
+	int mEini[8];
+	ViterbiR2O9 mCoder;
+	L1UplinkScatter mScatter;
+
+public:
+	TrChCodec(unsigned wTbSize, unsigned wFrameSize)
+		: mTbSize(wTbSize), mCodedSize(2 * (wTbSize + sCrcSize + sTailSize)), mFrameSize(wFrameSize)
+	{
+		rateMatchComputeUlEini(mCodedSize, mFrameSize, TTI10ms, mEini);
+		mScatter.build(mFrameSize, 0, mFrameSize, mCodedSize, mEini, 1, TrCHConsts::inter1Columns[TTI10ms],
+			TrCHConsts::inter1Perm[TTI10ms]);
+	}
+
+	unsigned tbSize() const { return mTbSize; }
+
+	void encode(const BitVector &tb, BitVector &frame)
+	{
+		BitVector block(mTbSize + sCrcSize + sTailSize);
+		block.zero();
+		tb.copyToSegment(block, 0);
+		BitVector parity(sCrcSize);
+		crc16(tb, parity);
+		parity.copyToSegment(block, mTbSize);
+		BitVector coded(mCodedSize);
+		block.encode(mCoder, coded);
+		BitVector matched(mFrameSize);
+		rateMatchFunc<char>(coded, matched, mEini[0]);
+		matched.interleavingNP(30, TrCHConsts::inter2Perm, frame);
+	}
+
+	/** Decode a radio frame of soft bits; return true if the CRC passes. */
+	bool decode(const SoftVector &frame, BitVector &tb)
+	{
+		SoftVector coded(mCodedSize);
+		mScatter.scatter(frame.begin(), 0, coded.begin());
+		BitVector block(mTbSize + sCrcSize + sTailSize);
+		coded.decode(mCoder, block);
+		block.head(mTbSize).copyTo(tb);
+		BitVector parity(sCrcSize);
+		crc16(tb, parity);
+		return parity == block.segment(mTbSize, sCrcSize);
+	}
+};
+
+/*
+	Traffic on one transport channel: a random transport block goes out in each frame the channel is used and
+	must come back intact.  A block that never comes back, because its preamble or its TFCI was missed, counts
+	as an error when its frame is finished.
+*/
+class TrCh {
+	static const unsigned sInFlight = 4; // Frames from sending to finishing, at most.
+
+	TrChCodec mCodec;
+	BitVector mSent[sInFlight];
+	int64_t mFrame[sInFlight];
+	bool mPending[sInFlight];
+	unsigned mSeed;
+
+public:
+	const char *mName;
+	unsigned mBlocks, mErrors;
+
+	TrCh(const char *wName, unsigned tbSize, unsigned frameSize, unsigned wSeed)
+		: mCodec(tbSize, frameSize), mSeed(wSeed), mName(wName), mBlocks(0), mErrors(0)
+	{
+		for (unsigned i = 0; i < sInFlight; i++) {
+			mSent[i].resize(tbSize);
+			mPending[i] = false;
+		}
+	}
+
+	/** A new block for the frame, coded into bits. */
+	void send(int64_t frame, BitVector &bits)
+	{
+		unsigned i = frame % sInFlight;
+		for (unsigned b = 0; b < mCodec.tbSize(); b++) {
+			mSent[i][b] = rand_r(&mSeed) & 1;
+		}
+		mFrame[i] = frame;
+		mPending[i] = true;
+		mBlocks++;
+		StageTimer timer(ENCODE);
+		mCodec.encode(mSent[i], bits);
+	}
+
+	/** The receiver's soft bits for the frame. */
+	void receive(int64_t frame, const SoftVector &soft)
+	{
+		unsigned i = frame % sInFlight;
+		if (!mPending[i] || mFrame[i] != frame) {
+			return;
+		}
+		mPending[i] = false;
+		StageTimer timer(DECODE);
+		BitVector tb(mCodec.tbSize());
+		if (!mCodec.decode(soft, tb) || !(tb == mSent[i])) {
+			mErrors++;
+		}
+	}
+
+	/** Frames are finished in order; a block still pending was lost. */
+	void finish(int64_t frame)
+	{
+		unsigned i = frame % sInFlight;
+		if (mPending[i] && mFrame[i] == frame) {
+			mPending[i] = false;
+			mErrors++;
+		}
+	}
+
+	float bler() const { return mBlocks ? (float)mErrors / mBlocks : 0.0; }
+
+	/** Kbits per second delivered over the given number of frames. */
+	float throughput(unsigned frames) const
+	{
+		return (float)(mBlocks - mErrors) * mCodec.tbSize() / (frames * gFrameMicroseconds * 1e-3);
+	}
+};
+
+struct Path {
+	float mDelay; // chips
+	float mPowerDB;
+};
+
+static const unsigned sMaxPaths = 6;
+
+struct Profile {
+	const char *mName;
+	float mDopplerHz; // 0 for no fading.
+	unsigned mNumPaths;
+	Path mPaths[sMaxPaths];
+};
+
+// ITU-R M.1225 delay profiles at 260.4 ns per chip, Doppler at 2 GHz.
+static const Profile sProfiles[] = {
+	{"AWGN", 0.0, 1, {{0.0, 0.0}}},
+	{"Pedestrian A, 3 km/h", 5.6, 4, {{0.0, 0.0}, {0.42, -9.7}, {0.73, -19.2}, {1.57, -22.8}}},
+	{"Vehicular A, 60 km/h", 111.0, 6,
+		{{0.0, 0.0}, {1.19, -1.0}, {2.73, -9.0}, {4.19, -10.0}, {6.65, -15.0}, {9.65, -20.0}}},
+};
+
+// Rayleigh fading of one path with unit mean power, by a sum of sinusoids at the Doppler shifts of arrival
+// angles spread round the circle.
+class Fader {
+	static const unsigned sSinusoids = 8;
+	double mOmega[sSinusoids]; // Radians per chip.
+	double mPhase[sSinusoids];
+
+public:
+	void init(float dopplerHz, unsigned *seed)
+	{
+		for (unsigned m = 0; m < sSinusoids; m++) {
+			double angle = 2.0 * M_PI * (m + uniform(seed)) / sSinusoids;
+			mOmega[m] = 2.0 * M_PI * dopplerHz * cos(angle) / sChipRate;
+			mPhase[m] = 2.0 * M_PI * uniform(seed);
+		}
+	}
+
+	complex gain(int64_t chip) const
+	{
+		double re = 0.0, im = 0.0;
+		for (unsigned m = 0; m < sSinusoids; m++) {
+			double a = mOmega[m] * chip + mPhase[m];
+			re += cos(a);
+			im += sin(a);
+		}
+		return complex(re, im) * (float)(1.0 / sqrt((double)sSinusoids));
+	}
+};
+
+/*
+	The receive side of the software radio device, for one antenna: what every link delivered over the last
+	few frames, in a ring.  A frame's chips are complete once everything that overlaps it has been sent, which
+	is one frame later since a frame only spreads a few chips into the one before it; then its noise is added
+	and the receivers may read it.
+*/
+class Antenna {
+	static const unsigned sFrames = 4;
+	static const unsigned sLen = sFrames * gFrameLen;
+
+	signalVector mRing;
+	float mNoiseAmplitude;
+	unsigned mSeed;
+
+	static unsigned index(int64_t chip) { return (unsigned)(((chip % sLen) + sLen) % sLen); }
+
+public:
+	Antenna(float noisePower, unsigned wSeed) : mRing(sLen), mNoiseAmplitude(sqrtf(noisePower)), mSeed(wSeed)
+	{
+		mRing.fill(0.0);
+	}
+
+	void clear(int64_t frame)
+	{
+		complex *p = mRing.begin() + index(frame * gFrameLen);
+		memset((void *)p, 0, gFrameLen * sizeof(complex));
+	}
+
+	void add(int64_t chip, const complex *in, unsigned n, complex gain)
+	{
+		unsigned i = index(chip);
+		for (unsigned k = 0; k < n; k++) {
+			mRing[i] += in[k] * gain;
+			if (++i == sLen) {
+				i = 0;
+			}
+		}
+	}
+
+	void addNoise(int64_t frame)
+	{
+		complex *p = mRing.begin() + index(frame * gFrameLen);
+		for (unsigned k = 0; k < gFrameLen; k++) {
+			p[k] += gaussian(&mSeed) * mNoiseAmplitude;
+		}
+	}
+
+	void read(int64_t chip, signalVector &out) const
+	{
+		unsigned i = index(chip);
+		for (unsigned k = 0; k < out.size(); k++) {
+			out[k] = mRing[i];
+			if (++i == sLen) {
+				i = 0;
+			}
+		}
+	}
+};
+
+// One radio link: a transmitted frame goes down each path of the profile with its own delay and fading and
+// arrives summed at the receive antenna.
+class Link {
+	static const unsigned sLead = 16;  // The fractional delay filter reaches 10 chips back...
+	static const unsigned sTrail = 48; // ...and the delays reach 20 chips forward.
+	static const unsigned sFadeBlock = 256; // Chips per fading gain update.
+
+	const Profile &mProfile;
+	Fader mFaders[sMaxPaths];
+	float mAmplitude[sMaxPaths];
+
+public:
+	Link(const Profile &wProfile, unsigned *seed) : mProfile(wProfile)
+	{
+		float total = 0.0;
+		for (unsigned p = 0; p < mProfile.mNumPaths; p++) {
+			total += fromDB(mProfile.mPaths[p].mPowerDB);
+		}
+		for (unsigned p = 0; p < mProfile.mNumPaths; p++) {
+			mAmplitude[p] = sqrtf(fromDB(mProfile.mPaths[p].mPowerDB) / total);
+			mFaders[p].init(mProfile.mDopplerHz, seed);
+		}
+	}
+
+	void send(const signalVector &tx, int64_t start, Antenna &antenna) const
+	{
+		StageTimer timer(CHANNEL);
+		signalVector delayed(sLead + tx.size() + sTrail);
+		for (unsigned p = 0; p < mProfile.mNumPaths; p++) {
+			delayed.fill(0.0);
+			tx.copyToSegment(delayed, sLead);
+			delayVector(delayed, sPropagationDelay + mProfile.mPaths[p].mDelay);
+			int64_t first = start - sLead;
+			for (unsigned i = 0; i < delayed.size(); i += sFadeBlock) {
+				complex gain = mAmplitude[p];
+				if (mProfile.mDopplerHz > 0.0) {
+					gain = mFaders[p].gain(first + i) * mAmplitude[p];
+				}
+				unsigned n = delayed.size() - i < sFadeBlock ? delayed.size() - i : sFadeBlock;
+				antenna.add(first + i, delayed.begin() + i, n, gain);
+			}
+		}
+	}
+};
+
+/*
+	The NodeB's physical layer, the RadioModem, with the RACH slots it decodes and the downlink clock it times
+	the AICH against supplied here rather than by the L1 and the NodeB.  Each burst of the software radio goes
+	to the RACH processor and to the processor of the one DCH, as receiveSlot queues it to them.
+*/
+class NodeB : public RadioModem {
+	UDPSocket &mRadio;
+	TrCh *mFACH, *mDlDCH, *mRACH, *mUlDCH;
+	DPDCH *mDPDCH;
+	Time mNow;	 // The next downlink slot.
+	int64_t mFrame; // The uplink frame being received.
+
+	float mMessageBits[sRACHFrameBits];
+	unsigned mMessageSlots;
+
+	void queue(const BitVector &bits, unsigned sfLog2, unsigned code, bool dch, int64_t frame)
+	{
+		unsigned perSlot = bits.size() / gFrameSlots;
+		for (unsigned s = 0; s < gFrameSlots; s++) {
+			TxBitsBurst *burst = new TxBitsBurst(1 << sfLog2, code, Time(frame % gHyperframe, s), dch, false);
+			burst->clone(bits.segment(s * perSlot, perSlot));
+			bool refused;
+			Time updateTime;
+			addBurst(burst, refused, updateTime);
+			if (refused) {
+				delete burst;
+			}
+		}
+	}
+
+	// decodeRACHMessage puts out the message part slot by slot once it has the whole of it, despread at SF 32
+	// only if it found TFCI 1.
+	void writeRACHSlot(const RxBitsBurst &slot)
+	{
+		unsigned perSlot = sRACHFrameBits / gFrameSlots;
+		if (mMessageSlots == gFrameSlots || slot.size() != perSlot) {
+			return;
+		}
+		memcpy(mMessageBits + mMessageSlots * perSlot, slot.begin(), perSlot * sizeof(float));
+		if (++mMessageSlots == gFrameSlots) {
+			mRACH->receive(mFrame, SoftVector(mMessageBits, sRACHFrameBits));
+		}
+	}
+
+	Time downlinkTime() { return mNow; }
+
+public:
+	unsigned mLate;
+
+	NodeB(UDPSocket &wData, UDPSocket &wRadio) : RadioModem(wData), mRadio(wRadio), mDPDCH(NULL), mMessageSlots(gFrameSlots), mLate(0) {}
+
+	/** Start a run with new transport channels, and a new DCH. */
+	void start(TrCh &wFACH, TrCh &wDlDCH, TrCh &wRACH, TrCh &wUlDCH)
+	{
+		mFACH = &wFACH;
+		mDlDCH = &wDlDCH;
+		mRACH = &wRACH;
+		mUlDCH = &wUlDCH;
+		delete mDPDCH;
+		mDPDCH = new DPDCH(NULL, Time(0, 0), newRakeReceiver());
+		mDPDCH->active = false;
+		mLate = 0;
+	}
+
+	/** The MAC's part: a FACH and a DCH block for the frame, queued ahead of the transmitter. */
+	void queue(int64_t frame)
+	{
+		BitVector fach(sFACHFrameBits), dch(sDlDCHFrameBits);
+		mFACH->send(frame, fach);
+		mDlDCH->send(frame, dch);
+		queue(fach, sFACHSFLog2, sFACHCode, false, frame);
+		queue(dch, sDlDCHSFLog2, sDlDCHCode, true, frame);
+	}
+
+	/** RadioModem::transmitSlot for each slot of the frame, and the radio's read of them from the socket. */
+	void transmit(int64_t frame, signalVector &out)
+	{
+		StageTimer timer(MODULATE);
+		for (unsigned s = 0; s < gFrameSlots; s++) {
+			bool underrun;
+			Time now(frame % gHyperframe, s);
+			transmitSlot(now, underrun);
+			mLate += underrun;
+			mNow = now + 1;
+
+			char buffer[MAX_UDP_LENGTH];
+			int len = mRadio.read(buffer);
+			assert(len == 2 * (int)gSlotLen + 4);
+			const signed char *rp = (const signed char *)buffer + 3;
+			for (unsigned n = 0; n < gSlotLen; n++) {
+				out[s * gSlotLen + n] = complex(rp[2 * n], rp[2 * n + 1]) * sDownlinkScale;
+			}
+		}
+	}
+
+	/** Receive one uplink burst; true if the RACH processor found a preamble in it. */
+	bool receive(const signalVector &burst, int64_t frame, unsigned slot)
+	{
+		StageTimer timer(DEMODULATE);
+		Time time(frame % gHyperframe, slot);
+		mFrame = frame;
+
+		// RACHLoopAdapter.
+		signalVector rachBurst(burst);
+		bool preamble = detectRACHPreamble(rachBurst, time, mRACHThreshold);
+		if (preamble) {
+			mMessageSlots = 0;
+		}
+		decodeRACHMessage(rachBurst, time, 5.0);
+
+		// DCHLoopAdapter.
+		signalVector dchBurst(burst);
+		DPDCH &dpdch = *mDPDCH;
+		if (slot == 0) {
+			dpdch.frameTime = time;
+			dpdch.active = true;
+			dpdch.bestSNR = -1000.0;
+			dpdch.pilotSIR.reset();
+		}
+		if (!dpdch.active) {
+			return preamble;
+		}
+		dpdch.active = decodeDCH(dchBurst, time, sUplinkDCHScramblingCode, sNumPilots, dpdch.descrambledBurst,
+			dpdch.rawBurst, dpdch.lastTOA, dpdch.bestTOA, dpdch.bestChannel, dpdch.bestSNR, dpdch.tfciBits,
+			dpdch.tpcBits, dpdch.pilotSIR, dpdch.rake);
+		if (slot == gFrameSlots - 1 && findTfci(dpdch.tfciBits, sNumTfc) != 0) {
+			unsigned sf = 1 << sUlDCHSFLog2;
+			decodeDPDCHFrame(dpdch, sUplinkDCHScramblingCode, sUlDCHSFLog2, sf / 4);
+			// FECDispatchLoopAdapter.
+			FECDispatchInfo *q = mDispatchQueue.read();
+			mUlDCH->receive(frame, *q->burst);
+			delete[] q->burst->begin();
+			delete q->burst;
+			delete q;
+		}
+		return preamble;
+	}
+
+	/** Have the generator thread build the DCH's uplink code, as it does when the DCH is opened. */
+	void prepare()
+	{
+		prepareUplink(sUplinkDCHScramblingCode, sNumPilots);
+		DPDCH probe(NULL, Time(0, 0));
+		signalVector burst(sBurstLen);
+		burst.fill(0.0);
+		while (!decodeDCH(burst, Time(0, 0), sUplinkDCHScramblingCode, sNumPilots, probe.descrambledBurst,
+			probe.rawBurst, probe.lastTOA, probe.bestTOA, probe.bestChannel, probe.bestSNR, probe.tfciBits,
+			probe.tpcBits, probe.pilotSIR)) {
+			usleep(1000);
+		}
+	}
+};
+
+// UE uplink DPCH: the DPDCH on I, the DPCCH with slot format 0 on Q, at equal gain and unit power, scrambled.
+static void modulateDPCH(const BitVector &data, unsigned tfci, signalVector &tx)
+{
+	StageTimer timer(MODULATE);
+	unsigned sf = 1 << sUlDCHSFLog2;
+	const int8_t *dataCode = gOVSFTree.code(sUlDCHSFLog2, sf / 4);
+	const int8_t *controlCode = gOVSFTree.code(8, 0);
+	uint32_t tfciCode = TrCHConsts::sTfciCodes[tfci];
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		bool control[10];
+		for (unsigned i = 0; i < sNumPilots; i++) {
+			control[i] = gPilotPatterns[sNumPilots - 3][slot].bit(i);
+		}
+		control[6] = (tfciCode >> (2 * slot)) & 1;
+		control[7] = (tfciCode >> (2 * slot + 1)) & 1;
+		control[8] = control[9] = 0; // TPC
+		for (unsigned c = 0; c < gSlotLen; c++) {
+			unsigned n = slot * gSlotLen + c;
+			float I = (data.bit(n / sf) ? -0.5 : 0.5) * dataCode[c % sf];
+			float Q = (control[c / 256] ? -0.5 : 0.5) * controlCode[c % 256];
+			tx[n] = complex(I, Q) * complex(sUplinkDCHCode->ICode()[n], sUplinkDCHCode->QCode()[n]);
+		}
+	}
+}
+
+// UE RACH preamble: the signature repeated, scrambled and rotated, as generateRACHPreambleTable expects.
+static void modulatePreamble(signalVector &tx)
+{
+	StageTimer timer(MODULATE);
+	for (unsigned n = 0; n < sPreambleLen; n++) {
+		float chip = (gRACHSignatures[sPRACHSignature].bit(n % 16) ? -1.0 : 1.0) * sPRACHCode->ICode()[n];
+		float arg = M_PI / 4.0 + M_PI / 2.0 * (n % 4);
+		tx[n] = complex(chip * cosf(arg), chip * sinf(arg));
+	}
+}
+
+// UE RACH message part: data on I, 8 pilots and the TFCI on Q, scrambled from chip 4096 of the code.
+static void modulateMessage(const BitVector &data, unsigned tfci, signalVector &tx)
+{
+	StageTimer timer(MODULATE);
+	unsigned sf = 1 << sPRACHSFLog2;
+	const int8_t *dataCode = gOVSFTree.code(sPRACHSFLog2, sf * sPRACHSignature / 16);
+	const int8_t *controlCode = gOVSFTree.code(8, 16 * sPRACHSignature + 15);
+	uint32_t tfciCode = TrCHConsts::sTfciCodes[tfci];
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		bool control[10];
+		for (unsigned i = 0; i < sMessagePilots; i++) {
+			control[i] = gRACHMessagePilots[slot].bit(i);
+		}
+		control[8] = (tfciCode >> (2 * slot)) & 1;
+		control[9] = (tfciCode >> (2 * slot + 1)) & 1;
+		for (unsigned c = 0; c < gSlotLen; c++) {
+			unsigned n = slot * gSlotLen + c;
+			float I = (data.bit(n / sf) ? -0.5 : 0.5) * dataCode[c % sf];
+			float Q = (control[c / 256] ? -0.5 : 0.5) * controlCode[c % 256];
+			unsigned k = sPreambleLen + n;
+			tx[n] = complex(I, Q) * complex(sPRACHCode->ICode()[k], sPRACHCode->QCode()[k]);
+		}
+	}
+}
+
+/*
+	The UE's downlink receiver, a RAKE on the CPICH.  Each slot the CPICH is correlated at every lag of the
+	search window, which serves both as the path search and as each finger's channel estimate.  Fingers go on
+	the strongest lags of the averaged profile, and are maximal ratio combined into descrambled chips.
+*/
+class UEReceiver {
+	static const unsigned sMaxFingers = 4;
+	static const unsigned sProfileSlots = 16;
+
+	float mProfile[64];
+	bool mFirst;
+
+public:
+	static const unsigned sSearch = 32; ///< Lags searched from the frame start.
+
+	UEReceiver() : mFirst(true) {}
+
+	/** rx starts at the frame start and has sSearch chips past the end of it. */
+	void receive(const signalVector &rx, signalVector &chips)
+	{
+		StageTimer timer(DEMODULATE);
+		const complex pilot = complex(-sCPICHAmplitude, -sCPICHAmplitude);
+		for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+			unsigned base = slot * gSlotLen;
+			const int8_t *cI = sDownlinkCode->ICode() + base;
+			const int8_t *cQ = sDownlinkCode->QCode() + base;
+			complex h[sSearch];
+			float max = 0.0, mean = 0.0;
+			for (unsigned d = 0; d < sSearch; d++) {
+				const complex *in = rx.begin() + base + d;
+				float re = 0.0, im = 0.0;
+				for (unsigned n = 0; n < gSlotLen; n++) {
+					// in * conj(code)
+					re += in[n].real() * cI[n] + in[n].imag() * cQ[n];
+					im += in[n].imag() * cI[n] - in[n].real() * cQ[n];
+				}
+				h[d] = complex(re, im) / (pilot * (float)(2 * gSlotLen));
+				float p = h[d].norm2();
+				mProfile[d] = mFirst ? p : mProfile[d] + (p - mProfile[d]) / sProfileSlots;
+				max = mProfile[d] > max ? mProfile[d] : max;
+				mean += mProfile[d] / sSearch;
+			}
+			mFirst = false;
+
+			// Strongest lags first, within 10 dB of the best and well clear of the average.
+			unsigned fingers[sMaxFingers], numFingers = 0;
+			bool taken[sSearch] = {false};
+			while (numFingers < sMaxFingers) {
+				int best = -1;
+				for (unsigned d = 0; d < sSearch; d++) {
+					if (!taken[d] && (best < 0 || mProfile[d] > mProfile[best])) {
+						best = d;
+					}
+				}
+				if (mProfile[best] < 0.1 * max || mProfile[best] < 2.0 * mean) {
+					break;
+				}
+				taken[best] = true;
+				fingers[numFingers++] = best;
+			}
+
+			float total = 0.0;
+			for (unsigned f = 0; f < numFingers; f++) {
+				total += h[fingers[f]].norm2();
+			}
+			complex *out = chips.begin() + base;
+			for (unsigned n = 0; n < gSlotLen; n++) {
+				out[n] = 0.0;
+			}
+			if (total == 0.0) {
+				continue;
+			}
+			for (unsigned f = 0; f < numFingers; f++) {
+				complex weight = h[fingers[f]].conj() / (2.0F * total);
+				const complex *in = rx.begin() + base + fingers[f];
+				for (unsigned n = 0; n < gSlotLen; n++) {
+					out[n] += in[n] * complex(cI[n], -cQ[n]) * weight;
+				}
+			}
+		}
+	}
+};
+
+// Despread one downlink code into soft bits, even bits from I and odd from Q as spread puts them.
+static void despreadDownlink(const signalVector &chips, unsigned sfLog2, unsigned index, float amplitude, SoftVector &soft)
+{
+	StageTimer timer(DEMODULATE);
+	unsigned sf = 1 << sfLog2;
+	const int8_t *code = gOVSFTree.code(sfLog2, index);
+	for (unsigned k = 0; k < soft.size() / 2; k++) {
+		complex acc = 0.0;
+		const complex *in = chips.begin() + k * sf;
+		for (unsigned c = 0; c < sf; c++) {
+			acc += in[c] * (float)code[c];
+		}
+		soft[2 * k] = 0.5 + acc.real() / (2.0 * sf * amplitude);
+		soft[2 * k + 1] = 0.5 + acc.imag() / (2.0 * sf * amplitude);
+	}
+}
+
+struct Result {
+	float mBler[4];
+	unsigned mErrors[4];
+	float mThroughput; // All channels, kbits/s.
+	unsigned mPreambles, mMissed, mFalseAlarms, mLate;
+};
+
+static int64_t sFrame = 0; // The next run starts here, so the modem's clock only goes forward.
+
+// Run one profile at one noise level.  Each step sends a frame on every link, then receives the frame before
+// last, whose chips are all in by then.
+static Result simulate(NodeB &nodeB, const Profile &profile, float snrDB, unsigned frames, unsigned seed)
+{
+	float noisePower = fromDB(-snrDB);
+	Antenna nodeBAntenna(noisePower, seed + 1), dchAntenna(noisePower, seed + 2), fachAntenna(noisePower, seed + 3);
+	unsigned linkSeed = seed;
+	Link toDCH(profile, &linkSeed), toFACH(profile, &linkSeed), fromDCH(profile, &linkSeed), fromRACH(profile, &linkSeed);
+
+	TrCh fach("FACH", 360, sFACHFrameBits, seed + 4);
+	TrCh dlDCH("DL DCH", 1000, sDlDCHFrameBits, seed + 5);
+	TrCh rach("RACH", 168, sRACHFrameBits, seed + 6);
+	TrCh ulDCH("UL DCH", 336, sUlDCHFrameBits, seed + 7);
+	TrCh *trchs[4] = {&fach, &dlDCH, &rach, &ulDCH};
+	nodeB.start(fach, dlDCH, rach, ulDCH);
+	UEReceiver dchUE, fachUE;
+
+	signalVector downlink(gFrameLen), uplink(gFrameLen), preamble(sPreambleLen);
+	signalVector window(gFrameLen + UEReceiver::sSearch), chips(gFrameLen), burst(sBurstLen);
+	BitVector ulBits(sUlDCHFrameBits), rachBits(sRACHFrameBits);
+	SoftVector dlDCHSoft(sDlDCHFrameBits), fachSoft(sFACHFrameBits);
+	Result result;
+	result.mPreambles = result.mMissed = result.mFalseAlarms = 0;
+	unsigned late = nodeB.mLate;
+
+	// Slots are numbered from frame 0.  The last preamble's message part is done before the last frame.
+	const int64_t first = sFrame, last = sFrame + frames;
+	const unsigned messageFrames = (sPreambleSlot + sMessageDelay + gFrameSlots - 1) / gFrameSlots + 1;
+	int64_t preambleSlot = -1, messageSlot = -1;
+	sFrame = last + sRACHPeriod;
+
+	for (int64_t k = first; k < last + 2; k++) {
+		nodeBAntenna.clear(k + 1);
+		dchAntenna.clear(k + 1);
+		fachAntenna.clear(k + 1);
+
+		if (k < last) {
+			nodeB.queue(k);
+			nodeB.transmit(k, downlink);
+			toDCH.send(downlink, k * gFrameLen, dchAntenna);
+			toFACH.send(downlink, k * gFrameLen, fachAntenna);
+
+			ulDCH.send(k, ulBits);
+			modulateDPCH(ulBits, 1, uplink);
+			fromDCH.send(uplink, k * gFrameLen + sDPCHOffset, nodeBAntenna);
+			if (k % sRACHPeriod == sPreambleFrame && k + messageFrames <= last) {
+				preambleSlot = k * gFrameSlots + sPreambleSlot;
+				modulatePreamble(preamble);
+				fromRACH.send(preamble, preambleSlot * gSlotLen, nodeBAntenna);
+				result.mPreambles++;
+			}
+			// The message part goes once the AICH has answered the preamble.
+			if (messageSlot >= 0 && messageSlot / gFrameSlots == k) {
+				rach.send((messageSlot + gFrameSlots - 1) / gFrameSlots, rachBits);
+				modulateMessage(rachBits, 1, uplink);
+				fromRACH.send(uplink, messageSlot * gSlotLen, nodeBAntenna);
+				messageSlot = -1;
+			}
+		}
+		if (k >= first + 1) {
+			StageTimer timer(CHANNEL);
+			nodeBAntenna.addNoise(k - 1);
+			dchAntenna.addNoise(k - 1);
+			fachAntenna.addNoise(k - 1);
+		}
+
+		int64_t j = k - 2;
+		if (j < first) {
+			continue;
+		}
+		dchAntenna.read(j * gFrameLen, window);
+		dchUE.receive(window, chips);
+		despreadDownlink(chips, sDlDCHSFLog2, sDlDCHCode, sDCHAmplitude, dlDCHSoft);
+		dlDCH.receive(j, dlDCHSoft);
+		fachAntenna.read(j * gFrameLen, window);
+		fachUE.receive(window, chips);
+		despreadDownlink(chips, sFACHSFLog2, sFACHCode, sFACHAmplitude, fachSoft);
+		fach.receive(j, fachSoft);
+
+		for (unsigned s = 0; s < gFrameSlots; s++) {
+			int64_t slot = j * gFrameSlots + s;
+			nodeBAntenna.read(slot * gSlotLen, burst);
+			if (!nodeB.receive(burst, j, s)) {
+				continue;
+			}
+			if (slot == preambleSlot) {
+				messageSlot = slot + sMessageDelay;
+				preambleSlot = -1;
+			} else {
+				result.mFalseAlarms++;
+			}
+		}
+		if (preambleSlot >= 0 && preambleSlot / gFrameSlots == j) {
+			result.mMissed++;
+			preambleSlot = -1;
+		}
+
+		for (unsigned t = 0; t < 4; t++) {
+			trchs[t]->finish(j);
+		}
+	}
+
+	// Idle up to the next run, so anything the modem queued past the end, an AICH say, still goes out on time.
+	for (int64_t k = last; k < sFrame; k++) {
+		nodeB.transmit(k, downlink);
+	}
+
+	result.mThroughput = 0.0;
+	for (unsigned t = 0; t < 4; t++) {
+		result.mBler[t] = trchs[t]->bler();
+		result.mErrors[t] = trchs[t]->mErrors;
+		result.mThroughput += trchs[t]->throughput(frames);
+	}
+	result.mLate = nodeB.mLate - late;
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("PhyLoopbackTest", "NOTICE");
+	gConfig.set("UMTS.Radio.MaxExpectedDelaySpread", sDelaySpread);
+	gConfig.set("UMTS.Radio.RakeFingers", 4);
+	gConfig.set("UMTS.Downlink.ScramblingCode", sDownlinkScramblingCode / 16);
+	gConfig.set("UMTS.PRACH.ScramblingCode", sPRACHScramblingCode - sDownlinkScramblingCode);
+	gConfig.set("UMTS.PRACH.Signature", sPRACHSignature);
+	gConfig.set("UMTS.PRACH.Subchannel", 1);
+	gConfig.set("UMTS.PRACH.SF", 1 << sPRACHSFLog2);
+
+	unsigned frames = argc > 1 ? atoi(argv[1]) : 40;
+	sDownlinkCode = new DownlinkScramblingCode(sDownlinkScramblingCode);
+	sUplinkDCHCode = new UplinkScramblingCode(sUplinkDCHScramblingCode);
+	sPRACHCode = new UplinkScramblingCode(sPRACHScramblingCode);
+
+	// The modem writes the downlink to the radio's socket.  It has threads that never start, so it is not
+	// destroyed.
+	UDPSocket radio(0);
+	UDPSocket data(0, "127.0.0.1", radio.port());
+	NodeB *nodeB = new NodeB(data, radio);
+	nodeB->prepare();
+
+	const float snrs[] = {-6.0, -3.0, 0.0, 3.0, 6.0, 10.0};
+	const unsigned numSnrs = sizeof(snrs) / sizeof(snrs[0]);
+	const unsigned numProfiles = sizeof(sProfiles) / sizeof(sProfiles[0]);
+	bool awgn = true, faded = true, gaining = true, onTime = true, found = true;
+	unsigned simulated = 0, falseAlarms = 0;
+
+	printf("%u frames per point; FACH SF %u, DL DCH SF %u, RACH SF %u, UL DCH SF %u; chip SNR in dB\n", frames,
+		1 << sFACHSFLog2, 1 << sDlDCHSFLog2, 1 << sPRACHSFLog2, 1 << sUlDCHSFLog2);
+	sStageStart = cpuSeconds();
+	for (unsigned p = 0; p < numProfiles; p++) {
+		printf("%s\n  %6s %8s %8s %8s %8s %10s %6s %8s\n", sProfiles[p].mName, "SNR", "FACH", "DL DCH", "RACH",
+			"UL DCH", "preamble", "false", "kbit/s");
+		Result first, last;
+		for (unsigned s = 0; s < numSnrs; s++) {
+			Result r = simulate(*nodeB, sProfiles[p], snrs[s], frames, 1000 * p + 10 * s);
+			simulated += frames;
+			printf("  %6.1f %8.4f %8.4f %8.4f %8.4f %4u of %3u %6u %8.1f\n", snrs[s], r.mBler[0], r.mBler[1],
+				r.mBler[2], r.mBler[3], r.mPreambles - r.mMissed, r.mPreambles, r.mFalseAlarms,
+				r.mThroughput);
+			if (s == 0) {
+				first = r;
+			}
+			last = r;
+			onTime &= r.mLate == 0;
+			falseAlarms += r.mFalseAlarms;
+			if (!sProfiles[p].mDopplerHz) {
+				awgn &= r.mBler[1] <= sMaxBler && r.mBler[2] <= sMaxBler && r.mBler[3] <= sMaxBler;
+				awgn &= snrs[s] < sMarginSNR || r.mBler[0] <= sMaxBler;
+				found &= r.mMissed == 0;
+			} else if (snrs[s] >= sMarginSNR) {
+				faded &= r.mBler[1] <= sMaxBler && r.mBler[3] <= sMaxBler;
+			}
+		}
+		gaining &= last.mThroughput >= first.mThroughput;
+	}
+	switchStage(OTHER);
+
+	double total = 0.0;
+	for (unsigned s = 0; s < NUM_STAGES; s++) {
+		total += sStageSeconds[s];
+	}
+	printf("processor time per 10 ms frame, NodeB and both UEs:\n");
+	for (unsigned s = 0; s < NUM_STAGES; s++) {
+		printf("  %-12s %8.0f us %5.1f%%\n", sStageNames[s], 1e6 * sStageSeconds[s] / simulated,
+			100.0 * sStageSeconds[s] / total);
+	}
+	printf("  %-12s %8.0f us, %.1f times real time\n", "total", 1e6 * total / simulated,
+		total / (simulated * gFrameMicroseconds * 1e-6));
+
+	check("AWGN: BLER within the mark where there is margin", awgn);
+	check("fading: DCH BLER within the mark above 3 dB", faded);
+	check("AWGN: every preamble found", found);
+	check("under one RACH false alarm in 100 frames", falseAlarms * sFalseAlarmFrames <= simulated);
+	check("more throughput at the highest SNR than the lowest", gaining);
+	check("every downlink burst went out on time", onTime);
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
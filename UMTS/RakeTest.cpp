@@ -0,0 +1,293 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Uplink DPCH through a simulated multipath channel, received with the single path receiver and with the RAKE.
+// Each frame carries one rate 1/2 convolutionally coded block on a SF 64 DPDCH; the block error rate of both
+// receivers is printed for AWGN and for the ITU Pedestrian B and Vehicular A delay profiles.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <CommonLibs/Utils.h>
+
+#include "UMTSCodes.h"
+#include "UMTSRadioModemSequences.h"
+#include "UMTSRake.h"
+
+using namespace std;
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+// Same layout as RadioModem: the uplink DPCH starts mDPCHOffset chips, plus a little group delay,
+// into a receive burst of gSlotLen + 1024 + MaxExpectedDelaySpread chips.
+static const unsigned sDPCHOffset = 1024;
+static const unsigned sNominalTOA = sDPCHOffset + 10;
+static const unsigned sDelaySpread = 50;
+static const unsigned sBurstLen = gSlotLen + 1024 + sDelaySpread;
+static const unsigned sPilotOffset = 384;
+static const unsigned sPilotFilterLen = 256;
+
+// Slot format 0: 6 pilots, 2 TFCI, 2 TPC.
+static const unsigned sNumPilots = 6;
+static const unsigned sDataSFLog2 = 6;
+static const unsigned sDataSF = 1 << sDataSFLog2;
+static const unsigned sCodedBits = gFrameLen / sDataSF;
+static const unsigned sTailBits = 8;
+static const unsigned sInfoBits = sCodedBits / 2 - sTailBits;
+
+struct Path {
+	float mDelay; // chips
+	float mPowerDB;
+};
+
+struct Profile {
+	const char *mName;
+	bool mFading;
+	unsigned mNumPaths;
+	Path mPaths[6];
+};
+
+// ITU-R M.1225 delay profiles, at 260.4 ns per chip.
+static const Profile sProfiles[] = {
+	{"AWGN", false, 1, {{0.0, 0.0}}},
+	{"AWGN, half chip offset", false, 1, {{0.5, 0.0}}},
+	{"Pedestrian B", true, 6, {{0.0, 0.0}, {0.77, -0.9}, {3.07, -4.9}, {4.61, -8.0}, {8.83, -7.8}, {14.21, -23.9}}},
+	{"Vehicular A", true, 6, {{0.0, 0.0}, {1.19, -1.0}, {2.73, -9.0}, {4.19, -10.0}, {6.65, -15.0}, {9.65, -20.0}}},
+};
+
+static UplinkScramblingCode *sScrambling;
+static signalVector *sPilotFilters[gFrameSlots];
+
+// dBinv only covers gains below 0 dB.
+static float fromDB(float x) { return powf(10.0F, x / 10.0F); }
+
+static float gaussian(unsigned *seed)
+{
+	float u1 = ((float)rand_r(seed) + 1.0F) / ((float)RAND_MAX + 1.0F);
+	float u2 = (float)rand_r(seed) / (float)RAND_MAX;
+	return sqrtf(-2.0F * logf(u1)) * cosf(2.0F * M_PI * u2);
+}
+
+static complex chip(unsigned n, float I, float Q)
+{
+	return complex(I, Q) * complex(sScrambling->ICode()[n], sScrambling->QCode()[n]);
+}
+
+// The pilot matched filters, built the same way as UplinkCodeBank::buildPilots.
+static void makePilotFilters()
+{
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		signalVector pilotChips(sPilotFilterLen);
+		for (unsigned i = 0; i < sPilotFilterLen; i++) {
+			unsigned c = sPilotOffset + i;
+			float pilot = gPilotPatterns[sNumPilots - 3][slot].bit(c / 256) ? -1.0 : 1.0;
+			pilotChips[i] = chip(slot * gSlotLen + c, 0.0, pilot);
+		}
+		sPilotFilters[slot] = reverseConjugate(&pilotChips);
+	}
+}
+
+// One frame of DPDCH on I and DPCCH on Q, at equal gain, scrambled.
+static void modulateFrame(const BitVector &coded, unsigned *seed, signalVector &tx)
+{
+	const int8_t *dataCode = gOVSFTree.code(sDataSFLog2, sDataSF / 4);
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		char control[10];
+		for (unsigned i = 0; i < sNumPilots; i++)
+			control[i] = gPilotPatterns[sNumPilots - 3][slot].bit(i);
+		for (unsigned i = sNumPilots; i < 10; i++)
+			control[i] = rand_r(seed) & 1;
+		for (unsigned c = 0; c < gSlotLen; c++) {
+			unsigned n = slot * gSlotLen + c;
+			float I = (coded.bit(n / sDataSF) ? -1.0 : 1.0) * dataCode[c % sDataSF];
+			float Q = control[c / 256] ? -1.0 : 1.0;
+			tx[n] = chip(n, I, Q);
+		}
+	}
+}
+
+// Pass tx through the channel and add noise.  The result is laid out like a run of receive bursts, with
+// the frame starting sNominalTOA chips in.
+static void channel(const Profile &profile, const signalVector &tx, float noisePower, unsigned *seed, signalVector &rx)
+{
+	rx.fill(0.0);
+	float total = 0.0;
+	for (unsigned p = 0; p < profile.mNumPaths; p++)
+		total += fromDB(profile.mPaths[p].mPowerDB);
+	for (unsigned p = 0; p < profile.mNumPaths; p++) {
+		const Path &path = profile.mPaths[p];
+		complex gain = sqrtf(fromDB(path.mPowerDB) / total);
+		if (profile.mFading)
+			gain = gain * complex(gaussian(seed), gaussian(seed)) * (float)M_SQRT1_2;
+		signalVector delayed(rx.size());
+		delayed.fill(0.0);
+		tx.copyToSegment(delayed, sNominalTOA);
+		delayVector(delayed, path.mDelay);
+		for (unsigned i = 0; i < rx.size(); i++)
+			rx[i] += delayed[i] * gain;
+	}
+	// Each transmitted chip has power 4.
+	signalVector *noise = gaussianNoise(rx.size(), 4.0 * noisePower / 2.0);
+	for (unsigned i = 0; i < rx.size(); i++)
+		rx[i] += (*noise)[i];
+	delete noise;
+}
+
+static void descramble(const signalVector &in, unsigned start, signalVector &out)
+{
+	for (unsigned i = 0; i < in.size(); i++)
+		out[i] = in[i] * complex(sScrambling->ICode()[start + i], -sScrambling->QCode()[start + i]);
+}
+
+// Despread DPDCH and turn it into soft bits the way decodeDPDCHFrame does.
+static void softBits(const signalVector &descrambled, SoftVector &soft)
+{
+	const int8_t *dataCode = gOVSFTree.code(sDataSFLog2, sDataSF / 4);
+	float bitScale = -0.5 / ((float)sDataSF * 2.0);
+	for (unsigned b = 0; b < sCodedBits; b++) {
+		float acc = 0.0;
+		for (unsigned c = 0; c < sDataSF; c++)
+			acc += descrambled[b * sDataSF + c].real() * dataCode[c];
+		soft[b] = bitScale * acc + 0.5;
+	}
+}
+
+// The single path receiver, as RadioModem::decodeDCH and decodeDPDCHFrame do it when UMTS.Radio.RakeFingers
+// is 0: the frame is delayed and scaled by the estimate from slot 0.
+class SinglePath {
+	float mGuessTOA;
+
+public:
+	SinglePath() : mGuessTOA(-10000.0) {}
+
+	void receive(signalVector &rx, signalVector &descrambled)
+	{
+		float startTOA = sDPCHOffset + sPilotOffset + 10.0;
+		float corrWindow = 40.0;
+		if (mGuessTOA > -5000.0) {
+			startTOA = mGuessTOA + sPilotOffset;
+			corrWindow = 5.0;
+		}
+		unsigned maxTOA = corrWindow * 2 + 1;
+		signalVector correlated(maxTOA);
+		correlate(&rx, sPilotFilters[0], &correlated, CUSTOM, true,
+			(sPilotFilters[0]->size() - 1) + (unsigned)(startTOA - corrWindow), maxTOA);
+		float TOA, meanPower = 1.0;
+		complex channel = peakDetect(correlated, &TOA, &meanPower);
+		float SNR = meanPower != 0.0 ? channel.norm2() / meanPower : -100.0;
+		TOA += (unsigned)(startTOA - corrWindow) - sPilotOffset;
+		channel = channel / (float)(2 * sPilotFilterLen);
+		if (channel == complex(0, 0))
+			channel = complex(1e6, 1e6);
+		mGuessTOA = SNR > 3.0 ? TOA : -10000.0;
+
+		signalVector raw(gFrameLen + gSlotLen);
+		rx.segmentCopyTo(raw, 0, raw.size());
+		delayVector(raw, -TOA);
+		signalVector trunc(raw.begin(), 0, gFrameLen);
+		scaleVector(trunc, complex(1.0, 0.0) / channel);
+		descramble(trunc, 0, descrambled);
+	}
+};
+
+// The RAKE receiver as decodeDCH runs it, slot by slot.
+static void rakeReceive(RakeReceiver &rake, signalVector &rx, signalVector &descrambled)
+{
+	signalVector combined(gSlotLen);
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		signalVector burst = rx.segment(slot * gSlotLen, sBurstLen);
+		rake.search(burst, sPilotFilters[slot], sPilotOffset);
+		rake.estimate(burst, sScrambling->ICode() + slot * gSlotLen, sScrambling->QCode() + slot * gSlotLen,
+			gPilotPatterns[sNumPilots - 3][slot]);
+		rake.combine(burst, combined);
+		signalVector out = descrambled.segment(slot * gSlotLen, gSlotLen);
+		descramble(combined, slot * gSlotLen, out);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("RakeTest", "NOTICE");
+	sigProcLibSetup(1);
+	srand(1);
+
+	unsigned frames = argc > 1 ? atoi(argv[1]) : 100;
+	sScrambling = new UplinkScramblingCode(1234);
+	makePilotFilters();
+	ViterbiR2O9 coder;
+	const float snrs[] = {-15.0, -12.0, -9.0, -6.0};
+	const unsigned numSnrs = sizeof(snrs) / sizeof(snrs[0]);
+	bool ok = true;
+
+	printf("%u frames per point, %u bit blocks, SF %u, chip SNR in dB\n", frames, sInfoBits, sDataSF);
+	for (unsigned p = 0; p < sizeof(sProfiles) / sizeof(sProfiles[0]); p++) {
+		const Profile &profile = sProfiles[p];
+		printf("%s\n  %8s %12s %12s\n", profile.mName, "SNR", "single BLER", "rake BLER");
+		for (unsigned s = 0; s < numSnrs; s++) {
+			unsigned seed = 1000 * p + s;
+			float noisePower = fromDB(-snrs[s]);
+			SinglePath single;
+			RakeReceiver rake(4, sNominalTOA - 40, sDelaySpread + 1024 - (sNominalTOA - 40) + 1);
+			unsigned singleErrors = 0, rakeErrors = 0;
+			double singleTime = 0.0, rakeTime = 0.0;
+			for (unsigned f = 0; f < frames; f++) {
+				BitVector info(sInfoBits + sTailBits);
+				for (unsigned i = 0; i < sInfoBits; i++)
+					info[i] = rand_r(&seed) & 1;
+				info.tail(sInfoBits).zero();
+				BitVector coded(sCodedBits);
+				info.encode(coder, coded);
+
+				signalVector tx(gFrameLen);
+				modulateFrame(coded, &seed, tx);
+				signalVector rx(gFrameLen + sBurstLen);
+				channel(profile, tx, noisePower, &seed, rx);
+
+				signalVector descrambled(gFrameLen);
+				SoftVector soft(sCodedBits);
+				BitVector decoded(sInfoBits + sTailBits);
+
+				signalVector rxCopy(rx);
+				double start = timef();
+				single.receive(rxCopy, descrambled);
+				singleTime += timef() - start;
+				softBits(descrambled, soft);
+				soft.decode(coder, decoded);
+				if (!(decoded.head(sInfoBits) == info.head(sInfoBits)))
+					singleErrors++;
+
+				start = timef();
+				rakeReceive(rake, rx, descrambled);
+				rakeTime += timef() - start;
+				softBits(descrambled, soft);
+				soft.decode(coder, decoded);
+				if (!(decoded.head(sInfoBits) == info.head(sInfoBits)))
+					rakeErrors++;
+			}
+			printf("  %8.1f %12.4f %12.4f   (%.0f vs %.0f us/frame)\n", snrs[s],
+				(float)singleErrors / frames, (float)rakeErrors / frames, 1e6 * singleTime / frames,
+				1e6 * rakeTime / frames);
+			// The RAKE has to do at least as well everywhere, including a path half way between two chips.
+			if (rakeErrors > singleErrors)
+				ok = false;
+		}
+	}
+
+	printf("%s\n", ok ? "PASSED" : "FAILED");
+	return ok ? 0 : 1;
+}
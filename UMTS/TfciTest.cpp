@@ -0,0 +1,246 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Decode clean and noisy TFCI codewords with findTfci and with the correlator it replaced, which matched every
+// code against the 30 soft bits, and time both.  Then check the soft bits and the pilot SIR of decodeDPCCHSlot
+// against the way RadioModem::decodeDCH made them before.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Logger.h>
+#include <Globals/Defines.h>
+
+#include "UMTSL1Const.h"
+
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The score findTfci used to give a tfci, and its decoder.
+static float oldMatch(const float *bits, unsigned tfci)
+{
+	uint32_t tfciCode = TrCHConsts::sTfciCodes[tfci];
+	float thisMatch = 0;
+	for (unsigned b = 0; b < 30; b++) {
+		unsigned wantbit = tfciCode & 1;
+		tfciCode >>= 1;
+		float havebit = RN_BOUND(bits[b], 0.0, 1.0);
+		if (wantbit) {
+			thisMatch += havebit;
+		} else {
+			thisMatch += 1.0 - havebit;
+		}
+	}
+	return thisMatch;
+}
+
+static unsigned oldFindTfci(const float *bits, unsigned numTfcis)
+{
+	unsigned bestTfci = 0;
+	float bestMatch = 0;
+	for (unsigned tfci = 0; tfci < numTfcis; tfci++) {
+		float thisMatch = oldMatch(bits, tfci);
+		if (thisMatch > bestMatch) {
+			bestMatch = thisMatch;
+			bestTfci = tfci;
+		}
+	}
+	return bestTfci;
+}
+
+static float gaussian()
+{
+	float u = (random() + 1.0F) / (RAND_MAX + 2.0F);
+	float v = (random() + 1.0F) / (RAND_MAX + 2.0F);
+	return sqrtf(-2.0F * logf(u)) * cosf(2.0F * M_PI * v);
+}
+
+// The soft bits of a tfci as decodeDCH makes them: a 0 bit is +1, plus noise of the given deviation.
+static void softBits(unsigned tfci, float sigma, float *bits)
+{
+	uint32_t code = TrCHConsts::sTfciCodes[tfci];
+	for (unsigned b = 0; b < 30; b++) {
+		float symbol = ((code >> b) & 1 ? -1.0F : 1.0F) + sigma * gaussian();
+		bits[b] = -0.5F * symbol + 0.5F;
+	}
+	bits[30] = bits[31] = 0.5F;
+}
+
+static void testClean()
+{
+	static const unsigned sizes[] = {2, 12, 64, 100, 256};
+	bool ok = true;
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (unsigned tfci = 0; tfci < sizes[s]; tfci++) {
+			float bits[32];
+			softBits(tfci, 0, bits);
+			if (findTfci(bits, sizes[s]) != tfci)
+				ok = false;
+		}
+	}
+	check("every clean codeword decodes, 2 to 256 TFCs", ok);
+
+	float bits[32];
+	for (unsigned b = 0; b < 32; b++) {
+		bits[b] = 0.5F;
+	}
+	check("no information picks tfci 0, as before", findTfci(bits, 64) == 0 && oldFindTfci(bits, 64) == 0);
+}
+
+// Against the old correlator on noisy codewords.  Where the two pick different tfcis, their old scores must tie.
+static void testNoisy(unsigned numTfcis, float sigma, unsigned trials)
+{
+	srandom(48 + numTfcis);
+	unsigned differ = 0, ties = 0, errors = 0;
+	for (unsigned n = 0; n < trials; n++) {
+		unsigned tfci = random() % numTfcis;
+		float bits[32];
+		softBits(tfci, sigma, bits);
+		unsigned got = findTfci(bits, numTfcis);
+		unsigned want = oldFindTfci(bits, numTfcis);
+		if (got != tfci)
+			errors++;
+		if (got != want) {
+			if (fabsf(oldMatch(bits, got) - oldMatch(bits, want)) < 1e-3F)
+				ties++;
+			else
+				differ++;
+		}
+	}
+	printf("%u TFCs, noise %.2f: %u of %u wrong, %u ties decided differently\n", numTfcis, sigma, errors, trials,
+		ties);
+	char what[80];
+	snprintf(what, sizeof(what), "same decisions as the correlator, %u TFCs %.2f", numTfcis, sigma);
+	check(what, differ == 0);
+}
+
+static void testSpeed(unsigned numTfcis, unsigned decodes)
+{
+	srandom(4800);
+	const unsigned sWords = 256;
+	static float words[sWords][32];
+	for (unsigned w = 0; w < sWords; w++) {
+		softBits(random() % numTfcis, 0.7F, words[w]);
+	}
+	unsigned sum = 0;
+	uint64_t t0 = nanoseconds();
+	for (unsigned n = 0; n < decodes; n++) {
+		sum += findTfci(words[n % sWords], numTfcis);
+	}
+	uint64_t newNs = nanoseconds() - t0;
+	t0 = nanoseconds();
+	for (unsigned n = 0; n < decodes; n++) {
+		sum += oldFindTfci(words[n % sWords], numTfcis);
+	}
+	uint64_t oldNs = nanoseconds() - t0;
+	printf("%u TFCs: Hadamard %.0f ns a frame, correlator %.0f ns (%u)\n", numTfcis, (double)newNs / decodes,
+		(double)oldNs / decodes, sum & 1);
+	char what[80];
+	snprintf(what, sizeof(what), "Hadamard faster than the correlator, %u TFCs", numTfcis);
+	check(what, newNs < oldNs);
+}
+
+static void testSlot()
+{
+	// Slot format 0 with 6 pilots, as decodeDCH scales its despread symbols.
+	const float scale = -0.5F / 256 / 2;
+	const float amplitude = 512;
+	const unsigned numPilots = 6;
+	const uint32_t pattern = 0x1f; // "111110", pilot 0 first.
+
+	float control[10], tfci[2], tpc[2];
+	for (unsigned i = 0; i < 10; i++) {
+		control[i] = (i * 37 % 11) * 100.0F - 500.0F;
+	}
+	PilotSIR sir;
+	decodeDPCCHSlot(control, scale, numPilots, pattern, tfci, tpc, sir);
+	check("TFCI and TPC soft bits as decodeDCH made them",
+		tfci[0] == scale * control[6] + 0.5F && tfci[1] == scale * control[7] + 0.5F &&
+			tpc[0] == scale * control[8] + 0.5F && tpc[1] == scale * control[9] + 0.5F);
+
+	sir.reset();
+	check("no pilots, no SIR", sir.sirDB() == -100);
+	for (unsigned i = 0; i < 10; i++) {
+		control[i] = i < numPilots && (pattern >> i) & 1 ? -amplitude : amplitude;
+	}
+	for (unsigned slot = 0; slot < 15; slot++) {
+		decodeDPCCHSlot(control, scale, numPilots, pattern, tfci, tpc, sir);
+	}
+	check("clean pilots, unbounded SIR", sir.count() == 90 && sir.sirDB() == 100);
+
+	// Pilots at 10 dB, over 100 frames of 90 pilots each.
+	srandom(480);
+	float worst = 0;
+	for (unsigned frame = 0; frame < 100; frame++) {
+		sir.reset();
+		for (unsigned slot = 0; slot < 15; slot++) {
+			for (unsigned i = 0; i < 10; i++) {
+				float symbol = i < numPilots && (pattern >> i) & 1 ? -amplitude : amplitude;
+				control[i] = symbol + amplitude / sqrtf(10.0F) * gaussian();
+			}
+			decodeDPCCHSlot(control, scale, numPilots, pattern, tfci, tpc, sir);
+		}
+		worst = fmaxf(worst, fabsf(sir.sirDB() - 10.0F));
+	}
+	printf("10 dB pilots: a frame's estimate within %.2f dB\n", worst);
+	check("frame SIR within 3 dB of 10 dB", worst < 3.0F);
+
+	uint64_t t0 = nanoseconds();
+	const unsigned slots = 1000000;
+	for (unsigned n = 0; n < slots; n++) {
+		control[n % 10] += 1.0F;
+		decodeDPCCHSlot(control, scale, numPilots, pattern, tfci, tpc, sir);
+	}
+	printf("decodeDPCCHSlot: %.1f ns a slot\n", (double)(nanoseconds() - t0) / slots);
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+	gLogInit("TfciTest", "EMERG");
+
+	testClean();
+	testNoisy(64, 0.5F, 20000);
+	testNoisy(64, 1.0F, 20000);
+	testNoisy(256, 0.8F, 20000);
+	testNoisy(12, 1.5F, 20000);
+	testSpeed(64, argc > 1 ? atoi(argv[1]) : 200000);
+	testSpeed(256, argc > 1 ? atoi(argv[1]) : 200000);
+	testSlot();
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
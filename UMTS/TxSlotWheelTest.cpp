@@ -0,0 +1,319 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the transmit slot wheel, then race many producer threads against one transmitter on it and on the
+// mutex protected priority queue it replaces, and time the producers' pushes and the transmitter's drains.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <CommonLibs/Configuration.h>
+#include <CommonLibs/Interthread.h>
+#include <CommonLibs/Threads.h>
+
+#include "UMTSTxWheel.h"
+
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+static unsigned sFailures = 0;
+
+static void check(const char *what, bool ok)
+{
+	printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Absolute slot count to a wrapping UMTS time.
+static Time slotTime(unsigned slot)
+{
+	return Time((slot / gFrameSlots) % gHyperframe, slot % gFrameSlots);
+}
+
+static TxBitsBurst *burst(unsigned slot)
+{
+	return new TxBitsBurst(256, 1, slotTime(slot), false);
+}
+
+static unsigned count(TxBitsBurst *list, const Time &t, bool &ok)
+{
+	unsigned n = 0;
+	while (list) {
+		ok &= list->time() == t;
+		TxBitsBurst *next = list->wheelNext();
+		delete list;
+		list = next;
+		n++;
+	}
+	return n;
+}
+
+static void testSingleThread()
+{
+	TxSlotWheel wheel(slotTime(0));
+	unsigned late;
+	bool ok = true;
+
+	// Three bursts in one slot, one in the next, one a whole horizon ahead.
+	ok &= wheel.push(burst(5)) == TxSlotWheel::QUEUED;
+	ok &= wheel.push(burst(5)) == TxSlotWheel::QUEUED;
+	ok &= wheel.push(burst(5)) == TxSlotWheel::QUEUED;
+	ok &= wheel.push(burst(6)) == TxSlotWheel::QUEUED;
+	ok &= wheel.push(burst(TxSlotWheel::sSlots)) == TxSlotWheel::QUEUED;
+	check("push", ok && wheel.size() == 5);
+
+	TxBitsBurst *b = burst(TxSlotWheel::sSlots + 1);
+	check("push beyond the horizon", wheel.push(b) == TxSlotWheel::TOO_EARLY && wheel.tooEarly() == 1);
+	delete b;
+
+	ok = true;
+	for (unsigned s = 1; s < 5; s++) {
+		ok &= wheel.drain(slotTime(s), late) == NULL && late == 0;
+	}
+	ok &= count(wheel.drain(slotTime(5), late), slotTime(5), ok) == 3 && late == 0;
+	check("drain", ok);
+
+	b = burst(5);
+	check("push for a drained slot is late", wheel.push(b) == TxSlotWheel::LATE && wheel.late() == 1);
+	delete b;
+
+	// Skipping slots 6..9 drops the burst in 6.
+	ok = wheel.drain(slotTime(10), late) == NULL && late == 1 && wheel.late() == 2;
+	check("skipped slots are dropped as late", ok);
+
+	ok = true;
+	for (unsigned s = 11; s < TxSlotWheel::sSlots; s++) {
+		ok &= wheel.drain(slotTime(s), late) == NULL;
+	}
+	ok &= count(wheel.drain(slotTime(TxSlotWheel::sSlots), late), slotTime(TxSlotWheel::sSlots), ok) == 1;
+	check("a whole horizon ahead", ok && wheel.size() == 0);
+
+	// Across the hyperframe wrap.
+	const unsigned end = gHyperframe * gFrameSlots;
+	TxSlotWheel wrap(slotTime(end - 2));
+	ok = wrap.push(burst(end - 1)) == TxSlotWheel::QUEUED && wrap.push(burst(end + 3)) == TxSlotWheel::QUEUED;
+	ok &= count(wrap.drain(slotTime(end - 1), late), slotTime(end - 1), ok) == 1;
+	ok &= count(wrap.drain(slotTime(end + 3), late), slotTime(end + 3), ok) == 1 && late == 0;
+	check("hyperframe wrap", ok);
+
+	// A wheel not given a time is placed by the first push, with room for other producers just behind it.
+	TxSlotWheel pushed;
+	ok = pushed.push(burst(1000)) == TxSlotWheel::QUEUED && pushed.push(burst(990)) == TxSlotWheel::QUEUED;
+	ok &= pushed.tooEarly() == 0 && pushed.late() == 0;
+	ok &= count(pushed.drain(slotTime(990), late), slotTime(990), ok) == 1 && late == 0;
+	ok &= count(pushed.drain(slotTime(1000), late), slotTime(1000), ok) == 1 && late == 0;
+	check("placed by the first push", ok);
+
+	// Or by the first drain.
+	TxSlotWheel drained;
+	ok = drained.drain(slotTime(500), late) == NULL && late == 0;
+	b = burst(500);
+	ok &= drained.push(b) == TxSlotWheel::LATE;
+	delete b;
+	ok &= drained.push(burst(501)) == TxSlotWheel::QUEUED;
+	ok &= count(drained.drain(slotTime(501), late), slotTime(501), ok) == 1;
+	check("placed by the first drain", ok);
+}
+
+// The transmit queue as it was: a priority queue under a mutex.
+class PriorityQueue : public InterthreadPriorityQueue<TxBitsBurst> {
+public:
+	bool push(TxBitsBurst *burst)
+	{
+		write(burst);
+		return true;
+	}
+
+	/** Drop stale bursts, send the current ones, as RadioModem::transmitSlot did; return the number sent. */
+	unsigned transmit(const Time &now, unsigned &late, bool &ok)
+	{
+		late = 0;
+		ScopedLock lock(mLock);
+		while (mQ.size() && mQ.top()->time() < now) {
+			delete mQ.top();
+			mQ.pop();
+			late++;
+		}
+		unsigned n = 0;
+		while (mQ.size() && mQ.top()->time() == now) {
+			delete mQ.top();
+			mQ.pop();
+			n++;
+		}
+		return n;
+	}
+};
+
+class WheelQueue : public TxSlotWheel {
+public:
+	bool push(TxBitsBurst *burst) { return TxSlotWheel::push(burst) == QUEUED; }
+
+	unsigned transmit(const Time &now, unsigned &late, bool &ok) { return count(drain(now, late), now, ok); }
+};
+
+static const unsigned sProducers = 16;
+static const unsigned sFrames = 1000;
+static const unsigned sSlotNanoseconds = 100000; // About 7 times real time.
+static const unsigned sLeadFrames = 2;
+
+template <class Q>
+struct Race {
+	Q queue;
+	volatile unsigned clock; // Slots drained so far.
+	volatile bool done;
+	unsigned pushed[sProducers], refused[sProducers];
+	uint64_t pushNs[sProducers];
+	unsigned delivered, dropped, wrongTime;
+	uint64_t drainNs, drainMaxNs;
+	unsigned producerIndex;
+
+	Race() : clock(0), done(false), delivered(0), dropped(0), wrongTime(0), drainNs(0), drainMaxNs(0)
+	{
+		producerIndex = 0;
+	}
+
+	// One downlink channel: a frame of 15 bursts a couple of frames ahead of the clock, once per frame.
+	static void *producer(void *arg)
+	{
+		Race *race = (Race *)arg;
+		unsigned me = __atomic_fetch_add(&race->producerIndex, 1, __ATOMIC_RELAXED);
+		race->pushed[me] = race->refused[me] = 0;
+		race->pushNs[me] = 0;
+		unsigned lastFrame = ~0U;
+		while (!race->done) {
+			unsigned frame = race->clock / gFrameSlots;
+			if (frame == lastFrame || frame + sLeadFrames + 1 >= sFrames) {
+				sched_yield();
+				continue;
+			}
+			lastFrame = frame;
+			for (unsigned s = 0; s < gFrameSlots; s++) {
+				TxBitsBurst *b = burst((frame + sLeadFrames) * gFrameSlots + s);
+				uint64_t start = nanoseconds();
+				bool ok = race->queue.push(b);
+				race->pushNs[me] += nanoseconds() - start;
+				race->pushed[me]++;
+				if (!ok) {
+					race->refused[me]++;
+					delete b;
+				}
+			}
+		}
+		return NULL;
+	}
+
+	void run()
+	{
+		Thread threads[sProducers];
+		for (unsigned p = 0; p < sProducers; p++) {
+			threads[p].start(producer, this);
+		}
+		// Sleep between slots, like the transmit loop, so the producers get the processor.
+		struct timespec next;
+		clock_gettime(CLOCK_MONOTONIC, &next);
+		for (unsigned slot = 1; slot <= sFrames * gFrameSlots; slot++) {
+			next.tv_nsec += sSlotNanoseconds;
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+			unsigned late;
+			uint64_t start = nanoseconds();
+			bool ok = true;
+			delivered += queue.transmit(slotTime(slot), late, ok);
+			uint64_t ns = nanoseconds() - start;
+			drainNs += ns;
+			drainMaxNs = ns > drainMaxNs ? ns : drainMaxNs;
+			dropped += late;
+			wrongTime += !ok;
+			__atomic_store_n(&clock, slot, __ATOMIC_RELEASE);
+		}
+		done = true;
+		for (unsigned p = 0; p < sProducers; p++) {
+			threads[p].join();
+		}
+	}
+
+	unsigned totalPushed() const
+	{
+		unsigned n = 0;
+		for (unsigned p = 0; p < sProducers; p++) {
+			n += pushed[p];
+		}
+		return n;
+	}
+
+	unsigned totalRefused() const
+	{
+		unsigned n = 0;
+		for (unsigned p = 0; p < sProducers; p++) {
+			n += refused[p];
+		}
+		return n;
+	}
+
+	double meanPushNs() const
+	{
+		uint64_t ns = 0;
+		for (unsigned p = 0; p < sProducers; p++) {
+			ns += pushNs[p];
+		}
+		return (double)ns / totalPushed();
+	}
+
+	void report(const char *name) const
+	{
+		printf("%-14s %8u bursts  push %6.0f ns  drain %6.0f ns mean %7.0f ns max  late %u\n", name,
+			totalPushed(), meanPushNs(), (double)drainNs / (sFrames * gFrameSlots), (double)drainMaxNs,
+			totalRefused() + dropped);
+	}
+};
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+
+	testSingleThread();
+
+	printf("%u producers, a frame each per frame %u frames ahead, one slot per %u us\n", sProducers, sLeadFrames,
+		sSlotNanoseconds / 1000);
+	Race<PriorityQueue> *old = new Race<PriorityQueue>;
+	old->run();
+	old->report("priority queue");
+	Race<WheelQueue> *wheel = new Race<WheelQueue>;
+	wheel->run();
+	wheel->report("slot wheel");
+
+	check("every burst delivered on time or counted late",
+		wheel->delivered + wheel->dropped + wheel->totalRefused() == wheel->totalPushed() &&
+			wheel->wrongTime == 0);
+	check("late bursts counted by the wheel", wheel->queue.late() == wheel->dropped + wheel->totalRefused());
+	delete old;
+	delete wheel;
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef UMTSACTIVELIST_H
+#define UMTSACTIVELIST_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <CommonLibs/Threads.h>
+
+namespace UMTS {
+
+/*
+	A set of channels that the radio threads walk every slot and that RRC changes now and then.
+
+	The set is published as an immutable snapshot.  Readers, the modem's receive and transmit loops, take
+	the current snapshot without a lock and walk it for as long as they like; a writer copies the snapshot,
+	changes the copy, and swaps it in.  Nothing a reader holds ever changes under it, so a writer has no
+	reason to wait for readers: the old snapshot is retired, and deleted later, once no reader can still be
+	walking it.  That is epoch based reclamation with two reader counts, as in sleepable RCU.  A reader
+	counts itself in under the parity of the current epoch.  A writer advances the epoch only when nobody is
+	counted under the parity it advances to, which means every reader from two epochs ago has gone, so a
+	snapshot retired in epoch e is free to delete once the epoch reaches e+2.  The writer never waits for
+	that; it deletes what it can and leaves the rest for the next change.
+
+	Only the snapshots are reclaimed.  The elements are not owned, and a reader may still see an element for
+	a slot after it was removed, so whatever they point to must stay valid; the DCHFECs live as long as the
+	ChannelTree, and a removed one is already closed.
+*/
+template <class T> class ActiveList {
+public:
+	typedef std::vector<T *> Items;
+	typedef typename Items::const_iterator const_iterator;
+
+	/** A reader's view of the set, pinned for the life of the object.  Constructing one never blocks. */
+	class Snapshot {
+		ActiveList &mList;
+		unsigned mParity;
+		const Items *mItems;
+
+		Snapshot(const Snapshot &);
+		Snapshot &operator=(const Snapshot &);
+
+	public:
+		Snapshot(ActiveList &wList) : mList(wList)
+		{
+			mParity = mList.enter();
+			mItems = __atomic_load_n(&mList.mCurrent, __ATOMIC_ACQUIRE);
+		}
+		~Snapshot() { mList.leave(mParity); }
+
+		const_iterator begin() const { return mItems->begin(); }
+		const_iterator end() const { return mItems->end(); }
+		size_t size() const { return mItems->size(); }
+		bool empty() const { return mItems->empty(); }
+	};
+
+private:
+	struct Retired {
+		const Items *mItems;
+		uint64_t mEpoch;
+	};
+
+	const Items *mCurrent; ///< The published snapshot.
+	uint64_t mEpoch;
+	// Readers counted in under each parity of the epoch, on their own cache lines since every slot changes them.
+	struct Count {
+		unsigned mReaders;
+	} __attribute__((aligned(64))) mCounts[2];
+
+	Mutex mLock;		       ///< Serializes writers; readers never take it.
+	std::vector<Retired> mRetired; ///< Snapshots a reader may still be walking; under mLock.
+	uint64_t mReclaimed;
+
+	ActiveList(const ActiveList &);
+	ActiveList &operator=(const ActiveList &);
+
+	unsigned enter()
+	{
+		for (;;) {
+			uint64_t epoch = __atomic_load_n(&mEpoch, __ATOMIC_SEQ_CST);
+			unsigned parity = epoch & 1;
+			__atomic_fetch_add(&mCounts[parity].mReaders, 1, __ATOMIC_SEQ_CST);
+			// If the epoch moved meanwhile, the writer may have found our parity empty; count in again.
+			if (__atomic_load_n(&mEpoch, __ATOMIC_SEQ_CST) == epoch) {
+				return parity;
+			}
+			__atomic_fetch_sub(&mCounts[parity].mReaders, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	void leave(unsigned parity) { __atomic_fetch_sub(&mCounts[parity].mReaders, 1, __ATOMIC_RELEASE); }
+
+	// Under mLock.  Advance the epoch as far as the readers allow, at most twice, and delete what that frees.
+	void reclaim()
+	{
+		for (unsigned i = 0; i < 2; i++) {
+			uint64_t epoch = __atomic_load_n(&mEpoch, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&mCounts[(epoch + 1) & 1].mReaders, __ATOMIC_SEQ_CST)) {
+				break;
+			}
+			__atomic_store_n(&mEpoch, epoch + 1, __ATOMIC_SEQ_CST);
+		}
+		uint64_t epoch = __atomic_load_n(&mEpoch, __ATOMIC_RELAXED);
+		size_t kept = 0;
+		for (size_t i = 0; i < mRetired.size(); i++) {
+			if (mRetired[i].mEpoch + 2 <= epoch) {
+				delete mRetired[i].mItems;
+				mReclaimed++;
+			} else {
+				mRetired[kept++] = mRetired[i];
+			}
+		}
+		mRetired.resize(kept);
+	}
+
+	// Under mLock.
+	void publish(const Items *items)
+	{
+		const Items *old = mCurrent;
+		__atomic_store_n(&mCurrent, items, __ATOMIC_SEQ_CST);
+		Retired r = {old, __atomic_load_n(&mEpoch, __ATOMIC_SEQ_CST)};
+		mRetired.push_back(r);
+		reclaim();
+	}
+
+public:
+	ActiveList() : mCurrent(new Items), mEpoch(0), mReclaimed(0) { mCounts[0].mReaders = mCounts[1].mReaders = 0; }
+
+	/** Only when no reader can be left. */
+	~ActiveList()
+	{
+		for (size_t i = 0; i < mRetired.size(); i++) {
+			delete mRetired[i].mItems;
+		}
+		delete mCurrent;
+	}
+
+	/** Add an element; any thread, never waits for readers. */
+	void push_back(T *item)
+	{
+		ScopedLock lock(mLock);
+		Items *items = new Items(*mCurrent);
+		items->push_back(item);
+		publish(items);
+	}
+
+	/** Remove every copy of an element; any thread, never waits for readers. */
+	void remove(T *item)
+	{
+		ScopedLock lock(mLock);
+		if (std::find(mCurrent->begin(), mCurrent->end(), item) == mCurrent->end()) {
+			return;
+		}
+		Items *items = new Items(*mCurrent);
+		items->erase(std::remove(items->begin(), items->end(), item), items->end());
+		publish(items);
+	}
+
+	/** Elements now; a reader wanting a consistent view should use a Snapshot. */
+	size_t size()
+	{
+		Snapshot s(*this);
+		return s.size();
+	}
+
+	/** Retired snapshots not yet deleted, and deleted so far. */
+	size_t retired()
+	{
+		ScopedLock lock(mLock);
+		return mRetired.size();
+	}
+	uint64_t reclaimed()
+	{
+		ScopedLock lock(mLock);
+		return mReclaimed;
+	}
+
+	/** The writers' lock, for a writer that has to keep other writers out around its change. */
+	Mutex &lock() { return mLock; }
+};
+
+} // namespace UMTS
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <math.h>
+
+#include "UMTSClockSync.h"
+
+namespace UMTS {
+
+static const unsigned char sClockMagic[4] = {'C', 'L', 'K', 1};
+
+static void put(char *buf, uint64_t v, unsigned bytes)
+{
+	for (unsigned i = 0; i < bytes; i++) {
+		buf[i] = (char)(v >> (8 * (bytes - 1 - i)));
+	}
+}
+
+static uint64_t get(const char *buf, unsigned bytes)
+{
+	uint64_t v = 0;
+	for (unsigned i = 0; i < bytes; i++) {
+		v = v << 8 | (unsigned char)buf[i];
+	}
+	return v;
+}
+
+// Magic 4, sequence 4, FN 2, TN 1, pad 1, chips 8.
+unsigned ClockIndication::write(char *buf) const
+{
+	for (unsigned i = 0; i < 4; i++) {
+		buf[i] = (char)sClockMagic[i];
+	}
+	put(buf + 4, mSeq, 4);
+	put(buf + 8, mFN, 2);
+	put(buf + 10, mTN, 1);
+	put(buf + 11, 0, 1);
+	put(buf + 12, (uint64_t)mChips, 8);
+	return sClockIndicationLength;
+}
+
+bool ClockIndication::parse(const char *buf, unsigned len)
+{
+	if (len < sClockIndicationLength) {
+		return false;
+	}
+	for (unsigned i = 0; i < 4; i++) {
+		if ((unsigned char)buf[i] != sClockMagic[i]) {
+			return false;
+		}
+	}
+	mSeq = get(buf + 4, 4);
+	mFN = get(buf + 8, 2);
+	mTN = get(buf + 10, 1);
+	mChips = (int64_t)get(buf + 12, 8);
+	return mFN < gHyperframe && mTN < gFrameSlots && mChips >= 0;
+}
+
+const double ClockEstimator::sNominalNsPerChip = 1e9 / 3840000.0;
+const double ClockEstimator::sMaxDriftPPM = 100.0;
+
+void ClockEstimator::reset()
+{
+	mCount = mNext = 0;
+	mRefChips = mRefNs = mLastChips = 0;
+	mNsPerChip = sNominalNsPerChip;
+	mInterceptNs = 0.0;
+	mJitterNs = mLastDelayNs = 0.0;
+	mOutliers = 0;
+	mUpdates = 0;
+}
+
+int64_t ClockEstimator::predict(int64_t chips) const
+{
+	return mRefNs + (int64_t)llround(mInterceptNs + mNsPerChip * (double)(chips - mRefChips));
+}
+
+bool ClockEstimator::update(int64_t chips, int64_t arrivalNs)
+{
+	bool fits = true;
+	if (mCount) {
+		int64_t off = arrivalNs - predict(chips);
+		if (off > sRelockNs && chips > mLastChips && ++mOutliers < sMaxOutliers) {
+			mSkipped++;
+			mLastDelayNs = (double)off;
+			return true;
+		}
+		if (chips <= mLastChips || off > sRelockNs || off < -sRelockNs) {
+			fits = false;
+			mRelocks++;
+			reset();
+		}
+	}
+	mOutliers = 0;
+	if (!mCount) {
+		mRefChips = chips;
+		mRefNs = arrivalNs;
+	}
+	mChips[mNext] = chips - mRefChips;
+	mNs[mNext] = arrivalNs - mRefNs;
+	mNext = (mNext + 1) % sWindow;
+	if (mCount < sWindow) {
+		mCount++;
+	}
+	mLastChips = chips;
+	mUpdates++;
+	if (chips - mRefChips > (1LL << 36)) {
+		rebase();
+	}
+	fit();
+	mLastDelayNs = (double)(arrivalNs - predict(chips));
+	return fits;
+}
+
+// Move the reference up to the oldest point, every few hours, before the offsets outgrow a double's precision.
+void ClockEstimator::rebase()
+{
+	unsigned oldest = mCount < sWindow ? 0 : mNext;
+	int64_t dChips = mChips[oldest], dNs = mNs[oldest];
+	for (unsigned i = 0; i < mCount; i++) {
+		mChips[i] -= dChips;
+		mNs[i] -= dNs;
+	}
+	mRefChips += dChips;
+	mRefNs += dNs;
+}
+
+// The line under every point that is closest to them on average, which is the linear program of Moon, Skelly and
+// Towsley for one way delays.  Its solution is the edge of the lower convex hull of the points that spans their
+// mean chip.  The delays are all positive and mostly small, so the hull is made of the least delayed points
+// and the late ones, however late, have no say.
+void ClockEstimator::fit()
+{
+	// Oldest first, so in order of chips, and less the nominal rate, to keep the products small.
+	double x[sWindow], y[sWindow];
+	unsigned first = mCount < sWindow ? 0 : mNext;
+	double mx = 0;
+	for (unsigned i = 0; i < mCount; i++) {
+		unsigned k = (first + i) % sWindow;
+		x[i] = (double)mChips[k];
+		y[i] = (double)mNs[k] - sNominalNsPerChip * x[i];
+		mx += x[i];
+	}
+	mx /= mCount;
+
+	double slope = 0;
+	if (mCount >= sMinFit) {
+		unsigned hull[sWindow], h = 0;
+		for (unsigned i = 0; i < mCount; i++) {
+			while (h >= 2) {
+				unsigned a = hull[h - 2], b = hull[h - 1];
+				if ((x[b] - x[a]) * (y[i] - y[a]) - (y[b] - y[a]) * (x[i] - x[a]) > 0) {
+					break;
+				}
+				h--;
+			}
+			hull[h++] = i;
+		}
+		for (unsigned k = 0; k + 1 < h; k++) {
+			unsigned a = hull[k], b = hull[k + 1];
+			if (x[b] >= mx) {
+				slope = (y[b] - y[a]) / (x[b] - x[a]);
+				break;
+			}
+		}
+		if (fabs(slope / sNominalNsPerChip) * 1e6 > sMaxDriftPPM) {
+			slope = 0;
+		}
+	}
+	mNsPerChip = sNominalNsPerChip + slope;
+
+	// The phase: the line goes under every point and touches the lowest.
+	double lowest = 0;
+	for (unsigned i = 0; i < mCount; i++) {
+		double r = y[i] - slope * x[i];
+		if (i == 0 || r < lowest) {
+			lowest = r;
+		}
+	}
+	mInterceptNs = lowest;
+	double sq = 0;
+	for (unsigned i = 0; i < mCount; i++) {
+		double above = y[i] - slope * x[i] - lowest;
+		sq += above * above;
+	}
+	mJitterNs = mCount ? sqrt(sq / mCount) : 0.0;
+}
+
+} // namespace UMTS
@@ -0,0 +1,130 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef UMTSCLOCKSYNC_H
+#define UMTSCLOCKSYNC_H
+
+#include <stdint.h>
+
+#include "UMTSCommon.h"
+
+namespace UMTS {
+
+/*
+	The clock indication the transceiver sends on the clock socket.
+
+	The text "IND CLOCK <FN>" only said what frame it was when the datagram happened to be read, so the
+	scheduling of the transceiver's and the BTS's threads went straight into the NodeB clock.  This one says
+	which radio chip a slot started on, counting every chip received since the transceiver started, so the
+	BTS can fit the radio's timeline against CLOCK_MONOTONIC over many indications.  The frame number has the
+	transceiver's transmit advance already added, as the text one did.
+
+	On the wire it is sClockIndicationLength bytes, big endian, starting with "CLK" and a version byte so it
+	cannot be taken for the text form.
+*/
+struct ClockIndication {
+	uint32_t mSeq;	 ///< Counts indications, to spot lost ones.
+	uint16_t mFN;	 ///< Frame the BTS should be in...
+	uint8_t mTN;	 ///< ...and slot.
+	int64_t mChips;	 ///< ...from this radio chip on.
+
+	ClockIndication() : mSeq(0), mFN(0), mTN(0), mChips(0) {}
+	ClockIndication(uint32_t wSeq, const Time &wTime, int64_t wChips)
+		: mSeq(wSeq), mFN(wTime.FN()), mTN(wTime.TN()), mChips(wChips)
+	{
+	}
+
+	/** Encode into buf, which must hold sClockIndicationLength bytes; return the length. */
+	unsigned write(char *buf) const;
+
+	/** Decode; false if this is not a binary indication. */
+	bool parse(const char *buf, unsigned len);
+};
+
+static const unsigned sClockIndicationLength = 20;
+
+/*
+	Estimates the radio clock against CLOCK_MONOTONIC from clock indications and the times they arrived.
+
+	An indication arrives some time after its chip was received: a fixed part, the transceiver's buffering and
+	the socket, and a variable part from scheduling, which can only make it later.  So the estimator draws the
+	line under the last sWindow (chip, arrival) points that is closest to them on average: its slope is the
+	radio's rate, and it runs along the least delayed arrivals, however late the others were.  Least squares
+	would be pulled up and tilted by every late arrival.  Unlike setting the clock at each arrival, the
+	estimate does not move with a late indication, and between indications it carries on at the measured rate
+	instead of the nominal one.
+
+	An indication far off the line, or a chip count that went backwards, means the transceiver restarted or
+	stalled, and the estimator starts over from that point.  Not thread safe; the clock handler owns it.
+*/
+class ClockEstimator {
+public:
+	static const unsigned sWindow = 64;
+	static const unsigned sMinFit = 4;	    ///< Points before the rate is fitted instead of nominal.
+	static const int64_t sRelockNs = 2000000; ///< Farther than this off the line is not believed...
+	static const unsigned sMaxOutliers = 3;	  ///< ...and this many late ones in a row, or one early, start over.
+	static const double sNominalNsPerChip;
+	static const double sMaxDriftPPM;	    ///< A fitted rate further off nominal than this is not believed.
+
+private:
+	int64_t mChips[sWindow]; ///< Relative to mRefChips.
+	int64_t mNs[sWindow];	 ///< Relative to mRefNs.
+	unsigned mCount;	 ///< Points in the window.
+	unsigned mNext;		 ///< Where the next point goes.
+	int64_t mRefChips, mRefNs; ///< An early point in the window, to keep the doubles small.
+	int64_t mLastChips;
+
+	double mNsPerChip;  ///< The fitted rate.
+	double mInterceptNs; ///< The line at mRefChips, relative to mRefNs.
+	double mJitterNs;    ///< RMS of the arrivals above the line over the window.
+	double mLastDelayNs; ///< How far above the line the last point arrived.
+	unsigned mOutliers; ///< Late indications in a row that were left out.
+	unsigned mRelocks;
+	unsigned mSkipped;
+	unsigned mUpdates;
+
+	void rebase();
+	void fit();
+
+public:
+	ClockEstimator() : mRelocks(0), mSkipped(0) { reset(); }
+
+	/** Forget everything. */
+	void reset();
+
+	/**
+		Add the chip of an indication and the CLOCK_MONOTONIC nanosecond it arrived.
+		An indication much later than the line is left out, since a stalled thread can delay one by tens of
+		milliseconds; a few in a row, or one much earlier, mean the radio clock really moved.
+		@return false if it did not fit the line and the estimator started over from it.
+	*/
+	bool update(int64_t chips, int64_t arrivalNs);
+
+	/** The CLOCK_MONOTONIC nanosecond the radio received the chip. */
+	int64_t predict(int64_t chips) const;
+
+	/** Points since the last start. */
+	unsigned updates() const { return mUpdates; }
+	unsigned relocks() const { return mRelocks; }
+	/** Late indications left out. */
+	unsigned skipped() const { return mSkipped; }
+	/** The radio clock rate against CLOCK_MONOTONIC, in parts per million fast. */
+	double driftPPM() const { return (sNominalNsPerChip / mNsPerChip - 1.0) * 1e6; }
+	double jitterNs() const { return mJitterNs; }
+	double lastDelayNs() const { return mLastDelayNs; }
+};
+
+} // namespace UMTS
+
+#endif
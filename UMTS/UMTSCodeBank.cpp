@@ -0,0 +1,292 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <CommonLibs/BitVector.h>
+#include <CommonLibs/Logger.h>
+
+#include "UMTSCodeBank.h"
+#include "UMTSCodes.h"
+#include "UMTSRadioModemSequences.h"
+#include "sigProcLib.h"
+
+namespace UMTS {
+
+void PackedScramblingCode::generate(unsigned N)
+{
+	// The generators and read masks of UplinkScramblingCode, one chip at a time.  A set bit is a -1 chip, so
+	// the products of chips are exclusive ors.
+	SequenceGenerator32 x(0x09, 25), y(0x0f, 25);
+	x.state((1 << 24) + N);
+	y.state(0x01ffffff);
+	memset(mI, 0, sPlaneBytes);
+	memset(mQ, 0, sPlaneBytes);
+	unsigned c2Even = 0;
+	for (unsigned i = 0; i < sChips; i++) {
+		unsigned c1 = x.LSB() ^ y.LSB();
+		unsigned c2 = x.read(0x040090) ^ y.read(0x020050);
+		x.step();
+		y.step();
+		// Q is C1 times C2 decimated by 2, times the sequence 1,-1 (25.213 4.3.2.1).
+		unsigned q;
+		if (i % 2 == 0) {
+			c2Even = c2;
+			q = c1 ^ c2;
+		} else {
+			q = c1 ^ c2Even ^ 1;
+		}
+		mI[i / 8] |= c1 << (i % 8);
+		mQ[i / 8] |= q << (i % 8);
+	}
+}
+
+// Each byte of a plane as eight +/-1 chips.
+static uint64_t sExpandTable[256];
+
+static bool initExpandTable()
+{
+	for (unsigned b = 0; b < 256; b++) {
+		int8_t chips[8];
+		for (unsigned i = 0; i < 8; i++) {
+			chips[i] = (b >> i) & 1 ? -1 : 1;
+		}
+		memcpy(&sExpandTable[b], chips, 8);
+	}
+	return true;
+}
+
+static bool sExpandTableReady = initExpandTable();
+
+static void expandPlane(const uint8_t *plane, unsigned start, unsigned len, int8_t *out)
+{
+	unsigned i = start, end = start + len;
+	for (; i < end && i % 8; i++) {
+		*out++ = (plane[i / 8] >> (i % 8)) & 1 ? -1 : 1;
+	}
+	const uint8_t *p = plane + i / 8;
+#ifdef __SSE2__
+	// Spread two bytes over 16 lanes, pick each lane's bit, and turn set bits into -1 and clear ones into 1.
+	const __m128i bits = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	const __m128i one = _mm_set1_epi8(1);
+	for (; i + 16 <= end; i += 16, p += 2, out += 16) {
+		__m128i v = _mm_cvtsi32_si128(p[0] | (p[1] << 8));
+		v = _mm_unpacklo_epi8(v, v);
+		v = _mm_unpacklo_epi16(v, v);
+		v = _mm_unpacklo_epi32(v, v);
+		v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+		_mm_storeu_si128((__m128i *)out, _mm_or_si128(v, one));
+	}
+#endif
+	for (; i + 8 <= end; i += 8, p++, out += 8) {
+		memcpy(out, &sExpandTable[*p], 8);
+	}
+	for (; i < end; i++) {
+		*out++ = (plane[i / 8] >> (i % 8)) & 1 ? -1 : 1;
+	}
+}
+
+void PackedScramblingCode::expand(unsigned start, unsigned len, int8_t *I, int8_t *Q) const
+{
+	assert(start + len <= sChips);
+	expandPlane(mI, start, len, I);
+	expandPlane(mQ, start, len, Q);
+}
+
+void *CodeBankGeneratorLoop(UplinkCodeBank *bank)
+{
+	bank->mLock.lock();
+	while (!bank->mStop) {
+		if (bank->mJobs.empty()) {
+			bank->mWork.wait(bank->mLock);
+			continue;
+		}
+		unsigned job = bank->mJobs.front();
+		bank->mJobs.pop_front();
+		bank->mLock.unlock();
+		bank->build(&bank->mEntries[job >> 4], (int)(job & 0x0f) - 1);
+		bank->mLock.lock();
+	}
+	bank->mLock.unlock();
+	return NULL;
+}
+
+UplinkCodeBank::UplinkCodeBank(unsigned capacity, unsigned pilotOffset, unsigned pilotLen)
+	: mCapacity(capacity), mPilotOffset(pilotOffset), mPilotLen(pilotLen), mUsed(0), mFilterBytes(0),
+	  mStop(false)
+{
+	mTableSize = 1;
+	while (mTableSize < 2 * capacity) {
+		mTableSize *= 2;
+	}
+	mEntries = new Entry[capacity];
+	mTable = new int[mTableSize];
+	memset(mTable, 0, mTableSize * sizeof(int));
+	mStorage = new uint8_t[capacity * 2 * PackedScramblingCode::sPlaneBytes];
+	for (unsigned i = 0; i < capacity; i++) {
+		Entry &e = mEntries[i];
+		e.mCode = -1;
+		e.mPacked.mI = mStorage + 2 * i * PackedScramblingCode::sPlaneBytes;
+		e.mPacked.mQ = e.mPacked.mI + PackedScramblingCode::sPlaneBytes;
+		e.mReady = 0;
+		e.mQueued = 0;
+		for (unsigned f = 0; f < sPilotFormats; f++) {
+			e.mPilots[f] = NULL;
+		}
+	}
+	mGenerator.start((void *(*)(void *))CodeBankGeneratorLoop, this);
+}
+
+UplinkCodeBank::~UplinkCodeBank()
+{
+	mLock.lock();
+	mStop = true;
+	mWork.signal();
+	mLock.unlock();
+	mGenerator.join();
+	for (unsigned i = 0; i < mUsed; i++) {
+		for (unsigned f = 0; f < sPilotFormats; f++) {
+			if (signalVector **pilots = mEntries[i].mPilots[f]) {
+				for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+					delete pilots[slot];
+				}
+				delete[] pilots;
+			}
+		}
+	}
+	delete[] mStorage;
+	delete[] mTable;
+	delete[] mEntries;
+}
+
+const UplinkCodeBank::Entry *UplinkCodeBank::find(unsigned code) const
+{
+	unsigned mask = mTableSize - 1;
+	for (unsigned i = hash(code) & mask;; i = (i + 1) & mask) {
+		int e = __atomic_load_n(&mTable[i], __ATOMIC_ACQUIRE);
+		if (!e) {
+			return NULL;
+		}
+		if (mEntries[e - 1].mCode == (int)code) {
+			return &mEntries[e - 1];
+		}
+	}
+}
+
+UplinkCodeBank::Entry *UplinkCodeBank::findOrAdd(unsigned code)
+{
+	unsigned mask = mTableSize - 1;
+	unsigned i = hash(code) & mask;
+	for (; mTable[i]; i = (i + 1) & mask) {
+		if (mEntries[mTable[i] - 1].mCode == (int)code) {
+			return &mEntries[mTable[i] - 1];
+		}
+	}
+	if (mUsed == mCapacity) {
+		return NULL;
+	}
+	Entry *entry = &mEntries[mUsed];
+	entry->mCode = code;
+	__atomic_store_n(&mUsed, mUsed + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&mTable[i], (int)(entry - mEntries) + 1, __ATOMIC_RELEASE);
+	return entry;
+}
+
+bool UplinkCodeBank::request(unsigned code, unsigned numPilots)
+{
+	assert(numPilots == 0 || (numPilots >= 3 && numPilots < 3 + sPilotFormats));
+	ScopedLock lock(mLock);
+	Entry *entry = findOrAdd(code);
+	if (!entry) {
+		LOG(ERR) << "uplink code bank full, " << mCapacity << " codes, no room for " << code;
+		return false;
+	}
+	unsigned want = numPilots ? 1 << (numPilots - 2) : 1;
+	if (entry->mQueued & want) {
+		return true;
+	}
+	entry->mQueued |= want | 1;
+	mJobs.push_back((entry - mEntries) << 4 | (numPilots ? numPilots - 2 : 0));
+	mWork.signal();
+	return true;
+}
+
+void UplinkCodeBank::build(Entry *entry, int format)
+{
+	if (!__atomic_load_n(&entry->mReady, __ATOMIC_ACQUIRE)) {
+		entry->mPacked.generate(entry->mCode);
+		__atomic_store_n(&entry->mReady, 1, __ATOMIC_RELEASE);
+	}
+	if (format >= 0 && !__atomic_load_n(&entry->mPilots[format], __ATOMIC_ACQUIRE)) {
+		buildPilots(entry, format + 3);
+	}
+}
+
+// The pilots go on the Q branch of the DPCCH, channelisation code 0 at SF 256 (25.211 5.2.1.1, 25.213 4.3.1.2),
+// then get scrambled; the filter is the stretch of that the RAKE correlates against.
+void UplinkCodeBank::buildPilots(Entry *entry, unsigned numPilots)
+{
+	const int8_t *ovsf = gOVSFTree.code(8, 0);
+	signalVector **pilots = new signalVector *[gFrameSlots];
+	int8_t scramI[gSlotLen], scramQ[gSlotLen];
+	for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+		entry->mPacked.expand(slot * gSlotLen + mPilotOffset, mPilotLen, scramI, scramQ);
+		signalVector chips(mPilotLen);
+		for (unsigned i = 0; i < mPilotLen; i++) {
+			unsigned c = mPilotOffset + i;
+			float Q = 0.0;
+			if (c < numPilots * 256) {
+				Q = (gPilotPatterns[numPilots - 3][slot].bit(c / 256) ? -1.0F : 1.0F) * ovsf[c % 256];
+			}
+			chips[i] = complex(-Q * scramQ[i], Q * scramI[i]);
+		}
+		pilots[slot] = reverseConjugate(&chips);
+	}
+	__atomic_add_fetch(&mFilterBytes, gFrameSlots * mPilotLen * sizeof(complex), __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->mPilots[numPilots - 3], pilots, __ATOMIC_RELEASE);
+}
+
+const PackedScramblingCode *UplinkCodeBank::code(unsigned code) const
+{
+	const Entry *entry = find(code);
+	if (!entry || !__atomic_load_n(&entry->mReady, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &entry->mPacked;
+}
+
+signalVector *UplinkCodeBank::pilotFilter(unsigned code, unsigned numPilots, unsigned slot) const
+{
+	if (numPilots < 3 || numPilots >= 3 + sPilotFormats) {
+		return NULL;
+	}
+	const Entry *entry = find(code);
+	if (!entry) {
+		return NULL;
+	}
+	signalVector **pilots = __atomic_load_n(&entry->mPilots[numPilots - 3], __ATOMIC_ACQUIRE);
+	return pilots ? pilots[slot] : NULL;
+}
+
+size_t UplinkCodeBank::bytes() const
+{
+	return size() * 2 * PackedScramblingCode::sPlaneBytes + __atomic_load_n(&mFilterBytes, __ATOMIC_RELAXED);
+}
+
+} // namespace UMTS
@@ -0,0 +1,143 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef UMTSCODEBANK_H
+#define UMTSCODEBANK_H
+
+#include <deque>
+#include <stdint.h>
+
+#include <CommonLibs/Threads.h>
+
+#include "UMTSCommon.h"
+#include "signalVector.h"
+
+namespace UMTS {
+
+/*
+	An uplink long scrambling code, 25.213 4.3.2.2, packed as two bit planes: bit i of the I plane is set
+	where chip i of the I code is -1, and likewise for Q.  That is 2 bits a chip, 10.6K for the frame plus
+	the 4096 chip offset the RACH message part starts at, where UplinkScramblingCode keeps 255K.  Receivers
+	expand the stretch they need into +/-1 bytes, a slot at a time, which with SSE2 is a few instructions
+	per 16 chips.
+*/
+class PackedScramblingCode {
+public:
+	static const unsigned sChips = gFrameLen + 4096;
+	static const unsigned sPlaneBytes = sChips / 8;
+
+private:
+	uint8_t *mI; ///< sPlaneBytes, in a buffer the UplinkCodeBank owns.
+	uint8_t *mQ;
+
+	friend class UplinkCodeBank;
+
+public:
+	PackedScramblingCode() : mI(NULL), mQ(NULL) {}
+
+	/** Generate code N into the planes; the same sequence as UplinkScramblingCode(N). */
+	void generate(unsigned N);
+
+	bool IBit(unsigned i) const { return (mI[i / 8] >> (i % 8)) & 1; }
+	bool QBit(unsigned i) const { return (mQ[i / 8] >> (i % 8)) & 1; }
+
+	/** Expand len chips from start into +/-1, as UplinkScramblingCode::ICode() and QCode() have them. */
+	void expand(unsigned start, unsigned len, int8_t *I, int8_t *Q) const;
+};
+
+/*
+	Uplink scrambling codes and DPCCH pilot matched filters for every DCH, shared by the demodulator threads.
+
+	RadioModem used to build these on the first burst of a DCH, in the demodulator thread, into std::maps the
+	other demodulator threads were reading without a lock.  Here the entries and the packed code storage are
+	allocated up front, a DCH asks for its code when it is opened, and a generator thread builds the code and
+	the filters for its pilot count in the background.  Entries are found through an open addressed hash
+	table; an entry is published with a release store once its code is set and never moves or goes away, and
+	its code and filters are published the same way once built, so lookups take no lock and never see a
+	partial entry.  A lookup for something not built yet returns NULL and the caller drops the slot, rather
+	than stall a demodulator thread for the few milliseconds generation takes.
+
+	There is no eviction: the ChannelTree gives each DCH its own fixed uplink code, so the bank only needs
+	room for that many codes, plus the PRACH.
+*/
+class UplinkCodeBank {
+public:
+	static const unsigned sPilotFormats = 6; ///< 3 to 8 pilot bits a slot.
+
+private:
+	struct Entry {
+		int mCode;			   ///< Scrambling code number; set before the entry is published.
+		PackedScramblingCode mPacked;	   ///< Valid once mReady.
+		int mReady;			   ///< Set once mPacked is generated.
+		signalVector **mPilots[sPilotFormats]; ///< gFrameSlots filters per pilot count, once generated.
+		unsigned mQueued;		   ///< Bit 0 the code, bit 1+n the filters for 3+n pilots; under mLock.
+	};
+
+	unsigned mCapacity;
+	unsigned mTableSize; ///< Power of two, at least twice mCapacity.
+	unsigned mPilotOffset, mPilotLen;
+	Entry *mEntries;
+	int *mTable;	     ///< Entry index + 1, or 0 for an empty slot.
+	unsigned mUsed;	     ///< Entries handed out; under mLock.
+	uint8_t *mStorage;   ///< The code planes of every entry.
+	size_t mFilterBytes; ///< Pilot filters generated so far.
+
+	Mutex mLock; ///< For requests and the job queue; lookups never take it.
+	Signal mWork;
+	std::deque<unsigned> mJobs; ///< Entry index << 4 | pilot format + 1, or 0 for the code alone.
+	bool mStop;
+	Thread mGenerator;
+
+	static unsigned hash(unsigned code) { return code * 2654435761U; }
+	const Entry *find(unsigned code) const;
+	Entry *findOrAdd(unsigned code);
+	void build(Entry *entry, int format);
+	void buildPilots(Entry *entry, unsigned numPilots);
+
+	friend void *CodeBankGeneratorLoop(UplinkCodeBank *);
+
+public:
+	/**
+		@param capacity Most codes the bank will hold.
+		@param pilotOffset, pilotLen The chips of each slot the pilot matched filters cover.
+	*/
+	UplinkCodeBank(unsigned capacity, unsigned pilotOffset, unsigned pilotLen);
+	~UplinkCodeBank();
+
+	/**
+		Have the code, and the pilot filters for this many pilot bits a slot if numPilots is not 0, built in the
+		background if they are not already.  Safe from any thread.
+		@return false if the bank is full.
+	*/
+	bool request(unsigned code, unsigned numPilots = 0);
+
+	/** The code, or NULL if it has not been built; lock-free. */
+	const PackedScramblingCode *code(unsigned code) const;
+
+	/**
+		The matched filter for the DPCCH pilots of a slot, reverse conjugated for correlate(), or NULL if it has
+		not been built; lock-free.
+	*/
+	signalVector *pilotFilter(unsigned code, unsigned numPilots, unsigned slot) const;
+
+	/** Codes held. */
+	unsigned size() const { return __atomic_load_n(&mUsed, __ATOMIC_RELAXED); }
+
+	/** Bytes held in code planes and pilot filters, for reporting. */
+	size_t bytes() const;
+};
+
+} // namespace UMTS
+
+#endif
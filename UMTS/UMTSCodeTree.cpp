@@ -0,0 +1,257 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "UMTSCodeTree.h"
+
+namespace UMTS {
+
+// Set n bits from lo.
+static void setRange(uint64_t *map, unsigned lo, unsigned n)
+{
+	while (n) {
+		unsigned off = lo % 64;
+		unsigned len = n < 64 - off ? n : 64 - off;
+		uint64_t mask = len == 64 ? ~0ULL : ((1ULL << len) - 1) << off;
+		map[lo / 64] |= mask;
+		lo += len;
+		n -= len;
+	}
+}
+
+// The bits of a tier's words that are codes.
+static uint64_t validBits(unsigned width, unsigned word)
+{
+	unsigned n = width - word * 64;
+	return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
+
+OVSFAllocator::OVSFAllocator()
+{
+	memset(mUsed, 0, sizeof(mUsed));
+	memset(mReserved, 0, sizeof(mReserved));
+	memset(mBelow, 0, sizeof(mBelow));
+	memset(mAbove, 0, sizeof(mAbove));
+	memset(mSubtree, 0, sizeof(mSubtree));
+}
+
+void OVSFAllocator::mark(int tier, unsigned code)
+{
+	assert(!isUsed(tier, code));
+	setBit(mUsed[tier], code, true);
+	for (int t = tier, c = code; t >= 0; t--, c /= 2) {
+		if (mSubtree[t][c]++ == 0) {
+			setBit(mBelow[t], c, true);
+		}
+	}
+	for (int t = tier + 1; t < sNumTiers; t++) {
+		unsigned n = 1U << (t - tier);
+		setRange(mAbove[t], code * n, n);
+	}
+}
+
+void OVSFAllocator::unmark(int tier, unsigned code)
+{
+	assert(isUsed(tier, code));
+	setBit(mUsed[tier], code, false);
+	for (int t = tier, c = code; t >= 0; t--, c /= 2) {
+		if (--mSubtree[t][c] == 0) {
+			setBit(mBelow[t], c, false);
+		}
+	}
+	// Something else above may still block the subtree, so rebuild it tier by tier from its parents.
+	for (int t = tier + 1; t < sNumTiers; t++) {
+		unsigned n = 1U << (t - tier);
+		for (unsigned i = code * n; i < (code + 1) * n; i++) {
+			setBit(mAbove[t], i, bit(mAbove[t - 1], i / 2) || bit(mUsed[t - 1], i / 2));
+		}
+	}
+}
+
+int OVSFAllocator::findFree(int tier) const
+{
+	unsigned w = width(tier);
+	for (unsigned word = 0; word * 64 < w; word++) {
+		uint64_t free = ~(mBelow[tier][word] | mAbove[tier][word]) & validBits(w, word);
+		if (free) {
+			return word * 64 + __builtin_ctzll(free);
+		}
+	}
+	return -1;
+}
+
+unsigned OVSFAllocator::freeCount(int tier) const
+{
+	unsigned w = width(tier), n = 0;
+	for (unsigned word = 0; word * 64 < w; word++) {
+		n += __builtin_popcountll(~(mBelow[tier][word] | mAbove[tier][word]) & validBits(w, word));
+	}
+	return n;
+}
+
+bool OVSFAllocator::findConflict(int tier, unsigned code, int *usedTier, unsigned *usedCode) const
+{
+	for (int t = 0; t <= tier; t++) {
+		unsigned c = code >> (tier - t);
+		if (isUsed(t, c)) {
+			*usedTier = t;
+			*usedCode = c;
+			return true;
+		}
+	}
+	if (!bit(mBelow[tier], code)) {
+		return false;
+	}
+	for (int t = tier + 1; t < sNumTiers; t++) {
+		unsigned n = 1U << (t - tier);
+		for (unsigned c = code * n; c < (code + 1) * n; c++) {
+			if (isUsed(t, c)) {
+				*usedTier = t;
+				*usedCode = c;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+int OVSFAllocator::allocate(int tier)
+{
+	int code = findFree(tier);
+	if (code >= 0) {
+		mark(tier, code);
+	}
+	return code;
+}
+
+bool OVSFAllocator::allocate(int tier, unsigned code)
+{
+	if (!isFree(tier, code)) {
+		return false;
+	}
+	mark(tier, code);
+	return true;
+}
+
+void OVSFAllocator::release(int tier, unsigned code)
+{
+	assert(!isReserved(tier, code));
+	unmark(tier, code);
+}
+
+bool OVSFAllocator::reserve(int tier, unsigned code)
+{
+	bool wasFree = isFree(tier, code);
+	if (!isUsed(tier, code)) {
+		mark(tier, code);
+	}
+	setBit(mReserved[tier], code, true);
+	return wasFree;
+}
+
+bool OVSFAllocator::planDefrag(int tier, unsigned *code, std::vector<Move> &moves) const
+{
+	moves.clear();
+	int free = findFree(tier);
+	if (free >= 0) {
+		*code = free;
+		return true;
+	}
+
+	// Try every code of the tier: move what is allocated over and under it, largest first, each to the
+	// lowest code that is free with the target taken.  Keep the candidate needing the fewest moves.
+	bool found = false;
+	std::vector<Move> candidate;
+	for (unsigned c = 0; c < width(tier); c++) {
+		candidate.clear();
+		bool movable = true;
+		for (int t = 0; t < tier && movable; t++) {
+			unsigned a = c >> (tier - t);
+			if (isUsed(t, a)) {
+				movable = !isReserved(t, a);
+				candidate.push_back(Move(t, a, 0));
+			}
+		}
+		for (int t = tier; t < sNumTiers && movable; t++) {
+			unsigned n = 1U << (t - tier);
+			for (unsigned d = c * n; d < (c + 1) * n && movable; d++) {
+				if (isUsed(t, d)) {
+					movable = !isReserved(t, d);
+					candidate.push_back(Move(t, d, 0));
+				}
+			}
+		}
+		if (!movable || (found && candidate.size() >= moves.size())) {
+			continue;
+		}
+
+		OVSFAllocator sim(*this);
+		for (unsigned i = 0; i < candidate.size(); i++) {
+			sim.unmark(candidate[i].tier, candidate[i].from);
+		}
+		sim.mark(tier, c);
+		bool placed = true;
+		for (unsigned i = 0; i < candidate.size() && placed; i++) {
+			int to = sim.allocate(candidate[i].tier);
+			placed = to >= 0;
+			candidate[i].to = to;
+		}
+		if (placed) {
+			found = true;
+			*code = c;
+			moves = candidate;
+		}
+	}
+	if (!found) {
+		moves.clear();
+	}
+	return found;
+}
+
+bool OVSFAllocator::check(std::ostream &os) const
+{
+	unsigned errors = 0;
+	for (int t = 0; t < sNumTiers; t++) {
+		for (unsigned c = 0; c < width(t); c++) {
+			unsigned subtree = 0;
+			for (int d = t; d < sNumTiers; d++) {
+				unsigned n = 1U << (d - t);
+				for (unsigned i = c * n; i < (c + 1) * n; i++) {
+					subtree += isUsed(d, i);
+				}
+			}
+			bool above = false;
+			for (int a = 0; a < t; a++) {
+				above |= isUsed(a, c >> (t - a));
+			}
+			bool ok = mSubtree[t][c] == subtree && bit(mBelow[t], c) == (subtree > 0) &&
+				  bit(mAbove[t], c) == above && (!isReserved(t, c) || isUsed(t, c));
+			// Allocations never overlap anything; only a misconfigured reservation may.
+			if (isUsed(t, c) && !isReserved(t, c) && (above || subtree > 1)) {
+				ok = false;
+			}
+			if (!ok && errors++ < 10) {
+				os << "OVSF code tree inconsistent at sf=" << width(t) << " code=" << c
+				   << " used=" << isUsed(t, c) << " reserved=" << isReserved(t, c)
+				   << " subtree=" << mSubtree[t][c] << "/" << subtree << " below=" << bit(mBelow[t], c)
+				   << " above=" << bit(mAbove[t], c) << "/" << above << "\n";
+			}
+		}
+	}
+	return errors == 0;
+}
+
+} // namespace UMTS
@@ -0,0 +1,125 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef UMTSCODETREE_H
+#define UMTSCODETREE_H
+
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+namespace UMTS {
+
+/*
+	Occupancy of the downlink OVSF code tree, SF=4 to SF=256, as bitmaps.
+
+	A code may be used if neither it, nor any code above it, nor any code below it is in use (25.213 4.3.1).
+	Rather than walk the tree to check that, every tier keeps two bitmaps: codes with something in use at or
+	below them, kept exact with a count per code, and codes with something in use above them.  A code is free
+	when its bit is clear in both, so finding the lowest free code of a tier is a find-first-set over at most
+	four words.  Using or releasing a code updates its ancestors, one per tier, and the bits of its subtree,
+	a contiguous range in each lower tier.
+
+	Reserved codes, for the CPICH, PCCPCH, SCCPCH and PICH, are in use for good.
+	This class does no locking; the ChannelTree does that.
+*/
+class OVSFAllocator {
+public:
+	static const int sNumTiers = 7;	 ///< SF=4 to SF=256.
+	static const unsigned sMaxWidth = 256; ///< Codes in the bottom tier.
+
+	static unsigned width(int tier) { return 4U << tier; }
+
+	/** Move an allocated code, as part of a defragmentation plan. */
+	struct Move {
+		int tier;
+		unsigned from, to;
+		Move(int wTier, unsigned wFrom, unsigned wTo) : tier(wTier), from(wFrom), to(wTo) {}
+	};
+
+private:
+	static const unsigned sWords = sMaxWidth / 64;
+
+	uint64_t mUsed[sNumTiers][sWords];     ///< Allocated or reserved.
+	uint64_t mReserved[sNumTiers][sWords]; ///< Reserved, never released.
+	uint64_t mBelow[sNumTiers][sWords];    ///< This code or one under it is used.
+	uint64_t mAbove[sNumTiers][sWords];    ///< A code over this one is used.
+	uint16_t mSubtree[sNumTiers][sMaxWidth]; ///< Used codes at and under each code.
+
+	static bool bit(const uint64_t *map, unsigned i) { return (map[i / 64] >> (i % 64)) & 1; }
+	static void setBit(uint64_t *map, unsigned i, bool val)
+	{
+		if (val)
+			map[i / 64] |= 1ULL << (i % 64);
+		else
+			map[i / 64] &= ~(1ULL << (i % 64));
+	}
+
+	void mark(int tier, unsigned code);
+	void unmark(int tier, unsigned code);
+
+public:
+	OVSFAllocator();
+
+	bool isUsed(int tier, unsigned code) const { return bit(mUsed[tier], code); }
+	bool isReserved(int tier, unsigned code) const { return bit(mReserved[tier], code); }
+	bool isFree(int tier, unsigned code) const
+	{
+		return !bit(mBelow[tier], code) && !bit(mAbove[tier], code);
+	}
+
+	/** Lowest free code in the tier, or -1 if none. */
+	int findFree(int tier) const;
+
+	/** Number of free codes in the tier. */
+	unsigned freeCount(int tier) const;
+
+	/**
+		Find a used code that conflicts with this one: the code itself, one above it or one below it.
+		@return false if there is none.
+	*/
+	bool findConflict(int tier, unsigned code, int *usedTier, unsigned *usedCode) const;
+
+	/** Allocate the lowest free code in the tier; return it, or -1 if none is free. */
+	int allocate(int tier);
+
+	/** Allocate this code, if it is free. */
+	bool allocate(int tier, unsigned code);
+
+	/** Release an allocated code. */
+	void release(int tier, unsigned code);
+
+	/**
+		Reserve a code for good.  A conflicting reservation is still made, as it is a configuration error the
+		caller reports, and the codes it blocks are blocked.
+		@return false if the code was not free.
+	*/
+	bool reserve(int tier, unsigned code);
+
+	/**
+		Plan the fewest moves of allocated codes that would free a code in the tier, if none is free now.
+		Moves are in the order they must be done, largest codes first, and each target is free once the moves
+		before it are done.  Nothing is changed; moving a live channel means reconfiguring the UE.
+		@param code Set to the code the moves free.
+		@return false if even moving codes cannot free one, because of reservations or sheer load.
+	*/
+	bool planDefrag(int tier, unsigned *code, std::vector<Move> &moves) const;
+
+	/** Recompute the derived bitmaps from scratch and compare; report any difference to os. */
+	bool check(std::ostream &os) const;
+};
+
+} // namespace UMTS
+
+#endif
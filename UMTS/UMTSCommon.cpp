@@ -14,6 +14,14 @@
  * See the LEGAL file in the main directory for details.
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "UMTSCommon.h"
 
 using namespace UMTS;
@@ -72,66 +80,142 @@ ostream &UMTS::operator<<(ostream &os, const Time &t)
 	return os;
 }
 
+static const int64_t sFrameNs = UMTS::gFrameMicroseconds * 1000LL;
+
+static long futex(uint32_t *word, int op, uint32_t val, const struct timespec *timeout, uint32_t bitset)
+{
+	return syscall(SYS_futex, word, op, val, timeout, NULL, bitset);
+}
+
+// Floor division, for times that may be a little before the base.
+static int64_t floorDiv(int64_t a, int64_t b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// A frame count from the base, as a frame number.
+static int hyperframeFN(int64_t frames)
+{
+	int fn = (int)(frames % UMTS::gHyperframe);
+	return fn < 0 ? fn + UMTS::gHyperframe : fn;
+}
+
+UMTS::Clock::Clock(const UMTS::Time &when)
+	: mSeq(0), mBaseFN(when.FN()), mBaseNs(nanoseconds()), mTick(0), mWaiters(0), mTickerStarted(false),
+	  mStop(false)
+{
+}
+
+UMTS::Clock::~Clock()
+{
+	__atomic_store_n(&mStop, true, __ATOMIC_RELEASE);
+	if (__atomic_load_n(&mTickerStarted, __ATOMIC_ACQUIRE)) {
+		mTicker.join();
+	}
+}
+
+int64_t UMTS::Clock::nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void UMTS::Clock::base(int64_t &baseFN, int64_t &baseNs, int64_t *now) const
+{
+	while (true) {
+		uint32_t seq = __atomic_load_n(&mSeq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+		baseFN = __atomic_load_n(&mBaseFN, __ATOMIC_RELAXED);
+		baseNs = __atomic_load_n(&mBaseNs, __ATOMIC_RELAXED);
+		if (now) {
+			*now = nanoseconds();
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&mSeq, __ATOMIC_RELAXED) == seq) {
+			return;
+		}
+	}
+}
+
+int64_t UMTS::Clock::elapsedFrames(int64_t now, int64_t baseNs, int64_t *fractionNs) const
+{
+	int64_t frames = floorDiv(now - baseNs, sFrameNs);
+	if (fractionNs) {
+		*fractionNs = now - baseNs - frames * sFrameNs;
+	}
+	return frames;
+}
+
 // (pat) This was called with a frame number argument, which did an auto-conversion to Time.
 // I changed the name and modified the arguments to match the call to clarify.
-void UMTS::Clock::setFN(unsigned wFN)
+void UMTS::Clock::setFN(unsigned wFN) { setBase(wFN, nanoseconds()); }
+
+int64_t UMTS::Clock::setBase(unsigned wFN, int64_t wBaseNs)
 {
-	int oldFN = FN(); // Debugging.
-	// (pat) Timeval is a surprisingly expensive operation, so I moved outside the lock period.
-	Timeval now(0);
-	mLock.lock();
-	mBaseTime = now;
-	mBaseFN = wFN;
-	mLock.unlock();
+	// Writers take the sequence odd, so readers retry until the base is whole again.  Readers sample the time
+	// inside the sequence too, so every reader that got the old base read the time before now.
+	uint32_t seq = __atomic_load_n(&mSeq, __ATOMIC_RELAXED);
+	while ((seq & 1) ||
+		!__atomic_compare_exchange_n(&mSeq, &seq, seq + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		seq = __atomic_load_n(&mSeq, __ATOMIC_RELAXED);
+	}
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t now = nanoseconds();
+	int64_t oldBaseFN = __atomic_load_n(&mBaseFN, __ATOMIC_RELAXED);
+	int64_t oldBaseNs = __atomic_load_n(&mBaseNs, __ATOMIC_RELAXED);
+	int oldFN = hyperframeFN(oldBaseFN + elapsedFrames(now, oldBaseNs, NULL));
+
+	// A base that puts the clock back in the frame before the one it read comes from an indication that
+	// arrived late, or from a frame number read just before a boundary and set just after.  Rather than step
+	// every reader back a frame, hold the clock at the start of the frame it read; the next indication
+	// brings the phase back.  Larger steps back are resyncs and are taken as they are.
+	if (FNDelta(hyperframeFN(wFN + elapsedFrames(now, wBaseNs, NULL)), oldFN) == -1) {
+		wFN = oldFN;
+		wBaseNs = now;
+	}
+
+	__atomic_store_n(&mBaseFN, (int64_t)wFN, __ATOMIC_RELAXED);
+	__atomic_store_n(&mBaseNs, wBaseNs, __ATOMIC_RELAXED);
+	__atomic_store_n(&mSeq, seq + 2, __ATOMIC_RELEASE);
+
+	// Waiters computed their deadlines from the old base.
+	__atomic_add_fetch(&mTick, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&mWaiters, __ATOMIC_SEQ_CST)) {
+		futex(&mTick, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, NULL, FUTEX_BITSET_MATCH_ANY);
+	}
+
+	// Where the old base had frame wFN start, taking the frame number the shortest way round the hyperframe.
+	const int64_t hyperframe = gHyperframe;
+	int64_t frames = ((int64_t)wFN - oldBaseFN) % hyperframe;
+	if (frames >= hyperframe / 2) {
+		frames -= hyperframe;
+	} else if (frames < -hyperframe / 2) {
+		frames += hyperframe;
+	}
+	int64_t moved = wBaseNs - (oldBaseNs + frames * sFrameNs);
 
 	{ // Debugging:
-		int diff = FNDelta(oldFN, wFN);
+		int diff = FNDelta(oldFN, FN());
 		if (diff > 1 || diff < -1) {
 			LOG(NOTICE) << "clock set FN:" << LOGVAR(oldFN) << LOGVAR2("newFN", wFN) << LOGVAR(diff)
-				    << LOGVAR2("BaseTime.sec", mBaseTime.sec()) << LOGVAR2(".usec", mBaseTime.usec())
-				    << LOGVAR2("t", format("%.2f", timef()));
+				    << LOGVAR2("baseNs", wBaseNs) << LOGVAR2("t", format("%.2f", timef()));
 		}
 	}
+	return moved;
 }
 
 // If fractionUSecs is non-null, return the fraction into the next cycle in usecs.
+// There is no lock and no shared write here; see the sequence lock in base().
 int32_t UMTS::Clock::FN(uint32_t *fractionUSecs) const
 {
-	Timeval now;  // (pat) Timeval is a surprisingly expensive operation, so I moved outside the lock period.
-	mLock.lock(); // (pat) lock synchronizes changes to mBaseTime and mBaseFN by setFN().
-	int32_t deltaSec = now.sec() - mBaseTime.sec();
-	int32_t deltaUSec = (signed)now.usec() - (signed)mBaseTime.usec(); // (pat) added the (signed) cast.
-	int64_t elapsedUSec = 1000000LL * deltaSec + deltaUSec;
-	int64_t elapsedFrames = elapsedUSec / UMTS::gFrameMicroseconds;
-	int32_t currentFN = (mBaseFN + elapsedFrames) % UMTS::gHyperframe;
+	int64_t baseFN, baseNs, now, fractionNs;
+	base(baseFN, baseNs, &now);
+	int32_t currentFN = hyperframeFN(baseFN + elapsedFrames(now, baseNs, &fractionNs));
 	if (fractionUSecs) {
-		*fractionUSecs = (uint32_t)elapsedUSec / UMTS::gFrameMicroseconds;
-	}
-	mLock.unlock();
-
-	{ // Debugging: Time must be monotonically increasing.
-		static int prevFN = -1;
-		static Timeval prev;
-		static uint32_t prevdeltaSec, prevdeltaUSec;
-		static uint64_t prevelapsedUSec, prevelapsedFrames;
-		bool backwards = (prevFN >= 0 && FNDelta(currentFN, prevFN) < 0);
-		if (backwards) {
-			LOG(NOTICE) << (backwards ? "TIME RAN BACKWARDS:" : "TIME:") << LOGVAR(prevFN)
-				    << LOGVAR2("prev.sec", prev.sec()) << LOGVAR2("usec", prev.usec())
-				    << LOGVAR(currentFN) << LOGVAR2("now.sec", now.sec()) << LOGVAR2("usec", now.usec())
-				    << LOGVAR(deltaSec) << LOGVAR(deltaUSec) << LOGVAR(elapsedUSec)
-				    << LOGVAR(elapsedFrames) << endl;
-			LOG(NOTICE) << LOGVAR2("basetime.sec", mBaseTime.sec()) << LOGVAR2("usec", mBaseTime.usec())
-				    << endl;
-			LOG(NOTICE) << LOGVAR(prevdeltaSec) << LOGVAR(prevdeltaUSec) << LOGVAR(prevelapsedUSec)
-				    << LOGVAR(prevelapsedFrames);
-		}
-		prevFN = currentFN;
-		prevdeltaSec = deltaSec;
-		prevdeltaUSec = deltaUSec;
-		prevelapsedUSec = elapsedUSec;
-		prevelapsedFrames = elapsedFrames;
-		prev = now;
+		*fractionUSecs = (uint32_t)(fractionNs / 1000);
 	}
 	return currentFN;
 }
@@ -157,36 +241,90 @@ int UMTS::FNCompare(int16_t v1, int16_t v2)
 	return 0;
 }
 
+void *UMTS::Clock::tickLoopAdapter(void *arg)
+{
+	((const Clock *)arg)->tickLoop();
+	return NULL;
+}
+
+// Sleep to each slot boundary and wake the waiters for each frame that started.  Slot boundaries are
+// computed from the base every time, so a setFN() takes effect at the next tick.
+void UMTS::Clock::tickLoop() const
+{
+	// Timer slack only ever makes the tick late, so ask for none.
+	prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+	int64_t lastFrame = -1;
+	while (!__atomic_load_n(&mStop, __ATOMIC_ACQUIRE)) {
+		int64_t baseFN, baseNs;
+		base(baseFN, baseNs);
+		int64_t slots = floorDiv((nanoseconds() - baseNs) * gFrameSlots, sFrameNs);
+		int64_t next = baseNs + ((slots + 1) * sFrameNs + gFrameSlots - 1) / gFrameSlots;
+		struct timespec ts;
+		ts.tv_sec = next / 1000000000LL;
+		ts.tv_nsec = next % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		}
+
+		// Sequentially consistent against the waiter's increment of mWaiters and its read of mTick, so
+		// either we see the waiter or its futex sees the new tick.
+		__atomic_add_fetch(&mTick, 1, __ATOMIC_SEQ_CST);
+		base(baseFN, baseNs);
+		int64_t frame = baseFN + elapsedFrames(nanoseconds(), baseNs, NULL);
+		if (frame != lastFrame && __atomic_load_n(&mWaiters, __ATOMIC_SEQ_CST)) {
+			// Waiters sleep on bit (FN & 31) of their target; wake every frame that started.
+			uint32_t bits = 0;
+			if (lastFrame < 0 || frame - lastFrame >= 32 || frame < lastFrame) {
+				bits = FUTEX_BITSET_MATCH_ANY;
+			} else {
+				for (int64_t f = lastFrame + 1; f <= frame; f++) {
+					bits |= 1U << (f & 31);
+				}
+			}
+			futex(&mTick, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, NULL, bits);
+		}
+		lastFrame = frame;
+	}
+}
+
 // (pat 12-13-2012) Formerly this waited an integral number of whole frames, so if it was in the middle
 // of a frame, it waited until the middle of the target frame.
 // Now it waits until the start of the specified 'when' frame.
 void UMTS::Clock::wait(const Time &when) const
 {
-	uint32_t fraction;
-	int16_t now = FN(&fraction);
-	int16_t target = when.FN();
-	// (pat) I think this was a bug because it should use modulo arith, and fixed:
-	// if (now>=target) return;
-	int16_t delta = FNDelta(target, now);
-	if (delta <= 0) {
-		return;
-	} // (pat) added
-	// The usleep amount is limited to 1e6.
-	// 9-8-2012 pat: usleep value is limited to 1000000, so switch to nanosleep.
-	// Also, nanosleep solves the problem that these calls may return early on interrupt,
-	// which is difficult to correct with usleep.
-	// The max sleep time is 2048 * 1e6 usecs, which just fits in 31 bits.
-	// 12-30-2012, pat: I tried leaving the fraction of a cycle out to debug why the
-	// stupid Sierra Wireless Modem is so flaky, but did not help.
-	uint32_t totalUsecs = delta * UMTS::gFrameMicroseconds - fraction;
-	struct timespec howlong, rem;
-	howlong.tv_sec = totalUsecs / 1000000;
-	howlong.tv_nsec = (totalUsecs - 1000000 * howlong.tv_sec) * 1000;
-	while (0 != nanosleep(&howlong, &rem)) {
-		howlong = rem;
+	if (!__atomic_load_n(&mTickerStarted, __ATOMIC_ACQUIRE) &&
+		!__atomic_exchange_n(&mTickerStarted, true, __ATOMIC_ACQ_REL)) {
+		mTicker.start(tickLoopAdapter, (void *)this);
 	}
 
-	// static const int32_t maxSleep = 100;
-	// if (delta>maxSleep) delta=maxSleep;
-	// usleep(delta*UMTS::gFrameMicroseconds);
+	// Nor for the timeout of the caller, as in tickLoop().
+	static __thread bool slackSet = false;
+	if (!slackSet) {
+		prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+		slackSet = true;
+	}
+
+	const int16_t target = when.FN();
+	while (true) {
+		uint32_t tick = __atomic_load_n(&mTick, __ATOMIC_SEQ_CST);
+		int64_t baseFN, baseNs, now, fractionNs;
+		base(baseFN, baseNs, &now);
+		int16_t fn = hyperframeFN(baseFN + elapsedFrames(now, baseNs, &fractionNs));
+		// (pat) I think this was a bug because it should use modulo arith, and fixed:
+		// if (now>=target) return;
+		int16_t delta = FNDelta(target, fn);
+		if (delta <= 0) {
+			return;
+		} // (pat) added
+
+		// The tick thread wakes us at the frame boundary, and the timeout is the boundary too, so whichever
+		// of the two timers fires first wins.  A tick or setFN() between reading mTick and sleeping makes the
+		// futex return at once.
+		int64_t deadline = now + delta * sFrameNs - fractionNs;
+		struct timespec ts;
+		ts.tv_sec = deadline / 1000000000LL;
+		ts.tv_nsec = deadline % 1000000000LL;
+		__atomic_add_fetch(&mWaiters, 1, __ATOMIC_SEQ_CST);
+		futex(&mTick, FUTEX_WAIT_BITSET_PRIVATE, tick, &ts, 1U << (target & 31));
+		__atomic_sub_fetch(&mWaiters, 1, __ATOMIC_RELEASE);
+	}
 }
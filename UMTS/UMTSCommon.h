@@ -21,6 +21,7 @@
 
 #include <CommonLibs/BitVector.h>
 #include <CommonLibs/Interthread.h>
+#include <CommonLibs/Threads.h>
 #include <CommonLibs/Timeval.h>
 #include <GSM/GSMCommon.h>
 
@@ -237,30 +238,73 @@ std::ostream &operator<<(std::ostream &os, const Time &ts);
 
 /**
 	A class for calculating the current UMTS frame number.
-	Has built-in concurrency protections.
+
+	The clock is a base frame number at a base CLOCK_MONOTONIC time; the current frame number is computed from
+	the elapsed time.  setFN(), called by the transceiver clock handler, is the only writer.  Everything else
+	reads, from dozens of threads, every slot or frame, so the base is published under a sequence lock:
+	readers never block or write a shared cache line, they just retry in the rare case setFN() ran at the
+	same time.
+
+	wait() does not sleep on its own timer.  The first caller starts a tick thread that sleeps to each slot
+	boundary with fine timer slack and, at each frame boundary, wakes the threads waiting for that frame with
+	a futex.  Waiters go back to sleep until their own frame, so a thread waiting a long time costs nothing,
+	and a setFN() that moves the clock wakes every waiter to recompute.
+
+	Setting the clock never takes it back by a single frame; see setBase().
 */
 class Clock {
 
 private:
-	mutable Mutex mLock;
+	mutable uint32_t mSeq; ///< Sequence lock; odd while setFN() is writing.
 	int64_t mBaseFN;
-	Timeval mBaseTime;
+	int64_t mBaseNs;       ///< CLOCK_MONOTONIC at mBaseFN, in nanoseconds.
+
+	mutable uint32_t mTick;    ///< Futex word, bumped at every slot tick and by setFN().
+	mutable uint32_t mWaiters; ///< Threads in wait(), so the tick thread can skip the wake call.
+	mutable bool mTickerStarted;
+	mutable bool mStop;
+	mutable Thread mTicker;
+
+	/** Read the base under the sequence lock, and if now is non-null the time along with it. */
+	void base(int64_t &baseFN, int64_t &baseNs, int64_t *now = NULL) const;
+
+	/** Frames and the nanoseconds into the current frame, since the base, at now. */
+	int64_t elapsedFrames(int64_t now, int64_t baseNs, int64_t *fractionNs) const;
+
+	void tickLoop() const;
+	static void *tickLoopAdapter(void *arg);
+
+	Clock(const Clock &);
+	Clock &operator=(const Clock &);
 
 public:
-	Clock(const UMTS::Time &when = UMTS::Time(0)) : mBaseFN(when.FN()) {}
+	Clock(const UMTS::Time &when = UMTS::Time(0));
+	~Clock();
+
+	/** Monotonic time in nanoseconds, the clock's time base. */
+	static int64_t nanoseconds();
 
 	/** Set the clock to a value. */
 	// (pat) This is called by TRXManager.cpp:TransceiverManager::clockHandler()
 	// However, I was seeing it called regularly, which is a bad thing.
 	void setFN(unsigned wFN);
 
-	/** Read the clock. */
+	/**
+		Set the clock so frame wFN starts at CLOCK_MONOTONIC nanosecond wBaseNs, for the clock indication
+		estimator, which knows better than the arrival time of the indication.
+		If that would put the clock in the frame before the one it reads now, it is held at the start of the
+		current frame instead, so readers never see the frame number go back by one.
+		@return How far this moved the start of frame wFN, in nanoseconds, later if positive.
+	*/
+	int64_t setBase(unsigned wFN, int64_t wBaseNs);
+
+	/** Read the clock; if fractionUSecs is non-null, also return how far into the frame it is. */
 	int32_t FN(uint32_t *fractionUSecs = NULL) const;
 
 	/** Read the clock. */
 	UMTS::Time get() const { return UMTS::Time(FN()); }
 
-	/** Block until the clock passes a given time. */
+	/** Block until the start of the given frame. */
 	void wait(const UMTS::Time &) const;
 };
 
@@ -23,6 +23,7 @@
 
 #include <CommonLibs/Configuration.h>
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
 
 #include "RateMatch.h"
 #include "UMTSConfig.h"
@@ -201,6 +202,15 @@ static void initSize(SoftVector &b, unsigned size)
 	}
 }
 
+static void initSize(SoftVector8 &b, unsigned size)
+{
+	if (b.size() == 0) {
+		b.resize(size);
+	} else {
+		assert(b.size() == size);
+	}
+}
+
 // This duplicates functionality in fecComputeUlTrChSizes and fecComputeDlTrChSizes and is used for testing.
 // Init the L1CCTrChInfo for a simplified full support channel: rach/fach/dch.
 // For uplink: one TrCh, one TF.
@@ -766,13 +776,13 @@ L1TrChEncoder::L1TrChEncoder(L1CCTrCh *wParent, L1FecProgInfo *wfpi) : mParent(w
 	rateMatchComputeEplus(nin, nout, &mDlEplus, &mDlEminus);
 }
 
-L1TrChDecoder::L1TrChDecoder(L1CCTrCh *wParent, L1FecProgInfo *wfpi) : mParent(wParent), mUpstream(NULL)
+L1TrChDecoder::L1TrChDecoder(L1CCTrCh *wParent, L1FecProgInfo *wfpi)
+	: mParent(wParent), mFixedPoint(false), mUpstream(NULL)
 {
 	// unsigned frameSize = gFrameLen / getSF();
 	unsigned nrf = wfpi->getNumRadioFrames(); // number of radio frames per tti
 	// mDTtiBuf = new SoftVector(mRadioFrameSz * nrf);
-	// mRMBuf and mDTtiBuf are after rate-matching:
-	initSize(mRMBuf, wfpi->mHighSideRMSz);
+	// mDTtiBuf is after rate-matching:
 	initSize(mDTtiBuf, wfpi->mHighSideRMSz * nrf);
 	mDTtiIndex = 0;
 
@@ -1406,23 +1416,18 @@ void L1CCTrChUplink::l1WriteLowSideFrame(const RxBitsBurst &burst, float tfci[30
 {
 	LOG_UPLINK "l1WriteLowSideFrame " << timestr() << " RxBitsBurst:" << burst.str();
 
-	// Start a new radio frame.
-	mReceiveTime = burst.time();
+	// The whole radio frame is here, so there is nothing to accumulate; the frame goes straight to the TrChs.
 	mSlotSize = burst.size() / gFrameSlots;
+	unsigned frameIndex = burst.time().FN();
+	memcpy(mRawTfciAccumulator, tfci, sizeof(mRawTfciAccumulator));
+	unsigned tfc = findTfci(mRawTfciAccumulator, mNumTfc);
+	LOG(NOTICE) << "TFCI: " << tfc << " time: " << burst.time();
 
-	// Check for skipped frames.
-	if (burst.time().FN() != mReceiveTime.FN()) {
-		// Hopeless.  Any slots we saved previously are useless; discard them.
-		LOG(NOTICE) << "Incoming skipped frames, expected=" << mReceiveTime << " burst.time=" << burst.time();
-		mReceiveTime = UMTS::Time(0, 1); // Set to garbage.
-		return;
-	}
+	l1Demultiplexer(burst.begin(), mSlotSize * gFrameSlots, tfc, frameIndex);
 
-	for (unsigned j = 0; j < gFrameSlots; j++) {
-		SoftVector burstSeg(burst.segment(j * mSlotSize, mSlotSize));
-		float tfciSeg[2] = {tfci[j * 2], tfci[j * 2 + 1]};
-		l1AccumulateSlots(&burstSeg, tfciSeg);
-	}
+	// Next expected is the first slot of the next frame.
+	mReceiveTime = burst.time();
+	mReceiveTime.incTN(gFrameSlots);
 	// LOG(INFO) << "2: mReceiveTime: " << mReceiveTime << " burstTime: " << burst.time();
 }
 
@@ -1454,33 +1459,16 @@ void L1CCTrChUplink::l1AccumulateSlots(const SoftVector *e, const float tfcibits
 	// 25.212 4.2.12 Physical Channel Mapping.
 	// "In compressed mode..."  Nope.
 
-	l1SecondDeinterleaving(mDSlotAccumulatorBuf, tfci, frameIndex);
+	l1Demultiplexer(mDSlotAccumulatorBuf.begin(), fullsize, tfci, frameIndex);
 }
 
-// It is called the 2nd interleaving but in uplink it happens before the 1st interleaving.
-void L1CCTrChUplink::l1SecondDeinterleaving(SoftVector &v, unsigned tfci, unsigned frameIndex)
+// The input here is one radio-frame, ie, 15 slots worth, still 2nd interleaved.
+// Chop it up into TrChs using the TFs specified by tfci, and send each straight to its decoder.
+void L1CCTrChUplink::l1Demultiplexer(const float *frame, unsigned frameSize, unsigned tfci, unsigned frameIndex)
 {
-
-	// 25.212 4.2.11 Second Interleaving.
-	// The SF and therefore the incoming buffer size can vary with each uplink TFC.
-	// const_cast<SoftVector&>(frame).deInterleavingNP(30, TrCHConsts::inter2Perm, *mHDIBuf);
-	if (v.size() != mHDIBuf.size()) {
-		mHDIBuf.resize(v.size());
-	}
-	v.deInterleavingNP(30, TrCHConsts::inter2Perm, mHDIBuf);
-	// assert(mHDIBuf.size() == frameSize);
-	// OBJLOG(INFO) << "2nd deinterleaved " << mHDIBuf.size() << " " << mHDIBuf;
-
+	// 25.212 4.2.11 Second Interleaving happens inside each TrCh's scatter.
 	// 25.212 4.2.10 Physical Channel Segmentation.
 	// "When more than one PhCh is used..."  Nope.
-
-	l1Demultiplexer(mHDIBuf, tfci, frameIndex);
-}
-
-// The input here is one radio-frame, ie, 15 slots worth.
-// Chop it up into TrChs using the TFs specified by tfci, and send it up to rate matching.
-void L1CCTrChUplink::l1Demultiplexer(SoftVector &frame, unsigned tfci, unsigned frameIndex)
-{
 	// 25.212 4.2.8 TrCh (De-)Multiplexing.
 	if (tfci >= getNumTfc()) {
 		// Invalid data.
@@ -1492,79 +1480,66 @@ void L1CCTrChUplink::l1Demultiplexer(SoftVector &frame, unsigned tfci, unsigned
 		// unsigned tfi = tfc->getTfIndex(tcid);
 		L1FecProgInfo *fpi = getFPI(tcid, tfci);
 		unsigned nbits = fpi->mLowSideRMSz; // Number of bits to go to this TrCh.
-		// printf("nbits: %d %d %u %u\n",nbits, fpi->mHighSideRMSz, loc,tfci);
 		if (!nbits) {
 			continue;
 		} // No bits for this TrCh this time.
-		// printf("framesize: %u %u %u %u\n",frame.size(),nbits,loc,tfci);
-		SoftVector tmp(frame.segment(loc, nbits));
+		if (loc + nbits > frameSize) {
+			LOG(ERR) << "uplink TrCh does not fit in radio frame" << LOGVAR(tcid) << LOGVAR(tfci) << LOGVAR(loc)
+				 << LOGVAR(nbits) << LOGVAR(frameSize);
+			return;
+		}
+		mDecoders[tcid][tfci]->l1ScatterFrame(fpi, frame, frameSize, loc, frameIndex);
 		loc += nbits;
-		mDecoders[tcid][tfci]->l1RateMatching(fpi, tmp, frameIndex);
 	}
-	// printf("loc: %d, frame.size: %d\n",loc,frame.size());
 	if (loc == 0)
 		return;
-	if (loc != frame.size())
-		LOG(INFO) << "loc: " << loc << " " << frame.size();
-	// assert(loc == frame.size());
+	if (loc != frameSize)
+		LOG(INFO) << "loc: " << loc << " " << frameSize;
 }
 
-void L1TrChDecoder::l1RateMatching(L1FecProgInfo *fpi, SoftVector &frame, unsigned frameIndex)
+// 25.212 4.2.11 2nd de-interleaving, 4.2.7 rate matching, 4.2.6 radio frame un-segmentation and 4.2.5 1st
+// de-interleaving, all in one move of this TrCh's soft bits from the radio frame to the TTI buffer.
+void L1TrChDecoder::l1ScatterFrame(L1FecProgInfo *fpi, const float *frame, unsigned frameSize, unsigned loc,
+	unsigned frameIndex)
 {
-	// 25.212 4.2.7 Rate Matching.
-	unsigned insize = fpi->mLowSideRMSz;
-	assert(frame.size() == insize);
-	unsigned outsize = fpi->mHighSideRMSz; // this->mCodeInBkSz/this->l1GetNumRadioFrames();
-	mDTtiIndex = frameIndex % fpi->getNumRadioFrames();
-	if (insize == outsize) {
-		l1RadioFrameUnsegmentation(fpi, frame);
-	} else {
-		rateMatchFunc<float>(frame, mRMBuf, this->mEini[mDTtiIndex]);
-		OBJLOG(INFO) << "insize: " << insize << "outsize: " << outsize;
-		// OBJLOG(INFO) << "rate-unmatched" << mRMBuf.size() << " " << mRMBuf;
-		l1RadioFrameUnsegmentation(fpi, mRMBuf);
+	unsigned nbits = fpi->mLowSideRMSz;
+	unsigned numFramesPerTti = fpi->getNumRadioFrames();
+	if (!mScatter.built(frameSize, loc, nbits)) {
+		// Only when the TFC is first used or the UE changes SF.
+		if (!mScatter.build(frameSize, loc, nbits, fpi->mHighSideRMSz, mEini, numFramesPerTti,
+			    fpi->inter1Columns(), fpi->inter1Perm())) {
+			OBJLOG(ERR) << "uplink scatter failed" << LOGVAR(frameSize) << LOGVAR(loc) << LOGVAR(nbits);
+			return;
+		}
+		assert(mScatter.ttiSize() == mDTtiBuf.size());
+		OBJLOG(INFO) << "uplink scatter" << LOGVAR(frameSize) << LOGVAR(loc) << LOGVAR(nbits)
+			     << LOGVAR2("outsize", fpi->mHighSideRMSz);
 	}
-}
 
-void L1TrChDecoder::l1RadioFrameUnsegmentation(L1FecProgInfo *fpi, const SoftVector &frame)
-{
-	// 25.212 4.2.6 Radio Frame Un-Segmentation.
-	// If not using TTI=10ms, At this point we have to reaccumulate the complete TTI data.
-	TTICodes tticode = fpi->getTTICode();
-	if (tticode == TTI10ms) {
-		l1FirstDeinterleave(fpi, frame);
-		return;
+	mDTtiIndex = frameIndex % numFramesPerTti;
+	if (mFixedPoint) {
+		mScatter.scatter(frame, mDTtiIndex, mDTtiBuf8.begin(), mQuantizer);
+	} else {
+		mScatter.scatter(frame, mDTtiIndex, mDTtiBuf.begin());
 	}
-
-	// Accumulate one ttis worth of Radio Frames into mDTtiBuf.
-	frame.copyToSegment(mDTtiBuf, mDTtiIndex * frame.size());
-
-	unsigned numFramesPerTti = fpi->getNumRadioFrames();
 	if (mDTtiIndex < numFramesPerTti - 1) {
 		return;
 	}
 	mDTtiIndex = 0; // prep for next TTI
-	l1FirstDeinterleave(fpi, mDTtiBuf);
-}
-
-// It is called the 1st interleaving but in uplink it happens after the 2nd interleaving.
-void L1TrChDecoder::l1FirstDeinterleave(L1FecProgInfo *fpi, const SoftVector &d)
-{
-	// first interleave - 25.212, 4.2.5
-	SoftVector t(d.size());
-	const_cast<SoftVector &>(d).deInterleavingNP(fpi->inter1Columns(), fpi->inter1Perm(), t);
-	// OBJLOG(INFO) << "deinterleaved " << t.size() << " " << t;
 
 	// radio frame equalization - 25.212, 4.2.4
 	// TODO
-	SoftVector c = t.alias();
-
-	l1ChannelDecoding(fpi, c);
+	if (mFixedPoint) {
+		l1ChannelDecoding(fpi, mDTtiBuf8);
+	} else {
+		l1ChannelDecoding(fpi, mDTtiBuf);
+	}
 }
 
 // Input is post-radio-frame-segmentation, which means input is the accumulation
 // of 1, 2, 4, 8 radio frames based on the TTI=10,20,40,80
-void L1TrChDecoder::l1ChannelDecoding(L1FecProgInfo *fpi, const SoftVector &c)
+template <class SV>
+void L1TrChDecoder::l1ChannelDecoding(L1FecProgInfo *fpi, const SV &c)
 {
 	// FIXME -- This stuff assumes a rate-1/2 coder.
 
@@ -1661,8 +1636,14 @@ void L1TrChDecoder::l1Deconcatenation(L1FecProgInfo *fpi, BitVector &b)
 	}
 }
 
+static StatCounter sGoodFrames("UMTS.L1.Frames.Good", "uplink CCTrCh frames that passed every CRC");
+static StatCounter sBadFrames("UMTS.L1.Frames.Bad", "uplink CCTrCh frames with a failed CRC");
+static StatHistogram sConvDecodeTime("UMTS.L1.Decode.Conv", "us", "convolutional decode time per code block");
+static StatHistogram sTurboDecodeTime("UMTS.L1.Decode.Turbo", "us", "turbo decode time per code block");
+
 void L1FER::countGoodFrame()
 {
+	sGoodFrames.inc();
 	// unnecessary: ScopedLock lock(mLock);
 	static const float a = 1.0F / ((float)mFERMemory);
 	static const float b = 1.0F - a;
@@ -1672,6 +1653,7 @@ void L1FER::countGoodFrame()
 
 void L1FER::countBadFrame()
 {
+	sBadFrames.inc();
 	static const float a = 1.0F / ((float)mFERMemory);
 	static const float b = 1.0F - a;
 	mFER = b * mFER + a;
@@ -1707,9 +1689,36 @@ void L1TrChEncoderLowRate::encode(BitVector &in, BitVector &c)
 	LOG_DOWNLINK << "convoluted " << c.str();
 }
 
+void L1TrChDecoder::decode(const SoftVector8 &c, BitVector &o)
+{
+	SoftVector f(c.size());
+	for (unsigned i = 0; i < c.size(); i++) {
+		f[i] = mQuantizer.dequantize(c[i]);
+	}
+	decode(f, o);
+}
+
+L1TrChDecoderLowRate::L1TrChDecoderLowRate(L1CCTrCh *wParent, L1FecProgInfo *wfpi) : L1TrChDecoder(wParent, wfpi)
+{
+	mFixedPoint = gConfig.getBool("UMTS.Uplink.FixedPointDecoding");
+	if (mFixedPoint) {
+		mQuantizer = SoftQuantizer(gConfig.getFloat("UMTS.Uplink.SoftBitScale"));
+		initSize(mDTtiBuf8, mDTtiBuf.size());
+	}
+}
+
+void L1TrChDecoderLowRate::decode(const SoftVector8 &c, BitVector &o)
+{
+	StatTimer timer(sConvDecodeTime);
+	mVFixed.decode(c, o);
+}
+
 void L1TrChDecoderLowRate::decode(const SoftVector &c, BitVector &o)
 {
-	c.decode(mVCoder, o);
+	{
+		StatTimer timer(sConvDecodeTime);
+		c.decode(mVCoder, o);
+	}
 	LOG_UPLINK << "unconvoluted " << c.str(); //<< c.size() << " " << c;
 }
 
@@ -1763,7 +1772,10 @@ void L1TrChDecoderTurbo::decode(const SoftVector &c, BitVector &o)
 {
 	// coding - 25.212, 4.2.3.1
 	// concatenation of encoded blocks - 25.212, 4.2.3.3
-	c.decode(mTCoder, o, mInterleaver);
+	{
+		StatTimer timer(sTurboDecodeTime);
+		c.decode(mTCoder, o, mInterleaver);
+	}
 	LOG_UPLINK << "turbo " << o.str(); // o.size() << " " << o;
 }
 
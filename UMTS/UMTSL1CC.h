@@ -28,6 +28,7 @@
 #include "MACEngine.h"
 #include "UMTSCommon.h"
 #include "UMTSL1Const.h"
+#include "UMTSL1Scatter.h"
 #include "UMTSPhCh.h"
 #include "URRCDefs.h"
 #include "URRCTrCh.h"
@@ -415,10 +416,13 @@ class L1TrChDecoder : public L1FER {
 protected:
 	L1CCTrCh *mParent;
 	// L1FecProgInfo *mFpi;
-	SoftVector mRMBuf;   // Rate-match  buffer.
-	SoftVector mDTtiBuf; // A full TTI of data.
+	SoftVector mDTtiBuf; // A full TTI of data, 1st de-interleaved, ready for the channel decoder.
+	SoftVector8 mDTtiBuf8; // The same in fixed point, used instead of mDTtiBuf if mFixedPoint.
+	bool mFixedPoint;
+	SoftQuantizer mQuantizer;
 	unsigned mDTtiIndex; // Incoming index in mDTtti in the range 0..8, depending on TTI
 	int mEini[8];	// Uplink pre-computed rate matching parameters.
+	L1UplinkScatter mScatter; // Radio frame to mDTtiBuf positions.
 
 	/** Connect the upstream MacEngine.  */
 	// Return the old one, used for testing.
@@ -446,16 +450,18 @@ private:
 	BitVector expectParity;
 
 public:
-	void l1RateMatching(L1FecProgInfo *fpi, SoftVector &f, unsigned frameIndex);
-	void l1RadioFrameUnsegmentation(L1FecProgInfo *fpi, const SoftVector &e);
-	void l1FirstDeinterleave(L1FecProgInfo *fpi, const SoftVector &d);
-	void l1ChannelDecoding(L1FecProgInfo *fpi, const SoftVector &);
+	void l1ScatterFrame(L1FecProgInfo *fpi, const float *frame, unsigned frameSize, unsigned loc,
+		unsigned frameIndex);
+	template <class SV>
+	void l1ChannelDecoding(L1FecProgInfo *fpi, const SV &);
 	void l1Deconcatenation(L1FecProgInfo *fpi, BitVector &);
 
 protected:
 	// Interface to the convolutional or turbo coder:
 	/** Invoke the actual decoder. */
 	virtual void decode(const SoftVector &c, BitVector &o) = 0;
+	/** Invoke the decoder on fixed point soft bits.  This default goes back to floats. */
+	virtual void decode(const SoftVector8 &c, BitVector &o);
 	virtual bool isTurbo() const = 0;
 	/** 25.212 4.2.2: Z is defined as the maximum code block size for this encoder. */
 	virtual unsigned getZ() const = 0;
@@ -479,11 +485,13 @@ public:
 class L1TrChDecoderLowRate : public L1TrChDecoder {
 protected:
 	ViterbiR2O9 mVCoder;
+	ViterbiR2O9Fixed mVFixed;
 
 public:
-	L1TrChDecoderLowRate(L1CCTrCh *wParent, L1FecProgInfo *wfpi) : L1TrChDecoder(wParent, wfpi) {}
+	L1TrChDecoderLowRate(L1CCTrCh *wParent, L1FecProgInfo *wfpi);
 
 	void decode(const SoftVector &c, BitVector &o);
+	void decode(const SoftVector8 &c, BitVector &o);
 	unsigned getZ() const { return 504; } // Max convolutional block size is a constant from 25.212 4.2.3
 	bool isTurbo() const { return false; }
 };
@@ -572,13 +580,8 @@ private:
 protected:
 	void l1AccumulateSlots(const SoftVector *e, const float tfcibits[2]);
 
-private:
-	SoftVector mHDIBuf; // uplink 2nd De-interleaving buffer.
-protected:
-	void l1SecondDeinterleaving(SoftVector &e, unsigned tfci, unsigned frameIndex);
-
 protected:
-	void l1Demultiplexer(SoftVector &e, unsigned tfci, unsigned frameIndex);
+	void l1Demultiplexer(const float *frame, unsigned frameSize, unsigned tfci, unsigned frameIndex);
 
 protected:
 	SoftVector mFillerBurst;
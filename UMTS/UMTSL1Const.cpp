@@ -12,6 +12,13 @@
  * See the LEGAL file in the main directory for details.
  */
 
+#include <assert.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <Globals/Defines.h>
 
 #include "UMTSCommon.h"
@@ -182,12 +189,31 @@ void TrCHConsts::initTfciCodes()
 		}
 		sTfciCodes[tfci] = result;
 	}
+
+	// Columns 0..4 of the table number the 32 code bits, so TFCI bits a0..a4 pick a Walsh function over that
+	// numbering, a5 is the all ones column and a6..a9 a mask.
+	uint32_t seen = 0;
+	for (unsigned i = 0; i <= 31; i++) {
+		unsigned position = 0, mask = 0;
+		for (unsigned n = 0; n <= 4; n++) {
+			position |= reedMullerTable[i][n] << n;
+		}
+		for (unsigned n = 6; n <= 9; n++) {
+			mask |= reedMullerTable[i][n] << (n - 6);
+		}
+		sTfciPosition[i] = position;
+		sTfciMaskBits[i] = mask;
+		seen |= 1u << position;
+	}
+	assert(seen == 0xffffffff);
 }
 
 // This is the wonderfully redundant redundant C++ way to declare declare static members.
 bool TrCHConsts::oneTimeInit = false;
 uint16_t TrCHConsts::sDlPilotBitPattern[4][15];
 uint32_t TrCHConsts::sTfciCodes[sMaxTfci]; // Table for up to 8 bit tfci, plenty for us.
+uint8_t TrCHConsts::sTfciPosition[32];
+uint8_t TrCHConsts::sTfciMaskBits[32];
 
 // TrCHConsts::TrCHConsts(TTICodes wTTImsDiv10Log2) :mTTImsDiv10Log2(wTTImsDiv10Log2)
 TrCHConsts::TrCHConsts()
@@ -217,36 +243,110 @@ TrCHConsts gDummyTrCHConsts; // need to be declared somewhere once to fill up st
 
 // In uplink each slot has 2 TFCI bits which are concatenated to form 30 bits,
 // from which we attempt to retrieve the original tfci.
-// TODO: Probably want a proper Reed-Muller soft decoder
+// The score of a tfci is how many of the 30 soft bits agree with its code, as it always was, but it comes out of a
+// 32 point fast Hadamard transform, which scores 32 tfcis at once and their complements with the same numbers.
+// One transform per mask (tfci bits a6..a9) scores every tfci, so the 64 tfcis of a mask take 80 adds instead of
+// 30 each.  Ties go to the lowest tfci.
 unsigned findTfci(float *rawTfciAccumulator, // Of size [gUlRawTfciSize]
 	unsigned numTfcis)
 {
 	float *bits = rawTfciAccumulator;
 
+	assert(numTfcis <= TrCHConsts::sMaxTfci);
+	// A soft bit h agrees with a 0 by 1-h and with a 1 by h, so a score is 15 plus half the sum over the bits of
+	// (1-2h), negated where the code has a 1.  Bits 30 and 31 are never sent.
+	float signs[32];
+	for (unsigned b = 0; b < 30; b++) {
+		signs[b] = 1.0F - 2.0F * RN_BOUND(bits[b], 0.0F, 1.0F);
+	}
+	signs[30] = signs[31] = 0;
+
 	unsigned bestTfci = 0;
 	float bestMatch = 0;
-	assert(numTfcis <= TrCHConsts::sMaxTfci);
-	for (unsigned tfci = 0; tfci < numTfcis; tfci++) {
-		uint32_t tfciCode = TrCHConsts::sTfciCodes[tfci];
-		float thisMatch = 0;
-		for (unsigned b = 0; b < 30; b++) {
-			// The bits are transmitted in the slots LSB first, so start with LSB of tfciCode.
-			unsigned wantbit = tfciCode & 1;
-			tfciCode >>= 1;
-			float havebit = RN_BOUND(bits[b], 0.0, 1.0);
-			if (wantbit) {
-				thisMatch += havebit;
-			} else {
-				thisMatch += 1.0 - havebit;
+	for (unsigned base = 0; base < numTfcis; base += 64) {
+		unsigned mask = base >> 6;
+		float w[32];
+		for (unsigned b = 0; b < 32; b++) {
+			float v = signs[b];
+			if (__builtin_popcount(TrCHConsts::sTfciMaskBits[b] & mask) & 1)
+				v = -v;
+			w[TrCHConsts::sTfciPosition[b]] = v;
+		}
+		for (unsigned half = 1; half < 32; half <<= 1) {
+			for (unsigned k = 0; k < 32; k += 2 * half) {
+				for (unsigned m = k; m < k + half; m++) {
+					float a = w[m], c = w[m + half];
+					w[m] = a + c;
+					w[m + half] = a - c;
+				}
 			}
 		}
-		// A perfect match would be 30.
-		if (thisMatch > bestMatch) {
-			bestMatch = thisMatch;
-			bestTfci = tfci;
+		unsigned count = numTfcis - base < 64 ? numTfcis - base : 64;
+		for (unsigned t = 0; t < count; t++) {
+			// Bit a5 flips every code bit.
+			float thisMatch = 15.0F + 0.5F * (t & 32 ? -w[t & 31] : w[t & 31]);
+			// A perfect match would be 30.
+			if (thisMatch > bestMatch) {
+				bestMatch = thisMatch;
+				bestTfci = base + t;
+			}
 		}
 	}
 	return bestTfci; // TODO: Regardless of how poor it is?
 }
 
+float PilotSIR::sirDB() const
+{
+	if (mCount < 2)
+		return -100;
+	float mean = mSum / mCount;
+	float variance = mSumSquares / mCount - mean * mean;
+	if (variance <= 0)
+		return 100;
+	float sir = mean * mean / variance;
+	return sir > 1e-10F ? 10.0F * log10f(sir) : -100;
+}
+
+void decodeDPCCHSlot(const float *control, float scale, unsigned numPilots, uint32_t pilotBits, float *tfci,
+	float *tpc, PilotSIR &sir)
+{
+	assert(numPilots <= 8);
+	uint32_t pilotMask = (1u << numPilots) - 1;
+	float sum, sumSquares;
+#ifdef __SSE2__
+	// The first 8 symbols in two sets of 4 lanes.  A pilot bit of 1 sets the sign bit of its lane, which takes
+	// the modulation off, and lanes past the pilots are zeroed.
+	const __m128i lane = _mm_set_epi32(8, 4, 2, 1);
+	__m128 x[2];
+	for (unsigned h = 0; h < 2; h++) {
+		__m128i pattern = _mm_and_si128(_mm_set1_epi32(pilotBits >> (4 * h)), lane);
+		__m128i used = _mm_and_si128(_mm_set1_epi32(pilotMask >> (4 * h)), lane);
+		__m128i flip = _mm_slli_epi32(_mm_cmpeq_epi32(pattern, lane), 31);
+		__m128i keep = _mm_cmpeq_epi32(used, lane);
+		x[h] = _mm_xor_ps(_mm_loadu_ps(control + 4 * h), _mm_castsi128_ps(flip));
+		x[h] = _mm_and_ps(x[h], _mm_castsi128_ps(keep));
+	}
+	__m128 s = _mm_add_ps(x[0], x[1]);
+	__m128 q = _mm_add_ps(_mm_mul_ps(x[0], x[0]), _mm_mul_ps(x[1], x[1]));
+	float lanes[4];
+	_mm_storeu_ps(lanes, s);
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	_mm_storeu_ps(lanes, q);
+	sumSquares = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+	sum = sumSquares = 0;
+	for (unsigned i = 0; i < numPilots; i++) {
+		float x = (pilotBits >> i) & 1 ? -control[i] : control[i];
+		sum += x;
+		sumSquares += x * x;
+	}
+#endif
+	sir.add(sum, sumSquares, numPilots);
+
+	tfci[0] = scale * control[6] + 0.5F;
+	tfci[1] = scale * control[7] + 0.5F;
+	tpc[0] = scale * control[8] + 0.5F;
+	tpc[1] = scale * control[9] + 0.5F;
+}
+
 }; // namespace UMTS
@@ -22,6 +22,48 @@ namespace UMTS {
 unsigned findTfci(float *rawTfciAccumulator, // Of size [gUlRawTfciSize]
 	unsigned numTfcis);
 
+/** Pilot statistics over the uplink DPCCH slots of a frame, for an SIR estimate. */
+class PilotSIR {
+	float mSum;	   ///< Of the pilot symbols with their modulation taken off.
+	float mSumSquares; ///< Of the same.
+	unsigned mCount;
+
+public:
+	PilotSIR() { reset(); }
+
+	void reset()
+	{
+		mSum = mSumSquares = 0;
+		mCount = 0;
+	}
+
+	void add(float sum, float sumSquares, unsigned count)
+	{
+		mSum += sum;
+		mSumSquares += sumSquares;
+		mCount += count;
+	}
+
+	unsigned count() const { return mCount; }
+
+	/** The mean pilot power over the variance about the mean, in dB; -100 if there is nothing to measure. */
+	float sirDB() const;
+};
+
+/**
+	Decode the despread control symbols of one uplink DPCCH slot in a single pass, assuming slot format 0,
+	25.211 5.2.1.1 table 2.  The TFCI and TPC symbols become soft bits for findTfci and the pilots, with their
+	modulation taken off by the packed pilot pattern, go into the SIR statistics.
+	@param control The real parts of the 10 control symbols.
+	@param scale A soft bit is scale * symbol + 0.5; negative, since a 0 bit is sent as +1.
+	@param numPilots Pilots at the start of the slot, at most 8.
+	@param pilotBits Bit i is pilot i of the slot's pattern; a 1 is sent as -1.
+	@param tfci Gets the slot's 2 TFCI soft bits.
+	@param tpc Gets the slot's 2 TPC soft bits.
+*/
+void decodeDPCCHSlot(const float *control, float scale, unsigned numPilots, uint32_t pilotBits, float *tfci,
+	float *tpc, PilotSIR &sir);
+
 class TrCHConsts {
 
 public:
@@ -36,6 +78,10 @@ public:
 	static const char inter2Perm[30];
 	// TFCI can be up to 10 bits, but we wont use them all.
 	static uint32_t sTfciCodes[sMaxTfci]; // Table for up to 8 bit tfci, plenty for us.
+	// For the Hadamard transform in findTfci: where each code bit goes among the 32 Walsh function positions, and
+	// the mask that TFCI bits a6..a9 put on it.
+	static uint8_t sTfciPosition[32];
+	static uint8_t sTfciMaskBits[32];
 	static void initTfciCodes();
 
 	// These are the pre-computed pilot patterns for Npilot =2,4,8,16.
@@ -1119,7 +1119,7 @@ void DCHFEC::fecConfig(TrChConfig &config, bool turbo)
 
 void DCHFEC::open()
 {
-	ScopedLock lock(gActiveDCH.mLock);
+	ScopedLock lock(gActiveDCH.lock());
 	// The DCHFEC was already allocated from the ChannelTree by the caller.
 	assert(phChAllocated());
 #if USE_OLD_DCH
@@ -1128,19 +1128,19 @@ void DCHFEC::open()
 #else
 	controlOpen();
 #endif
+	if (getRadio()) {
+		getRadio()->prepareUplink(SrCode(), getUlDPCCH()->mNPilot);
+	}
 	gActiveDCH.push_back((DCHFEC *)this);
 	cout << "Opening DCH" << endl;
 }
 
 // TODO: Do we want a time delay here somewhere before reusing the channel?
+// The radio threads may finish the slot they are in with this DCH; it stays valid, and is no longer active.
 void DCHFEC::close()
 {
-	printf("waiting to remove...\n");
-	while (gActiveDCH.inTxUse || gActiveDCH.inRxUse)
-		usleep(1000);
-	ScopedLock lock(gActiveDCH.mLock);
+	ScopedLock lock(gActiveDCH.lock());
 	gActiveDCH.remove((DCHFEC *)this);
-	printf("removed\n");
 #if USE_OLD_DCH
 	mEncoder->close();
 	mDecoder->close();
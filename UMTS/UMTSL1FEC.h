@@ -26,6 +26,7 @@
 #include <TRXManager/TRXManager.h>
 
 #include "MACEngine.h"
+#include "UMTSActiveList.h"
 #include "UMTSCommon.h"
 #include "UMTSL1CC.h"
 #include "UMTSL1Const.h"
@@ -50,13 +51,9 @@ class TrChConfig;
 class RrcTfs;
 
 // The list of currently in-use DCHFEC, maintained by RRC using the ChannelTree,
-// to be used by the PHY layer.  There is a lock to prevent it from changing
-// while you are trying to look at it.
-class DCHListType : public std::list<DCHFEC *> {
-public:
-	Mutex mLock;
-	bool inTxUse, inRxUse;
-};
+// to be used by the PHY layer.  The PHY walks a DCHListType::Snapshot of it every slot
+// without locking, and open() and close() change it without waiting for the PHY.
+typedef ActiveList<DCHFEC> DCHListType;
 
 extern DCHListType gActiveDCH;
 
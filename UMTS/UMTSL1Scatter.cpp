@@ -0,0 +1,80 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include "RateMatch.h"
+#include "UMTSL1Const.h"
+#include "UMTSL1Scatter.h"
+
+namespace UMTS {
+
+bool L1UplinkScatter::build(unsigned frameSize, unsigned loc, unsigned nbits, unsigned outsize, const int *eini,
+	unsigned numFrames, unsigned columns, const char *perm)
+{
+	mFrameSize = 0;
+	if (nbits == 0 || loc + nbits > frameSize || numFrames == 0 || numFrames > sMaxFrames) {
+		return false;
+	}
+
+	// Number the positions of the raw frame and push the numbers through the 2nd de-interleaving.
+	Vector<unsigned> raw(frameSize), frame(frameSize);
+	for (unsigned i = 0; i < frameSize; i++) {
+		raw[i] = i;
+	}
+	raw.deInterleavingNP(30, TrCHConsts::inter2Perm, frame);
+
+	// De-multiplex and rate match each radio frame of the TTI, concatenating them as in radio frame
+	// un-segmentation.  The TTI holds frame index * frameSize + frame position.
+	Vector<unsigned> trch(frame.segment(loc, nbits));
+	Vector<unsigned> rm(outsize), tti(outsize * numFrames);
+	for (unsigned i = 0; i < numFrames; i++) {
+		rm.fill(0); // In case of a rate matching mis-calculation, which is logged.
+		rateMatchFunc<unsigned>(trch, rm, eini[i]);
+		for (unsigned j = 0; j < outsize; j++) {
+			tti[i * outsize + j] = i * frameSize + rm[j];
+		}
+	}
+
+	// 1st de-interleaving gives the decoder's order.
+	Vector<unsigned> decoder(tti.size());
+	tti.deInterleavingNP(columns, perm, decoder);
+
+	// Group the decoder positions by the radio frame they come from.
+	unsigned counts[sMaxFrames] = {0};
+	for (unsigned k = 0; k < decoder.size(); k++) {
+		counts[decoder[k] / frameSize]++;
+	}
+	for (unsigned i = 0; i < sMaxFrames; i++) {
+		unsigned n = i < numFrames ? counts[i] : 0;
+		if (mSrc[i].size() != n) {
+			mSrc[i].resize(n);
+			mDst[i].resize(n);
+		}
+		counts[i] = 0;
+	}
+	for (unsigned k = 0; k < decoder.size(); k++) {
+		unsigned i = decoder[k] / frameSize;
+		mSrc[i][counts[i]] = decoder[k] % frameSize;
+		mDst[i][counts[i]] = k;
+		counts[i]++;
+	}
+
+	mFrameSize = frameSize;
+	mLoc = loc;
+	mNBits = nbits;
+	mNumFrames = numFrames;
+	mTtiSize = decoder.size();
+	return true;
+}
+
+} // namespace UMTS
@@ -0,0 +1,109 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef UMTSL1SCATTER_H
+#define UMTSL1SCATTER_H
+
+#include <CommonLibs/SoftBits.h>
+#include <CommonLibs/Vector.h>
+
+namespace UMTS {
+
+/*
+	Precomputed uplink receive path for one TrCh of one TFC.
+
+	Between the radio frame and the channel decoder the uplink applies, in order: 2nd de-interleaving of the
+	whole frame (25.212 4.2.11), TrCh de-multiplexing (4.2.8), rate matching (4.2.7), radio frame
+	un-segmentation into a TTI (4.2.6) and 1st de-interleaving of the TTI (4.2.5).  Every one of those steps
+	just moves soft bits around, and rate matching only drops or repeats them, so each soft bit the decoder
+	reads comes from exactly one position of one radio frame of the TTI.  The tables here record that source
+	position for every decoder position, grouped by the radio frame it comes from, so a frame is moved into
+	the decoder's buffer in a single gather without any intermediate copies.
+
+	The tables are built by running the very same interleaving and rate matching code on position numbers
+	instead of soft bits, so the result is exactly what the step by step path would produce.  They depend on
+	the radio frame size, which follows the spreading factor the UE picks, so they are rebuilt if that changes.
+*/
+class L1UplinkScatter {
+	static const unsigned sMaxFrames = 8; // Radio frames per TTI, at most 80ms.
+
+	unsigned mFrameSize;	// Radio frame size the tables were built for, 0 if none.
+	unsigned mLoc, mNBits;  // This TrCh's bits in the 2nd de-interleaved frame.
+	unsigned mNumFrames;	// Radio frames per TTI.
+	unsigned mTtiSize;	// Soft bits in the decoder's TTI buffer.
+	// For radio frame i of the TTI, decoder position mDst[i][k] takes frame position mSrc[i][k].
+	Vector<unsigned> mSrc[sMaxFrames];
+	Vector<unsigned> mDst[sMaxFrames];
+	SoftVector8 mFrame8;	// The radio frame in fixed point, for the fixed point scatter.
+
+public:
+	L1UplinkScatter() : mFrameSize(0), mLoc(0), mNBits(0), mNumFrames(0), mTtiSize(0) {}
+
+	/**
+		Build the tables.
+		@param frameSize Soft bits in the whole radio frame, all TrChs.
+		@param loc, nbits Location of this TrCh in the de-interleaved frame, ie, the de-multiplexing.
+		@param outsize Soft bits per radio frame after rate matching.
+		@param eini The rate matching eini of each radio frame of the TTI.
+		@param numFrames Radio frames per TTI.
+		@param columns, perm The 1st interleaver.
+		@return false if the TrCh does not fit in the frame.
+	*/
+	bool build(unsigned frameSize, unsigned loc, unsigned nbits, unsigned outsize, const int *eini,
+		unsigned numFrames, unsigned columns, const char *perm);
+
+	/** True if the tables are for this frame size and TrCh location. */
+	bool built(unsigned frameSize, unsigned loc, unsigned nbits) const
+	{
+		return mFrameSize == frameSize && mLoc == loc && mNBits == nbits;
+	}
+
+	unsigned ttiSize() const { return mTtiSize; }
+
+	/** Move radio frame ttiIndex of the TTI from the raw frame into the decoder's TTI buffer. */
+	void scatter(const float *frame, unsigned ttiIndex, float *tti) const
+	{
+		const unsigned *src = mSrc[ttiIndex].begin();
+		const unsigned *dst = mDst[ttiIndex].begin();
+		unsigned n = mSrc[ttiIndex].size();
+		for (unsigned k = 0; k < n; k++) {
+			tti[dst[k]] = frame[src[k]];
+		}
+	}
+
+	/**
+		The same, converting to fixed point on the way.
+		Quantizing inside the gather cost a scalar conversion per bit, three times the float scatter, so the
+		frame is quantized first in one vectorized pass and the gather moves bytes.  That is still about
+		twice the float scatter; the fixed point decoder more than wins it back, but float stays the default.
+	*/
+	void scatter(const float *frame, unsigned ttiIndex, int8_t *tti, const SoftQuantizer &quantizer)
+	{
+		if (mFrame8.size() != mFrameSize) {
+			mFrame8.resize(mFrameSize);
+		}
+		quantizer.quantize(frame, mFrame8.begin(), mFrameSize);
+		const int8_t *frame8 = mFrame8.begin();
+		const unsigned *src = mSrc[ttiIndex].begin();
+		const unsigned *dst = mDst[ttiIndex].begin();
+		unsigned n = mSrc[ttiIndex].size();
+		for (unsigned k = 0; k < n; k++) {
+			tti[dst[k]] = frame8[src[k]];
+		}
+	}
+};
+
+} // namespace UMTS
+
+#endif
@@ -15,6 +15,7 @@
  */
 
 #include <Control/ControlCommon.h>
+#include <Control/LocationUpdating.h>
 #include <GSM/GSML3MMMessages.h>
 
 #include "UMTSLogicalChannel.h"
@@ -56,10 +57,43 @@ void LogicalChannel::l3writeHighSide(ByteVector &msg)
 	// UMTS::DCCHLogicalChannel* thisChan = dynamic_cast<UMTS::DCCHLogicalChannel*>(this);
 	// Control::DCCHDispatchMessage(msg2,thisChan);
 	// delete msg2;
+	{
+		ScopedLock lock(mListenLock);
+		if (mListenPool) {
+			mListenPool->post(mListenID, new Control::L3FrameEvent(frame3));
+			return;
+		}
+		if (mHeld) {
+			mL3RxQ.write(frame3);
+			return;
+		}
+	}
 	mL3RxQ.write(frame3);
 	gDCCHLogicalChannelFIFO.write(dynamic_cast<UMTS::DCCHLogicalChannel *>(this));
 }
 
+void LogicalChannel::listen(Control::EventPool *pool, uint64_t id)
+{
+	ScopedLock lock(mListenLock);
+	mListenPool = pool;
+	mListenID = id;
+	mHeld = false;
+}
+
+void LogicalChannel::hold()
+{
+	ScopedLock lock(mListenLock);
+	mListenPool = NULL;
+	mHeld = true;
+}
+
+void LogicalChannel::unlisten()
+{
+	ScopedLock lock(mListenLock);
+	mListenPool = NULL;
+	mHeld = false;
+}
+
 // TODO: What to do with SAPI?
 GSM::L3Frame *LogicalChannel::recv(unsigned timeout_ms, unsigned SAPI)
 {
@@ -42,6 +42,10 @@ class L3Frame;
 class L3Message;
 } // namespace GSM
 
+namespace Control {
+class EventPool;
+}
+
 class ARFCNManager;
 
 namespace UMTS {
@@ -77,6 +81,13 @@ class LogicalChannel {
 	// class deigns to read them, and an easy way to do the timeout.
 	InterthreadQueue<GSM::L3Frame> mL3RxQ;
 
+	// While a procedure running as events listens, incoming frames go to it instead of mL3RxQ.
+	// While held, they go to mL3RxQ but not to the DCCH dispatcher.
+	Mutex mListenLock;
+	Control::EventPool *mListenPool;
+	uint64_t mListenID;
+	bool mHeld;
+
 protected:
 	/**@name Contained layer processors. */
 	//@{
@@ -109,7 +120,7 @@ public:
 	*/
 	LogicalChannel()
 		: // mRLC(NULL),mMAC(NULL), mPHY(NULL)
-		  mUep(NULL), mDCCH(NULL)
+		  mListenPool(NULL), mListenID(0), mHeld(false), mUep(NULL), mDCCH(NULL)
 	{
 	}
 
@@ -123,6 +134,21 @@ public:
 	// Called from rrcRecvL3Msg() for protocol descriptors the GSM stack wants.
 	void l3writeHighSide(ByteVector &msg);
 
+	/**
+		Post the frames that arrive from here on to a handler on an EventPool, as Control::L3FrameEvents,
+		instead of queueing them for recv() and the DCCH dispatcher.  Frames queued already stay queued.
+	*/
+	void listen(Control::EventPool *pool, uint64_t id);
+
+	/**
+		Queue the frames that arrive from here on for recv() only, keeping them from the DCCH dispatcher, for a
+		controller that reads the channel itself after a listening procedure is done with it.
+	*/
+	void hold();
+
+	/** Queue incoming frames for recv() and the DCCH dispatcher again. */
+	void unlisten();
+
 	/**@name Pass-throughs. */
 	//@{
 
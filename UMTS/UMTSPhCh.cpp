@@ -303,6 +303,15 @@ PhCh::PhCh(PhChType chType,
 	//}
 }
 
+void PhCh::phChClose()
+{
+	if (isDch()) {
+		gChannelTree.chRelease(this);
+	} else {
+		mAllocated = false;
+	}
+}
+
 // Same result as PhCh::getDlRadioFrameSize but if you dont have a channel pointer handy.
 unsigned getDlRadioFrameSize(PhChType chtype, unsigned sf)
 {
@@ -605,19 +614,6 @@ ASN::DL_InformationPerRL_List *PhCh::toAsnDL_InformationPerRL_List()
 	return result;
 }
 
-// Is this specific DCH available for allocation, ignoring the rest of the tree?
-// This is an internal function to test a single spot in the tree;
-// dont call this externally - you probably want chChooseByBW() or chChooseBySF().
-bool ChannelTreeElt::available(bool checkOnlyReserved)
-{
-	if (checkOnlyReserved) {
-		return !mReserved;
-	}
-	return !mReserved && !mAlsoReserved && mDch && !mDch->phChAllocated();
-}
-
-bool ChannelTreeElt::active(void) { return mReserved || !mDch || mDch->phChAllocated(); }
-
 void ChannelTree::chConflict(Tier t1, unsigned ch1, Tier t2, unsigned ch2)
 {
 	LOG(ALERT) << "Attempt to reserve channel:" << LOGVAR2("sf", tier2sf(t1)) << LOGVAR2("chcode", ch1)
@@ -645,21 +641,11 @@ void ChannelTree::chReserve(unsigned sf, unsigned chcode)
 	Tier badtier;
 	unsigned badcode; // To hold a conflicing reservation.
 	printf("chReserve(%d,%d)\n", sf, chcode);
-	if (!isTierFreeUpward(t, chcode, true, &badtier, &badcode) ||
-		!isTierFreeDownward(t, chcode, 1, true, &badtier, &badcode)) {
+	ScopedLock lock(mChLock);
+	if (mCodes.findConflict(t, chcode, &badtier, &badcode)) {
 		chConflict(t, chcode, badtier, badcode);
 	}
-#if 0
-	unsigned chcode2 = chcode;
-	for (Tier t2 = t; t2 >= 0; t2--) {
-		if (mTree[t2][chcode2].mReserved) { chConflict(sf,chcode,tier2sf(t2),chcode2); }
-		chcode2 = chcode2 / 2;
-	}
-	for (Tier t3 = t; t3 <sNumTiers>= 0; t3++) {
-		if (mTree[t3][chcode3].mReserved) { chConflict(sf,chcode,tier2sf(t3),chcode3); }
-		chcode3 = chcode3 * 2;
-	}
-#endif
+	mCodes.reserve(t, chcode);
 
 	// All ok.  Reserve this ch and also reserve everything above it.
 	mTree[t][chcode].mReserved = true;
@@ -751,79 +737,65 @@ ChannelTree::Tier ChannelTree::bw2tier(unsigned ops, bool guaranteed)
 	return 6; // SF=256, actual == 3.75K
 }
 
-// Is anything allocated above this channel?
-// We dont have to test reserved because reservations are bubbled up when they are made.
-bool ChannelTree::isTierFreeUpward(
-	Tier tier, unsigned startcode, bool checkOnlyReserved, Tier *badtier, unsigned *badcode)
-{
-	// unsigned code = startcode; (pat) 11-2012: this looks like a bug?
-	unsigned code = startcode / 2; // (pat) 11-2012: Should be this.
-	for (Tier t = tier - 1; t >= 0; t--) {
-		// printf("isTierFreeUpward(%d %d %d)\n",t,code,checkOnlyReserved);
-		// Harvind (3-11-13): Don't care if node above is "AlsoReserved", only care if its reserved or allocated
-		//	an "AlsoReserved" node has sub-trees w/ codes that are still permissible
-		if (mTree[t][code].active()) {
-			// if (! mTree[t][code].available(checkOnlyReserved)) {
-			if (badtier) {
-				*badtier = t;
-			}
-			if (badcode) {
-				*badcode = code;
-			}
-			return false;
+// This function opens the channel before returning to prevent a race.
+// TODO: If we cannot allocate a channel with the specified KBps, should we allocate a lower-bandwidth ch?
+DCHFEC *ChannelTree::chChooseByTier(Tier tier)
+{
+	ScopedLock lock(mChLock);
+	// For a channel to be free the sub-tree below and all channels above that chcode must be unused;
+	// the allocator keeps that as a bitmap per tier and returns the lowest such code.
+	int chcode = mCodes.allocate(tier);
+	if (chcode < 0) {
+		unsigned target;
+		std::vector<OVSFAllocator::Move> moves;
+		if (mCodes.planDefrag(tier, &target, moves)) {
+			LOG(INFO) << "no free channel at" << LOGVAR2("sf", tier2sf(tier)) << ", moving " << moves.size()
+				  << " channels would free" << LOGVAR2("chcode", target);
 		}
-		code = code / 2;
+		return NULL;
+	}
+	DCHFEC *result = mTree[tier][chcode].mDch;
+	if (!result) {
+		// Not populated yet.
+		mCodes.release(tier, chcode);
+		return NULL;
 	}
-	return true;
+	result->phChOpen();
+	return result;
 }
 
-// Is the sub-tree with apex at this tier and startcode free?
-// On the first call width is 1, then it recursively descends to check the sub-tiers,
-// increasing the width by 2 each time to cover the entire sub-tree.
-bool ChannelTree::isTierFreeDownward(
-	Tier tier, unsigned startcode, unsigned width, bool checkOnlyReserved, Tier *badtier, unsigned *badcode)
+void ChannelTree::chRelease(PhCh *ch)
 {
-	if (tier >= sNumTiers) {
-		return true;
-	}
-	// printf("isTierFreeDownward(%d %d %d %d)\n",tier,startcode,width,checkOnlyReserved);
-	unsigned code = startcode;
-	for (unsigned i = 0; i < width; i++, code++) {
-		// redundant with available(): if (mTree[tier][code].mReserved) {return false;}
-		// // permanently reserved.
-		if (!mTree[tier][code].available(checkOnlyReserved)) {
-			if (badtier) {
-				*badtier = tier;
-			}
-			if (badcode) {
-				*badcode = code;
-			}
-			return false; // in use.
-		}
-		if (!isTierFreeDownward(tier + 1, 2 * startcode, 2 * width, checkOnlyReserved, badtier, badcode)) {
-			return false;
-		} // something underneath is in use.
+	ScopedLock lock(mChLock);
+	if (ch->mAllocated) {
+		mCodes.release(sf2tier(ch->getDlSF()), ch->getSpCode());
+		ch->mAllocated = false;
 	}
-	return true; // entire specified sub-tree is free.
 }
 
-// This function opens the channel before returning to prevent a race.
-// TODO: If we cannot allocate a channel with the specified KBps, should we allocate a lower-bandwidth ch?
-DCHFEC *ChannelTree::chChooseByTier(Tier tier)
+bool ChannelTree::chPlanDefrag(unsigned sf, unsigned *chcode, std::vector<OVSFAllocator::Move> &moves)
+{
+	ScopedLock lock(mChLock);
+	return mCodes.planDefrag(sf2tier(sf), chcode, moves);
+}
+
+bool ChannelTree::chCheck(std::ostream &os)
 {
 	ScopedLock lock(mChLock);
-	unsigned sf = tier2sf(tier);
-	// For a channel to be free the sub-tree below and all channels above that chcode must be unused.
-	for (unsigned chcode = 0; chcode < sf; chcode++) {
-		// Harvind (3-11-13) upward search should only check reserved codes, don't care if upward codes are
-		// "also reserved"
-		if (isTierFreeDownward(tier, chcode, 1, false, 0, 0) && isTierFreeUpward(tier, chcode, true, 0, 0)) {
-			DCHFEC *result = mTree[tier][chcode].mDch;
-			result->phChOpen();
-			return result;
+	bool ok = mCodes.check(os);
+	unsigned sf = 4;
+	for (Tier tier = 0; tier < sNumTiers; tier++, sf *= 2) {
+		for (unsigned chcode = 0; chcode < sf; chcode++) {
+			ChannelTreeElt *cte = &mTree[tier][chcode];
+			bool allocated = cte->mDch && cte->mDch->phChAllocated();
+			if (mCodes.isUsed(tier, chcode) != (allocated || cte->mReserved)) {
+				os << "ChannelTree disagrees with its codes at" << LOGVAR(sf) << LOGVAR(chcode)
+				   << LOGVAR(allocated) << LOGVAR2("reserved", cte->mReserved) << "\n";
+				ok = false;
+			}
 		}
 	}
-	return NULL;
+	return ok;
 }
 
 DCHFEC *ChannelTree::chChooseByBW(unsigned ops) // octets per second
@@ -924,6 +896,7 @@ void ChannelTree::chTest(std::ostream &os)
 	chTestFree(4, 4, os);
 	chTestAlloc(4, 1, os);
 	chTestAlloc(16, 5, os);
+	os << "ChannelTree check " << (chCheck(os) ? "ok" : "FAILED") << "\n";
 }
 
 std::ostream &operator<<(std::ostream &os, const ChannelTree &tree)
@@ -18,6 +18,7 @@
 #include <CommonLibs/Threads.h>
 #include <TRXManager/TRXManager.h>
 
+#include "UMTSCodeTree.h"
 #include "UMTSCommon.h"
 
 namespace ASN {
@@ -207,9 +208,11 @@ public:
 	// physical channel back tothe pool.
 	//@{
 	void phChOpen() { mAllocated = true; }
-	void phChClose() { mAllocated = false; }
+	void phChClose(); // Releases the code in the ChannelTree too.
 	//@}
 	bool phChAllocated() { return mAllocated; }
+
+	friend class ChannelTree;
 };
 
 // Downlink only channel has spreading factor and spreading [channel] code
@@ -230,15 +233,13 @@ struct PhChUplink : PhCh {
 };
 
 // An element in the channel tree.
-// The channel allocation indication is not here,
-// it is inside the DCHFEC class accessed by active() method.
+// The channel allocation indication is not here, it is in the ChannelTree's OVSFAllocator,
+// and mirrored in the DCHFEC class by phChAllocated().
 struct ChannelTreeElt {
 	bool mReserved;     // This channel is reserved for something other than DCH.
 	bool mAlsoReserved; // This channel is above a reserved channel, so you cant use it either.
 	DCHFEC *mDch;       // The DPDCH, although we could put the other PhChs in here too. (SCCPCH, PCCPCH, etc)
-	bool available(bool checkOnlyReserved);
-	bool active(void);
-	ChannelTreeElt() : mReserved(0), mDch(0) {}
+	ChannelTreeElt() : mReserved(0), mAlsoReserved(0), mDch(0) {}
 };
 
 // The ChannelTree's primary purpose is to allocate DCH channels
@@ -252,9 +253,9 @@ struct ChannelTreeElt {
 // CHANNEL ALLOCATION:
 // Use the chChooseByBW() or chChooseBySF() methods to allocate a DCH channel.
 // It is dynamic, so you can mix and match SF, no restrictions except what is intrinsic.
-// There is no data stored in this structure about which channels are active,
-// rather it calls the phChAllocated() method from the channel each time.
-// So when a channel is deallocated, nothing is done in this tree at all.
+// Which codes are in use is kept in occupancy bitmaps by the OVSFAllocator, so choosing a channel
+// is a find-first-set per tier rather than a walk over the tree.
+// When a channel is deallocated by phChClose() it releases its code here.
 // The chChoose functions currently open the channel before returning to make sure
 // there is no race between two threads trying to allocate channels simultaneously.
 // Dont know if that is possible because the callers dont yet exist :-)
@@ -292,15 +293,12 @@ class ChannelTree {
 public:
 	typedef int Tier;		// In the range 0..(sNumTiers-1) for SF=4 to SF=256.
 					// Use 'int' because we have loops for (...; tier >= 0; tier--)
-	static const int sNumTiers = 7; // seven tree tiers for SF=4 to SF=256.
+	static const int sNumTiers = OVSFAllocator::sNumTiers; // seven tree tiers for SF=4 to SF=256.
 
 private:
 	ChannelTreeElt *mTree[sNumTiers]; // The tree itself is a pyramidal matrix.
+	OVSFAllocator mCodes;		  // Which codes are reserved or allocated.
 
-	// These are internal functions of chChooseByTier and chReserve:
-	bool isTierFreeUpward(Tier tier, unsigned chcode, bool checkOnlyReserved, Tier *badtier, unsigned *badcode);
-	bool isTierFreeDownward(Tier tier, unsigned startcode, unsigned width, bool checkOnlyReserved, Tier *badtier,
-		unsigned *badcode);
 	void chConflict(Tier t1, unsigned ch1, Tier t2, unsigned ch2);
 	DCHFEC *chChooseByTier(Tier tier); // Choose a DCH specified by SF expressed as a Tier.
 
@@ -313,6 +311,9 @@ public:
 	DCHFEC *chChooseByBW(unsigned KBps);     // Choose one of the DCH channels by bandwidth in KBytes/s.
 	DCHFEC *chChooseBySF(unsigned sf);       // Choose a DCH specified by SF.
 
+	// Release the code of a channel from chChoose; called by PhCh::phChClose().
+	void chRelease(PhCh *ch);
+
 	// Is this exact ch reserved?  This does not check above and below in the ChannelTree and is used
 	// only to assert that we have correctly reserved a channel previously.
 	bool isReserved(unsigned sf, unsigned code) { return mTree[sf2tier(sf)][code].mReserved; }
@@ -323,6 +324,12 @@ public:
 	// Call after reserving dedicated channels with chReserve()
 	void chPopulate(ARFCNManager *downstream);
 
+	// Which allocated channels would have to be moved to make room for one at this SF; see
+	// OVSFAllocator::planDefrag.  Returns false if there is no way.
+	bool chPlanDefrag(unsigned sf, unsigned *chcode, std::vector<OVSFAllocator::Move> &moves);
+	// Check the code bitmaps and the channels agree.
+	bool chCheck(std::ostream &os);
+
 	void chTest(std::ostream &os);
 	void chTestAlloc(int sf, int cnt, std::ostream &os);
 	void chTestFree(int sf, int cnt, std::ostream &os);
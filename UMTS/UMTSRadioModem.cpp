@@ -15,6 +15,7 @@
  */
 
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
 #include <TransceiverUHD/Transceiver.h> // FIXME
 
 #include "UMTSConfig.h"
@@ -25,42 +26,12 @@ using namespace UMTS;
 
 const float UMTS::RadioModem::mRACHThreshold = 10.0;
 
-UMTS::Time TxBitsQueue::nextTime() const
-{
-	UMTS::Time retVal;
-	ScopedLock lock(mLock);
-	while (mQ.size() == 0)
-		mWriteSignal.wait(mLock);
-	return mQ.top()->time();
-}
-
-TxBitsBurst *TxBitsQueue::getStaleBurst(const UMTS::Time &targTime)
-{
-	ScopedLock lock(mLock);
-	if ((mQ.size() == 0)) {
-		return NULL;
-	}
-	if (mQ.top()->time() < targTime) {
-		TxBitsBurst *retVal = mQ.top();
-		mQ.pop();
-		return retVal;
-	}
-	return NULL;
-}
-
-TxBitsBurst *TxBitsQueue::getCurrentBurst(const UMTS::Time &targTime)
-{
-	ScopedLock lock(mLock);
-	if ((mQ.size() == 0)) {
-		return NULL;
-	}
-	if (mQ.top()->time() == targTime) {
-		TxBitsBurst *retVal = mQ.top();
-		mQ.pop();
-		return retVal;
-	}
-	return NULL;
-}
+static StatHistogram sDCHSlotTime("UMTS.Radio.DCHSlot", "us", "uplink DCH slot demodulation time");
+static StatHistogram sDPDCHFrameTime("UMTS.Radio.DPDCHFrame", "us", "uplink DPDCH frame despread time");
+static StatCounter sTxLate("UMTS.Radio.TxLate", "downlink bursts dropped for missing their slot");
+static StatCounter sTxTooEarly("UMTS.Radio.TxTooEarly", "downlink bursts refused as too far ahead");
+static StatHistogram sDPCCHSIR("UMTS.Radio.DPCCHSIR", "dB", "uplink DPCCH pilot SIR of each DCH frame, from 0");
+static StatCounter sUplinkCodeMiss("UMTS.Radio.UplinkCodeMiss", "uplink DCH slots dropped for want of their code");
 
 // Assuming one sample per chip.
 
@@ -78,11 +49,10 @@ signalVector *rcvInverseCICFilter;
 signalVector *txHistoryVector;
 signalVector *rxHistoryVector;
 
-RadioModem::RadioModem(UDPSocket &wDataSocket) : mDataSocket(wDataSocket)
+RadioModem::RadioModem(UDPSocket &wDataSocket)
+	: mDataSocket(wDataSocket), mUplinkCodes(mUplinkCodeBankSize, mDPCCHPilotOffset, mDPCCHSearchSize)
 {
 	sigProcLibSetup(1);
-	mUplinkPilotWaveformMap.clear();
-	mUplinkScramblingCodes.clear();
 
 	inverseCICFilter = new signalVector(FILTLEN);
 	// RN_MEMLOG(signalVector,inverseCICFilter);
@@ -102,7 +72,6 @@ RadioModem::RadioModem(UDPSocket &wDataSocket) : mDataSocket(wDataSocket)
 		*itr++ = complex(invFiltRcv[i], 0.0);
 	rxHistoryVector = new signalVector(FILTLEN - 1);
 
-	mTxQueue = new TxBitsQueue;
 
 	for (int i = 0; i < 16; i++) {
 		mRACHSignatureMask[i] = false;
@@ -135,7 +104,6 @@ RadioModem::RadioModem(UDPSocket &wDataSocket) : mDataSocket(wDataSocket)
 	mRACHMessageSlots = 30 / 2; // FIXME:: needs this from config or higher layers
 
 	mDPCCHCorrelationWindow = 0;
-	mDPCCHSearchSize = 256;				    // 2*256/8;
 	mSSCHGroupNum = mDownlinkScramblingCodeIndex / 128; // 3GPP 25.213 Sec. 5.2.2
 
 	generateDownlinkPilotWaveforms();
@@ -233,7 +201,8 @@ void *DCHLoopAdapter(DCHLoopInfo *dli)
 		int slotIx = wTime.TN();
 		if ((slotIx == 0) && (modem->gActiveDPDCH.find((void *)currDCH) == modem->gActiveDPDCH.end())) {
 			// add to DPDCH map
-			modem->gActiveDPDCH[(void *)currDCH] = new DPDCH((void *)currDCH, wTime);
+			modem->gActiveDPDCH[(void *)currDCH] =
+				new DPDCH((void *)currDCH, wTime, modem->newRakeReceiver());
 		}
 		if (modem->gActiveDPDCH.find((void *)currDCH) == modem->gActiveDPDCH.end())
 			continue;
@@ -248,6 +217,7 @@ void *DCHLoopAdapter(DCHLoopInfo *dli)
 			currDPDCH->frameTime = wTime;
 			currDPDCH->active = true;
 			currDPDCH->bestSNR = -1000.0;
+			currDPDCH->pilotSIR.reset();
 		}
 		if (!currDPDCH->active) {
 			delete (signalVector *)(q->burst);
@@ -256,13 +226,19 @@ void *DCHLoopAdapter(DCHLoopInfo *dli)
 		}
 		int uplinkScramblingCodeIndex = currDCH->getPhCh()->SrCode();
 		int numPilots = currDCH->getPhCh()->getUlDPCCH()->mNPilot;
-		currDPDCH->active = modem->decodeDCH(*burstCopy, wTime, uplinkScramblingCodeIndex, numPilots,
-			currDPDCH->descrambledBurst, currDPDCH->rawBurst, currDPDCH->lastTOA, currDPDCH->bestTOA,
-			currDPDCH->bestChannel, currDPDCH->bestSNR, currDPDCH->tfciBits, currDPDCH->tpcBits);
+		{
+			StatTimer timer(sDCHSlotTime);
+			currDPDCH->active = modem->decodeDCH(*burstCopy, wTime, uplinkScramblingCodeIndex, numPilots,
+				currDPDCH->descrambledBurst, currDPDCH->rawBurst, currDPDCH->lastTOA,
+				currDPDCH->bestTOA, currDPDCH->bestChannel, currDPDCH->bestSNR, currDPDCH->tfciBits,
+				currDPDCH->tpcBits, currDPDCH->pilotSIR, currDPDCH->rake);
+		}
 
 		if (slotIx == gFrameSlots - 1) { // gots a frame, let's decode it
 			// First, need to figure out TFCI
 			int TFCI = findTfci(currDPDCH->tfciBits, currDCH->l1ul()->mNumTfc);
+			float SIR = currDPDCH->pilotSIR.sirDB();
+			sDPCCHSIR.record(SIR > 0 ? (uint64_t)SIR : 0);
 
 			// (pat) The uplink spreading factor can depend on the TFC of this particular uplink vector.
 			// We need to decode the DPCCH first then look up the SF based on the TFCI bits.  Someday.
@@ -275,11 +251,12 @@ void *DCHLoopAdapter(DCHLoopInfo *dli)
 			LOG(NOTICE) << "numTFCI: " << currDCH->l1ul()->mNumTfc << " TFCI: " << TFCI
 				    << ", SF: " << (1 << uplinkSpreadingFactorLog2)
 				    << ", scram: " << uplinkScramblingCodeIndex
-				    << ", code: " << uplinkSpreadingCodeIndex << ", time:" << wTime;
+				    << ", code: " << uplinkSpreadingCodeIndex << ", SIR: " << SIR << ", time:" << wTime;
 			// LOG(INFO) << "TPC: " << currDPDCH->tpcBits[0] << " " << currDPDCH->tpcBits[1];
 
 			if (TFCI != 0) {
 				currDCH->l1ul()->mReceived = true;
+				StatTimer timer(sDPDCHFrameTime);
 				modem->decodeDPDCHFrame(*currDPDCH, uplinkScramblingCodeIndex,
 					uplinkSpreadingFactorLog2, uplinkSpreadingCodeIndex);
 			}
@@ -323,65 +300,13 @@ void RadioModem::generateRACHMessagePilots(int filtLen)
 	}
 }
 
-signalVector *RadioModem::UplinkPilotWaveforms(int scramblingCode, int codeIndex, int numPilots, int slotIx)
-{
-
-	int hashValue = waveformMapHash(scramblingCode, numPilots - 3);
-	if (mUplinkPilotWaveformMap.find(hashValue) != mUplinkPilotWaveformMap.end()) {
-		return mUplinkPilotWaveformMap[hashValue][slotIx];
-	} else { // need to generate set of pilot vectors for scrambling code
-		// NOTE: Pilot sequences are on the Q channel
-		// Create a zeroed out I burst.
-		radioData_t zeroIBurst[gSlotLen];
-		memset(zeroIBurst, 0, gSlotLen * sizeof(radioData_t));
-
-		signalVector **newPilots = new signalVector *[gFrameSlots];
-
-		// Figure out scrambling code
-		int Np = numPilots - 3;
-		if (mUplinkScramblingCodes.find(scramblingCode) == mUplinkScramblingCodes.end()) {
-			mUplinkScramblingCodes[scramblingCode] = new UplinkScramblingCode(scramblingCode);
-		}
-		int8_t *scramI = (int8_t *)(mUplinkScramblingCodes[scramblingCode])->ICode();
-		int8_t *scramQ = (int8_t *)(mUplinkScramblingCodes[scramblingCode])->QCode();
-		unsigned seqSz = mDPCCHSearchSize; // numPilots*256;
-		radioData_t pilotSeq[numPilots * 256];
-		for (unsigned slot = 0; slot < gFrameSlots; slot++) {
-			memset(pilotSeq, 0, numPilots * 256 * sizeof(radioData_t));
-			spreadOneBranch((BitVector &)gPilotPatterns[Np][slot], (int8_t *)gOVSFTree.code(8, codeIndex),
-				256, (radioData_t *)pilotSeq, numPilots * 256);
-			radioData_t *Iside = NULL;
-			radioData_t *Qside = NULL;
-			scramble((radioData_t *)zeroIBurst, (radioData_t *)pilotSeq, numPilots * 256,
-				scramI + gSlotLen * slot, scramQ + gSlotLen * slot, numPilots * 256, &Iside, &Qside);
-			signalVector pilotChips(seqSz);
-			signalVector::iterator itr = pilotChips.begin();
-			// FIXME: need to specify correlation size here
-			for (unsigned i = 0; i < seqSz; i++)
-				*itr++ = complex(Iside[i + 384], Qside[i + 384]);
-			newPilots[slot] = reverseConjugate(&pilotChips);
-			delete[] Iside;
-			delete[] Qside;
-		}
-		mUplinkPilotWaveformMap[hashValue] = newPilots;
-		return newPilots[slotIx];
-	}
-}
-
 void RadioModem::generateRACHPreambleTable(int startIx, int filtLen)
 {
 	unsigned scramblingCodeIx = mUplinkPRACHScramblingCodeIndex;
 	LOG(INFO) << "RACH scramblingCodeIx: " << scramblingCodeIx;
-	if (!mUplinkScramblingCodes[scramblingCodeIx]) {
-		mUplinkScramblingCodes[scramblingCodeIx] = new UplinkScramblingCode(scramblingCodeIx);
-		for (unsigned i = 0; i < gFrameLen; i++) {
-			unsigned alignedIx = (i + 4096);
-			mRACHMessageAlignedScramblingCodeI[i] =
-				*(mUplinkScramblingCodes[scramblingCodeIx]->ICode() + alignedIx);
-			mRACHMessageAlignedScramblingCodeQ[i] =
-				*(mUplinkScramblingCodes[scramblingCodeIx]->QCode() + alignedIx);
-		}
-	}
+	UplinkScramblingCode code(scramblingCodeIx);
+	memcpy(mRACHMessageAlignedScramblingCodeI, code.ICode() + 4096, gFrameLen);
+	memcpy(mRACHMessageAlignedScramblingCodeQ, code.QCode() + 4096, gFrameLen);
 
 	for (int signature = 0; signature < 16; signature++) {
 		radioData_t repeatedRACHPreambleI[256 * 16];
@@ -390,8 +315,7 @@ void RadioModem::generateRACHPreambleTable(int startIx, int filtLen)
 		}
 		radioData_t *RACHIside = NULL;
 
-		scrambleRACH(repeatedRACHPreambleI, 4096, (int8_t *)mUplinkScramblingCodes[scramblingCodeIx]->ICode(),
-			256 * 16, &RACHIside);
+		scrambleRACH(repeatedRACHPreambleI, 4096, (int8_t *)code.ICode(), 256 * 16, &RACHIside);
 
 		signalVector RACHmodBurst(filtLen);
 		signalVector::iterator RACHmodBurstItr = RACHmodBurst.begin();
@@ -612,6 +536,17 @@ signalVector *RadioModem::despread(signalVector &wBurst, const int8_t *code, int
 	return retVec;
 }
 
+RakeReceiver *RadioModem::newRakeReceiver()
+{
+	unsigned fingers = gConfig.getNum("UMTS.Radio.RakeFingers");
+	if (fingers == 0)
+		return NULL;
+	// Search the same window the single path receiver uses before it locks, out to the end of the burst.
+	unsigned searchStart = mDPCHOffset + 10 - 40;
+	unsigned searchEnd = 1024 + mDelaySpread;
+	return new RakeReceiver(fingers, searchStart, searchEnd > searchStart ? searchEnd - searchStart + 1 : 1);
+}
+
 int consecutiveRACH = 0;
 int consecutiveRACHTOA = 0;
 
@@ -673,24 +608,28 @@ bool RadioModem::detectRACHPreamble(signalVector &wBurst, UMTS::Time wTime, floa
 				// to priority queue for next available timestamp.
 				UMTS::Time mAICHResponseTime = wTime;
 
-				while (mAICHResponseTime < gNodeB->clock().get() + UMTS::Time(1, 9)) {
+				while (mAICHResponseTime < downlinkTime() + UMTS::Time(1, 9)) {
 					mAICHResponseTime = mAICHResponseTime + UMTS::Time(1, 9); // 12 access slots
 				}
 				// mAICHResponseTime = mAICHResponseTime + UMTS::Time(1,9);
 				LOG(INFO) << "Insert AICH" << LOGVAR(SNR) << LOGVAR(TOA) << " at " << mAICHResponseTime
 					  << " and " << mAICHResponseTime + UMTS::Time(0, 1)
 					  << ", last transmit: " << mLastTransmitTime
-					  << ", now: " << gNodeB->clock().get() << "rcvTime: " << cpTime;
+					  << ", now: " << downlinkTime() << "rcvTime: " << cpTime;
 				bool dummy;
 				Time uselessTime;
 				TxBitsBurst *out1 = new TxBitsBurst(gAICHSignatures[j].segment(0, 20), 256,
 					mAICHSpreadingCodeIndex, mAICHResponseTime, false);
 				RN_MEMLOG(TxBitsBurst, out1);
 				addBurst(out1, dummy, uselessTime);
+				if (dummy)
+					delete out1;
 				TxBitsBurst *out2 = new TxBitsBurst(gAICHSignatures[j].segment(20, 12), 256,
 					mAICHSpreadingCodeIndex, mAICHResponseTime + UMTS::Time(0, 1), false);
 				RN_MEMLOG(TxBitsBurst, out2);
 				addBurst(out2, dummy, uselessTime);
+				if (dummy)
+					delete out2;
 				// Indicated that a RACH message part is coming soon for demodulator
 				mNextRACHMessageStart = mAICHResponseTime + UMTS::Time(0, 3); // Sec. 7.3 of 25.211
 				mRACHMessagePending = true;
@@ -775,7 +714,7 @@ bool RadioModem::decodeRACHMessage(signalVector &wBurst, UMTS::Time wTime, float
 	signalVector *despreadRACHData =
 		despread(descrambledRACHFrame, gOVSFTree.code(sfLog2, sfIndex), (1 << sfLog2), false);
 
-	// Where to send these results? the FEC is at gNodeB->mRachFec
+	// The results go to writeRACHSlot
 	// FIXME: need to set RSSI
 	unsigned slotSize = despreadRACHData->size() / gFrameSlots;
 	for (unsigned j = 0; j < gFrameSlots; j++) {
@@ -792,7 +731,7 @@ bool RadioModem::decodeRACHMessage(signalVector &wBurst, UMTS::Time wTime, float
 		RxBitsBurst dataBurst(sfLog2, dataBits, slotTime, TOA, 0);
 		dataBurst.mTfciBits[0] = RACHTFCI[0 + 2 * j];
 		dataBurst.mTfciBits[1] = RACHTFCI[1 + 2 * j];
-		gNodeB->mRachFec->l1WriteLowSide(dataBurst);
+		writeRACHSlot(dataBurst);
 	}
 
 	delete despreadRACHData;
@@ -800,59 +739,87 @@ bool RadioModem::decodeRACHMessage(signalVector &wBurst, UMTS::Time wTime, float
 	return true;
 }
 
+void RadioModem::writeRACHSlot(const RxBitsBurst &slot)
+{
+	gNodeB->mRachFec->l1WriteLowSide(slot);
+}
+
+UMTS::Time RadioModem::downlinkTime()
+{
+	return gNodeB->clock().get();
+}
+
 bool RadioModem::decodeDCH(signalVector &wBurst, UMTS::Time wTime, int uplinkScramblingCodeIndex, int numPilots,
 	signalVector &descrambledBurst, signalVector &rawBurst, float &guessTOA, float &bestTOA, complex &bestChannel,
-	float &bestSNR, float *TFCI, float *TPC)
+	float &bestSNR, float *TFCI, float *TPC, PilotSIR &pilotSIR, RakeReceiver *rake)
 {
 	// LOG(INFO) << "decodeDCH start: " << wTime;
 	// correlate pilots on Q-channel for slot
 	int slotIx = wTime.TN();
 	complex channel;
 	float TOA;
-	signalVector *uplinkPilots = UplinkPilotWaveforms(uplinkScramblingCodeIndex, 0, numPilots, slotIx);
-	// FIXME: this start TOA should be adaptive based on previous TOA results
-	float startTOA = (float)mDPCHOffset + 384; // uplink DCH is offset by 1024 chips
-	startTOA += 10.0;			   // seems to be constant...Tx+Rx group delay of the RAD3 perhaps.
 	float SNR;
-	float corrWindow = 40.0;
-	bool validTOAGuess = (guessTOA > -5000.0);
-	if (validTOAGuess) { // guess is useful
-		startTOA = guessTOA + 384;
-		corrWindow = 5.0;
+	signalVector *uplinkPilots = mUplinkCodes.pilotFilter(uplinkScramblingCodeIndex, numPilots, slotIx);
+	const PackedScramblingCode *code = mUplinkCodes.code(uplinkScramblingCodeIndex);
+	if (!uplinkPilots || !code) {
+		// Not built yet; a DCH normally asks for them when it is opened.
+		sUplinkCodeMiss.inc();
+		mUplinkCodes.request(uplinkScramblingCodeIndex, numPilots);
+		return false;
 	}
-	SNR = estimateChannel(&wBurst, uplinkPilots, corrWindow * 2 + 1, (startTOA - corrWindow), &channel, &TOA);
+	int8_t scramI[gSlotLen], scramQ[gSlotLen];
+	code->expand(gSlotLen * slotIx, gSlotLen, scramI, scramQ);
 
-	const float idealCorrelationAmplitude = 2 * uplinkPilots->size();
-	channel = channel / idealCorrelationAmplitude;
-	TOA = TOA - 384;
-	LOG(INFO) << "slotIx: " << slotIx << ", SNR: " << SNR << ", guessTOA: " << guessTOA << ", TOA: " << TOA << " "
-		  << corrWindow << ", c: " << channel << " abs: " << channel.abs();
+	signalVector descrambleResult = descrambledBurst.segment(gSlotLen * slotIx, gSlotLen);
 
-	// if viable correlation, demodulate data on I-channel and send to RACH decoder
-	// if (SNR < detectionThreshold) return false;
+	if (rake) {
+		SNR = rake->search(wBurst, uplinkPilots, mDPCCHPilotOffset);
+		rake->estimate(wBurst, scramI, scramQ, gPilotPatterns[numPilots - 3][slotIx]);
+		signalVector combined(gSlotLen);
+		rake->combine(wBurst, combined);
+		descramble(combined, scramI, scramQ, &descrambleResult);
+		TOA = rake->mainDelay();
+		channel = rake->numFingers() ? rake->finger(0).mChannel : complex(0, 0);
+		LOG(INFO) << "slotIx: " << slotIx << ", SNR: " << SNR << ", fingers: " << rake->numFingers()
+			  << ", TOA: " << TOA << ", c: " << channel << " abs: " << channel.abs();
+	} else {
+		// FIXME: this start TOA should be adaptive based on previous TOA results
+		float startTOA = (float)mDPCHOffset + mDPCCHPilotOffset; // uplink DCH is offset by 1024 chips
+		startTOA += 10.0; // seems to be constant...Tx+Rx group delay of the RAD3 perhaps.
+		float corrWindow = 40.0;
+		bool validTOAGuess = (guessTOA > -5000.0);
+		if (validTOAGuess) { // guess is useful
+			startTOA = guessTOA + mDPCCHPilotOffset;
+			corrWindow = 5.0;
+		}
+		SNR = estimateChannel(
+			&wBurst, uplinkPilots, corrWindow * 2 + 1, (startTOA - corrWindow), &channel, &TOA);
 
-	if (channel == complex(0, 0))
-		channel = complex(1e6, 1e6); // don't divide by zero.
+		const float idealCorrelationAmplitude = 2 * uplinkPilots->size();
+		channel = channel / idealCorrelationAmplitude;
+		TOA = TOA - mDPCCHPilotOffset;
+		LOG(INFO) << "slotIx: " << slotIx << ", SNR: " << SNR << ", guessTOA: " << guessTOA
+			  << ", TOA: " << TOA << " " << corrWindow << ", c: " << channel << " abs: " << channel.abs();
 
-	signalVector rawData = rawBurst.segment(gSlotLen * slotIx, wBurst.size());
-	wBurst.copyTo(rawData);
+		// if viable correlation, demodulate data on I-channel and send to RACH decoder
+		// if (SNR < detectionThreshold) return false;
 
-	// scaleVector(wBurst,complex(1.0,0.0)/channel);
-	delayVector(wBurst, -TOA); // round(-TOA));
+		if (channel == complex(0, 0))
+			channel = complex(1e6, 1e6); // don't divide by zero.
 
-	// FIXME: we should use segment or alias to avoid copy operations
-	signalVector truncBurst(wBurst.begin(), 0, gSlotLen);
-	scaleVector(truncBurst, complex(1.0, 0.0) / channel);
+		signalVector rawData = rawBurst.segment(gSlotLen * slotIx, wBurst.size());
+		wBurst.copyTo(rawData);
 
-	if (!mUplinkScramblingCodes[uplinkScramblingCodeIndex])
-		mUplinkScramblingCodes[uplinkScramblingCodeIndex] = new UplinkScramblingCode(uplinkScramblingCodeIndex);
+		// scaleVector(wBurst,complex(1.0,0.0)/channel);
+		delayVector(wBurst, -TOA); // round(-TOA));
 
-	signalVector descrambleResult = descrambledBurst.segment(gSlotLen * slotIx, gSlotLen);
+		// FIXME: we should use segment or alias to avoid copy operations
+		signalVector truncBurst(wBurst.begin(), 0, gSlotLen);
+		scaleVector(truncBurst, complex(1.0, 0.0) / channel);
 
-	// LOG(INFO) << "des start: " << wTime;
-	descramble(truncBurst, (int8_t *)mUplinkScramblingCodes[uplinkScramblingCodeIndex]->ICode() + gSlotLen * slotIx,
-		(int8_t *)mUplinkScramblingCodes[uplinkScramblingCodeIndex]->QCode() + gSlotLen * slotIx,
-		&descrambleResult);
+		// LOG(INFO) << "des start: " << wTime;
+		descramble(truncBurst, scramI, scramQ, &descrambleResult);
+	}
 
 	// if ((wTime.FN() % 100 == 0) && (!wTime.TN()))
 	//	LOG(INFO) << "despread DCH data: " << *despreadDCHData;
@@ -868,10 +835,16 @@ bool RadioModem::decodeDCH(signalVector &wBurst, UMTS::Time wTime, int uplinkScr
 
 	// FIXME: assume slot format 0...need to adapt accordingly
 	float bitscale = -0.5 * (1.0 / (float)(1 << 8) / 2.0);
-	TFCI[0 + 2 * slotIx] = bitscale * ((*despreadDCHControl)[0 + 6].real()) + 0.5;
-	TFCI[1 + 2 * slotIx] = bitscale * ((*despreadDCHControl)[1 + 6].real()) + 0.5;
-	TPC[0 + 2 * slotIx] = bitscale * ((*despreadDCHControl)[2 + 6].real()) + 0.5;
-	TPC[1 + 2 * slotIx] = bitscale * ((*despreadDCHControl)[3 + 6].real()) + 0.5;
+	float control[10];
+	for (int i = 0; i < 10; i++) {
+		control[i] = (*despreadDCHControl)[i].real();
+	}
+	const BitVector &pilots = gPilotPatterns[numPilots - 3][slotIx];
+	uint32_t pilotBits = 0;
+	for (int i = 0; i < numPilots; i++) {
+		pilotBits |= (uint32_t)pilots.bit(i) << i;
+	}
+	decodeDPCCHSlot(control, bitscale, numPilots, pilotBits, &TFCI[2 * slotIx], &TPC[2 * slotIx], pilotSIR);
 
 	// LOG(INFO) << "DCH TFCI: " << TFCI[0+2*slotIx] << " " << TFCI[1+2*slotIx];
 
@@ -899,24 +872,34 @@ bool RadioModem::decodeDCH(signalVector &wBurst, UMTS::Time wTime, int uplinkScr
 bool RadioModem::decodeDPDCHFrame(
 	DPDCH &frame, int uplinkScramblingCodeIndex, int uplinkSpreadingFactorLog2, int uplinkSpreadingCodeIndex)
 {
-
-	delayVector(frame.rawBurst, -frame.bestTOA); // round(-TOA));
-
-	// FIXME: we should use segment or alias to avoid copy operations
-	signalVector truncBurst(frame.rawBurst.begin(), 0, gFrameLen);
-	scaleVector(truncBurst, complex(1.0, 0.0) / frame.bestChannel);
-
-	if (!mUplinkScramblingCodes[uplinkScramblingCodeIndex])
-		mUplinkScramblingCodes[uplinkScramblingCodeIndex] = new UplinkScramblingCode(uplinkScramblingCodeIndex);
-
-	signalVector descrambleResult(truncBurst.size());
-
-	// LOG(INFO) << "des start: " << wTime;
-	descramble(truncBurst, (int8_t *)mUplinkScramblingCodes[uplinkScramblingCodeIndex]->ICode(),
-		(int8_t *)mUplinkScramblingCodes[uplinkScramblingCodeIndex]->QCode(), &descrambleResult);
+	// With a RAKE, decodeDCH already combined and descrambled each slot using that slot's own channel estimates.
+	signalVector *descrambled = &frame.descrambledBurst;
+	signalVector descrambleResult;
+	if (!frame.rake) {
+		delayVector(frame.rawBurst, -frame.bestTOA); // round(-TOA));
+
+		// FIXME: we should use segment or alias to avoid copy operations
+		signalVector truncBurst(frame.rawBurst.begin(), 0, gFrameLen);
+		scaleVector(truncBurst, complex(1.0, 0.0) / frame.bestChannel);
+
+		// decodeDCH already had the code for every slot of the frame.
+		const PackedScramblingCode *code = mUplinkCodes.code(uplinkScramblingCodeIndex);
+		assert(code);
+		descrambleResult.resize(truncBurst.size());
+
+		// LOG(INFO) << "des start: " << wTime;
+		int8_t scramI[gSlotLen], scramQ[gSlotLen];
+		for (unsigned slot = 0; slot < gFrameSlots; slot++) {
+			code->expand(gSlotLen * slot, gSlotLen, scramI, scramQ);
+			signalVector in = truncBurst.segment(gSlotLen * slot, gSlotLen);
+			signalVector out = descrambleResult.segment(gSlotLen * slot, gSlotLen);
+			descramble(in, scramI, scramQ, &out);
+		}
+		descrambled = &descrambleResult;
+	}
 
 	signalVector *despreadDCHData =
-		despread(descrambleResult, gOVSFTree.code(uplinkSpreadingFactorLog2, uplinkSpreadingCodeIndex),
+		despread(*descrambled, gOVSFTree.code(uplinkSpreadingFactorLog2, uplinkSpreadingCodeIndex),
 			(1 << uplinkSpreadingFactorLog2), false);
 
 	// LOG(INFO) << "despreadDCHData: " << despreadDCHData->segment(0,1000);
@@ -1013,20 +996,14 @@ void RadioModem::receiveSlot(signalVector *wwBurst, UMTS::Time wTime)
 #if 1
 	// gActiveDCH...a list of active DCH FEC objects.
 	// go through list and demodulate for each DCH.
-	DCHListType::const_iterator DCHBegin, DCHEnd;
-	{
-		ScopedLock lock(gActiveDCH.mLock);
-		if ((wTime.TN() == 0) && (wTime.FN() % 4 == 0) && (gActiveDPDCH.size() > gActiveDCH.size())) {
-			// more than one DCH just closed, need to rebuild map
-			gActiveDPDCH.clear();
-		}
-		DCHBegin = gActiveDCH.begin();
-		DCHEnd = gActiveDCH.end();
-		gActiveDCH.inRxUse = true;
+	DCHListType::Snapshot activeDCH(gActiveDCH);
+	if ((wTime.TN() == 0) && (wTime.FN() % 4 == 0) && (gActiveDPDCH.size() > activeDCH.size())) {
+		// more than one DCH just closed, need to rebuild map
+		gActiveDPDCH.clear();
 	}
 
 	int threadCtr = 0;
-	for (DCHListType::const_iterator DCHItr = DCHBegin; DCHItr != DCHEnd; DCHItr++) {
+	for (DCHListType::const_iterator DCHItr = activeDCH.begin(); DCHItr != activeDCH.end(); DCHItr++) {
 		DCHFEC *currDCH = *DCHItr;
 		if (!currDCH->active())
 			continue;
@@ -1037,10 +1014,6 @@ void RadioModem::receiveSlot(signalVector *wwBurst, UMTS::Time wTime)
 		RN_MEMLOG(signalVector, (signalVector *)(q->burst));
 		mDCHQueue[threadCtr++].write(q);
 	}
-	{
-		ScopedLock lock(gActiveDCH.mLock);
-		gActiveDCH.inRxUse = false;
-	}
 #endif
 
 	return;
@@ -1063,18 +1036,19 @@ void RadioModem::transmitSlot(UMTS::Time nowTime, bool &underrun)
 
 	underrun = false;
 
-	// dump stale bursts, if any
-	while (TxBitsBurst *staleBurst = mTxQueue->getStaleBurst(nowTime)) {
-		LOG(NOTICE) << "dumping STALE burst in UMTS Tx Queue, nowTime: " << nowTime
-			    << ", burst time:" << staleBurst->time();
-		delete staleBurst;
+	// bursts that missed their slot were dropped by the wheel
+	unsigned late;
+	TxBitsBurst *next = mTxWheel.drain(nowTime, late);
+	if (late) {
+		LOG(NOTICE) << "dropped " << late << " late bursts in UMTS Tx wheel, nowTime: " << nowTime;
+		sTxLate.inc(late);
 		underrun = true;
 	}
 
 	std::map<unsigned int, bool> receivedBursts;
 	receivedBursts.clear();
-	// if queue contains data at the desired timestamp, spread it and accumulate
-	while (TxBitsBurst *next = (TxBitsBurst *)mTxQueue->getCurrentBurst(nowTime)) {
+	// spread the bursts for this slot and accumulate
+	while (next) {
 		// LOG(INFO) << "transmitFIFO: wrote burst " << next << " at time: " << nowTime;
 		unsigned int startIx = (next->rightJustified()) ? (gSlotLen - (next->size() / 2 * next->SF())) : 0;
 		if (next->DCH()) //(next->SF()!=256)
@@ -1085,21 +1059,16 @@ void RadioModem::transmitSlot(UMTS::Time nowTime, bool &underrun)
 			waveformI + startIx, waveformQ + startIx, gSlotLen,
 			next->DCH() ? mDCHAmplitude : mCCPCHAmplitude);
 		receivedBursts[(1 << next->log2SF()) + (next->codeIndex() << 16)] = true;
-		delete next;
+		TxBitsBurst *done = next;
+		next = next->wheelNext();
+		delete done;
 	}
 
 #if 1
 	// stick in DPCCH pilots for any active DCH channels, UE needs these for synchronization in CELL_DCH state
 	// need to stick in TPC bits and TFCI bits too.
-	DCHListType::const_iterator DCHItr, DCHEnd;
-	{
-		// LOG(NOTICE) << "waiting for lock";
-		ScopedLock lock(gActiveDCH.mLock);
-		// LOG(NOTICE) << "got lock";
-		DCHItr = gActiveDCH.begin();
-		DCHEnd = gActiveDCH.end();
-		gActiveDCH.inTxUse = true;
-	}
+	DCHListType::Snapshot activeDCH(gActiveDCH);
+	DCHListType::const_iterator DCHItr = activeDCH.begin(), DCHEnd = activeDCH.end();
 	while (DCHItr != DCHEnd) {
 		DCHFEC *currDCH = *DCHItr; // dynamic_cast<DCHFEC*>(*DCHItr);	// (pat) cast should not be needed?
 		if (!currDCH->active()) {
@@ -1144,10 +1113,6 @@ void RadioModem::transmitSlot(UMTS::Time nowTime, bool &underrun)
 		DCHItr++;
 	}
 #endif
-	{
-		ScopedLock lock(gActiveDCH.mLock);
-		gActiveDCH.inTxUse = false;
-	}
 
 	// scramble
 	// start with the P-SCH + S-SCH waveforms as they are unscrambled
@@ -1187,14 +1152,27 @@ void RadioModem::transmitSlot(UMTS::Time nowTime, bool &underrun)
 	// LOG(INFO) << LOGVAR(mLastTransmitTime) <<LOGVAR2("clock.FN",gNodeB->clock().FN());
 }
 
+void RadioModem::prepareUplink(unsigned scramblingCode, unsigned numPilots)
+{
+	mUplinkCodes.request(scramblingCode, numPilots);
+}
+
 void RadioModem::addBurst(TxBitsBurst *wBurst, bool &underrun, Time &updateTime)
 {
-	underrun = false;
-	if (wBurst->time() > mLastTransmitTime) {
-		mTxQueue->write(wBurst);
-		assert(mTxQueue->size() < 10000); // (pat) FIXME: Make sure someone is on the other end.
-	} else {
+	switch (mTxWheel.push(wBurst)) {
+	case TxSlotWheel::QUEUED:
+		underrun = false;
+		break;
+	case TxSlotWheel::LATE:
+		underrun = true;
+		updateTime = mTxWheel.lastTime();
+		break;
+	case TxSlotWheel::TOO_EARLY:
+		LOG(WARNING) << "burst too far ahead for UMTS Tx wheel: " << wBurst->time()
+			     << ", last transmit: " << mTxWheel.lastTime();
+		sTxTooEarly.inc();
 		underrun = true;
-		updateTime = mLastTransmitTime;
+		updateTime = mTxWheel.lastTime();
+		break;
 	}
 }
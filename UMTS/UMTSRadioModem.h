@@ -19,35 +19,17 @@
 #include <CommonLibs/LinkedLists.h>
 #include <CommonLibs/Sockets.h>
 
+#include "UMTSCodeBank.h"
 #include "UMTSCodes.h"
+#include "UMTSL1Const.h"
+#include "UMTSRake.h"
+#include "UMTSTxWheel.h"
 #include "sigProcLib.h"
 
 namespace UMTS {
 
 typedef int16_t radioData_t;
 
-/** a priority queue of radioVectors, i.e. UMTS bursts, sorted so that earliest element is at top */
-class TxBitsQueue : public InterthreadPriorityQueue<TxBitsBurst> {
-
-public:
-	/** the top element of the queue */
-	UMTS::Time nextTime() const;
-
-	/**
-	  Get stale burst, if any.
-	  @param targTime The target time.
-	  @return Pointer to burst older than target time, removed from queue, or NULL.
-	*/
-	TxBitsBurst *getStaleBurst(const UMTS::Time &targTime);
-
-	/**
-	  Get current burst, if any.
-	  @param targTime The target time.
-	  @return Pointer to burst at the target time, removed from queue, or NULL.
-	*/
-	TxBitsBurst *getCurrentBurst(const UMTS::Time &targTime);
-};
-
 struct FECDispatchInfo {
 	void *fec; // actually DCHFEC;
 	RxBitsBurst *burst;
@@ -86,14 +68,16 @@ public:
 	signalVector rawBurst;
 	float tfciBits[32];
 	float tpcBits[30];
+	PilotSIR pilotSIR;
 	bool active;
 	float bestTOA;
 	complex bestChannel;
 	float bestSNR;
 	float lastTOA;
 	float powerMultiplier;
+	RakeReceiver *rake; // NULL for the single path receiver.
 
-	DPDCH(void *wFEC, UMTS::Time wTime) : fec(wFEC), frameTime(wTime)
+	DPDCH(void *wFEC, UMTS::Time wTime, RakeReceiver *wRake = NULL) : fec(wFEC), frameTime(wTime), rake(wRake)
 	{
 		active = true;
 		descrambledBurst = signalVector(gFrameLen);
@@ -103,7 +87,7 @@ public:
 		powerMultiplier = 1.0;
 	}
 
-	~DPDCH() {}
+	~DPDCH() { delete rake; }
 };
 
 // TODO: The RadioModem needs a loop to call transmitSlot repeatedly.
@@ -137,19 +121,20 @@ public:
 	UDPSocket &mDataSocket;
 
 	RadioModem(UDPSocket &wDataSocket);
+	virtual ~RadioModem() {}
 
-	/* (pointer to channel map,
-		    map of scrambling codes,
-		    priority queue of TxBitsBurst objects)
-	*/
 	// gather up submitted slots for transmission at timestamp
-	// return underrun to indicate that queue contains bursts that are too old
+	// return underrun to indicate that bursts missed their slot and were dropped
 	void transmitSlot(UMTS::Time timestamp, bool &underrun);
 
 	// public method to add TxBitsBurst burst for transmission
-	// return underrun to indicate that burst is too late, and what time the clock should be updated to
+	// return underrun to indicate that burst is too late or too early and was not taken, and what time the
+	// clock should be updated to
 	void addBurst(TxBitsBurst *wBurst, bool &underrun, Time &updateTime);
 
+	// have the uplink scrambling code and pilot filters of a DCH built ahead of its first burst
+	void prepareUplink(unsigned scramblingCode, unsigned numPilots);
+
 	// receive burst from UDP packet
 	void receiveBurst(void);
 
@@ -172,17 +157,15 @@ private:
 	// receive data
 	void receiveSlot(signalVector *wBurst, UMTS::Time wTime);
 
-	// map between a hash and an array of 15 signalVectors of varying length
-	// hash function is (scramblingcode*6)+nP
-	std::map<int, signalVector **> mUplinkPilotWaveformMap;
-	std::map<int, UplinkScramblingCode *> mUplinkScramblingCodes;
-
-	inline int waveformMapHash(int scramblingCode, int nP) { return scramblingCode * 6 + nP; }
+	// Uplink DCH scrambling codes and pilot matched filters, built when the DCH is opened.
+	// Room for every DCH the ChannelTree populates.
+	static const unsigned mUplinkCodeBankSize = 512;
+	UplinkCodeBank mUplinkCodes;
 
 	signalVector *mRACHTable[16];
 
 	//      ChannelMap   *mMap; // ???
-	TxBitsQueue *mTxQueue;
+	TxSlotWheel mTxWheel;
 
 	// Going to assume we are only using one signature
 	bool mRACHSignatureMask[16];
@@ -222,12 +205,14 @@ private:
 	// latest transmit timestamp
 public:
 	UMTS::Time mLastTransmitTime;
-	unsigned txqsize() { return mTxQueue->size(); }
+	unsigned txqsize() { return mTxWheel.size(); }
 
 private:
 	int mDelaySpread;
 	int mDPCCHCorrelationWindow;
-	int mDPCCHSearchSize;
+	// The pilot matched filter covers these chips of each slot.
+	static const int mDPCCHPilotOffset = 384;
+	static const int mDPCCHSearchSize = 256;
 
 	int mSSCHGroupNum;
 	radioData_t *mDownlinkSCHWaveformsI[gFrameSlots];
@@ -247,10 +232,6 @@ private:
 	Thread mRACHProcessor;
 	Thread mDCHProcessor[100];
 
-	/* Generate a table of pilot sequences for lookup and later correlation
-	   Defined Sec. 5.2.1.1 of 25.211, dependes upon higher layer parameters and the slot */
-	signalVector *UplinkPilotWaveforms(int scramblingCode, int codeIndex, int numPilots, int slotIx);
-
 	/* Generate a table of RACH preambles
 	   Need to know scrambling code assigned to RACH preambles and message part */
 	void generateRACHPreambleTable(int startIx, int filtLen);
@@ -298,10 +279,20 @@ public:
 	/* Decode expected DCH burst */
 	bool decodeDCH(signalVector &wBurst, UMTS::Time wTime, int uplinkScramblingCodeIndex, int numPilots,
 		signalVector &descrambledBurst, signalVector &rawBurst, float &guessTOA, float &bestTOA,
-		complex &bestChannel, float &bestSNR, float *TFCI, float *TPC);
+		complex &bestChannel, float &bestSNR, float *TFCI, float *TPC, PilotSIR &pilotSIR,
+		RakeReceiver *rake = NULL);
 
 	bool decodeDPDCHFrame(DPDCH &frame, int uplinkScramblingCodeIndex, int uplinkSpreadingFactorLog2,
 		int uplinkSpreadingCodeIndex);
+
+	/* Where decodeRACHMessage sends each slot of a RACH message part: the RACH FEC of the NodeB. */
+	virtual void writeRACHSlot(const RxBitsBurst &slot);
+
+	/* The downlink clock detectRACHPreamble times the AICH against: the NodeB clock. */
+	virtual UMTS::Time downlinkTime();
+
+	/* A RAKE receiver for a new DCH, sized from the config, or NULL to use the single path receiver. */
+	RakeReceiver *newRakeReceiver();
 	void radioModemStart();
 };
 
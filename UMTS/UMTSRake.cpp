@@ -0,0 +1,261 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <CommonLibs/Logger.h>
+
+#include "UMTSRake.h"
+
+using namespace UMTS;
+
+const float RakeReceiver::sFingerRangeDB = 15.0;
+const float RakeReceiver::sFingerFloor = 2.0;
+
+// DPCCH is always spread with C(256,0), which is all ones.
+static const unsigned sPilotSF = 256;
+
+RakeReceiver::RakeReceiver(unsigned wMaxFingers, unsigned wSearchStart, unsigned wSearchLen)
+	: mMaxFingers(wMaxFingers), mSearchStart(wSearchStart), mSearchLen(wSearchLen)
+{
+	if (mMaxFingers > sMaxFingers)
+		mMaxFingers = sMaxFingers;
+	if (mMaxFingers < 1)
+		mMaxFingers = 1;
+	if (mSearchLen < 1)
+		mSearchLen = 1;
+	if (mSearchLen > sMaxSearchLen)
+		mSearchLen = sMaxSearchLen;
+	reset();
+}
+
+void RakeReceiver::reset()
+{
+	memset(mProfile, 0, mSearchLen * sizeof(float));
+	mSlots = 0;
+	mNumFingers = 0;
+}
+
+float RakeReceiver::search(signalVector &burst, signalVector *pilotFilter, unsigned pilotOffset)
+{
+	signalVector correlation(mSearchLen);
+	correlate(&burst, pilotFilter, &correlation, CUSTOM, true,
+		(pilotFilter->size() - 1) + mSearchStart + pilotOffset, mSearchLen);
+
+	// Running mean until the profile is full, then a single pole average.
+	if (mSlots < sProfileSlots)
+		mSlots++;
+	float alpha = 1.0F / (float)mSlots;
+	float peak = 0.0, sum = 0.0;
+	for (unsigned i = 0; i < mSearchLen; i++) {
+		float power = correlation[i].norm2();
+		mProfile[i] += alpha * (power - mProfile[i]);
+		if (power > peak)
+			peak = power;
+		sum += power;
+	}
+	placeFingers();
+
+	float mean = sum / (float)mSearchLen;
+	return (mean != 0.0) ? peak / mean : -100.0;
+}
+
+// Amplitude of the path at a lag of the profile, with the noise floor taken out.
+static float pathAmplitude(float power, float noise) { return power > noise ? sqrtf(power - noise) : 0.0; }
+
+// Hann windowed sinc, for the point frac after each chip in turn.  The taps are scaled to pass white noise
+// at the same power as a finger on one chip, so the fingers can be compared and combined as they are.
+static void interpolator(float frac, float *taps)
+{
+	const int first = 1 - (int)RakeReceiver::sInterpTaps / 2;
+	float energy = 0.0;
+	for (unsigned t = 0; t < RakeReceiver::sInterpTaps; t++) {
+		float x = (float)(first + (int)t) - frac;
+		float window = 0.5F + 0.5F * cosf(M_PI * x / (float)(RakeReceiver::sInterpTaps / 2 + 1));
+		taps[t] = window * sinf(M_PI * x) / (M_PI * x);
+		energy += taps[t] * taps[t];
+	}
+	float scale = 1.0F / sqrtf(energy);
+	for (unsigned t = 0; t < RakeReceiver::sInterpTaps; t++)
+		taps[t] *= scale;
+}
+
+void RakeReceiver::placeFingers()
+{
+	float mean = 0.0;
+	for (unsigned i = 0; i < mSearchLen; i++)
+		mean += mProfile[i];
+	mean /= (float)mSearchLen;
+
+	memset(mTaken, 0, sizeof(mTaken));
+	float floor = 0.0;
+	unsigned used = 0; // Fingers between two chips count as two.
+	mNumFingers = 0;
+	while (used < mMaxFingers) {
+		int best = -1;
+		for (unsigned i = 0; i < mSearchLen; i++) {
+			if (!mTaken[i] && (best < 0 || mProfile[i] > mProfile[best]))
+				best = i;
+		}
+		if (best < 0)
+			break;
+		if (mNumFingers == 0) {
+			// The strongest path always gets a finger, same as the single path receiver.
+			floor = mProfile[best] * dBinv(-sFingerRangeDB);
+			if (floor < sFingerFloor * mean)
+				floor = sFingerFloor * mean;
+		} else if (mProfile[best] < floor) {
+			break;
+		}
+		mTaken[best] = true;
+		used++;
+
+		Finger &finger = mFingers[mNumFingers++];
+		finger.mDelay = mSearchStart + best;
+		finger.mFrac = 0.0;
+		finger.mSplit = false;
+		finger.mChannel = finger.mNextChannel = 0.0;
+
+		// Its stronger free neighbour, if that would get a finger too.
+		int next = -1;
+		if (best > 0 && !mTaken[best - 1] && mProfile[best - 1] >= floor)
+			next = best - 1;
+		if ((unsigned)best + 1 < mSearchLen && !mTaken[best + 1] && mProfile[best + 1] >= floor &&
+			(next < 0 || mProfile[best + 1] > mProfile[next]))
+			next = best + 1;
+		if (next < 0 || used >= mMaxFingers)
+			continue;
+		mTaken[next] = true;
+		used++;
+
+		// A single path d chips after lag k shows up as sinc(d) at k and sinc(1 - d) at k + 1, so d is the
+		// second over the sum of the two.  The window is mostly noise, so its mean is the noise floor.
+		float here = pathAmplitude(mProfile[best], mean);
+		float there = pathAmplitude(mProfile[next], mean);
+		if (next < best) {
+			finger.mDelay--;
+			finger.mFrac = here / (here + there);
+		} else {
+			finger.mFrac = there / (here + there);
+		}
+		interpolator(finger.mFrac, finger.mTaps);
+	}
+}
+
+// Chip n of the slot, delay chips into the burst and interpolated with taps if there are any, or 0 past either
+// end of the burst.
+static inline complex chipAt(const signalVector &burst, unsigned delay, const float *taps, unsigned n)
+{
+	unsigned pos = delay + n;
+	if (!taps)
+		return pos < burst.size() ? burst[pos] : complex(0.0);
+	const int first = 1 - (int)RakeReceiver::sInterpTaps / 2;
+	if ((int)pos + first < 0 || pos + first + RakeReceiver::sInterpTaps > burst.size())
+		return 0.0;
+	signalVector::const_iterator in = burst.begin() + pos + first;
+	complex result = 0.0;
+	for (unsigned t = 0; t < RakeReceiver::sInterpTaps; t++)
+		result += *in++ * taps[t];
+	return result;
+}
+
+// The channel on one path from the DPCCH pilot symbols at the start of the slot.
+static complex pilotChannel(const signalVector &burst, unsigned delay, const float *taps, const int8_t *scramI,
+	const int8_t *scramQ, const BitVector &pilots)
+{
+	unsigned numPilots = pilots.size();
+	complex acc = 0.0;
+	for (unsigned s = 0; s < numPilots; s++) {
+		unsigned start = s * sPilotSF;
+		unsigned stop = start + sPilotSF;
+		if (delay + stop > burst.size())
+			break;
+		complex symbol = 0.0;
+		if (taps) {
+			for (unsigned n = start; n < stop; n++)
+				symbol += chipAt(burst, delay, taps, n) * complex(scramI[n], -scramQ[n]);
+		} else {
+			signalVector::const_iterator chip = burst.begin() + delay + start;
+			for (unsigned n = start; n < stop; n++)
+				symbol += *chip++ * complex(scramI[n], -scramQ[n]);
+		}
+		if (pilots.bit(s))
+			acc -= symbol;
+		else
+			acc += symbol;
+	}
+	// Pilots are on Q, so the descrambled pilot chips come out as 2*j*h*pilot.
+	return acc * complex(0.0, -1.0) / (float)(2 * sPilotSF * numPilots);
+}
+
+float RakeReceiver::estimate(
+	const signalVector &burst, const int8_t *scramI, const int8_t *scramQ, const BitVector &pilots)
+{
+	float total = 0.0;
+	for (unsigned f = 0; f < mNumFingers; f++) {
+		Finger &finger = mFingers[f];
+		if (finger.mFrac == 0.0) {
+			finger.mChannel = pilotChannel(burst, finger.mDelay, NULL, scramI, scramQ, pilots);
+			total += finger.mChannel.norm2();
+			continue;
+		}
+		complex between = pilotChannel(burst, finger.mDelay, finger.mTaps, scramI, scramQ, pilots);
+		complex before = pilotChannel(burst, finger.mDelay, NULL, scramI, scramQ, pilots);
+		complex after = pilotChannel(burst, finger.mDelay + 1, NULL, scramI, scramQ, pilots);
+		finger.mSplit = before.norm2() + after.norm2() > between.norm2();
+		finger.mChannel = finger.mSplit ? before : between;
+		finger.mNextChannel = finger.mSplit ? after : complex(0.0);
+		total += finger.mChannel.norm2() + finger.mNextChannel.norm2();
+	}
+	return total;
+}
+
+// Add the chips of one path, weighted, to out.
+static void addPath(const signalVector &burst, unsigned delay, const float *taps, complex weight, signalVector &out)
+{
+	if (delay >= burst.size())
+		return;
+	unsigned len = burst.size() - delay;
+	if (len > out.size())
+		len = out.size();
+	signalVector::iterator acc = out.begin();
+	if (taps) {
+		for (unsigned n = 0; n < len; n++)
+			*acc++ += chipAt(burst, delay, taps, n) * weight;
+		return;
+	}
+	signalVector::const_iterator in = burst.begin() + delay;
+	signalVector::iterator end = out.begin() + len;
+	while (acc < end)
+		*acc++ += *in++ * weight;
+}
+
+void RakeReceiver::combine(const signalVector &burst, signalVector &out) const
+{
+	out.fill(0.0);
+	float total = 0.0;
+	for (unsigned f = 0; f < mNumFingers; f++)
+		total += mFingers[f].mChannel.norm2() + mFingers[f].mNextChannel.norm2();
+	if (total == 0.0)
+		return;
+
+	for (unsigned f = 0; f < mNumFingers; f++) {
+		const Finger &finger = mFingers[f];
+		bool between = finger.mFrac != 0.0 && !finger.mSplit;
+		addPath(burst, finger.mDelay, between ? finger.mTaps : NULL, finger.mChannel.conj() / total, out);
+		if (finger.mSplit)
+			addPath(burst, finger.mDelay + 1, NULL, finger.mNextChannel.conj() / total, out);
+	}
+}
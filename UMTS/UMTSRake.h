@@ -0,0 +1,113 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef UMTSRAKE_H
+#define UMTSRAKE_H
+
+#include <CommonLibs/BitVector.h>
+
+#include "sigProcLib.h"
+
+namespace UMTS {
+
+/*
+	RAKE receiver for one uplink DPCH, at one sample per chip.
+
+	The single path receiver locks onto the strongest correlation peak and throws away the energy in every
+	other path, which in a typical urban channel is a good part of the signal.  Here the path searcher
+	correlates the slot's pilots over the whole delay window every slot and keeps a running average of the
+	power delay profile; fingers are placed on the strongest lags of that profile.  Each finger gets its own
+	channel estimate from all the pilot symbols of the current slot, and the fingers are maximal ratio
+	combined back into a single chip stream, scaled the same way the single path receiver scales its one
+	path, so everything downstream (descramble, despread, findTfci, decodeDPDCHFrame) is unchanged.
+
+	The profile is at one sample per chip, so a path that falls between two chips shows up on both
+	neighbouring lags.  Fingers on the two chips get only about 80% of the path's energy at a half chip
+	offset, and each needs a channel estimate of its own, which at low SNR made the RAKE worse than the
+	single path receiver, which interpolates to the path.  When two neighbouring lags both qualify they get
+	one finger between them, at the offset their two amplitudes give for a single path, whose chips are
+	interpolated from the burst.  Two paths a chip or so apart look the same in the averaged profile, and
+	for them the chip fingers do better, so every slot the finger is estimated both ways and the one with
+	more energy is combined.
+*/
+class RakeReceiver {
+
+public:
+	static const unsigned sMaxFingers = 8;
+	// Longest delay window; RadioModem::newRakeReceiver asks for MaxExpectedDelaySpread + 31 lags.
+	static const unsigned sMaxSearchLen = 256;
+	// Taps of the interpolator for fingers between two chips, from sInterpTaps / 2 - 1 chips before.
+	static const unsigned sInterpTaps = 8;
+
+	struct Finger {
+		unsigned mDelay;          // Chips from the start of the receive burst to the start of the slot on this path.
+		float mFrac;              // Chips after mDelay where the path is, 0 for a finger on one chip.
+		float mTaps[sInterpTaps]; // The interpolator for mFrac.
+		bool mSplit;              // This slot the chips either side of mFrac do better on their own.
+		complex mChannel;         // This slot's estimate, scaled like RadioModem::decodeDCH scales its single path.
+		complex mNextChannel;     // If split, the estimate for the chip after mDelay.
+	};
+
+private:
+	unsigned mMaxFingers;
+	unsigned mSearchStart; // First lag of the delay window, in chips from the start of the burst.
+	unsigned mSearchLen;   // Number of lags in the delay window.
+	float mProfile[sMaxSearchLen]; // Averaged power delay profile, one entry per lag.
+	bool mTaken[sMaxSearchLen];    // Lags covered by a finger, while placing them.
+	unsigned mSlots;               // Number of slots averaged into mProfile.
+	Finger mFingers[sMaxFingers];
+	unsigned mNumFingers;
+
+	// Profile averaging time constant in slots.
+	static const unsigned sProfileSlots = 16;
+	// Fingers must be within this many dB of the strongest path...
+	static const float sFingerRangeDB;
+	// ...and this many times the average of the profile, which keeps fingers off the noise.
+	static const float sFingerFloor;
+
+	void placeFingers();
+
+public:
+	RakeReceiver(unsigned wMaxFingers, unsigned wSearchStart, unsigned wSearchLen);
+
+	/* Forget the delay profile, eg when the channel is given to another UE. */
+	void reset();
+
+	/*
+	  Path search.  Correlate the burst against the slot's pilot matched filter (reversed and conjugated)
+	  over the delay window, update the averaged profile and move the fingers.  pilotOffset is the
+	  position of the matched filter's first chip within the slot.
+	  Return the peak to mean ratio of this slot's correlation, like RadioModem::estimateChannel.
+	*/
+	float search(signalVector &burst, signalVector *pilotFilter, unsigned pilotOffset);
+
+	/*
+	  Estimate each finger's channel from the DPCCH pilot symbols at the start of the slot.
+	  scramI and scramQ are the uplink scrambling code aligned to the start of the slot.
+	  Return the total estimated signal power of the combined fingers.
+	*/
+	float estimate(const signalVector &burst, const int8_t *scramI, const int8_t *scramQ, const BitVector &pilots);
+
+	/* Maximal ratio combine the fingers into out, starting at the start of the slot. */
+	void combine(const signalVector &burst, signalVector &out) const;
+
+	unsigned numFingers() const { return mNumFingers; }
+	const Finger &finger(unsigned i) const { return mFingers[i]; }
+	// The delay of the strongest finger, or -1 if there are no fingers yet.
+	int mainDelay() const { return mNumFingers ? (int)mFingers[0].mDelay : -1; }
+};
+
+} // namespace UMTS
+
+#endif
@@ -22,7 +22,8 @@
 namespace UMTS {
 
 TxBitsBurst::TxBitsBurst(const BitVector &bits, size_t wSF, size_t wCodeIndex, const Time &wTime, bool wRightJustified)
-	: BitVector(bits), mSF(wSF), mCodeIndex(wCodeIndex), mTime(wTime), mRightJustified(wRightJustified)
+	: BitVector(bits), mSF(wSF), mCodeIndex(wCodeIndex), mTime(wTime), mRightJustified(wRightJustified),
+	  mWheelNext(NULL)
 {
 	mDCH = false;
 	assert(size() / 2 <= gSlotLen / wSF);
@@ -62,11 +62,14 @@ protected:
 	bool mDCH;	   ///< indicates if burst is a DCH (true) or CCH (false)
 	bool mAICH;
 	bool mRightJustified; ///< bits should be right justified w.r.t slot boundary
+	TxBitsBurst *mWheelNext; ///< link in a TxSlotWheel bucket
+
+	friend class TxSlotWheel;
 
 public:
 	TxBitsBurst(size_t wSF, size_t wCodeIndex, const Time &wTime, bool wDCH, bool wRightJustified = true)
 		: BitVector(gSlotLen / wSF), mSF(wSF), mCodeIndex(wCodeIndex), mTime(wTime), mDCH(wDCH),
-		  mRightJustified(wRightJustified)
+		  mRightJustified(wRightJustified), mWheelNext(NULL)
 	{
 		mLog2SF = 0;
 		while (wSF > 1) {
@@ -98,6 +101,9 @@ public:
 
 	bool rightJustified() const { return mRightJustified; }
 
+	/** The next burst for the same slot, as returned by TxSlotWheel::drain. */
+	TxBitsBurst *wheelNext() const { return mWheelNext; }
+
 	std::ostream &text(std::ostream &os) const;
 	friend std::ostream &operator<<(std::ostream &os, const TxBitsBurst &tbb);
 	friend std::ostream &operator<<(std::ostream &os, const TxBitsBurst *ptbb);
@@ -0,0 +1,132 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include "UMTSTxWheel.h"
+
+namespace UMTS {
+
+TxSlotWheel::TxSlotWheel() : mDrained(sUnplaced), mSize(0), mLate(0), mTooEarly(0)
+{
+	for (unsigned i = 0; i < sSlots; i++) {
+		mBuckets[i] = NULL;
+	}
+}
+
+TxSlotWheel::TxSlotWheel(const Time &lastTime) : mDrained(slotNumber(lastTime)), mSize(0), mLate(0), mTooEarly(0)
+{
+	for (unsigned i = 0; i < sSlots; i++) {
+		mBuckets[i] = NULL;
+	}
+}
+
+TxSlotWheel::~TxSlotWheel()
+{
+	for (unsigned i = 0; i < sSlots; i++) {
+		while (TxBitsBurst *burst = mBuckets[i]) {
+			mBuckets[i] = burst->mWheelNext;
+			delete burst;
+		}
+	}
+}
+
+int TxSlotWheel::drained(int slot)
+{
+	int drained = __atomic_load_n(&mDrained, __ATOMIC_ACQUIRE);
+	if (drained == sUnplaced) {
+		// Whoever loses the race gets the winner's placing.
+		if (__atomic_compare_exchange_n(&mDrained, &drained, slot, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			drained = slot;
+	}
+	return drained;
+}
+
+TxSlotWheel::Result TxSlotWheel::push(TxBitsBurst *burst)
+{
+	int slot = slotNumber(burst->time());
+	int ahead = slotDelta(slot, drained((slot - (int)sSlots / 2 + sCycle) % sCycle));
+	if (ahead <= 0) {
+		__atomic_add_fetch(&mLate, 1, __ATOMIC_RELAXED);
+		return LATE;
+	}
+	if (ahead > (int)sSlots) {
+		__atomic_add_fetch(&mTooEarly, 1, __ATOMIC_RELAXED);
+		return TOO_EARLY;
+	}
+
+	TxBitsBurst **bucket = &mBuckets[slot % sSlots];
+	TxBitsBurst *head = __atomic_load_n(bucket, __ATOMIC_RELAXED);
+	do {
+		burst->mWheelNext = head;
+	} while (!__atomic_compare_exchange_n(bucket, &head, burst, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	__atomic_add_fetch(&mSize, 1, __ATOMIC_RELAXED);
+	return QUEUED;
+}
+
+TxBitsBurst *TxSlotWheel::take(int slot, unsigned &late)
+{
+	TxBitsBurst *burst = __atomic_exchange_n(&mBuckets[slot % sSlots], (TxBitsBurst *)NULL, __ATOMIC_ACQUIRE);
+	TxBitsBurst *keep = NULL;
+	unsigned taken = 0;
+	while (burst) {
+		TxBitsBurst *next = burst->mWheelNext;
+		taken++;
+		if (slotNumber(burst->time()) == slot) {
+			burst->mWheelNext = keep;
+			keep = burst;
+		} else {
+			// A push that lost the race with an earlier drain of this bucket.
+			delete burst;
+			late++;
+		}
+		burst = next;
+	}
+	__atomic_sub_fetch(&mSize, taken, __ATOMIC_RELAXED);
+	return keep;
+}
+
+TxBitsBurst *TxSlotWheel::drain(const Time &now, unsigned &late)
+{
+	late = 0;
+	int slot = slotNumber(now);
+	int prev = drained((slot - 1 + sCycle) % sCycle);
+	int step = slotDelta(slot, prev);
+	if (step <= 0) {
+		// Already drained; anything pushed for it since is late and waits for the bucket to come round.
+		return NULL;
+	}
+
+	// Close the slot to producers first, so whatever they push from here on is refused or found late.
+	__atomic_store_n(&mDrained, slot, __ATOMIC_RELEASE);
+
+	// Slots the transmitter skipped; a long gap empties every other bucket once.
+	unsigned skipped = step - 1 < (int)sSlots ? step - 1 : sSlots - 1;
+	for (unsigned i = 0; i < skipped; i++) {
+		int s = (slot - 1 - (int)i + sCycle) % sCycle;
+		TxBitsBurst *missed = take(s, late);
+		while (missed) {
+			TxBitsBurst *next = missed->mWheelNext;
+			delete missed;
+			late++;
+			missed = next;
+		}
+	}
+
+	TxBitsBurst *due = take(slot, late);
+	if (late) {
+		__atomic_add_fetch(&mLate, late, __ATOMIC_RELAXED);
+	}
+	return due;
+}
+
+} // namespace UMTS
@@ -0,0 +1,118 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef UMTSTXWHEEL_H
+#define UMTSTXWHEEL_H
+
+#include "UMTSTransfer.h"
+
+namespace UMTS {
+
+/*
+	Downlink bursts waiting for their transmit slot.
+
+	Every FACH, DCH and BCH encoder thread hands its slots to the modem ahead of time, and the transmit loop
+	takes whatever is due one slot at a time.  Since a burst is always for one exact slot and producers never
+	run more than a few TTIs ahead, there is no need to sort: the wheel has one bucket per slot over a fixed
+	horizon and a burst goes straight into the bucket of its slot.  Each bucket is a lock-free stack, so any
+	number of producers push with a single compare-and-swap, and the one consumer takes a whole bucket with
+	a single exchange.  Nothing here takes a lock or allocates.
+
+	The consumer publishes the last slot it drained before draining it, and producers refuse bursts for that
+	slot or earlier.  A producer that raced past that check leaves its burst in a bucket that has already
+	gone by; the burst is found, with the wrong time, when the bucket comes round again, and dropped as late.
+	Either way a late burst costs O(1) and never reaches the air at the wrong time.
+
+	The modem's wheel is made before the radio clock is known, so unless it is given a time it waits for the
+	first push or drain to place it.  A first drain places it at that slot; a first push places it half a
+	horizon before the burst, so the other producers, which may run a little less far ahead, are not late.
+*/
+class TxSlotWheel {
+public:
+	static const unsigned sHorizonFrames = 64; ///< How far ahead a burst may be queued.
+	static const unsigned sSlots = sHorizonFrames * gFrameSlots;
+	static const unsigned sCycle = gHyperframe * gFrameSlots; ///< Slot numbers wrap here; sSlots divides it.
+	static const int sUnplaced = -1; ///< mDrained before the first push or drain.
+
+	enum Result {
+		QUEUED,	///< In the wheel.
+		LATE,	///< For the slot being transmitted or earlier; the caller still owns it.
+		TOO_EARLY ///< Beyond the horizon; the caller still owns it.
+	};
+
+private:
+	TxBitsBurst *mBuckets[sSlots]; ///< Heads of the bucket stacks, linked through TxBitsBurst::mWheelNext.
+	int mDrained;		       ///< Slot number of the last drained slot, or sUnplaced.
+	unsigned mSize;		       ///< Bursts in the wheel, for reporting only.
+	unsigned mLate;		       ///< Bursts dropped or refused as late.
+	unsigned mTooEarly;	    ///< Bursts refused as beyond the horizon.
+
+	static int slotNumber(const Time &t) { return t.FN() * gFrameSlots + t.TN(); }
+
+	/** Signed distance in slots from b to a, modulo the slot number cycle. */
+	static int slotDelta(int a, int b)
+	{
+		int d = (a - b) % (int)sCycle;
+		if (d >= (int)sCycle / 2)
+			d -= sCycle;
+		if (d < -(int)sCycle / 2)
+			d += sCycle;
+		return d;
+	}
+
+	/** mDrained, placing the wheel so that slot is the last drained if it has not been placed yet. */
+	int drained(int slot);
+
+	/** Take a whole bucket; delete its bursts that are not for slot and return the rest, linked. */
+	TxBitsBurst *take(int slot, unsigned &late);
+
+	TxSlotWheel(const TxSlotWheel &);
+	TxSlotWheel &operator=(const TxSlotWheel &);
+
+public:
+	/** The wheel is placed by its first push or drain. */
+	TxSlotWheel();
+
+	/** The wheel starts as if lastTime had just been drained. */
+	TxSlotWheel(const Time &lastTime);
+	~TxSlotWheel();
+
+	/** Queue a burst for its time; any thread. */
+	Result push(TxBitsBurst *burst);
+
+	/**
+		Take the bursts for now, linked through TxBitsBurst::wheelNext(), in no particular order.
+		Only one thread may drain.  Slots skipped since the previous drain are emptied on the way and
+		their bursts deleted, as are late bursts found in this slot's bucket.
+		@param late Set to the number of bursts deleted.
+	*/
+	TxBitsBurst *drain(const Time &now, unsigned &late);
+
+	/** The last drained slot, or 0 before the wheel is placed. */
+	Time lastTime() const
+	{
+		int s = __atomic_load_n(&mDrained, __ATOMIC_ACQUIRE);
+		if (s == sUnplaced)
+			s = 0;
+		return Time(s / gFrameSlots, s % gFrameSlots);
+	}
+
+	unsigned size() const { return __atomic_load_n(&mSize, __ATOMIC_RELAXED); }
+	unsigned late() const { return __atomic_load_n(&mLate, __ATOMIC_RELAXED); }
+	unsigned tooEarly() const { return __atomic_load_n(&mTooEarly, __ATOMIC_RELAXED); }
+};
+
+} // namespace UMTS
+
+#endif
@@ -15,6 +15,7 @@
 #define URLC_IMPLEMENTATION 1
 
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
 
 #include "MACEngine.h" // For macHeaderSize
 #include "URLC.h"
@@ -27,6 +28,9 @@
 
 namespace UMTS {
 
+static StatCounter sAmRetransmits("UMTS.RLC.AM.Retransmits", "AMD PDUs sent again after a NACK");
+static StatCounter sAmMaxDat("UMTS.RLC.AM.MaxDAT", "AMD PDUs discarded after MaxDAT transmissions");
+
 const char *URlcMode2Name(URlcMode mode)
 {
 	switch (mode) {
@@ -1184,6 +1188,7 @@ URlcPdu *URlcTransAm::readLowSidePdu2()
 	// you may only resend the most recently sent PDU.
 
 	if (mNackedBlocksWaiting) {
+		sAmRetransmits.inc();
 		// Send this negatively acknowledged pdu.
 		// TODO: If we support piggy-backed status, that needs to be fixed here too.
 		pdu = mPduTxQ[mVSNack];
@@ -1216,6 +1221,7 @@ URlcPdu *URlcTransAm::readLowSidePdu2()
 		// Note that the documentation of the option names does not exactly match
 		// the names in 25.331 RRC 10.3.4.25 Transmission RLC Discard IE.
 		RLCLOG("pdu %d exceeded VTDAT=%d, discarded", pdu->getAmSN(), pdu->mVTDAT);
+		sAmMaxDat.inc();
 		switch (mConfig->mRlcDiscard.mSduDiscardMode) {
 		default:
 			RLCERR("Unsupported RLC discard mode configured:%d", (int)mConfig->mRlcDiscard.mSduDiscardMode);
@@ -16,16 +16,19 @@
 #include <SGSNGGSN/SgsnExport.h>
 
 #include "AsnHelper.h"
+#include "AsnTemplate.h"
 #include "MACEngine.h"
 #include "UMTSLogicalChannel.h"
 #include "UMTSTransfer.h"
 #include "URRC.h"
 #include "URRCMessages.h"
+#include "URRCTemplates.h"
 
 namespace ASN {
 #include "DL-CCCH-Message.h"
 #include "DL-DCCH-Message.h"
 #include "InitialUE-Identity.h"
+#include "PCCH-Message.h"
 #include "UL-CCCH-Message.h"
 #include "UL-DCCH-Message.h"
 #include "asn_SEQUENCE_OF.h"
@@ -47,6 +50,7 @@ const std::string descrRadioBearerSetup("RRC Radio Bearer Setup Message");
 const std::string descrRadioBearerRelease("RRC Radio Bearer Release Message");
 const std::string descrCellUpdateConfirm("RRC Cell Update Confirm Message");
 const std::string descrSecurityModeCommand("RRC Security Mode Command");
+const std::string descrPagingType1("RRC Paging Type 1 Message");
 
 typedef unsigned char uchar;
 
@@ -239,11 +243,52 @@ static bool encodeCcchMsg(ASN::DL_CCCH_Message_t *msg, ByteVector &result,
 	return stat;
 }
 
+// The CCCH messages below are identical for every UE except for a few ids, so they are encoded
+// from AsnMessageTemplates; see AsnTemplate.h and URRCTemplates.cpp.  After a configuration change each
+// template re-encodes its message once and is only relearned if those bits changed, so a change that does
+// not touch what the messages are built from costs three encodes.  If someone is watching the messages in
+// the log we build the asn structure the old way so asnLogMsg has something to print; the bits are the
+// same either way.
+static Mutex sRrcTemplateLock;
+static unsigned sRrcTemplateGeneration = 0; // Configuration generation the templates were learned from.
+static void learnRrcTemplates();
+
+static bool encodeCcchTemplate(AsnMessageTemplate &tmpl, const uint32_t *fieldValues, void *splice,
+	ByteVector &result, string descr, UEInfo *uep, uint32_t urnti)
+{
+	const AsnTemplateSpec &spec = tmpl.spec();
+	if (asnLogWanted()) {
+		ASN::DL_CCCH_Message_t msg;
+		memset(&msg, 0, sizeof(msg));
+		spec.mBuild(&msg, fieldValues, splice);
+		bool stat = encodeCcchMsg(&msg, result, descr, uep, urnti);
+		if (spec.mUnsplice) {
+			spec.mUnsplice(&msg);
+		}
+		if (spec.mFree) {
+			ASN::asn_DEF_DL_CCCH_Message.free_struct(&ASN::asn_DEF_DL_CCCH_Message, &msg, 1);
+		}
+		return stat;
+	}
+
+	ScopedLock lock(sRrcTemplateLock);
+	unsigned generation = ConfigurationSnapshotRef(gConfig)->generation();
+	if (generation != sRrcTemplateGeneration) {
+		learnRrcTemplates();
+		sRrcTemplateGeneration = generation;
+	}
+	if (!tmpl.encode(fieldValues, splice, result)) {
+		return false;
+	}
+	asnCaptureEncoded(&ASN::asn_DEF_DL_CCCH_Message, result);
+	return true;
+}
+
 // Same as RB_InformationSetup but without PDCP info.
 // The list we put these things in may be either SRB_InformationSetupList or SRB_InformationSetupList2,
 // which are 100% identical, but nevertheless the result list type must be void**
 // 25.331 10.3.4.24
-static void toAsnSRB_InformationSetupList(RrcMasterChConfig *masterConfig, void *srblist)
+void toAsnSRB_InformationSetupList(RrcMasterChConfig *masterConfig, void *srblist)
 {
 	// Set up SRBs.
 	for (unsigned rbid = SRB1; rbid <= SRB3; rbid++) {
@@ -459,7 +504,7 @@ ASN::UL_AddReconfTransChInfoList *toAsnUL_AddReconfTransChInfoList(RrcMasterChCo
 }
 
 // Create a fake uplink TrCh, needed just to align an ASN struct.
-static void toAsnFakeUL_AddReconfTransChInfoList(ASN::UL_AddReconfTransChInfoList *ulchlist)
+void toAsnFakeUL_AddReconfTransChInfoList(ASN::UL_AddReconfTransChInfoList *ulchlist)
 {
 	// The easiest way to do this is to manufacturer a TFS and use that:
 	UlTrChInfo ulfoo;
@@ -517,23 +562,6 @@ static ASN::DL_AddReconfTransChInfoList *toAsnDL_AddReconfTransChInfoList(RrcMas
 	return result;
 }
 
-void toAsnDL_AddReconfTransChInfoListSameAsUl(ASN::DL_AddReconfTransChInfoList *dlchlist,
-	int dltcid, // Downlink 1-based TrCh-id to configure
-	int ultcid) // Uplink 1-based TrCh-id to copy to downlink trch.
-{
-	ASN::DL_AddReconfTransChInformation *dummyDlDCH = RN_CALLOC(ASN::DL_AddReconfTransChInformation);
-	asn_long2INTEGER(&dummyDlDCH->dl_TransportChannelType, ASN::DL_TrCH_Type_dch);
-	dummyDlDCH->dl_transportChannelIdentity = dltcid;
-
-	// Since this is just a dummy structure, use the simplest type,which is sameAsUlTrCh.
-	dummyDlDCH->tfs_SignallingMode.present =
-		ASN::DL_AddReconfTransChInformation__tfs_SignallingMode_PR_sameAsULTrCH;
-	asn_long2INTEGER(
-		&dummyDlDCH->tfs_SignallingMode.choice.sameAsULTrCH.ul_TransportChannelType, ASN::UL_TrCH_Type_dch);
-	dummyDlDCH->tfs_SignallingMode.choice.sameAsULTrCH.ul_TransportChannelIdentity = ultcid;
-	ASN_SEQUENCE_ADD(&dlchlist->list, dummyDlDCH);
-}
-
 ByteVector *sendDirectTransfer(UEInfo *uep, ByteVector &dlpdu, const char *descr, bool psDomain)
 {
 	ASN::DL_DCCH_Message_t msg;
@@ -557,24 +585,6 @@ ByteVector *sendDirectTransfer(UEInfo *uep, ByteVector &dlpdu, const char *descr
 	return result;
 }
 
-static void toAsnURNTI(ASN::U_RNTI_t *urnti, unsigned srncid, unsigned srnti)
-{
-	setAsnBIT_STRING(&urnti->srnc_Identity, (uint8_t *)calloc(1, 2), 12);
-	AsnBitString2BVTemp(urnti->srnc_Identity).setField(0, srncid, 12);
-	setAsnBIT_STRING(&urnti->s_RNTI, (uint8_t *)calloc(1, 3), 20);
-	AsnBitString2BVTemp(urnti->s_RNTI).setField(0, srnti, 20);
-}
-
-static ASN::C_RNTI_t *toAsnCRNTI(unsigned crnti)
-{
-	// C_RNTI_t    *new_c_RNTI /* OPTIONAL */;
-	ASN::C_RNTI_t *result = RN_CALLOC(ASN::C_RNTI_t);
-	// new_c_RNTI is a BIT_STRING_t
-	setAsnBIT_STRING(result, (uint8_t *)calloc(1, 2), 16);
-	AsnBitString2BVTemp(result).setField(0, crnti, 16);
-	return result;
-}
-
 // NOTE: The RRC Connection Setup messages are defined as using CCCH and SRB0 which is TM
 // uplink and UM downlink.  That makes sense because uplink messages are small and the downlink
 // message is huge and may need to be segmented.
@@ -586,6 +596,8 @@ static ASN::C_RNTI_t *toAsnCRNTI(unsigned crnti)
 // Note that this message is still small: the rlc-info for TM&UM is pretty small,
 // and the TrCh info comes from SIB5/6.
 
+static AsnMessageTemplate sRrcConnectionSetupTemplate(gRrcConnectionSetupSpec);
+
 // Release 3 version of this message.  The samsung and other phones did not seem to like this,
 // so 11-16-2012 tried switching to release 4 version.
 void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
@@ -727,101 +739,14 @@ void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
 
 	} else {
 		// Version 3 of this message.
-
-		// struct RRCConnectionSetup_r3_IEs
-		csp->present = ASN::RRCConnectionSetup_PR_r3; // Guessing we can use any of the variants.
-		ASN::RRCConnectionSetup_r3_IEs_t *iep = &csp->choice.r3.rrcConnectionSetup_r3;
-
-		// InitialUE_Identity_t     initialUE_Identity;
-		// WARNING: Now there are temporarily two pointers to the memory in UE_Identity.
-		iep->initialUE_Identity = *ueInitialId;
-
-		// RRC_TransactionIdentifier_t  rrc_TransactionIdentifier;
-		iep->rrc_TransactionIdentifier = transactionId;
-
-		// ActivationTime_t    *activationTime /* OPTIONAL */;
-
-		// U_RNTI_t     new_U_RNTI;
-		// U-RNTI is mandatory.
-		// They took apart the U_RNTI into its constituent parts, which was kinda dumb:
-		// the parts are 12 bit SRNC id and 20 bit S-RNTI.
-		toAsnURNTI(&iep->new_U_RNTI, uep->getSrncId(), uep->getSRNTI());
-		// setAsnBIT_STRING(&iep->new_U_RNTI.srnc_Identity,(uint8_t*)calloc(1,2),12);
-		// AsnBitString2BVTemp(iep->new_U_RNTI.srnc_Identity).setField(0,uep->getSrncId(),12);
-		// setAsnBIT_STRING(&iep->new_U_RNTI.s_RNTI,(uint8_t*)calloc(1,3),20);
-		// AsnBitString2BVTemp(iep->new_U_RNTI.s_RNTI).setField(0,uep->getSRNTI(),20);
-
-		// srnti = 0x12345;
-		// ByteVector tst(3);
-		// tst.setField(0,srnti,20);
-		// printf("SRNTI=0x%x bv=%s\n",srnti,tst.hexstr().c_str());
-
-		// C_RNTI_t    *new_c_RNTI /* OPTIONAL */;
-		// C-RNTI
-		iep->new_c_RNTI = toAsnCRNTI(uep->mCRNTI);
-		// iep->new_c_RNTI = RN_CALLOC(ASN::C_RNTI_t);
-		// new_c_RNTI is a BIT_STRING_t
-		// setAsnBIT_STRING(iep->new_c_RNTI,(uint8_t*)calloc(1,2),16);
-		// AsnBitString2BVTemp(iep->new_c_RNTI).setField(0,uep->mCRNTI,16);
-
-		// RRC_StateIndicator_t     rrc_StateIndicator;
-		asn_long2INTEGER(&iep->rrc_StateIndicator, ASN::RRC_StateIndicator_cell_FACH);
-
-		// UTRAN_DRX_CycleLengthCoefficient_t   utran_DRX_CycleLengthCoeff;
-		// 10.3.3.49: DRC mode.  "Refers to 'k' in the formula 25.304 Discontinous Reception".
-		iep->utran_DRX_CycleLengthCoeff = 3; // Must be in range 3..9
-		// skip optional CapabilityUpdateRequirement
-
-		// struct CapabilityUpdateRequirement  *capabilityUpdateRequirement    /* OPTIONAL */;
-		iep->capabilityUpdateRequirement = RN_CALLOC(ASN::CapabilityUpdateRequirement);
-		iep->capabilityUpdateRequirement->ue_RadioCapabilityFDDUpdateRequirement = true;
-		iep->capabilityUpdateRequirement->ue_RadioCapabilityTDDUpdateRequirement = false;
-
-		// SRB_InformationSetupList2_t  srb_InformationSetupList;
-		toAsnSRB_InformationSetupList(gRrcDcchConfig, &iep->srb_InformationSetupList.list);
-
-		// struct UL_CommonTransChInfo *ul_CommonTransChInfo   /* OPTIONAL */;
-		// struct DL_CommonInformation *dl_CommonInformation   /* OPTIONAL */;
-		// UL_AddReconfTransChInfoList_t    ul_AddReconfTransChInfoList;
-		// DL_AddReconfTransChInfoList_t    dl_AddReconfTransChInfoList;
-
-		// All the TrCh info is optional, and not used in our case because we are
-		// defining RACH/FACH rather than DCH, BUT...
-		// For ul_ and dl_AddReconfTransChInfoList we are required to put in something anyway,
-		// and 8.1.3.4 recommends a single zero-sized TF.
-		// You can not use the "NOTHING" option - the ASN compiler just uses
-		// that to mark an uninitialized value and fails.
-		toAsnFakeUL_AddReconfTransChInfoList(&iep->ul_AddReconfTransChInfoList);
-		toAsnDL_AddReconfTransChInfoListSameAsUl(&iep->dl_AddReconfTransChInfoList, 31, 31);
-
-		// These IEs are all skipped, needed only for DCH:
-		// struct UL_ChannelRequirement    *ul_ChannelRequirement  /* OPTIONAL */;
-		// struct DL_InformationPerRL_List *dl_InformationPerRL_List   /* OPTIONAL */;
-		// PhCh *phch = new PhCh(DPDCHType,256,254,256,9999,NULL);
-		// iep->ul_ChannelRequirement = phch->toAsnUL_ChannelRequirement();
-		// iep->dl_CommonInformation = phch->toAsnDL_CommonInformation();
-		// iep->dl_InformationPerRL_List = phch->toAsnDL_InformationPerRL_List();
-		/*ASN::DL_InformationPerRL_List *result2 = RN_CALLOC(ASN::DL_InformationPerRL_List);
-			ASN::DL_InformationPerRL *one = RN_CALLOC(ASN::DL_InformationPerRL);
-			one->modeSpecificInfo.present = ASN::DL_InformationPerRL__modeSpecificInfo_PR_fdd;
-			int primarySC = gConfig.getNum("UMTS.Downlink.ScramblingCode");
-			one->modeSpecificInfo.choice.fdd.primaryCPICH_Info.primaryScramblingCode = primarySC;
-			//one->dl_DPCH_InfoPerRL = toAsnDL_DPCH_InfoPerRL();
-			ASN_SEQUENCE_ADD(&result2->list,one);
-			iep->dl_InformationPerRL_List = result2;*/
-
-		// struct FrequencyInfo    *frequencyInfo  /* OPTIONAL */;
-
-		// TODO: Do we need this?
-		// MaxAllowedUL_TX_Power_t *maxAllowedUL_TX_Power  /* OPTIONAL */;
-
-		if (!encodeCcchMsg(&msg, result, descrRrcConnectionSetup, uep, 0)) {
+		uint32_t fields[3];
+		fields[0] = transactionId;
+		fields[1] = uep->getSrncId() << 20 | uep->getSRNTI();
+		fields[2] = uep->mCRNTI;
+		if (!encodeCcchTemplate(sRrcConnectionSetupTemplate, fields, ueInitialId, result, descrRrcConnectionSetup,
+			    uep, 0)) {
 			return;
 		}
-
-		// Zero out the initialUE_Identity that we copied above so that there
-		// is only one copy of it and we dont try to free it twice.
-		memset(&iep->initialUE_Identity, 0, sizeof(ASN::InitialUE_Identity_t));
 	}
 
 	LOG(INFO) << "gNodeB: " << gNodeB->clock().get() << ", SCCPCH: " << result;
@@ -839,28 +764,67 @@ void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
 	gMacSwitch.writeHighSideCcch(result, descrRrcConnectionSetup);
 }
 
+static AsnMessageTemplate sRrcConnectionReleaseCcchTemplate(gRrcConnectionReleaseCcchSpec);
+
 // Sent when an unrecognized UE tries to talk to us.
 // Tell it to release the connection and start over.
 static void sendRrcConnectionReleaseCcch(int32_t urnti)
 {
-	ASN::DL_CCCH_Message_t msg;
+	uint32_t fields[1];
+	fields[0] = urnti;
+	ByteVector result(1000);
+	if (!encodeCcchTemplate(sRrcConnectionReleaseCcchTemplate, fields, NULL, result, descrRrcConnectionRelease,
+		    NULL, urnti)) {
+		return;
+	}
+	gMacSwitch.writeHighSideCcch(result, descrRrcConnectionRelease);
+}
+
+bool encodePagingType1(const RRC::PagingBatch &batch, ByteVector &result)
+{
+	ASN::PCCH_Message_t msg;
 	memset(&msg, 0, sizeof(msg));
-	msg.message.present = ASN::DL_CCCH_MessageType_PR_rrcConnectionRelease;
-	ASN::RRCConnectionRelease_CCCH *m1 = &msg.message.choice.rrcConnectionRelease;
-	m1->present = ASN::RRCConnectionRelease_CCCH_PR_r3;
-	ASN::RRCConnectionRelease_CCCH_r3_IEs *m2 = &m1->choice.r3.rrcConnectionRelease_CCCH_r3;
-	unsigned srncid = urnti >> 20 & 0xfff;
-	unsigned srnti = urnti & 0xfffff;
-	toAsnURNTI(&m2->u_RNTI, srncid, srnti);
-	ASN::RRCConnectionRelease_r3_IEs_t *m3 = &m2->rrcConnectionRelease;
-	m3->rrc_TransactionIdentifier = 0; // bogus, because we are not expecting a reply.
-	m3->releaseCause = toAsnEnumerated(ASN::ReleaseCause_unspecified); // TODO: What cause should we use?
+	msg.message.present = ASN::PCCH_MessageType_PR_pagingType1;
+	ASN::PagingRecordList *list = RN_CALLOC(ASN::PagingRecordList);
+	msg.message.choice.pagingType1.pagingRecordList = list;
+	for (RRC::PagingBatch::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+		ASN::PagingRecord *record = RN_CALLOC(ASN::PagingRecord);
+		record->present = ASN::PagingRecord_PR_cn_Identity;
+		struct ASN::PagingRecord::PagingRecord_u::PagingRecord__cn_Identity *cn = &record->choice.cn_Identity;
+		// SMS and the like need only a DCCH; anything else is a call.
+		cn->pagingCause = toAsnEnumerated(it->type() == DCCHType ? ASN::PagingCause_terminatingLowPrioritySignalling
+									: ASN::PagingCause_terminatingConversationalCall);
+		cn->cn_DomainIdentity = toAsnEnumerated(ASN::CN_DomainIdentity_cs_domain);
+		if (it->ID().type() == GSM::TMSIType) {
+			cn->cn_pagedUE_Identity.present = ASN::CN_PagedUE_Identity_PR_tmsi_GSM_MAP;
+			cn->cn_pagedUE_Identity.choice.tmsi_GSM_MAP = allocAsnBIT_STRING(32);
+			uint32_t tmsi = it->ID().TMSI();
+			for (unsigned i = 0; i < 4; i++) {
+				cn->cn_pagedUE_Identity.choice.tmsi_GSM_MAP.buf[i] = tmsi >> (24 - 8 * i);
+			}
+		} else {
+			cn->cn_pagedUE_Identity.present = ASN::CN_PagedUE_Identity_PR_imsi_GSM_MAP;
+			setASN1SeqOfDigits(&cn->cn_pagedUE_Identity.choice.imsi_GSM_MAP, it->ID().digits());
+		}
+		ASN::ASN_SEQUENCE_ADD(&list->list, record);
+	}
+	bool stat = uperEncodeToBV(&ASN::asn_DEF_PCCH_Message, &msg, result, descrPagingType1);
+	if (stat) {
+		string comment = format("PCCH %s message size=%zu", descrPagingType1.c_str(), result.size());
+		asnLogMsg(0, &ASN::asn_DEF_PCCH_Message, &msg, comment.c_str());
+	}
+	ASN::asn_DEF_PCCH_Message.free_struct(&ASN::asn_DEF_PCCH_Message, &msg, 1);
+	return stat;
+}
 
+void sendPagingType1(const RRC::PagingBatch &batch)
+{
 	ByteVector result(1000);
-	if (!encodeCcchMsg(&msg, result, descrRrcConnectionRelease, NULL, urnti)) {
+	if (!encodePagingType1(batch, result)) {
 		return;
 	}
-	gMacSwitch.writeHighSideCcch(result, descrRrcConnectionRelease);
+	// TODO: There is no PCH or PICH yet (see UMTSConfig::init), so the message stops here.
+	LOG(DEBUG) << "gNodeB: " << gNodeB->clock().get() << ", PCH: " << result;
 }
 
 // This puts the phone in idle mode.
@@ -1268,26 +1232,6 @@ void sendRadioBearerRelease(UEInfo *uep,
 	uep->ueWriteHighSide(SRB2, result, descrRadioBearerRelease);
 }
 
-static unsigned commonCellUpdateConfirm(UEInfo *uep, ASN::CellUpdateConfirm_r3_IEs_t *ies)
-{
-
-	// Apparently even CCCH messages get a transaction id, which will be used if the UE
-	// replies to indicate an error in this message.
-	unsigned transactionId = uep->newTransactionId();
-	ies->rrc_TransactionIdentifier = transactionId;
-
-	// Huge message but almost everything is optional.  Here are the mandatory parts:
-	ies->rrc_StateIndicator = toAsnEnumerated(UEState2Asn(uep->ueGetState()));
-	ies->rlc_Re_establishIndicatorRb2_3or4 = 0;
-	ies->rlc_Re_establishIndicatorRb5orAbove = 0;
-	ies->modeSpecificTransChInfo.present = ASN::CellUpdateConfirm_r3_IEs__modeSpecificTransChInfo_PR_fdd;
-	ies->modeSpecificPhysChInfo.present = ASN::CellUpdateConfirm_r3_IEs__modeSpecificPhysChInfo_PR_fdd;
-
-	// We can define a new URNTI.
-	// TODO: Do we need to assign a new URNTI if this message is on CCCH?
-	return transactionId;
-}
-
 // The CellUpdateConfirm message may be sent out on either DCCH or CCCH.
 // This version is for DCCH.
 // TODO: It would be wise to implement the RLC re-establish indicators.
@@ -1299,7 +1243,8 @@ static void sendCellUpdateConfirmDcch(UEInfo *uep)
 	msg.message.present = ASN::DL_DCCH_MessageType_PR_cellUpdateConfirm;
 	msg.message.choice.cellUpdateConfirm.present = ASN::CellUpdateConfirm_PR_r3;
 	ASN::CellUpdateConfirm_r3_IEs_t *ies = &msg.message.choice.cellUpdateConfirm.choice.r3.cellUpdateConfirm_r3;
-	unsigned transactionId = commonCellUpdateConfirm(uep, ies);
+	unsigned transactionId = uep->newTransactionId();
+	commonCellUpdateConfirm(ies, transactionId, UEState2Asn(uep->ueGetState()));
 
 	ByteVector result(1000);
 	if (!encodeDcchMsg(uep, SRB2, &msg, result, descrCellUpdateConfirm)) {
@@ -1309,22 +1254,18 @@ static void sendCellUpdateConfirmDcch(UEInfo *uep)
 	uep->ueWriteHighSide(SRB2, result, descrCellUpdateConfirm);
 }
 
+static AsnMessageTemplate sCellUpdateConfirmCcchTemplate(gCellUpdateConfirmCcchSpec);
+
 static void sendCellUpdateConfirmCcch(UEInfo *uep)
 {
-	ASN::DL_CCCH_Message_t msg;
-	memset(&msg, 0, sizeof(msg));
-	msg.message.present = ASN::DL_CCCH_MessageType_PR_cellUpdateConfirm;
-	msg.message.choice.cellUpdateConfirm.present = ASN::CellUpdateConfirm_CCCH_PR_r3;
-
-	// U_RNTI_t     u_RNTI;
-	toAsnURNTI(&msg.message.choice.cellUpdateConfirm.choice.r3.u_RNTI, uep->getSrncId(), uep->getSRNTI());
-
-	// CellUpdateConfirm_r3_IEs_t   cellUpdateConfirm_r3;
-	ASN::CellUpdateConfirm_r3_IEs_t *ies = &msg.message.choice.cellUpdateConfirm.choice.r3.cellUpdateConfirm_r3;
-	unsigned transactionId = commonCellUpdateConfirm(uep, ies);
+	unsigned transactionId = uep->newTransactionId();
+	uint32_t fields[3];
+	fields[0] = uep->getSrncId() << 20 | uep->getSRNTI();
+	fields[1] = transactionId;
+	fields[2] = UEState2Asn(uep->ueGetState());
 
 	ByteVector result(1000);
-	if (!encodeCcchMsg(&msg, result, descrCellUpdateConfirm, uep, 0)) {
+	if (!encodeCcchTemplate(sCellUpdateConfirmCcchTemplate, fields, NULL, result, descrCellUpdateConfirm, uep, 0)) {
 		return;
 	}
 	UeTransaction(uep, UeTransaction::ttCellUpdateConfirm, 0, transactionId);
@@ -1344,6 +1285,33 @@ void sendCellUpdateConfirm(UEInfo *uep)
 	}
 }
 
+// Called with sRrcTemplateLock held.  A template that fails to learn falls back to the full encode,
+// so this can only cost time, not correctness.  A template whose message is unchanged is kept.
+static void learnRrcTemplates()
+{
+	// Two identities whose encodings have different lengths, so the template can find the splice.
+	ASN::InitialUE_Identity_t longId, shortId;
+	memset(&longId, 0, sizeof(longId));
+	memset(&shortId, 0, sizeof(shortId));
+	longId.present = shortId.present = ASN::InitialUE_Identity_PR_imsi;
+	setASN1SeqOfDigits(&longId.choice.imsi.list, "001010123456789");
+	setASN1SeqOfDigits(&shortId.choice.imsi.list, "001010");
+
+	if (!sRrcConnectionSetupTemplate.learn(&longId, &shortId)) {
+		LOG(WARNING) << "RRC Connection Setup template unusable, using full asn encode";
+	}
+	if (!sCellUpdateConfirmCcchTemplate.learn()) {
+		LOG(WARNING) << "Cell Update Confirm template unusable, using full asn encode";
+	}
+	if (!sRrcConnectionReleaseCcchTemplate.learn()) {
+		LOG(WARNING) << "RRC Connection Release template unusable, using full asn encode";
+	}
+	LOG(INFO) << "learned RRC templates" << LOGVAR2("setupBits", sRrcConnectionSetupTemplate.sizeBits());
+
+	ASN::asn_DEF_InitialUE_Identity.free_struct(&ASN::asn_DEF_InitialUE_Identity, &longId, 1);
+	ASN::asn_DEF_InitialUE_Identity.free_struct(&ASN::asn_DEF_InitialUE_Identity, &shortId, 1);
+}
+
 // 33.102 5.1.2 Specifies two types of Security procedure: section 6.3 describes the main
 // authentication method using Ki; section 6.5 describes a local authentication mechanism
 // using an integrity key.  You must do one of the two procedures at each connection setup,
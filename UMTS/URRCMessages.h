@@ -16,6 +16,7 @@
 #define URRCMESSAGES_H 1
 
 #include <CommonLibs/ByteVector.h>
+#include <Control/PagingTable.h>
 
 #include "URRCDefs.h"
 
@@ -46,6 +47,10 @@ void sendRrcConnectionRelease(UEInfo *uep);
 void sendCellUpdateConfirm(UEInfo *uep);
 void sendSecurityModeCommand(UEInfo *uep);
 
+// PagingType1 for UEs in idle mode, one record for each entry of the batch, 25.331 10.2.20.
+bool encodePagingType1(const RRC::PagingBatch &batch, ByteVector &result);
+void sendPagingType1(const RRC::PagingBatch &batch);
+
 // The UE initially sends its identity in the RRC Connection Request Message.
 // We dont really care what it is, we just need to copy the exact
 // same UE id info into the RRC Connection Setup Message, which also assigns a U-RNTI.
@@ -0,0 +1,228 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// The CCCH messages that URRCMessages.cpp sends through AsnMessageTemplates.
+// They are kept here, away from the UE and RRC state, so that AsnTemplateTest can check the templates
+// against the same builders the BTS uses.
+
+#include "AsnHelper.h"
+#include "URRCTemplates.h"
+
+namespace ASN {
+#include "DL-CCCH-Message.h"
+#include "asn_SEQUENCE_OF.h"
+};
+
+namespace UMTS {
+
+void toAsnURNTI(ASN::U_RNTI_t *urnti, unsigned srncid, unsigned srnti)
+{
+	setAsnBIT_STRING(&urnti->srnc_Identity, (uint8_t *)calloc(1, 2), 12);
+	AsnBitString2BVTemp(urnti->srnc_Identity).setField(0, srncid, 12);
+	setAsnBIT_STRING(&urnti->s_RNTI, (uint8_t *)calloc(1, 3), 20);
+	AsnBitString2BVTemp(urnti->s_RNTI).setField(0, srnti, 20);
+}
+
+ASN::C_RNTI_t *toAsnCRNTI(unsigned crnti)
+{
+	// C_RNTI_t    *new_c_RNTI /* OPTIONAL */;
+	ASN::C_RNTI_t *result = RN_CALLOC(ASN::C_RNTI_t);
+	// new_c_RNTI is a BIT_STRING_t
+	setAsnBIT_STRING(result, (uint8_t *)calloc(1, 2), 16);
+	AsnBitString2BVTemp(result).setField(0, crnti, 16);
+	return result;
+}
+
+void toAsnDL_AddReconfTransChInfoListSameAsUl(ASN::DL_AddReconfTransChInfoList *dlchlist,
+	int dltcid, // Downlink 1-based TrCh-id to configure
+	int ultcid) // Uplink 1-based TrCh-id to copy to downlink trch.
+{
+	ASN::DL_AddReconfTransChInformation *dummyDlDCH = RN_CALLOC(ASN::DL_AddReconfTransChInformation);
+	asn_long2INTEGER(&dummyDlDCH->dl_TransportChannelType, ASN::DL_TrCH_Type_dch);
+	dummyDlDCH->dl_transportChannelIdentity = dltcid;
+
+	// Since this is just a dummy structure, use the simplest type,which is sameAsUlTrCh.
+	dummyDlDCH->tfs_SignallingMode.present =
+		ASN::DL_AddReconfTransChInformation__tfs_SignallingMode_PR_sameAsULTrCH;
+	asn_long2INTEGER(
+		&dummyDlDCH->tfs_SignallingMode.choice.sameAsULTrCH.ul_TransportChannelType, ASN::UL_TrCH_Type_dch);
+	dummyDlDCH->tfs_SignallingMode.choice.sameAsULTrCH.ul_TransportChannelIdentity = ultcid;
+	ASN_SEQUENCE_ADD(&dlchlist->list, dummyDlDCH);
+}
+
+// Release 3 version of the RRC Connection Setup message.
+// Template fields are: transaction id, U-RNTI, C-RNTI; the InitialUE-Identity is spliced in.
+static void buildRrcConnectionSetupR3(void *arg, const uint32_t *fields, void *ueInitialId)
+{
+	ASN::DL_CCCH_Message *msg = (ASN::DL_CCCH_Message *)arg;
+	msg->message.present = ASN::DL_CCCH_MessageType_PR_rrcConnectionSetup;
+
+	// struct RRCConnectionSetup_r3_IEs
+	ASN::RRCConnectionSetup *csp = &msg->message.choice.rrcConnectionSetup;
+	csp->present = ASN::RRCConnectionSetup_PR_r3; // Guessing we can use any of the variants.
+	ASN::RRCConnectionSetup_r3_IEs_t *iep = &csp->choice.r3.rrcConnectionSetup_r3;
+
+	// InitialUE_Identity_t     initialUE_Identity;
+	// WARNING: Now there are temporarily two pointers to the memory in UE_Identity.
+	iep->initialUE_Identity = *(ASN::InitialUE_Identity *)ueInitialId;
+
+	// RRC_TransactionIdentifier_t  rrc_TransactionIdentifier;
+	iep->rrc_TransactionIdentifier = fields[0];
+
+	// ActivationTime_t    *activationTime /* OPTIONAL */;
+
+	// U_RNTI_t     new_U_RNTI;
+	// U-RNTI is mandatory.
+	// They took apart the U_RNTI into its constituent parts, which was kinda dumb:
+	// the parts are 12 bit SRNC id and 20 bit S-RNTI.
+	toAsnURNTI(&iep->new_U_RNTI, fields[1] >> 20, fields[1] & 0xfffff);
+	// setAsnBIT_STRING(&iep->new_U_RNTI.srnc_Identity,(uint8_t*)calloc(1,2),12);
+	// AsnBitString2BVTemp(iep->new_U_RNTI.srnc_Identity).setField(0,uep->getSrncId(),12);
+	// setAsnBIT_STRING(&iep->new_U_RNTI.s_RNTI,(uint8_t*)calloc(1,3),20);
+	// AsnBitString2BVTemp(iep->new_U_RNTI.s_RNTI).setField(0,uep->getSRNTI(),20);
+
+	// srnti = 0x12345;
+	// ByteVector tst(3);
+	// tst.setField(0,srnti,20);
+	// printf("SRNTI=0x%x bv=%s\n",srnti,tst.hexstr().c_str());
+
+	// C_RNTI_t    *new_c_RNTI /* OPTIONAL */;
+	// C-RNTI
+	iep->new_c_RNTI = toAsnCRNTI(fields[2]);
+	// iep->new_c_RNTI = RN_CALLOC(ASN::C_RNTI_t);
+	// new_c_RNTI is a BIT_STRING_t
+	// setAsnBIT_STRING(iep->new_c_RNTI,(uint8_t*)calloc(1,2),16);
+	// AsnBitString2BVTemp(iep->new_c_RNTI).setField(0,uep->mCRNTI,16);
+
+	// RRC_StateIndicator_t     rrc_StateIndicator;
+	asn_long2INTEGER(&iep->rrc_StateIndicator, ASN::RRC_StateIndicator_cell_FACH);
+
+	// UTRAN_DRX_CycleLengthCoefficient_t   utran_DRX_CycleLengthCoeff;
+	// 10.3.3.49: DRC mode.  "Refers to 'k' in the formula 25.304 Discontinous Reception".
+	iep->utran_DRX_CycleLengthCoeff = 3; // Must be in range 3..9
+	// skip optional CapabilityUpdateRequirement
+
+	// struct CapabilityUpdateRequirement  *capabilityUpdateRequirement    /* OPTIONAL */;
+	iep->capabilityUpdateRequirement = RN_CALLOC(ASN::CapabilityUpdateRequirement);
+	iep->capabilityUpdateRequirement->ue_RadioCapabilityFDDUpdateRequirement = true;
+	iep->capabilityUpdateRequirement->ue_RadioCapabilityTDDUpdateRequirement = false;
+
+	// SRB_InformationSetupList2_t  srb_InformationSetupList;
+	toAsnSRB_InformationSetupList(gRrcDcchConfig, &iep->srb_InformationSetupList.list);
+
+	// struct UL_CommonTransChInfo *ul_CommonTransChInfo   /* OPTIONAL */;
+	// struct DL_CommonInformation *dl_CommonInformation   /* OPTIONAL */;
+	// UL_AddReconfTransChInfoList_t    ul_AddReconfTransChInfoList;
+	// DL_AddReconfTransChInfoList_t    dl_AddReconfTransChInfoList;
+
+	// All the TrCh info is optional, and not used in our case because we are
+	// defining RACH/FACH rather than DCH, BUT...
+	// For ul_ and dl_AddReconfTransChInfoList we are required to put in something anyway,
+	// and 8.1.3.4 recommends a single zero-sized TF.
+	// You can not use the "NOTHING" option - the ASN compiler just uses
+	// that to mark an uninitialized value and fails.
+	toAsnFakeUL_AddReconfTransChInfoList(&iep->ul_AddReconfTransChInfoList);
+	toAsnDL_AddReconfTransChInfoListSameAsUl(&iep->dl_AddReconfTransChInfoList, 31, 31);
+
+	// These IEs are all skipped, needed only for DCH:
+	// struct UL_ChannelRequirement    *ul_ChannelRequirement  /* OPTIONAL */;
+	// struct DL_InformationPerRL_List *dl_InformationPerRL_List   /* OPTIONAL */;
+	// PhCh *phch = new PhCh(DPDCHType,256,254,256,9999,NULL);
+	// iep->ul_ChannelRequirement = phch->toAsnUL_ChannelRequirement();
+	// iep->dl_CommonInformation = phch->toAsnDL_CommonInformation();
+	// iep->dl_InformationPerRL_List = phch->toAsnDL_InformationPerRL_List();
+	/*ASN::DL_InformationPerRL_List *result2 = RN_CALLOC(ASN::DL_InformationPerRL_List);
+		ASN::DL_InformationPerRL *one = RN_CALLOC(ASN::DL_InformationPerRL);
+		one->modeSpecificInfo.present = ASN::DL_InformationPerRL__modeSpecificInfo_PR_fdd;
+		int primarySC = gConfig.getNum("UMTS.Downlink.ScramblingCode");
+		one->modeSpecificInfo.choice.fdd.primaryCPICH_Info.primaryScramblingCode = primarySC;
+		//one->dl_DPCH_InfoPerRL = toAsnDL_DPCH_InfoPerRL();
+		ASN_SEQUENCE_ADD(&result2->list,one);
+		iep->dl_InformationPerRL_List = result2;*/
+
+	// struct FrequencyInfo    *frequencyInfo  /* OPTIONAL */;
+
+	// TODO: Do we need this?
+	// MaxAllowedUL_TX_Power_t *maxAllowedUL_TX_Power  /* OPTIONAL */;
+}
+
+// Zero out the initialUE_Identity that we copied in so that there
+// is only one copy of it and we dont try to free it twice.
+static void unspliceRrcConnectionSetupR3(void *arg)
+{
+	ASN::DL_CCCH_Message *msg = (ASN::DL_CCCH_Message *)arg;
+	memset(&msg->message.choice.rrcConnectionSetup.choice.r3.rrcConnectionSetup_r3.initialUE_Identity, 0,
+		sizeof(ASN::InitialUE_Identity_t));
+}
+
+// The InitialUE_Identity is zeroed out of the message before it is freed, so only the caller frees it.
+const AsnTemplateSpec gRrcConnectionSetupSpec = {&ASN::asn_DEF_DL_CCCH_Message, sizeof(ASN::DL_CCCH_Message),
+	true, &ASN::asn_DEF_InitialUE_Identity, 3, {2, 32, 16}, buildRrcConnectionSetupR3,
+	unspliceRrcConnectionSetupR3};
+
+// Template field is the U-RNTI.
+static void buildRrcConnectionReleaseCcch(void *arg, const uint32_t *fields, void *)
+{
+	ASN::DL_CCCH_Message_t *msg = (ASN::DL_CCCH_Message_t *)arg;
+	msg->message.present = ASN::DL_CCCH_MessageType_PR_rrcConnectionRelease;
+	ASN::RRCConnectionRelease_CCCH *m1 = &msg->message.choice.rrcConnectionRelease;
+	m1->present = ASN::RRCConnectionRelease_CCCH_PR_r3;
+	ASN::RRCConnectionRelease_CCCH_r3_IEs *m2 = &m1->choice.r3.rrcConnectionRelease_CCCH_r3;
+	unsigned srncid = fields[0] >> 20 & 0xfff;
+	unsigned srnti = fields[0] & 0xfffff;
+	toAsnURNTI(&m2->u_RNTI, srncid, srnti);
+	ASN::RRCConnectionRelease_r3_IEs_t *m3 = &m2->rrcConnectionRelease;
+	m3->rrc_TransactionIdentifier = 0; // bogus, because we are not expecting a reply.
+	m3->releaseCause = toAsnEnumerated(ASN::ReleaseCause_unspecified); // TODO: What cause should we use?
+}
+
+const AsnTemplateSpec gRrcConnectionReleaseCcchSpec = {&ASN::asn_DEF_DL_CCCH_Message,
+	sizeof(ASN::DL_CCCH_Message_t), true, NULL, 1, {32}, buildRrcConnectionReleaseCcch, NULL};
+
+void commonCellUpdateConfirm(ASN::CellUpdateConfirm_r3_IEs *ies, unsigned transactionId, unsigned stateIndicator)
+{
+	// Apparently even CCCH messages get a transaction id, which will be used if the UE
+	// replies to indicate an error in this message.
+	ies->rrc_TransactionIdentifier = transactionId;
+
+	// Huge message but almost everything is optional.  Here are the mandatory parts:
+	ies->rrc_StateIndicator = toAsnEnumerated(stateIndicator);
+	ies->rlc_Re_establishIndicatorRb2_3or4 = 0;
+	ies->rlc_Re_establishIndicatorRb5orAbove = 0;
+	ies->modeSpecificTransChInfo.present = ASN::CellUpdateConfirm_r3_IEs__modeSpecificTransChInfo_PR_fdd;
+	ies->modeSpecificPhysChInfo.present = ASN::CellUpdateConfirm_r3_IEs__modeSpecificPhysChInfo_PR_fdd;
+
+	// We can define a new URNTI.
+	// TODO: Do we need to assign a new URNTI if this message is on CCCH?
+}
+
+// Template fields are: U-RNTI, transaction id, RRC state indicator.
+static void buildCellUpdateConfirmCcch(void *arg, const uint32_t *fields, void *)
+{
+	ASN::DL_CCCH_Message_t *msg = (ASN::DL_CCCH_Message_t *)arg;
+	msg->message.present = ASN::DL_CCCH_MessageType_PR_cellUpdateConfirm;
+	msg->message.choice.cellUpdateConfirm.present = ASN::CellUpdateConfirm_CCCH_PR_r3;
+
+	// U_RNTI_t     u_RNTI;
+	toAsnURNTI(&msg->message.choice.cellUpdateConfirm.choice.r3.u_RNTI, fields[0] >> 20, fields[0] & 0xfffff);
+
+	// CellUpdateConfirm_r3_IEs_t   cellUpdateConfirm_r3;
+	ASN::CellUpdateConfirm_r3_IEs_t *ies = &msg->message.choice.cellUpdateConfirm.choice.r3.cellUpdateConfirm_r3;
+	commonCellUpdateConfirm(ies, fields[1], fields[2]);
+}
+
+const AsnTemplateSpec gCellUpdateConfirmCcchSpec = {&ASN::asn_DEF_DL_CCCH_Message,
+	sizeof(ASN::DL_CCCH_Message_t), true, NULL, 3, {32, 2, 2}, buildCellUpdateConfirmCcch, NULL};
+
+}; // namespace UMTS
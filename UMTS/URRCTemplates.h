@@ -0,0 +1,55 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef URRCTEMPLATES_H
+#define URRCTEMPLATES_H
+
+#include "AsnTemplate.h"
+
+namespace ASN {
+#include "C-RNTI.h"
+#include "DL-AddReconfTransChInfoList.h"
+#include "U-RNTI.h"
+#include "UL-AddReconfTransChInfoList.h"
+struct CellUpdateConfirm_r3_IEs;
+};
+
+namespace UMTS {
+
+class RrcMasterChConfig;
+extern RrcMasterChConfig *gRrcDcchConfig;
+
+// In URRCMessages.cpp; these need the RRC channel configuration.  The SRB list of RRCConnectionSetup
+// comes from gRrcDcchConfig.
+void toAsnSRB_InformationSetupList(RrcMasterChConfig *masterConfig, void *srblist);
+void toAsnFakeUL_AddReconfTransChInfoList(ASN::UL_AddReconfTransChInfoList *ulchlist);
+
+void toAsnDL_AddReconfTransChInfoListSameAsUl(ASN::DL_AddReconfTransChInfoList *dlchlist, int dltcid, int ultcid);
+
+void toAsnURNTI(ASN::U_RNTI_t *urnti, unsigned srncid, unsigned srnti);
+ASN::C_RNTI_t *toAsnCRNTI(unsigned crnti);
+
+// The mandatory IEs of CellUpdateConfirm, on DCCH or CCCH; stateIndicator is an ASN::RRC_StateIndicator.
+void commonCellUpdateConfirm(ASN::CellUpdateConfirm_r3_IEs *ies, unsigned transactionId, unsigned stateIndicator);
+
+// Fields: transaction id, U-RNTI, C-RNTI.  The InitialUE-Identity is spliced in.
+extern const AsnTemplateSpec gRrcConnectionSetupSpec;
+// Field: U-RNTI.
+extern const AsnTemplateSpec gRrcConnectionReleaseCcchSpec;
+// Fields: U-RNTI, transaction id, RRC state indicator.
+extern const AsnTemplateSpec gCellUpdateConfirmCcchSpec;
+
+}; // namespace UMTS
+
+#endif
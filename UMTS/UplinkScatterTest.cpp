@@ -0,0 +1,246 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the single pass uplink scatter, in float and in fixed point, against the step by step receive path it
+// replaces, and time them per radio frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <CommonLibs/BitVector.h>
+#include <CommonLibs/Configuration.h>
+
+#include "RateMatch.h"
+#include "UMTSL1Const.h"
+#include "UMTSL1Scatter.h"
+
+using namespace UMTS;
+
+ConfigurationTable *gConfigObject;
+
+static const unsigned sMaxTrCh = 2;
+
+struct TrChConfig {
+	unsigned nbits;   // Soft bits per radio frame before rate matching.
+	unsigned outsize; // After rate matching.
+	TTICodes tti;
+};
+
+struct FrameConfig {
+	const char *name;
+	unsigned frameSize;
+	unsigned numTrCh;
+	TrChConfig trch[sMaxTrCh];
+};
+
+// Frame sizes are 15 slots at uplink SF 64, 32, 16, 8 and 4.
+static const FrameConfig sConfigs[] = {
+	{"SF64 2 TrCh 20ms/40ms", 600, 2, {{300, 270, TTI20ms}, {300, 336, TTI40ms}}},
+	{"SF32 1 TrCh 80ms", 1200, 1, {{1200, 1000, TTI80ms}}},
+	{"SF16 1 TrCh 20ms", 2400, 1, {{2400, 2250, TTI20ms}}},
+	{"SF8 1 TrCh 10ms", 4800, 1, {{4800, 4800, TTI10ms}}},
+	{"SF4 1 TrCh 10ms", 9600, 1, {{9600, 10200, TTI10ms}}},
+};
+
+static unsigned sFailures = 0;
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The receive path as it was, one step and one buffer at a time, from 15 slots to the decoder input.
+class Reference {
+	const FrameConfig &mConfig;
+	SoftVector mAccumulator, mHDI;
+	SoftVector mRM[sMaxTrCh], mTti[sMaxTrCh];
+	int mEini[sMaxTrCh][8];
+
+public:
+	SoftVector mOut[sMaxTrCh];
+
+	Reference(const FrameConfig &wConfig) : mConfig(wConfig), mAccumulator(wConfig.frameSize), mHDI(wConfig.frameSize)
+	{
+		for (unsigned t = 0; t < mConfig.numTrCh; t++) {
+			const TrChConfig &tc = mConfig.trch[t];
+			mRM[t].resize(tc.outsize);
+			mTti[t].resize(tc.outsize * TTICode2NumFrames(tc.tti));
+			mOut[t].resize(mTti[t].size());
+			rateMatchComputeUlEini(tc.outsize, tc.nbits, tc.tti, mEini[t]);
+		}
+	}
+
+	const int *eini(unsigned t) const { return mEini[t]; }
+
+	// Return a mask of the TrChs whose TTI completed.
+	unsigned frame(const SoftVector &burst, unsigned frameIndex)
+	{
+		unsigned slotSize = mConfig.frameSize / 15;
+		for (unsigned j = 0; j < 15; j++) {
+			SoftVector slot(burst.segment(j * slotSize, slotSize));
+			slot.copyToSegment(mAccumulator, j * slotSize);
+		}
+		mAccumulator.deInterleavingNP(30, TrCHConsts::inter2Perm, mHDI);
+		unsigned loc = 0, done = 0;
+		for (unsigned t = 0; t < mConfig.numTrCh; t++) {
+			const TrChConfig &tc = mConfig.trch[t];
+			unsigned numFrames = TTICode2NumFrames(tc.tti);
+			unsigned ttiIndex = frameIndex % numFrames;
+			SoftVector tmp(mHDI.segment(loc, tc.nbits));
+			loc += tc.nbits;
+			rateMatchFunc<float>(tmp, mRM[t], mEini[t][ttiIndex]);
+			mRM[t].copyToSegment(mTti[t], ttiIndex * tc.outsize);
+			if (ttiIndex == numFrames - 1) {
+				SoftVector d(mTti[t].size());
+				mTti[t].deInterleavingNP(TrCHConsts::inter1Columns[tc.tti], TrCHConsts::inter1Perm[tc.tti], d);
+				d.copyTo(mOut[t]);
+				done |= 1 << t;
+			}
+		}
+		return done;
+	}
+};
+
+// The new path, as L1CCTrChUplink drives it.
+class Scatter {
+	const FrameConfig &mConfig;
+	L1UplinkScatter mScatter[sMaxTrCh];
+
+public:
+	SoftVector mOut[sMaxTrCh];
+	SoftVector8 mOut8[sMaxTrCh];
+	SoftQuantizer mQuantizer;
+
+	Scatter(const FrameConfig &wConfig, const Reference &ref) : mConfig(wConfig)
+	{
+		unsigned loc = 0;
+		for (unsigned t = 0; t < mConfig.numTrCh; t++) {
+			const TrChConfig &tc = mConfig.trch[t];
+			if (!mScatter[t].build(mConfig.frameSize, loc, tc.nbits, tc.outsize, ref.eini(t),
+				    TTICode2NumFrames(tc.tti), TrCHConsts::inter1Columns[tc.tti],
+				    TrCHConsts::inter1Perm[tc.tti])) {
+				printf("build failed\n");
+				sFailures++;
+			}
+			mOut[t].resize(mScatter[t].ttiSize());
+			mOut8[t].resize(mScatter[t].ttiSize());
+			loc += tc.nbits;
+		}
+	}
+
+	unsigned frame(const SoftVector &burst, unsigned frameIndex, bool fixedPoint)
+	{
+		unsigned done = 0;
+		for (unsigned t = 0; t < mConfig.numTrCh; t++) {
+			unsigned numFrames = TTICode2NumFrames(mConfig.trch[t].tti);
+			unsigned ttiIndex = frameIndex % numFrames;
+			if (fixedPoint) {
+				mScatter[t].scatter(burst.begin(), ttiIndex, mOut8[t].begin(), mQuantizer);
+			} else {
+				mScatter[t].scatter(burst.begin(), ttiIndex, mOut[t].begin());
+			}
+			if (ttiIndex == numFrames - 1) {
+				done |= 1 << t;
+			}
+		}
+		return done;
+	}
+};
+
+static void fill(SoftVector &v, unsigned *seed)
+{
+	for (unsigned i = 0; i < v.size(); i++) {
+		v[i] = (float)rand_r(seed) / RAND_MAX;
+	}
+}
+
+static void run(const FrameConfig &config)
+{
+	Reference ref(config);
+	Scatter scatter(config, ref);
+	SoftVector burst(config.frameSize);
+	unsigned seed = config.frameSize;
+	bool ok = true;
+
+	// Every bit of every TTI over two 80ms TTIs.
+	for (unsigned fn = 0; fn < 16; fn++) {
+		fill(burst, &seed);
+		unsigned doneRef = ref.frame(burst, fn);
+		unsigned done = scatter.frame(burst, fn, false);
+		ok &= done == doneRef && scatter.frame(burst, fn, true) == doneRef;
+		for (unsigned t = 0; t < config.numTrCh; t++) {
+			if (done & (1 << t)) {
+				ok &= scatter.mOut[t].size() == ref.mOut[t].size();
+				for (unsigned i = 0; ok && i < ref.mOut[t].size(); i++) {
+					ok &= scatter.mOut[t][i] == ref.mOut[t][i];
+					ok &= scatter.mOut8[t][i] == scatter.mQuantizer.quantize<int8_t>(ref.mOut[t][i]);
+				}
+			}
+		}
+	}
+
+	const unsigned frames = 20000;
+	uint64_t ns = nanoseconds(), cy = cycles();
+	for (unsigned fn = 0; fn < frames; fn++) {
+		ref.frame(burst, fn);
+	}
+	double refNs = (double)(nanoseconds() - ns) / frames, refCycles = (double)(cycles() - cy) / frames;
+
+	ns = nanoseconds();
+	cy = cycles();
+	for (unsigned fn = 0; fn < frames; fn++) {
+		scatter.frame(burst, fn, false);
+	}
+	double newNs = (double)(nanoseconds() - ns) / frames, newCycles = (double)(cycles() - cy) / frames;
+
+	cy = cycles();
+	for (unsigned fn = 0; fn < frames; fn++) {
+		scatter.frame(burst, fn, true);
+	}
+	double fixedCycles = (double)(cycles() - cy) / frames;
+
+	printf("%-24s %s  step by step %7.0f ns %8.0f cycles  scatter %7.0f ns %8.0f cycles  x%.1f  int8 %8.0f cycles\n",
+		config.name, ok ? "ok    " : "FAILED", refNs, refCycles, newNs, newCycles, refNs / newNs, fixedCycles);
+	if (!ok) {
+		sFailures++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	gConfigObject = new ConfigurationTable();
+
+	printf("per radio frame, all TrChs, from slots to decoder input\n");
+	for (unsigned i = 0; i < sizeof(sConfigs) / sizeof(sConfigs[0]); i++) {
+		run(sConfigs[i]);
+	}
+
+	printf("%s\n", sFailures ? "FAILED" : "PASSED");
+	return sFailures ? 1 : 0;
+}
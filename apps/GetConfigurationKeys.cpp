@@ -202,6 +202,20 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("Control.LUR.Workers", "4", "threads", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "1:64", true,
+		"Number of threads running Location Updating procedures.  "
+		"Each thread runs many procedures at once, so this need not grow with the number of handsets.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("Control.LUR.WelcomeThreads", "8", "threads", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "1:64", true,
+		"Number of threads sending welcome messages after Location Updating.  "
+		"Each sends one message at a time and can wait many seconds for the handset to acknowledge it.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("Control.LUR.UnprovisionedRejectCause", "0x04", "", ConfigurationKey::CUSTOMERWARN,
 		ConfigurationKey::CHOICE,
 		"0x02|IMSI unknown in HLR,"
@@ -234,6 +248,20 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("Control.Reporting.StatsFile", "/var/run/OpenBTS-UMTS-Stats.json", "",
+		ConfigurationKey::CUSTOMERWARN, ConfigurationKey::FILEPATH_OPT, "", false,
+		"File path for the periodic performance counter snapshot, in JSON.  "
+		"The file is replaced every Control.Reporting.StatsPeriod seconds.  "
+		"Leave empty to disable.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("Control.Reporting.StatsPeriod", "60", "seconds", ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE, "0:3600", false,
+		"Seconds between performance counter snapshots written to Control.Reporting.StatsFile.  0 disables them.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("Control.Reporting.TMSITable", "/var/run/OpenBTS-UMTS-TMSITable.db", "",
 		ConfigurationKey::CUSTOMERWARN, ConfigurationKey::FILEPATH, "", true,
 		"File path for TMSITable database.");
@@ -705,6 +733,20 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("SIP.RTP.Workers", "2", "threads", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "1:16", true,
+		"Number of threads that send and receive the RTP of all calls.  "
+		"Each thread serves hundreds of calls.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("SIP.RTP.SessionsPerWorker", "256", "calls", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "16:4096", true,
+		"Most calls each RTP thread serves.  "
+		"Frames for this many calls on every thread are allocated at start, about 7 KB a call.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("SIP.RegistrationPeriod", "90", "minutes", ConfigurationKey::DEVELOPER,
 		ConfigurationKey::VALRANGE,
 		"6:2298", // educated guess
@@ -762,6 +804,20 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("SIP.Workers", "4", "threads", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "1:64", true,
+		"Number of threads that parse and dispatch incoming SIP messages.  "
+		"The messages of one call always go to the same thread, in order.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("SIP.Workers.QueueLimit", "1000", "messages", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "10:100000", true,
+		"Incoming SIP messages each SIP worker thread can have waiting.  "
+		"Beyond this they are dropped, as a full socket would drop them, and the sender retransmits.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("SMS.FakeSrcSMSC", "0000", "", ConfigurationKey::CUSTOMERWARN,
 		ConfigurationKey::STRING, "^[0-9]+$", false, "Use this to fill in L4 SMSC address in SMS delivery.");
 	map[tmp->getName()] = *tmp;
@@ -810,6 +866,15 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("TRX.Latency.UnderrunTarget", "100", "underruns per million slots",
+		ConfigurationKey::DEVELOPER, ConfigurationKey::VALRANGE, "1:100000", false,
+		"Transmit underruns the transceiver aims for.  "
+		"The transceiver sets its transmit latency so that about this many slots in a million miss the radio.  "
+		"Lower costs latency on every slot; higher costs more lost slots.  "
+		"Can be changed on a running transceiver with the SETLATENCYTARGET control command.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("TRX.Port", "5700", "", ConfigurationKey::FACTORY, ConfigurationKey::PORT, "", true,
 		"IP port of the transceiver application.");
 	map[tmp->getName()] = *tmp;
@@ -885,6 +950,13 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("UMTS.Debug.ASN.Capture", "0", "", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::BOOLEAN, "", false,
+		"Keep the raw encoding of recent RRC messages in memory for the asncapture command.  "
+		"Much cheaper than UMTS.Debug.Messages.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("UMTS.Debug.ASN.Free", "0", "", ConfigurationKey::DEVELOPER,
 		ConfigurationKey::BOOLEAN, "", false, "Have no idea.");
 	map[tmp->getName()] = *tmp;
@@ -975,6 +1047,13 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("UMTS.Paging.Share", "100", "percent", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "10:100", false,
+		"Percent of the PCH radio frames that paging messages may use, one message of up to 8 mobile IDs to a frame.  "
+		"A burst of pages beyond that waits for later frames.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	// FROM SOURCE: TODO UMTS -- what does this mean?
 	tmp = new ConfigurationKey("UMTS.PRACH.DynamicPersistenceLevel", "1", "??", ConfigurationKey::FACTORY,
 		ConfigurationKey::VALRANGE,
@@ -1101,6 +1180,15 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("UMTS.Radio.RakeFingers", "4", "fingers", ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE, "0:8", false,
+		"Maximum number of RAKE fingers combined for each uplink DCH.  "
+		"Fingers are placed on the strongest paths found within UMTS.Radio.MaxExpectedDelaySpread.  "
+		"0 selects the original receiver, which tracks only the strongest path.  "
+		"Takes effect for newly allocated DCHs.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("UMTS.Radio.RxGain", "57", "dB", ConfigurationKey::FACTORY,
 		ConfigurationKey::VALRANGE,
 		"0:75", // educated guess
@@ -1172,6 +1260,25 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("UMTS.Uplink.FixedPointDecoding", "0", "", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::BOOLEAN, "", false,
+		"Carry uplink soft bits for convolutionally coded transport channels as 8 bit fixed point from the "
+		"demodulator output to the Viterbi decoder, instead of as floats.  "
+		"Turbo coded channels always use floats.  "
+		"Moving each radio frame into the decoder takes about twice as long in fixed point, which the faster "
+		"decoder more than makes up for, but floats remain the default.  "
+		"Takes effect for newly allocated DCHs.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("UMTS.Uplink.SoftBitScale", "1.0", "", ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE, "0.25:4.0", false,
+		"Scaling of uplink soft bits into fixed point when UMTS.Uplink.FixedPointDecoding is enabled.  "
+		"At 1.0 a noiseless bit is a quarter of full scale.  "
+		"Raise it if soft bits use too little of the range, lower it if they saturate.");
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	// FROM SOURCE: Uplink puncturing limit expressed as percent in the range 40 to 100.
 	// 		From sql "UMTS.Uplink.Puncturing.Limit"; default 100 (no puncturing); bounded if out of range.
 	tmp = new ConfigurationKey("UMTS.Uplink.Puncturing.Limit", "100", "percent", ConfigurationKey::FACTORY,
@@ -30,6 +30,7 @@
 #include <CLI/CLI.h>
 #include <CommonLibs/Configuration.h>
 #include <CommonLibs/Logger.h>
+#include <CommonLibs/Stats.h>
 #include <Control/ControlCommon.h>
 #include <Control/TransactionTable.h>
 #include <NodeManager/NodeManager.h>
@@ -172,6 +173,7 @@ int main(int argc, char *argv[])
 
 		// verify(argv[0]);
 		gParser.addCommands();
+		statsStartSnapshots();
 
 		COUT("\nStarting the system...");
 